@@ -0,0 +1,229 @@
+/*
+ * PROJECT:     ReactOS Disk Statistics Utility
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Displays the latency histograms collected by the disk class driver
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <windef.h>
+#include <winbase.h>
+#include <winioctl.h>
+
+#include <conutils.h>
+#include <diskstat.h>
+
+#include "resource.h"
+
+static
+HANDLE
+OpenDisk(
+    _In_ ULONG DiskNumber)
+{
+    WCHAR Path[MAX_PATH];
+
+    swprintf(Path, L"\\\\.\\PhysicalDrive%lu", DiskNumber);
+    return CreateFileW(Path,
+                       0,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       NULL,
+                       OPEN_EXISTING,
+                       0,
+                       NULL);
+}
+
+static
+VOID
+PrintHistogram(
+    _In_ UINT NameId,
+    _In_ PDISK_LATENCY_HISTOGRAM Histogram)
+{
+    WCHAR Name[32];
+    ULONG i;
+
+    if (Histogram->Count == 0)
+        return;
+
+    K32LoadStringW(GetModuleHandleW(NULL), NameId, Name, ARRAYSIZE(Name));
+    ConResPrintf(StdOut, IDS_OPERATION,
+                 Name,
+                 Histogram->Count,
+                 Histogram->TotalTime / Histogram->Count / 10,
+                 Histogram->MaximumTime / 10);
+
+    for (i = 0; i < DISK_LATENCY_BUCKETS; i++)
+    {
+        if (Histogram->Buckets[i] == 0)
+            continue;
+
+        if (i == DISK_LATENCY_BUCKETS - 1)
+        {
+            ConPrintf(StdOut, L"    >= %8lu us: %lu\n",
+                      1UL << (i + DISK_LATENCY_BUCKET_SHIFT - 1),
+                      Histogram->Buckets[i]);
+        }
+        else
+        {
+            ConPrintf(StdOut, L"    <  %8lu us: %lu\n",
+                      1UL << (i + DISK_LATENCY_BUCKET_SHIFT),
+                      Histogram->Buckets[i]);
+        }
+    }
+}
+
+static
+BOOL
+PrintDisk(
+    _In_ HANDLE hDisk,
+    _In_ ULONG DiskNumber)
+{
+    DISK_PERFORMANCE_EX Performance;
+    PDISK_LATENCY_INFORMATION Latency = &Performance.Latency;
+    DWORD BytesReturned;
+    ULONG i;
+
+    ZeroMemory(&Performance, sizeof(Performance));
+    if (!DeviceIoControl(hDisk,
+                         IOCTL_DISK_PERFORMANCE,
+                         NULL,
+                         0,
+                         &Performance,
+                         sizeof(Performance),
+                         &BytesReturned,
+                         NULL))
+    {
+        ConResPrintf(StdErr, IDS_ERROR_QUERY, DiskNumber, GetLastError());
+        return FALSE;
+    }
+
+    ConResPrintf(StdOut, IDS_DISK, DiskNumber);
+    ConResPrintf(StdOut, IDS_TOTALS,
+                 Performance.Performance.ReadCount,
+                 Performance.Performance.BytesRead.QuadPart,
+                 Performance.Performance.WriteCount,
+                 Performance.Performance.BytesWritten.QuadPart,
+                 Performance.Performance.SplitCount,
+                 Performance.Performance.IdleTime.QuadPart / 10000);
+
+    /* Other disk drivers may only know about DISK_PERFORMANCE */
+    if (BytesReturned < sizeof(Performance) ||
+        Latency->Version != DISK_LATENCY_INFORMATION_VERSION)
+    {
+        ConResPuts(StdOut, IDS_NO_LATENCY);
+        return TRUE;
+    }
+
+    PrintHistogram(IDS_READ, &Latency->Operations[DiskLatencyRead]);
+    PrintHistogram(IDS_WRITE, &Latency->Operations[DiskLatencyWrite]);
+    PrintHistogram(IDS_FLUSH, &Latency->Operations[DiskLatencyFlush]);
+
+    ConResPrintf(StdOut, IDS_QUEUE_DEPTH,
+                 Performance.Performance.QueueDepth,
+                 Latency->MaximumQueueDepth);
+    for (i = 0; i < DISK_QUEUE_DEPTH_BUCKETS; i++)
+    {
+        if (Latency->QueueDepth[i] == 0)
+            continue;
+
+        ConPrintf(StdOut, L"    %5lu - %5lu: %lu\n",
+                  1UL << i,
+                  (1UL << (i + 1)) - 1,
+                  Latency->QueueDepth[i]);
+    }
+
+    return TRUE;
+}
+
+static
+BOOL
+ResetDisk(
+    _In_ HANDLE hDisk,
+    _In_ ULONG DiskNumber)
+{
+    DISK_PERFORMANCE Performance;
+    DWORD BytesReturned;
+
+    /* Turning the counters off clears them, querying turns them back on */
+    if (!DeviceIoControl(hDisk,
+                         IOCTL_DISK_PERFORMANCE_OFF,
+                         NULL,
+                         0,
+                         NULL,
+                         0,
+                         &BytesReturned,
+                         NULL) ||
+        !DeviceIoControl(hDisk,
+                         IOCTL_DISK_PERFORMANCE,
+                         NULL,
+                         0,
+                         &Performance,
+                         sizeof(Performance),
+                         &BytesReturned,
+                         NULL))
+    {
+        ConResPrintf(StdErr, IDS_ERROR_RESET, DiskNumber, GetLastError());
+        return FALSE;
+    }
+
+    ConResPrintf(StdOut, IDS_RESET, DiskNumber);
+    return TRUE;
+}
+
+int wmain(int argc, WCHAR* argv[])
+{
+    BOOL bReset = FALSE;
+    BOOL bSuccess = TRUE;
+    HANDLE hDisk;
+    ULONG DiskNumber;
+
+    /* Initialize the Console Standard Streams */
+    ConInitStdStreams();
+
+    if (argc > 2)
+    {
+        ConResPuts(StdOut, IDS_USAGE);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2)
+    {
+        if (wcscmp(argv[1], L"/?") == 0)
+        {
+            ConResPuts(StdOut, IDS_USAGE);
+            return EXIT_SUCCESS;
+        }
+        else if (_wcsicmp(argv[1], L"/reset") == 0)
+        {
+            bReset = TRUE;
+        }
+        else
+        {
+            ConResPrintf(StdErr, IDS_ERROR_INVALID_SWITCH, argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (DiskNumber = 0; ; DiskNumber++)
+    {
+        hDisk = OpenDisk(DiskNumber);
+        if (hDisk == INVALID_HANDLE_VALUE)
+            break;
+
+        if (bReset)
+            bSuccess &= ResetDisk(hDisk, DiskNumber);
+        else
+            bSuccess &= PrintDisk(hDisk, DiskNumber);
+
+        CloseHandle(hDisk);
+    }
+
+    if (DiskNumber == 0)
+    {
+        ConResPuts(StdErr, IDS_ERROR_NO_DISKS);
+        return EXIT_FAILURE;
+    }
+
+    return bSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
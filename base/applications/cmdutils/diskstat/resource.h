@@ -0,0 +1,16 @@
+#pragma once
+
+#define IDS_USAGE                   0
+#define IDS_ERROR_INVALID_SWITCH    1
+#define IDS_ERROR_NO_DISKS          2
+#define IDS_ERROR_QUERY             3
+#define IDS_ERROR_RESET             4
+#define IDS_DISK                    5
+#define IDS_TOTALS                  6
+#define IDS_NO_LATENCY              7
+#define IDS_OPERATION               8
+#define IDS_QUEUE_DEPTH             9
+#define IDS_RESET                   10
+#define IDS_READ                    11
+#define IDS_WRITE                   12
+#define IDS_FLUSH                   13
@@ -369,6 +369,7 @@
 @ stdcall NtMakePermanentObject(ptr)
 @ stdcall NtMakeTemporaryObject(long)
 @ stdcall -stub -version=0x600+ NtMapCMFModule(long long ptr ptr ptr ptr)
+@ stdcall NtMapPortRing(ptr long ptr)
 @ stdcall NtMapUserPhysicalPages(ptr ptr ptr)
 @ stdcall NtMapUserPhysicalPagesScatter(ptr ptr ptr)
 @ stdcall NtMapViewOfSection(long long ptr long long ptr ptr long long long)
@@ -560,6 +561,7 @@
 @ stdcall NtShutdownSystem(long)
 @ stdcall -stub -version=0x600+ NtShutdownWorkerFactory(ptr ptr)
 @ stdcall NtSignalAndWaitForSingleObject(long long long ptr)
+@ stdcall NtSignalWaitPortRing(ptr long ptr)
 @ stdcall -stub -version=0x600+ NtSinglePhaseReject(ptr ptr)
 @ stdcall NtStartProfile(ptr)
 @ stdcall NtStopProfile(ptr)
@@ -1531,6 +1533,7 @@
 @ stdcall ZwMakePermanentObject(ptr)
 @ stdcall ZwMakeTemporaryObject(long)
 @ stdcall -stub -version=0x600+ ZwMapCMFModule(long long ptr ptr ptr)
+@ stdcall ZwMapPortRing(ptr long ptr)
 @ stdcall ZwMapUserPhysicalPages(ptr ptr ptr)
 @ stdcall ZwMapUserPhysicalPagesScatter(ptr ptr ptr)
 @ stdcall ZwMapViewOfSection(long long ptr long long ptr ptr long long long)
@@ -1722,6 +1725,7 @@
 @ stdcall ZwShutdownSystem(long)
 @ stdcall -stub -version=0x600+ ZwShutdownWorkerFactory(ptr ptr)
 @ stdcall ZwSignalAndWaitForSingleObject(long long long ptr)
+@ stdcall ZwSignalWaitPortRing(ptr long ptr)
 @ stdcall -stub -version=0x600+ ZwSinglePhaseReject(ptr ptr)
 @ stdcall ZwStartProfile(ptr)
 @ stdcall ZwStopProfile(ptr)
@@ -2490,6 +2490,8 @@ WSPIoctl(IN  SOCKET Handle,
                 GUID ConnectExGUID = WSAID_CONNECTEX;
                 GUID DisconnectExGUID = WSAID_DISCONNECTEX;
                 GUID GetAcceptExSockaddrsGUID = WSAID_GETACCEPTEXSOCKADDRS;
+                GUID PollSetCreateGUID = WSAID_POLLSETCREATE;
+                GUID PollSetControlGUID = WSAID_POLLSETCONTROL;
 
                 if (IsEqualGUID(&AcceptExGUID, lpvInBuffer))
                 {
@@ -2524,6 +2526,20 @@ WSPIoctl(IN  SOCKET Handle,
                     ERR("SIO_GET_EXTENSION_FUNCTION_POINTER UNIMPLEMENTED\n");
                     Ret = SOCKET_ERROR;
                 }
+                else if (IsEqualGUID(&PollSetCreateGUID, lpvInBuffer))
+                {
+                    *((PVOID *)lpvOutBuffer) = WSPPollSetCreate;
+                    cbRet = sizeof(PVOID);
+                    Errno = NO_ERROR;
+                    Ret = NO_ERROR;
+                }
+                else if (IsEqualGUID(&PollSetControlGUID, lpvInBuffer))
+                {
+                    *((PVOID *)lpvOutBuffer) = WSPPollSetControl;
+                    cbRet = sizeof(PVOID);
+                    Errno = NO_ERROR;
+                    Ret = NO_ERROR;
+                }
                 else
                 {
                     ERR("Querying unknown extension function: %x\n", ((GUID*)lpvInBuffer)->Data1);
@@ -243,4 +243,133 @@ WSPEnumNetworkEvents(
     return MsafdReturnWithErrno(STATUS_SUCCESS, lpErrno, 0, NULL);
 }
 
+HANDLE
+WSPAPI
+WSPPollSetCreate(
+    IN HANDLE CompletionPort,
+    IN ULONG_PTR CompletionKey)
+{
+    UNICODE_STRING              AfdPollSet;
+    OBJECT_ATTRIBUTES           ObjectAttributes;
+    IO_STATUS_BLOCK             IOSB;
+    FILE_COMPLETION_INFORMATION CompletionInfo;
+    HANDLE                      PollSet;
+    NTSTATUS                    Status;
+
+    TRACE("Called (CompletionPort %p Key %p)\n", CompletionPort, CompletionKey);
+
+    /* A poll set is a plain AFD handle without an endpoint behind it */
+    RtlInitUnicodeString(&AfdPollSet, L"\\Device\\Afd\\PollSet");
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &AfdPollSet,
+                               OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+
+    Status = NtCreateFile(&PollSet,
+                          GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IOSB,
+                          NULL,
+                          0,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN_IF,
+                          0,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status))
+    {
+        ERR("Could not open a poll set 0x%08x\n", Status);
+        SetLastError(TranslateNtStatusError(Status));
+        return NULL;
+    }
+
+    /* Every ready socket is posted to this port */
+    CompletionInfo.Port = CompletionPort;
+    CompletionInfo.Key = (PVOID)CompletionKey;
+    Status = NtSetInformationFile(PollSet,
+                                  &IOSB,
+                                  &CompletionInfo,
+                                  sizeof(CompletionInfo),
+                                  FileCompletionInformation);
+    if (!NT_SUCCESS(Status))
+    {
+        ERR("Could not bind the poll set 0x%08x\n", Status);
+        NtClose(PollSet);
+        SetLastError(TranslateNtStatusError(Status));
+        return NULL;
+    }
+
+    return PollSet;
+}
+
+INT
+WSPAPI
+WSPPollSetControl(
+    IN HANDLE PollSet,
+    IN SOCKET Handle,
+    IN LONG lNetworkEvents,
+    IN PVOID Context)
+{
+    AFD_POLL_SET_INFO PollSetInfo;
+    IO_STATUS_BLOCK   IOSB;
+    NTSTATUS          Status;
+
+    TRACE("Called (PollSet %p Socket %lx Events %lx)\n", PollSet, Handle, lNetworkEvents);
+
+    PollSetInfo.Handle = (HANDLE)Handle;
+    PollSetInfo.Context = Context;
+    PollSetInfo.Events = 0;
+
+    if (lNetworkEvents & FD_READ) {
+        PollSetInfo.Events |= AFD_EVENT_RECEIVE;
+    }
+
+    if (lNetworkEvents & FD_WRITE) {
+        PollSetInfo.Events |= AFD_EVENT_SEND;
+    }
+
+    if (lNetworkEvents & FD_OOB) {
+        PollSetInfo.Events |= AFD_EVENT_OOB_RECEIVE;
+    }
+
+    if (lNetworkEvents & FD_ACCEPT) {
+        PollSetInfo.Events |= AFD_EVENT_ACCEPT;
+    }
+
+    if (lNetworkEvents & FD_CONNECT) {
+        PollSetInfo.Events |= AFD_EVENT_CONNECT | AFD_EVENT_CONNECT_FAIL;
+    }
+
+    if (lNetworkEvents & FD_CLOSE) {
+        PollSetInfo.Events |= AFD_EVENT_DISCONNECT | AFD_EVENT_ABORT | AFD_EVENT_CLOSE;
+    }
+
+    /* No APC context, so that the request itself is not posted to the port */
+    Status = NtDeviceIoControlFile(PollSet,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   &IOSB,
+                                   IOCTL_AFD_POLL_SET_CONTROL,
+                                   &PollSetInfo,
+                                   sizeof(PollSetInfo),
+                                   NULL,
+                                   0);
+
+    if (Status == STATUS_PENDING) {
+        NtWaitForSingleObject(PollSet, FALSE, NULL);
+        Status = IOSB.Status;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        ERR("Status 0x%08x\n", Status);
+        SetLastError(TranslateNtStatusError(Status));
+        return SOCKET_ERROR;
+    }
+
+    return 0;
+}
+
 /* EOF */
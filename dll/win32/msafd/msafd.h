@@ -28,6 +28,7 @@
 #include <tdi.h>
 #include <afd/shared.h>
 #include <mswsock.h>
+#include <winsock/mswinsock.h>
 
 #include <wine/debug.h>
 WINE_DEFAULT_DEBUG_CHANNEL(msafd);
@@ -469,6 +470,20 @@ WSPGetAcceptExSockaddrs(
     OUT struct sockaddr **RemoteSockaddr,
     OUT LPINT RemoteSockaddrLength);
 
+HANDLE
+WSPAPI
+WSPPollSetCreate(
+    IN HANDLE CompletionPort,
+    IN ULONG_PTR CompletionKey);
+
+INT
+WSPAPI
+WSPPollSetControl(
+    IN HANDLE PollSet,
+    IN SOCKET Handle,
+    IN LONG lNetworkEvents,
+    IN PVOID Context);
+
 PSOCKET_INFORMATION GetSocketStructure(
 	SOCKET Handle
 );
@@ -43,12 +43,22 @@ NTSTATUS WarmSocketForBind( PAFD_FCB FCB, ULONG ShareType ) {
 
         if (NT_SUCCESS(Status) && !FCB->Recv.Window)
         {
-            FCB->Recv.Window = ExAllocatePoolWithTag(PagedPool,
-                                                     FCB->Recv.Size,
-                                                     TAG_AFD_DATA_BUFFER);
-
-            if (!FCB->Recv.Window)
-                Status = STATUS_NO_MEMORY;
+            if (AfdChargeWindow(FCB->Recv.Size))
+            {
+                FCB->Recv.Window = ExAllocatePoolWithTag(PagedPool,
+                                                         FCB->Recv.Size,
+                                                         TAG_AFD_DATA_BUFFER);
+
+                if (!FCB->Recv.Window)
+                {
+                    AfdReturnWindowCharge(FCB->Recv.Size);
+                    Status = STATUS_NO_MEMORY;
+                }
+            }
+            else
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
         }
 
         if (NT_SUCCESS(Status) && FCB->Recv.Content < FCB->Recv.Size)
@@ -281,20 +281,34 @@ MakeSocketIntoConnection(PAFD_FCB FCB) {
     /* Allocate the receive area and start receiving */
     if (!FCB->Recv.Window)
     {
+        if (!AfdChargeWindow(FCB->Recv.Size))
+            return STATUS_INSUFFICIENT_RESOURCES;
+
         FCB->Recv.Window = ExAllocatePoolWithTag(PagedPool,
                                                  FCB->Recv.Size,
                                                  TAG_AFD_DATA_BUFFER);
 
-        if( !FCB->Recv.Window ) return STATUS_NO_MEMORY;
+        if( !FCB->Recv.Window )
+        {
+            AfdReturnWindowCharge(FCB->Recv.Size);
+            return STATUS_NO_MEMORY;
+        }
     }
 
     if (!FCB->Send.Window)
     {
+        if (!AfdChargeWindow(FCB->Send.Size))
+            return STATUS_INSUFFICIENT_RESOURCES;
+
         FCB->Send.Window = ExAllocatePoolWithTag(PagedPool,
                                                  FCB->Send.Size,
                                                  TAG_AFD_DATA_BUFFER);
 
-        if( !FCB->Send.Window ) return STATUS_NO_MEMORY;
+        if( !FCB->Send.Window )
+        {
+            AfdReturnWindowCharge(FCB->Send.Size);
+            return STATUS_NO_MEMORY;
+        }
     }
 
     FCB->State = SOCKET_STATE_CONNECTED;
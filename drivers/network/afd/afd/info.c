@@ -10,6 +10,33 @@
 
 #include "afd.h"
 
+/* Bytes of socket buffers above AFD_UNCHARGED_WINDOW_SIZE, over all sockets */
+static LONG AfdWindowCharge = 0;
+
+BOOLEAN
+AfdChargeWindow( ULONG Size ) {
+    LONG Charge;
+
+    if (Size <= AFD_UNCHARGED_WINDOW_SIZE)
+        return TRUE;
+
+    Charge = (LONG)(Size - AFD_UNCHARGED_WINDOW_SIZE);
+    if (InterlockedExchangeAdd(&AfdWindowCharge, Charge) + Charge > AFD_MAX_WINDOW_CHARGE)
+    {
+        InterlockedExchangeAdd(&AfdWindowCharge, -Charge);
+        AFD_DbgPrint(MIN_TRACE,("No budget left for a %u byte buffer\n", Size));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+AfdReturnWindowCharge( ULONG Size ) {
+    if (Size > AFD_UNCHARGED_WINDOW_SIZE)
+        InterlockedExchangeAdd(&AfdWindowCharge, -(LONG)(Size - AFD_UNCHARGED_WINDOW_SIZE));
+}
+
 NTSTATUS NTAPI
 AfdGetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
             PIO_STACK_LOCATION IrpSp ) {
@@ -128,9 +155,15 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                     FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS)
                 {
                     /* FIXME: likely not right, check tcpip.sys for TDI_QUERY_MAX_DATAGRAM_INFO */
-                    if (InfoReq->Information.Ulong > 0 && InfoReq->Information.Ulong < 0xFFFF &&
+                    if (InfoReq->Information.Ulong > 0 && InfoReq->Information.Ulong <= AFD_MAX_WINDOW_SIZE &&
                         InfoReq->Information.Ulong != FCB->Recv.Size)
                     {
+                        if (!AfdChargeWindow(InfoReq->Information.Ulong))
+                        {
+                            Status = STATUS_INSUFFICIENT_RESOURCES;
+                            break;
+                        }
+
                         NewBuffer = ExAllocatePoolWithTag(PagedPool,
                                                           InfoReq->Information.Ulong,
                                                           TAG_AFD_DATA_BUFFER);
@@ -147,6 +180,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                                               FCB->Recv.Content);
 
                                 ExFreePoolWithTag(FCB->Recv.Window, TAG_AFD_DATA_BUFFER);
+                                AfdReturnWindowCharge(FCB->Recv.Size);
                             }
 
                             FCB->Recv.Size = InfoReq->Information.Ulong;
@@ -156,6 +190,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                         }
                         else
                         {
+                            AfdReturnWindowCharge(InfoReq->Information.Ulong);
                             Status = STATUS_NO_MEMORY;
                         }
                     }
@@ -173,9 +208,15 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                 if (FCB->State == SOCKET_STATE_CONNECTED ||
                     FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS)
                 {
-                    if (InfoReq->Information.Ulong > 0 && InfoReq->Information.Ulong < 0xFFFF &&
+                    if (InfoReq->Information.Ulong > 0 && InfoReq->Information.Ulong <= AFD_MAX_WINDOW_SIZE &&
                         InfoReq->Information.Ulong != FCB->Send.Size)
                     {
+                        if (!AfdChargeWindow(InfoReq->Information.Ulong))
+                        {
+                            Status = STATUS_INSUFFICIENT_RESOURCES;
+                            break;
+                        }
+
                         NewBuffer = ExAllocatePoolWithTag(PagedPool,
                                                           InfoReq->Information.Ulong,
                                                           TAG_AFD_DATA_BUFFER);
@@ -192,6 +233,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                                               FCB->Send.BytesUsed);
 
                                 ExFreePoolWithTag(FCB->Send.Window, TAG_AFD_DATA_BUFFER);
+                                AfdReturnWindowCharge(FCB->Send.Size);
                             }
 
                             FCB->Send.Size = InfoReq->Information.Ulong;
@@ -201,6 +243,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
                         }
                         else
                         {
+                            AfdReturnWindowCharge(InfoReq->Information.Ulong);
                             Status = STATUS_NO_MEMORY;
                         }
                     }
@@ -367,6 +367,8 @@ AfdCreateSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
     InitializeListHead( &FCB->DatagramList );
     InitializeListHead( &FCB->PendingConnections );
+    InitializeListHead( &FCB->PollSetEntries );
+    InitializeListHead( &FCB->PollSetMembers );
 
     AFD_DbgPrint(MID_TRACE,("%p: Checking command channel\n", FCB));
 
@@ -452,6 +454,7 @@ AfdCleanupSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
+    KillPollSetEntries( FCB->DeviceExt, FileObject );
 
     return UnlockAndMaybeComplete(FCB, STATUS_SUCCESS, Irp, 0);
 }
@@ -491,6 +494,7 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
+    KillPollSetEntries( FCB->DeviceExt, FileObject );
 
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_CONNECT]));
     ASSERT(IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]));
@@ -520,10 +524,16 @@ AfdCloseSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         ExFreePoolWithTag(FCB->Context, TAG_AFD_SOCKET_CONTEXT);
 
     if (FCB->Recv.Window)
+    {
         ExFreePoolWithTag(FCB->Recv.Window, TAG_AFD_DATA_BUFFER);
+        AfdReturnWindowCharge(FCB->Recv.Size);
+    }
 
     if (FCB->Send.Window)
+    {
         ExFreePoolWithTag(FCB->Send.Window, TAG_AFD_DATA_BUFFER);
+        AfdReturnWindowCharge(FCB->Send.Size);
+    }
 
     if (FCB->AddressFrom)
         ExFreePoolWithTag(FCB->AddressFrom, TAG_AFD_TDI_CONNECTION_INFORMATION);
@@ -968,6 +978,9 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_ENUM_NETWORK_EVENTS:
             return AfdEnumEvents( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_POLL_SET_CONTROL:
+            return AfdPollSetControl( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_RECV_DATAGRAM:
             return AfdPacketSocketReadData( DeviceObject, Irp, IrpSp );
 
@@ -1274,6 +1287,17 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             return;
     }
 
+    /* The transport is using this request's buffer, so it is completed
+     * from our completion routine once the transport lets go of it */
+    if ((Function == FUNCTION_RECV && Irp == FCB->ReceiveIrp.UserIrp) ||
+        (Function == FUNCTION_SEND && Irp == FCB->SendIrp.UserIrp))
+    {
+        IoCancelIrp(Function == FUNCTION_RECV ? FCB->ReceiveIrp.InFlightRequest :
+                                                FCB->SendIrp.InFlightRequest);
+        SocketStateUnlock(FCB);
+        return;
+    }
+
     CurrentEntry = FCB->PendingIrpList[Function].Flink;
     while (CurrentEntry != &FCB->PendingIrpList[Function])
     {
@@ -10,6 +10,57 @@
 
 #include "afd.h"
 
+static BOOLEAN ReceiveDirect( PAFD_FCB FCB )
+{
+    PIRP NextIrp;
+    PAFD_RECV_INFO RecvReq;
+    PAFD_MAPBUF Map;
+    NTSTATUS Status;
+
+    /* Data must not overtake what is already buffered */
+    if (FCB->Recv.Content != FCB->Recv.BytesUsed ||
+        IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV]))
+        return FALSE;
+
+    NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                IRP, Tail.Overlay.ListEntry);
+    RecvReq = GetLockedData(NextIrp, IoGetCurrentIrpStackLocation(NextIrp));
+    Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+
+    if (RecvReq->BufferCount != 1 || !Map[0].Mdl ||
+        (RecvReq->TdiFlags & TDI_RECEIVE_PEEK) ||
+        RecvReq->BufferArray[0].len < AFD_DIRECT_IO_THRESHOLD)
+        return FALSE;
+
+    /* Non-blocking requests never wait for the transport */
+    if (!(RecvReq->AfdFlags & AFD_OVERLAPPED) &&
+        ((RecvReq->AfdFlags & AFD_IMMEDIATE) || FCB->NonBlocking))
+        return FALSE;
+
+    AFD_DbgPrint(MID_TRACE,("Receiving into %p directly\n", NextIrp));
+
+    /* The transport may complete this before TdiReceiveMdl returns */
+    RemoveEntryList(&NextIrp->Tail.Overlay.ListEntry);
+    FCB->ReceiveIrp.UserIrp = NextIrp;
+
+    Status = TdiReceiveMdl( &FCB->ReceiveIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            TDI_RECEIVE_NORMAL,
+                            Map[0].Mdl,
+                            RecvReq->BufferArray[0].len,
+                            ReceiveComplete,
+                            FCB );
+    if (Status != STATUS_PENDING)
+    {
+        FCB->ReceiveIrp.UserIrp = NULL;
+        InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                       &NextIrp->Tail.Overlay.ListEntry);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static VOID RefillSocketBuffer( PAFD_FCB FCB )
 {
     /* Make sure nothing's in flight first */
@@ -18,6 +69,9 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
+    /* A waiting receive can take the data without it passing through our buffer */
+    if (ReceiveDirect(FCB)) return;
+
     /* Check if the buffer is full */
     if (FCB->Recv.Content == FCB->Recv.Size)
     {
@@ -85,6 +139,47 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
     }
 }
 
+static VOID HandleDirectReceiveComplete( PAFD_FCB FCB, PIRP UserIrp,
+                                         NTSTATUS Status, ULONG_PTR Information )
+{
+    PAFD_RECV_INFO RecvReq = GetLockedData(UserIrp, IoGetCurrentIrpStackLocation(UserIrp));
+
+    if (Status == STATUS_SUCCESS)
+    {
+        /* Check for graceful closure */
+        if (Information == 0)
+        {
+            FCB->LastReceiveStatus = Status;
+            FCB->TdiReceiveClosed = TRUE;
+        }
+    }
+    else if (FCB->TdiReceiveClosed)
+    {
+        /* Cancelled by a receive shutdown */
+        Status = FCB->LastReceiveStatus;
+    }
+    else if (Status != STATUS_CANCELLED)
+    {
+        /* Unexpected closure */
+        FCB->LastReceiveStatus = Status;
+        FCB->TdiReceiveClosed = TRUE;
+    }
+    /* Otherwise only this request was cancelled, the connection is fine */
+
+    AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%u)\n", UserIrp,
+                            (UINT)Information));
+
+    UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+    UserIrp->IoStatus.Status = Status;
+    UserIrp->IoStatus.Information = Information;
+    if( UserIrp->MdlAddress ) UnlockRequest( UserIrp, IoGetCurrentIrpStackLocation( UserIrp ) );
+    (void)IoSetCancelRoutine(UserIrp, NULL);
+    IoCompleteRequest( UserIrp, IO_NETWORK_INCREMENT );
+
+    /* Move on to the next waiting receive, or keep our buffer stocked */
+    RefillSocketBuffer(FCB);
+}
+
 static BOOLEAN CantReadMore( PAFD_FCB FCB ) {
     UINT BytesAvailable = FCB->Recv.Content - FCB->Recv.BytesUsed;
 
@@ -268,18 +363,29 @@ NTSTATUS NTAPI ReceiveComplete
     PIRP NextIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
+    PIRP UserIrp;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
     AFD_DbgPrint(MID_TRACE,("Called\n"));
 
+    /* Must be gone before the I/O manager unlocks the MDLs */
+    TdiFreePartialMdl(Irp);
+
     if( !SocketAcquireStateLock( FCB ) )
         return STATUS_FILE_CLOSED;
 
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    UserIrp = FCB->ReceiveIrp.UserIrp;
+    FCB->ReceiveIrp.UserIrp = NULL;
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
+        if (UserIrp)
+            InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                           &UserIrp->Tail.Overlay.ListEntry);
+
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
             NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_RECV]);
@@ -301,7 +407,10 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if (UserIrp)
+        HandleDirectReceiveComplete( FCB, UserIrp, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    else
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
 
     ReceiveActivity( FCB, NULL );
 
@@ -525,6 +634,10 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         AFD_DbgPrint(MID_TRACE,("Leaving read irp\n"));
         IoMarkIrpPending( Irp );
         (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+
+        /* Hand this buffer to the transport if nothing else is receiving */
+        if( FCB->State == SOCKET_STATE_CONNECTED )
+            RefillSocketBuffer( FCB );
     } else {
         AFD_DbgPrint(MID_TRACE,("Completed with status %x\n", Status));
     }
@@ -381,12 +381,22 @@ AfdEnumEvents( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 /* * * NOTE ALWAYS CALLED AT DISPATCH_LEVEL * * */
 static BOOLEAN UpdatePollWithFCB( PAFD_ACTIVE_POLL Poll, PFILE_OBJECT FileObject ) {
     UINT i;
-    PAFD_FCB FCB;
+    PAFD_FCB FCB = FileObject->FsContext;
     UINT Signalled = 0;
     PAFD_POLL_INFO PollReq = Poll->Irp->AssociatedIrp.SystemBuffer;
 
     ASSERT( KeGetCurrentIrql() == DISPATCH_LEVEL );
 
+    /* Only the socket that changed can wake this poll up, the others
+     * were already looked at when the poll was queued */
+    for( i = 0; i < PollReq->HandleCount; i++ ) {
+        if( (PFILE_OBJECT)AFD_HANDLES(PollReq)[i].Handle == FileObject &&
+            (PollReq->Handles[i].Events & FCB->PollState) )
+            break;
+    }
+
+    if( i == PollReq->HandleCount ) return FALSE;
+
     for( i = 0; i < PollReq->HandleCount; i++ ) {
         if( !AFD_HANDLES(PollReq)[i].Handle ) continue;
 
@@ -404,6 +414,201 @@ static BOOLEAN UpdatePollWithFCB( PAFD_ACTIVE_POLL Poll, PFILE_OBJECT FileObject
     return Signalled ? 1 : 0;
 }
 
+static ULONG PollSetNetworkEvents( ULONG Events ) {
+    ULONG NetworkEvents = 0;
+
+    if( Events & AFD_EVENT_RECEIVE )
+        NetworkEvents |= FD_READ;
+    if( Events & AFD_EVENT_SEND )
+        NetworkEvents |= FD_WRITE;
+    if( Events & AFD_EVENT_OOB_RECEIVE )
+        NetworkEvents |= FD_OOB;
+    if( Events & AFD_EVENT_ACCEPT )
+        NetworkEvents |= FD_ACCEPT;
+    if( Events & (AFD_EVENT_CONNECT | AFD_EVENT_CONNECT_FAIL) )
+        NetworkEvents |= FD_CONNECT;
+    if( Events & (AFD_EVENT_DISCONNECT | AFD_EVENT_ABORT | AFD_EVENT_CLOSE) )
+        NetworkEvents |= FD_CLOSE;
+
+    return NetworkEvents;
+}
+
+/* * * NOTE ALWAYS CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+static VOID SignalPollSetEntry( PAFD_POLL_SET_ENTRY Entry, ULONG PollState ) {
+    PIO_COMPLETION_CONTEXT CompletionContext = Entry->PollSet->CompletionContext;
+    ULONG Triggered = Entry->Events & PollState;
+    NTSTATUS Status;
+
+    if( !Entry->Armed || !Triggered || !CompletionContext ) return;
+
+    AFD_DbgPrint(MID_TRACE,("Posting %x for %p to poll set %p\n",
+                            Triggered, Entry->Socket, Entry->PollSet));
+
+    /* Registrations are one-shot: the application re-arms the socket once
+     * it has dealt with the event, so an idle socket never costs anything */
+    Status = IoSetIoCompletion( CompletionContext->Port,
+                                CompletionContext->Key,
+                                Entry->Context,
+                                STATUS_SUCCESS,
+                                PollSetNetworkEvents( Triggered ),
+                                FALSE );
+    if( NT_SUCCESS(Status) )
+        Entry->Armed = FALSE;
+}
+
+NTSTATUS NTAPI
+AfdPollSetControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                   PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PAFD_POLL_SET_INFO PollSetInfo =
+        (PAFD_POLL_SET_INFO)LockRequest( Irp, IrpSp, FALSE, NULL );
+    PAFD_POLL_SET_ENTRY Entry = NULL, NewEntry = NULL, OldEntry = NULL;
+    PFILE_OBJECT SocketObject;
+    PAFD_FCB SocketFCB;
+    PLIST_ENTRY ListEntry;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        return LostSocket( Irp );
+    }
+
+    if( !PollSetInfo ) {
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Called (Set %p Socket %p Events %x)\n",
+                            FileObject, PollSetInfo->Handle,
+                            PollSetInfo->Events));
+
+    /* Notifications go to the completion port the poll set is bound to */
+    if( !FileObject->CompletionContext ) {
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    Status = ObReferenceObjectByHandle( PollSetInfo->Handle,
+                                        FILE_READ_DATA,
+                                        *IoFileObjectType,
+                                        Irp->RequestorMode,
+                                        (PVOID *)&SocketObject,
+                                        NULL );
+    if( !NT_SUCCESS(Status) ) {
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    if( SocketObject->DeviceObject != DeviceObject ||
+        SocketObject == FileObject ||
+        !SocketObject->FsContext ) {
+        ObDereferenceObject( SocketObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_HANDLE, Irp, 0 );
+    }
+
+    SocketFCB = SocketObject->FsContext;
+
+    if( PollSetInfo->Events ) {
+        NewEntry = ExAllocatePoolWithTag( NonPagedPool,
+                                          sizeof(AFD_POLL_SET_ENTRY),
+                                          TAG_AFD_POLL_SET_ENTRY );
+        if( !NewEntry ) {
+            ObDereferenceObject( SocketObject );
+            return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+        }
+    }
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    for( ListEntry = SocketFCB->PollSetEntries.Flink;
+         ListEntry != &SocketFCB->PollSetEntries;
+         ListEntry = ListEntry->Flink ) {
+        Entry = CONTAINING_RECORD( ListEntry, AFD_POLL_SET_ENTRY, SocketEntry );
+        if( Entry->PollSet == FileObject ) break;
+        Entry = NULL;
+    }
+
+    if( !PollSetInfo->Events ) {
+        /* No events means the socket leaves the set */
+        if( Entry ) {
+            RemoveEntryList( &Entry->SetEntry );
+            RemoveEntryList( &Entry->SocketEntry );
+            OldEntry = Entry;
+        } else {
+            Status = STATUS_NOT_FOUND;
+        }
+    } else {
+        if( !Entry ) {
+            /* The new entry keeps our reference on the socket */
+            Entry = NewEntry;
+            NewEntry = NULL;
+            Entry->PollSet = FileObject;
+            Entry->Socket = SocketObject;
+            SocketObject = NULL;
+            InsertTailList( &FCB->PollSetMembers, &Entry->SetEntry );
+            InsertTailList( &SocketFCB->PollSetEntries, &Entry->SocketEntry );
+        }
+
+        Entry->Events = PollSetInfo->Events;
+        Entry->Context = PollSetInfo->Context;
+        Entry->Armed = TRUE;
+
+        /* The socket may already be ready */
+        SignalPollSetEntry( Entry, SocketFCB->PollState );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    if( OldEntry ) {
+        ObDereferenceObject( OldEntry->Socket );
+        ExFreePoolWithTag( OldEntry, TAG_AFD_POLL_SET_ENTRY );
+    }
+
+    if( NewEntry )
+        ExFreePoolWithTag( NewEntry, TAG_AFD_POLL_SET_ENTRY );
+
+    if( SocketObject )
+        ObDereferenceObject( SocketObject );
+
+    return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+}
+
+/* Drops every registration of FileObject, both as a socket and as a poll set */
+VOID KillPollSetEntries( PAFD_DEVICE_EXTENSION DeviceExt,
+                         PFILE_OBJECT FileObject ) {
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_POLL_SET_ENTRY Entry;
+    LIST_ENTRY DeadEntries;
+    KIRQL OldIrql;
+
+    InitializeListHead( &DeadEntries );
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    while( !IsListEmpty( &FCB->PollSetEntries ) ) {
+        Entry = CONTAINING_RECORD( RemoveHeadList( &FCB->PollSetEntries ),
+                                   AFD_POLL_SET_ENTRY, SocketEntry );
+        RemoveEntryList( &Entry->SetEntry );
+        InsertTailList( &DeadEntries, &Entry->SetEntry );
+    }
+
+    while( !IsListEmpty( &FCB->PollSetMembers ) ) {
+        Entry = CONTAINING_RECORD( RemoveHeadList( &FCB->PollSetMembers ),
+                                   AFD_POLL_SET_ENTRY, SetEntry );
+        RemoveEntryList( &Entry->SocketEntry );
+        InsertTailList( &DeadEntries, &Entry->SetEntry );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    /* The socket references can only be dropped outside of the lock */
+    while( !IsListEmpty( &DeadEntries ) ) {
+        Entry = CONTAINING_RECORD( RemoveHeadList( &DeadEntries ),
+                                   AFD_POLL_SET_ENTRY, SetEntry );
+        ObDereferenceObject( Entry->Socket );
+        ExFreePoolWithTag( Entry, TAG_AFD_POLL_SET_ENTRY );
+    }
+}
+
 VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
     PAFD_ACTIVE_POLL Poll = NULL;
     PLIST_ENTRY ThePollEnt = NULL;
@@ -440,6 +645,16 @@ VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
             ThePollEnt = ThePollEnt->Flink;
     }
 
+    /* Poll sets only hear about the sockets registered with them */
+    for( ThePollEnt = FCB->PollSetEntries.Flink;
+         ThePollEnt != &FCB->PollSetEntries;
+         ThePollEnt = ThePollEnt->Flink ) {
+        SignalPollSetEntry( CONTAINING_RECORD( ThePollEnt,
+                                               AFD_POLL_SET_ENTRY,
+                                               SocketEntry ),
+                            FCB->PollState );
+    }
+
     KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
 
     if((FCB->EventSelect) &&
@@ -1055,6 +1055,190 @@ NTSTATUS TdiReceive(
 }
 
 
+static PMDL TdiBuildPartialMdl(
+    PMDL SourceMdl,
+    UINT Offset,
+    UINT Length)
+/*
+ * FUNCTION: Describes part of an already locked buffer
+ * ARGUMENTS:
+ *     SourceMdl = Pointer to MDL of the locked buffer
+ *     Offset    = Offset of the part to describe
+ *     Length    = Length of the part to describe
+ * RETURNS:
+ *     The partial MDL, or NULL if out of resources
+ * NOTES:
+ *     Partial MDLs aren't locked themselves, completion routines must
+ *     release them with TdiFreePartialMdl before the I/O manager sees them
+ */
+{
+    PCHAR VirtualAddress = (PCHAR)MmGetMdlVirtualAddress(SourceMdl) + Offset;
+    PMDL Mdl;
+
+    Mdl = IoAllocateMdl(VirtualAddress, /* Virtual address */
+                        Length,         /* Length of buffer */
+                        FALSE,          /* Not secondary */
+                        FALSE,          /* Don't charge quota */
+                        NULL);          /* Don't use IRP */
+    if (!Mdl) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return NULL;
+    }
+
+    IoBuildPartialMdl(SourceMdl, Mdl, VirtualAddress, Length);
+
+    return Mdl;
+}
+
+VOID TdiFreePartialMdl(
+    PIRP Irp)
+/*
+ * FUNCTION: Frees a partial MDL handed to the transport
+ * ARGUMENTS:
+ *     Irp = Pointer to the completed transport IRP
+ */
+{
+    PMDL Mdl = Irp->MdlAddress;
+
+    if (Mdl && (Mdl->MdlFlags & MDL_PARTIAL)) {
+        MmPrepareMdlForReuse(Mdl);
+        IoFreeMdl(Mdl);
+        Irp->MdlAddress = NULL;
+    }
+}
+
+NTSTATUS TdiSendMdl(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL Mdl,
+    UINT Offset,
+    UINT Length,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+/*
+ * FUNCTION: Sends straight from a caller's locked buffer
+ * ARGUMENTS:
+ *     Mdl    = Pointer to MDL of the locked user buffer
+ *     Offset = Offset of the first byte to send
+ *     Length = Number of bytes to send
+ * NOTES:
+ *     The buffer must stay locked until the completion routine runs
+ */
+{
+    PDEVICE_OBJECT DeviceObject;
+    PMDL PartialMdl;
+
+    ASSERT(*Irp == NULL);
+
+    if (!TransportObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad transport object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    DeviceObject = IoGetRelatedDeviceObject(TransportObject);
+    if (!DeviceObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad device object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Irp = TdiBuildInternalDeviceControlIrp(TDI_SEND,                /* Sub function */
+                                            DeviceObject,            /* Device object */
+                                            TransportObject,         /* File object */
+                                            NULL,                    /* Event */
+                                            NULL);                   /* Status */
+
+    if (!*Irp) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    PartialMdl = TdiBuildPartialMdl(Mdl, Offset, Length);
+    if (!PartialMdl) {
+        IoCompleteRequest(*Irp, IO_NO_INCREMENT);
+        *Irp = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TdiBuildSend(*Irp,                   /* I/O Request Packet */
+                 DeviceObject,           /* Device object */
+                 TransportObject,        /* File object */
+                 CompletionRoutine,      /* Completion routine */
+                 CompletionContext,      /* Completion context */
+                 PartialMdl,             /* Data buffer */
+                 Flags,                  /* Flags */
+                 Length);                /* Length of data */
+
+    TdiCall(*Irp, DeviceObject, NULL, NULL);
+
+    return STATUS_PENDING;
+}
+
+NTSTATUS TdiReceiveMdl(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL Mdl,
+    UINT Length,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+/*
+ * FUNCTION: Receives straight into a caller's locked buffer
+ * ARGUMENTS:
+ *     Mdl    = Pointer to MDL of the locked user buffer
+ *     Length = Size of the buffer
+ * NOTES:
+ *     The buffer must stay locked until the completion routine runs
+ */
+{
+    PDEVICE_OBJECT DeviceObject;
+    PMDL PartialMdl;
+
+    ASSERT(*Irp == NULL);
+
+    if (!TransportObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad transport object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    DeviceObject = IoGetRelatedDeviceObject(TransportObject);
+    if (!DeviceObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad device object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Irp = TdiBuildInternalDeviceControlIrp(TDI_RECEIVE,             /* Sub function */
+                                            DeviceObject,            /* Device object */
+                                            TransportObject,         /* File object */
+                                            NULL,                    /* Event */
+                                            NULL);                   /* Status */
+
+    if (!*Irp) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    PartialMdl = TdiBuildPartialMdl(Mdl, 0, Length);
+    if (!PartialMdl) {
+        IoCompleteRequest(*Irp, IO_NO_INCREMENT);
+        *Irp = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TdiBuildReceive(*Irp,                   /* I/O Request Packet */
+                    DeviceObject,           /* Device object */
+                    TransportObject,        /* File object */
+                    CompletionRoutine,      /* Completion routine */
+                    CompletionContext,      /* Completion context */
+                    PartialMdl,             /* Data buffer */
+                    Flags,                  /* Flags */
+                    Length);                /* Length of data */
+
+    TdiCall(*Irp, DeviceObject, NULL, NULL);
+
+    return STATUS_PENDING;
+}
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -11,6 +11,61 @@
 #include "afd.h"
 
 static IO_COMPLETION_ROUTINE SendComplete;
+
+static BOOLEAN HandleDirectSendComplete( PAFD_FCB FCB, NTSTATUS Status,
+                                         ULONG_PTR Information )
+{
+    PIRP UserIrp = FCB->SendIrp.UserIrp;
+    PAFD_SEND_INFO SendReq = GetLockedData(UserIrp, IoGetCurrentIrpStackLocation(UserIrp));
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    ULONG_PTR BytesSent;
+
+    /* We use the IRP tail to track how much of the buffer went out */
+    BytesSent = (ULONG_PTR)UserIrp->Tail.Overlay.DriverContext[3] + Information;
+
+    /* The FCB is being destroyed, don't send the rest from under it */
+    if (FCB->State == SOCKET_STATE_CLOSED)
+    {
+        Status = STATUS_FILE_CLOSED;
+        BytesSent = 0;
+    }
+
+    /* The transport may take less than we asked for, so send the rest */
+    if (NT_SUCCESS(Status) && Information != 0 &&
+        BytesSent < SendReq->BufferArray[0].len)
+    {
+        UserIrp->Tail.Overlay.DriverContext[3] = (PVOID)BytesSent;
+
+        Status = TdiSendMdl(&FCB->SendIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            0,
+                            Map[0].Mdl,
+                            (UINT)BytesSent,
+                            SendReq->BufferArray[0].len - (UINT)BytesSent,
+                            SendComplete,
+                            FCB);
+        if (Status == STATUS_PENDING)
+            return FALSE;
+
+        /* Report what did go out */
+        Status = STATUS_SUCCESS;
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Completing direct send %p (%u)\n", UserIrp,
+                            (UINT)BytesSent));
+
+    FCB->SendIrp.UserIrp = NULL;
+
+    UserIrp->IoStatus.Status = Status;
+    UserIrp->IoStatus.Information = BytesSent;
+    (void)IoSetCancelRoutine(UserIrp, NULL);
+    UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
+    if (UserIrp->MdlAddress) UnlockRequest(UserIrp, IoGetCurrentIrpStackLocation(UserIrp));
+    IoCompleteRequest(UserIrp, IO_NETWORK_INCREMENT);
+
+    return TRUE;
+}
+
 static NTSTATUS NTAPI SendComplete
 ( PDEVICE_OBJECT DeviceObject,
   PIRP Irp,
@@ -24,7 +79,7 @@ static NTSTATUS NTAPI SendComplete
     PAFD_MAPBUF Map;
     SIZE_T TotalBytesCopied = 0, TotalBytesProcessed = 0, SpaceAvail, i;
     UINT SendLength, BytesCopied;
-    BOOLEAN HaltSendQueue;
+    BOOLEAN HaltSendQueue, Direct = FALSE;
 
     UNREFERENCED_PARAMETER(DeviceObject);
 
@@ -41,6 +96,9 @@ static NTSTATUS NTAPI SendComplete
                             Irp->IoStatus.Status,
                             Irp->IoStatus.Information));
 
+    /* Must be gone before the I/O manager unlocks the MDLs */
+    TdiFreePartialMdl(Irp);
+
     if( !SocketAcquireStateLock( FCB ) )
         return STATUS_FILE_CLOSED;
 
@@ -48,6 +106,22 @@ static NTSTATUS NTAPI SendComplete
     FCB->SendIrp.InFlightRequest = NULL;
     /* Request is not in flight any longer */
 
+    /* A send straight from the user's buffer never went through the window */
+    if( FCB->SendIrp.UserIrp ) {
+        if( !HandleDirectSendComplete( FCB, Status, Irp->IoStatus.Information ) ) {
+            /* The rest of the buffer is on its way */
+            SocketStateUnlock( FCB );
+            return STATUS_SUCCESS;
+        }
+
+        /* Cancelling it doesn't affect the sends queued behind it,
+         * a closed socket fails them below */
+        if( Status == STATUS_CANCELLED )
+            Status = STATUS_SUCCESS;
+
+        Direct = TRUE;
+    }
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
@@ -99,12 +173,17 @@ static NTSTATUS NTAPI SendComplete
         return STATUS_SUCCESS;
     }
 
-    RtlMoveMemory( FCB->Send.Window,
-                   FCB->Send.Window + Irp->IoStatus.Information,
-                   FCB->Send.BytesUsed - Irp->IoStatus.Information );
+    if( Direct ) {
+        SendLength = 0;
+    } else {
+        RtlMoveMemory( FCB->Send.Window,
+                       FCB->Send.Window + Irp->IoStatus.Information,
+                       FCB->Send.BytesUsed - Irp->IoStatus.Information );
+
+        SendLength = Irp->IoStatus.Information;
+    }
 
     TotalBytesProcessed = 0;
-    SendLength = Irp->IoStatus.Information;
     HaltSendQueue = FALSE;
     while (!IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) && SendLength > 0) {
         NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
@@ -325,6 +404,57 @@ static NTSTATUS NTAPI PacketSocketSendComplete
     return STATUS_SUCCESS;
 }
 
+static NTSTATUS SendDirect( PAFD_FCB FCB, PIRP Irp, PAFD_SEND_INFO SendReq )
+{
+    PAFD_MAPBUF Map = (PAFD_MAPBUF)(SendReq->BufferArray + SendReq->BufferCount);
+    NTSTATUS Status;
+
+    AFD_DbgPrint(MID_TRACE,("Sending from %p directly\n", Irp));
+
+    /* Let the queue deal with a request that's already being cancelled */
+    IoAcquireCancelSpinLock(&Irp->CancelIrql);
+    if (Irp->Cancel)
+    {
+        IoReleaseCancelSpinLock(Irp->CancelIrql);
+        return LeaveIrpUntilLater(FCB, Irp, FUNCTION_SEND);
+    }
+    (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+    IoMarkIrpPending(Irp);
+
+    /* The window is still free for whatever comes next */
+    FCB->PollState |= AFD_EVENT_SEND;
+    FCB->PollStatus[FD_WRITE_BIT] = STATUS_SUCCESS;
+    PollReeval( FCB->DeviceExt, FCB->FileObject );
+
+    /* The transport may complete this before TdiSendMdl returns */
+    Irp->Tail.Overlay.DriverContext[3] = (PVOID)0;
+    FCB->SendIrp.UserIrp = Irp;
+
+    Status = TdiSendMdl(&FCB->SendIrp.InFlightRequest,
+                        FCB->Connection.Object,
+                        0,
+                        Map[0].Mdl,
+                        0,
+                        SendReq->BufferArray[0].len,
+                        SendComplete,
+                        FCB);
+    if (Status != STATUS_PENDING)
+    {
+        FCB->SendIrp.UserIrp = NULL;
+        (void)IoSetCancelRoutine(Irp, NULL);
+        UnlockBuffers(SendReq->BufferArray, SendReq->BufferCount, FALSE);
+        UnlockRequest(Irp, IoGetCurrentIrpStackLocation(Irp));
+        Irp->IoStatus.Status = Status;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest(Irp, IO_NETWORK_INCREMENT);
+    }
+
+    SocketStateUnlock(FCB);
+
+    return STATUS_PENDING;
+}
+
 NTSTATUS NTAPI
 AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                             PIO_STACK_LOCATION IrpSp, BOOLEAN Short) {
@@ -472,6 +602,18 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         SendLength += SendReq->BufferArray[i].len;
     }
 
+    /* With nothing queued ahead of it, a large buffer can be sent without
+     * copying it into the window. Non-blocking sockets keep going through
+     * the window since they expect the send to finish right away. */
+    if (FCB->Send.BytesUsed == 0 && !FCB->SendIrp.InFlightRequest &&
+        IsListEmpty(&FCB->PendingIrpList[FUNCTION_SEND]) &&
+        SendReq->BufferCount == 1 && SendLength >= AFD_DIRECT_IO_THRESHOLD &&
+        ((PAFD_MAPBUF)(SendReq->BufferArray + 1))->Mdl &&
+        !((SendReq->AfdFlags & AFD_IMMEDIATE) || (FCB->NonBlocking)))
+    {
+        return SendDirect(FCB, Irp, SendReq);
+    }
+
     /* Make sure we've got the space */
     if (SendLength > SpaceAvail)
     {
@@ -35,6 +35,28 @@
 #define	IP_MIB_STATS_ID 1
 #define	IP_MIB_ADDRTABLE_ENTRY_ID 0x102
 
+/* Largest buffer SO_SNDBUF/SO_RCVBUF may ask for */
+#define AFD_MAX_WINDOW_SIZE 0x100000
+
+/* Buffers up to the old limit are free, the rest of every larger buffer is
+ * charged against a budget shared by all sockets */
+#define AFD_UNCHARGED_WINDOW_SIZE 0x10000
+#define AFD_MAX_WINDOW_CHARGE (64 * 1024 * 1024)
+
+/* Exported by ntoskrnl, but not declared in the DDK headers */
+NTSTATUS
+NTAPI
+IoSetIoCompletion(
+    IN PVOID IoCompletion,
+    IN PVOID KeyContext,
+    IN PVOID ApcContext,
+    IN NTSTATUS IoStatus,
+    IN ULONG_PTR IoStatusInformation,
+    IN BOOLEAN Quota);
+
+/* Smallest stream send/recv buffer handed to the transport without copying */
+#define AFD_DIRECT_IO_THRESHOLD 0x2000
+
 #define TAG_AFD_DATA_BUFFER                'BdfA'
 #define TAG_AFD_TRANSPORT_ADDRESS          'tdfA'
 #define TAG_AFD_SOCKET_CONTEXT             'XdfA'
@@ -47,6 +69,7 @@
 #define TAG_AFD_POLL_HANDLE                'hpfA'
 #define TAG_AFD_FCB                        'cffA'
 #define TAG_AFD_ACTIVE_POLL                'pafA'
+#define TAG_AFD_POLL_SET_ENTRY             'epfA'
 #define TAG_AFD_EA_INFO                    'aefA'
 #define TAG_AFD_STORED_DATAGRAM            'gsfA'
 #define TAG_AFD_SNMP_ADDRESS_INFO          'asfA'
@@ -123,6 +146,17 @@ typedef struct _AFD_ACTIVE_POLL {
     BOOLEAN Exclusive;
 } AFD_ACTIVE_POLL, *PAFD_ACTIVE_POLL;
 
+/* A socket registered with a poll set. Protected by the device extension lock */
+typedef struct _AFD_POLL_SET_ENTRY {
+    LIST_ENTRY SetEntry;      /* Linked on the poll set's PollSetMembers */
+    LIST_ENTRY SocketEntry;   /* Linked on the socket's PollSetEntries */
+    PFILE_OBJECT PollSet;
+    PFILE_OBJECT Socket;      /* Referenced */
+    ULONG Events;
+    PVOID Context;
+    BOOLEAN Armed;
+} AFD_POLL_SET_ENTRY, *PAFD_POLL_SET_ENTRY;
+
 typedef struct _IRP_LIST {
     LIST_ENTRY ListEntry;
     PIRP Irp;
@@ -142,6 +176,7 @@ typedef struct _AFD_TDI_OBJECT_QELT {
 
 typedef struct _AFD_IN_FLIGHT_REQUEST {
     PIRP InFlightRequest;
+    PIRP UserIrp; /* Request whose buffer InFlightRequest uses directly */
     PTDI_CONNECTION_INFORMATION ConnectionCallInfo;
     PTDI_CONNECTION_INFORMATION ConnectionReturnInfo;
 } AFD_IN_FLIGHT_REQUEST, *PAFD_IN_FLIGHT_REQUEST;
@@ -201,6 +236,8 @@ typedef struct _AFD_FCB {
     LIST_ENTRY PendingIrpList[MAX_FUNCTIONS];
     LIST_ENTRY DatagramList;
     LIST_ENTRY PendingConnections;
+    LIST_ENTRY PollSetEntries;
+    LIST_ENTRY PollSetMembers;
 } AFD_FCB, *PAFD_FCB;
 
 /* bind.c */
@@ -250,6 +287,12 @@ AfdSetContext( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
 /* info.c */
 
+BOOLEAN
+AfdChargeWindow( ULONG Size );
+
+VOID
+AfdReturnWindowCharge( ULONG Size );
+
 NTSTATUS NTAPI
 AfdGetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 	    PIO_STACK_LOCATION IrpSp );
@@ -328,6 +371,11 @@ AfdEventSelect( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdEnumEvents( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 	       PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPollSetControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		   PIO_STACK_LOCATION IrpSp );
+VOID KillPollSetEntries( PAFD_DEVICE_EXTENSION DeviceExt,
+                         PFILE_OBJECT FileObject );
 VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceObject, PFILE_OBJECT FileObject );
 VOID KillSelectsForFCB( PAFD_DEVICE_EXTENSION DeviceExt,
                         PFILE_OBJECT FileObject, BOOLEAN ExclusiveOnly );
@@ -379,6 +427,28 @@ NTSTATUS TdiSend
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+NTSTATUS TdiReceiveMdl
+( PIRP *Irp,
+  PFILE_OBJECT ConnectionObject,
+  USHORT Flags,
+  PMDL Mdl,
+  UINT Length,
+  PIO_COMPLETION_ROUTINE  CompletionRoutine,
+  PVOID CompletionContext);
+
+NTSTATUS TdiSendMdl
+( PIRP *Irp,
+  PFILE_OBJECT ConnectionObject,
+  USHORT Flags,
+  PMDL Mdl,
+  UINT Offset,
+  UINT Length,
+  PIO_COMPLETION_ROUTINE  CompletionRoutine,
+  PVOID CompletionContext);
+
+VOID TdiFreePartialMdl(
+    PIRP Irp);
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -83,6 +83,18 @@ typedef struct _NDIS_WRAPPER_CONTEXT {
 
 #define GET_MINIPORT_DRIVER(Handle)((PNDIS_M_DRIVER_BLOCK)Handle)
 
+/* Received packets waiting to be indicated on one processor */
+typedef struct _MINIPORT_RECEIVE_QUEUE {
+    KDPC                        Dpc;                    /* Indicates the packets on the queue's processor */
+    KSPIN_LOCK                  Lock;                   /* Protects the packet list */
+    KSPIN_LOCK                  IndicateLock;           /* Keeps the adapter's bindings in place while indicating */
+    PNDIS_PACKET                Head;                   /* First packet, linked through WrapperReservedEx */
+    PNDIS_PACKET                Tail;                   /* Last packet */
+    struct _LOGICAL_ADAPTER     *Adapter;               /* Adapter the queue belongs to */
+} MINIPORT_RECEIVE_QUEUE, *PMINIPORT_RECEIVE_QUEUE;
+
+#define MINIPORT_RSS_TABLE_SIZE 128                     /* Entries in the receive indirection table */
+
 /* Information about a logical adapter */
 typedef struct _LOGICAL_ADAPTER
 {
@@ -96,6 +108,10 @@ typedef struct _LOGICAL_ADAPTER
     HARDWARE_ADDRESS            Address;                /* Hardware address of adapter */
     ULONG                       AddressLength;          /* Length of hardware address */
     PMINIPORT_BUGCHECK_CONTEXT  BugcheckContext;        /* Adapter's shutdown handler */
+    PMINIPORT_RECEIVE_QUEUE     ReceiveQueues;          /* Per processor receive queues */
+    ULONG                       ReceiveQueueCount;      /* Number of receive queues, 0 if receives aren't spread */
+    UCHAR                       ReceiveIndirection[MINIPORT_RSS_TABLE_SIZE]; /* Maps hash values to receive queues */
+    ULONG                       ReceivedPackets[MAXIMUM_PROCESSORS]; /* Packets indicated on each processor */
 } LOGICAL_ADAPTER, *PLOGICAL_ADAPTER;
 
 #define GET_LOGICAL_ADAPTER(Handle)((PLOGICAL_ADAPTER)Handle)
@@ -132,6 +148,16 @@ PLOGICAL_ADAPTER
 MiniLocateDevice(
     PNDIS_STRING AdapterName);
 
+VOID
+MiniLockBindings(
+    PLOGICAL_ADAPTER Adapter,
+    PKIRQL           OldIrql);
+
+VOID
+MiniUnlockBindings(
+    PLOGICAL_ADAPTER Adapter,
+    KIRQL            OldIrql);
+
 NDIS_STATUS
 MiniQueryInformation(
     PLOGICAL_ADAPTER    Adapter,
@@ -49,6 +49,21 @@ static NDIS_MEDIUM MediaArray[MEDIA_ARRAY_SIZE] =
     NdisMediumMax
 };
 
+/* Default Toeplitz key from the RSS specification, also used by most hardware */
+static const UCHAR RssHashKey[40] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+/* Most packets a receive queue DPC indicates at once */
+#define RECEIVE_QUEUE_BATCH 32
+
+#define RECEIVE_QUEUE_LINK(Packet) (*(PNDIS_PACKET*)(Packet)->WrapperReservedEx)
+
 /* global list and lock of Miniports NDIS has registered */
 LIST_ENTRY MiniportListHead;
 KSPIN_LOCK MiniportListLock;
@@ -289,27 +304,28 @@ NdisReturnPackets(
     }
 }
 
-VOID NTAPI
-MiniIndicateReceivePacket(
-    IN  NDIS_HANDLE    MiniportAdapterHandle,
-    IN  PPNDIS_PACKET  PacketArray,
-    IN  UINT           NumberOfPackets)
+static
+VOID
+MiniIndicatePackets(
+    PLOGICAL_ADAPTER Adapter,
+    PPNDIS_PACKET    PacketArray,
+    UINT             NumberOfPackets)
 /*
- * FUNCTION: receives miniport packet array indications
+ * FUNCTION: Indicates received packets to bound protocols
  * ARGUMENTS:
- *     MiniportAdapterHandle: Miniport handle for the adapter
+ *     Adapter: Adapter the packets were received on
  *     PacketArray: pointer to a list of packet pointers to indicate
  *     NumberOfPackets: number of packets to indicate
- *
+ * NOTES:
+ *     Must be called with the miniport block lock or the indicate lock
+ *     of one of the adapter's receive queues held
  */
 {
-    PLOGICAL_ADAPTER Adapter = MiniportAdapterHandle;
     PLIST_ENTRY CurrentEntry;
     PADAPTER_BINDING AdapterBinding;
-    KIRQL OldIrql;
     UINT i;
 
-    KeAcquireSpinLock(&Adapter->NdisMiniportBlock.Lock, &OldIrql);
+    Adapter->ReceivedPackets[KeGetCurrentProcessorNumber()] += NumberOfPackets;
 
     CurrentEntry = Adapter->ProtocolListHead.Flink;
 
@@ -351,7 +367,6 @@ MiniIndicateReceivePacket(
                 if (!LookAheadBuffer)
                 {
                     NDIS_DbgPrint(MIN_TRACE, ("Failed to allocate lookahead buffer!\n"));
-                    KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
                     return;
                 }
 
@@ -428,6 +443,369 @@ MiniIndicateReceivePacket(
         }
     }
 
+}
+
+static
+ULONG
+MiniHashPacket(
+    PLOGICAL_ADAPTER Adapter,
+    PNDIS_PACKET     Packet)
+/*
+ * FUNCTION: Computes the RSS hash of a received packet
+ * ARGUMENTS:
+ *     Adapter: Adapter the packet was received on
+ *     Packet: Received packet
+ * RETURNS:
+ *     Toeplitz hash of the IPv4 addresses and, for unfragmented TCP and
+ *     UDP datagrams, the ports. 0 for anything else
+ * NOTES:
+ *     NDIS 5 miniports can't hand us a hash, so it is always computed here
+ */
+{
+    PNDIS_BUFFER NdisBuffer;
+    PUCHAR Frame, IpHeader;
+    UINT FirstBufferLength, TotalBufferLength, HeaderSize, IpHeaderSize, InputLength;
+    UCHAR Input[12];
+    ULONG Hash, Window, i, Bit;
+
+    NdisGetFirstBufferFromPacket(Packet,
+                                 &NdisBuffer,
+                                 (PVOID*)&Frame,
+                                 &FirstBufferLength,
+                                 &TotalBufferLength);
+
+    HeaderSize = NDIS_GET_PACKET_HEADER_SIZE(Packet);
+    if (HeaderSize == 0)
+        HeaderSize = Adapter->MediumHeaderSize;
+
+    /* Only look at IPv4 over Ethernet, with the headers in the first buffer */
+    if (Adapter->NdisMiniportBlock.MediaType != NdisMedium802_3 || HeaderSize < 14 ||
+        FirstBufferLength < HeaderSize + 20 ||
+        Frame[12] != 0x08 || Frame[13] != 0x00)
+    {
+        return 0;
+    }
+
+    IpHeader = Frame + HeaderSize;
+    IpHeaderSize = (IpHeader[0] & 0x0F) << 2;
+    if ((IpHeader[0] >> 4) != 4 || IpHeaderSize < 20)
+        return 0;
+
+    /* Source and destination address */
+    RtlCopyMemory(Input, IpHeader + 12, 8);
+    InputLength = 8;
+
+    /* Ports of TCP (6) and UDP (17), unless fragments could end up elsewhere */
+    if ((IpHeader[9] == 6 || IpHeader[9] == 17) &&
+        !(IpHeader[6] & 0x3F) && !IpHeader[7] &&
+        FirstBufferLength >= HeaderSize + IpHeaderSize + 4)
+    {
+        RtlCopyMemory(Input + 8, IpHeader + IpHeaderSize, 4);
+        InputLength = 12;
+    }
+
+    Hash = 0;
+    Window = ((ULONG)RssHashKey[0] << 24) | ((ULONG)RssHashKey[1] << 16) |
+             ((ULONG)RssHashKey[2] << 8) | RssHashKey[3];
+    for (i = 0; i < InputLength; i++)
+    {
+        for (Bit = 0; Bit < 8; Bit++)
+        {
+            if (Input[i] & (0x80 >> Bit))
+                Hash ^= Window;
+            Window = (Window << 1) | ((RssHashKey[i + 4] >> (7 - Bit)) & 1);
+        }
+    }
+
+    return Hash;
+}
+
+static
+VOID
+NTAPI
+MiniReceiveQueueDpc(
+    PKDPC Dpc,
+    PVOID DeferredContext,
+    PVOID SystemArgument1,
+    PVOID SystemArgument2)
+/*
+ * FUNCTION: Indicates the packets steered to a receive queue
+ * ARGUMENTS:
+ *     DeferredContext: Receive queue
+ */
+{
+    PMINIPORT_RECEIVE_QUEUE Queue = DeferredContext;
+    PLOGICAL_ADAPTER Adapter = Queue->Adapter;
+    PNDIS_PACKET PacketArray[RECEIVE_QUEUE_BATCH];
+    UINT NumberOfPackets;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    for (;;)
+    {
+        KeAcquireSpinLockAtDpcLevel(&Queue->Lock);
+        for (NumberOfPackets = 0; NumberOfPackets < RECEIVE_QUEUE_BATCH && Queue->Head; NumberOfPackets++)
+        {
+            PacketArray[NumberOfPackets] = Queue->Head;
+            Queue->Head = RECEIVE_QUEUE_LINK(Queue->Head);
+        }
+        if (!Queue->Head)
+            Queue->Tail = NULL;
+        KeReleaseSpinLockFromDpcLevel(&Queue->Lock);
+
+        if (NumberOfPackets == 0)
+            break;
+
+        /* Only our own lock, so the other queues can indicate at the same time */
+        KeAcquireSpinLockAtDpcLevel(&Queue->IndicateLock);
+        MiniIndicatePackets(Adapter, PacketArray, NumberOfPackets);
+        KeReleaseSpinLockFromDpcLevel(&Queue->IndicateLock);
+    }
+}
+
+VOID
+MiniLockBindings(
+    PLOGICAL_ADAPTER Adapter,
+    PKIRQL           OldIrql)
+/*
+ * FUNCTION: Locks the list of protocols bound to an adapter for a change
+ * ARGUMENTS:
+ *     Adapter: Adapter to lock the bindings of
+ *     OldIrql: Receives the IRQL to go back to
+ * NOTES:
+ *     Receive queue DPCs walk the list holding only their own indicate
+ *     lock, so changing it takes all of those besides the miniport block
+ *     lock. Protocols can't take the miniport block lock while they are
+ *     being indicated to, which keeps this order deadlock free
+ */
+{
+    ULONG i;
+
+    KeAcquireSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
+    for (i = 0; i < Adapter->ReceiveQueueCount; i++)
+        KeAcquireSpinLockAtDpcLevel(&Adapter->ReceiveQueues[i].IndicateLock);
+}
+
+VOID
+MiniUnlockBindings(
+    PLOGICAL_ADAPTER Adapter,
+    KIRQL            OldIrql)
+/*
+ * FUNCTION: Unlocks the list of protocols bound to an adapter
+ * ARGUMENTS:
+ *     Adapter: Adapter to unlock the bindings of
+ *     OldIrql: IRQL returned by MiniLockBindings
+ */
+{
+    ULONG i;
+
+    for (i = Adapter->ReceiveQueueCount; i > 0; i--)
+        KeReleaseSpinLockFromDpcLevel(&Adapter->ReceiveQueues[i - 1].IndicateLock);
+    KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
+}
+
+static
+BOOLEAN
+MiniQueueReceivePackets(
+    PLOGICAL_ADAPTER Adapter,
+    PPNDIS_PACKET    PacketArray,
+    UINT             NumberOfPackets)
+/*
+ * FUNCTION: Spreads received packets over the receive queues
+ * ARGUMENTS:
+ *     Adapter: Adapter the packets were received on
+ *     PacketArray: pointer to a list of packet pointers to indicate
+ *     NumberOfPackets: number of packets to indicate
+ * RETURNS:
+ *     TRUE if the packets were queued, FALSE if they must be indicated now
+ * NOTES:
+ *     Must be called with the miniport block lock held. All packets of a
+ *     connection land on the same queue, and so on the same processor
+ */
+{
+    PMINIPORT_RECEIVE_QUEUE Queue;
+    UINT i;
+
+    if (Adapter->ReceiveQueueCount == 0)
+        return FALSE;
+
+    /* Packets the miniport wants back right away can't wait */
+    for (i = 0; i < NumberOfPackets; i++)
+    {
+        if (NDIS_GET_PACKET_STATUS(PacketArray[i]) == NDIS_STATUS_RESOURCES)
+            return FALSE;
+    }
+
+    for (i = 0; i < NumberOfPackets; i++)
+    {
+        PacketArray[i]->Reserved[1] = (ULONG_PTR)Adapter;
+        RECEIVE_QUEUE_LINK(PacketArray[i]) = NULL;
+
+        Queue = &Adapter->ReceiveQueues[Adapter->ReceiveIndirection[MiniHashPacket(Adapter, PacketArray[i]) &
+                                                                    (MINIPORT_RSS_TABLE_SIZE - 1)]];
+
+        KeAcquireSpinLockAtDpcLevel(&Queue->Lock);
+        if (Queue->Tail)
+            RECEIVE_QUEUE_LINK(Queue->Tail) = PacketArray[i];
+        else
+            Queue->Head = PacketArray[i];
+        Queue->Tail = PacketArray[i];
+        KeInsertQueueDpc(&Queue->Dpc, NULL, NULL);
+        KeReleaseSpinLockFromDpcLevel(&Queue->Lock);
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+MiniStartReceiveQueues(
+    PLOGICAL_ADAPTER Adapter,
+    ULONG            QueueCount)
+/*
+ * FUNCTION: Sets up a receive queue for each of the first processors
+ * ARGUMENTS:
+ *     Adapter: Adapter to spread the receives of
+ *     QueueCount: Number of queues wanted
+ * NOTES:
+ *     Only deserialized miniports hand over their packets until they
+ *     are returned, so only they can have their receives deferred
+ */
+{
+    PMINIPORT_RECEIVE_QUEUE Queues;
+    KIRQL OldIrql;
+    ULONG i;
+
+    if (QueueCount > (ULONG)KeNumberProcessors)
+        QueueCount = KeNumberProcessors;
+    if (QueueCount > MINIPORT_RSS_TABLE_SIZE)
+        QueueCount = MINIPORT_RSS_TABLE_SIZE;
+
+    if (QueueCount < 2 ||
+        !(Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE) ||
+        !Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.ReturnPacketHandler)
+    {
+        return;
+    }
+
+    Queues = ExAllocatePool(NonPagedPool, QueueCount * sizeof(MINIPORT_RECEIVE_QUEUE));
+    if (!Queues)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return;
+    }
+
+    for (i = 0; i < QueueCount; i++)
+    {
+        KeInitializeDpc(&Queues[i].Dpc, MiniReceiveQueueDpc, &Queues[i]);
+        KeSetTargetProcessorDpc(&Queues[i].Dpc, (CCHAR)i);
+        KeInitializeSpinLock(&Queues[i].Lock);
+        KeInitializeSpinLock(&Queues[i].IndicateLock);
+        Queues[i].Head = NULL;
+        Queues[i].Tail = NULL;
+        Queues[i].Adapter = Adapter;
+    }
+
+    for (i = 0; i < MINIPORT_RSS_TABLE_SIZE; i++)
+        Adapter->ReceiveIndirection[i] = (UCHAR)(i % QueueCount);
+
+    /* Protocols may be binding already */
+    KeAcquireSpinLock(&Adapter->NdisMiniportBlock.Lock, &OldIrql);
+    Adapter->ReceiveQueues = Queues;
+    Adapter->ReceiveQueueCount = QueueCount;
+    KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
+
+    NDIS_DbgPrint(MIN_TRACE, ("Spreading receives over %lu processors\n", QueueCount));
+}
+
+static
+VOID
+MiniStopReceiveQueues(
+    PLOGICAL_ADAPTER Adapter)
+/*
+ * FUNCTION: Goes back to indicating receives on the miniport's processor
+ * ARGUMENTS:
+ *     Adapter: Adapter to stop spreading the receives of
+ * NOTES:
+ *     Everything queued so far is indicated before this returns
+ */
+{
+    KIRQL OldIrql;
+
+    if (Adapter->ReceiveQueues)
+    {
+        KeAcquireSpinLock(&Adapter->NdisMiniportBlock.Lock, &OldIrql);
+        Adapter->ReceiveQueueCount = 0;
+        KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
+
+        KeFlushQueuedDpcs();
+
+        ExFreePool(Adapter->ReceiveQueues);
+        Adapter->ReceiveQueues = NULL;
+    }
+}
+
+static
+NDIS_STATUS
+MiniQueryReceiveQueueStatistics(
+    PLOGICAL_ADAPTER Adapter,
+    ULONG            Size,
+    PVOID            Buffer,
+    PULONG           BytesWritten)
+/*
+ * FUNCTION: Answers OID_GEN_RECEIVE_QUEUE_STATISTICS
+ * ARGUMENTS:
+ *     Adapter      = Adapter to return the receive counters of
+ *     Size         = Size of the passed buffer
+ *     Buffer       = Buffer for the output
+ *     BytesWritten = Address of buffer to place number of bytes written
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PNDIS_RECEIVE_QUEUE_STATISTICS Statistics = Buffer;
+    ULONG ProcessorCount = min((ULONG)KeNumberProcessors, MAXIMUM_PROCESSORS);
+    ULONG Needed = FIELD_OFFSET(NDIS_RECEIVE_QUEUE_STATISTICS, ReceivedPackets[ProcessorCount]);
+    ULONG i;
+
+    *BytesWritten = 0;
+    if (Size < Needed)
+        return NDIS_STATUS_BUFFER_TOO_SHORT;
+
+    Statistics->QueueCount = Adapter->ReceiveQueueCount;
+    Statistics->ProcessorCount = ProcessorCount;
+    for (i = 0; i < ProcessorCount; i++)
+        Statistics->ReceivedPackets[i] = Adapter->ReceivedPackets[i];
+
+    *BytesWritten = Needed;
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID NTAPI
+MiniIndicateReceivePacket(
+    IN  NDIS_HANDLE    MiniportAdapterHandle,
+    IN  PPNDIS_PACKET  PacketArray,
+    IN  UINT           NumberOfPackets)
+/*
+ * FUNCTION: receives miniport packet array indications
+ * ARGUMENTS:
+ *     MiniportAdapterHandle: Miniport handle for the adapter
+ *     PacketArray: pointer to a list of packet pointers to indicate
+ *     NumberOfPackets: number of packets to indicate
+ *
+ */
+{
+    PLOGICAL_ADAPTER Adapter = MiniportAdapterHandle;
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&Adapter->NdisMiniportBlock.Lock, &OldIrql);
+
+    /* Hand the packets to the processors their connections belong to */
+    if (!MiniQueueReceivePackets(Adapter, PacketArray, NumberOfPackets))
+        MiniIndicatePackets(Adapter, PacketArray, NumberOfPackets);
+
     KeReleaseSpinLock(&Adapter->NdisMiniportBlock.Lock, OldIrql);
 }
 
@@ -1914,6 +2292,7 @@ NdisIPnPStartDevice(
   ULONG BytesWritten;
   PLIST_ENTRY CurrentEntry;
   PPROTOCOL_BINDING ProtocolBinding;
+  ULONG RssQueues;
 
   /*
    * Prepare wrapper context used by HW and configuration routines.
@@ -2073,6 +2452,25 @@ NdisIPnPStartDevice(
     }
   WrapperContext.SlotNumber = Adapter->NdisMiniportBlock.SlotNumber;
 
+  /* Receives are spread over all processors unless the standard RSS
+   * keywords say otherwise */
+  RssQueues = KeNumberProcessors;
+  NdisInitUnicodeString(&ParamName, L"*RSS");
+  NdisReadConfiguration(&NdisStatus, &ConfigParam, ConfigHandle,
+                        &ParamName, NdisParameterInteger);
+  if (NdisStatus == NDIS_STATUS_SUCCESS && ConfigParam->ParameterData.IntegerData == 0)
+    {
+      RssQueues = 0;
+    }
+  else
+    {
+      NdisInitUnicodeString(&ParamName, L"*NumRssQueues");
+      NdisReadConfiguration(&NdisStatus, &ConfigParam, ConfigHandle,
+                            &ParamName, NdisParameterInteger);
+      if (NdisStatus == NDIS_STATUS_SUCCESS)
+        RssQueues = ConfigParam->ParameterData.IntegerData;
+    }
+
   NdisCloseConfiguration(ConfigHandle);
 
   /* Set handlers (some NDIS macros require these) */
@@ -2175,6 +2573,8 @@ NdisIPnPStartDevice(
       return NdisStatus;
     }
 
+  MiniStartReceiveQueues(Adapter, RssQueues);
+
   /* Check for a hang every two seconds if it wasn't set in MiniportInitialize */
   if (Adapter->NdisMiniportBlock.CheckForHangSeconds == 0)
       Adapter->NdisMiniportBlock.CheckForHangSeconds = 2;
@@ -2234,6 +2634,9 @@ NdisIPnPStopDevice(
   Adapter->NdisMiniportBlock.OldPnPDeviceState = Adapter->NdisMiniportBlock.PnPDeviceState;
   Adapter->NdisMiniportBlock.PnPDeviceState = NdisPnPDeviceStopped;
 
+  /* Get the queued receives indicated while the miniport is still there */
+  MiniStopReceiveQueues(Adapter);
+
   (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.HaltHandler)(Adapter);
 
   IoSetDeviceInterfaceState(&Adapter->NdisMiniportBlock.SymbolicLinkName, FALSE);
@@ -2306,11 +2709,22 @@ NdisIDeviceIoControl(
   switch (ControlCode)
   {
     case IOCTL_NDIS_QUERY_GLOBAL_STATS:
-      Status = MiniQueryInformation(Adapter,
-                                    *(PNDIS_OID)Irp->AssociatedIrp.SystemBuffer,
-                                    Stack->Parameters.DeviceIoControl.OutputBufferLength,
-                                    MmGetSystemAddressForMdl(Irp->MdlAddress),
-                                    &Written);
+      if (*(PNDIS_OID)Irp->AssociatedIrp.SystemBuffer == OID_GEN_RECEIVE_QUEUE_STATISTICS)
+      {
+          /* The miniport knows nothing about these */
+          Status = MiniQueryReceiveQueueStatistics(Adapter,
+                                                   Stack->Parameters.DeviceIoControl.OutputBufferLength,
+                                                   MmGetSystemAddressForMdl(Irp->MdlAddress),
+                                                   &Written);
+      }
+      else
+      {
+          Status = MiniQueryInformation(Adapter,
+                                        *(PNDIS_OID)Irp->AssociatedIrp.SystemBuffer,
+                                        Stack->Parameters.DeviceIoControl.OutputBufferLength,
+                                        MmGetSystemAddressForMdl(Irp->MdlAddress),
+                                        &Written);
+      }
       Irp->IoStatus.Information = Written;
       break;
 
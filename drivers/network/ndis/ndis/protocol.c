@@ -578,61 +578,47 @@ ProSendPackets(
     IN  NDIS_HANDLE     NdisBindingHandle,
     IN  PPNDIS_PACKET   PacketArray,
     IN  UINT            NumberOfPackets)
+/*
+ * FUNCTION: Forwards an array of packets to an NDIS miniport
+ * ARGUMENTS:
+ *     NdisBindingHandle = Adapter binding handle
+ *     PacketArray       = Array of packets to send
+ *     NumberOfPackets   = Number of entries in PacketArray
+ * NOTES:
+ *     Every packet is completed through the protocol's SendComplete handler
+ */
 {
     PADAPTER_BINDING AdapterBinding = NdisBindingHandle;
     PLOGICAL_ADAPTER Adapter = AdapterBinding->Adapter;
-    KIRQL RaiseOldIrql;
     NDIS_STATUS NdisStatus;
     UINT i;
 
-    if(Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler)
+    /* A deserialized miniport takes the whole array at once, unless
+     * loopback or scatter/gather DMA has to be done per packet first */
+    if (Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler &&
+        (Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE) &&
+        !(Adapter->NdisMiniportBlock.MacOptions & NDIS_MAC_OPTION_NO_LOOPBACK) &&
+        Adapter->NdisMiniportBlock.ScatterGatherListSize == 0)
     {
-       if(Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE)
-       {
-          (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler)(
-           Adapter->NdisMiniportBlock.MiniportAdapterContext, PacketArray, NumberOfPackets);
-       }
-       else
-       {
-          /* SendPackets is called at DISPATCH_LEVEL for all serialized miniports */
-          KeRaiseIrql(DISPATCH_LEVEL, &RaiseOldIrql);
-          (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler)(
-           Adapter->NdisMiniportBlock.MiniportAdapterContext, PacketArray, NumberOfPackets);
-          KeLowerIrql(RaiseOldIrql);
-          for (i = 0; i < NumberOfPackets; i++)
-          {
-             NdisStatus = NDIS_GET_PACKET_STATUS(PacketArray[i]);
-             if (NdisStatus != NDIS_STATUS_PENDING)
-                 MiniSendComplete(Adapter, PacketArray[i], NdisStatus);
-          }
-       }
-     }
-     else
-     {
-       if(Adapter->NdisMiniportBlock.Flags & NDIS_ATTRIBUTE_DESERIALIZE)
-       {
-          for (i = 0; i < NumberOfPackets; i++)
-          {
-             NdisStatus = (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendHandler)(
-                           Adapter->NdisMiniportBlock.MiniportAdapterContext, PacketArray[i], PacketArray[i]->Private.Flags);
-             if (NdisStatus != NDIS_STATUS_PENDING)
-                 MiniSendComplete(Adapter, PacketArray[i], NdisStatus);
-          }
-       }
-       else
-       {
-         /* Send is called at DISPATCH_LEVEL for all serialized miniports */
-         KeRaiseIrql(DISPATCH_LEVEL, &RaiseOldIrql);
-         for (i = 0; i < NumberOfPackets; i++)
-         {
-            NdisStatus = (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendHandler)(
-                           Adapter->NdisMiniportBlock.MiniportAdapterContext, PacketArray[i], PacketArray[i]->Private.Flags);
-            if (NdisStatus != NDIS_STATUS_PENDING)
-                MiniSendComplete(Adapter, PacketArray[i], NdisStatus);
-         }
-         KeLowerIrql(RaiseOldIrql);
-       }
-     }
+        for (i = 0; i < NumberOfPackets; i++)
+            PacketArray[i]->Reserved[1] = (ULONG_PTR)NdisBindingHandle;
+
+        (*Adapter->NdisMiniportBlock.DriverHandle->MiniportCharacteristics.SendPacketsHandler)(
+         Adapter->NdisMiniportBlock.MiniportAdapterContext, PacketArray, NumberOfPackets);
+        return;
+    }
+
+    for (i = 0; i < NumberOfPackets; i++)
+    {
+        NdisStatus = ProSend(NdisBindingHandle, PacketArray[i]);
+        if (NdisStatus != NDIS_STATUS_PENDING)
+        {
+            (*AdapterBinding->ProtocolBinding->Chars.SendCompleteHandler)(
+                AdapterBinding->NdisOpenBlock.ProtocolBindingContext,
+                PacketArray[i],
+                NdisStatus);
+        }
+    }
 }
 
 NDIS_STATUS NTAPI
@@ -711,6 +697,7 @@ NdisCloseAdapter(
  */
 {
     PADAPTER_BINDING AdapterBinding = GET_ADAPTER_BINDING(NdisBindingHandle);
+    KIRQL OldIrql;
 
     NDIS_DbgPrint(MAX_TRACE, ("Called.\n"));
 
@@ -718,7 +705,9 @@ NdisCloseAdapter(
     ExInterlockedRemoveEntryList(&AdapterBinding->ProtocolListEntry, &AdapterBinding->ProtocolBinding->Lock);
 
     /* Remove protocol from adapter's bound protocols list */
-    ExInterlockedRemoveEntryList(&AdapterBinding->AdapterListEntry, &AdapterBinding->Adapter->NdisMiniportBlock.Lock);
+    MiniLockBindings(AdapterBinding->Adapter, &OldIrql);
+    RemoveEntryList(&AdapterBinding->AdapterListEntry);
+    MiniUnlockBindings(AdapterBinding->Adapter, OldIrql);
 
     ExFreePool(AdapterBinding);
 
@@ -794,6 +783,7 @@ NdisOpenAdapter(
   PLOGICAL_ADAPTER Adapter;
   PADAPTER_BINDING AdapterBinding;
   PPROTOCOL_BINDING Protocol = GET_PROTOCOL_BINDING(NdisProtocolHandle);
+  KIRQL OldIrql;
 
   NDIS_DbgPrint(MAX_TRACE, ("Called.\n"));
 
@@ -866,7 +856,9 @@ NdisOpenAdapter(
 
   /* Put protocol on adapter's bound protocols list */
   NDIS_DbgPrint(MAX_TRACE, ("acquiring miniport block lock\n"));
-  ExInterlockedInsertTailList(&Adapter->ProtocolListHead, &AdapterBinding->AdapterListEntry, &Adapter->NdisMiniportBlock.Lock);
+  MiniLockBindings(Adapter, &OldIrql);
+  InsertTailList(&Adapter->ProtocolListHead, &AdapterBinding->AdapterListEntry);
+  MiniUnlockBindings(Adapter, OldIrql);
 
   *NdisBindingHandle = (NDIS_HANDLE)AdapterBinding;
 
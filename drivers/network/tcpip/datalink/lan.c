@@ -28,6 +28,17 @@ typedef struct _LAN_WQ_ITEM {
     BOOLEAN LegacyReceive;
 } LAN_WQ_ITEM, *PLAN_WQ_ITEM;
 
+/* Received packets are processed on the processor that took them in, so
+ * that all of a connection's traffic stays on the CPU NDIS steered it to */
+typedef struct _LAN_RECEIVE_QUEUE {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY ListHead;
+    KEVENT Event;
+    PKTHREAD Thread;
+    ULONG Processor;
+    BOOLEAN Stopping;
+} LAN_RECEIVE_QUEUE, *PLAN_RECEIVE_QUEUE;
+
 typedef struct _RECONFIGURE_CONTEXT {
     ULONG State;
     PLAN_ADAPTER Adapter;
@@ -37,6 +48,14 @@ NDIS_HANDLE NdisProtocolHandle = (NDIS_HANDLE)NULL;
 BOOLEAN ProtocolRegistered     = FALSE;
 LIST_ENTRY AdapterListHead;
 KSPIN_LOCK AdapterListLock;
+PLAN_RECEIVE_QUEUE ReceiveQueues = NULL;
+ULONG ReceiveQueueCount = 0;
+PKTHREAD LanTransmitBatchThread = NULL;
+
+VOID NTAPI ProtocolSendComplete(
+    NDIS_HANDLE BindingContext,
+    PNDIS_PACKET Packet,
+    NDIS_STATUS Status);
 
 NDIS_STATUS NDISCall(
     PLAN_ADAPTER Adapter,
@@ -176,10 +195,176 @@ VOID FreeAdapter(
  *     Adapter = Pointer to LAN_ADAPTER structure to free
  */
 {
+    PNDIS_PACKET Packet;
+
+    while ((Packet = Adapter->SendCache) != NULL) {
+        Adapter->SendCache = (PNDIS_PACKET)PC(Packet)->DLComplete;
+        FreeNdisPacket(Packet);
+    }
+
     ExFreePoolWithTag(Adapter, LAN_ADAPTER_TAG);
 }
 
 
+static NDIS_STATUS LanAllocateSendPacket(
+    PLAN_ADAPTER Adapter,
+    PNDIS_PACKET *NdisPacket,
+    UINT Size)
+/*
+ * FUNCTION: Gets a packet to transmit a frame in
+ * ARGUMENTS:
+ *     Adapter    = Pointer to a LAN_ADAPTER structure
+ *     NdisPacket = Address of pointer to receive the packet
+ *     Size       = Size of the frame
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     Frames up to SendCacheSize reuse packets from the adapter's cache,
+ *     which ProtocolSendComplete puts them back into
+ */
+{
+    PNDIS_PACKET Packet;
+    PNDIS_BUFFER Buffer;
+    NDIS_STATUS NdisStatus;
+    KIRQL OldIrql;
+
+    if (Size > Adapter->SendCacheSize) {
+        NdisStatus = AllocatePacketWithBuffer(NdisPacket, NULL, Size);
+        if (NdisStatus == NDIS_STATUS_SUCCESS)
+            PC(*NdisPacket)->Context = NULL;
+        return NdisStatus;
+    }
+
+    TcpipAcquireSpinLock(&Adapter->SendCacheLock, &OldIrql);
+    Packet = Adapter->SendCache;
+    if (Packet) {
+        Adapter->SendCache = (PNDIS_PACKET)PC(Packet)->DLComplete;
+        Adapter->SendCacheDepth--;
+    }
+    TcpipReleaseSpinLock(&Adapter->SendCacheLock, OldIrql);
+
+    if (!Packet) {
+        NdisStatus = AllocatePacketWithBuffer(&Packet, NULL, Adapter->SendCacheSize);
+        if (NdisStatus != NDIS_STATUS_SUCCESS)
+            return NdisStatus;
+    }
+
+    /* Trim the buffer down to the frame, it is restored on recycling */
+    NdisQueryPacket(Packet, NULL, NULL, &Buffer, NULL);
+    NdisAdjustBufferLength(Buffer, Size);
+    NdisRecalculatePacketCounts(Packet);
+
+    PC(Packet)->Context = Adapter;
+    *NdisPacket = Packet;
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+
+static VOID LanRecycleSendPacket(
+    PLAN_ADAPTER Adapter,
+    PNDIS_PACKET Packet)
+/*
+ * FUNCTION: Returns a sent packet to the adapter's cache
+ * ARGUMENTS:
+ *     Adapter = Pointer to a LAN_ADAPTER structure
+ *     Packet  = Packet from LanAllocateSendPacket
+ */
+{
+    PNDIS_BUFFER Buffer;
+    KIRQL OldIrql;
+
+    NdisQueryPacket(Packet, NULL, NULL, &Buffer, NULL);
+    NdisAdjustBufferLength(Buffer, Adapter->SendCacheSize);
+    NdisRecalculatePacketCounts(Packet);
+
+    NDIS_PER_PACKET_INFO_FROM_PACKET(Packet, TcpIpChecksumPacketInfo) = NULL;
+    NdisClearPacketFlags(Packet, NDIS_PROTOCOL_ID_MASK);
+
+    TcpipAcquireSpinLock(&Adapter->SendCacheLock, &OldIrql);
+    if (Adapter->SendCacheDepth < LAN_SEND_CACHE_DEPTH) {
+        PC(Packet)->DLComplete = (PACKET_COMPLETION_ROUTINE)Adapter->SendCache;
+        Adapter->SendCache = Packet;
+        Adapter->SendCacheDepth++;
+        Packet = NULL;
+    }
+    TcpipReleaseSpinLock(&Adapter->SendCacheLock, OldIrql);
+
+    if (Packet)
+        FreeNdisPacket(Packet);
+}
+
+
+static VOID LanFlushSendBatch(
+    PLAN_ADAPTER Adapter)
+/*
+ * FUNCTION: Hands the packets batched up for an adapter to NDIS
+ * ARGUMENTS:
+ *     Adapter = Pointer to a LAN_ADAPTER structure
+ * NOTES:
+ *     NDIS reports every packet through ProtocolSendComplete,
+ *     whether or not the miniport completed it right away
+ */
+{
+    PNDIS_PACKET Dropped[LAN_SEND_BATCH_SIZE];
+    UINT Count, i;
+    KIRQL OldIrql;
+
+    TcpipAcquireSpinLock(&Adapter->Lock, &OldIrql);
+    Count = Adapter->SendBatchCount;
+    if (Count != 0 && Adapter->NdisHandle) {
+        TI_DbgPrint(MID_TRACE, ("NdisSendPackets (%d)\n", Count));
+        NdisSendPackets(Adapter->NdisHandle, Adapter->SendBatch, Count);
+        Count = 0;
+    } else {
+        RtlCopyMemory(Dropped, Adapter->SendBatch, Count * sizeof(PNDIS_PACKET));
+    }
+    Adapter->SendBatchCount = 0;
+    TcpipReleaseSpinLock(&Adapter->Lock, OldIrql);
+
+    /* The binding went away under us */
+    for (i = 0; i < Count; i++)
+        ProtocolSendComplete((NDIS_HANDLE)Adapter, Dropped[i], NDIS_STATUS_NOT_ACCEPTED);
+}
+
+
+VOID LANBeginTransmitBatch(VOID)
+/*
+ * FUNCTION: Starts batching the frames this thread transmits
+ * NOTES:
+ *     Only one thread batches at a time; it is the lwIP thread,
+ *     which sends all of the segments of a tcp_output pass
+ */
+{
+    LanTransmitBatchThread = KeGetCurrentThread();
+}
+
+
+VOID LANEndTransmitBatch(VOID)
+/*
+ * FUNCTION: Stops batching and sends whatever was batched on every adapter
+ */
+{
+    PLIST_ENTRY CurrentEntry;
+    PLAN_ADAPTER Adapter;
+    KIRQL OldIrql;
+
+    if (LanTransmitBatchThread != KeGetCurrentThread())
+        return;
+
+    LanTransmitBatchThread = NULL;
+
+    TcpipAcquireSpinLock(&AdapterListLock, &OldIrql);
+    for (CurrentEntry = AdapterListHead.Flink;
+         CurrentEntry != &AdapterListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+        Adapter = CONTAINING_RECORD(CurrentEntry, LAN_ADAPTER, ListEntry);
+        LanFlushSendBatch(Adapter);
+    }
+    TcpipReleaseSpinLock(&AdapterListLock, OldIrql);
+}
+
+
 NTSTATUS TcpipLanGetDwordOid
 ( PIP_INTERFACE Interface,
   NDIS_OID Oid,
@@ -301,7 +486,12 @@ VOID NTAPI ProtocolSendComplete(
  *     Status         = Status of the operation
  */
 {
-    FreeNdisPacket(Packet);
+    PLAN_ADAPTER Adapter = (PLAN_ADAPTER)BindingContext;
+
+    if (PC(Packet)->Context == Adapter)
+        LanRecycleSendPacket(Adapter, Packet);
+    else
+        FreeNdisPacket(Packet);
 }
 
 VOID LanReceiveWorker( PVOID Context ) {
@@ -313,6 +503,7 @@ VOID LanReceiveWorker( PVOID Context ) {
     IP_PACKET IPPacket;
     BOOLEAN LegacyReceive;
     PIP_INTERFACE Interface;
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
 
     TI_DbgPrint(DEBUG_DATALINK, ("Called.\n"));
 
@@ -358,6 +549,20 @@ VOID LanReceiveWorker( PVOID Context ) {
 
         /* Calculate packet size (excluding media header) */
         NdisQueryPacketLength(IPPacket.NdisPacket, &IPPacket.TotalSize);
+
+        /* Note the checksums the adapter has already verified. Failures
+         * are left to the software checks, which will drop the packet */
+        if (Interface->Offload & (IP_OFFLOAD_RX_IP_CHECKSUM | IP_OFFLOAD_RX_UDP_CHECKSUM))
+        {
+            ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(Packet,
+                                                                             TcpIpChecksumPacketInfo));
+            if ((Interface->Offload & IP_OFFLOAD_RX_IP_CHECKSUM) &&
+                ChecksumInfo.Receive.NdisPacketIpChecksumSucceeded)
+                IPPacket.Flags |= IP_PACKET_FLAG_IP_CSUM;
+            if ((Interface->Offload & IP_OFFLOAD_RX_UDP_CHECKSUM) &&
+                ChecksumInfo.Receive.NdisPacketUdpChecksumSucceeded)
+                IPPacket.Flags |= IP_PACKET_FLAG_UDP_CSUM;
+        }
     }
 
     TI_DbgPrint
@@ -385,6 +590,104 @@ VOID LanReceiveWorker( PVOID Context ) {
     }
 }
 
+VOID NTAPI LanReceiveQueueThread( PVOID Context ) {
+    PLAN_RECEIVE_QUEUE Queue = Context;
+    PLIST_ENTRY Entry;
+    BOOLEAN Stopping;
+    KIRQL OldIrql;
+
+    KeSetSystemAffinityThread((KAFFINITY)1 << Queue->Processor);
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+    do {
+        KeWaitForSingleObject(&Queue->Event, Executive, KernelMode, FALSE, NULL);
+
+        /* Drain everything, even when stopping, so no packet is left behind */
+        for (;;) {
+            KeAcquireSpinLock(&Queue->Lock, &OldIrql);
+            Stopping = Queue->Stopping;
+            if (IsListEmpty(&Queue->ListHead)) {
+                KeReleaseSpinLock(&Queue->Lock, OldIrql);
+                break;
+            }
+            Entry = RemoveHeadList(&Queue->ListHead);
+            KeReleaseSpinLock(&Queue->Lock, OldIrql);
+
+            LanReceiveWorker(CONTAINING_RECORD(Entry, LAN_WQ_ITEM, ListEntry));
+        }
+    } while (!Stopping);
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+VOID LanStartReceiveQueues(VOID)
+/*
+ * FUNCTION: Creates one receive thread bound to each processor
+ * NOTES: Without them, received packets go to system worker threads
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    ULONG i;
+
+    if (KeNumberProcessors < 2)
+        return;
+
+    ReceiveQueues = ExAllocatePoolWithTag(NonPagedPool,
+                                          KeNumberProcessors * sizeof(LAN_RECEIVE_QUEUE),
+                                          RECEIVE_QUEUE_TAG);
+    if (!ReceiveQueues)
+        return;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++) {
+        Queue = &ReceiveQueues[i];
+        KeInitializeSpinLock(&Queue->Lock);
+        InitializeListHead(&Queue->ListHead);
+        KeInitializeEvent(&Queue->Event, SynchronizationEvent, FALSE);
+        Queue->Processor = i;
+        Queue->Stopping = FALSE;
+        Queue->Thread = NULL;
+
+        Status = PsCreateSystemThread(&ThreadHandle, THREAD_ALL_ACCESS, NULL, NULL,
+                                      NULL, LanReceiveQueueThread, Queue);
+        if (NT_SUCCESS(Status)) {
+            ObReferenceObjectByHandle(ThreadHandle, THREAD_ALL_ACCESS, *PsThreadType,
+                                      KernelMode, (PVOID*)&Queue->Thread, NULL);
+            ZwClose(ThreadHandle);
+        }
+        if (!Queue->Thread)
+            break;
+    }
+
+    ReceiveQueueCount = i;
+    TI_DbgPrint(MIN_TRACE, ("%lu receive queues\n", ReceiveQueueCount));
+}
+
+VOID LanStopReceiveQueues(VOID)
+/*
+ * FUNCTION: Stops the receive threads once they have drained their queues
+ * NOTES: Packets submitted from then on go to system worker threads
+ */
+{
+    PLAN_RECEIVE_QUEUE Queue;
+    KIRQL OldIrql;
+    ULONG i;
+
+    for (i = 0; i < ReceiveQueueCount; i++) {
+        Queue = &ReceiveQueues[i];
+
+        KeAcquireSpinLock(&Queue->Lock, &OldIrql);
+        Queue->Stopping = TRUE;
+        KeReleaseSpinLock(&Queue->Lock, OldIrql);
+        KeSetEvent(&Queue->Event, IO_NO_INCREMENT, FALSE);
+
+        KeWaitForSingleObject(Queue->Thread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(Queue->Thread);
+        Queue->Thread = NULL;
+    }
+}
+
 VOID LanSubmitReceiveWork(
     NDIS_HANDLE BindingContext,
     PNDIS_PACKET Packet,
@@ -393,6 +696,9 @@ VOID LanSubmitReceiveWork(
     PLAN_WQ_ITEM WQItem = ExAllocatePoolWithTag(NonPagedPool, sizeof(LAN_WQ_ITEM),
                                                 WQ_CONTEXT_TAG);
     PLAN_ADAPTER Adapter = (PLAN_ADAPTER)BindingContext;
+    PLAN_RECEIVE_QUEUE Queue;
+    BOOLEAN Queued = FALSE, WasEmpty = FALSE;
+    KIRQL OldIrql;
 
     TI_DbgPrint(DEBUG_DATALINK,("called\n"));
 
@@ -403,6 +709,24 @@ VOID LanSubmitReceiveWork(
     WQItem->BytesTransferred = BytesTransferred;
     WQItem->LegacyReceive = LegacyReceive;
 
+    if (ReceiveQueueCount != 0) {
+        Queue = &ReceiveQueues[KeGetCurrentProcessorNumber() % ReceiveQueueCount];
+
+        KeAcquireSpinLock(&Queue->Lock, &OldIrql);
+        if (!Queue->Stopping) {
+            WasEmpty = IsListEmpty(&Queue->ListHead);
+            InsertTailList(&Queue->ListHead, &WQItem->ListEntry);
+            Queued = TRUE;
+        }
+        KeReleaseSpinLock(&Queue->Lock, OldIrql);
+
+        /* The thread empties the whole list each time it wakes up */
+        if (WasEmpty)
+            KeSetEvent(&Queue->Event, IO_NETWORK_INCREMENT, FALSE);
+        if (Queued)
+            return;
+    }
+
     if (!ChewCreate( LanReceiveWorker, WQItem ))
         ExFreePoolWithTag(WQItem, WQ_CONTEXT_TAG);
 }
@@ -783,6 +1107,10 @@ BOOLEAN ReconfigureAdapter(PRECONFIGURE_CONTEXT Context)
                               sizeof(Adapter->MaxPacketSize));
         if (NdisStatus != NDIS_STATUS_SUCCESS)
             return FALSE;
+
+        /* Cached transmit packets keep the size they were first made with */
+        if (Adapter->SendCacheSize == 0)
+            Adapter->SendCacheSize = Adapter->MaxPacketSize;
     }
 
     Adapter->State = Context->State;
@@ -968,6 +1296,8 @@ VOID LANTransmit(
     KIRQL OldIrql;
     PNDIS_PACKET XmitPacket;
     PIP_INTERFACE Interface = Adapter->Context;
+    PVOID ChecksumInfo;
+    BOOLEAN BatchFull;
 
     TI_DbgPrint(DEBUG_DATALINK,
 		("Called( NdisPacket %x, Offset %d, Adapter %x )\n",
@@ -989,7 +1319,7 @@ VOID LANTransmit(
 
     GetDataPtr( NdisPacket, 0, &OldData, &OldSize );
 
-    NdisStatus = AllocatePacketWithBuffer(&XmitPacket, NULL, OldSize + Adapter->HeaderSize);
+    NdisStatus = LanAllocateSendPacket(Adapter, &XmitPacket, OldSize + Adapter->HeaderSize);
     if (NdisStatus != NDIS_STATUS_SUCCESS) {
         (*PC(NdisPacket)->DLComplete)(PC(NdisPacket)->Context, NdisPacket, NDIS_STATUS_RESOURCES);
         return;
@@ -999,6 +1329,13 @@ VOID LANTransmit(
 
     RtlCopyMemory(Data + Adapter->HeaderSize, OldData, OldSize);
 
+    /* Carry over the checksums IP left to the adapter */
+    ChecksumInfo = NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket, TcpIpChecksumPacketInfo);
+    if (ChecksumInfo != NULL) {
+        NDIS_PER_PACKET_INFO_FROM_PACKET(XmitPacket, TcpIpChecksumPacketInfo) = ChecksumInfo;
+        NdisSetPacketFlags(XmitPacket, NDIS_PROTOCOL_ID_TCP_IP);
+    }
+
     (*PC(NdisPacket)->DLComplete)(PC(NdisPacket)->Context, NdisPacket, NDIS_STATUS_SUCCESS);
 
     switch (Adapter->Media) {
@@ -1049,16 +1386,20 @@ VOID LANTransmit(
 		   ((PCHAR)LinkAddress)[5] & 0xff));
 	}
 
-    if (Adapter->MTU < Size) {
-        /* This is NOT a pointer. MSDN explicitly says so. */
-        NDIS_PER_PACKET_INFO_FROM_PACKET(NdisPacket,
-                                         TcpLargeSendPacketInfo) = (PVOID)((ULONG_PTR)Adapter->MTU);
-    }
-
     /* Update interface stats */
     Interface->Stats.OutBytes += Size;
 
 	TcpipAcquireSpinLock( &Adapter->Lock, &OldIrql );
+	if (LanTransmitBatchThread == KeGetCurrentThread()) {
+	    /* Sent along with the rest of the batch */
+	    Adapter->SendBatch[Adapter->SendBatchCount++] = XmitPacket;
+	    BatchFull = (Adapter->SendBatchCount >= Adapter->SendBatchLimit);
+	    TcpipReleaseSpinLock( &Adapter->Lock, OldIrql );
+
+	    if (BatchFull)
+	        LanFlushSendBatch(Adapter);
+	    return;
+	}
 	TI_DbgPrint(MID_TRACE, ("NdisSend\n"));
 	NdisSend(&NdisStatus, Adapter->NdisHandle, XmitPacket);
 	TI_DbgPrint(MID_TRACE, ("NdisSend %s\n",
@@ -1302,6 +1643,127 @@ VOID GetName( PUNICODE_STRING RegistryKey,
     AppendUnicodeString( OutName, &PartialRegistryKey, FALSE );
 }
 
+/* Room for the offload header and every task a NDIS 5 miniport can report */
+#define TASK_OFFLOAD_BUFFER_SIZE 256
+
+VOID LANNegotiateTaskOffload(
+    PLAN_ADAPTER Adapter,
+    PIP_INTERFACE IF)
+/*
+ * FUNCTION: Enables the checksum offloads of an adapter that IP can use
+ * ARGUMENTS:
+ *     Adapter = Pointer to LAN_ADAPTER structure
+ *     IF      = Pointer to IP interface to record the enabled offloads in
+ * NOTES:
+ *     Large send offload isn't requested. lwIP cuts the send queue into MSS
+ *     sized segments when data is written and keeps each one for its own
+ *     retransmission, so TCP never has a larger segment to hand down.
+ *     Merging them again below lwIP would need a flush point after every
+ *     tcp_output call. IF->Offload is left zero if the adapter offloads nothing
+ */
+{
+    ULONG Buffer[TASK_OFFLOAD_BUFFER_SIZE / sizeof(ULONG)];
+    PNDIS_TASK_OFFLOAD_HEADER Header = (PNDIS_TASK_OFFLOAD_HEADER)Buffer;
+    PNDIS_TASK_OFFLOAD Task;
+    PNDIS_TASK_TCP_IP_CHECKSUM Supported = NULL;
+    NDIS_TASK_TCP_IP_CHECKSUM Enabled;
+    ULONG Offset, Offload = 0;
+    NDIS_STATUS NdisStatus;
+
+    if (Adapter->Media != NdisMedium802_3)
+        return;
+
+    RtlZeroMemory(Buffer, sizeof(Buffer));
+    Header->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Header->Size = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Header->EncapsulationFormat.Encapsulation = IEEE_802_3_Encapsulation;
+    Header->EncapsulationFormat.Flags.FixedHeaderSize = 1;
+    Header->EncapsulationFormat.EncapsulationHeaderSize = Adapter->HeaderSize;
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestQueryInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Buffer,
+                          sizeof(Buffer));
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        TI_DbgPrint(DEBUG_DATALINK, ("No task offload support (0x%X).\n", NdisStatus));
+        return;
+    }
+
+    /* Look for the checksum task, each task's offset is relative to the previous one */
+    for (Offset = Header->OffsetFirstTask; Offset != 0; Offset += Task->OffsetNextTask) {
+        if (Offset > sizeof(Buffer) - FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer))
+            break;
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Buffer + Offset);
+        if (Task->Task == TcpIpChecksumNdisTask &&
+            Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_IP_CHECKSUM) &&
+            Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+                sizeof(NDIS_TASK_TCP_IP_CHECKSUM) <= sizeof(Buffer)) {
+            Supported = (PNDIS_TASK_TCP_IP_CHECKSUM)Task->TaskBuffer;
+        }
+        if (Task->Task == TcpLargeSendNdisTask) {
+            /* See the note above, we leave it disabled */
+            TI_DbgPrint(DEBUG_DATALINK, ("Adapter offers large send offload, not used.\n"));
+        }
+        if (Task->OffsetNextTask == 0 || Task->OffsetNextTask > sizeof(Buffer))
+            break;
+    }
+
+    if (!Supported)
+        return;
+
+    /* Only ask for what we use. TCP segments may carry options */
+    RtlZeroMemory(&Enabled, sizeof(Enabled));
+    if (Supported->V4Transmit.TcpChecksum && Supported->V4Transmit.TcpOptionsSupported) {
+        Enabled.V4Transmit.TcpOptionsSupported = 1;
+        Enabled.V4Transmit.TcpChecksum = 1;
+        Offload |= IP_OFFLOAD_TX_TCP_CHECKSUM;
+    }
+    if (Supported->V4Transmit.UdpChecksum) {
+        Enabled.V4Transmit.UdpChecksum = 1;
+        Offload |= IP_OFFLOAD_TX_UDP_CHECKSUM;
+    }
+    if (Supported->V4Transmit.IpChecksum && Offload) {
+        Enabled.V4Transmit.IpChecksum = 1;
+        Offload |= IP_OFFLOAD_TX_IP_CHECKSUM;
+    }
+    if (Supported->V4Receive.IpChecksum) {
+        Enabled.V4Receive.IpChecksum = 1;
+        Offload |= IP_OFFLOAD_RX_IP_CHECKSUM;
+    }
+    if (Supported->V4Receive.UdpChecksum) {
+        Enabled.V4Receive.UdpChecksum = 1;
+        Offload |= IP_OFFLOAD_RX_UDP_CHECKSUM;
+    }
+
+    if (!Offload)
+        return;
+
+    Header->OffsetFirstTask = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Task = (PNDIS_TASK_OFFLOAD)(Header + 1);
+    Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+    Task->Task = TcpIpChecksumNdisTask;
+    Task->OffsetNextTask = 0;
+    Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+    RtlCopyMemory(Task->TaskBuffer, &Enabled, sizeof(Enabled));
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestSetInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Buffer,
+                          sizeof(NDIS_TASK_OFFLOAD_HEADER) +
+                          FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+                          sizeof(NDIS_TASK_TCP_IP_CHECKSUM));
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        TI_DbgPrint(MIN_TRACE, ("Could not enable checksum offload (0x%X).\n", NdisStatus));
+        return;
+    }
+
+    TI_DbgPrint(DEBUG_DATALINK, ("Checksum offload enabled (0x%X).\n", Offload));
+    IF->Offload = Offload;
+}
+
 BOOLEAN BindAdapter(
     PLAN_ADAPTER Adapter,
     PNDIS_STRING RegistryPath)
@@ -1371,6 +1833,9 @@ BOOLEAN BindAdapter(
     TI_DbgPrint(DEBUG_DATALINK,("Adapter Description: %wZ\n",
                 &IF->Description));
 
+    /* This has to be known before TCP sets up the interface */
+    LANNegotiateTaskOffload(Adapter, IF);
+
     /* Register interface with IP layer */
     IPRegisterInterface(IF);
 
@@ -1467,6 +1932,7 @@ NDIS_STATUS LANRegisterAdapter(
 
     /* Initialize protecting spin lock */
     KeInitializeSpinLock(&IF->Lock);
+    KeInitializeSpinLock(&IF->SendCacheLock);
 
     KeInitializeEvent(&IF->Event, SynchronizationEvent, FALSE);
 
@@ -1532,6 +1998,10 @@ NDIS_STATUS LANRegisterAdapter(
            assume it can send at least one packet per call to NdisSend(Packets) */
         IF->MaxSendPackets = 1;
 
+    IF->SendBatchLimit = min(IF->MaxSendPackets, LAN_SEND_BATCH_SIZE);
+    if (IF->SendBatchLimit == 0)
+        IF->SendBatchLimit = 1;
+
     /* Get current hardware address */
     NdisStatus = NDISCall(IF,
                           NdisRequestQueryInformation,
@@ -1584,6 +2054,9 @@ NDIS_STATUS LANUnregisterAdapter(
     /* Unbind adapter from IP layer */
     UnbindAdapter(Adapter);
 
+    /* Send what is still batched while the binding is there */
+    LanFlushSendBatch(Adapter);
+
     TcpipAcquireSpinLock(&Adapter->Lock, &OldIrql);
     NdisHandle = Adapter->NdisHandle;
     if (NdisHandle) {
@@ -1602,6 +2075,9 @@ NDIS_STATUS LANUnregisterAdapter(
     } else
         TcpipReleaseSpinLock(&Adapter->Lock, OldIrql);
 
+    /* Anything batched since then never reaches NDIS */
+    LanFlushSendBatch(Adapter);
+
     FreeAdapter(Adapter);
 
     return NdisStatus;
@@ -1624,6 +2100,8 @@ LANUnregisterProtocol(VOID)
         PLAN_ADAPTER Current;
         KIRQL OldIrql;
 
+        LanStopReceiveQueues();
+
         TcpipAcquireSpinLock(&AdapterListLock, &OldIrql);
 
         /* Search the list and remove every adapter we find */
@@ -1640,6 +2118,13 @@ LANUnregisterProtocol(VOID)
 
         NdisDeregisterProtocol(&NdisStatus, NdisProtocolHandle);
         ProtocolRegistered = FALSE;
+
+        /* Nothing can be submitted to the queues any more */
+        if (ReceiveQueues) {
+            ReceiveQueueCount = 0;
+            ExFreePoolWithTag(ReceiveQueues, RECEIVE_QUEUE_TAG);
+            ReceiveQueues = NULL;
+        }
     }
 }
 
@@ -1695,6 +2180,9 @@ NTSTATUS LANRegisterProtocol(
     ProtChars.UnbindAdapterHandler           = ProtocolUnbindAdapter;
     ProtChars.UnloadHandler                  = LANUnregisterProtocol;
 
+    /* Adapters may start indicating as soon as the protocol is registered */
+    LanStartReceiveQueues();
+
     /* Try to register protocol */
     NdisRegisterProtocol(&NdisStatus,
                          &NdisProtocolHandle,
@@ -1703,6 +2191,12 @@ NTSTATUS LANRegisterProtocol(
     if (NdisStatus != NDIS_STATUS_SUCCESS)
     {
         TI_DbgPrint(DEBUG_DATALINK, ("NdisRegisterProtocol failed, status 0x%x\n", NdisStatus));
+        LanStopReceiveQueues();
+        if (ReceiveQueues) {
+            ReceiveQueueCount = 0;
+            ExFreePoolWithTag(ReceiveQueues, RECEIVE_QUEUE_TAG);
+            ReceiveQueues = NULL;
+        }
         return (NTSTATUS)NdisStatus;
     }
 
@@ -27,6 +27,18 @@ UDPv4ChecksumCalculate(
   PUCHAR PacketBuffer,
   ULONG DataLength);
 
+USHORT
+IPv4PseudoHeaderChecksum(
+  PIPv4_HEADER IPHeader,
+  UCHAR Protocol,
+  ULONG Length);
+
+VOID
+IPv4CompleteChecksum(
+  PIPv4_HEADER IPHeader,
+  UINT HeaderSize,
+  UINT TotalSize);
+
 #define IPv4Checksum(Data, Count, Seed)(~ChecksumFold(ChecksumCompute(Data, Count, Seed)))
 #define TCPv4Checksum(Data, Count, Seed)(~ChecksumFold(csum_partial(Data, Count, Seed)))
 //#define TCPv4Checksum(Data, Count, Seed)(~ChecksumFold(ChecksumCompute(Data, Count, Seed)))
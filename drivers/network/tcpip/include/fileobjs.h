@@ -12,6 +12,12 @@ extern KSPIN_LOCK AddressFileListLock;
 extern LIST_ENTRY ConnectionEndpointListHead;
 extern KSPIN_LOCK ConnectionEndpointListLock;
 
+VOID AddrInitializeHashTable(VOID);
+
+VOID AddrFileSetPort(
+  PADDRESS_FILE AddrFile,
+  USHORT Port);
+
 NTSTATUS FileOpenAddress(
   PTDI_REQUEST Request,
   PTA_IP_ADDRESS AddrList,
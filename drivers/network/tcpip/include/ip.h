@@ -91,6 +91,8 @@ typedef struct _IP_PACKET {
 } IP_PACKET, *PIP_PACKET;
 
 #define IP_PACKET_FLAG_RAW      0x01    /* Raw IP packet */
+#define IP_PACKET_FLAG_IP_CSUM  0x02    /* IP header checksum verified by the adapter */
+#define IP_PACKET_FLAG_UDP_CSUM 0x04    /* UDP checksum verified by the adapter */
 
 
 /* Packet context */
@@ -168,8 +170,15 @@ typedef struct _IP_INTERFACE {
     LL_TRANSMIT_ROUTINE Transmit; /* Pointer to transmit function */
     PVOID TCPContext;             /* TCP Content for this interface */
     SEND_RECV_STATS Stats;        /* Send/Receive statistics */
+    ULONG Offload;                /* Offloads enabled on the adapter (see IP_OFFLOAD_xx below) */
 } IP_INTERFACE, *PIP_INTERFACE;
 
+#define IP_OFFLOAD_TX_IP_CHECKSUM   0x0001  /* Adapter computes IPv4 header checksums */
+#define IP_OFFLOAD_TX_TCP_CHECKSUM  0x0002  /* Adapter computes TCP checksums */
+#define IP_OFFLOAD_TX_UDP_CHECKSUM  0x0004  /* Adapter computes UDP checksums */
+#define IP_OFFLOAD_RX_IP_CHECKSUM   0x0100  /* Adapter verifies IPv4 header checksums */
+#define IP_OFFLOAD_RX_UDP_CHECKSUM  0x0200  /* Adapter verifies UDP checksums */
+
 typedef struct _IP_SET_ADDRESS {
     ULONG NteIndex;
     IPv4_RAW_ADDRESS Address;
@@ -212,6 +221,9 @@ PIP_PACKET IPInitializePacket(
     PIP_PACKET IPPacket,
     ULONG Type);
 
+VOID DeinitializePacket(
+    PVOID Object);
+
 PIP_INTERFACE IPCreateInterface(
     PLLIP_BIND_INFO BindInfo);
 
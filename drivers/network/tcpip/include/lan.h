@@ -35,6 +35,12 @@ typedef struct ETH_HEADER {
 /* Max packets queued for a single adapter */
 #define IP_MAX_RECV_BACKLOG 0x20
 
+/* Max packets handed to NdisSendPackets at once */
+#define LAN_SEND_BATCH_SIZE 16
+
+/* Max transmit packets kept around for reuse per adapter */
+#define LAN_SEND_CACHE_DEPTH 64
+
 /* Per adapter information */
 typedef struct LAN_ADAPTER {
     LIST_ENTRY ListEntry;                   /* Entry on list */
@@ -59,6 +65,13 @@ typedef struct LAN_ADAPTER {
     UINT MacOptions;                        /* MAC options for NIC driver/adapter */
     UINT Speed;                             /* Link speed */
     UINT PacketFilter;                      /* Packet filter for this adapter */
+    PNDIS_PACKET SendBatch[LAN_SEND_BATCH_SIZE]; /* Packets waiting for NdisSendPackets */
+    UINT SendBatchCount;                    /* Number of packets in SendBatch */
+    UINT SendBatchLimit;                    /* Flush SendBatch at this many packets */
+    KSPIN_LOCK SendCacheLock;               /* Lock for the transmit packet cache */
+    PNDIS_PACKET SendCache;                 /* Free transmit packets */
+    UINT SendCacheDepth;                    /* Number of packets in SendCache */
+    UINT SendCacheSize;                     /* Buffer size of cached packets */
 } LAN_ADAPTER, *PLAN_ADAPTER;
 
 /* LAN adapter state constants */
@@ -98,6 +111,9 @@ LANUnregisterProtocol(VOID);
 VOID LANStartup(VOID);
 VOID LANShutdown(VOID);
 
+VOID LANBeginTransmitBatch(VOID);
+VOID LANEndTransmitBatch(VOID);
+
 NTSTATUS TcpipLanGetDwordOid( PIP_INTERFACE Interface, NDIS_OID Oid,
                               PULONG Result );
 
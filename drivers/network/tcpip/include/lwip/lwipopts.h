@@ -37,25 +37,20 @@
 
 #define SO_REUSE_RXTOALL                1
 
-/* FIXME: These MSS and TCP Window definitions assume an MTU
- * of 1500. We need to add some code to lwIP which would allow us
- * to change these values based upon the interface we are
- * using. Currently ReactOS only supports Ethernet so we're
- * fine for now but it does need to be fixed later when we
- * add support for other transport mediums */
-#define TCP_MSS                         1460
+/* TCP_MSS is only an upper bound: lwIP lowers it to fit the MTU of the
+ * interface a connection goes through (TCP_CALCULATE_EFF_SEND_MSS), so the
+ * loopback interface gets larger segments than Ethernet. It is as large as
+ * the lwIP sanity checks allow with TCP_SNDLOWAT, which has to stay 4 MSS
+ * below the u16_t limit. The sizes that depend on the MSS assume Ethernet,
+ * see lwiptcpopts.h */
+#define TCP_MSS                         (10 * 1024)
 
-#define TCP_WND                         0xFFFF
+#include "lwiptcpopts.h"
 
-#define TCP_SND_BUF                     TCP_WND
+#define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_ETHERNET_MSS+PBUF_IP_HLEN+PBUF_TRANSPORT_HLEN+PBUF_LINK_ENCAPSULATION_HLEN+PBUF_LINK_HLEN)
 
-#define TCP_MAXRTX                      8
-
-#define TCP_SYNMAXRTX                   4
-
-#define TCP_LISTEN_BACKLOG              1
-
-#define LWIP_TCP_TIMESTAMPS             1
+/* Lets TCP leave its checksum to adapters that offload it */
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
 
 #define LWIP_SOCKET                     0
 
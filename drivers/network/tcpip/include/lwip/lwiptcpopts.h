@@ -0,0 +1,40 @@
+/*
+   ----------------------------------------
+   ---------- TCP tuning options ----------
+   ----------------------------------------
+*/
+
+/* Kept apart from lwipopts.h so that the lwIP throughput unit tests can be
+ * built with the same window and buffer sizes as the driver, see
+ * lwip/test/unit/lwipopts.h */
+
+#define TCP_ETHERNET_MSS                1460
+
+/* RFC 7323 window scaling, so that a single connection is not capped at
+ * 64 KiB in flight per round trip. The receive window is only reopened by
+ * the glue once the data has been consumed, see InternalRecvEventHandler */
+#define LWIP_WND_SCALE                  1
+
+#define TCP_RCV_SCALE                   3
+
+#define TCP_WND                         (256 * 1024)
+
+#define TCP_SND_BUF                     (256 * 1024)
+
+#define TCP_SND_QUEUELEN                ((4 * TCP_SND_BUF) / TCP_ETHERNET_MSS)
+
+/* Only used by the sockets/netconn layers, must stay below the u16_t limit */
+#define TCP_SNDLOWAT                    (16 * TCP_ETHERNET_MSS)
+
+#define TCP_WND_UPDATE_THRESHOLD        (4 * TCP_ETHERNET_MSS)
+
+/* Send SACK blocks for out-of-sequence data we hold (RFC 2018) */
+#define LWIP_TCP_SACK_OUT               1
+
+#define TCP_MAXRTX                      8
+
+#define TCP_SYNMAXRTX                   4
+
+#define TCP_LISTEN_BACKLOG              1
+
+#define LWIP_TCP_TIMESTAMPS             1
@@ -0,0 +1,42 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * FILE:        include/lwip/rcvwnd.h
+ * PURPOSE:     Receive window auto-tuning
+ */
+
+#pragma once
+
+#include <lwip/arch.h>
+
+/* Only lwIP types are used here, so the lwIP unit tests can build the
+ * auto-tuning along with the stack (see lwip/test/unit/Filelists.cmake) */
+
+struct tcp_pcb;
+
+/* The window the connection starts out with, what an unscaled SYN can offer */
+#define RCV_WND_INITIAL 0xFFFF
+
+typedef struct _RCV_WND_TUNING
+{
+    u32_t Window;          /* Current receive window */
+    u32_t Copied;          /* Bytes consumed during the current round trip */
+    u32_t Space;           /* Bytes consumed during the busiest round trip so far */
+    u64_t SpaceTime;       /* Start of the current round trip */
+    u32_t Rtt;             /* Receiver side round trip estimate */
+    u32_t RttSeq;          /* Sequence number ending the current RTT sample */
+    u64_t RttTime;         /* Start of the current RTT sample */
+} RCV_WND_TUNING, *PRCV_WND_TUNING;
+
+void
+RcvWndInitialize(
+    PRCV_WND_TUNING Tuning,
+    struct tcp_pcb *pcb,
+    u64_t Now);
+
+u32_t
+RcvWndUpdate(
+    PRCV_WND_TUNING Tuning,
+    struct tcp_pcb *pcb,
+    u32_t Consumed,
+    u64_t Now);
@@ -10,9 +10,13 @@
 #include <neighbor.h>
 
 
+struct _FIB_NODE;
+
 /* Forward Information Base Entry */
 typedef struct _FIB_ENTRY {
     LIST_ENTRY ListEntry;         /* Entry on list */
+    LIST_ENTRY NodeEntry;         /* Entry on the route list of the trie node */
+    struct _FIB_NODE *Node;       /* Trie node holding this prefix (IPv4 only) */
     OBJECT_FREE_ROUTINE Free;     /* Routine used to free resources for the object */
     IP_ADDRESS NetworkAddress;    /* Address of network */
     IP_ADDRESS Netmask;           /* Netmask of network */
@@ -26,6 +30,8 @@ PFIB_ENTRY RouterAddRoute(
     PNEIGHBOR_CACHE_ENTRY Router,
     UINT Metric);
 
+VOID RouterInvalidateCache(VOID);
+
 PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination);
 
 NTSTATUS RouterRemoveRoute(PIP_ADDRESS Target, PIP_ADDRESS Router);
@@ -27,6 +27,7 @@
 #define PACKET_BUFFER_TAG 'fuBP'
 #define FRAGMENT_DATA_TAG 'taDF'
 #define FIB_TAG ' BIF'
+#define FIB_NODE_TAG 'NBIF'
 #define IFC_TAG ' CFI'
 #define TDI_BUCKET_TAG 'BidT'
 #define FBSD_TAG 'DSBF'
@@ -35,6 +36,7 @@
 #define OSK_SMALL_TAG 'SKSO'
 #define LAN_ADAPTER_TAG ' NAL'
 #define WQ_CONTEXT_TAG 'noCW'
+#define RECEIVE_QUEUE_TAG 'qRCT'
 #define ROUTE_ENTRY_TAG 'erCT'
 #define OUT_DATA_TAG 'doCT'
 #define ARP_ENTRY_TAG 'raCT'
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <rcvwnd.h>
+
 /*
  * VOID ReferenceObject(
  *     PVOID Object)
@@ -111,6 +113,7 @@ typedef struct _DATAGRAM_SEND_REQUEST {
    field holds a pointer to this structure */
 typedef struct _ADDRESS_FILE {
     LIST_ENTRY ListEntry;                 /* Entry on list */
+    LIST_ENTRY HashEntry;                 /* Entry on (protocol, port) hash chain */
     LONG RefCount;                        /* Reference count */
     OBJECT_FREE_ROUTINE Free;             /* Routine to use to free resources for the object */
     ERESOURCE Resource;                   /* Resource to manipulate this structure */
@@ -181,6 +184,7 @@ typedef struct _ADDRESS_FILE {
 
 /* Structure used to search through Address Files */
 typedef struct _AF_SEARCH {
+    PLIST_ENTRY Head;       /* Hash chain being searched */
     PLIST_ENTRY Next;       /* Next address file to check */
     PIP_ADDRESS Address;    /* Pointer to address to be found */
     USHORT Port;            /* Network port */
@@ -255,6 +259,11 @@ typedef struct _CONNECTION_ENDPOINT {
 
     LIST_ENTRY PacketQueue;    /* Queued received packets waiting to be processed */
 
+    /* Receive window */
+    RCV_WND_TUNING RecvTuning; /* Auto-tuning state, times in 100ns */
+    ULONG RecvCredit;          /* Bytes consumed but not yet returned to the window */
+    BOOLEAN RecvCreditPending; /* The tcpip thread will return RecvCredit */
+
     /* Disconnect Timer */
     KTIMER DisconnectTimer;
     KDPC DisconnectDpc;
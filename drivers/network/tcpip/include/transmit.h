@@ -27,9 +27,12 @@ typedef struct IPFRAGMENT_CONTEXT {
     PNEIGHBOR_CACHE_ENTRY NCE;          /* Pointer to NCE to use */
     KEVENT Event;                       /* Signalled when the transmission is complete */
     NDIS_STATUS Status;                 /* Status of the transmission */
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO Offload; /* Checksums left to the adapter */
 } IPFRAGMENT_CONTEXT, *PIPFRAGMENT_CONTEXT;
 
 
+BOOLEAN IPOffloadChecksum(PIP_INTERFACE Interface, PIP_PACKET IPPacket);
+
 NTSTATUS IPSendDatagram(PIP_PACKET IPPacket, PNEIGHBOR_CACHE_ENTRY NCE);
 
 /* EOF */
@@ -0,0 +1,88 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * FILE:        ip/lwip_glue/rcvwnd.c
+ * PURPOSE:     Receive window auto-tuning
+ */
+
+#include <lwip/tcp.h>
+
+#include <rcvwnd.h>
+
+/* Received data is only credited back to the receive window once the client has
+ * consumed it, so a slow reader closes the window instead of making us queue an
+ * unbounded amount of data. The window itself starts out at what the SYN could
+ * advertise and is auto-tuned from there: once per round trip we look at how much
+ * the client consumed, and if that grew, the window is grown to twice that amount
+ * (up to TCP_WND) so the sender is never limited by it. The round trip is estimated
+ * on the receiver side, as the time it takes to receive a full window of data.
+ * Times are in whatever unit the caller's clock counts */
+
+void
+RcvWndInitialize(
+    PRCV_WND_TUNING Tuning,
+    struct tcp_pcb *pcb,
+    u64_t Now)
+{
+    /* Nothing has been received yet and the peer was only offered the unscaled
+     * window of the SYN, so we can still start out with a smaller window */
+    if (pcb->rcv_wnd > RCV_WND_INITIAL)
+    {
+        pcb->rcv_wnd = pcb->rcv_ann_wnd = RCV_WND_INITIAL;
+        pcb->rcv_ann_right_edge = pcb->rcv_nxt + RCV_WND_INITIAL;
+    }
+
+    Tuning->Window = pcb->rcv_wnd;
+    Tuning->Copied = 0;
+    Tuning->Space = Tuning->Window / 2;
+    Tuning->SpaceTime = Now;
+    Tuning->Rtt = 0;
+    Tuning->RttSeq = pcb->rcv_nxt + Tuning->Window;
+    Tuning->RttTime = Now;
+}
+
+/* Takes the bytes consumed since the last call and returns by how much the
+ * window grew. The caller credits both to lwIP */
+u32_t
+RcvWndUpdate(
+    PRCV_WND_TUNING Tuning,
+    struct tcp_pcb *pcb,
+    u32_t Consumed,
+    u64_t Now)
+{
+    u32_t Sample, NewWindow, Growth = 0;
+
+    Tuning->Copied += Consumed;
+
+    /* A full window can't be received in less than a round trip, keep the smallest sample */
+    if ((s32_t)(pcb->rcv_nxt - Tuning->RttSeq) >= 0)
+    {
+        Sample = (u32_t)LWIP_MIN(Now - Tuning->RttTime, 0xFFFFFFFF);
+        if (Sample != 0 && (Tuning->Rtt == 0 || Sample < Tuning->Rtt))
+            Tuning->Rtt = Sample;
+
+        Tuning->RttSeq = pcb->rcv_nxt + Tuning->Window;
+        Tuning->RttTime = Now;
+    }
+
+    if (Tuning->Rtt != 0 &&
+        Now - Tuning->SpaceTime >= Tuning->Rtt)
+    {
+        if (Tuning->Copied > Tuning->Space)
+        {
+            Tuning->Space = Tuning->Copied;
+
+            NewWindow = LWIP_MIN(2 * Tuning->Copied, TCP_WND_MAX(pcb));
+            if (NewWindow > Tuning->Window)
+            {
+                Growth = NewWindow - Tuning->Window;
+                Tuning->Window = NewWindow;
+            }
+        }
+
+        Tuning->Copied = 0;
+        Tuning->SpaceTime = Now;
+    }
+
+    return Growth;
+}
@@ -12,11 +12,15 @@ NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
 static LARGE_INTEGER StartTime;
 
+/* The thread running tcpip_thread, the only one whose sends are batched */
+static PKTHREAD TcpipThread;
+
 typedef struct _thread_t
 {
     HANDLE Handle;
     void (* ThreadFunction)(void *arg);
     void *ThreadContext;
+    BOOLEAN IsTcpipThread;
     LIST_ENTRY ListEntry;
 } *thread_t;
 
@@ -102,6 +106,7 @@ sys_arch_sem_wait(sys_sem_t* sem, u32_t timeout)
                                       FALSE,
                                       timeout != 0 ? &LargeTimeout : NULL,
                                       NULL);
+
     if (Status == STATUS_WAIT_0)
     {
         KeQuerySystemTime(&PostWaitTime);
@@ -184,11 +189,17 @@ sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
     PLIST_ENTRY Entry;
     KIRQL OldIrql;
     PVOID WaitObjects[] = {&mbox->Event, &TerminationEvent};
+    BOOLEAN Batching = (KeGetCurrentThread() == TcpipThread);
 
     LargeTimeout.QuadPart = Int32x32To64(timeout, -10000);
 
     KeQuerySystemTime(&PreWaitTime);
 
+    /* Whatever the last message or timer made lwIP send goes out
+     * before we sleep, everything until the next wait is batched */
+    if (Batching)
+        LANEndTransmitBatch();
+
     Status = KeWaitForMultipleObjects(2,
                                       WaitObjects,
                                       WaitAny,
@@ -198,6 +209,9 @@ sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
                                       timeout != 0 ? &LargeTimeout : NULL,
                                       NULL);
 
+    if (Batching)
+        LANBeginTransmitBatch();
+
     if (Status == STATUS_WAIT_0)
     {
         KeAcquireSpinLock(&mbox->Lock, &OldIrql);
@@ -260,6 +274,9 @@ LwipThreadMain(PVOID Context)
 
     ExInterlockedInsertHeadList(&ThreadListHead, &Container->ListEntry, &ThreadListLock);
 
+    if (Container->IsTcpipThread)
+        TcpipThread = KeGetCurrentThread();
+
     Container->ThreadFunction(Container->ThreadContext);
 
     KeAcquireSpinLock(&ThreadListLock, &OldIrql);
@@ -283,6 +300,7 @@ sys_thread_new(const char *name, lwip_thread_fn thread, void *arg, int stacksize
 
     Container->ThreadFunction = thread;
     Container->ThreadContext = arg;
+    Container->IsTcpipThread = (name && strcmp(name, TCPIP_THREAD_NAME) == 0);
 
     Status = PsCreateSystemThread(&Container->Handle,
                                   THREAD_ALL_ACCESS,
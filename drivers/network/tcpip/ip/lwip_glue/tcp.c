@@ -70,6 +70,113 @@ LibTCPEmptyQueue(PCONNECTION_ENDPOINT Connection)
     DereferenceObject(Connection);
 }
 
+static
+void
+LibTCPReturnWindow(PTCP_PCB pcb, ULONG Length)
+{
+    u16_t Chunk;
+
+    while (Length != 0)
+    {
+        Chunk = (u16_t)MIN(Length, 0xFFFF);
+        tcp_recved(pcb, Chunk);
+        Length -= Chunk;
+    }
+}
+
+/* See rcvwnd.c for how the window is tuned */
+static
+void
+LibTCPInitializeWindow(PCONNECTION_ENDPOINT Connection, PTCP_PCB pcb)
+{
+    LockObject(Connection);
+    RcvWndInitialize(&Connection->RecvTuning, pcb, KeQueryInterruptTime());
+    Connection->RecvCredit = 0;
+    UnlockObject(Connection);
+}
+
+static
+void
+LibTCPUpdateWindow(PCONNECTION_ENDPOINT Connection, PTCP_PCB pcb)
+{
+    ULONG Credit, Growth;
+
+    LockObject(Connection);
+
+    Credit = Connection->RecvCredit;
+    Connection->RecvCredit = 0;
+    Connection->RecvCreditPending = FALSE;
+    Growth = RcvWndUpdate(&Connection->RecvTuning, pcb, Credit, KeQueryInterruptTime());
+
+    UnlockObject(Connection);
+
+    LibTCPReturnWindow(pcb, Credit + Growth);
+}
+
+static
+void
+LibTCPRecvedCallback(void *arg)
+{
+    PCONNECTION_ENDPOINT Connection = arg;
+    PTCP_PCB pcb;
+    ULONG Credit;
+
+    LockObject(Connection);
+
+    Credit = Connection->RecvCredit;
+    Connection->RecvCredit = 0;
+    Connection->RecvCreditPending = FALSE;
+    Connection->RecvTuning.Copied += Credit;
+    pcb = Connection->SocketContext;
+
+    UnlockObject(Connection);
+
+    /* The PCB may be gone by now, in which case there is no window to update */
+    if (pcb && Credit)
+        LibTCPReturnWindow(pcb, Credit);
+
+    DereferenceObject(Connection);
+}
+
+/* Hands the consumed data over to the tcpip thread. Reads from the tcpip thread
+ * itself never get here, RecvCreditPending is set while a packet is indicated
+ * and LibTCPUpdateWindow takes the credit. Anyone else waits for room in the
+ * mailbox if it is full: with the whole window consumed, nothing else would
+ * ever reopen it */
+static
+void
+LibTCPQueueCredit(PCONNECTION_ENDPOINT Connection)
+{
+    ReferenceObject(Connection);
+
+    if (tcpip_callback_with_block(LibTCPRecvedCallback, Connection, 0) == ERR_OK)
+        return;
+
+    if (tcpip_callback_with_block(LibTCPRecvedCallback, Connection, 1) == ERR_OK)
+        return;
+
+    /* Out of memory, the next read or received packet will try again */
+    LockObject(Connection);
+    Connection->RecvCreditPending = FALSE;
+    UnlockObject(Connection);
+
+    DereferenceObject(Connection);
+}
+
+/* Returns the whole window before the PCB gets closed, otherwise lwIP
+ * would take the data we didn't credit yet as unread and reset the connection */
+static
+void
+LibTCPFlushWindow(PCONNECTION_ENDPOINT Connection, PTCP_PCB pcb)
+{
+    LockObject(Connection);
+    Connection->RecvCredit = 0;
+    UnlockObject(Connection);
+
+    if (pcb->state != LISTEN)
+        LibTCPReturnWindow(pcb, TCP_WND_MAX(pcb) - pcb->rcv_wnd);
+}
+
 void LibTCPEnqueuePacket(PCONNECTION_ENDPOINT Connection, struct pbuf *p)
 {
     PQUEUE_ENTRY qp;
@@ -80,6 +187,10 @@ void LibTCPEnqueuePacket(PCONNECTION_ENDPOINT Connection, struct pbuf *p)
 
     LockObject(Connection);
     InsertTailList(&Connection->PacketQueue, &qp->ListEntry);
+
+    /* We're in the tcpip thread, whatever gets consumed while the data
+     * is being indicated is credited by InternalRecvEventHandler */
+    Connection->RecvCreditPending = TRUE;
     UnlockObject(Connection);
 }
 
@@ -103,6 +214,7 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
     struct pbuf* p;
     NTSTATUS Status;
     UINT ReadLength, PayloadLength, Offset, Copied;
+    BOOLEAN QueueCredit = FALSE;
 
     (*Received) = 0;
 
@@ -157,6 +269,14 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
             if (!RecvLen)
                 break;
         }
+
+        /* Give the consumed data back to the receive window */
+        Connection->RecvCredit += (*Received);
+        if (!Connection->RecvCreditPending)
+        {
+            Connection->RecvCreditPending = TRUE;
+            QueueCredit = TRUE;
+        }
     }
     else
     {
@@ -168,6 +288,9 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
 
     UnlockObject(Connection);
 
+    if (QueueCredit)
+        LibTCPQueueCredit(Connection);
+
     return Status;
 }
 
@@ -227,9 +350,9 @@ InternalRecvEventHandler(void *arg, PTCP_PCB pcb, struct pbuf *p, const err_t er
     {
         LibTCPEnqueuePacket(Connection, p);
 
-        tcp_recved(pcb, p->tot_len);
-
         TCPRecvEventHandler(arg);
+
+        LibTCPUpdateWindow(Connection, pcb);
     }
     else if (err == ERR_OK)
     {
@@ -287,6 +410,9 @@ InternalConnectEventHandler(void *arg, PTCP_PCB pcb, const err_t err)
     if (!arg)
         return ERR_OK;
 
+    if (err == ERR_OK)
+        LibTCPInitializeWindow(arg, pcb);
+
     TCPConnectEventHandler(arg, err);
 
     return ERR_OK;
@@ -466,7 +592,7 @@ done:
 }
 
 PTCP_PCB
-LibTCPListen(PCONNECTION_ENDPOINT Connection, const u8_t backlog)
+LibTCPListen(PCONNECTION_ENDPOINT Connection, const UINT backlog)
 {
     struct lwip_callback_msg *msg;
     PTCP_PCB ret;
@@ -476,7 +602,8 @@ LibTCPListen(PCONNECTION_ENDPOINT Connection, const u8_t backlog)
     {
         KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
         msg->Input.Listen.Connection = Connection;
-        msg->Input.Listen.Backlog = backlog;
+        /* lwIP keeps the backlog in a byte, don't let it wrap around */
+        msg->Input.Listen.Backlog = (u8_t)MIN(backlog, TCP_DEFAULT_LISTEN_BACKLOG);
 
         tcpip_callback_with_block(LibTCPListenCallback, msg, 1);
 
@@ -499,7 +626,8 @@ LibTCPSendCallback(void *arg)
 {
     struct lwip_callback_msg *msg = arg;
     PTCP_PCB pcb = msg->Input.Send.Connection->SocketContext;
-    ULONG SendLength;
+    ULONG SendLength, Sent;
+    u16_t Chunk;
     UCHAR SendFlags;
 
     ASSERT(msg);
@@ -533,15 +661,28 @@ LibTCPSendCallback(void *arg)
         SendFlags |= TCP_WRITE_FLAG_MORE;
     }
 
-    msg->Output.Send.Error = tcp_write(pcb,
-                                       msg->Input.Send.Data,
-                                       SendLength,
-                                       SendFlags);
-    if (msg->Output.Send.Error == ERR_OK)
+    /* With window scaling the send buffer can hold more than tcp_write() takes at once */
+    Sent = 0;
+    do
+    {
+        Chunk = (u16_t)MIN(SendLength - Sent, 0xFFFF);
+
+        msg->Output.Send.Error = tcp_write(pcb,
+                                           (PUCHAR)msg->Input.Send.Data + Sent,
+                                           Chunk,
+                                           SendFlags | (Sent + Chunk < SendLength ? TCP_WRITE_FLAG_MORE : 0));
+        if (msg->Output.Send.Error != ERR_OK)
+            break;
+
+        Sent += Chunk;
+    } while (Sent < SendLength);
+
+    if (Sent != 0)
     {
         /* Queued successfully so try to send it */
         tcp_output((PTCP_PCB)msg->Input.Send.Connection->SocketContext);
-        msg->Output.Send.Information = SendLength;
+        msg->Output.Send.Error = ERR_OK;
+        msg->Output.Send.Information = Sent;
     }
     else if (msg->Output.Send.Error == ERR_MEM)
     {
@@ -554,7 +695,7 @@ done:
 }
 
 err_t
-LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, ULONG *sent, const int safe)
+LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const ULONG len, ULONG *sent, const int safe)
 {
     err_t ret;
     struct lwip_callback_msg *msg;
@@ -668,6 +809,9 @@ LibTCPShutdownCallback(void *arg)
      * PCB without telling us if we shutdown TX and RX. To avoid these problems, we'll clear the
      * socket context if we have called shutdown for TX and RX.
      */
+    if (msg->Input.Shutdown.shut_rx)
+        LibTCPFlushWindow(msg->Input.Shutdown.Connection, pcb);
+
     if (msg->Input.Shutdown.shut_rx != msg->Input.Shutdown.shut_tx) {
         if (msg->Input.Shutdown.shut_rx) {
             msg->Output.Shutdown.Error = tcp_shutdown(pcb, TRUE, FALSE);
@@ -771,6 +915,8 @@ LibTCPCloseCallback(void *arg)
         goto done;
     }
 
+    LibTCPFlushWindow(msg->Input.Close.Connection, pcb);
+
     /* Clear the PCB pointer and stop callbacks */
     msg->Input.Close.Connection->SocketContext = NULL;
     tcp_arg(pcb, NULL);
@@ -837,6 +983,8 @@ LibTCPAccept(PTCP_PCB pcb, struct tcp_pcb *listen_pcb, void *arg)
     tcp_err(pcb, InternalErrorEventHandler);
     tcp_arg(pcb, arg);
 
+    LibTCPInitializeWindow(arg, pcb);
+
     tcp_accepted(listen_pcb);
 }
 
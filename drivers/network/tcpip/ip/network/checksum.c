@@ -103,3 +103,65 @@ UDPv4ChecksumCalculate(
   return ~ChecksumFold(Sum);
 }
 
+
+USHORT
+IPv4PseudoHeaderChecksum(
+  PIPv4_HEADER IPHeader,
+  UCHAR Protocol,
+  ULONG Length)
+/*
+ * FUNCTION: Calculate the pseudo header sum of a TCP or UDP datagram
+ * ARGUMENTS:
+ *     IPHeader = Pointer to IPv4 header
+ *     Protocol = Transport protocol number
+ *     Length   = Length of transport header and data
+ * RETURNS:
+ *     Folded, uncomplemented sum in network byte order. This is what
+ *     adapters doing checksum offload expect in the checksum field
+ */
+{
+  ULONG Sum;
+
+  Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), 0);
+  Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum += WH2N(Protocol);
+  Sum += WH2N((USHORT)Length);
+
+  return (USHORT)ChecksumFold(Sum);
+}
+
+VOID
+IPv4CompleteChecksum(
+  PIPv4_HEADER IPHeader,
+  UINT HeaderSize,
+  UINT TotalSize)
+/*
+ * FUNCTION: Calculate the TCP or UDP checksum of a datagram in software
+ * ARGUMENTS:
+ *     IPHeader   = Pointer to IPv4 header, followed by the transport data
+ *     HeaderSize = Size of IPv4 header
+ *     TotalSize  = Size of the whole datagram
+ * NOTES:
+ *     Used when a datagram prepared for checksum offload ends up on a
+ *     path that can't offload it (fragmentation, loopback)
+ */
+{
+  PUCHAR Data = (PUCHAR)IPHeader + HeaderSize;
+  UINT Length = TotalSize - HeaderSize;
+  USHORT Seed = IPv4PseudoHeaderChecksum(IPHeader, IPHeader->Protocol, Length);
+  PUSHORT Checksum;
+
+  if (IPHeader->Protocol == IPPROTO_TCP)
+      Checksum = &((PTCPv4_HEADER)Data)->Checksum;
+  else if (IPHeader->Protocol == IPPROTO_UDP)
+      Checksum = &((PUDP_HEADER)Data)->Checksum;
+  else
+      return;
+
+  *Checksum = 0;
+  *Checksum = (USHORT)IPv4Checksum(Data, Length, Seed);
+
+  /* A zero UDP checksum means none was computed */
+  if (*Checksum == 0 && IPHeader->Protocol == IPPROTO_UDP)
+      *Checksum = 0xFFFF;
+}
@@ -133,7 +133,12 @@ VOID NBTimeout(VOID)
                     /* We haven't gotten a packet from them in
                      * EventCount seconds so we mark them as stale
                      * and solicit now */
-                    NCE->State |= NUD_STALE;
+                    if (!(NCE->State & NUD_STALE))
+                    {
+                        /* Routes through it have to be looked up again */
+                        NCE->State |= NUD_STALE;
+                        RouterInvalidateCache();
+                    }
                     NBSendSolicit(NCE);
                 }
                 if (NCE->EventTimer - NCE->EventCount == 0) {
@@ -359,6 +364,7 @@ VOID NBUpdateNeighbor(
 {
     KIRQL OldIrql;
     UINT HashValue;
+    UCHAR OldState;
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X)  LinkAddress (0x%X)  State (0x%X).\n", NCE, LinkAddress, State));
 
@@ -371,11 +377,16 @@ VOID NBUpdateNeighbor(
     TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
 
     RtlCopyMemory(NCE->LinkAddress, LinkAddress, NCE->LinkAddressLength);
+    OldState = NCE->State;
     NCE->State = State;
     NCE->EventCount = 0;
 
     TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
 
+    /* A router that came back may be preferred over the one lookups fell back to */
+    if ((OldState ^ State) & (NUD_STALE | NUD_INCOMPLETE))
+        RouterInvalidateCache();
+
     if( !(NCE->State & NUD_INCOMPLETE) )
     {
         if (NCE->EventTimer) NCE->EventTimer = ARP_COMPLETE_TIMEOUT;
@@ -17,6 +17,199 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* IPv4 routes are also indexed by a path-compressed binary trie on their
+ * network prefix, so a lookup only visits the prefixes of the destination
+ * instead of the whole FIB. Nodes without routes only exist to branch. */
+typedef struct _FIB_NODE {
+    struct _FIB_NODE *Child[2];   /* Subtrees, indexed by the bit following the prefix */
+    ULONG Prefix;                 /* Network prefix in host order, host bits cleared */
+    UINT PrefixLength;            /* Number of significant bits in Prefix */
+    LIST_ENTRY RouteListHead;     /* FIB entries for exactly this prefix */
+} FIB_NODE, *PFIB_NODE;
+
+static PFIB_NODE FIBTrieRoot;
+
+/* Small direct-mapped cache of recent lookups. Any FIB change, and any router
+ * becoming reachable or unreachable, bumps the generation, which invalidates
+ * every cached entry at once */
+#define ROUTE_CACHE_SIZE 64
+
+typedef struct _ROUTE_CACHE_ENTRY {
+    IPv4_RAW_ADDRESS Destination; /* Destination address (network order) */
+    LONG Generation;              /* FIB generation the entry was looked up in */
+    PFIB_ENTRY FIBE;              /* Route selected for the destination */
+} ROUTE_CACHE_ENTRY, *PROUTE_CACHE_ENTRY;
+
+static ROUTE_CACHE_ENTRY RouteCache[ROUTE_CACHE_SIZE];
+static LONG FIBGeneration = 1;
+
+#define FIB_PREFIX_MASK(Length) ((Length) ? (0xFFFFFFFF << (32 - (Length))) : 0)
+#define FIB_PREFIX_BIT(Address, Index) (((Address) >> (31 - (Index))) & 1)
+
+static __inline BOOLEAN FIBRouteUsable(PFIB_ENTRY FIBE)
+{
+    return !(FIBE->Router->State & (NUD_STALE | NUD_INCOMPLETE));
+}
+
+static PFIB_NODE FIBAllocateNode(ULONG Prefix, UINT PrefixLength)
+{
+    PFIB_NODE Node;
+
+    Node = ExAllocatePoolWithTag(NonPagedPool, sizeof(FIB_NODE), FIB_NODE_TAG);
+    if (!Node)
+        return NULL;
+
+    Node->Child[0] = Node->Child[1] = NULL;
+    Node->Prefix = Prefix;
+    Node->PrefixLength = PrefixLength;
+    InitializeListHead(&Node->RouteListHead);
+
+    return Node;
+}
+
+static PFIB_NODE FIBTrieInsert(ULONG Prefix, UINT PrefixLength)
+/*
+ * FUNCTION: Finds or creates the trie node for a prefix
+ * ARGUMENTS:
+ *     Prefix       = Network prefix in host order
+ *     PrefixLength = Number of significant bits in Prefix
+ * RETURNS:
+ *     Pointer to trie node, NULL if out of memory
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE *Link = &FIBTrieRoot;
+    PFIB_NODE Node, NewNode, Branch;
+    UINT Common = 0;
+
+    Prefix &= FIB_PREFIX_MASK(PrefixLength);
+
+    while ((Node = *Link) != NULL) {
+        /* Count the leading bits shared with this node */
+        for (Common = 0;
+             Common < MIN(Node->PrefixLength, PrefixLength) &&
+             FIB_PREFIX_BIT(Node->Prefix, Common) == FIB_PREFIX_BIT(Prefix, Common);
+             Common++);
+
+        if (Common != Node->PrefixLength)
+            break;
+
+        if (Node->PrefixLength == PrefixLength)
+            return Node;
+
+        Link = &Node->Child[FIB_PREFIX_BIT(Prefix, Node->PrefixLength)];
+    }
+
+    NewNode = FIBAllocateNode(Prefix, PrefixLength);
+    if (!NewNode)
+        return NULL;
+
+    if (!Node) {
+        *Link = NewNode;
+    } else if (Common == PrefixLength) {
+        /* The new prefix covers the node, so it goes above it */
+        NewNode->Child[FIB_PREFIX_BIT(Node->Prefix, PrefixLength)] = Node;
+        *Link = NewNode;
+    } else {
+        /* The prefixes diverge, so they need a common branch node */
+        Branch = FIBAllocateNode(Prefix & FIB_PREFIX_MASK(Common), Common);
+        if (!Branch) {
+            ExFreePoolWithTag(NewNode, FIB_NODE_TAG);
+            return NULL;
+        }
+        Branch->Child[FIB_PREFIX_BIT(Prefix, Common)] = NewNode;
+        Branch->Child[FIB_PREFIX_BIT(Node->Prefix, Common)] = Node;
+        *Link = Branch;
+    }
+
+    return NewNode;
+}
+
+static VOID FIBTrieRemove(PFIB_NODE Target)
+/*
+ * FUNCTION: Removes a trie node that no longer holds any route
+ * ARGUMENTS:
+ *     Target = Pointer to trie node
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE *Link = &FIBTrieRoot, *ParentLink = NULL;
+    PFIB_NODE Parent;
+
+    ASSERT(IsListEmpty(&Target->RouteListHead));
+
+    /* A node with two subtrees still has to branch */
+    if (Target->Child[0] && Target->Child[1])
+        return;
+
+    while (*Link != Target) {
+        ASSERT(*Link);
+        ParentLink = Link;
+        Link = &(*Link)->Child[FIB_PREFIX_BIT(Target->Prefix, (*Link)->PrefixLength)];
+    }
+
+    *Link = Target->Child[0] ? Target->Child[0] : Target->Child[1];
+    ExFreePoolWithTag(Target, FIB_NODE_TAG);
+
+    /* If that left a route-less parent with a single subtree, fold it too */
+    if (ParentLink && *Link == NULL) {
+        Parent = *ParentLink;
+        if (IsListEmpty(&Parent->RouteListHead)) {
+            *ParentLink = Parent->Child[0] ? Parent->Child[0] : Parent->Child[1];
+            ExFreePoolWithTag(Parent, FIB_NODE_TAG);
+        }
+    }
+}
+
+static PFIB_ENTRY FIBTrieLookup(ULONG Destination)
+/*
+ * FUNCTION: Finds the longest matching prefix route for a destination
+ * ARGUMENTS:
+ *     Destination = Destination address in host order
+ * RETURNS:
+ *     Pointer to FIB entry, NULL if no route matches
+ * NOTES:
+ *     Routes through a stale or incomplete router are only used when no
+ *     matching prefix has a better one. Within a prefix, the lowest
+ *     metric wins. The forward information base lock must be held
+ */
+{
+    PFIB_NODE Node = FIBTrieRoot;
+    PLIST_ENTRY CurrentEntry;
+    PFIB_ENTRY Current, Best = NULL, BestUsable = NULL, NodeBest, NodeUsable;
+
+    while (Node && (Destination & FIB_PREFIX_MASK(Node->PrefixLength)) == Node->Prefix) {
+        NodeBest = NodeUsable = NULL;
+
+        CurrentEntry = Node->RouteListHead.Flink;
+        while (CurrentEntry != &Node->RouteListHead) {
+            Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, NodeEntry);
+
+            if (!NodeBest || Current->Metric < NodeBest->Metric)
+                NodeBest = Current;
+            if (FIBRouteUsable(Current) &&
+                (!NodeUsable || Current->Metric < NodeUsable->Metric))
+                NodeUsable = Current;
+
+            CurrentEntry = CurrentEntry->Flink;
+        }
+
+        if (NodeBest)
+            Best = NodeBest;
+        if (NodeUsable)
+            BestUsable = NodeUsable;
+
+        if (Node->PrefixLength == 32)
+            break;
+
+        Node = Node->Child[FIB_PREFIX_BIT(Destination, Node->PrefixLength)];
+    }
+
+    return BestUsable ? BestUsable : Best;
+}
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -69,6 +262,15 @@ VOID DestroyFIBE(
     /* Unlink the FIB entry from the list */
     RemoveEntryList(&FIBE->ListEntry);
 
+    /* And from the trie */
+    if (FIBE->Node) {
+        RemoveEntryList(&FIBE->NodeEntry);
+        if (IsListEmpty(&FIBE->Node->RouteListHead))
+            FIBTrieRemove(FIBE->Node);
+    }
+
+    RouterInvalidateCache();
+
     /* And free the FIB entry */
     FreeFIB(FIBE);
 }
@@ -207,6 +409,7 @@ PFIB_ENTRY RouterAddRoute(
  */
 {
     PFIB_ENTRY FIBE;
+    KIRQL OldIrql;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
         "Router (0x%X)  Metric (%d).\n", NetworkAddress, Netmask, Router, Metric));
@@ -228,14 +431,44 @@ PFIB_ENTRY RouterAddRoute(
 		   sizeof(FIBE->Netmask) );
     FIBE->Router         = Router;
     FIBE->Metric         = Metric;
+    FIBE->Node           = NULL;
+
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+
+    /* Index IPv4 routes by prefix */
+    if (NetworkAddress->Type == IP_ADDRESS_V4) {
+        FIBE->Node = FIBTrieInsert(IPv4NToHl(NetworkAddress->Address.IPv4Address),
+                                   AddrCountPrefixBits(Netmask));
+        if (!FIBE->Node) {
+            TcpipReleaseSpinLock(&FIBLock, OldIrql);
+            TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+            FreeFIB(FIBE);
+            return NULL;
+        }
+        InsertTailList(&FIBE->Node->RouteListHead, &FIBE->NodeEntry);
+    }
 
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    RouterInvalidateCache();
+
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
 
 
+VOID RouterInvalidateCache(VOID)
+/*
+ * FUNCTION: Forgets every cached route lookup
+ * NOTES:
+ *     Called whenever the route a lookup would pick may have changed
+ */
+{
+    InterlockedIncrement(&FIBGeneration);
+}
+
+
 PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 /*
  * FUNCTION: Finds a router to use to get to Destination
@@ -254,6 +487,7 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
     UCHAR State;
     UINT Length, BestLength = 0, MaskLength;
     PNEIGHBOR_CACHE_ENTRY NCE, BestNCE = NULL;
+    PROUTE_CACHE_ENTRY Cache;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
 
@@ -261,6 +495,33 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
 
+    if (Destination->Type == IP_ADDRESS_V4) {
+        Cache = &RouteCache[(Destination->Address.IPv4Address ^
+                             (Destination->Address.IPv4Address >> 16) ^
+                             (Destination->Address.IPv4Address >> 8)) & (ROUTE_CACHE_SIZE - 1)];
+
+        /* Reuse the last lookup for this destination unless its router went bad */
+        if (Cache->Generation == FIBGeneration &&
+            Cache->Destination == Destination->Address.IPv4Address &&
+            FIBRouteUsable(Cache->FIBE)) {
+            Current = Cache->FIBE;
+        } else {
+            Current = FIBTrieLookup(IPv4NToHl(Destination->Address.IPv4Address));
+            if (Current) {
+                Cache->Destination = Destination->Address.IPv4Address;
+                Cache->Generation = FIBGeneration;
+                Cache->FIBE = Current;
+            }
+        }
+
+        if (Current)
+            BestNCE = Current->Router;
+
+        TcpipReleaseSpinLock(&FIBLock, OldIrql);
+
+        goto done;
+    }
+
     CurrentEntry = FIBListHead.Flink;
     while (CurrentEntry != &FIBListHead) {
         NextEntry = CurrentEntry->Flink;
@@ -288,6 +549,7 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
+done:
     if( BestNCE ) {
 	TI_DbgPrint(DEBUG_ROUTER,("Routing to %s\n", A2S(&BestNCE->Address)));
     } else {
@@ -112,9 +112,10 @@ BOOLEAN PrepareNextFragment(
 
         /* FIXME: Handle options */
 
-        /* Calculate checksum of IP header */
+        /* Calculate checksum of IP header, unless the adapter does it */
         Header->Checksum = 0;
-        Header->Checksum = (USHORT)IPv4Checksum(Header, IFC->HeaderSize, 0);
+        if (!IFC->Offload.Transmit.NdisPacketIpChecksum)
+            Header->Checksum = (USHORT)IPv4Checksum(Header, IFC->HeaderSize, 0);
 	TI_DbgPrint(MID_TRACE,("IP Check: %x\n", Header->Checksum));
 
         /* Update pointers */
@@ -196,6 +197,21 @@ NTSTATUS SendFragments(
 
     RtlCopyMemory( IFC->Header, IPPacket->Header, IPPacket->HeaderSize );
 
+    /* Checksum offload only works on unfragmented datagrams */
+    IFC->Offload.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                     TcpIpChecksumPacketInfo));
+    if (IFC->Offload.Value != 0)
+    {
+        if (IFC->BytesLeft > PathMTU - IFC->HeaderSize)
+        {
+            IPv4CompleteChecksum(IPPacket->Header, IPPacket->HeaderSize, IPPacket->TotalSize);
+            IFC->Offload.Value = 0;
+        }
+
+        NDIS_PER_PACKET_INFO_FROM_PACKET(IFC->NdisPacket, TcpIpChecksumPacketInfo) =
+            UlongToPtr(IFC->Offload.Value);
+    }
+
     while (PrepareNextFragment(IFC))
     {
         NdisStatus = IPSendFragment(IFC->NdisPacket, NCE, IFC);
@@ -220,6 +236,57 @@ NTSTATUS SendFragments(
     return NdisStatus;
 }
 
+BOOLEAN IPOffloadChecksum(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
+/*
+ * FUNCTION: Leaves the transport checksum of a datagram to the adapter
+ * ARGUMENTS:
+ *     Interface = Pointer to interface the datagram will be sent on
+ *     IPPacket  = Pointer to a complete TCP or UDP datagram
+ * RETURNS:
+ *     TRUE if the adapter will compute the checksum, FALSE if the
+ *     caller has to compute it
+ * NOTES:
+ *     The checksum field is seeded with the pseudo header sum
+ */
+{
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+    PIPv4_HEADER Header = IPPacket->Header;
+    PUSHORT Checksum;
+
+    if (IPPacket->Type != IP_ADDRESS_V4 || IPPacket->TotalSize > Interface->MTU)
+        return FALSE;
+
+    ChecksumInfo.Value = 0;
+    ChecksumInfo.Transmit.NdisPacketChecksumV4 = 1;
+
+    if (Header->Protocol == IPPROTO_TCP && (Interface->Offload & IP_OFFLOAD_TX_TCP_CHECKSUM))
+    {
+        Checksum = &((PTCPv4_HEADER)((PUCHAR)Header + IPPacket->HeaderSize))->Checksum;
+        ChecksumInfo.Transmit.NdisPacketTcpChecksum = 1;
+    }
+    else if (Header->Protocol == IPPROTO_UDP && (Interface->Offload & IP_OFFLOAD_TX_UDP_CHECKSUM))
+    {
+        Checksum = &((PUDP_HEADER)((PUCHAR)Header + IPPacket->HeaderSize))->Checksum;
+        ChecksumInfo.Transmit.NdisPacketUdpChecksum = 1;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    if (Interface->Offload & IP_OFFLOAD_TX_IP_CHECKSUM)
+        ChecksumInfo.Transmit.NdisPacketIpChecksum = 1;
+
+    *Checksum = IPv4PseudoHeaderChecksum(Header,
+                                         Header->Protocol,
+                                         IPPacket->TotalSize - IPPacket->HeaderSize);
+
+    NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket, TcpIpChecksumPacketInfo) =
+        UlongToPtr(ChecksumInfo.Value);
+
+    return TRUE;
+}
+
 NTSTATUS IPSendDatagram(PIP_PACKET IPPacket, PNEIGHBOR_CACHE_ENTRY NCE)
 /*
  * FUNCTION: Sends an IP datagram to a remote address
@@ -85,7 +85,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
                     UnlockObject(Connection);
                     return STATUS_TOO_MANY_ADDRESSES;
                 }
-                Connection->AddressFile->Port = AllocatedPort;
+                AddrFileSetPort(Connection->AddressFile, AllocatedPort);
             }
         }
     }
@@ -71,6 +71,15 @@ TCPSendDataCallback(struct netif *netif, struct pbuf *p, const ip4_addr_t *dest)
     Packet.SrcAddr = LocalAddress;
     Packet.DstAddr = RemoteAddress;
 
+    /* lwIP skipped the checksum, so either the adapter does it or we do.
+     * The route may well lead through another interface than this netif */
+    if (Header->Protocol == IPPROTO_TCP &&
+        !NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_TCP) &&
+        !IPOffloadChecksum(NCE->Interface, &Packet))
+    {
+        IPv4CompleteChecksum(Packet.Header, Packet.HeaderSize, Packet.TotalSize);
+    }
+
     NdisStatus = IPSendDatagram(&Packet, NCE);
     if (!NT_SUCCESS(NdisStatus))
         return ERR_RTE;
@@ -107,6 +116,13 @@ TCPInterfaceInit(struct netif *netif)
 
     netif->flags |= NETIF_FLAG_BROADCAST;
 
+    /* Loopback packets never need checksums. Otherwise the adapter may
+     * compute TCP checksums, see TCPSendDataCallback */
+    if (IF == Loopback)
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_DISABLE_ALL);
+    else if (IF->Offload & IP_OFFLOAD_TX_TCP_CHECKSUM)
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
+
     TCPUpdateInterfaceLinkStatus(IF);
 
     TCPUpdateInterfaceIPInformation(IF);
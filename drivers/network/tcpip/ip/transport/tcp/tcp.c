@@ -389,7 +389,7 @@ NTSTATUS TCPConnect
             UnlockObject(Connection);
             return STATUS_TOO_MANY_ADDRESSES;
         }
-        Connection->AddressFile->Port = AllocatedPort;
+        AddrFileSetPort(Connection->AddressFile, AllocatedPort);
     }
 
     connaddr.addr = RemoteAddress.Address.IPv4Address;
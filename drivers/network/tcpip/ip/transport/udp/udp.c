@@ -15,6 +15,7 @@ PORT_SET UDPPorts;
 
 NTSTATUS AddUDPHeaderIPv4(
     PADDRESS_FILE AddrFile,
+    PIP_INTERFACE Interface,
     PIP_ADDRESS RemoteAddress,
     USHORT RemotePort,
     PIP_ADDRESS LocalAddress,
@@ -26,6 +27,7 @@ NTSTATUS AddUDPHeaderIPv4(
  * FUNCTION: Adds an IPv4 and UDP header to an IP packet
  * ARGUMENTS:
  *     SendRequest  = Pointer to send request
+ *     Interface    = Pointer to interface the datagram will be sent on
  *     LocalAddress = Pointer to our local address
  *     LocalPort    = The port we send this datagram from
  *     IPPacket     = Pointer to IP packet
@@ -61,10 +63,14 @@ NTSTATUS AddUDPHeaderIPv4(
 
     RtlCopyMemory(IPPacket->Data, Data, DataLength);
 
-    UDPHeader->Checksum = UDPv4ChecksumCalculate((PIPv4_HEADER)IPPacket->Header,
-                                                 (PUCHAR)UDPHeader,
-                                                 DataLength + sizeof(UDP_HEADER));
-    UDPHeader->Checksum = WH2N(UDPHeader->Checksum);
+    /* Leave the checksum to the adapter if it can do it */
+    if (!IPOffloadChecksum(Interface, IPPacket))
+    {
+        UDPHeader->Checksum = UDPv4ChecksumCalculate((PIPv4_HEADER)IPPacket->Header,
+                                                     (PUCHAR)UDPHeader,
+                                                     DataLength + sizeof(UDP_HEADER));
+        UDPHeader->Checksum = WH2N(UDPHeader->Checksum);
+    }
 
     TI_DbgPrint(MID_TRACE, ("Packet: %d ip %d udp %d payload\n",
 			    (PCHAR)UDPHeader - (PCHAR)IPPacket->Header,
@@ -77,6 +83,7 @@ NTSTATUS AddUDPHeaderIPv4(
 
 NTSTATUS BuildUDPPacket(
     PADDRESS_FILE AddrFile,
+    PIP_INTERFACE Interface,
     PIP_PACKET Packet,
     PIP_ADDRESS RemoteAddress,
     USHORT RemotePort,
@@ -88,6 +95,7 @@ NTSTATUS BuildUDPPacket(
  * FUNCTION: Builds an UDP packet
  * ARGUMENTS:
  *     Context      = Pointer to context information (DATAGRAM_SEND_REQUEST)
+ *     Interface    = Pointer to interface the packet will be sent on
  *     LocalAddress = Pointer to our local address
  *     LocalPort    = The port we send this datagram from
  *     IPPacket     = Address of pointer to IP packet
@@ -121,7 +129,7 @@ NTSTATUS BuildUDPPacket(
 
     switch (RemoteAddress->Type) {
         case IP_ADDRESS_V4:
-            Status = AddUDPHeaderIPv4(AddrFile, RemoteAddress, RemotePort,
+            Status = AddUDPHeaderIPv4(AddrFile, Interface, RemoteAddress, RemotePort,
                                       LocalAddress, LocalPort, Packet, DataBuffer, DataLen);
             break;
         case IP_ADDRESS_V6:
@@ -214,6 +222,7 @@ NTSTATUS UDPSendDatagram(
     }
 
     Status = BuildUDPPacket( AddrFile,
+							 NCE->Interface,
 							 &Packet,
 							 &RemoteAddress,
 							 RemotePort,
@@ -278,14 +287,17 @@ VOID UDPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
 
   UDPHeader = (PUDP_HEADER)IPPacket->Data;
 
-  /* Calculate and validate UDP checksum */
-  i = UDPv4ChecksumCalculate(IPv4Header,
-                             (PUCHAR)UDPHeader,
-                             WH2N(UDPHeader->Length));
-  if (i != DH2N(0x0000FFFF) && UDPHeader->Checksum != 0)
+  /* Calculate and validate UDP checksum, unless the adapter already did */
+  if (!(IPPacket->Flags & IP_PACKET_FLAG_UDP_CSUM))
   {
-      TI_DbgPrint(MIN_TRACE, ("Bad checksum on packet received.\n"));
-      return;
+      i = UDPv4ChecksumCalculate(IPv4Header,
+                                 (PUCHAR)UDPHeader,
+                                 WH2N(UDPHeader->Length));
+      if (i != DH2N(0x0000FFFF) && UDPHeader->Checksum != 0)
+      {
+          TI_DbgPrint(MIN_TRACE, ("Bad checksum on packet received.\n"));
+          return;
+      }
   }
 
   /* Sanity checks */
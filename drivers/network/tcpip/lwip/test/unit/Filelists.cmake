@@ -36,3 +36,16 @@ set(LWIP_TESTFILES
 	${LWIP_TESTDIR}/udp/test_udp.c
 	${LWIP_TESTDIR}/ppp/test_pppos.c
 )
+
+# The TCP throughput tests need the TCP settings of the ReactOS tcpip driver
+# and its receive window auto-tuning, so they get their own runner: build it
+# with LWIP_TESTS_TCPIP_DRIVER defined and LWIP_TCPIP_TESTINCLUDES added to the
+# include path (modules/rostests/unittests/lwip does).
+set(LWIP_TCPIP_TESTFILES
+	${LWIP_TESTDIR}/lwip_unittests.c
+	${LWIP_TESTDIR}/arch/sys_arch.c
+	${LWIP_TESTDIR}/tcp/tcp_helper.c
+	${LWIP_TESTDIR}/tcp/test_tcp_throughput.c
+	${LWIP_DIR}/../ip/lwip_glue/rcvwnd.c
+)
+set(LWIP_TCPIP_TESTINCLUDES ${LWIP_DIR}/../include/lwip)
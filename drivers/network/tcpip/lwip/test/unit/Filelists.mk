@@ -52,3 +52,12 @@ TESTFILES=$(TESTDIR)/lwip_unittests.c \
 	$(TESTDIR)/udp/test_udp.c \
 	$(TESTDIR)/ppp/test_pppos.c
 
+# The TCP throughput tests need the TCP settings of the ReactOS tcpip driver
+# and its receive window auto-tuning, so they get their own runner, built with
+# TCPIP_TESTFLAGS.
+TCPIP_TESTFILES=$(TESTDIR)/lwip_unittests.c \
+	$(TESTDIR)/arch/sys_arch.c \
+	$(TESTDIR)/tcp/tcp_helper.c \
+	$(TESTDIR)/tcp/test_tcp_throughput.c \
+	$(LWIPDIR)/../../ip/lwip_glue/rcvwnd.c
+TCPIP_TESTFLAGS=-DLWIP_TESTS_TCPIP_DRIVER -I$(LWIPDIR)/../../include/lwip
@@ -6,6 +6,7 @@
 #include "tcp/test_tcp.h"
 #include "tcp/test_tcp_oos.h"
 #include "tcp/test_tcp_state.h"
+#include "tcp/test_tcp_throughput.h"
 #include "core/test_def.h"
 #include "core/test_dns.h"
 #include "core/test_mem.h"
@@ -75,6 +76,9 @@ int main(void)
   SRunner *sr;
   size_t i;
   suite_getter_fn* suites[] = {
+#ifdef LWIP_TESTS_TCPIP_DRIVER
+    tcp_throughput_suite
+#else /* LWIP_TESTS_TCPIP_DRIVER */
     ip4_suite,
     ip6_suite,
     udp_suite,
@@ -95,6 +99,7 @@ int main(void)
 #if PPP_SUPPORT && PPPOS_SUPPORT
     , pppos_suite
 #endif /* PPP_SUPPORT && PPPOS_SUPPORT */
+#endif /* LWIP_TESTS_TCPIP_DRIVER */
   };
   size_t num = sizeof(suites)/sizeof(void*);
   LWIP_ASSERT("No suites defined", num > 0);
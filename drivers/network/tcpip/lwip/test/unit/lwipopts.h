@@ -58,6 +58,15 @@
 #define LWIP_DNS                        1
 #define LWIP_DNS_SECURE (LWIP_DNS_SECURE_RAND_XID | LWIP_DNS_SECURE_RAND_SRC_PORT)
 
+#ifdef LWIP_TESTS_TCPIP_DRIVER
+/* The TCP throughput tests run with the TCP settings of the ReactOS tcpip
+   driver, over Ethernet sized segments (see Filelists.cmake) */
+#include "lwiptcpopts.h"
+#define TCP_MSS                         TCP_ETHERNET_MSS
+#define MEMP_NUM_TCP_SEG                TCP_SND_QUEUELEN
+#define MEM_SIZE                        (4 * TCP_SND_BUF)
+#define PBUF_POOL_SIZE                  (4 * TCP_WND / TCP_MSS)
+#else /* LWIP_TESTS_TCPIP_DRIVER */
 /* Minimal changes to opt.h required for tcp unit tests: */
 #define MEM_SIZE                        16000
 #define TCP_SND_QUEUELEN                40
@@ -67,6 +76,7 @@
 #define LWIP_WND_SCALE                  1
 #define TCP_RCV_SCALE                   0
 #define PBUF_POOL_SIZE                  400 /* pbuf tests need ~200KByte */
+#endif /* LWIP_TESTS_TCPIP_DRIVER */
 
 /* Enable IGMP and MDNS for MDNS tests */
 #define LWIP_IGMP                       1
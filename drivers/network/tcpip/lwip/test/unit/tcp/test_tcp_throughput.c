@@ -0,0 +1,568 @@
+#include "test_tcp_throughput.h"
+
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/stats.h"
+#include "lwip/ip4.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "tcp_helper.h"
+#include "rcvwnd.h"
+
+#if !LWIP_STATS || !TCP_STATS || !MEMP_STATS
+#error "This tests needs TCP- and MEMP-statistics enabled"
+#endif
+#ifndef LWIP_TESTS_TCPIP_DRIVER
+#error "This tests needs the TCP settings of the tcpip driver, see Filelists.cmake"
+#endif
+
+/* Two endpoints talking over an emulated link: each end has its own netif
+   and its pcbs are bound to it. Whatever is sent out of one of the netifs is
+   delivered into the other one after LINK_DELAY_MS, so data from the client
+   to the server and the ACKs going back each take that long. */
+#define LINK_DELAY_MS   50
+#define LINK_RTT_MS     (2 * LINK_DELAY_MS)
+#define LINK_QUEUE_LEN  1024
+
+#define SERVER_PORT     0x2000
+#define CLIENT_PORT     0x3000
+#define MAX_CLIENTS     2
+
+/* Best throughput a window limited connection can achieve per round trip */
+#define TEST_WND        LWIP_MIN(TCP_WND, TCP_SND_BUF)
+
+struct link_packet {
+  struct pbuf *p;
+  struct netif *inp;
+  u32_t due;
+};
+
+static struct link_packet link_queue[LINK_QUEUE_LEN];
+static u32_t link_head;
+static u32_t link_tail;
+static u32_t link_now;
+static u32_t link_drop_data;
+static u32_t link_sack_acks;
+
+static struct netif client_netif;
+static struct netif server_netif;
+static ip_addr_t client_ip = IPADDR4_INIT_BYTES(192, 168, 1, 1);
+static ip_addr_t server_ip = IPADDR4_INIT_BYTES(192, 168, 2, 1);
+static ip_addr_t link_netmask = IPADDR4_INIT_BYTES(255, 255, 255, 0);
+
+static struct tcp_pcb *client_pcbs[MAX_CLIENTS];
+static u32_t client_connected;
+static struct tcp_pcb *server_pcb;
+static u32_t server_accepted;
+
+static u32_t tx_offset;
+static u32_t rx_offset;
+static u32_t rx_bad;
+
+/* Receiver side application settings: with rx_tuning the window is managed
+   like the tcpip driver does it, with rx_rate the application only consumes
+   that many bytes per ms (0: all of it right away) */
+static u8_t rx_tuning;
+static u32_t rx_rate;
+static u32_t rx_pending;
+static RCV_WND_TUNING rx_tuning_state;
+
+static u8_t test_tcp_timer;
+
+static u8_t
+stream_byte(u32_t offset)
+{
+  /* not a power of two, so reordered or duplicated data can't go unnoticed */
+  return (u8_t)(offset % 251);
+}
+
+/* Returns 1 if the TCP header of p carries a SACK option */
+static int
+link_has_sack(struct pbuf *p)
+{
+  u8_t hdr[IP_HLEN + TCP_HLEN + 40];
+  u16_t len, iphlen, tcphlen, i;
+
+  len = pbuf_copy_partial(p, hdr, sizeof(hdr), 0);
+  if (len < IP_HLEN) {
+    return 0;
+  }
+  iphlen = (u16_t)((hdr[0] & 0x0f) * 4);
+  if (len < iphlen + TCP_HLEN) {
+    return 0;
+  }
+  tcphlen = (u16_t)((hdr[iphlen + 12] >> 4) * 4);
+  for (i = iphlen + TCP_HLEN; (i < iphlen + tcphlen) && (i < len); ) {
+    if (hdr[i] == LWIP_TCP_OPT_EOL) {
+      break;
+    } else if (hdr[i] == LWIP_TCP_OPT_NOP) {
+      i++;
+    } else if (hdr[i] == 5) {
+      return 1;
+    } else if (i + 1 < len) {
+      i = (u16_t)(i + LWIP_MAX(hdr[i + 1], 2));
+    } else {
+      break;
+    }
+  }
+  return 0;
+}
+
+/* Returns the TCP payload length of an IPv4 packet */
+static u16_t
+link_payload_len(struct pbuf *p)
+{
+  u8_t hdr[IP_HLEN + TCP_HLEN];
+  u16_t iphlen;
+
+  if (pbuf_copy_partial(p, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+    return 0;
+  }
+  iphlen = (u16_t)((hdr[0] & 0x0f) * 4);
+  return (u16_t)(p->tot_len - iphlen - (hdr[iphlen + 12] >> 4) * 4);
+}
+
+static err_t
+link_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+  struct pbuf *q;
+  LWIP_UNUSED_ARG(ipaddr);
+
+  if (netif == &server_netif) {
+    /* ACKs from the server */
+    if (link_has_sack(p)) {
+      link_sack_acks++;
+    }
+  } else if (link_drop_data && (link_payload_len(p) > 0)) {
+    /* data from a client, lost on the way */
+    link_drop_data--;
+    return ERR_OK;
+  }
+
+  EXPECT_RETX(link_tail - link_head < LINK_QUEUE_LEN, ERR_OK);
+  q = pbuf_clone(PBUF_RAW, PBUF_POOL, p);
+  EXPECT_RETX(q != NULL, ERR_OK);
+
+  link_queue[link_tail % LINK_QUEUE_LEN].p = q;
+  link_queue[link_tail % LINK_QUEUE_LEN].inp = (netif == &client_netif) ? &server_netif : &client_netif;
+  link_queue[link_tail % LINK_QUEUE_LEN].due = link_now + LINK_DELAY_MS;
+  link_tail++;
+  return ERR_OK;
+}
+
+static void
+link_init_netif(struct netif *netif, const ip_addr_t *ip_addr, u8_t num)
+{
+  memset(netif, 0, sizeof(struct netif));
+  netif->num = num;
+  netif->output = link_output;
+  netif->flags |= NETIF_FLAG_UP | NETIF_FLAG_LINK_UP;
+  ip_addr_copy_from_ip4(netif->netmask, *ip_2_ip4(&link_netmask));
+  ip_addr_copy_from_ip4(netif->ip_addr, *ip_2_ip4(ip_addr));
+  netif->next = netif_list;
+  netif_list = netif;
+}
+
+static void
+link_flush(void)
+{
+  while (link_head != link_tail) {
+    pbuf_free(link_queue[link_head % LINK_QUEUE_LEN].p);
+    link_head++;
+  }
+}
+
+/* Sender side application: keep the send buffer full */
+static void
+client_fill(struct tcp_pcb *pcb)
+{
+  u8_t buf[TCP_MSS];
+  u16_t len, i;
+
+  while ((len = (u16_t)LWIP_MIN(tcp_sndbuf(pcb), sizeof(buf))) > 0) {
+    for (i = 0; i < len; i++) {
+      buf[i] = stream_byte(tx_offset + i);
+    }
+    if (tcp_write(pcb, buf, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+      break;
+    }
+    tx_offset += len;
+  }
+  tcp_output(pcb);
+}
+
+static err_t
+client_connected_fn(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(pcb);
+  EXPECT(err == ERR_OK);
+  client_connected++;
+  return ERR_OK;
+}
+
+/* Give consumed data back to the receive window */
+static void
+server_consume(struct tcp_pcb *pcb, u32_t len)
+{
+  u16_t chunk;
+
+  if (rx_tuning) {
+    /* the emulated time counts in ms */
+    len += RcvWndUpdate(&rx_tuning_state, pcb, len, link_now);
+  }
+  while (len != 0) {
+    chunk = (u16_t)LWIP_MIN(len, 0xffff);
+    tcp_recved(pcb, chunk);
+    len -= chunk;
+  }
+}
+
+/* Receiver side application: check the data and consume it at rx_rate */
+static err_t
+server_recv_fn(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  struct pbuf *q;
+  u16_t i;
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  if (p == NULL) {
+    return ERR_OK;
+  }
+  for (q = p; q != NULL; q = q->next) {
+    for (i = 0; i < q->len; i++) {
+      if (((u8_t *)q->payload)[i] != stream_byte(rx_offset)) {
+        rx_bad++;
+      }
+      rx_offset++;
+    }
+  }
+  if (rx_rate == 0) {
+    server_consume(pcb, p->tot_len);
+  } else {
+    rx_pending += p->tot_len;
+  }
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t
+server_accept_fn(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  EXPECT_RETX(err == ERR_OK, ERR_VAL);
+  tcp_recv(pcb, server_recv_fn);
+  if (rx_tuning) {
+    RcvWndInitialize(&rx_tuning_state, pcb, link_now);
+  }
+  server_pcb = pcb;
+  server_accepted++;
+  return ERR_OK;
+}
+
+/* Advance the emulated time: deliver due packets and run the TCP timers */
+static void
+link_run(u32_t ms, struct tcp_pcb *sender)
+{
+  struct link_packet *pkt;
+  u32_t chunk;
+
+  while (ms--) {
+    link_now++;
+    while ((link_head != link_tail) &&
+           ((s32_t)(link_queue[link_head % LINK_QUEUE_LEN].due - link_now) <= 0)) {
+      pkt = &link_queue[link_head % LINK_QUEUE_LEN];
+      link_head++;
+      ip4_input(pkt->p, pkt->inp);
+    }
+    if ((server_pcb != NULL) && (rx_pending != 0)) {
+      chunk = LWIP_MIN(rx_pending, rx_rate);
+      rx_pending -= chunk;
+      server_consume(server_pcb, chunk);
+    }
+    if ((link_now % TCP_TMR_INTERVAL) == 0) {
+      tcp_fasttmr();
+      if (++test_tcp_timer & 1) {
+        tcp_slowtmr();
+      }
+    }
+    if (sender != NULL) {
+      client_fill(sender);
+    }
+  }
+}
+
+static struct tcp_pcb *
+server_listen(u8_t backlog)
+{
+  struct tcp_pcb *pcb, *lpcb;
+
+  pcb = tcp_new();
+  EXPECT_RETNULL(pcb != NULL);
+  tcp_bind_netif(pcb, &server_netif);
+  EXPECT(tcp_bind(pcb, &server_ip, SERVER_PORT) == ERR_OK);
+  lpcb = tcp_listen_with_backlog(pcb, backlog);
+  EXPECT_RETNULL(lpcb != NULL);
+  tcp_accept(lpcb, server_accept_fn);
+  return lpcb;
+}
+
+static struct tcp_pcb *
+client_connect(u16_t port)
+{
+  struct tcp_pcb *pcb;
+
+  pcb = tcp_new();
+  EXPECT_RETNULL(pcb != NULL);
+  tcp_bind_netif(pcb, &client_netif);
+  EXPECT(tcp_bind(pcb, &client_ip, port) == ERR_OK);
+  EXPECT(tcp_connect(pcb, &server_ip, SERVER_PORT, client_connected_fn) == ERR_OK);
+  return pcb;
+}
+
+/* Sets up a connection and returns the client end */
+static struct tcp_pcb *
+test_tcp_throughput_open(void)
+{
+  struct tcp_pcb *listener, *client;
+
+  listener = server_listen(TCP_DEFAULT_LISTEN_BACKLOG);
+  EXPECT_RETNULL(listener != NULL);
+  client = client_connect(CLIENT_PORT);
+  EXPECT_RETNULL(client != NULL);
+  link_run(2 * LINK_RTT_MS, NULL);
+  EXPECT_RETNULL(client_connected == 1);
+  EXPECT_RETNULL(server_accepted == 1);
+  return client;
+}
+
+
+/* Setups/teardown functions */
+static struct netif *old_netif_list;
+static struct netif *old_netif_default;
+
+static void
+tcp_throughput_setup(void)
+{
+  old_netif_list = netif_list;
+  old_netif_default = netif_default;
+  netif_list = NULL;
+  netif_default = NULL;
+  tcp_remove_all();
+  lwip_check_ensure_no_alloc(SKIP_POOL(MEMP_SYS_TIMEOUT));
+
+  link_init_netif(&client_netif, &client_ip, 0);
+  link_init_netif(&server_netif, &server_ip, 1);
+  link_head = link_tail = 0;
+  link_now = 0;
+  link_drop_data = 0;
+  link_sack_acks = 0;
+  memset(client_pcbs, 0, sizeof(client_pcbs));
+  client_connected = 0;
+  server_pcb = NULL;
+  server_accepted = 0;
+  tx_offset = rx_offset = rx_bad = 0;
+  rx_tuning = 0;
+  rx_rate = rx_pending = 0;
+  memset(&rx_tuning_state, 0, sizeof(rx_tuning_state));
+  test_tcp_timer = 0;
+}
+
+static void
+tcp_throughput_teardown(void)
+{
+  link_flush();
+  /* no route for the RSTs sent while aborting the connections */
+  netif_list = NULL;
+  tcp_remove_all();
+  netif_list = old_netif_list;
+  netif_default = old_netif_default;
+  lwip_check_ensure_no_alloc(SKIP_POOL(MEMP_SYS_TIMEOUT));
+}
+
+
+/* Test functions */
+
+/** A bulk transfer over a long link is only limited by the window: check that
+ * window scaling gets negotiated, that the whole window is put to use and that
+ * the sender never has more in flight than the receiver offered. */
+START_TEST(test_tcp_throughput_window)
+{
+  struct tcp_pcb *client;
+  u32_t rtt, start, inflight, max_inflight = 0;
+  LWIP_UNUSED_ARG(_i);
+
+  client = test_tcp_throughput_open();
+  EXPECT_RET(client != NULL);
+  EXPECT_RET(server_pcb != NULL);
+
+#if LWIP_WND_SCALE
+  EXPECT(client->flags & TF_WND_SCALE);
+  EXPECT(server_pcb->flags & TF_WND_SCALE);
+  EXPECT(client->snd_scale == TCP_RCV_SCALE);
+  EXPECT(server_pcb->snd_scale == TCP_RCV_SCALE);
+#endif
+
+  /* let slow start open the congestion window */
+  for (rtt = 0; rtt < 20; rtt++) {
+    link_run(LINK_RTT_MS, client);
+  }
+
+  start = rx_offset;
+  for (rtt = 0; rtt < 10; rtt++) {
+    link_run(LINK_RTT_MS / 2, client);
+    inflight = client->snd_nxt - client->lastack;
+    max_inflight = LWIP_MAX(max_inflight, inflight);
+    link_run(LINK_RTT_MS / 2, client);
+  }
+
+  EXPECT(rx_bad == 0);
+  EXPECT(max_inflight <= TCP_WND);
+#if TCP_WND > 0xffff
+  /* more than an unscaled window could ever allow */
+  EXPECT(max_inflight > 0xffff);
+#endif
+  /* at least half of the best case (one window per round trip) */
+  EXPECT((rx_offset - start) / 10 >= TEST_WND / 2);
+}
+END_TEST
+
+/** Lose a data segment in the middle of a transfer: the receiver has to report
+ * the data it holds beyond the hole and the stream must recover without
+ * corruption. */
+START_TEST(test_tcp_throughput_loss)
+{
+  struct tcp_pcb *client;
+  u32_t rtt, lost_at;
+  LWIP_UNUSED_ARG(_i);
+
+  client = test_tcp_throughput_open();
+  EXPECT_RET(client != NULL);
+  EXPECT_RET(server_pcb != NULL);
+
+  for (rtt = 0; rtt < 20; rtt++) {
+    link_run(LINK_RTT_MS, client);
+  }
+
+  lost_at = rx_offset;
+  link_drop_data = 1;
+  for (rtt = 0; rtt < 20; rtt++) {
+    link_run(LINK_RTT_MS, client);
+  }
+
+  EXPECT(link_drop_data == 0);
+#if LWIP_TCP_SACK_OUT
+  EXPECT(link_sack_acks > 0);
+#endif
+  EXPECT(rx_bad == 0);
+  EXPECT(server_pcb->ooseq == NULL);
+  EXPECT(rx_offset - lost_at > 4 * TEST_WND);
+}
+END_TEST
+
+/** Let the receive window be auto-tuned like the tcpip driver does it: it has
+ * to start out unscaled and grow to the full TCP_WND for a reader that keeps
+ * up with the link. */
+START_TEST(test_tcp_throughput_tuning_fast)
+{
+  struct tcp_pcb *client;
+  u32_t rtt, inflight, max_inflight = 0;
+  LWIP_UNUSED_ARG(_i);
+
+  rx_tuning = 1;
+  client = test_tcp_throughput_open();
+  EXPECT_RET(client != NULL);
+  EXPECT_RET(server_pcb != NULL);
+  EXPECT(rx_tuning_state.Window == LWIP_MIN(TCP_WND, RCV_WND_INITIAL));
+
+  for (rtt = 0; rtt < 40; rtt++) {
+    link_run(LINK_RTT_MS / 2, client);
+    inflight = client->snd_nxt - client->lastack;
+    max_inflight = LWIP_MAX(max_inflight, inflight);
+    link_run(LINK_RTT_MS / 2, client);
+  }
+
+  EXPECT(rx_bad == 0);
+  /* about the round trip time of the link */
+  EXPECT(rx_tuning_state.Rtt >= LINK_RTT_MS);
+  EXPECT(rx_tuning_state.Rtt <= 2 * LINK_RTT_MS);
+  EXPECT(rx_tuning_state.Window == TCP_WND);
+  EXPECT(max_inflight <= rx_tuning_state.Window);
+#if TCP_WND > 0xffff
+  EXPECT(max_inflight > 0xffff);
+#endif
+}
+END_TEST
+
+/** A reader slower than the link must not make the window grow: the data it
+ * has yet to consume closes the window instead of piling up. */
+START_TEST(test_tcp_throughput_tuning_slow)
+{
+  struct tcp_pcb *client;
+  u32_t rtt, inflight, max_inflight = 0;
+  LWIP_UNUSED_ARG(_i);
+
+  rx_tuning = 1;
+  /* a tenth of the initial window per round trip */
+  rx_rate = RCV_WND_INITIAL / 10 / LINK_RTT_MS;
+  client = test_tcp_throughput_open();
+  EXPECT_RET(client != NULL);
+  EXPECT_RET(server_pcb != NULL);
+
+  for (rtt = 0; rtt < 40; rtt++) {
+    link_run(LINK_RTT_MS / 2, client);
+    inflight = client->snd_nxt - client->lastack;
+    max_inflight = LWIP_MAX(max_inflight, inflight);
+    link_run(LINK_RTT_MS / 2, client);
+  }
+
+  EXPECT(rx_bad == 0);
+  EXPECT(rx_tuning_state.Window == LWIP_MIN(TCP_WND, RCV_WND_INITIAL));
+  EXPECT(max_inflight <= RCV_WND_INITIAL);
+  /* what is buffered on the receiver never exceeds the window */
+  EXPECT(rx_pending <= RCV_WND_INITIAL);
+}
+END_TEST
+
+/** Connect several clients at once: the listener has to keep as many
+ * half-open connections as its backlog allows. */
+START_TEST(test_tcp_throughput_backlog)
+{
+  struct tcp_pcb *listener;
+  u32_t i;
+  LWIP_UNUSED_ARG(_i);
+
+  listener = server_listen(MAX_CLIENTS - 1);
+  EXPECT_RET(listener != NULL);
+  for (i = 0; i < MAX_CLIENTS; i++) {
+    client_pcbs[i] = client_connect((u16_t)(CLIENT_PORT + i));
+    EXPECT_RET(client_pcbs[i] != NULL);
+  }
+
+  /* less than the SYN retransmission timeout */
+  link_run(5 * LINK_RTT_MS, NULL);
+
+#if TCP_LISTEN_BACKLOG
+  EXPECT(server_accepted == MAX_CLIENTS - 1);
+  EXPECT(client_connected == MAX_CLIENTS - 1);
+#else
+  EXPECT(server_accepted == MAX_CLIENTS);
+  EXPECT(client_connected == MAX_CLIENTS);
+#endif
+}
+END_TEST
+
+
+/** Create the suite including all tests for this module */
+Suite *
+tcp_throughput_suite(void)
+{
+  testfunc tests[] = {
+    TESTFUNC(test_tcp_throughput_window),
+    TESTFUNC(test_tcp_throughput_loss),
+    TESTFUNC(test_tcp_throughput_tuning_fast),
+    TESTFUNC(test_tcp_throughput_tuning_slow),
+    TESTFUNC(test_tcp_throughput_backlog)
+  };
+  return create_suite("TCP_THROUGHPUT", tests, sizeof(tests)/sizeof(testfunc), tcp_throughput_setup, tcp_throughput_teardown);
+}
@@ -0,0 +1,8 @@
+#ifndef LWIP_HDR_TEST_TCP_THROUGHPUT_H
+#define LWIP_HDR_TEST_TCP_THROUGHPUT_H
+
+#include "../lwip_check.h"
+
+Suite *tcp_throughput_suite(void);
+
+#endif
@@ -21,10 +21,53 @@
 LIST_ENTRY AddressFileListHead;
 KSPIN_LOCK AddressFileListLock;
 
+/* Address files hashed by (protocol, port), also protected by AddressFileListLock.
+ * The local address is not part of the key: broadcast and unspecified destinations
+ * must reach every address file bound to the port, so AddrReceiveMatch still
+ * filters the (short) chain. */
+#define ADDRESS_FILE_HASH_SIZE 256
+static LIST_ENTRY AddressFileHashTable[ADDRESS_FILE_HASH_SIZE];
+
+static __inline PLIST_ENTRY AddrHashBucket(
+    USHORT Port,
+    USHORT Protocol)
+{
+    return &AddressFileHashTable[(Port ^ (Port >> 8) ^ Protocol) & (ADDRESS_FILE_HASH_SIZE - 1)];
+}
+
 /* List of all connection endpoint file objects managed by this driver */
 LIST_ENTRY ConnectionEndpointListHead;
 KSPIN_LOCK ConnectionEndpointListLock;
 
+VOID AddrInitializeHashTable(VOID)
+{
+    ULONG i;
+
+    for (i = 0; i < ADDRESS_FILE_HASH_SIZE; i++)
+        InitializeListHead(&AddressFileHashTable[i]);
+}
+
+/*
+ * FUNCTION: Changes the port of an address file and moves it to the matching hash chain
+ * ARGUMENTS:
+ *     AddrFile = Pointer to address file
+ *     Port     = New port number (network byte order)
+ */
+VOID AddrFileSetPort(
+    PADDRESS_FILE AddrFile,
+    USHORT Port)
+{
+    KIRQL OldIrql;
+
+    TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
+
+    RemoveEntryList(&AddrFile->HashEntry);
+    AddrFile->Port = Port;
+    InsertTailList(AddrHashBucket(Port, AddrFile->Protocol), &AddrFile->HashEntry);
+
+    TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
+}
+
 /*
  * FUNCTION: Searches through address file entries to find the first match
  * ARGUMENTS:
@@ -49,10 +92,12 @@ PADDRESS_FILE AddrSearchFirst(
 
     TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
 
-    SearchContext->Next = AddressFileListHead.Flink;
+    /* Only address files bound to this protocol and port can match */
+    SearchContext->Head = AddrHashBucket(Port, Protocol);
+    SearchContext->Next = SearchContext->Head->Flink;
 
-    if (!IsListEmpty(&AddressFileListHead))
-        ReferenceObject(CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, ListEntry));
+    if (!IsListEmpty(SearchContext->Head))
+        ReferenceObject(CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, HashEntry));
 
     TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
 
@@ -192,15 +237,16 @@ PADDRESS_FILE AddrFindShared(
     USHORT Port,
     USHORT Protocol)
 {
-    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY CurrentEntry, Head;
     KIRQL OldIrql;
     PADDRESS_FILE Current = NULL;
 
     TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
 
-    CurrentEntry = AddressFileListHead.Flink;
-    while (CurrentEntry != &AddressFileListHead) {
-        Current = CONTAINING_RECORD(CurrentEntry, ADDRESS_FILE, ListEntry);
+    Head = AddrHashBucket(Port, Protocol);
+    CurrentEntry = Head->Flink;
+    while (CurrentEntry != Head) {
+        Current = CONTAINING_RECORD(CurrentEntry, ADDRESS_FILE, HashEntry);
 
         /* See if this address matches the search criteria */
         if ((Current->Port == Port) &&
@@ -240,19 +286,28 @@ PADDRESS_FILE AddrSearchNext(
 
     TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
 
-    if (SearchContext->Next == &AddressFileListHead)
+    if (SearchContext->Next == SearchContext->Head)
     {
         TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
         return NULL;
     }
 
     /* Save this pointer so we can dereference it later */
-    StartingAddrFile = CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, ListEntry);
+    StartingAddrFile = CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, HashEntry);
+
+    /* A TCP address file gets its port late (see AddrFileSetPort). If that moved
+     * the entry to another chain, its links no longer lead back to our head */
+    if (AddrHashBucket(StartingAddrFile->Port, StartingAddrFile->Protocol) != SearchContext->Head)
+    {
+        DereferenceObject(StartingAddrFile);
+        TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
+        return NULL;
+    }
 
     CurrentEntry = SearchContext->Next;
 
-    while (CurrentEntry != &AddressFileListHead) {
-        Current = CONTAINING_RECORD(CurrentEntry, ADDRESS_FILE, ListEntry);
+    while (CurrentEntry != SearchContext->Head) {
+        Current = CONTAINING_RECORD(CurrentEntry, ADDRESS_FILE, HashEntry);
 
         IPAddress = &Current->Address;
 
@@ -279,10 +334,10 @@ PADDRESS_FILE AddrSearchNext(
     {
         SearchContext->Next = CurrentEntry->Flink;
 
-        if (SearchContext->Next != &AddressFileListHead)
+        if (SearchContext->Next != SearchContext->Head)
         {
             /* Reference the next address file to prevent the link from disappearing behind our back */
-            ReferenceObject(CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, ListEntry));
+            ReferenceObject(CONTAINING_RECORD(SearchContext->Next, ADDRESS_FILE, HashEntry));
         }
 
         /* Reference the returned address file before dereferencing the starting
@@ -318,9 +373,10 @@ VOID AddrFileFree(
   /* We should not be associated with a connection here */
   ASSERT(!AddrFile->Connection);
 
-  /* Remove address file from the global list */
+  /* Remove address file from the global list and its hash chain */
   TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
   RemoveEntryList(&AddrFile->ListEntry);
+  RemoveEntryList(&AddrFile->HashEntry);
   TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
 
   /* FIXME: Kill TCP connections on this address file object */
@@ -405,6 +461,7 @@ NTSTATUS FileOpenAddress(
 {
   PADDRESS_FILE AddrFile;
   UINT AllocatedPort;
+  KIRQL OldIrql;
 
   TI_DbgPrint(MID_TRACE, ("Called (Proto %d).\n", Protocol));
 
@@ -569,11 +626,11 @@ NTSTATUS FileOpenAddress(
   /* Return address file object */
   Request->Handle.AddressHandle = AddrFile;
 
-  /* Add address file to global list */
-  ExInterlockedInsertTailList(
-    &AddressFileListHead,
-    &AddrFile->ListEntry,
-    &AddressFileListLock);
+  /* Add address file to global list and hash it by protocol and port */
+  TcpipAcquireSpinLock(&AddressFileListLock, &OldIrql);
+  InsertTailList(&AddressFileListHead, &AddrFile->ListEntry);
+  InsertTailList(AddrHashBucket(AddrFile->Port, Protocol), &AddrFile->HashEntry);
+  TcpipReleaseSpinLock(&AddressFileListLock, OldIrql);
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 
@@ -934,6 +934,7 @@ DriverEntry(
     /* Initialize address file list and protecting spin lock */
     InitializeListHead(&AddressFileListHead);
     KeInitializeSpinLock(&AddressFileListLock);
+    AddrInitializeHashTable();
 
     /* Initialize connection endpoint list and protecting spin lock */
     InitializeListHead(&ConnectionEndpointListHead);
@@ -3555,6 +3555,7 @@ Return Value:
             if (numPackets > 1){
                 IoMarkIrpPending(Irp);
                 status = STATUS_PENDING;
+                ClasspPerfLogSplitRequest(fdoData);
             }
             else {
                 status = STATUS_SUCCESS;
@@ -4060,6 +4061,7 @@ ClassSendSrbSynchronous(
     NTSTATUS status;
     BOOLEAN retry;
     PSTORAGE_REQUEST_BLOCK_HEADER Srb = (PSTORAGE_REQUEST_BLOCK_HEADER)_Srb;
+    LARGE_INTEGER startTime;
 
     //
     // NOTE: This code is only pagable because we are not freezing
@@ -4284,8 +4286,12 @@ retry:
 
     //
     // Call the port driver with the request and wait for it to complete.
+    // Cache flushes come through here, so account for them.
     //
 
+    startTime = ClasspGetCurrentTime();
+    ClasspPerfLogSendRequest(fdoData, Srb);
+
     status = IoCallDriver(fdoExtension->CommonExtension.LowerDeviceObject, irp);
 
     if (status == STATUS_PENDING) {
@@ -4293,6 +4299,8 @@ retry:
         status = ioStatus.Status;
     }
 
+    ClasspPerfLogReturnedRequest(fdoData, Srb, startTime, ClasspGetCurrentTime());
+
 //    NT_ASSERT(SRB_STATUS(Srb->SrbStatus) != SRB_STATUS_PENDING);
     NT_ASSERT(status != STATUS_PENDING);
     NT_ASSERT(!(Srb->SrbStatus & SRB_STATUS_QUEUE_FROZEN));
@@ -7582,6 +7590,16 @@ ClassDeviceControl(
             break;
         }
 
+        case IOCTL_DISK_PERFORMANCE: {
+            status = ClasspDiskPerformance(DeviceObject, Irp);
+            break;
+        }
+
+        case IOCTL_DISK_PERFORMANCE_OFF: {
+            status = ClasspDiskPerformanceOff(DeviceObject, Irp);
+            break;
+        }
+
         default:
             status = STATUS_PENDING;
             break;
@@ -10545,6 +10563,7 @@ ClassRemoveDevice(
 
                     FREE_POOL(fdoExtension->PrivateFdoData->PowerProcessIrp);
                     FREE_POOL(fdoExtension->PrivateFdoData->FreeTransferPacketsLists);
+                    FREE_POOL(fdoExtension->PrivateFdoData->PerfCounters);
                     FREE_POOL(fdoExtension->PrivateFdoData);
                 }
 
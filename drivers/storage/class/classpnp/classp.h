@@ -42,6 +42,7 @@ Revision History:
 #include <wmidata.h>
 #include <classpnp.h>
 #include <storduid.h>
+#include <reactos/drivers/diskstat.h>
 
 #if CLASS_INIT_GUID
 #include <initguid.h>
@@ -647,6 +648,19 @@ typedef struct _PNL_SLIST_HEADER {
     ULONG DbgPeakNumTransferPackets;
 } PNL_SLIST_HEADER, *PPNL_SLIST_HEADER;
 
+/*
+ *  Per-processor I/O statistics (see perf.c).
+ *  Each processor only updates its own copy at DISPATCH_LEVEL,
+ *  they are summed up when someone asks for them.
+ */
+typedef struct _CLASS_PERF_COUNTERS {
+    DECLSPEC_CACHEALIGN DISK_LATENCY_HISTOGRAM Operations[DiskLatencyOperationMax];
+    ULONGLONG BytesTransferred[DiskLatencyOperationMax];
+    ULONG QueueDepth[DISK_QUEUE_DEPTH_BUCKETS];
+    ULONG MaximumQueueDepth;
+    ULONG SplitCount;
+} CLASS_PERF_COUNTERS, *PCLASS_PERF_COUNTERS;
+
 //
 // !!! WARNING !!!
 // DO NOT use the following structure in code outside of classpnp
@@ -980,6 +994,23 @@ struct _CLASS_PRIVATE_FDO_DATA {
     //
     BOOLEAN DisableThrottling;
 
+    //
+    // Latency histograms and queue depth samples, one set per processor.
+    // Requests are counted as long as PerfDisabled is clear, which is
+    // the default; IOCTL_DISK_PERFORMANCE_OFF sets it and clears the counters.
+    //
+    PCLASS_PERF_COUNTERS PerfCounters;
+    ULONG PerfCounterCount;
+    BOOLEAN PerfDisabled;
+
+    //
+    // Requests sent down and not completed yet, and the time the disk
+    // spent with none of them (in ClasspGetCurrentTime units).
+    //
+    LONG PerfOutstandingIo;
+    LARGE_INTEGER PerfIdleStartTime;
+    LONGLONG PerfIdleTime;
+
 };
 
 //
@@ -1741,6 +1772,13 @@ VOID FreeDeviceInputMdl(PMDL Mdl);
 VOID ClasspFreeDeviceMdl(PMDL Mdl);
 NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo);
 VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo);
+NTSTATUS ClasspInitializePerfCounters(PCLASS_PRIVATE_FDO_DATA FdoData);
+VOID ClasspPerfLogSendRequest(PCLASS_PRIVATE_FDO_DATA FdoData, PVOID Srb);
+VOID ClasspPerfLogReturnedRequest(PCLASS_PRIVATE_FDO_DATA FdoData, PVOID Srb, LARGE_INTEGER StartTime, LARGE_INTEGER CompletionTime);
+VOID ClasspPerfLogSplitRequest(PCLASS_PRIVATE_FDO_DATA FdoData);
+NTSTATUS ClasspDiskPerformance(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+NTSTATUS ClasspDiskPerformanceOff(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+VOID ClasspPerfQuery(PFUNCTIONAL_DEVICE_EXTENSION FdoExtension, PDISK_PERFORMANCE Performance, PDISK_LATENCY_INFORMATION Latency);
 VOID InterpretCapacityData(PDEVICE_OBJECT Fdo, PREAD_CAPACITY_DATA_EX ReadCapacityData);
 IO_WORKITEM_ROUTINE_EX CleanupTransferPacketToWorkingSetSizeWorker;
 VOID CleanupTransferPacketToWorkingSetSize(_In_ PDEVICE_OBJECT Fdo, _In_ BOOLEAN LimitNumPktToDelete, _In_ ULONG Node);
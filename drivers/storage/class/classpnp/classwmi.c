@@ -89,6 +89,7 @@ ClassFindInternalGuid(
 
 #ifdef __REACTOS__
 #define MSStorageDriver_ClassErrorLogGuid {0xD5A9A51E, 0x03F9, 0x404d, {0x97, 0x22, 0x15, 0xF9, 0x0E, 0xB0, 0x70, 0x38}}
+#define MSStorageDriver_LatencyInformationGuid {0x3A7F2B1C, 0x5D64, 0x4E8B, {0x9C, 0x0A, 0x7E, 0x1F, 0x6B, 0x2D, 0x4C, 0x93}}
 #endif
 
 //
@@ -98,10 +99,18 @@ GUIDREGINFO wmiClassGuids[] =
 {
     {
         MSStorageDriver_ClassErrorLogGuid, 1, 0
+    },
+    {
+        MSDiskDriver_PerformanceDataGuid, 1, 0
+    },
+    {
+        MSStorageDriver_LatencyInformationGuid, 1, 0
     }
 };
 
 #define MSStorageDriver_ClassErrorLogGuid_Index     0
+#define MSDiskDriver_PerformanceDataGuid_Index      1
+#define MSStorageDriver_LatencyInformationGuid_Index 2
 #define NUM_CLASS_WMI_GUIDS     (sizeof(wmiClassGuids) / sizeof(GUIDREGINFO))
 
 
@@ -778,6 +787,51 @@ ClassSystemControl(
 } // end ClassSystemControl()
 
 
+//
+// The disk performance counters are collected by classpnp itself, see perf.c
+//
+C_ASSERT(sizeof(WMI_DISK_PERFORMANCE) == sizeof(DISK_PERFORMANCE));
+
+static
+NTSTATUS
+ClasspQueryPerfDataBlock(
+    _In_ PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    _In_ ULONG GuidIndex,
+    _In_ ULONG BufferAvail,
+    _Out_writes_bytes_(BufferAvail) PUCHAR Buffer,
+    _Out_ PULONG SizeNeeded
+    )
+{
+    DISK_PERFORMANCE performance;
+    DISK_LATENCY_INFORMATION latency;
+
+    if ((FdoExtension->CommonExtension.IsFdo == FALSE) ||
+        (FdoExtension->PrivateFdoData == NULL)) {
+        *SizeNeeded = 0;
+        return STATUS_WMI_INSTANCE_NOT_FOUND;
+    }
+
+    if (GuidIndex == MSDiskDriver_PerformanceDataGuid_Index) {
+        *SizeNeeded = sizeof(WMI_DISK_PERFORMANCE);
+    } else {
+        *SizeNeeded = sizeof(DISK_LATENCY_INFORMATION);
+    }
+
+    if (BufferAvail < *SizeNeeded) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    ClasspPerfQuery(FdoExtension, &performance, &latency);
+
+    if (GuidIndex == MSDiskDriver_PerformanceDataGuid_Index) {
+        RtlCopyMemory(Buffer, &performance, sizeof(WMI_DISK_PERFORMANCE));
+    } else {
+        RtlCopyMemory(Buffer, &latency, sizeof(DISK_LATENCY_INFORMATION));
+    }
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 ClassQueryInternalDataBlock(
     IN PDEVICE_OBJECT DeviceObject,
@@ -904,6 +958,9 @@ Return Value:
         } else {
             status = STATUS_BUFFER_TOO_SMALL;
         }
+    } else if (GuidIndex == MSDiskDriver_PerformanceDataGuid_Index ||
+               GuidIndex == MSStorageDriver_LatencyInformationGuid_Index) {
+        status = ClasspQueryPerfDataBlock(fdoExt, GuidIndex, BufferAvail, Buffer, &sizeNeeded);
     } else if (GuidIndex > 0 && GuidIndex < NUM_CLASS_WMI_GUIDS) {
         status = STATUS_WMI_INSTANCE_NOT_FOUND;
     } else {
@@ -911,7 +968,12 @@ Return Value:
     }
 #else
     ULONG sizeNeeded = 0;
-    status = STATUS_WMI_GUID_NOT_FOUND;
+    if (GuidIndex == MSDiskDriver_PerformanceDataGuid_Index ||
+        GuidIndex == MSStorageDriver_LatencyInformationGuid_Index) {
+        status = ClasspQueryPerfDataBlock(DeviceObject->DeviceExtension, GuidIndex, BufferAvail, Buffer, &sizeNeeded);
+    } else {
+        status = STATUS_WMI_GUID_NOT_FOUND;
+    }
 #endif
     status = ClassWmiCompleteRequest(DeviceObject,
                                     Irp,
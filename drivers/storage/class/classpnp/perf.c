@@ -0,0 +1,385 @@
+/*
+ * PROJECT:     ReactOS Storage Stack / SCSI Class System Dll
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Per-disk latency histograms and queue depth sampling
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "classp.h"
+#include "debug.h"
+
+#ifdef DEBUG_USE_WPP
+#include "perf.tmh"
+#endif
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, ClasspInitializePerfCounters)
+    #pragma alloc_text(PAGE, ClasspDiskPerformance)
+    #pragma alloc_text(PAGE, ClasspDiskPerformanceOff)
+#endif
+
+#ifdef __REACTOS__
+/*
+ *  ClasspGetCurrentTime hands out performance counter ticks here,
+ *  this is what it takes to turn them into 100ns units.
+ */
+static LARGE_INTEGER ClasspPerfFrequency;
+#endif
+
+
+NTSTATUS ClasspInitializePerfCounters(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG count = (ULONG)KeNumberProcessors;
+
+    PAGED_CODE();
+
+#ifdef __REACTOS__
+    if (ClasspPerfFrequency.QuadPart == 0) {
+        KeQueryPerformanceCounter(&ClasspPerfFrequency);
+    }
+#endif
+
+    /*
+     *  The counters survive a stop/start of the device, only the
+     *  remove frees them.
+     */
+    if (FdoData->PerfCounters == NULL) {
+        FdoData->PerfCounters = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                                      count * sizeof(CLASS_PERF_COUNTERS),
+                                                      CLASS_TAG_PRIVATE_DATA);
+        if (FdoData->PerfCounters == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(FdoData->PerfCounters, count * sizeof(CLASS_PERF_COUNTERS));
+        FdoData->PerfIdleStartTime = ClasspGetCurrentTime();
+        FdoData->PerfIdleTime = 0;
+        FdoData->PerfCounterCount = count;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+static ULONGLONG ClasspPerfTimeTo100ns(ULONGLONG Time)
+{
+#ifdef __REACTOS__
+    ULONGLONG frequency = ClasspPerfFrequency.QuadPart;
+
+    if (frequency == 0) {
+        return 0;
+    }
+
+    return (Time / frequency) * 10000000 + ((Time % frequency) * 10000000) / frequency;
+#else
+    return Time;
+#endif
+}
+
+
+/*
+ *  Only reads, writes and cache flushes sent to the device are counted.
+ */
+static DISK_LATENCY_OPERATION ClasspPerfGetOperation(PVOID Srb)
+{
+    PCDB cdb;
+
+    if (SrbGetSrbFunction(Srb) != SRB_FUNCTION_EXECUTE_SCSI) {
+        return DiskLatencyOperationMax;
+    }
+
+    cdb = SrbGetCdb(Srb);
+    if (cdb == NULL) {
+        return DiskLatencyOperationMax;
+    }
+
+    switch (cdb->CDB6GENERIC.OperationCode) {
+        case SCSIOP_READ6:
+        case SCSIOP_READ:
+        case SCSIOP_READ12:
+        case SCSIOP_READ16:
+            return DiskLatencyRead;
+
+        case SCSIOP_WRITE6:
+        case SCSIOP_WRITE:
+        case SCSIOP_WRITE12:
+        case SCSIOP_WRITE16:
+            return DiskLatencyWrite;
+
+        case SCSIOP_SYNCHRONIZE_CACHE:
+        case SCSIOP_SYNCHRONIZE_CACHE16:
+            return DiskLatencyFlush;
+
+        default:
+            return DiskLatencyOperationMax;
+    }
+}
+
+
+/*
+ *  Must be called at DISPATCH_LEVEL so that we stay on this processor
+ *  while we update its counters.
+ */
+FORCEINLINE PCLASS_PERF_COUNTERS ClasspPerfGetCurrentCounters(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG processor = KeGetCurrentProcessorNumber();
+
+    NT_ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    if (processor >= FdoData->PerfCounterCount) {
+        processor = 0;
+    }
+
+    return &FdoData->PerfCounters[processor];
+}
+
+
+VOID ClasspPerfLogSendRequest(PCLASS_PRIVATE_FDO_DATA FdoData, PVOID Srb)
+{
+    DISK_LATENCY_OPERATION operation = ClasspPerfGetOperation(Srb);
+    PCLASS_PERF_COUNTERS counters;
+    LARGE_INTEGER currentTime;
+    LONG queueDepth;
+    ULONG bucket;
+    KIRQL oldIrql;
+
+    if (operation == DiskLatencyOperationMax) {
+        return;
+    }
+
+    /*
+     *  The outstanding count is kept even when the statistics are off,
+     *  so that it stays balanced with the completions.
+     */
+    queueDepth = InterlockedIncrement(&FdoData->PerfOutstandingIo);
+    if ((queueDepth == 1) && (FdoData->PerfCounters != NULL)) {
+        currentTime = ClasspGetCurrentTime();
+        InterlockedAdd64(&FdoData->PerfIdleTime,
+                         currentTime.QuadPart - FdoData->PerfIdleStartTime.QuadPart);
+    }
+
+    if (FdoData->PerfDisabled || (FdoData->PerfCounters == NULL)) {
+        return;
+    }
+
+    bucket = min((ULONG)RtlFindMostSignificantBit(queueDepth), DISK_QUEUE_DEPTH_BUCKETS - 1);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    counters = ClasspPerfGetCurrentCounters(FdoData);
+    counters->QueueDepth[bucket]++;
+    if ((ULONG)queueDepth > counters->MaximumQueueDepth) {
+        counters->MaximumQueueDepth = queueDepth;
+    }
+
+    KeLowerIrql(oldIrql);
+}
+
+
+VOID ClasspPerfLogReturnedRequest(PCLASS_PRIVATE_FDO_DATA FdoData, PVOID Srb, LARGE_INTEGER StartTime, LARGE_INTEGER CompletionTime)
+{
+    DISK_LATENCY_OPERATION operation = ClasspPerfGetOperation(Srb);
+    PCLASS_PERF_COUNTERS counters;
+    PDISK_LATENCY_HISTOGRAM histogram;
+    ULONGLONG latency = 0;
+    ULONGLONG microseconds;
+    ULONG bytes = 0;
+    ULONG bucket = 0;
+    KIRQL oldIrql;
+
+    if (operation == DiskLatencyOperationMax) {
+        return;
+    }
+
+    if (InterlockedDecrement(&FdoData->PerfOutstandingIo) == 0) {
+        FdoData->PerfIdleStartTime = CompletionTime;
+    }
+
+    if (FdoData->PerfDisabled || (FdoData->PerfCounters == NULL)) {
+        return;
+    }
+
+    if (CompletionTime.QuadPart > StartTime.QuadPart) {
+        latency = ClasspPerfTimeTo100ns(CompletionTime.QuadPart - StartTime.QuadPart);
+    }
+
+    microseconds = latency / 10;
+    if (microseconds >= (1 << DISK_LATENCY_BUCKET_SHIFT)) {
+        bucket = RtlFindMostSignificantBit(microseconds) - DISK_LATENCY_BUCKET_SHIFT + 1;
+        bucket = min(bucket, DISK_LATENCY_BUCKETS - 1);
+    }
+
+    if ((operation != DiskLatencyFlush) &&
+        (SRB_STATUS(SrbGetSrbStatus(Srb)) == SRB_STATUS_SUCCESS)) {
+        bytes = SrbGetDataTransferLength(Srb);
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    counters = ClasspPerfGetCurrentCounters(FdoData);
+    histogram = &counters->Operations[operation];
+    histogram->Count++;
+    histogram->TotalTime += latency;
+    if (latency > histogram->MaximumTime) {
+        histogram->MaximumTime = latency;
+    }
+    histogram->Buckets[bucket]++;
+    counters->BytesTransferred[operation] += bytes;
+
+    KeLowerIrql(oldIrql);
+}
+
+
+VOID ClasspPerfLogSplitRequest(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    KIRQL oldIrql;
+
+    if (FdoData->PerfDisabled || (FdoData->PerfCounters == NULL)) {
+        return;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    ClasspPerfGetCurrentCounters(FdoData)->SplitCount++;
+    KeLowerIrql(oldIrql);
+}
+
+
+/*
+ *  Sums up the per-processor counters. They keep changing while we read
+ *  them, which is fine for statistics.
+ */
+VOID ClasspPerfQuery(PFUNCTIONAL_DEVICE_EXTENSION FdoExtension, PDISK_PERFORMANCE Performance, PDISK_LATENCY_INFORMATION Latency)
+{
+    PCLASS_PRIVATE_FDO_DATA fdoData = FdoExtension->PrivateFdoData;
+    PCLASS_PERF_COUNTERS counters;
+    PDISK_LATENCY_HISTOGRAM histogram;
+    LARGE_INTEGER currentTime;
+    LONGLONG idleTime;
+    ULONG processor, operation, i;
+
+    RtlZeroMemory(Performance, sizeof(DISK_PERFORMANCE));
+    RtlZeroMemory(Latency, sizeof(DISK_LATENCY_INFORMATION));
+    Latency->Version = DISK_LATENCY_INFORMATION_VERSION;
+    Latency->Size = sizeof(DISK_LATENCY_INFORMATION);
+
+    for (processor = 0; processor < fdoData->PerfCounterCount; processor++) {
+        counters = &fdoData->PerfCounters[processor];
+
+        for (operation = 0; operation < DiskLatencyOperationMax; operation++) {
+            histogram = &Latency->Operations[operation];
+            histogram->Count += counters->Operations[operation].Count;
+            histogram->TotalTime += counters->Operations[operation].TotalTime;
+            histogram->MaximumTime = max(histogram->MaximumTime, counters->Operations[operation].MaximumTime);
+            for (i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+                histogram->Buckets[i] += counters->Operations[operation].Buckets[i];
+            }
+        }
+
+        for (i = 0; i < DISK_QUEUE_DEPTH_BUCKETS; i++) {
+            Latency->QueueDepth[i] += counters->QueueDepth[i];
+        }
+        Latency->MaximumQueueDepth = max(Latency->MaximumQueueDepth, counters->MaximumQueueDepth);
+
+        Performance->BytesRead.QuadPart += counters->BytesTransferred[DiskLatencyRead];
+        Performance->BytesWritten.QuadPart += counters->BytesTransferred[DiskLatencyWrite];
+        Performance->SplitCount += counters->SplitCount;
+    }
+
+    Performance->ReadTime.QuadPart = Latency->Operations[DiskLatencyRead].TotalTime;
+    Performance->WriteTime.QuadPart = Latency->Operations[DiskLatencyWrite].TotalTime;
+    Performance->ReadCount = (ULONG)Latency->Operations[DiskLatencyRead].Count;
+    Performance->WriteCount = (ULONG)Latency->Operations[DiskLatencyWrite].Count;
+    Performance->QueueDepth = max(fdoData->PerfOutstandingIo, 0);
+
+    /*
+     *  Add the idle period we are in, if any.
+     */
+    idleTime = fdoData->PerfIdleTime;
+    if (fdoData->PerfOutstandingIo == 0) {
+        currentTime = ClasspGetCurrentTime();
+        idleTime += currentTime.QuadPart - fdoData->PerfIdleStartTime.QuadPart;
+    }
+    Performance->IdleTime.QuadPart = ClasspPerfTimeTo100ns(max(idleTime, 0));
+
+    KeQuerySystemTime(&Performance->QueryTime);
+    Performance->StorageDeviceNumber = FdoExtension->DeviceNumber;
+    RtlCopyMemory(Performance->StorageManagerName, L"PhysDisk", sizeof(Performance->StorageManagerName));
+}
+
+
+/*
+ *  IOCTL_DISK_PERFORMANCE
+ *
+ *  Callers that pass a buffer large enough for a DISK_PERFORMANCE_EX
+ *  also get the latency histograms.
+ */
+NTSTATUS ClasspDiskPerformance(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = commonExtension->PartitionZeroExtension;
+    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
+    ULONG outputLength = irpStack->Parameters.DeviceIoControl.OutputBufferLength;
+    PDISK_PERFORMANCE_EX performance;
+    DISK_LATENCY_INFORMATION latency;
+
+    PAGED_CODE();
+
+    if (fdoExtension->PrivateFdoData == NULL) {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    if (outputLength < sizeof(DISK_PERFORMANCE)) {
+        Irp->IoStatus.Information = sizeof(DISK_PERFORMANCE);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    /*
+     *  Asking for the counters turns them back on if they were off.
+     */
+    fdoExtension->PrivateFdoData->PerfDisabled = FALSE;
+
+    performance = Irp->AssociatedIrp.SystemBuffer;
+    ClasspPerfQuery(fdoExtension, &performance->Performance, &latency);
+
+    if (outputLength >= sizeof(DISK_PERFORMANCE_EX)) {
+        performance->Latency = latency;
+        Irp->IoStatus.Information = sizeof(DISK_PERFORMANCE_EX);
+    } else {
+        Irp->IoStatus.Information = sizeof(DISK_PERFORMANCE);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+/*
+ *  IOCTL_DISK_PERFORMANCE_OFF
+ *
+ *  Stops counting and throws the counters away, the next
+ *  IOCTL_DISK_PERFORMANCE starts over from zero.
+ */
+NTSTATUS ClasspDiskPerformanceOff(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = commonExtension->PartitionZeroExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExtension->PrivateFdoData;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(Irp);
+
+    if (fdoData == NULL) {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    fdoData->PerfDisabled = TRUE;
+
+    if (fdoData->PerfCounters != NULL) {
+        RtlZeroMemory(fdoData->PerfCounters, fdoData->PerfCounterCount * sizeof(CLASS_PERF_COUNTERS));
+    }
+
+    fdoData->PerfIdleTime = 0;
+    fdoData->PerfIdleStartTime = ClasspGetCurrentTime();
+
+    return STATUS_SUCCESS;
+}
@@ -94,6 +94,15 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
 
     InitializeListHead(&fdoData->AllTransferPacketsList);
 
+    //
+    // Allocate per-processor latency and queue depth counters.
+    // The disk works fine without them, it just reports no statistics.
+    //
+    status = ClasspInitializePerfCounters(fdoData);
+    if (!NT_SUCCESS(status)) {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT, "Failed to allocate performance counters, status %!STATUS!.", status));
+    }
+
     //
     // Set the packet threshold numbers based on the Windows Client or Server SKU.
     //
@@ -922,6 +931,9 @@ NTSTATUS SubmitTransferPacket(PTRANSFER_PACKET Pkt)
         }
     }
 
+    Pkt->RequestStartTime = ClasspGetCurrentTime().QuadPart;
+    ClasspPerfLogSendRequest(fdoData, Pkt->Srb);
+
     IoSetCompletionRoutine(Pkt->Irp, TransferPktComplete, Pkt, TRUE, TRUE, TRUE);
     return IoCallDriver(nextDevObj, Pkt->Irp);
 }
@@ -938,6 +950,7 @@ TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Context)
     BOOLEAN idleRequest = FALSE;
     ULONG transferLength;
     LARGE_INTEGER completionTime;
+    LARGE_INTEGER requestStartTime;
     ULONGLONG lastIoCompletionTime;
 
     UNREFERENCED_PARAMETER(NullFdo);
@@ -985,6 +998,9 @@ TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Context)
         }
     }
 
+    requestStartTime.QuadPart = pkt->RequestStartTime;
+    ClasspPerfLogReturnedRequest(fdoData, pkt->Srb, requestStartTime, completionTime);
+
     //
     // If partial MDL was used, unmap the pages.  When the packet is retried, the
     // MDL will be recreated.  If the packet is done, the MDL will be ready to be reused.
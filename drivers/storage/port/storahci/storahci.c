@@ -118,6 +118,16 @@ AhciPortInitialize (
                                                                                   PortExtension->IdentifyDeviceData,
                                                                                   &mappedLength);
 
+    PortExtension->NcqErrorLogPhysicalAddress = StorPortGetPhysicalAddress(adapterExtension,
+                                                                           NULL,
+                                                                           PortExtension->NcqErrorLog,
+                                                                           &mappedLength);
+
+    PortExtension->TrimBufferPhysicalAddress = StorPortGetPhysicalAddress(adapterExtension,
+                                                                          NULL,
+                                                                          PortExtension->TrimBuffer,
+                                                                          &mappedLength);
+
     // set device power state flag to D0
     PortExtension->DevicePowerState = StorPowerDeviceD0;
 
@@ -172,7 +182,10 @@ AhciAllocateResourceForAdapter (
     AdapterExtension->PortCount = portCount;
     nonCachedExtensionSize =    sizeof(AHCI_COMMAND_HEADER) * AlignedNCS + //should be 1K aligned
                                 sizeof(AHCI_RECEIVED_FIS) +
-                                sizeof(IDENTIFY_DEVICE_DATA);
+                                sizeof(AHCI_COMMAND_TABLE) + // 128 byte aligned
+                                sizeof(IDENTIFY_DEVICE_DATA) +
+                                sizeof(GP_LOG_NCQ_COMMAND_ERROR) +
+                                DEVICE_ATA_BLOCK_SIZE;
 
     // align nonCachedExtensionSize to 1024
     nonCachedExtensionSize = ROUND_UP(nonCachedExtensionSize, 1024);
@@ -205,7 +218,18 @@ AhciAllocateResourceForAdapter (
             tmp = (PCHAR)(nonCachedExtension + sizeof(AHCI_COMMAND_HEADER) * AlignedNCS);
 
             PortExtension->ReceivedFIS = (PAHCI_RECEIVED_FIS)tmp;
-            PortExtension->IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)(tmp + sizeof(AHCI_RECEIVED_FIS));
+            tmp += sizeof(AHCI_RECEIVED_FIS);
+
+            PortExtension->RecoveryCommandTable = (PAHCI_COMMAND_TABLE)tmp;
+            tmp += sizeof(AHCI_COMMAND_TABLE);
+
+            PortExtension->IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)tmp;
+            tmp += sizeof(IDENTIFY_DEVICE_DATA);
+
+            PortExtension->NcqErrorLog = (PGP_LOG_NCQ_COMMAND_ERROR)tmp;
+            tmp += sizeof(GP_LOG_NCQ_COMMAND_ERROR);
+
+            PortExtension->TrimBuffer = (PULONG64)tmp;
             PortExtension->MaxPortQueueDepth = NCS;
             nonCachedExtension += nonCachedExtensionSize;
         }
@@ -579,7 +603,7 @@ AhciCompleteIssuedSrb (
 
     for (i = 0; i < NCS; i++)
     {
-        if (((1 << i) & CommandsToComplete) != 0)
+        if (((1UL << i) & CommandsToComplete) != 0)
         {
             Srb = PortExtension->Slot[i];
 
@@ -591,6 +615,11 @@ AhciCompleteIssuedSrb (
             SrbExtension = GetSrbExtension(Srb);
             NT_ASSERT(SrbExtension != NULL);
 
+            if ((SrbExtension->Flags & ATA_FLAGS_TRIM_BUFFER) != 0)
+            {
+                InterlockedExchange(&PortExtension->TrimBufferBusy, 0);
+            }
+
             if (SrbExtension->CompletionRoutine != NULL)
             {
                 AddQueue(&PortExtension->CompletionQueue, Srb);
@@ -605,9 +634,321 @@ AhciCompleteIssuedSrb (
         }
     }
 
+    PortExtension->NcqSlots &= ~CommandsToComplete;
     return;
 }// -- AhciCompleteIssuedSrb();
 
+/**
+ * @name AhciFailIssuedSrb
+ * @implemented
+ *
+ * Complete the Srbs of the given slots with an error,
+ * or put them back to the pending queue to be issued again
+ *
+ * @param PortExtension
+ * @param Slots
+ * @param SrbStatus
+ * SRB_STATUS_PENDING to retry the Srbs
+ *
+ */
+VOID
+AhciFailIssuedSrb (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in ULONG Slots,
+    __in UCHAR SrbStatus
+    )
+{
+    ULONG i;
+    PSCSI_REQUEST_BLOCK Srb;
+    PAHCI_SRB_EXTENSION SrbExtension;
+
+    AhciDebugPrint("AhciFailIssuedSrb()\n");
+    AhciDebugPrint("\tSlots: %x SrbStatus: %x\n", Slots, SrbStatus);
+
+    for (i = 0; i < MAXIMUM_AHCI_PORT_NCS; i++)
+    {
+        if (((1UL << i) & Slots) == 0)
+        {
+            continue;
+        }
+
+        Srb = PortExtension->Slot[i];
+        PortExtension->Slot[i] = NULL;
+
+        if (Srb == NULL)
+        {
+            continue;
+        }
+
+        if (SrbStatus == SRB_STATUS_PENDING)
+        {
+            // the device aborted it because of another command, issue it again
+            AddQueue(&PortExtension->SrbQueue, Srb);
+            continue;
+        }
+
+        SrbExtension = GetSrbExtension(Srb);
+        if ((SrbExtension->Flags & ATA_FLAGS_TRIM_BUFFER) != 0)
+        {
+            InterlockedExchange(&PortExtension->TrimBufferBusy, 0);
+        }
+
+        Srb->SrbStatus = SrbStatus;
+        StorPortNotification(RequestComplete, PortExtension->AdapterExtension, Srb);
+    }
+
+    PortExtension->NcqSlots &= ~Slots;
+    return;
+}// -- AhciFailIssuedSrb();
+
+/**
+ * @name AhciRestartPort
+ * @implemented
+ *
+ * 6.2.2.1 / 6.2.2.2
+ * Stop the command list DMA engine, clear the error and start it again.
+ * PxCI and PxSACT are cleared by the HBA when PxCMD.ST is cleared.
+ *
+ * @param PortExtension
+ *
+ * @return
+ * return TRUE if the port is running again
+ */
+BOOLEAN
+AhciRestartPort (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG ticks;
+    AHCI_PORT_CMD cmd;
+    AHCI_TASK_FILE_DATA tfd;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciRestartPort()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    // clear PxCMD.ST and wait up to 500ms for PxCMD.CR to clear
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 0;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    ticks = 500;
+    do
+    {
+        StorPortStallExecution(1000);
+        cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+        if (ticks == 0)
+        {
+            AhciDebugPrint("\tPxCMD.CR did not clear\n");
+            return FALSE;
+        }
+        ticks--;
+    }
+    while (cmd.CR != 0);
+
+    // clear the error bits
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    // device still busy, use command list override to get BSY and DRQ cleared
+    tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+    if (tfd.STS.BSY || tfd.STS.DRQ)
+    {
+        cmd.CLO = 1;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+        ticks = 500;
+        do
+        {
+            StorPortStallExecution(1000);
+            cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+            if (ticks == 0)
+            {
+                AhciDebugPrint("\tPxCMD.CLO did not clear\n");
+                return FALSE;
+            }
+            ticks--;
+        }
+        while (cmd.CLO != 0);
+    }
+
+    cmd.ST = 1;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    return TRUE;
+}// -- AhciRestartPort();
+
+/**
+ * @name AhciStartErrorRecovery
+ * @implemented
+ *
+ * 6.2.2.2 Non-Queued and Native Command Queuing error recovery.
+ * Completes the commands which finished before the error, restarts the port and
+ * for native queued commands reads the NCQ Command Error log to find out which tag failed.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciStartErrorRecovery (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    AHCI_PORT_CMD cmd;
+    ULONG ci, sact, outstanding, failed, length;
+    PAHCI_COMMAND_HEADER CommandHeader;
+    PAHCI_COMMAND_TABLE cmdTable;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    STOR_PHYSICAL_ADDRESS CommandTablePhysicalAddress;
+
+    AhciDebugPrint("AhciStartErrorRecovery()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
+    sact = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SACT);
+
+    if (PortExtension->ErrorRecovery)
+    {
+        // READ LOG EXT failed as well, give up on the aborted commands
+        PortExtension->ErrorRecovery = FALSE;
+        AhciRestartPort(PortExtension);
+        AhciFailIssuedSrb(PortExtension, PortExtension->FailedSlots, SRB_STATUS_ERROR);
+        PortExtension->FailedSlots = 0;
+        return;
+    }
+
+    // commands which completed before the error was raised
+    outstanding = ci | sact;
+    if ((PortExtension->CommandIssuedSlots & (~outstanding)) != 0)
+    {
+        AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
+    }
+
+    failed = PortExtension->CommandIssuedSlots & outstanding;
+    PortExtension->CommandIssuedSlots = 0;
+
+    if (!AhciRestartPort(PortExtension))
+    {
+        AhciFailIssuedSrb(PortExtension, failed, SRB_STATUS_ERROR);
+        return;
+    }
+
+    if ((failed & PortExtension->NcqSlots) == 0)
+    {
+        // Non-Queued command, PxCMD.CCS points to the failing slot
+        AhciFailIssuedSrb(PortExtension, failed & (1UL << cmd.CCS), SRB_STATUS_ERROR);
+        AhciFailIssuedSrb(PortExtension, failed & ~(1UL << cmd.CCS), SRB_STATUS_PENDING);
+        return;
+    }
+
+    // Native queued commands, all of them were aborted by the device.
+    // READ LOG EXT page 10h tells which one failed and clears the error condition.
+    PortExtension->ErrorRecovery = TRUE;
+    PortExtension->FailedSlots = failed;
+
+    cmdTable = PortExtension->RecoveryCommandTable;
+    AhciZeroMemory((PCHAR)cmdTable, sizeof(AHCI_COMMAND_TABLE));
+
+    cmdTable->CFIS[AHCI_ATA_CFIS_FisType] = FIS_TYPE_REG_H2D;
+    cmdTable->CFIS[AHCI_ATA_CFIS_PMPort_C] = (1 << 7);
+    cmdTable->CFIS[AHCI_ATA_CFIS_CommandReg] = IDE_COMMAND_READ_LOG_EXT;
+    cmdTable->CFIS[AHCI_ATA_CFIS_LBA0] = ATA_LOG_NCQ_COMMAND_ERROR;
+    cmdTable->CFIS[AHCI_ATA_CFIS_Device] = IDE_LBA_MODE;
+    cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountLow] = 1;
+
+    cmdTable->PRDT[0].DBA = PortExtension->NcqErrorLogPhysicalAddress.LowPart;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        cmdTable->PRDT[0].DBAU = PortExtension->NcqErrorLogPhysicalAddress.HighPart;
+    }
+    cmdTable->PRDT[0].DBC = sizeof(GP_LOG_NCQ_COMMAND_ERROR) - 1;
+
+    CommandTablePhysicalAddress = StorPortGetPhysicalAddress(AdapterExtension,
+                                                             NULL,
+                                                             cmdTable,
+                                                             &length);
+
+    // all slots are free after the restart, use the first one
+    CommandHeader = &PortExtension->CommandList[0];
+    CommandHeader->DI.Status = 0;
+    CommandHeader->DI.CFL = 5;
+    CommandHeader->DI.PRDTL = 1;
+    CommandHeader->PRDBC = 0;
+    CommandHeader->CTBA = CommandTablePhysicalAddress.LowPart;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        CommandHeader->CTBA_U = CommandTablePhysicalAddress.HighPart;
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, 1);
+    return;
+}// -- AhciStartErrorRecovery();
+
+/**
+ * @name AhciCompleteErrorRecovery
+ * @implemented
+ *
+ * NCQ Command Error log has been read, fail the command it names and
+ * issue the other aborted commands again
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciCompleteErrorRecovery (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG failedSlot;
+    PSENSE_DATA SenseData;
+    PSCSI_REQUEST_BLOCK Srb;
+    PGP_LOG_NCQ_COMMAND_ERROR ErrorLog;
+
+    AhciDebugPrint("AhciCompleteErrorRecovery()\n");
+
+    ErrorLog = PortExtension->NcqErrorLog;
+    PortExtension->ErrorRecovery = FALSE;
+
+    failedSlot = 1UL << ErrorLog->NcqTag;
+    if (ErrorLog->NonQueuedCmd || ((PortExtension->FailedSlots & failedSlot) == 0))
+    {
+        AhciDebugPrint("\tNo failing tag in the log\n");
+        AhciFailIssuedSrb(PortExtension, PortExtension->FailedSlots, SRB_STATUS_ERROR);
+        PortExtension->FailedSlots = 0;
+        return;
+    }
+
+    AhciDebugPrint("\tTag %d failed, Status: %x Error: %x\n", ErrorLog->NcqTag, ErrorLog->Status, ErrorLog->Error);
+
+    // pass on the sense data if the device provided it
+    Srb = PortExtension->Slot[ErrorLog->NcqTag];
+    if ((Srb != NULL) && (ErrorLog->SenseKey != 0) &&
+        (Srb->SenseInfoBuffer != NULL) && (Srb->SenseInfoBufferLength >= sizeof(SENSE_DATA)))
+    {
+        SenseData = (PSENSE_DATA)Srb->SenseInfoBuffer;
+        AhciZeroMemory((PCHAR)SenseData, sizeof(SENSE_DATA));
+        SenseData->ErrorCode = 0x70; // current error, fixed format
+        SenseData->Valid = 1;
+        SenseData->SenseKey = ErrorLog->SenseKey;
+        SenseData->AdditionalSenseLength = sizeof(SENSE_DATA) - RTL_SIZEOF_THROUGH_FIELD(SENSE_DATA, AdditionalSenseLength);
+        SenseData->AdditionalSenseCode = ErrorLog->ASC;
+        SenseData->AdditionalSenseCodeQualifier = ErrorLog->ASCQ;
+
+        AhciFailIssuedSrb(PortExtension, failedSlot, SRB_STATUS_ERROR | SRB_STATUS_AUTOSENSE_VALID);
+    }
+    else
+    {
+        AhciFailIssuedSrb(PortExtension, failedSlot, SRB_STATUS_ERROR);
+    }
+
+    AhciFailIssuedSrb(PortExtension, PortExtension->FailedSlots & ~failedSlot, SRB_STATUS_PENDING);
+    PortExtension->FailedSlots = 0;
+    return;
+}// -- AhciCompleteErrorRecovery();
+
 /**
  * @name AhciInterruptHandler
  * @not_implemented
@@ -663,6 +1004,15 @@ AhciInterruptHandler (
         // non-queued commands were being issued or native command queuing commands were being issued.
 
         AhciDebugPrint("\tFatal Error: %x\n", PxIS.Status);
+
+        // restarting the port clears PxIS
+        AhciStartErrorRecovery(PortExtension);
+
+        is = (1 << PortExtension->PortNumber);
+        StorPortWriteRegisterUlong(AdapterExtension, AdapterExtension->IS, is);
+
+        AhciIssueQueuedCommands(PortExtension);
+        return;
     }
 
     // Normal Command Completion
@@ -692,13 +1042,28 @@ AhciInterruptHandler (
     ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
     sact = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SACT);
 
-    outstanding = ci | sact; // NOTE: Including both non-NCQ and NCQ based commands
+    if (PortExtension->ErrorRecovery)
+    {
+        // waiting for READ LOG EXT in slot 0
+        if ((ci & 1) == 0)
+        {
+            AhciCompleteErrorRecovery(PortExtension);
+            AhciIssueQueuedCommands(PortExtension);
+        }
+        return;
+    }
+
+    // Native queued commands are completed through PxSACT (Set Device Bits FIS),
+    // non-queued ones through PxCI
+    outstanding = ci | sact;
     if ((PortExtension->CommandIssuedSlots & (~outstanding)) != 0)
     {
         AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
         PortExtension->CommandIssuedSlots &= outstanding;
     }
 
+    // fill the freed slots
+    AhciIssueQueuedCommands(PortExtension);
     return;
 }// -- AhciInterruptHandler();
 
@@ -889,6 +1254,9 @@ AhciHwStartIo (
                     case SCSIOP_WRITE:
                         Srb->SrbStatus = DeviceRequestReadWrite(AdapterExtension, Srb, cdb);
                         break;
+                    case SCSIOP_UNMAP:
+                        Srb->SrbStatus = DeviceRequestUnmap(AdapterExtension, Srb, cdb);
+                        break;
                     default:
                         AhciDebugPrint("\tOperationCode: %d\n", cdb->CDB10.OperationCode);
                         Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
@@ -1414,6 +1782,12 @@ AhciProcessSrb (
     else if (IsAtaCommand(SrbExtension->AtaFunction))
     {
         cfl = AhciATA_CFIS(PortExtension, SrbExtension);
+
+        // FPDMA QUEUED commands carry their tag in the count field, the tag is the slot
+        if (IsNcqCommand(SrbExtension))
+        {
+            SrbExtension->CommandTable.CFIS[AHCI_ATA_CFIS_SectorCountLow] = (UCHAR)(SlotIndex << 3);
+        }
     }
     else
     {
@@ -1467,7 +1841,11 @@ AhciProcessSrb (
 
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
-    PortExtension->QueueSlots |= 1 << SlotIndex;
+    PortExtension->QueueSlots |= 1UL << SlotIndex;
+    if (IsNcqCommand(SrbExtension))
+    {
+        PortExtension->NcqSlots |= 1UL << SlotIndex;
+    }
     return;
 }// -- AhciProcessSrb();
 
@@ -1492,7 +1870,7 @@ AhciActivatePort (
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    ULONG QueueSlots, ncqSlots;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1514,23 +1892,21 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
-
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
-    else
-        slotToActivate = (QueueSlots & (~tmp));
-
-    // mark that bit off in QueueSlots
-    // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    // issue every programmed slot at once
+    PortExtension->QueueSlots = 0;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= QueueSlots;
+
+    // 5.3.2.4 -- for native queued commands PxSACT must be set before PxCI
+    ncqSlots = QueueSlots & PortExtension->NcqSlots;
+    if (ncqSlots != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, ncqSlots);
+    }
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, QueueSlots);
 
     return;
 }// -- AhciActivatePort();
@@ -1539,6 +1915,82 @@ AhciActivatePort (
     #pragma warning(pop)
 #endif
 
+/**
+ * @name AhciIssueQueuedCommands
+ * @implemented
+ *
+ * Populate pending commands to free slots of the command list and
+ * program controller's port to process them. Caller holds the interrupt lock.
+ *
+ * Native queued and non-queued commands are never outstanding together,
+ * and non-queued commands are issued one at a time.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciIssueQueuedCommands (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK tmpSrb;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
+
+    AhciDebugPrint("AhciIssueQueuedCommands()\n");
+
+    if ((PortExtension->DeviceParams.IsActive == FALSE) || PortExtension->ErrorRecovery)
+    {
+        return; // we should wait for device to get active
+    }
+
+    NCS = AHCI_Global_Port_CAP_NCS(PortExtension->AdapterExtension->CAP);
+
+    // iterate over HBA port slots
+    for (slotIndex = 0; slotIndex < NCS; slotIndex++)
+    {
+        occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
+        commandSlotMask = AHCI_SLOT_MASK(NCS) & ~occupiedSlots; // available slots mask
+
+        if ((commandSlotMask & (1UL << slotIndex)) == 0)
+        {
+            continue;
+        }
+
+        tmpSrb = PeekQueue(&PortExtension->SrbQueue);
+        if (tmpSrb == NULL)
+        {
+            break;
+        }
+
+        SrbExtension = GetSrbExtension(tmpSrb);
+        if (IsNcqCommand(SrbExtension))
+        {
+            // wait for outstanding non-queued command
+            if ((occupiedSlots & ~PortExtension->NcqSlots) != 0)
+                break;
+        }
+        else if (occupiedSlots != 0)
+        {
+            // wait for the port to drain
+            break;
+        }
+
+        tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
+        NT_ASSERT(tmpSrb->PathId == PortExtension->PortNumber);
+        AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
+
+        if (!IsNcqCommand(SrbExtension))
+        {
+            break;
+        }
+    }
+
+    // program HBA port
+    AhciActivatePort(PortExtension);
+    return;
+}// -- AhciIssueQueuedCommands();
+
 /**
  * @name AhciProcessIO
  * @implemented
@@ -1558,10 +2010,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1576,46 +2026,7 @@ AhciProcessIO (
     // add Srb to queue
     AddQueue(&PortExtension->SrbQueue, Srb);
 
-    if (PortExtension->DeviceParams.IsActive == FALSE)
-    {
-        // Release Lock
-        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
-        return; // we should wait for device to get active
-    }
-
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
-
-    // program HBA port
-    AhciActivatePort(PortExtension);
+    AhciIssueQueuedCommands(PortExtension);
 
     // Release Lock
     StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
@@ -1766,6 +2177,24 @@ InquiryCompletion (
 
         PortExtension->DeviceParams.BytesPerPhysicalSector = DEVICE_ATA_BLOCK_SIZE;
 
+        /* Native Command Queuing, needs the HBA and the device to support it */
+        PortExtension->DeviceParams.NcqSupported = 0;
+        if (IsAdapterCAPSNCQ(AdapterExtension->CAP) &&
+            PortExtension->DeviceParams.Lba48BitMode &&
+            IdentifyDeviceData->SerialAtaCapabilities.NCQ)
+        {
+            PortExtension->DeviceParams.NcqSupported = 1;
+            PortExtension->DeviceParams.NcqQueueDepth = min(AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP),
+                                                            (ULONG)IdentifyDeviceData->QueueDepth + 1);
+        }
+
+        PortExtension->DeviceParams.TrimSupported = 0;
+        if (PortExtension->DeviceParams.Lba48BitMode &&
+            IdentifyDeviceData->DataSetManagementFeature.SupportsTrim)
+        {
+            PortExtension->DeviceParams.TrimSupported = 1;
+        }
+
         // last byte should be NULL
         StorPortCopyMemory(PortExtension->DeviceParams.VendorId, IdentifyDeviceData->ModelNumber, sizeof(PortExtension->DeviceParams.VendorId) - 1);
         StorPortCopyMemory(PortExtension->DeviceParams.RevisionID, IdentifyDeviceData->FirmwareRevision, sizeof(PortExtension->DeviceParams.RevisionID) - 1);
@@ -1798,7 +2227,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqSupported;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1820,6 +2249,8 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
+                                         PortExtension->DeviceParams.NcqSupported ?
+                                         PortExtension->DeviceParams.NcqQueueDepth :
                                          AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
 
     NT_ASSERT(status == TRUE);
@@ -2041,6 +2472,37 @@ DeviceRequestReadWrite (
         SrbExtension->CommandReg = IDE_COMMAND_WRITE_DMA;
     }
 
+    SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
+
+    if (PortExtension->DeviceParams.NcqSupported)
+    {
+        // READ/WRITE FPDMA QUEUED, the sector count moves to the features register
+        // and the tag is filled in once the command got its slot
+        SrbExtension->Flags |= ATA_FLAGS_NCQ | ATA_FLAGS_48BIT_COMMAND;
+        SrbExtension->CommandReg = IsReading ? IDE_COMMAND_READ_FPDMA_QUEUED : IDE_COMMAND_WRITE_FPDMA_QUEUED;
+
+        SrbExtension->FeaturesLow = (SectorCount >> 0) & 0xFF;
+        SrbExtension->FeaturesHigh = (SectorCount >> 8) & 0xFF;
+        SrbExtension->LBA0 = (StartOffset >> 0) & 0xFF;
+        SrbExtension->LBA1 = (StartOffset >> 8) & 0xFF;
+        SrbExtension->LBA2 = (StartOffset >> 16) & 0xFF;
+        SrbExtension->LBA3 = (StartOffset >> 24) & 0xFF;
+        SrbExtension->LBA4 = (StartOffset >> 32) & 0xFF;
+        SrbExtension->LBA5 = (StartOffset >> 40) & 0xFF;
+
+        SrbExtension->Device = IDE_LBA_MODE;
+        if (Cdb->CDB10.ForceUnitAccess)
+        {
+            SrbExtension->Device |= (1 << 7);
+        }
+
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+
+        NT_ASSERT(SectorCount <= 0x10000);
+        return SRB_STATUS_PENDING;
+    }
+
     SrbExtension->FeaturesLow = 0;
     SrbExtension->LBA0 = (StartOffset >> 0) & 0xFF;
     SrbExtension->LBA1 = (StartOffset >> 8) & 0xFF;
@@ -2076,11 +2538,132 @@ DeviceRequestReadWrite (
 
     NT_ASSERT(SectorCount < 0x100);
 
-    SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
-
     return SRB_STATUS_PENDING;
 }// -- DeviceRequestReadWrite();
 
+/**
+ * @name DeviceRequestUnmap
+ * @implemented
+ *
+ * Handle SCSIOP_UNMAP OperationCode by sending DATA SET MANAGEMENT with the TRIM bit set
+ *
+ * @param AdapterExtension
+ * @param Srb
+ * @param Cdb
+ *
+ * @return
+ * return STOR status for DeviceRequestUnmap
+ */
+UCHAR
+DeviceRequestUnmap (
+    __in PAHCI_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in PCDB Cdb
+    )
+{
+    PUCHAR ParameterList, Descriptor;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    PAHCI_PORT_EXTENSION PortExtension;
+    ULONG DescriptorCount, RangeCount, index, i;
+    ULONG64 Lba;
+    ULONG LbaCount, Length;
+
+    UNREFERENCED_PARAMETER(Cdb);
+
+    AhciDebugPrint("DeviceRequestUnmap()\n");
+
+    NT_ASSERT(IsPortValid(AdapterExtension, Srb->PathId));
+
+    SrbExtension = GetSrbExtension(Srb);
+    PortExtension = &AdapterExtension->PortExtension[Srb->PathId];
+
+    if (!PortExtension->DeviceParams.TrimSupported)
+    {
+        return SRB_STATUS_INVALID_REQUEST;
+    }
+
+    ParameterList = Srb->DataBuffer;
+    if ((ParameterList == NULL) || (Srb->DataTransferLength < 8))
+    {
+        return SRB_STATUS_INVALID_REQUEST;
+    }
+
+    // unmap block descriptors are 16 bytes each and follow the 8 byte header
+    DescriptorCount = ((ParameterList[2] << 8) | ParameterList[3]) / 16;
+    if ((8 + DescriptorCount * 16) > Srb->DataTransferLength)
+    {
+        return SRB_STATUS_INVALID_REQUEST;
+    }
+
+    // the range buffer is shared by the port
+    if (InterlockedCompareExchange(&PortExtension->TrimBufferBusy, 1, 0) != 0)
+    {
+        return SRB_STATUS_BUSY;
+    }
+
+    AhciZeroMemory((PCHAR)PortExtension->TrimBuffer, DEVICE_ATA_BLOCK_SIZE);
+
+    // each ATA range entry holds a 48 bit LBA and a 16 bit sector count
+    RangeCount = 0;
+    for (index = 0; index < DescriptorCount; index++)
+    {
+        Descriptor = &ParameterList[8 + index * 16];
+
+        Lba = 0;
+        for (i = 0; i < 8; i++)
+            Lba = (Lba << 8) | Descriptor[i];
+
+        LbaCount = ((ULONG)Descriptor[8] << 24) | ((ULONG)Descriptor[9] << 16) |
+                   ((ULONG)Descriptor[10] << 8) | Descriptor[11];
+
+        while (LbaCount != 0)
+        {
+            if (RangeCount == MAXIMUM_TRIM_RANGE_ENTRIES)
+            {
+                InterlockedExchange(&PortExtension->TrimBufferBusy, 0);
+                return SRB_STATUS_INVALID_REQUEST;
+            }
+
+            Length = min(LbaCount, MAXIMUM_TRIM_RANGE_LENGTH);
+            PortExtension->TrimBuffer[RangeCount++] = (Lba & 0xFFFFFFFFFFFFULL) | ((ULONG64)Length << 48);
+
+            Lba += Length;
+            LbaCount -= Length;
+        }
+    }
+
+    if (RangeCount == 0)
+    {
+        InterlockedExchange(&PortExtension->TrimBufferBusy, 0);
+        return SRB_STATUS_SUCCESS;
+    }
+
+    SrbExtension->AtaFunction = ATA_FUNCTION_ATA_COMMAND;
+    SrbExtension->Flags |= ATA_FLAGS_USE_DMA | ATA_FLAGS_DATA_OUT | ATA_FLAGS_48BIT_COMMAND | ATA_FLAGS_TRIM_BUFFER;
+    SrbExtension->CompletionRoutine = NULL;
+    SrbExtension->CommandReg = IDE_COMMAND_DATA_SET_MANAGEMENT;
+
+    SrbExtension->FeaturesLow = 1; // TRIM
+    SrbExtension->FeaturesHigh = 0;
+    SrbExtension->LBA0 = 0;
+    SrbExtension->LBA1 = 0;
+    SrbExtension->LBA2 = 0;
+    SrbExtension->LBA3 = 0;
+    SrbExtension->LBA4 = 0;
+    SrbExtension->LBA5 = 0;
+    SrbExtension->Device = IDE_LBA_MODE;
+    SrbExtension->SectorCountLow = 1;
+    SrbExtension->SectorCountHigh = 0;
+
+    SrbExtension->Sgl.NumberOfElements = 1;
+    SrbExtension->Sgl.List[0].PhysicalAddress.LowPart = PortExtension->TrimBufferPhysicalAddress.LowPart;
+    SrbExtension->Sgl.List[0].PhysicalAddress.HighPart = PortExtension->TrimBufferPhysicalAddress.HighPart;
+    SrbExtension->Sgl.List[0].Length = DEVICE_ATA_BLOCK_SIZE;
+
+    SrbExtension->pSgl = &SrbExtension->Sgl;
+    return SRB_STATUS_PENDING;
+}// -- DeviceRequestUnmap();
+
 /**
  * @name DeviceRequestCapacity
  * @implemented
@@ -2547,6 +3130,33 @@ RemoveQueue (
     return Srb;
 }// -- RemoveQueue();
 
+/**
+ * @name PeekQueue
+ * @implemented
+ *
+ * Return Srb at the head of the Queue without removing it
+ *
+ * @param Queue
+ *
+ * @return
+ * return Srb
+ *
+ */
+FORCEINLINE
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    )
+{
+    NT_ASSERT(Queue->Head < MAXIMUM_QUEUE_BUFFER_SIZE);
+    NT_ASSERT(Queue->Tail < MAXIMUM_QUEUE_BUFFER_SIZE);
+
+    if (Queue->Head == Queue->Tail)
+        return NULL;
+
+    return Queue->Buffer[Queue->Tail];
+}// -- PeekQueue();
+
 /**
  * @name GetSrbExtension
  * @implemented
@@ -20,12 +20,23 @@
 
 #define MAXIMUM_AHCI_PORT_COUNT             32
 #define MAXIMUM_AHCI_PRDT_ENTRIES           32
-#define MAXIMUM_AHCI_PORT_NCS               30
+#define MAXIMUM_AHCI_PORT_NCS               32
 #define MAXIMUM_QUEUE_BUFFER_SIZE           255
 #define MAXIMUM_TRANSFER_LENGTH             (128*1024) // 128 KB
 
 #define DEVICE_ATA_BLOCK_SIZE               512
 
+// DATA SET MANAGEMENT takes one 512 byte block of LBA range entries
+#define MAXIMUM_TRIM_RANGE_ENTRIES          (DEVICE_ATA_BLOCK_SIZE / sizeof(ULONG64))
+#define MAXIMUM_TRIM_RANGE_LENGTH           0xFFFF
+
+// NCQ Command Error log page (READ LOG EXT)
+#define ATA_LOG_NCQ_COMMAND_ERROR           0x10
+
+#ifndef SCSIOP_UNMAP
+#define SCSIOP_UNMAP                        0x42
+#endif
+
 // device type (DeviceParams)
 #define AHCI_DEVICE_TYPE_ATA                1
 #define AHCI_DEVICE_TYPE_ATAPI              2
@@ -33,6 +44,7 @@
 
 // section 3.1.2
 #define AHCI_Global_HBA_CAP_S64A            (1 << 31)
+#define AHCI_Global_HBA_CAP_SNCQ            (1 << 30)
 
 // FIS Types : https://wiki.osdev.org/AHCI
 #define FIS_TYPE_REG_H2D        0x27 // Register FIS - host to device
@@ -71,14 +83,20 @@
 #define ATA_FLAGS_DATA_OUT                  (1 << 2)
 #define ATA_FLAGS_48BIT_COMMAND             (1 << 3)
 #define ATA_FLAGS_USE_DMA                   (1 << 4)
+#define ATA_FLAGS_NCQ                       (1 << 5)
+#define ATA_FLAGS_TRIM_BUFFER               (1 << 6)
 
 #define IsAtaCommand(AtaFunction)           (AtaFunction & ATA_FUNCTION_ATA_COMMAND)
 #define IsAtapiCommand(AtaFunction)         (AtaFunction & ATA_FUNCTION_ATAPI_COMMAND)
 #define IsDataTransferNeeded(SrbExtension)  (SrbExtension->Flags & (ATA_FLAGS_DATA_IN | ATA_FLAGS_DATA_OUT))
 #define IsAdapterCAPS64(CAP)                (CAP & AHCI_Global_HBA_CAP_S64A)
+#define IsAdapterCAPSNCQ(CAP)               (CAP & AHCI_Global_HBA_CAP_SNCQ)
+#define IsNcqCommand(SrbExtension)          (SrbExtension->Flags & ATA_FLAGS_NCQ)
 
 // 3.1.1 NCS = CAP[12:08] -> Align
-#define AHCI_Global_Port_CAP_NCS(x)         (((x) & 0xF00) >> 8)
+// 0's based value, so 0x1F means all 32 command slots
+#define AHCI_Global_Port_CAP_NCS(x)         ((((x) & 0x1F00) >> 8) + 1)
+#define AHCI_SLOT_MASK(NCS)                 (((NCS) >= 32) ? (ULONG)~0 : ((1UL << (NCS)) - 1))
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 //#define AhciDebugPrint(format, ...) StorPortDebugPrint(0, format, __VA_ARGS__)
@@ -464,8 +482,14 @@ typedef struct _AHCI_PORT_EXTENSION
     ULONG PortNumber;
     ULONG QueueSlots;                                   // slots which we have already assigned task (Slot)
     ULONG CommandIssuedSlots;                           // slots which has been programmed
+    ULONG NcqSlots;                                     // slots holding a native queued command
     ULONG MaxPortQueueDepth;
 
+    // NCQ error recovery, see AhciStartErrorRecovery
+    BOOLEAN ErrorRecovery;                              // READ LOG EXT in progress
+    ULONG FailedSlots;                                  // slots aborted by the device error
+    LONG TrimBufferBusy;
+
     struct
     {
         UCHAR RemovableDevice;
@@ -473,6 +497,9 @@ typedef struct _AHCI_PORT_EXTENSION
         UCHAR AccessType;
         UCHAR DeviceType;
         UCHAR IsActive;
+        UCHAR NcqSupported;
+        UCHAR TrimSupported;
+        ULONG NcqQueueDepth;
         LARGE_INTEGER MaxLba;
         ULONG BytesPerLogicalSector;
         ULONG BytesPerPhysicalSector;
@@ -491,6 +518,11 @@ typedef struct _AHCI_PORT_EXTENSION
     STOR_DEVICE_POWER_STATE DevicePowerState;           // Device Power State
     PIDENTIFY_DEVICE_DATA IdentifyDeviceData;
     STOR_PHYSICAL_ADDRESS IdentifyDeviceDataPhysicalAddress;
+    PAHCI_COMMAND_TABLE RecoveryCommandTable;           // READ LOG EXT during error recovery
+    PGP_LOG_NCQ_COMMAND_ERROR NcqErrorLog;
+    STOR_PHYSICAL_ADDRESS NcqErrorLogPhysicalAddress;
+    PULONG64 TrimBuffer;                                // DATA SET MANAGEMENT range entries
+    STOR_PHYSICAL_ADDRESS TrimBufferPhysicalAddress;
     struct _AHCI_ADAPTER_EXTENSION* AdapterExtension;   // Port's Adapter Information
 } AHCI_PORT_EXTENSION, *PAHCI_PORT_EXTENSION;
 
@@ -632,6 +664,17 @@ UCHAR DeviceReportLuns (
     __in PCDB Cdb
     );
 
+UCHAR DeviceRequestUnmap (
+    __in PAHCI_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in PCDB Cdb
+    );
+
+VOID
+AhciIssueQueuedCommands (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
 FORCEINLINE
 BOOLEAN
 AddQueue (
@@ -645,6 +688,12 @@ RemoveQueue (
     __inout PAHCI_QUEUE Queue
     );
 
+FORCEINLINE
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    );
+
 FORCEINLINE
 PAHCI_SRB_EXTENSION
 GetSrbExtension(
@@ -702,6 +751,7 @@ C_ASSERT(FIELD_OFFSET(AHCI_PORT, RSV1)   == 0x44);
 C_ASSERT(FIELD_OFFSET(AHCI_PORT, Vendor) == 0x70);
 
 C_ASSERT((sizeof(AHCI_COMMAND_TABLE) % 128) == 0);
+C_ASSERT(sizeof(GP_LOG_NCQ_COMMAND_ERROR) == DEVICE_ATA_BLOCK_SIZE);
 
 C_ASSERT(sizeof(AHCI_GHC)                        == sizeof(ULONG));
 C_ASSERT(sizeof(AHCI_PORT_CMD)                   == sizeof(ULONG));
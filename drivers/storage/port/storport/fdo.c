@@ -24,7 +24,7 @@ PortFdoInterruptRoutine(
 {
     PFDO_DEVICE_EXTENSION DeviceExtension;
 
-    DPRINT1("PortFdoInterruptRoutine(%p %p)\n",
+    DPRINT("PortFdoInterruptRoutine(%p %p)\n",
             Interrupt, ServiceContext);
 
     DeviceExtension = (PFDO_DEVICE_EXTENSION)ServiceContext;
@@ -99,6 +99,162 @@ PortFdoConnectInterrupt(
 }
 
 
+static
+VOID
+NTAPI
+PortFdoCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2);
+
+
+static
+VOID
+PortFdoFreeRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    DPRINT1("PortFdoFreeRequests(%p)\n", DeviceExtension);
+
+    if (DeviceExtension->Requests != NULL)
+    {
+        ExFreePoolWithTag(DeviceExtension->Requests, TAG_REQUEST_DATA);
+        DeviceExtension->Requests = NULL;
+    }
+
+    if (DeviceExtension->SrbExtensionBase != NULL)
+    {
+        MmFreeContiguousMemorySpecifyCache(DeviceExtension->SrbExtensionBase,
+                                           DeviceExtension->RequestCount * DeviceExtension->SrbExtensionSize,
+                                           MmCached);
+        DeviceExtension->SrbExtensionBase = NULL;
+    }
+
+    if (DeviceExtension->CompletionQueues != NULL)
+    {
+        ExFreePoolWithTag(DeviceExtension->CompletionQueues, TAG_COMPLETION_DATA);
+        DeviceExtension->CompletionQueues = NULL;
+    }
+
+    DeviceExtension->FreeRequestList.Next = NULL;
+    DeviceExtension->RequestCount = 0;
+    DeviceExtension->CompletionQueueCount = 0;
+}
+
+
+static
+NTSTATUS
+PortFdoInitializeRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig;
+    PHYSICAL_ADDRESS LowestAddress, HighestAddress, BoundaryAddress;
+    PPORT_COMPLETION_QUEUE Queue;
+    PPORT_REQUEST Request;
+    PUCHAR SgListBase;
+    ULONG MaximumTransferLength, SgListSize, RequestCount, i;
+
+    DPRINT1("PortFdoInitializeRequests(%p)\n", DeviceExtension);
+
+    PortConfig = &DeviceExtension->Miniport.PortConfig;
+
+    /* One completion queue per processor */
+    DeviceExtension->CompletionQueueCount = KeNumberOfProcessors;
+    DeviceExtension->CompletionQueues = ExAllocatePoolWithTag(NonPagedPool,
+                                                              DeviceExtension->CompletionQueueCount * sizeof(PORT_COMPLETION_QUEUE),
+                                                              TAG_COMPLETION_DATA);
+    if (DeviceExtension->CompletionQueues == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (i = 0; i < DeviceExtension->CompletionQueueCount; i++)
+    {
+        Queue = &DeviceExtension->CompletionQueues[i];
+        KeInitializeSpinLock(&Queue->Lock);
+        InitializeListHead(&Queue->ListHead);
+        KeInitializeDpc(&Queue->Dpc, PortFdoCompletionDpc, DeviceExtension);
+        KeSetTargetProcessorDpc(&Queue->Dpc, (CCHAR)i);
+    }
+
+    /* Every request carries a scatter/gather list large enough for the largest transfer */
+    MaximumTransferLength = PortConfig->MaximumTransferLength;
+    if (MaximumTransferLength == 0 || MaximumTransferLength == SP_UNINITIALIZED_VALUE)
+        MaximumTransferLength = 128 * 1024;
+
+    DeviceExtension->MaxSgElements = BYTES_TO_PAGES(MaximumTransferLength) + 1;
+    SgListSize = FIELD_OFFSET(STOR_SCATTER_GATHER_LIST, List[DeviceExtension->MaxSgElements]);
+
+    /* The SRB extensions must be physically contiguous, so allocate them in one block.
+       Settle for fewer requests if there is not enough contiguous memory. */
+    DeviceExtension->SrbExtensionSize = ALIGN_UP_BY(PortConfig->SrbExtensionSize, 16);
+
+    LowestAddress.QuadPart = 0;
+    HighestAddress.QuadPart = 0xFFFFFFFF;
+    BoundaryAddress.QuadPart = 0;
+
+    for (RequestCount = PORT_MAXIMUM_REQUESTS; RequestCount != 0; RequestCount /= 2)
+    {
+        if (DeviceExtension->SrbExtensionSize == 0)
+            break;
+
+        DeviceExtension->SrbExtensionBase = MmAllocateContiguousMemorySpecifyCache(RequestCount * DeviceExtension->SrbExtensionSize,
+                                                                                   LowestAddress,
+                                                                                   HighestAddress,
+                                                                                   BoundaryAddress,
+                                                                                   MmCached);
+        if (DeviceExtension->SrbExtensionBase != NULL)
+            break;
+    }
+
+    if (RequestCount == 0)
+    {
+        DPRINT1("Failed to allocate the SRB extensions\n");
+        PortFdoFreeRequests(DeviceExtension);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DeviceExtension->RequestCount = RequestCount;
+
+    if (DeviceExtension->SrbExtensionBase != NULL)
+    {
+        RtlZeroMemory(DeviceExtension->SrbExtensionBase,
+                      RequestCount * DeviceExtension->SrbExtensionSize);
+        DeviceExtension->SrbExtensionPhysicalBase = MmGetPhysicalAddress(DeviceExtension->SrbExtensionBase);
+    }
+
+    /* Allocate the requests, followed by their scatter/gather lists */
+    DeviceExtension->Requests = ExAllocatePoolWithTag(NonPagedPool,
+                                                      RequestCount * (sizeof(PORT_REQUEST) + SgListSize),
+                                                      TAG_REQUEST_DATA);
+    if (DeviceExtension->Requests == NULL)
+    {
+        PortFdoFreeRequests(DeviceExtension);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(DeviceExtension->Requests,
+                  RequestCount * (sizeof(PORT_REQUEST) + SgListSize));
+
+    SgListBase = (PUCHAR)&DeviceExtension->Requests[RequestCount];
+    DeviceExtension->FreeRequestList.Next = NULL;
+
+    for (i = RequestCount; i-- > 0; )
+    {
+        Request = &DeviceExtension->Requests[i];
+        Request->SgList = (PSTOR_SCATTER_GATHER_LIST)(SgListBase + i * SgListSize);
+
+        if (DeviceExtension->SrbExtensionBase != NULL)
+            Request->SrbExtension = (PUCHAR)DeviceExtension->SrbExtensionBase + i * DeviceExtension->SrbExtensionSize;
+
+        PushEntryList(&DeviceExtension->FreeRequestList, &Request->FreeEntry);
+    }
+
+    DPRINT1("%lu requests, %lu scatter/gather elements each\n",
+            RequestCount, DeviceExtension->MaxSgElements);
+
+    return STATUS_SUCCESS;
+}
+
+
 static
 NTSTATUS
 PortFdoStartMiniport(
@@ -139,11 +295,20 @@ PortFdoStartMiniport(
         return Status;
     }
 
+    /* Set up the requests the miniport will be handed */
+    Status = PortFdoInitializeRequests(DeviceExtension);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("PortFdoInitializeRequests() failed (Status 0x%08lx)\n", Status);
+        return Status;
+    }
+
     /* Connect the configured interrupt */
     Status = PortFdoConnectInterrupt(DeviceExtension);
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("PortFdoConnectInterrupt() failed (Status 0x%08lx)\n", Status);
+        PortFdoFreeRequests(DeviceExtension);
         return Status;
     }
 
@@ -563,6 +728,208 @@ PortFdoFilterRequirements(
 }
 
 
+PPORT_REQUEST
+PortAllocateRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PSINGLE_LIST_ENTRY Entry;
+    KLOCK_QUEUE_HANDLE LockHandle;
+
+    KeAcquireInStackQueuedSpinLock(&DeviceExtension->RequestLock,
+                                   &LockHandle);
+
+    Entry = PopEntryList(&DeviceExtension->FreeRequestList);
+    if (Entry == NULL)
+        DeviceExtension->RequestsExhausted = TRUE;
+
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    if (Entry == NULL)
+        return NULL;
+
+    return CONTAINING_RECORD(Entry, PORT_REQUEST, FreeEntry);
+}
+
+
+BOOLEAN
+PortFreeRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    KLOCK_QUEUE_HANDLE LockHandle;
+    BOOLEAN Exhausted;
+
+    Request->Irp = NULL;
+    Request->Srb = NULL;
+    Request->PdoExtension = NULL;
+
+    KeAcquireInStackQueuedSpinLock(&DeviceExtension->RequestLock,
+                                   &LockHandle);
+
+    PushEntryList(&DeviceExtension->FreeRequestList, &Request->FreeEntry);
+
+    /* Tell the caller if a LUN had to wait for this request */
+    Exhausted = DeviceExtension->RequestsExhausted;
+    DeviceExtension->RequestsExhausted = FALSE;
+
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    return Exhausted;
+}
+
+
+VOID
+PortQueueCompletedRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PPORT_COMPLETION_QUEUE Queue;
+    PIRP Irp;
+
+    Irp = (PIRP)Srb->OriginalRequest;
+    ASSERT(Irp != NULL);
+
+    /* Finish the request on the processor that reported it */
+    Queue = &DeviceExtension->CompletionQueues[KeGetCurrentProcessorNumber() % DeviceExtension->CompletionQueueCount];
+
+    ExInterlockedInsertTailList(&Queue->ListHead,
+                                &Irp->Tail.Overlay.ListEntry,
+                                &Queue->Lock);
+
+    KeInsertQueueDpc(&Queue->Dpc, NULL, NULL);
+}
+
+
+static
+VOID
+PortRestartAllLuns(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    PLIST_ENTRY Entry;
+    ULONG Index, i;
+
+    /* The PDO lock must not be held while starting I/O, so look the LUNs up one by one */
+    for (Index = 0; ; Index++)
+    {
+        PdoExtension = NULL;
+
+        KeAcquireInStackQueuedSpinLock(&DeviceExtension->PdoListLock,
+                                       &LockHandle);
+
+        for (Entry = DeviceExtension->PdoListHead.Flink, i = 0;
+             Entry != &DeviceExtension->PdoListHead;
+             Entry = Entry->Flink, i++)
+        {
+            if (i == Index)
+            {
+                PdoExtension = CONTAINING_RECORD(Entry, PDO_DEVICE_EXTENSION, PdoListEntry);
+                break;
+            }
+        }
+
+        KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+        if (PdoExtension == NULL)
+            break;
+
+        PortStartNextLuRequests(PdoExtension);
+    }
+}
+
+
+static
+VOID
+PortFdoCompleteRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PIRP Irp)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PPORT_REQUEST Request;
+    PSCSI_REQUEST_BLOCK Srb;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    BOOLEAN Exhausted;
+
+    Request = (PPORT_REQUEST)Irp->Tail.Overlay.DriverContext[0];
+    Srb = Request->Srb;
+    PdoExtension = Request->PdoExtension;
+
+    switch (SRB_STATUS(Srb->SrbStatus))
+    {
+        case SRB_STATUS_SUCCESS:
+        case SRB_STATUS_DATA_OVERRUN:
+            Irp->IoStatus.Status = STATUS_SUCCESS;
+            Irp->IoStatus.Information = Srb->DataTransferLength;
+            break;
+
+        case SRB_STATUS_INVALID_REQUEST:
+        case SRB_STATUS_BAD_FUNCTION:
+            Irp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+            Irp->IoStatus.Information = 0;
+            break;
+
+        case SRB_STATUS_NO_DEVICE:
+        case SRB_STATUS_SELECTION_TIMEOUT:
+        case SRB_STATUS_INVALID_LUN:
+            Irp->IoStatus.Status = STATUS_DEVICE_DOES_NOT_EXIST;
+            Irp->IoStatus.Information = 0;
+            break;
+
+        case SRB_STATUS_BUSY:
+            Irp->IoStatus.Status = STATUS_DEVICE_BUSY;
+            Irp->IoStatus.Information = 0;
+            break;
+
+        default:
+            Irp->IoStatus.Status = STATUS_IO_DEVICE_ERROR;
+            Irp->IoStatus.Information = 0;
+            break;
+    }
+
+    /* The SRB extension goes back to the pool with the request */
+    Srb->SrbExtension = NULL;
+    Exhausted = PortFreeRequest(DeviceExtension, Request);
+
+    KeAcquireInStackQueuedSpinLock(&PdoExtension->RequestLock,
+                                   &LockHandle);
+    PdoExtension->ActiveCount--;
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    IoCompleteRequest(Irp, IO_DISK_INCREMENT);
+
+    /* Refill the LUN queue, or every queue if some LUN ran out of requests */
+    if (Exhausted)
+        PortRestartAllLuns(DeviceExtension);
+    else
+        PortStartNextLuRequests(PdoExtension);
+}
+
+
+static
+VOID
+NTAPI
+PortFdoCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPORT_COMPLETION_QUEUE Queue;
+    PLIST_ENTRY Entry;
+
+    DeviceExtension = (PFDO_DEVICE_EXTENSION)DeferredContext;
+    Queue = CONTAINING_RECORD(Dpc, PORT_COMPLETION_QUEUE, Dpc);
+
+    while ((Entry = ExInterlockedRemoveHeadList(&Queue->ListHead, &Queue->Lock)) != NULL)
+    {
+        PortFdoCompleteRequest(DeviceExtension,
+                               CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry));
+    }
+}
+
+
 NTSTATUS
 NTAPI
 PortFdoScsi(
@@ -624,6 +991,14 @@ PortFdoPnp(
 
         case IRP_MN_REMOVE_DEVICE: /* 0x02 */
             DPRINT1("IRP_MJ_PNP / IRP_MN_REMOVE_DEVICE\n");
+            /* No more requests can come in, stop the completions before freeing their queues */
+            if (DeviceExtension->Interrupt != NULL)
+            {
+                IoDisconnectInterrupt(DeviceExtension->Interrupt);
+                DeviceExtension->Interrupt = NULL;
+            }
+            KeFlushQueuedDpcs();
+            PortFdoFreeRequests(DeviceExtension);
             break;
 
         case IRP_MN_CANCEL_REMOVE_DEVICE: /* 0x03 */
@@ -355,28 +355,88 @@ MiniportHwInterrupt(
 {
     BOOLEAN Result;
 
-    DPRINT1("MiniportHwInterrupt(%p)\n",
-            Miniport);
+    DPRINT("MiniportHwInterrupt(%p)\n",
+           Miniport);
 
     Result = Miniport->InitData->HwInterrupt(&Miniport->MiniportExtension->HwDeviceExtension);
-    DPRINT1("HwInterrupt() returned %u\n", Result);
+    DPRINT("HwInterrupt() returned %u\n", Result);
 
     return Result;
 }
 
 
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    DPRINT("MiniportBuildIo(%p %p)\n",
+           Miniport, Srb);
+
+    /* HwBuildIo is optional */
+    if (Miniport->InitData->HwBuildIo == NULL)
+        return TRUE;
+
+    return Miniport->InitData->HwBuildIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
+}
+
+
+typedef struct _MINIPORT_START_IO_CONTEXT
+{
+    PMINIPORT Miniport;
+    PSCSI_REQUEST_BLOCK Srb;
+    BOOLEAN Result;
+} MINIPORT_START_IO_CONTEXT, *PMINIPORT_START_IO_CONTEXT;
+
+
+static
+BOOLEAN
+NTAPI
+MiniportSynchronizedStartIo(
+    _In_ PVOID SynchronizeContext)
+{
+    PMINIPORT_START_IO_CONTEXT Context = SynchronizeContext;
+
+    Context->Result = Context->Miniport->InitData->HwStartIo(&Context->Miniport->MiniportExtension->HwDeviceExtension,
+                                                             Context->Srb);
+    return TRUE;
+}
+
+
 BOOLEAN
 MiniportStartIo(
     _In_ PMINIPORT Miniport,
     _In_ PSCSI_REQUEST_BLOCK Srb)
 {
+    PFDO_DEVICE_EXTENSION DeviceExtension = Miniport->DeviceExtension;
+    MINIPORT_START_IO_CONTEXT Context;
+    KLOCK_QUEUE_HANDLE LockHandle;
     BOOLEAN Result;
 
-    DPRINT1("MiniportHwStartIo(%p %p)\n",
-            Miniport, Srb);
+    DPRINT("MiniportHwStartIo(%p %p)\n",
+           Miniport, Srb);
+
+    if (Miniport->PortConfig.SynchronizationModel == StorSynchronizeHalfDuplex &&
+        DeviceExtension->Interrupt != NULL)
+    {
+        /* Half duplex: StartIo runs under the interrupt lock */
+        Context.Miniport = Miniport;
+        Context.Srb = Srb;
+        Context.Result = FALSE;
+        KeSynchronizeExecution(DeviceExtension->Interrupt,
+                               MiniportSynchronizedStartIo,
+                               &Context);
+        Result = Context.Result;
+    }
+    else
+    {
+        /* Full duplex: StartIo only excludes other StartIo calls */
+        KeAcquireInStackQueuedSpinLock(&DeviceExtension->StartIoLock, &LockHandle);
+        Result = Miniport->InitData->HwStartIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
+        KeReleaseInStackQueuedSpinLock(&LockHandle);
+    }
 
-    Result = Miniport->InitData->HwStartIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
-    DPRINT1("HwStartIo() returned %u\n", Result);
+    DPRINT("HwStartIo() returned %u\n", Result);
 
     return Result;
 }
@@ -15,6 +15,22 @@
 
 /* FUNCTIONS ******************************************************************/
 
+static
+VOID
+NTAPI
+PortPdoRestartDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension = (PPDO_DEVICE_EXTENSION)DeferredContext;
+
+    /* The queue depth went up, fill the new slots */
+    PortStartNextLuRequests(PdoExtension);
+}
+
+
 NTSTATUS
 PortCreatePdo(
     _In_ PFDO_DEVICE_EXTENSION FdoDeviceExtension,
@@ -58,6 +74,33 @@ PortCreatePdo(
     DeviceExtension->FdoExtension = FdoDeviceExtension;
     DeviceExtension->PnpState = dsStopped;
 
+    /* Allocate the miniport's per-LUN storage */
+    if (FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize != 0)
+    {
+        DeviceExtension->LuExtension = ExAllocatePoolWithTag(NonPagedPool,
+                                                             FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize,
+                                                             TAG_LUN_DATA);
+        if (DeviceExtension->LuExtension == NULL)
+        {
+            IoDeleteDevice(Pdo);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(DeviceExtension->LuExtension,
+                      FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize);
+    }
+
+    /* Initialize the LUN queue; the miniport may change its depth later */
+    KeInitializeSpinLock(&DeviceExtension->RequestLock);
+    InitializeListHead(&DeviceExtension->RequestListHead);
+    KeInitializeDpc(&DeviceExtension->RestartDpc, PortPdoRestartDpc, DeviceExtension);
+    DeviceExtension->QueueDepth = FdoDeviceExtension->Miniport.PortConfig.MultipleRequestPerLu ?
+                                  PORT_DEFAULT_QUEUE_DEPTH : 1;
+
+    DeviceExtension->Bus = Bus;
+    DeviceExtension->Target = Target;
+    DeviceExtension->Lun = Lun;
+
     /* Add the PDO to the PDO list*/
     KeAcquireInStackQueuedSpinLock(&FdoDeviceExtension->PdoListLock,
                                    &LockHandle);
@@ -66,10 +109,6 @@ PortCreatePdo(
     FdoDeviceExtension->PdoCount++;
     KeReleaseInStackQueuedSpinLock(&LockHandle);
 
-    DeviceExtension->Bus = Bus;
-    DeviceExtension->Target = Target;
-    DeviceExtension->Lun = Lun;
-
 
     // FIXME: More initialization
 
@@ -88,6 +127,10 @@ PortDeletePdo(
     _In_ PPDO_DEVICE_EXTENSION PdoExtension)
 {
     KLOCK_QUEUE_HANDLE LockHandle;
+    LIST_ENTRY RequestListHead;
+    PSCSI_REQUEST_BLOCK Srb;
+    PLIST_ENTRY Entry;
+    PIRP Irp;
 
     DPRINT("PortDeletePdo(%p)\n", PdoExtension);
 
@@ -98,12 +141,45 @@ PortDeletePdo(
     PdoExtension->FdoExtension->PdoCount--;
     KeReleaseInStackQueuedSpinLock(&LockHandle);
 
+    /* Nobody can find the LUN anymore, let a queued restart run out */
+    KeFlushQueuedDpcs();
+
+    /* Fail the requests that never made it to the miniport */
+    InitializeListHead(&RequestListHead);
+    KeAcquireInStackQueuedSpinLock(&PdoExtension->RequestLock,
+                                   &LockHandle);
+    while (!IsListEmpty(&PdoExtension->RequestListHead))
+    {
+        Entry = RemoveHeadList(&PdoExtension->RequestListHead);
+        InsertTailList(&RequestListHead, Entry);
+    }
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    while (!IsListEmpty(&RequestListHead))
+    {
+        Entry = RemoveHeadList(&RequestListHead);
+        Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
+
+        Srb = IoGetCurrentIrpStackLocation(Irp)->Parameters.Scsi.Srb;
+        Srb->SrbStatus = SRB_STATUS_NO_DEVICE;
+
+        Irp->IoStatus.Status = STATUS_NO_SUCH_DEVICE;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
     if (PdoExtension->InquiryBuffer)
     {
         ExFreePoolWithTag(PdoExtension->InquiryBuffer, TAG_INQUIRY_DATA);
         PdoExtension->InquiryBuffer = NULL;
     }
 
+    if (PdoExtension->LuExtension)
+    {
+        ExFreePoolWithTag(PdoExtension->LuExtension, TAG_LUN_DATA);
+        PdoExtension->LuExtension = NULL;
+    }
+
 
     // FIXME: More uninitialization
 
@@ -115,18 +191,414 @@ PortDeletePdo(
 }
 
 
+PPDO_DEVICE_EXTENSION
+PortGetPdoExtension(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ ULONG Bus,
+    _In_ ULONG Target,
+    _In_ ULONG Lun)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension, Found = NULL;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    PLIST_ENTRY Entry;
+
+    KeAcquireInStackQueuedSpinLock(&FdoExtension->PdoListLock,
+                                   &LockHandle);
+
+    for (Entry = FdoExtension->PdoListHead.Flink;
+         Entry != &FdoExtension->PdoListHead;
+         Entry = Entry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(Entry, PDO_DEVICE_EXTENSION, PdoListEntry);
+        if (PdoExtension->Bus == Bus &&
+            PdoExtension->Target == Target &&
+            PdoExtension->Lun == Lun)
+        {
+            Found = PdoExtension;
+            break;
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    return Found;
+}
+
+
+static
+BOOLEAN
+PortIsReadWriteRequest(
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    if (Srb->Function != SRB_FUNCTION_EXECUTE_SCSI)
+        return FALSE;
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ6:
+        case SCSIOP_WRITE6:
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+        case SCSIOP_READ12:
+        case SCSIOP_WRITE12:
+        case SCSIOP_READ16:
+        case SCSIOP_WRITE16:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+static
+BOOLEAN
+PortMapRequest(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    PSTOR_SCATTER_GATHER_LIST SgList = Request->SgList;
+    PMDL Mdl = Request->Irp->MdlAddress;
+    PPFN_NUMBER PfnArray = NULL;
+    ULONG_PTR Address, MdlAddress;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG Remaining, Length, PageIndex = 0, Count = 0;
+    PVOID SystemAddress;
+
+    SgList->NumberOfElements = 0;
+
+    if (Srb->DataBuffer == NULL || Srb->DataTransferLength == 0)
+        return TRUE;
+
+    Address = (ULONG_PTR)Srb->DataBuffer;
+    Remaining = Srb->DataTransferLength;
+
+    /* Buffers described by the MDL are looked up by page frame,
+       anything else must be a non-paged system buffer */
+    if (Mdl != NULL)
+    {
+        MdlAddress = (ULONG_PTR)MmGetMdlVirtualAddress(Mdl);
+        if (Address >= MdlAddress &&
+            Address + Remaining <= MdlAddress + MmGetMdlByteCount(Mdl))
+        {
+            PfnArray = MmGetMdlPfnArray(Mdl);
+            PageIndex = (ULONG)((Address - (ULONG_PTR)PAGE_ALIGN(MdlAddress)) >> PAGE_SHIFT);
+        }
+        else
+        {
+            Mdl = NULL;
+        }
+    }
+
+    /* Build the scatter/gather list, merging adjacent pages */
+    while (Remaining != 0)
+    {
+        Length = min(PAGE_SIZE - BYTE_OFFSET(Address), Remaining);
+
+        if (PfnArray != NULL)
+            PhysicalAddress.QuadPart = ((ULONGLONG)PfnArray[PageIndex++] << PAGE_SHIFT) + BYTE_OFFSET(Address);
+        else
+            PhysicalAddress = MmGetPhysicalAddress((PVOID)Address);
+
+        if (Count != 0 &&
+            SgList->List[Count - 1].PhysicalAddress.QuadPart + SgList->List[Count - 1].Length == PhysicalAddress.QuadPart)
+        {
+            SgList->List[Count - 1].Length += Length;
+        }
+        else
+        {
+            if (Count == FdoExtension->MaxSgElements)
+            {
+                DPRINT1("Transfer of %lu bytes needs too many elements\n", Srb->DataTransferLength);
+                return FALSE;
+            }
+
+            SgList->List[Count].PhysicalAddress.QuadPart = PhysicalAddress.QuadPart;
+            SgList->List[Count].Length = Length;
+            SgList->List[Count].Reserved = 0;
+            Count++;
+        }
+
+        Address += Length;
+        Remaining -= Length;
+    }
+
+    SgList->NumberOfElements = Count;
+
+    /* Give the miniport a system address if it wants to touch the data */
+    if (Mdl != NULL &&
+        (FdoExtension->Miniport.PortConfig.MapBuffers == STOR_MAP_ALL_BUFFERS ||
+         (FdoExtension->Miniport.PortConfig.MapBuffers == STOR_MAP_NON_READ_WRITE_BUFFERS &&
+          !PortIsReadWriteRequest(Srb))))
+    {
+        SystemAddress = MmGetSystemAddressForMdlSafe(Mdl, HighPagePriority);
+        if (SystemAddress == NULL)
+            return FALSE;
+
+        Srb->DataBuffer = (PUCHAR)SystemAddress +
+                          ((ULONG_PTR)Srb->DataBuffer - (ULONG_PTR)MmGetMdlVirtualAddress(Mdl));
+    }
+
+    return TRUE;
+}
+
+
+static
+VOID
+PortStartRequest(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _In_ PPORT_REQUEST Request,
+    _In_ PIRP Irp)
+{
+    PFDO_DEVICE_EXTENSION FdoExtension = PdoExtension->FdoExtension;
+    PSCSI_REQUEST_BLOCK Srb;
+
+    Srb = IoGetCurrentIrpStackLocation(Irp)->Parameters.Scsi.Srb;
+
+    Request->Irp = Irp;
+    Request->Srb = Srb;
+    Request->PdoExtension = PdoExtension;
+    Irp->Tail.Overlay.DriverContext[0] = Request;
+
+    Srb->OriginalRequest = Irp;
+    Srb->SrbExtension = Request->SrbExtension;
+    Srb->PathId = (UCHAR)PdoExtension->Bus;
+    Srb->TargetId = (UCHAR)PdoExtension->Target;
+    Srb->Lun = (UCHAR)PdoExtension->Lun;
+
+    if (!PortMapRequest(FdoExtension, Request))
+    {
+        Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+        PortQueueCompletedRequest(FdoExtension, Srb);
+        return;
+    }
+
+    /* HwBuildIo returns FALSE when it has completed the request itself */
+    if (!MiniportBuildIo(&FdoExtension->Miniport, Srb))
+        return;
+
+    MiniportStartIo(&FdoExtension->Miniport, Srb);
+}
+
+
+VOID
+PortStartNextLuRequests(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension)
+{
+    KLOCK_QUEUE_HANDLE LockHandle;
+    PPORT_REQUEST Request;
+    PLIST_ENTRY Entry;
+
+    for (;;)
+    {
+        KeAcquireInStackQueuedSpinLock(&PdoExtension->RequestLock,
+                                       &LockHandle);
+
+        /* Keep no more requests outstanding than the LUN queue depth allows */
+        if (IsListEmpty(&PdoExtension->RequestListHead) ||
+            PdoExtension->ActiveCount >= PdoExtension->QueueDepth)
+        {
+            KeReleaseInStackQueuedSpinLock(&LockHandle);
+            return;
+        }
+
+        /* The adapter has run out of requests, a completion restarts us */
+        Request = PortAllocateRequest(PdoExtension->FdoExtension);
+        if (Request == NULL)
+        {
+            KeReleaseInStackQueuedSpinLock(&LockHandle);
+            return;
+        }
+
+        Entry = RemoveHeadList(&PdoExtension->RequestListHead);
+        PdoExtension->ActiveCount++;
+
+        KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+        PortStartRequest(PdoExtension,
+                         Request,
+                         CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry));
+    }
+}
+
+
 NTSTATUS
 NTAPI
 PortPdoScsi(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp)
 {
-    DPRINT1("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+    PPDO_DEVICE_EXTENSION DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    PSCSI_REQUEST_BLOCK Srb;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    NTSTATUS Status;
+
+    DPRINT("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+
+    DeviceExtension = (PPDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    ASSERT(DeviceExtension);
+    ASSERT(DeviceExtension->ExtensionType == PdoExtension);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Srb = Stack->Parameters.Scsi.Srb;
+    if (Srb == NULL)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+    else
+    {
+        switch (Srb->Function)
+        {
+            case SRB_FUNCTION_CLAIM_DEVICE:
+            case SRB_FUNCTION_ATTACH_DEVICE:
+                /* Hand our device object to the class driver */
+                Srb->DataBuffer = DeviceObject;
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                Status = STATUS_SUCCESS;
+                break;
+
+            case SRB_FUNCTION_RELEASE_DEVICE:
+            case SRB_FUNCTION_RELEASE_QUEUE:
+            case SRB_FUNCTION_FLUSH_QUEUE:
+            case SRB_FUNCTION_LOCK_QUEUE:
+            case SRB_FUNCTION_UNLOCK_QUEUE:
+                /* LUN queues are never frozen or locked */
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                Status = STATUS_SUCCESS;
+                break;
+
+            default:
+                /* Everything else goes to the miniport through the LUN queue */
+                IoMarkIrpPending(Irp);
+                Srb->SrbStatus = SRB_STATUS_PENDING;
+
+                KeAcquireInStackQueuedSpinLock(&DeviceExtension->RequestLock,
+                                               &LockHandle);
+                InsertTailList(&DeviceExtension->RequestListHead,
+                               &Irp->Tail.Overlay.ListEntry);
+                KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+                PortStartNextLuRequests(DeviceExtension);
+                return STATUS_PENDING;
+        }
+    }
 
     Irp->IoStatus.Information = 0;
-    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Status = Status;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    return STATUS_SUCCESS;
+    return Status;
+}
+
+
+NTSTATUS
+NTAPI
+PortPdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp)
+{
+    PPDO_DEVICE_EXTENSION DeviceExtension;
+    PPORT_CONFIGURATION_INFORMATION PortConfig;
+    PIO_STACK_LOCATION Stack;
+    PSTORAGE_PROPERTY_QUERY Query;
+    PSTORAGE_ADAPTER_DESCRIPTOR Descriptor;
+    PSCSI_ADDRESS Address;
+    ULONG_PTR Information = 0;
+    ULONG Length;
+    NTSTATUS Status;
+
+    DPRINT("PortPdoDeviceControl(%p %p)\n", DeviceObject, Irp);
+
+    DeviceExtension = (PPDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    ASSERT(DeviceExtension->ExtensionType == PdoExtension);
+
+    PortConfig = &DeviceExtension->FdoExtension->Miniport.PortConfig;
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Length = Stack->Parameters.DeviceIoControl.OutputBufferLength;
+
+    switch (Stack->Parameters.DeviceIoControl.IoControlCode)
+    {
+        case IOCTL_STORAGE_QUERY_PROPERTY:
+            Query = Irp->AssociatedIrp.SystemBuffer;
+            if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(STORAGE_PROPERTY_QUERY) ||
+                Query->PropertyId != StorageAdapterProperty)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            if (Query->QueryType == PropertyExistsQuery)
+            {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if (Query->QueryType != PropertyStandardQuery ||
+                Length < sizeof(STORAGE_DESCRIPTOR_HEADER))
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            /* Tell the class driver how large its transfers may get */
+            Descriptor = Irp->AssociatedIrp.SystemBuffer;
+            if (Length >= sizeof(STORAGE_ADAPTER_DESCRIPTOR))
+            {
+                RtlZeroMemory(Descriptor, sizeof(STORAGE_ADAPTER_DESCRIPTOR));
+                Descriptor->MaximumTransferLength = (DeviceExtension->FdoExtension->MaxSgElements - 1) * PAGE_SIZE;
+                if (PortConfig->MaximumTransferLength != SP_UNINITIALIZED_VALUE &&
+                    PortConfig->MaximumTransferLength < Descriptor->MaximumTransferLength)
+                {
+                    Descriptor->MaximumTransferLength = PortConfig->MaximumTransferLength;
+                }
+                Descriptor->MaximumPhysicalPages = DeviceExtension->FdoExtension->MaxSgElements;
+                Descriptor->AlignmentMask = PortConfig->AlignmentMask;
+                Descriptor->AdapterUsesPio = FALSE;
+                Descriptor->AdapterScansDown = PortConfig->AdapterScansDown;
+                Descriptor->CommandQueueing = PortConfig->TaggedQueuing;
+                Descriptor->AcceleratedTransfer = TRUE;
+                Descriptor->BusType = BusTypeUnknown;
+                Length = sizeof(STORAGE_ADAPTER_DESCRIPTOR);
+            }
+            else
+            {
+                Length = sizeof(STORAGE_DESCRIPTOR_HEADER);
+            }
+
+            Descriptor->Version = sizeof(STORAGE_ADAPTER_DESCRIPTOR);
+            Descriptor->Size = sizeof(STORAGE_ADAPTER_DESCRIPTOR);
+            Information = Length;
+            Status = STATUS_SUCCESS;
+            break;
+
+        case IOCTL_SCSI_GET_ADDRESS:
+            if (Length < sizeof(SCSI_ADDRESS))
+            {
+                Status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            Address = Irp->AssociatedIrp.SystemBuffer;
+            Address->Length = sizeof(SCSI_ADDRESS);
+            Address->PortNumber = 0;
+            Address->PathId = (UCHAR)DeviceExtension->Bus;
+            Address->TargetId = (UCHAR)DeviceExtension->Target;
+            Address->Lun = (UCHAR)DeviceExtension->Lun;
+            Information = sizeof(SCSI_ADDRESS);
+            Status = STATUS_SUCCESS;
+            break;
+
+        default:
+            DPRINT1("Unsupported IOCTL 0x%lx\n", Stack->Parameters.DeviceIoControl.IoControlCode);
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+    }
+
+    Irp->IoStatus.Information = Information;
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return Status;
 }
 
 
@@ -31,6 +31,15 @@
 #define TAG_ADDRESS_MAPPING 'MAtS'
 #define TAG_INQUIRY_DATA    'QItS'
 #define TAG_SENSE_DATA      'NStS'
+#define TAG_REQUEST_DATA    'QRtS'
+#define TAG_LUN_DATA        'ULtS'
+#define TAG_COMPLETION_DATA 'PCtS'
+
+/* Requests the adapter may have outstanding at once */
+#define PORT_MAXIMUM_REQUESTS       256
+
+/* Default queue depth of a LUN that takes more than one request */
+#define PORT_DEFAULT_QUEUE_DEPTH    16
 
 typedef enum
 {
@@ -87,6 +96,25 @@ typedef struct _UNIT_DATA
     INQUIRYDATA InquiryData;
 } UNIT_DATA, *PUNIT_DATA;
 
+/* An SRB that has been handed to the miniport */
+typedef struct _PORT_REQUEST
+{
+    SINGLE_LIST_ENTRY FreeEntry;
+    PIRP Irp;
+    PSCSI_REQUEST_BLOCK Srb;
+    struct _PDO_DEVICE_EXTENSION *PdoExtension;
+    PVOID SrbExtension;
+    PSTOR_SCATTER_GATHER_LIST SgList;
+} PORT_REQUEST, *PPORT_REQUEST;
+
+/* Completed requests of one processor, finished by its own DPC */
+typedef struct _PORT_COMPLETION_QUEUE
+{
+    KDPC Dpc;
+    KSPIN_LOCK Lock;
+    LIST_ENTRY ListHead;
+} PORT_COMPLETION_QUEUE, *PPORT_COMPLETION_QUEUE;
+
 typedef struct _FDO_DEVICE_EXTENSION
 {
     EXTENSION_TYPE ExtensionType;
@@ -115,6 +143,19 @@ typedef struct _FDO_DEVICE_EXTENSION
     KSPIN_LOCK PdoListLock;
     LIST_ENTRY PdoListHead;
     ULONG PdoCount;
+
+    KSPIN_LOCK StartIoLock;
+    KSPIN_LOCK RequestLock;
+    SINGLE_LIST_ENTRY FreeRequestList;
+    PPORT_REQUEST Requests;
+    ULONG RequestCount;
+    BOOLEAN RequestsExhausted;
+    PVOID SrbExtensionBase;
+    PHYSICAL_ADDRESS SrbExtensionPhysicalBase;
+    ULONG SrbExtensionSize;
+    ULONG MaxSgElements;
+    PPORT_COMPLETION_QUEUE CompletionQueues;
+    ULONG CompletionQueueCount;
 } FDO_DEVICE_EXTENSION, *PFDO_DEVICE_EXTENSION;
 
 
@@ -131,8 +172,13 @@ typedef struct _PDO_DEVICE_EXTENSION
     ULONG Target;
     ULONG Lun;
     PINQUIRYDATA InquiryBuffer;
+    PVOID LuExtension;
 
-
+    KSPIN_LOCK RequestLock;
+    LIST_ENTRY RequestListHead;
+    ULONG QueueDepth;
+    ULONG ActiveCount;
+    KDPC RestartDpc;
 } PDO_DEVICE_EXTENSION, *PPDO_DEVICE_EXTENSION;
 
 
@@ -150,6 +196,20 @@ PortFdoPnp(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp);
 
+PPORT_REQUEST
+PortAllocateRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension);
+
+BOOLEAN
+PortFreeRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request);
+
+VOID
+PortQueueCompletedRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
 
 /* miniport.c */
 
@@ -171,6 +231,11 @@ BOOLEAN
 MiniportHwInterrupt(
     _In_ PMINIPORT Miniport);
 
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
 BOOLEAN
 MiniportStartIo(
     _In_ PMINIPORT Miniport,
@@ -243,12 +308,29 @@ NTSTATUS
 PortDeletePdo(
     _In_ PPDO_DEVICE_EXTENSION PdoExtension);
 
+PPDO_DEVICE_EXTENSION
+PortGetPdoExtension(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ ULONG Bus,
+    _In_ ULONG Target,
+    _In_ ULONG Lun);
+
+VOID
+PortStartNextLuRequests(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension);
+
 NTSTATUS
 NTAPI
 PortPdoScsi(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp);
 
+NTSTATUS
+NTAPI
+PortPdoDeviceControl(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp);
+
 NTSTATUS
 NTAPI
 PortPdoPnp(
@@ -108,23 +108,32 @@ PortAcquireSpinLock(
     PVOID LockContext,
     PSTOR_LOCK_HANDLE LockHandle)
 {
-    DPRINT1("PortAcquireSpinLock(%p %lu %p %p)\n",
-            DeviceExtension, SpinLock, LockContext, LockHandle);
+    DPRINT("PortAcquireSpinLock(%p %lu %p %p)\n",
+           DeviceExtension, SpinLock, LockContext, LockHandle);
 
     LockHandle->Lock = SpinLock;
 
     switch (SpinLock)
     {
         case DpcLock: /* 1, */
-            DPRINT1("DpcLock\n");
+            DPRINT("DpcLock\n");
+            KeAcquireInStackQueuedSpinLock((PKSPIN_LOCK)&((PSTOR_DPC)LockContext)->Lock,
+                                           (PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
             break;
 
         case StartIoLock: /* 2 */
-            DPRINT1("StartIoLock\n");
+            DPRINT("StartIoLock\n");
+            /* Half duplex miniports run StartIo under the interrupt lock */
+            if (DeviceExtension->Miniport.PortConfig.SynchronizationModel == StorSynchronizeHalfDuplex &&
+                DeviceExtension->Interrupt != NULL)
+                LockHandle->Context.OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+            else
+                KeAcquireInStackQueuedSpinLock(&DeviceExtension->StartIoLock,
+                                               (PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
             break;
 
         case InterruptLock: /* 3 */
-            DPRINT1("InterruptLock\n");
+            DPRINT("InterruptLock\n");
             if (DeviceExtension->Interrupt == NULL)
                 LockHandle->Context.OldIrql = 0;
             else
@@ -140,21 +149,28 @@ PortReleaseSpinLock(
     PFDO_DEVICE_EXTENSION DeviceExtension,
     PSTOR_LOCK_HANDLE LockHandle)
 {
-    DPRINT1("PortReleaseSpinLock(%p %p)\n",
-            DeviceExtension, LockHandle);
+    DPRINT("PortReleaseSpinLock(%p %p)\n",
+           DeviceExtension, LockHandle);
 
     switch (LockHandle->Lock)
     {
         case DpcLock: /* 1, */
-            DPRINT1("DpcLock\n");
+            DPRINT("DpcLock\n");
+            KeReleaseInStackQueuedSpinLock((PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
             break;
 
         case StartIoLock: /* 2 */
-            DPRINT1("StartIoLock\n");
+            DPRINT("StartIoLock\n");
+            if (DeviceExtension->Miniport.PortConfig.SynchronizationModel == StorSynchronizeHalfDuplex &&
+                DeviceExtension->Interrupt != NULL)
+                KeReleaseInterruptSpinLock(DeviceExtension->Interrupt,
+                                           LockHandle->Context.OldIrql);
+            else
+                KeReleaseInStackQueuedSpinLock((PKLOCK_QUEUE_HANDLE)&LockHandle->Context);
             break;
 
         case InterruptLock: /* 3 */
-            DPRINT1("InterruptLock\n");
+            DPRINT("InterruptLock\n");
             if (DeviceExtension->Interrupt != NULL)
                 KeReleaseInterruptSpinLock(DeviceExtension->Interrupt,
                                            LockHandle->Context.OldIrql);
@@ -163,6 +179,27 @@ PortReleaseSpinLock(
 }
 
 
+typedef struct _PORT_SYNCHRONIZE_CONTEXT
+{
+    PVOID HwDeviceExtension;
+    PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine;
+    PVOID Context;
+} PORT_SYNCHRONIZE_CONTEXT, *PPORT_SYNCHRONIZE_CONTEXT;
+
+
+static
+BOOLEAN
+NTAPI
+PortSynchronizeRoutine(
+    _In_ PVOID SynchronizeContext)
+{
+    PPORT_SYNCHRONIZE_CONTEXT Context = SynchronizeContext;
+
+    return Context->SynchronizedAccessRoutine(Context->HwDeviceExtension,
+                                              Context->Context);
+}
+
+
 static
 NTSTATUS
 NTAPI
@@ -226,6 +263,9 @@ PortAddDevice(
     KeInitializeSpinLock(&DeviceExtension->PdoListLock);
     InitializeListHead(&DeviceExtension->PdoListHead);
 
+    KeInitializeSpinLock(&DeviceExtension->StartIoLock);
+    KeInitializeSpinLock(&DeviceExtension->RequestLock);
+
     /* Attach the FDO to the device stack */
     Status = IoAttachDeviceToDeviceStackSafe(Fdo,
                                              PhysicalDeviceObject,
@@ -327,9 +367,16 @@ PortDispatchDeviceControl(
     IN PDEVICE_OBJECT DeviceObject,
     IN PIRP Irp)
 {
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
     DPRINT1("PortDispatchDeviceControl(%p %p)\n",
             DeviceObject, Irp);
 
+    DeviceExtension = (PFDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    if (DeviceExtension->ExtensionType == PdoExtension)
+        return PortPdoDeviceControl(DeviceObject,
+                                    Irp);
+
     Irp->IoStatus.Status = STATUS_SUCCESS;
     Irp->IoStatus.Information = 0;
 
@@ -348,11 +395,11 @@ PortDispatchScsi(
 {
     PFDO_DEVICE_EXTENSION DeviceExtension;
 
-    DPRINT1("PortDispatchScsi(%p %p)\n",
-            DeviceObject, Irp);
+    DPRINT("PortDispatchScsi(%p %p)\n",
+           DeviceObject, Irp);
 
     DeviceExtension = (PFDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
-    DPRINT1("ExtensionType: %u\n", DeviceExtension->ExtensionType);
+    DPRINT("ExtensionType: %u\n", DeviceExtension->ExtensionType);
 
     switch (DeviceExtension->ExtensionType)
     {
@@ -765,7 +812,7 @@ StorPortGetDeviceBase(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 PVOID
@@ -776,9 +823,24 @@ StorPortGetLogicalUnit(
     _In_ UCHAR TargetId,
     _In_ UCHAR Lun)
 {
-    DPRINT1("StorPortGetLogicalUnit()\n");
-    UNIMPLEMENTED;
-    return NULL;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortGetLogicalUnit(%p %u %u %u)\n",
+           HwDeviceExtension, PathId, TargetId, Lun);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+
+    PdoExtension = PortGetPdoExtension(MiniportExtension->Miniport->DeviceExtension,
+                                       PathId,
+                                       TargetId,
+                                       Lun);
+    if (PdoExtension == NULL)
+        return NULL;
+
+    return PdoExtension->LuExtension;
 }
 
 
@@ -799,15 +861,15 @@ StorPortGetPhysicalAddress(
     STOR_PHYSICAL_ADDRESS PhysicalAddress;
     ULONG_PTR Offset;
 
-    DPRINT1("StorPortGetPhysicalAddress(%p %p %p %p)\n",
-            HwDeviceExtension, Srb, VirtualAddress, Length);
+    DPRINT("StorPortGetPhysicalAddress(%p %p %p %p)\n",
+           HwDeviceExtension, Srb, VirtualAddress, Length);
 
     /* Get the miniport extension */
     MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
                                           MINIPORT_DEVICE_EXTENSION,
                                           HwDeviceExtension);
-    DPRINT1("HwDeviceExtension %p  MiniportExtension %p\n",
-            HwDeviceExtension, MiniportExtension);
+    DPRINT("HwDeviceExtension %p  MiniportExtension %p\n",
+           HwDeviceExtension, MiniportExtension);
 
     DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
 
@@ -823,6 +885,19 @@ StorPortGetPhysicalAddress(
         return PhysicalAddress;
     }
 
+    /* Inside of the SRB extension block? */
+    if (DeviceExtension->SrbExtensionBase != NULL &&
+        ((ULONG_PTR)VirtualAddress >= (ULONG_PTR)DeviceExtension->SrbExtensionBase) &&
+        ((ULONG_PTR)VirtualAddress < (ULONG_PTR)DeviceExtension->SrbExtensionBase + DeviceExtension->RequestCount * DeviceExtension->SrbExtensionSize))
+    {
+        Offset = (ULONG_PTR)VirtualAddress - (ULONG_PTR)DeviceExtension->SrbExtensionBase;
+
+        PhysicalAddress.QuadPart = DeviceExtension->SrbExtensionPhysicalBase.QuadPart + Offset;
+        *Length = DeviceExtension->SrbExtensionSize - (ULONG)(Offset % DeviceExtension->SrbExtensionSize);
+
+        return PhysicalAddress;
+    }
+
     // FIXME
 
 
@@ -838,7 +913,7 @@ StorPortGetPhysicalAddress(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 PSTOR_SCATTER_GATHER_LIST
@@ -847,9 +922,22 @@ StorPortGetScatterGatherList(
     _In_ PVOID DeviceExtension,
     _In_ PSCSI_REQUEST_BLOCK Srb)
 {
-    DPRINT1("StorPortGetScatterGatherList()\n");
-    UNIMPLEMENTED;
-    return NULL;
+    PPORT_REQUEST Request;
+    PIRP Irp;
+
+    DPRINT("StorPortGetScatterGatherList(%p %p)\n",
+           DeviceExtension, Srb);
+
+    /* Only requests that went through the LUN queues have a list */
+    Irp = (PIRP)Srb->OriginalRequest;
+    if (Irp == NULL)
+        return NULL;
+
+    Request = (PPORT_REQUEST)Irp->Tail.Overlay.DriverContext[0];
+    if (Request == NULL || Request->Srb != Srb || Request->SgList->NumberOfElements == 0)
+        return NULL;
+
+    return Request->SgList;
 }
 
 
@@ -1100,6 +1188,9 @@ StorPortNotification(
     PHW_PASSIVE_INITIALIZE_ROUTINE HwPassiveInitRoutine;
     PSTORPORT_EXTENDED_FUNCTIONS *ppExtendedFunctions;
     PBOOLEAN Result;
+    PLONG DpcResult;
+    PVOID SystemArgument1;
+    PVOID SystemArgument2;
     PSTOR_DPC Dpc;
     PHW_DPC_ROUTINE HwDpcRoutine;
     va_list ap;
@@ -1109,8 +1200,8 @@ StorPortNotification(
     PSTOR_LOCK_HANDLE LockHandle;
     PSCSI_REQUEST_BLOCK Srb;
 
-    DPRINT1("StorPortNotification(%x %p)\n",
-            NotificationType, HwDeviceExtension);
+    DPRINT("StorPortNotification(%x %p)\n",
+           NotificationType, HwDeviceExtension);
 
     /* Get the miniport extension */
     if (HwDeviceExtension != NULL)
@@ -1118,8 +1209,8 @@ StorPortNotification(
         MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
                                               MINIPORT_DEVICE_EXTENSION,
                                               HwDeviceExtension);
-        DPRINT1("HwDeviceExtension %p  MiniportExtension %p\n",
-                HwDeviceExtension, MiniportExtension);
+        DPRINT("HwDeviceExtension %p  MiniportExtension %p\n",
+               HwDeviceExtension, MiniportExtension);
 
         DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
     }
@@ -1129,14 +1220,11 @@ StorPortNotification(
     switch (NotificationType)
     {
         case RequestComplete:
-            DPRINT1("RequestComplete\n");
+            DPRINT("RequestComplete\n");
             Srb = (PSCSI_REQUEST_BLOCK)va_arg(ap, PSCSI_REQUEST_BLOCK);
-            DPRINT1("Srb %p\n", Srb);
-            if (Srb->OriginalRequest != NULL)
-            {
-                DPRINT1("Need to complete the IRP!\n");
-
-            }
+            DPRINT("Srb %p\n", Srb);
+            if (Srb->OriginalRequest != NULL && DeviceExtension != NULL)
+                PortQueueCompletedRequest(DeviceExtension, Srb);
             break;
 
         case GetExtendedFunctionTable:
@@ -1169,20 +1257,33 @@ StorPortNotification(
             HwDpcRoutine = (PHW_DPC_ROUTINE)va_arg(ap, PHW_DPC_ROUTINE);
             DPRINT1("HwDpcRoutine %p\n", HwDpcRoutine);
 
+            /* The miniport DPC routine expects its own device extension */
             KeInitializeDpc((PRKDPC)&Dpc->Dpc,
                             (PKDEFERRED_ROUTINE)HwDpcRoutine,
-                            (PVOID)DeviceExtension);
-            KeInitializeSpinLock(&Dpc->Lock);
+                            HwDeviceExtension);
+            KeInitializeSpinLock((PKSPIN_LOCK)&Dpc->Lock);
+            break;
+
+        case IssueDpc:
+            DPRINT("IssueDpc\n");
+            Dpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            SystemArgument1 = (PVOID)va_arg(ap, PVOID);
+            SystemArgument2 = (PVOID)va_arg(ap, PVOID);
+            DpcResult = (PLONG)va_arg(ap, PLONG);
+
+            *DpcResult = KeInsertQueueDpc((PRKDPC)&Dpc->Dpc,
+                                          SystemArgument1,
+                                          SystemArgument2);
             break;
 
         case AcquireSpinLock:
-            DPRINT1("AcquireSpinLock\n");
+            DPRINT("AcquireSpinLock\n");
             SpinLock = (STOR_SPINLOCK)va_arg(ap, STOR_SPINLOCK);
-            DPRINT1("SpinLock %lu\n", SpinLock);
+            DPRINT("SpinLock %lu\n", SpinLock);
             LockContext = (PVOID)va_arg(ap, PVOID);
-            DPRINT1("LockContext %p\n", LockContext);
+            DPRINT("LockContext %p\n", LockContext);
             LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
-            DPRINT1("LockHandle %p\n", LockHandle);
+            DPRINT("LockHandle %p\n", LockHandle);
             PortAcquireSpinLock(DeviceExtension,
                                 SpinLock,
                                 LockContext,
@@ -1190,9 +1291,9 @@ StorPortNotification(
             break;
 
         case ReleaseSpinLock:
-            DPRINT1("ReleaseSpinLock\n");
+            DPRINT("ReleaseSpinLock\n");
             LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
-            DPRINT1("LockHandle %p\n", LockHandle);
+            DPRINT("LockHandle %p\n", LockHandle);
             PortReleaseSpinLock(DeviceExtension,
                                 LockHandle);
             break;
@@ -1390,7 +1491,7 @@ StorPortSetBusDataByOffset(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1402,9 +1503,35 @@ StorPortSetDeviceQueueDepth(
     _In_ UCHAR Lun,
     _In_ ULONG Depth)
 {
-    DPRINT1("StorPortSetDeviceQueueDepth()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    ULONG OldDepth;
+
+    DPRINT1("StorPortSetDeviceQueueDepth(%p %u %u %u %lu)\n",
+            HwDeviceExtension, PathId, TargetId, Lun, Depth);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+
+    PdoExtension = PortGetPdoExtension(MiniportExtension->Miniport->DeviceExtension,
+                                       PathId,
+                                       TargetId,
+                                       Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    OldDepth = InterlockedExchange((PLONG)&PdoExtension->QueueDepth, max(Depth, 1));
+
+    /*
+     * A lower depth takes effect with the next request that is started. The
+     * miniport may call us from HwStartIo, so waiting requests are started
+     * from a DPC rather than from here.
+     */
+    if (Depth > OldDepth)
+        KeInsertQueueDpc(&PdoExtension->RestartDpc, NULL, NULL);
+
+    return TRUE;
 }
 
 
@@ -1422,7 +1549,7 @@ StorPortStallExecution(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 VOID
@@ -1432,8 +1559,31 @@ StorPortSynchronizeAccess(
     _In_ PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine,
     _In_opt_ PVOID Context)
 {
-    DPRINT1("StorPortSynchronizeAccess()\n");
-    UNIMPLEMENTED;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PORT_SYNCHRONIZE_CONTEXT SynchronizeContext;
+
+    DPRINT("StorPortSynchronizeAccess(%p %p %p)\n",
+           HwDeviceExtension, SynchronizedAccessRoutine, Context);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    if (DeviceExtension->Interrupt == NULL)
+    {
+        SynchronizedAccessRoutine(HwDeviceExtension, Context);
+        return;
+    }
+
+    SynchronizeContext.HwDeviceExtension = HwDeviceExtension;
+    SynchronizeContext.SynchronizedAccessRoutine = SynchronizedAccessRoutine;
+    SynchronizeContext.Context = Context;
+
+    KeSynchronizeExecution(DeviceExtension->Interrupt,
+                           PortSynchronizeRoutine,
+                           &SynchronizeContext);
 }
 
 
@@ -0,0 +1,580 @@
+/*
+ * PROJECT:     ReactOS VirtIO Block Miniport
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Translation of SCSI commands to virtio-blk requests
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "viostor.h"
+
+/*
+ * The device only knows reads, writes, flushes and discards. Everything else
+ * the disk class driver asks for is answered from the device configuration.
+ */
+
+static
+ULONG
+VioStorGetUlong (
+    __in PUCHAR Bytes
+    )
+{
+    return ((ULONG)Bytes[0] << 24) | ((ULONG)Bytes[1] << 16) | ((ULONG)Bytes[2] << 8) | Bytes[3];
+}
+
+static
+ULONG64
+VioStorGetUlong64 (
+    __in PUCHAR Bytes
+    )
+{
+    return ((ULONG64)VioStorGetUlong(Bytes) << 32) | VioStorGetUlong(Bytes + 4);
+}
+
+static
+VOID
+VioStorSetUlong (
+    __out PUCHAR Bytes,
+    __in ULONG Value
+    )
+{
+    Bytes[0] = (UCHAR)(Value >> 24);
+    Bytes[1] = (UCHAR)(Value >> 16);
+    Bytes[2] = (UCHAR)(Value >> 8);
+    Bytes[3] = (UCHAR)Value;
+}
+
+static
+VOID
+VioStorSetUlong64 (
+    __out PUCHAR Bytes,
+    __in ULONG64 Value
+    )
+{
+    VioStorSetUlong(Bytes, (ULONG)(Value >> 32));
+    VioStorSetUlong(Bytes + 4, (ULONG)Value);
+}
+
+static
+BOOLEAN
+VioStorCompleteSrb (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in UCHAR SrbStatus
+    )
+{
+    Srb->SrbStatus = SrbStatus;
+    StorPortNotification(RequestComplete, AdapterExtension, Srb);
+
+    // nothing left for HwStartIo
+    return FALSE;
+}
+
+static
+UCHAR
+VioStorReturnData (
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in PVOID Data,
+    __in ULONG Length
+    )
+{
+    if (Srb->DataBuffer == NULL)
+        return SRB_STATUS_INVALID_REQUEST;
+
+    Length = min(Length, Srb->DataTransferLength);
+    StorPortMoveMemory(Srb->DataBuffer, Data, Length);
+    Srb->DataTransferLength = Length;
+
+    return SRB_STATUS_SUCCESS;
+}
+
+static
+VOID
+VioStorSetBufferDescriptor (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in ULONG Index,
+    __in PVOID Buffer,
+    __in ULONG Length
+    )
+{
+    PVIOSTOR_SRB_EXTENSION srbExtension = GetSrbExtension(Srb);
+    ULONG physicalLength;
+
+    srbExtension->Sg[Index].physAddr = StorPortGetPhysicalAddress(AdapterExtension, Srb, Buffer, &physicalLength);
+    srbExtension->Sg[Index].length = Length;
+}
+
+/**
+ * @name VioStorBuildRequest
+ *
+ * Lay out header, payload and status byte of a request in its SRB extension.
+ * Payload segments are either the data buffer or the discard segment list.
+ */
+static
+BOOLEAN
+VioStorBuildRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in ULONG Type,
+    __in ULONG64 Sector,
+    __in ULONG DiscardSegments
+    )
+{
+    PVIOSTOR_SRB_EXTENSION srbExtension = GetSrbExtension(Srb);
+    PSTOR_SCATTER_GATHER_LIST sgl;
+    ULONG index, count;
+
+    srbExtension->Header.Type = Type;
+    srbExtension->Header.IoPriority = 0;
+    srbExtension->Header.Sector = Sector;
+    srbExtension->Status = 0xFF;
+
+    count = 0;
+    VioStorSetBufferDescriptor(AdapterExtension, Srb, count++, &srbExtension->Header, sizeof(srbExtension->Header));
+
+    if (Type == VIRTIO_BLK_T_IN || Type == VIRTIO_BLK_T_OUT)
+    {
+        sgl = StorPortGetScatterGatherList(AdapterExtension, Srb);
+        if (sgl == NULL || sgl->NumberOfElements == 0 || sgl->NumberOfElements > AdapterExtension->MaxSegments)
+            return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_INVALID_REQUEST);
+
+        for (index = 0; index < sgl->NumberOfElements; index++, count++)
+        {
+            srbExtension->Sg[count].physAddr = sgl->List[index].PhysicalAddress;
+            srbExtension->Sg[count].length = sgl->List[index].Length;
+        }
+    }
+    else if (Type == VIRTIO_BLK_T_DISCARD)
+    {
+        VioStorSetBufferDescriptor(AdapterExtension, Srb, count++, srbExtension->Discard,
+                                   DiscardSegments * sizeof(VIRTIO_BLK_DISCARD_SEGMENT));
+    }
+
+    // the device writes read data and the status byte
+    if (Type == VIRTIO_BLK_T_IN)
+    {
+        srbExtension->OutCount = 1;
+        srbExtension->InCount = count;
+    }
+    else
+    {
+        srbExtension->OutCount = count;
+        srbExtension->InCount = 1;
+    }
+
+    VioStorSetBufferDescriptor(AdapterExtension, Srb, count, &srbExtension->Status, sizeof(srbExtension->Status));
+
+    return TRUE;
+}
+
+VOID
+VioStorBuildFlushRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    VioStorBuildRequest(AdapterExtension, Srb, VIRTIO_BLK_T_FLUSH, 0, 0);
+}
+
+/**
+ * @name VioStorSetQueueDepth
+ *
+ * Let the port driver keep as many requests outstanding as the ring holds.
+ * Retried on every read and write until the port knows the unit.
+ */
+static
+VOID
+VioStorSetQueueDepth (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    ULONG depth;
+
+    if (AdapterExtension->QueueDepthSet)
+        return;
+
+    depth = AdapterExtension->IndirectDescriptors ?
+            AdapterExtension->QueueSize :
+            max(AdapterExtension->QueueSize / (AdapterExtension->MaxSegments + 2), 1);
+
+    if (StorPortSetDeviceQueueDepth(AdapterExtension, Srb->PathId, Srb->TargetId, Srb->Lun, depth))
+        AdapterExtension->QueueDepthSet = TRUE;
+}
+
+static
+BOOLEAN
+VioStorReadWrite (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PUCHAR cdb = Srb->Cdb;
+    ULONG64 lba, length;
+    ULONG blocks;
+    BOOLEAN isWrite;
+
+    switch (cdb[0])
+    {
+        case SCSIOP_READ6:
+        case SCSIOP_WRITE6:
+            lba = ((ULONG)(cdb[1] & 0x1F) << 16) | ((ULONG)cdb[2] << 8) | cdb[3];
+            blocks = cdb[4] ? cdb[4] : 256;
+            break;
+
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+            lba = VioStorGetUlong(&cdb[2]);
+            blocks = ((ULONG)cdb[7] << 8) | cdb[8];
+            break;
+
+        case SCSIOP_READ12:
+        case SCSIOP_WRITE12:
+            lba = VioStorGetUlong(&cdb[2]);
+            blocks = VioStorGetUlong(&cdb[6]);
+            break;
+
+        default:
+            lba = VioStorGetUlong64(&cdb[2]);
+            blocks = VioStorGetUlong(&cdb[10]);
+            break;
+    }
+
+    isWrite = (cdb[0] == SCSIOP_WRITE6 || cdb[0] == SCSIOP_WRITE ||
+               cdb[0] == SCSIOP_WRITE12 || cdb[0] == SCSIOP_WRITE16);
+
+    if (isWrite && AdapterExtension->ReadOnly)
+    {
+        return VioStorCompleteSrb(AdapterExtension, Srb,
+                                  VioStorSetSenseData(Srb, SCSI_SENSE_DATA_PROTECT, SCSI_ADSENSE_WRITE_PROTECT));
+    }
+
+    if (blocks == 0)
+        return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_SUCCESS);
+
+    // a READ(12)/READ(16) block count times the block size does not fit a ULONG
+    length = (ULONG64)blocks * AdapterExtension->BlockSize;
+
+    if (lba > AdapterExtension->LastLba || blocks - 1 > AdapterExtension->LastLba - lba ||
+        Srb->DataTransferLength < length)
+    {
+        return VioStorCompleteSrb(AdapterExtension, Srb,
+                                  VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_BLOCK));
+    }
+
+    Srb->DataTransferLength = (ULONG)length;
+
+    VioStorSetQueueDepth(AdapterExtension, Srb);
+
+    return VioStorBuildRequest(AdapterExtension,
+                               Srb,
+                               isWrite ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+                               lba * AdapterExtension->SectorsPerBlock,
+                               0);
+}
+
+/**
+ * @name VioStorUnmap
+ *
+ * Turn the UNMAP parameter list into virtio-blk discard segments.
+ */
+static
+BOOLEAN
+VioStorUnmap (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PVIOSTOR_SRB_EXTENSION srbExtension = GetSrbExtension(Srb);
+    PUCHAR parameterList, descriptor;
+    ULONG descriptorCount, segmentCount, index, length, maxSectors;
+    ULONG64 sector, sectors;
+
+    if (!AdapterExtension->DiscardSupported)
+    {
+        return VioStorCompleteSrb(AdapterExtension, Srb,
+                                  VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND));
+    }
+
+    // 8 byte header followed by 16 byte block descriptors
+    parameterList = Srb->DataBuffer;
+    if (parameterList == NULL || Srb->DataTransferLength < 8)
+        return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_INVALID_REQUEST);
+
+    descriptorCount = (((ULONG)parameterList[2] << 8) | parameterList[3]) / 16;
+    if (8 + descriptorCount * 16 > Srb->DataTransferLength)
+        return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_INVALID_REQUEST);
+
+    maxSectors = AdapterExtension->Config.MaxDiscardSectors ? AdapterExtension->Config.MaxDiscardSectors : MAXULONG;
+
+    segmentCount = 0;
+    for (index = 0; index < descriptorCount; index++)
+    {
+        descriptor = &parameterList[8 + index * 16];
+        sector = VioStorGetUlong64(descriptor) * AdapterExtension->SectorsPerBlock;
+        sectors = (ULONG64)VioStorGetUlong(descriptor + 8) * AdapterExtension->SectorsPerBlock;
+
+        while (sectors != 0)
+        {
+            if (segmentCount == AdapterExtension->MaxDiscardSegments)
+            {
+                return VioStorCompleteSrb(AdapterExtension, Srb,
+                                          VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB));
+            }
+
+            length = (ULONG)min(sectors, maxSectors);
+            srbExtension->Discard[segmentCount].Sector = sector;
+            srbExtension->Discard[segmentCount].NumSectors = length;
+            srbExtension->Discard[segmentCount].Flags = 0;
+            segmentCount++;
+
+            sector += length;
+            sectors -= length;
+        }
+    }
+
+    if (segmentCount == 0)
+        return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_SUCCESS);
+
+    return VioStorBuildRequest(AdapterExtension, Srb, VIRTIO_BLK_T_DISCARD, 0, segmentCount);
+}
+
+static
+UCHAR
+VioStorInquiry (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    UCHAR buffer[64];
+    INQUIRYDATA inquiryData;
+    ULONG maxBlocks;
+    PUCHAR cdb = Srb->Cdb;
+
+    RtlZeroMemory(buffer, sizeof(buffer));
+
+    if (!(cdb[1] & 1))
+    {
+        if (cdb[2] != 0)
+            return VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+
+        RtlZeroMemory(&inquiryData, sizeof(inquiryData));
+        inquiryData.DeviceType = DIRECT_ACCESS_DEVICE;
+        inquiryData.Versions = 5;           // SPC-3
+        inquiryData.ResponseDataFormat = 2;
+        inquiryData.AdditionalLength = sizeof(INQUIRYDATA) - 5;
+        inquiryData.CommandQueue = 1;
+        RtlCopyMemory(inquiryData.VendorId, "VirtIO  ", sizeof(inquiryData.VendorId));
+        RtlCopyMemory(inquiryData.ProductId, "Block Device    ", sizeof(inquiryData.ProductId));
+        RtlCopyMemory(inquiryData.ProductRevisionLevel, "0001", sizeof(inquiryData.ProductRevisionLevel));
+
+        // the LUN queue depth is bounded by the ring size
+        VioStorSetQueueDepth(AdapterExtension, Srb);
+
+        return VioStorReturnData(Srb, &inquiryData, sizeof(inquiryData));
+    }
+
+    buffer[1] = cdb[2];
+
+    switch (cdb[2])
+    {
+        case VPD_SUPPORTED_PAGES:
+            buffer[3] = 2;
+            buffer[4] = VPD_SUPPORTED_PAGES;
+            buffer[5] = VPD_BLOCK_LIMITS;
+            if (AdapterExtension->DiscardSupported)
+                buffer[4 + buffer[3]++] = VPD_LOGICAL_BLOCK_PROVISIONING;
+            return VioStorReturnData(Srb, buffer, 4 + buffer[3]);
+
+        case VPD_BLOCK_LIMITS:
+            buffer[3] = 0x3C;
+            maxBlocks = (AdapterExtension->MaxSegments - 1) * (PAGE_SIZE / AdapterExtension->BlockSize);
+            VioStorSetUlong(&buffer[8], maxBlocks);     // maximum transfer length
+            if (AdapterExtension->DiscardSupported)
+            {
+                VioStorSetUlong(&buffer[20], AdapterExtension->Config.MaxDiscardSectors ?
+                                             AdapterExtension->Config.MaxDiscardSectors / AdapterExtension->SectorsPerBlock :
+                                             MAXULONG);
+                VioStorSetUlong(&buffer[24], AdapterExtension->MaxDiscardSegments);
+                VioStorSetUlong(&buffer[28], max(AdapterExtension->Config.DiscardSectorAlignment / AdapterExtension->SectorsPerBlock, 1));
+            }
+            return VioStorReturnData(Srb, buffer, 4 + buffer[3]);
+
+        case VPD_LOGICAL_BLOCK_PROVISIONING:
+            if (!AdapterExtension->DiscardSupported)
+                break;
+            buffer[3] = 4;
+            buffer[5] = 0x80;                   // LBPU, UNMAP is supported
+            return VioStorReturnData(Srb, buffer, 4 + buffer[3]);
+    }
+
+    return VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+}
+
+static
+UCHAR
+VioStorReadCapacity (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    UCHAR buffer[32];
+
+    RtlZeroMemory(buffer, sizeof(buffer));
+
+    if (Srb->Cdb[0] == SCSIOP_READ_CAPACITY)
+    {
+        VioStorSetUlong(&buffer[0], (ULONG)min(AdapterExtension->LastLba, MAXULONG));
+        VioStorSetUlong(&buffer[4], AdapterExtension->BlockSize);
+        return VioStorReturnData(Srb, buffer, 8);
+    }
+
+    VioStorSetUlong64(&buffer[0], AdapterExtension->LastLba);
+    VioStorSetUlong(&buffer[8], AdapterExtension->BlockSize);
+    buffer[13] = AdapterExtension->Config.Topology.PhysicalBlockExp & 0x0F;
+    if (AdapterExtension->DiscardSupported)
+        buffer[14] = 0x80;                      // LBPME
+    return VioStorReturnData(Srb, buffer, sizeof(buffer));
+}
+
+static
+UCHAR
+VioStorModeSense (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    UCHAR buffer[8 + 20];
+    UCHAR deviceSpecific, pageCode;
+    ULONG headerLength, length;
+    PUCHAR page;
+
+    RtlZeroMemory(buffer, sizeof(buffer));
+
+    headerLength = (Srb->Cdb[0] == SCSIOP_MODE_SENSE) ? sizeof(MODE_PARAMETER_HEADER) : sizeof(MODE_PARAMETER_HEADER10);
+    pageCode = Srb->Cdb[2] & 0x3F;
+
+    deviceSpecific = AdapterExtension->ReadOnly ? 0x80 : 0;     // WP
+    if (AdapterExtension->FlushSupported)
+        deviceSpecific |= 0x10;                                 // DPOFUA
+
+    length = headerLength;
+    if (pageCode == MODE_PAGE_CACHING || pageCode == MODE_SENSE_RETURN_ALL)
+    {
+        page = &buffer[headerLength];
+        page[0] = MODE_PAGE_CACHING;
+        page[1] = 0x12;
+        if (AdapterExtension->FlushSupported)
+            page[2] = 0x04;                                     // WCE
+        length += 20;
+    }
+
+    if (headerLength == sizeof(MODE_PARAMETER_HEADER))
+    {
+        buffer[0] = (UCHAR)(length - 1);
+        buffer[2] = deviceSpecific;
+    }
+    else
+    {
+        buffer[1] = (UCHAR)(length - 2);
+        buffer[3] = deviceSpecific;
+    }
+
+    return VioStorReturnData(Srb, buffer, length);
+}
+
+static
+UCHAR
+VioStorReportLuns (
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    UCHAR buffer[16];
+
+    // a single LUN 0
+    RtlZeroMemory(buffer, sizeof(buffer));
+    buffer[3] = 8;
+
+    return VioStorReturnData(Srb, buffer, sizeof(buffer));
+}
+
+/**
+ * @name VioStorBuildScsiRequest
+ *
+ * @return
+ * TRUE if the request has to go to the device, FALSE if it was completed.
+ */
+BOOLEAN
+VioStorBuildScsiRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    UCHAR srbStatus;
+
+    if (Srb->PathId != 0 || Srb->TargetId != 0 || Srb->Lun != 0)
+        return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_NO_DEVICE);
+
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ6:
+        case SCSIOP_READ:
+        case SCSIOP_READ12:
+        case SCSIOP_READ16:
+        case SCSIOP_WRITE6:
+        case SCSIOP_WRITE:
+        case SCSIOP_WRITE12:
+        case SCSIOP_WRITE16:
+            return VioStorReadWrite(AdapterExtension, Srb);
+
+        case SCSIOP_SYNCHRONIZE_CACHE:
+        case SCSIOP_SYNCHRONIZE_CACHE16:
+            if (!AdapterExtension->FlushSupported)
+                return VioStorCompleteSrb(AdapterExtension, Srb, SRB_STATUS_SUCCESS);
+            VioStorBuildFlushRequest(AdapterExtension, Srb);
+            return TRUE;
+
+        case SCSIOP_UNMAP:
+            return VioStorUnmap(AdapterExtension, Srb);
+
+        case SCSIOP_INQUIRY:
+            srbStatus = VioStorInquiry(AdapterExtension, Srb);
+            break;
+
+        case SCSIOP_READ_CAPACITY:
+            srbStatus = VioStorReadCapacity(AdapterExtension, Srb);
+            break;
+
+        case SCSIOP_SERVICE_ACTION_IN16:
+            if ((Srb->Cdb[1] & 0x1F) == SERVICE_ACTION_READ_CAPACITY16)
+                srbStatus = VioStorReadCapacity(AdapterExtension, Srb);
+            else
+                srbStatus = VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_INVALID_CDB);
+            break;
+
+        case SCSIOP_MODE_SENSE:
+        case SCSIOP_MODE_SENSE10:
+            srbStatus = VioStorModeSense(AdapterExtension, Srb);
+            break;
+
+        case SCSIOP_REPORT_LUNS:
+            srbStatus = VioStorReportLuns(Srb);
+            break;
+
+        case SCSIOP_TEST_UNIT_READY:
+        case SCSIOP_START_STOP_UNIT:
+        case SCSIOP_MEDIUM_REMOVAL:
+        case SCSIOP_VERIFY:
+        case SCSIOP_VERIFY16:
+            srbStatus = SRB_STATUS_SUCCESS;
+            break;
+
+        default:
+            srbStatus = VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND);
+            break;
+    }
+
+    return VioStorCompleteSrb(AdapterExtension, Srb, srbStatus);
+}
+
+/* EOF */
@@ -0,0 +1,593 @@
+/*
+ * PROJECT:     ReactOS VirtIO Block Miniport
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Storport miniport driver for virtio-blk devices
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "viostor.h"
+
+/*
+ * Requests are spread over up to VIOSTOR_MAX_QUEUES request queues, picked
+ * by the processor that issues them, so the host can serve them in parallel.
+ * Each request takes a single ring slot through an indirect descriptor table
+ * kept in its SRB extension. With VIRTIO_RING_F_EVENT_IDX the device is only
+ * notified, and only interrupts us, when the other side actually needs it.
+ */
+
+static const ULONG64 VioStorWantedFeatures =
+    (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+    (1ULL << VIRTIO_BLK_F_RO) |
+    (1ULL << VIRTIO_BLK_F_BLK_SIZE) |
+    (1ULL << VIRTIO_BLK_F_FLUSH) |
+    (1ULL << VIRTIO_BLK_F_TOPOLOGY) |
+    (1ULL << VIRTIO_BLK_F_MQ) |
+    (1ULL << VIRTIO_BLK_F_DISCARD) |
+    (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
+    (1ULL << VIRTIO_RING_F_EVENT_IDX) |
+    (1ULL << VIRTIO_F_ANY_LAYOUT) |
+    (1ULL << VIRTIO_F_VERSION_1);
+
+#define VioStorGetConfigField(AdapterExtension, Field) \
+    virtio_get_config(&(AdapterExtension)->VirtIODevice, \
+                      FIELD_OFFSET(VIRTIO_BLK_CONFIG, Field), \
+                      &(AdapterExtension)->Config.Field, \
+                      sizeof((AdapterExtension)->Config.Field))
+
+static
+VOID
+VioStorReadConfig (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension
+    )
+{
+    ULONG64 features = AdapterExtension->Features;
+
+    VioStorGetConfigField(AdapterExtension, Capacity);
+
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_SEG_MAX))
+        VioStorGetConfigField(AdapterExtension, SegMax);
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_BLK_SIZE))
+        VioStorGetConfigField(AdapterExtension, BlkSize);
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_TOPOLOGY))
+        VioStorGetConfigField(AdapterExtension, Topology);
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_MQ))
+        VioStorGetConfigField(AdapterExtension, NumQueues);
+
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_DISCARD))
+    {
+        VioStorGetConfigField(AdapterExtension, MaxDiscardSectors);
+        VioStorGetConfigField(AdapterExtension, MaxDiscardSeg);
+        VioStorGetConfigField(AdapterExtension, DiscardSectorAlignment);
+    }
+}
+
+static
+VOID
+VioStorUpdateCapacity (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension
+    )
+{
+    ULONG64 blocks;
+
+    VioStorGetConfigField(AdapterExtension, Capacity);
+
+    blocks = AdapterExtension->Config.Capacity / AdapterExtension->SectorsPerBlock;
+    AdapterExtension->LastLba = (blocks != 0) ? blocks - 1 : 0;
+}
+
+/**
+ * @name VioStorHwFindAdapter
+ *
+ * Negotiate features with the device, read its configuration and set up
+ * the request queues in the uncached extension.
+ */
+static
+ULONG
+NTAPI
+VioStorHwFindAdapter (
+    __in PVOID DeviceExtension,
+    __in PVOID HwContext,
+    __in PVOID BusInformation,
+    __in PCHAR ArgumentString,
+    __inout PPORT_CONFIGURATION_INFORMATION ConfigInfo,
+    __in PBOOLEAN Reserved3
+    )
+{
+    PVIOSTOR_ADAPTER_EXTENSION adapterExtension = DeviceExtension;
+    VirtIODevice *vdev = &adapterExtension->VirtIODevice;
+    PACCESS_RANGE accessRange;
+    ULONG index, poolSize, pci_cfg_len;
+    ULONG64 features;
+    USHORT queueSize;
+    unsigned long ringSize, heapSize;
+    NTSTATUS status;
+    int bar;
+
+    DPRINT("VioStorHwFindAdapter()\n");
+
+    UNREFERENCED_PARAMETER(HwContext);
+    UNREFERENCED_PARAMETER(BusInformation);
+    UNREFERENCED_PARAMETER(ArgumentString);
+    UNREFERENCED_PARAMETER(Reserved3);
+
+    adapterExtension->SystemIoBusNumber = ConfigInfo->SystemIoBusNumber;
+    adapterExtension->SlotNumber = ConfigInfo->SlotNumber;
+    adapterExtension->AdapterInterfaceType = ConfigInfo->AdapterInterfaceType;
+
+    // the virtio capabilities live in the device specific part of the configuration space
+    pci_cfg_len = StorPortGetBusData(adapterExtension,
+                                     PCIConfiguration,
+                                     ConfigInfo->SystemIoBusNumber,
+                                     ConfigInfo->SlotNumber,
+                                     adapterExtension->PciConfigBuffer,
+                                     sizeof(adapterExtension->PciConfigBuffer));
+    if (pci_cfg_len != sizeof(adapterExtension->PciConfigBuffer))
+    {
+        DPRINT1("Failed to read the PCI configuration (%lu)\n", pci_cfg_len);
+        return SP_RETURN_ERROR;
+    }
+
+    if (ConfigInfo->NumberOfAccessRanges > 0)
+    {
+        accessRange = *(ConfigInfo->AccessRanges);
+        for (index = 0; index < ConfigInfo->NumberOfAccessRanges; index++)
+        {
+            bar = virtio_get_bar_index((PPCI_COMMON_HEADER)adapterExtension->PciConfigBuffer,
+                                       accessRange[index].RangeStart);
+            if (bar < 0 || bar >= PCI_TYPE0_ADDRESSES)
+                continue;
+
+            adapterExtension->Bars[bar].BasePA = accessRange[index].RangeStart;
+            adapterExtension->Bars[bar].Length = accessRange[index].RangeLength;
+            adapterExtension->Bars[bar].InMemory = accessRange[index].RangeInMemory;
+        }
+    }
+
+    status = virtio_device_initialize(vdev, &VioStorSystemOps, adapterExtension, FALSE);
+    if (!NT_SUCCESS(status))
+    {
+        DPRINT1("virtio_device_initialize() failed (Status 0x%08lx)\n", status);
+        return SP_RETURN_NOT_FOUND;
+    }
+
+    features = virtio_get_features(vdev) & VioStorWantedFeatures;
+    status = virtio_set_features(vdev, features);
+    if (!NT_SUCCESS(status))
+    {
+        DPRINT1("virtio_set_features() failed (Status 0x%08lx)\n", status);
+        goto Failed;
+    }
+    adapterExtension->Features = features;
+
+    VioStorReadConfig(adapterExtension);
+
+    adapterExtension->IndirectDescriptors = virtio_is_feature_enabled(features, VIRTIO_RING_F_INDIRECT_DESC);
+    adapterExtension->ReadOnly = virtio_is_feature_enabled(features, VIRTIO_BLK_F_RO);
+    adapterExtension->FlushSupported = virtio_is_feature_enabled(features, VIRTIO_BLK_F_FLUSH);
+    adapterExtension->DiscardSupported = virtio_is_feature_enabled(features, VIRTIO_BLK_F_DISCARD);
+
+    adapterExtension->BlockSize = VIOSTOR_SECTOR_SIZE;
+    if (adapterExtension->Config.BlkSize >= VIOSTOR_SECTOR_SIZE &&
+        (adapterExtension->Config.BlkSize & (adapterExtension->Config.BlkSize - 1)) == 0)
+    {
+        adapterExtension->BlockSize = adapterExtension->Config.BlkSize;
+    }
+    adapterExtension->SectorsPerBlock = adapterExtension->BlockSize >> VIOSTOR_SECTOR_SHIFT;
+    VioStorUpdateCapacity(adapterExtension);
+
+    // one queue per processor, as far as the device offers them
+    adapterExtension->NumQueues = 1;
+    if (virtio_is_feature_enabled(features, VIRTIO_BLK_F_MQ) && adapterExtension->Config.NumQueues > 1)
+    {
+        adapterExtension->NumQueues = min(adapterExtension->Config.NumQueues, (ULONG)KeNumberProcessors);
+        adapterExtension->NumQueues = min(adapterExtension->NumQueues, VIOSTOR_MAX_QUEUES);
+    }
+
+    // the rings and their control blocks come from the uncached extension
+    poolSize = 0;
+    adapterExtension->QueueSize = MAXUSHORT;
+    for (index = 0; index < adapterExtension->NumQueues; index++)
+    {
+        status = virtio_query_queue_allocation(vdev, index, &queueSize, &ringSize, &heapSize);
+        if (!NT_SUCCESS(status))
+        {
+            if (index == 0)
+            {
+                DPRINT1("No request queue (Status 0x%08lx)\n", status);
+                goto Failed;
+            }
+            adapterExtension->NumQueues = index;
+            break;
+        }
+
+        poolSize += ROUND_TO_PAGES(ringSize) + ALIGN_UP_BY(heapSize, SMP_CACHE_BYTES);
+        adapterExtension->QueueSize = min(adapterExtension->QueueSize, queueSize);
+    }
+
+    adapterExtension->MaxSegments = VIOSTOR_MAX_SEGMENTS;
+    if (adapterExtension->Config.SegMax != 0)
+        adapterExtension->MaxSegments = min(adapterExtension->MaxSegments, adapterExtension->Config.SegMax);
+    if (!adapterExtension->IndirectDescriptors)
+        adapterExtension->MaxSegments = min(adapterExtension->MaxSegments, adapterExtension->QueueSize - 2);
+
+    adapterExtension->MaxDiscardSegments = 1;
+    if (adapterExtension->Config.MaxDiscardSeg != 0)
+        adapterExtension->MaxDiscardSegments = min(adapterExtension->Config.MaxDiscardSeg, VIOSTOR_MAX_DISCARD_SEGMENTS);
+
+    DPRINT1("virtio-blk: %I64u sectors, block size %lu, %lu queue(s) of %lu, features 0x%I64x\n",
+            adapterExtension->Config.Capacity, adapterExtension->BlockSize,
+            adapterExtension->NumQueues, adapterExtension->QueueSize, features);
+
+    ConfigInfo->Master = TRUE;
+    ConfigInfo->AlignmentMask = 0x3;
+    ConfigInfo->ScatterGather = TRUE;
+    ConfigInfo->DmaWidth = Width32Bits;
+    ConfigInfo->Dma32BitAddresses = TRUE;
+    ConfigInfo->Dma64BitAddresses = TRUE;
+    ConfigInfo->WmiDataProvider = FALSE;
+    ConfigInfo->CachesData = adapterExtension->FlushSupported;
+
+    ConfigInfo->NumberOfBuses = 1;
+    ConfigInfo->MaximumNumberOfTargets = 1;
+    ConfigInfo->MaximumNumberOfLogicalUnits = 1;
+    ConfigInfo->NumberOfPhysicalBreaks = adapterExtension->MaxSegments - 1;
+    ConfigInfo->MaximumTransferLength = (adapterExtension->MaxSegments - 1) * PAGE_SIZE;
+    ConfigInfo->SynchronizationModel = StorSynchronizeFullDuplex;
+
+    adapterExtension->PoolBase = StorPortGetUncachedExtension(adapterExtension, ConfigInfo, poolSize);
+    if (adapterExtension->PoolBase == NULL)
+    {
+        DPRINT1("Failed to get %lu bytes of uncached extension\n", poolSize);
+        goto Failed;
+    }
+    adapterExtension->PoolSize = poolSize;
+    VioStorResetPool(adapterExtension);
+
+    status = virtio_find_queues(vdev, adapterExtension->NumQueues, adapterExtension->Queues);
+    if (!NT_SUCCESS(status))
+    {
+        DPRINT1("virtio_find_queues() failed (Status 0x%08lx)\n", status);
+        goto Failed;
+    }
+
+    for (index = 0; index < adapterExtension->NumQueues; index++)
+    {
+        adapterExtension->QueueSize = min(adapterExtension->QueueSize,
+                                          virtio_get_queue_size(adapterExtension->Queues[index]));
+    }
+
+    return SP_RETURN_FOUND;
+
+Failed:
+    virtio_add_status(vdev, VIRTIO_CONFIG_S_FAILED);
+    virtio_device_shutdown(vdev);
+    return SP_RETURN_ERROR;
+}
+
+/**
+ * @name VioStorHwInitialize
+ *
+ * Tell the device that the driver is ready to go.
+ */
+static
+BOOLEAN
+NTAPI
+VioStorHwInitialize (
+    __in PVOID DeviceExtension
+    )
+{
+    PVIOSTOR_ADAPTER_EXTENSION adapterExtension = DeviceExtension;
+
+    DPRINT("VioStorHwInitialize()\n");
+
+    virtio_device_ready(&adapterExtension->VirtIODevice);
+    adapterExtension->Started = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * @name VioStorHwBuildIo
+ *
+ * Prepare the request outside of any lock. Requests that do not need the
+ * device are completed here and never reach HwStartIo.
+ */
+static
+BOOLEAN
+NTAPI
+VioStorHwBuildIo (
+    __in PVOID DeviceExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PVIOSTOR_ADAPTER_EXTENSION adapterExtension = DeviceExtension;
+
+    GetSrbExtension(Srb)->QueueIndex = KeGetCurrentProcessorNumber() % adapterExtension->NumQueues;
+
+    switch (Srb->Function)
+    {
+        case SRB_FUNCTION_EXECUTE_SCSI:
+            return VioStorBuildScsiRequest(adapterExtension, Srb);
+
+        case SRB_FUNCTION_FLUSH:
+        case SRB_FUNCTION_SHUTDOWN:
+            if (adapterExtension->FlushSupported)
+            {
+                VioStorBuildFlushRequest(adapterExtension, Srb);
+                return TRUE;
+            }
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            break;
+
+        case SRB_FUNCTION_RESET_BUS:
+        case SRB_FUNCTION_RESET_DEVICE:
+        case SRB_FUNCTION_RESET_LOGICAL_UNIT:
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            break;
+
+        default:
+            Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+            break;
+    }
+
+    StorPortNotification(RequestComplete, adapterExtension, Srb);
+    return FALSE;
+}
+
+/**
+ * @name VioStorHwStartIo
+ *
+ * Put a request built by HwBuildIo on its queue.
+ */
+static
+BOOLEAN
+NTAPI
+VioStorHwStartIo (
+    __in PVOID DeviceExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    return VioStorSubmitRequest(DeviceExtension, Srb);
+}
+
+/**
+ * @name VioStorSubmitRequest
+ *
+ * Add the request to the ring of its queue and notify the device if the
+ * device asked for it. The notification is a trapping register write, so
+ * it is done after dropping the lock.
+ */
+BOOLEAN
+VioStorSubmitRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    PVIOSTOR_SRB_EXTENSION srbExtension = GetSrbExtension(Srb);
+    STOR_LOCK_HANDLE lockhandle = {0};
+    STOR_PHYSICAL_ADDRESS indirectPA;
+    struct virtqueue *vq;
+    PVOID indirectVA = NULL;
+    BOOLEAN notify;
+    ULONG length;
+    int result;
+
+    vq = AdapterExtension->Queues[srbExtension->QueueIndex];
+
+    indirectPA.QuadPart = 0;
+    if (AdapterExtension->IndirectDescriptors)
+    {
+        indirectVA = srbExtension->Descriptors;
+        indirectPA = StorPortGetPhysicalAddress(AdapterExtension, Srb, indirectVA, &length);
+    }
+
+    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+
+    result = virtqueue_add_buf(vq,
+                               srbExtension->Sg,
+                               srbExtension->OutCount,
+                               srbExtension->InCount,
+                               Srb,
+                               indirectVA,
+                               indirectPA.QuadPart);
+
+    notify = (result == 0) && virtqueue_kick_prepare(vq);
+
+    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+    if (result != 0)
+    {
+        // the ring is full, let the port driver retry later
+        Srb->SrbStatus = SRB_STATUS_BUSY;
+        StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        return TRUE;
+    }
+
+    if (notify)
+        virtqueue_notify(vq);
+
+    return TRUE;
+}
+
+/**
+ * @name VioStorCompleteRequests
+ *
+ * Complete everything the device has put on the used ring. Called from
+ * the interrupt handler.
+ */
+VOID
+VioStorCompleteRequests (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in ULONG QueueIndex
+    )
+{
+    struct virtqueue *vq = AdapterExtension->Queues[QueueIndex];
+    PVIOSTOR_SRB_EXTENSION srbExtension;
+    PSCSI_REQUEST_BLOCK Srb;
+    unsigned int length;
+
+    do
+    {
+        virtqueue_disable_cb(vq);
+
+        while ((Srb = virtqueue_get_buf(vq, &length)) != NULL)
+        {
+            srbExtension = GetSrbExtension(Srb);
+
+            switch (srbExtension->Status)
+            {
+                case VIRTIO_BLK_S_OK:
+                    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                    break;
+
+                case VIRTIO_BLK_S_UNSUPP:
+                    Srb->SrbStatus = VioStorSetSenseData(Srb, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ADSENSE_ILLEGAL_COMMAND);
+                    break;
+
+                default:
+                    Srb->SrbStatus = VioStorSetSenseData(Srb, SCSI_SENSE_MEDIUM_ERROR, SCSI_ADSENSE_NO_SENSE);
+                    break;
+            }
+
+            StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        }
+
+        // re-enabling reports whether more buffers came in meanwhile
+    } while (!virtqueue_enable_cb(vq));
+}
+
+/**
+ * @name VioStorHwInterrupt
+ *
+ * Reading the ISR status acknowledges the interrupt.
+ */
+static
+BOOLEAN
+NTAPI
+VioStorHwInterrupt (
+    __in PVOID DeviceExtension
+    )
+{
+    PVIOSTOR_ADAPTER_EXTENSION adapterExtension = DeviceExtension;
+    ULONG index;
+    UCHAR isr;
+
+    isr = virtio_read_isr_status(&adapterExtension->VirtIODevice);
+    if (isr == 0)
+        return FALSE;
+
+    if (!adapterExtension->Started)
+        return TRUE;
+
+    if (isr & VIRTIO_PCI_ISR_QUEUE)
+    {
+        for (index = 0; index < adapterExtension->NumQueues; index++)
+            VioStorCompleteRequests(adapterExtension, index);
+    }
+
+    if (isr & VIRTIO_PCI_ISR_CONFIG)
+    {
+        // the disk was resized
+        VioStorUpdateCapacity(adapterExtension);
+        StorPortNotification(BusChangeDetected, adapterExtension, 0);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @name VioStorHwResetBus
+ *
+ * virtio-blk has no way to abort requests, outstanding ones complete normally.
+ */
+static
+BOOLEAN
+NTAPI
+VioStorHwResetBus (
+    __in PVOID DeviceExtension,
+    __in ULONG PathId
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceExtension);
+    UNREFERENCED_PARAMETER(PathId);
+
+    DPRINT("VioStorHwResetBus()\n");
+
+    return TRUE;
+}
+
+/**
+ * @name VioStorSetSenseData
+ *
+ * Fill in fixed format sense data for a failed request.
+ *
+ * @return
+ * SRB status to complete the request with
+ */
+UCHAR
+VioStorSetSenseData (
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in UCHAR SenseKey,
+    __in UCHAR AdditionalSenseCode
+    )
+{
+    PSENSE_DATA senseData;
+
+    Srb->ScsiStatus = SCSISTAT_CHECK_CONDITION;
+
+    senseData = Srb->SenseInfoBuffer;
+    if (senseData == NULL || Srb->SenseInfoBufferLength < sizeof(SENSE_DATA))
+        return SRB_STATUS_ERROR;
+
+    RtlZeroMemory(senseData, sizeof(SENSE_DATA));
+    senseData->ErrorCode = 0x70; // current error, fixed format
+    senseData->SenseKey = SenseKey;
+    senseData->AdditionalSenseLength = sizeof(SENSE_DATA) - FIELD_OFFSET(SENSE_DATA, CommandSpecificInformation);
+    senseData->AdditionalSenseCode = AdditionalSenseCode;
+
+    return SRB_STATUS_ERROR | SRB_STATUS_AUTOSENSE_VALID;
+}
+
+ULONG
+NTAPI
+DriverEntry (
+    __in PVOID DriverObject,
+    __in PVOID RegistryPath
+    )
+{
+    HW_INITIALIZATION_DATA hwInitializationData = {0};
+    ULONG status;
+
+    DPRINT("DriverEntry()\n");
+
+    hwInitializationData.HwInitializationDataSize = sizeof(HW_INITIALIZATION_DATA);
+
+    hwInitializationData.HwFindAdapter = VioStorHwFindAdapter;
+    hwInitializationData.HwInitialize = VioStorHwInitialize;
+    hwInitializationData.HwBuildIo = VioStorHwBuildIo;
+    hwInitializationData.HwStartIo = VioStorHwStartIo;
+    hwInitializationData.HwInterrupt = VioStorHwInterrupt;
+    hwInitializationData.HwResetBus = VioStorHwResetBus;
+
+    hwInitializationData.TaggedQueuing = TRUE;
+    hwInitializationData.AutoRequestSense = TRUE;
+    hwInitializationData.MultipleRequestPerLu = TRUE;
+    hwInitializationData.NeedPhysicalAddresses = TRUE;
+
+    hwInitializationData.NumberOfAccessRanges = PCI_TYPE0_ADDRESSES;
+    hwInitializationData.AdapterInterfaceType = PCIBus;
+    hwInitializationData.MapBuffers = STOR_MAP_NON_READ_WRITE_BUFFERS;
+
+    hwInitializationData.SrbExtensionSize = sizeof(VIOSTOR_SRB_EXTENSION);
+    hwInitializationData.DeviceExtensionSize = sizeof(VIOSTOR_ADAPTER_EXTENSION);
+
+    status = StorPortInitialize(DriverObject,
+                                RegistryPath,
+                                &hwInitializationData,
+                                NULL);
+
+    DPRINT("StorPortInitialize() returned 0x%08lx\n", status);
+    return status;
+}
+
+/* EOF */
@@ -0,0 +1,241 @@
+/*
+ * PROJECT:     ReactOS VirtIO Block Miniport
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Storport miniport driver for virtio-blk devices
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include <ntddk.h>
+#include <storport.h>
+
+#include <osdep.h>
+#include <virtio_pci.h>
+#include <VirtIO.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#if defined(_MSC_VER)
+#pragma warning(disable:4214) // bit field types other than int
+#pragma warning(disable:4201) // nameless struct/union
+#endif
+
+#define VIOSTOR_MAX_QUEUES                  MAX_QUEUES_PER_DEVICE_DEFAULT
+#define VIOSTOR_MAX_SEGMENTS                64
+#define VIOSTOR_MAX_DISCARD_SEGMENTS        16
+#define VIOSTOR_SECTOR_SIZE                 512
+#define VIOSTOR_SECTOR_SHIFT                9
+
+// header and status byte come on top of the data segments
+#define VIOSTOR_MAX_DESCRIPTORS             (VIOSTOR_MAX_SEGMENTS + 2)
+
+// virtio-blk device features
+#define VIRTIO_BLK_F_SIZE_MAX               1
+#define VIRTIO_BLK_F_SEG_MAX                2
+#define VIRTIO_BLK_F_GEOMETRY               4
+#define VIRTIO_BLK_F_RO                     5
+#define VIRTIO_BLK_F_BLK_SIZE               6
+#define VIRTIO_BLK_F_FLUSH                  9
+#define VIRTIO_BLK_F_TOPOLOGY               10
+#define VIRTIO_BLK_F_CONFIG_WCE             11
+#define VIRTIO_BLK_F_MQ                     12
+#define VIRTIO_BLK_F_DISCARD                13
+
+// request types
+#define VIRTIO_BLK_T_IN                     0
+#define VIRTIO_BLK_T_OUT                    1
+#define VIRTIO_BLK_T_FLUSH                  4
+#define VIRTIO_BLK_T_DISCARD                11
+
+// request status
+#define VIRTIO_BLK_S_OK                     0
+#define VIRTIO_BLK_S_IOERR                  1
+#define VIRTIO_BLK_S_UNSUPP                 2
+
+// ISR status bits
+#define VIRTIO_PCI_ISR_QUEUE                0x1
+
+#ifndef SCSIOP_UNMAP
+#define SCSIOP_UNMAP                        0x42
+#endif
+
+#define SERVICE_ACTION_READ_CAPACITY16      0x10
+
+#define VPD_BLOCK_LIMITS                    0xB0
+#define VPD_LOGICAL_BLOCK_PROVISIONING      0xB2
+
+#define MODE_PAGE_CACHING                   0x08
+
+#define SCSI_ADSENSE_NO_SENSE               0x00
+#define SCSI_ADSENSE_ILLEGAL_COMMAND        0x20
+#define SCSI_ADSENSE_ILLEGAL_BLOCK          0x21
+#define SCSI_ADSENSE_INVALID_CDB            0x24
+#define SCSI_ADSENSE_WRITE_PROTECT          0x27
+
+#include <pshpack1.h>
+
+// device configuration space, 5.2.4
+typedef struct _VIRTIO_BLK_CONFIG
+{
+    ULONG64 Capacity;                       // in 512 byte sectors
+    ULONG SizeMax;
+    ULONG SegMax;
+    struct
+    {
+        USHORT Cylinders;
+        UCHAR Heads;
+        UCHAR Sectors;
+    } Geometry;
+    ULONG BlkSize;
+    struct
+    {
+        UCHAR PhysicalBlockExp;
+        UCHAR AlignmentOffset;
+        USHORT MinIoSize;
+        ULONG OptIoSize;
+    } Topology;
+    UCHAR Writeback;
+    UCHAR Unused0;
+    USHORT NumQueues;
+    ULONG MaxDiscardSectors;
+    ULONG MaxDiscardSeg;
+    ULONG DiscardSectorAlignment;
+    ULONG MaxWriteZeroesSectors;
+    ULONG MaxWriteZeroesSeg;
+    UCHAR WriteZeroesMayUnmap;
+    UCHAR Unused1[3];
+} VIRTIO_BLK_CONFIG, *PVIRTIO_BLK_CONFIG;
+
+typedef struct _VIRTIO_BLK_REQUEST_HEADER
+{
+    ULONG Type;
+    ULONG IoPriority;
+    ULONG64 Sector;
+} VIRTIO_BLK_REQUEST_HEADER, *PVIRTIO_BLK_REQUEST_HEADER;
+
+typedef struct _VIRTIO_BLK_DISCARD_SEGMENT
+{
+    ULONG64 Sector;
+    ULONG NumSectors;
+    ULONG Flags;
+} VIRTIO_BLK_DISCARD_SEGMENT, *PVIRTIO_BLK_DISCARD_SEGMENT;
+
+// layout of a split ring descriptor, used for the indirect tables
+typedef struct _VIRTIO_BLK_DESCRIPTOR
+{
+    ULONG64 Address;
+    ULONG Length;
+    USHORT Flags;
+    USHORT Next;
+} VIRTIO_BLK_DESCRIPTOR, *PVIRTIO_BLK_DESCRIPTOR;
+
+#include <poppack.h>
+
+C_ASSERT(FIELD_OFFSET(VIRTIO_BLK_CONFIG, NumQueues) == 34);
+C_ASSERT(FIELD_OFFSET(VIRTIO_BLK_CONFIG, MaxDiscardSeg) == 40);
+C_ASSERT(sizeof(VIRTIO_BLK_REQUEST_HEADER) == 16);
+C_ASSERT(sizeof(VIRTIO_BLK_DESCRIPTOR) == 16);
+
+typedef struct _VIOSTOR_BAR
+{
+    PHYSICAL_ADDRESS BasePA;
+    ULONG Length;
+    BOOLEAN InMemory;
+    PVOID BaseVA;
+} VIOSTOR_BAR, *PVIOSTOR_BAR;
+
+typedef struct _VIOSTOR_ADAPTER_EXTENSION
+{
+    VirtIODevice VirtIODevice;
+
+    ULONG SystemIoBusNumber;
+    ULONG SlotNumber;
+    INTERFACE_TYPE AdapterInterfaceType;
+    UCHAR PciConfigBuffer[sizeof(PCI_COMMON_CONFIG)];
+    VIOSTOR_BAR Bars[PCI_TYPE0_ADDRESSES];
+
+    // queue rings and their control blocks are carved out of the uncached extension
+    PUCHAR PoolBase;
+    ULONG PoolSize;
+    ULONG PoolOffset;
+
+    ULONG64 Features;
+    VIRTIO_BLK_CONFIG Config;
+
+    ULONG NumQueues;
+    ULONG QueueSize;
+    struct virtqueue *Queues[VIOSTOR_MAX_QUEUES];
+
+    ULONG BlockSize;                        // logical block size in bytes
+    ULONG SectorsPerBlock;                  // 512 byte sectors per logical block
+    ULONG64 LastLba;
+    ULONG MaxSegments;
+    ULONG MaxDiscardSegments;
+
+    BOOLEAN IndirectDescriptors;
+    BOOLEAN ReadOnly;
+    BOOLEAN FlushSupported;
+    BOOLEAN DiscardSupported;
+    BOOLEAN Started;
+    BOOLEAN QueueDepthSet;
+} VIOSTOR_ADAPTER_EXTENSION, *PVIOSTOR_ADAPTER_EXTENSION;
+
+typedef struct _VIOSTOR_SRB_EXTENSION
+{
+    // indirect descriptor table, keep it first for alignment
+    VIRTIO_BLK_DESCRIPTOR Descriptors[VIOSTOR_MAX_DESCRIPTORS];
+    struct VirtIOBufferDescriptor Sg[VIOSTOR_MAX_DESCRIPTORS];
+    VIRTIO_BLK_REQUEST_HEADER Header;
+    VIRTIO_BLK_DISCARD_SEGMENT Discard[VIOSTOR_MAX_DISCARD_SEGMENTS];
+    ULONG OutCount;
+    ULONG InCount;
+    ULONG QueueIndex;
+    UCHAR Status;
+} VIOSTOR_SRB_EXTENSION, *PVIOSTOR_SRB_EXTENSION;
+
+#define GetSrbExtension(Srb) ((PVIOSTOR_SRB_EXTENSION)(Srb)->SrbExtension)
+#define GetAdapterExtension(vdev) CONTAINING_RECORD((vdev), VIOSTOR_ADAPTER_EXTENSION, VirtIODevice)
+
+/* viostor.c */
+
+BOOLEAN
+VioStorSubmitRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    );
+
+VOID
+VioStorCompleteRequests (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in ULONG QueueIndex
+    );
+
+UCHAR
+VioStorSetSenseData (
+    __in PSCSI_REQUEST_BLOCK Srb,
+    __in UCHAR SenseKey,
+    __in UCHAR AdditionalSenseCode
+    );
+
+/* scsi.c */
+
+BOOLEAN
+VioStorBuildScsiRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    );
+
+VOID
+VioStorBuildFlushRequest (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in PSCSI_REQUEST_BLOCK Srb
+    );
+
+/* virtio.c */
+
+extern VirtIOSystemOps VioStorSystemOps;
+
+VOID
+VioStorResetPool (
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension
+    );
@@ -0,0 +1,335 @@
+/*
+ * PROJECT:     ReactOS VirtIO Block Miniport
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Storport implementation of the VirtIO library callbacks
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "viostor.h"
+#include <kdebugprint.h>
+
+/* Debug output of the VirtIO library */
+int virtioDebugLevel = 0;
+int bDebugPrint = 1;
+
+static
+VOID
+VioStorDebugPrint(
+    const char *Format,
+    ...)
+{
+    va_list Arguments;
+
+    va_start(Arguments, Format);
+    vDbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, Format, Arguments);
+    va_end(Arguments);
+}
+
+tDebugPrintFunc VirtioDebugPrintProc = VioStorDebugPrint;
+
+/*
+ * The lower 64k of memory is never mapped, so the same routines serve port I/O
+ * and memory mapped BARs and the address alone tells which one is meant.
+ */
+#define PORT_MASK 0xFFFF
+
+static
+u8
+ReadVirtIODeviceByte(
+    ULONG_PTR Register)
+{
+    if (Register & ~PORT_MASK)
+        return StorPortReadRegisterUchar(NULL, (PUCHAR)Register);
+    else
+        return StorPortReadPortUchar(NULL, (PUCHAR)Register);
+}
+
+static
+u16
+ReadVirtIODeviceWord(
+    ULONG_PTR Register)
+{
+    if (Register & ~PORT_MASK)
+        return StorPortReadRegisterUshort(NULL, (PUSHORT)Register);
+    else
+        return StorPortReadPortUshort(NULL, (PUSHORT)Register);
+}
+
+static
+u32
+ReadVirtIODeviceRegister(
+    ULONG_PTR Register)
+{
+    if (Register & ~PORT_MASK)
+        return StorPortReadRegisterUlong(NULL, (PULONG)Register);
+    else
+        return StorPortReadPortUlong(NULL, (PULONG)Register);
+}
+
+static
+void
+WriteVirtIODeviceByte(
+    ULONG_PTR Register,
+    u8 Value)
+{
+    if (Register & ~PORT_MASK)
+        StorPortWriteRegisterUchar(NULL, (PUCHAR)Register, Value);
+    else
+        StorPortWritePortUchar(NULL, (PUCHAR)Register, Value);
+}
+
+static
+void
+WriteVirtIODeviceWord(
+    ULONG_PTR Register,
+    u16 Value)
+{
+    if (Register & ~PORT_MASK)
+        StorPortWriteRegisterUshort(NULL, (PUSHORT)Register, Value);
+    else
+        StorPortWritePortUshort(NULL, (PUSHORT)Register, Value);
+}
+
+static
+void
+WriteVirtIODeviceRegister(
+    ULONG_PTR Register,
+    u32 Value)
+{
+    if (Register & ~PORT_MASK)
+        StorPortWriteRegisterUlong(NULL, (PULONG)Register, Value);
+    else
+        StorPortWritePortUlong(NULL, (PULONG)Register, Value);
+}
+
+VOID
+VioStorResetPool(
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension)
+{
+    /* Queues are set up again from the start of the pool */
+    AdapterExtension->PoolOffset = 0;
+}
+
+static
+PVOID
+VioStorAllocatePool(
+    __in PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    __in ULONG Size,
+    __in ULONG Alignment)
+{
+    ULONG Offset;
+    PUCHAR Block;
+
+    Offset = ALIGN_UP_BY(AdapterExtension->PoolOffset, Alignment);
+    if (AdapterExtension->PoolBase == NULL ||
+        Offset > AdapterExtension->PoolSize ||
+        Size > AdapterExtension->PoolSize - Offset)
+    {
+        DPRINT1("Out of uncached memory (%lu bytes requested)\n", Size);
+        return NULL;
+    }
+
+    Block = AdapterExtension->PoolBase + Offset;
+    AdapterExtension->PoolOffset = Offset + Size;
+    RtlZeroMemory(Block, Size);
+    return Block;
+}
+
+static
+void *
+mem_alloc_contiguous_pages(
+    void *context,
+    size_t size)
+{
+    /* The uncached extension is page aligned and physically contiguous */
+    return VioStorAllocatePool(context, (ULONG)size, PAGE_SIZE);
+}
+
+static
+void
+mem_free_contiguous_pages(
+    void *context,
+    void *virt)
+{
+    /* Released together with the uncached extension */
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(virt);
+}
+
+static
+ULONGLONG
+mem_get_physical_address(
+    void *context,
+    void *virt)
+{
+    STOR_PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG Length;
+
+    PhysicalAddress = StorPortGetPhysicalAddress(context, NULL, virt, &Length);
+    return PhysicalAddress.QuadPart;
+}
+
+static
+void *
+mem_alloc_nonpaged_block(
+    void *context,
+    size_t size)
+{
+    return VioStorAllocatePool(context, (ULONG)size, SMP_CACHE_BYTES);
+}
+
+static
+void
+mem_free_nonpaged_block(
+    void *context,
+    void *addr)
+{
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(addr);
+}
+
+/* The configuration space was read once in HwFindAdapter */
+static
+int
+PciReadConfig(
+    PVIOSTOR_ADAPTER_EXTENSION AdapterExtension,
+    int where,
+    void *buffer,
+    size_t length)
+{
+    if (where < 0 || (ULONG)where + length > sizeof(AdapterExtension->PciConfigBuffer))
+        return -1;
+
+    StorPortMoveMemory(buffer, &AdapterExtension->PciConfigBuffer[where], (ULONG)length);
+    return 0;
+}
+
+static
+int
+pci_read_config_byte(
+    void *context,
+    int where,
+    u8 *bVal)
+{
+    return PciReadConfig(context, where, bVal, sizeof(*bVal));
+}
+
+static
+int
+pci_read_config_word(
+    void *context,
+    int where,
+    u16 *wVal)
+{
+    return PciReadConfig(context, where, wVal, sizeof(*wVal));
+}
+
+static
+int
+pci_read_config_dword(
+    void *context,
+    int where,
+    u32 *dwVal)
+{
+    return PciReadConfig(context, where, dwVal, sizeof(*dwVal));
+}
+
+static
+size_t
+pci_get_resource_len(
+    void *context,
+    int bar)
+{
+    PVIOSTOR_ADAPTER_EXTENSION AdapterExtension = context;
+
+    if (bar < 0 || bar >= PCI_TYPE0_ADDRESSES)
+        return 0;
+
+    return AdapterExtension->Bars[bar].Length;
+}
+
+static
+void *
+pci_map_address_range(
+    void *context,
+    int bar,
+    size_t offset,
+    size_t maxlen)
+{
+    PVIOSTOR_ADAPTER_EXTENSION AdapterExtension = context;
+    PVIOSTOR_BAR Bar;
+
+    UNREFERENCED_PARAMETER(maxlen);
+
+    if (bar < 0 || bar >= PCI_TYPE0_ADDRESSES)
+        return NULL;
+
+    Bar = &AdapterExtension->Bars[bar];
+    if (Bar->Length == 0 || offset >= Bar->Length)
+        return NULL;
+
+    if (Bar->BaseVA == NULL)
+    {
+        Bar->BaseVA = StorPortGetDeviceBase(AdapterExtension,
+                                            AdapterExtension->AdapterInterfaceType,
+                                            AdapterExtension->SystemIoBusNumber,
+                                            Bar->BasePA,
+                                            Bar->Length,
+                                            !Bar->InMemory);
+        if (Bar->BaseVA == NULL)
+        {
+            DPRINT1("Failed to map BAR %d\n", bar);
+            return NULL;
+        }
+    }
+
+    return (PUCHAR)Bar->BaseVA + offset;
+}
+
+static
+u16
+vdev_get_msix_vector(
+    void *context,
+    int queue)
+{
+    /* All queues share the line interrupt */
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(queue);
+
+    return VIRTIO_MSI_NO_VECTOR;
+}
+
+static
+void
+vdev_sleep(
+    void *context,
+    unsigned int msecs)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    while (msecs--)
+        StorPortStallExecution(1000);
+}
+
+VirtIOSystemOps VioStorSystemOps = {
+    /* .vdev_read_byte = */ ReadVirtIODeviceByte,
+    /* .vdev_read_word = */ ReadVirtIODeviceWord,
+    /* .vdev_read_dword = */ ReadVirtIODeviceRegister,
+    /* .vdev_write_byte = */ WriteVirtIODeviceByte,
+    /* .vdev_write_word = */ WriteVirtIODeviceWord,
+    /* .vdev_write_dword = */ WriteVirtIODeviceRegister,
+    /* .mem_alloc_contiguous_pages = */ mem_alloc_contiguous_pages,
+    /* .mem_free_contiguous_pages = */ mem_free_contiguous_pages,
+    /* .mem_get_physical_address = */ mem_get_physical_address,
+    /* .mem_alloc_nonpaged_block = */ mem_alloc_nonpaged_block,
+    /* .mem_free_nonpaged_block = */ mem_free_nonpaged_block,
+    /* .pci_read_config_byte = */ pci_read_config_byte,
+    /* .pci_read_config_word = */ pci_read_config_word,
+    /* .pci_read_config_dword = */ pci_read_config_dword,
+    /* .pci_get_resource_len = */ pci_get_resource_len,
+    /* .pci_map_address_range = */ pci_map_address_range,
+    /* .vdev_get_msix_vector = */ vdev_get_msix_vector,
+    /* .vdev_sleep = */ vdev_sleep,
+};
+
+/* EOF */
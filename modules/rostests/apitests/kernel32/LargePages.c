@@ -0,0 +1,128 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for MEM_LARGE_PAGES and random access over large buffers
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+
+#include <ndk/setypes.h>
+
+#define ACCESS_COUNT (16 * 1024 * 1024)
+
+/* Touch the buffer all over the place, so that every access is likely a TLB miss */
+static
+ULONGLONG
+RandomAccess(
+    _In_ PUCHAR Buffer,
+    _In_ SIZE_T Size)
+{
+    LARGE_INTEGER Frequency, Start, End;
+    ULONG Seed = 0x12345678;
+    ULONG Sum = 0;
+    ULONG i;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ACCESS_COUNT; i++)
+    {
+        Seed = Seed * 1664525 + 1013904223;
+        Sum += ++Buffer[Seed % Size];
+    }
+    QueryPerformanceCounter(&End);
+
+    ok(Sum != 0, "Sum is 0\n");
+    return (End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart;
+}
+
+static
+VOID
+TestLargePages(
+    _In_ SIZE_T LargePageSize)
+{
+    MEMORYSTATUSEX MemoryStatus;
+    MEMORY_BASIC_INFORMATION Info;
+    SIZE_T Size;
+    PUCHAR Buffer;
+    ULONGLONG Small, Large;
+
+    /* Up to 1 GiB, but leave room for the rest of the system */
+    MemoryStatus.dwLength = sizeof(MemoryStatus);
+    ok(GlobalMemoryStatusEx(&MemoryStatus), "GlobalMemoryStatusEx failed with %lu\n", GetLastError());
+    Size = (SIZE_T)min(MemoryStatus.ullAvailPhys / 2, 1024 * 1024 * 1024);
+    Size &= ~(LargePageSize - 1);
+    if (Size == 0)
+    {
+        skip("Not enough memory for a single large page\n");
+        return;
+    }
+
+    /* The size has to be a multiple of the large page size */
+    Buffer = VirtualAlloc(NULL, LargePageSize / 2, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(Buffer == NULL, "VirtualAlloc succeeded\n");
+    ok_err(ERROR_INVALID_PARAMETER);
+
+    /* And large pages can't be reserved only */
+    Buffer = VirtualAlloc(NULL, LargePageSize, MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(Buffer == NULL, "VirtualAlloc succeeded\n");
+
+    Buffer = VirtualAlloc(NULL, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    ok(Buffer != NULL, "VirtualAlloc failed with %lu\n", GetLastError());
+    if (!Buffer)
+        return;
+    Small = RandomAccess(Buffer, Size);
+    ok(VirtualFree(Buffer, 0, MEM_RELEASE), "VirtualFree failed with %lu\n", GetLastError());
+
+    Buffer = VirtualAlloc(NULL, Size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!Buffer)
+    {
+        /* Physical memory may be too fragmented, even after compaction */
+        skip("VirtualAlloc(MEM_LARGE_PAGES, %Iu) failed with %lu\n", Size, GetLastError());
+        return;
+    }
+    ok(((ULONG_PTR)Buffer & (LargePageSize - 1)) == 0, "Buffer %p is not aligned\n", Buffer);
+
+    /* The memory is zeroed and committed right away */
+    ok(Buffer[0] == 0 && Buffer[Size - 1] == 0, "Buffer is not zeroed\n");
+    ok_size_t(VirtualQuery(Buffer + PAGE_SIZE, &Info, sizeof(Info)), sizeof(Info));
+    ok(Info.AllocationBase == Buffer, "AllocationBase is %p, expected %p\n", Info.AllocationBase, Buffer);
+    ok_hex(Info.State, MEM_COMMIT);
+    ok_hex(Info.Protect, PAGE_READWRITE);
+    ok_size_t(Info.RegionSize, Size - PAGE_SIZE);
+
+    Large = RandomAccess(Buffer, Size);
+    trace("%u random accesses over %Iu MB: %I64u ms with small pages, %I64u ms with large pages\n",
+          ACCESS_COUNT, Size / (1024 * 1024), Small, Large);
+
+    /* Only the whole allocation can go away */
+    ok(!VirtualFree(Buffer + LargePageSize, 0, MEM_RELEASE), "VirtualFree succeeded\n");
+    ok(VirtualFree(Buffer, 0, MEM_RELEASE), "VirtualFree failed with %lu\n", GetLastError());
+}
+
+START_TEST(LargePages)
+{
+    SIZE_T LargePageSize;
+    BOOLEAN Enabled;
+    NTSTATUS Status;
+
+    LargePageSize = GetLargePageMinimum();
+    trace("Large page size: %Iu\n", LargePageSize);
+    if (LargePageSize == 0)
+    {
+        skip("Large pages are not supported\n");
+        return;
+    }
+    ok((LargePageSize & (LargePageSize - 1)) == 0, "Large page size %Iu is not a power of two\n", LargePageSize);
+
+    Status = RtlAdjustPrivilege(SE_LOCK_MEMORY_PRIVILEGE, TRUE, FALSE, &Enabled);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("RtlAdjustPrivilege(SE_LOCK_MEMORY_PRIVILEGE) failed (Status 0x%08lx)\n", Status);
+        return;
+    }
+
+    TestLargePages(LargePageSize);
+
+    RtlAdjustPrivilege(SE_LOCK_MEMORY_PRIVILEGE, Enabled, FALSE, &Enabled);
+}
@@ -0,0 +1,223 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Page faults taken while walking file and image views
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+#include <ndk/psfuncs.h>
+
+#define FILE_SIZE   (32 * 1024 * 1024)
+
+/* The default Memory Management\FaultAroundSize */
+#define FAULT_AROUND_SIZE   0x10000
+
+static SYSTEM_INFO SystemInfo;
+
+static
+ULONG
+GetPageFaultCount(VOID)
+{
+    VM_COUNTERS Counters;
+    NTSTATUS Status;
+
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessVmCounters,
+                                       &Counters,
+                                       sizeof(Counters),
+                                       NULL);
+    ok(NT_SUCCESS(Status), "NtQueryInformationProcess failed with 0x%lx\n", Status);
+    return NT_SUCCESS(Status) ? Counters.PageFaultCount : 0;
+}
+
+static
+VOID
+ReportScan(
+    _In_ PCWSTR Name,
+    _In_ SIZE_T Size,
+    _In_ ULONG Faults,
+    _In_ PLARGE_INTEGER Start,
+    _In_ PLARGE_INTEGER End)
+{
+    LARGE_INTEGER Frequency;
+
+    QueryPerformanceFrequency(&Frequency);
+    trace("%ls: %Iu pages, %lu faults, %I64u us\n", Name, Size / SystemInfo.dwPageSize, Faults,
+          (End->QuadPart - Start->QuadPart) * 1000000 / Frequency.QuadPart);
+}
+
+/* Touches one byte per page and returns a checksum so nothing gets optimized away */
+static
+ULONG
+ScanView(
+    _In_ const UCHAR *Base,
+    _In_ SIZE_T Size)
+{
+    ULONG Sum = 0;
+    SIZE_T Offset;
+
+    for (Offset = 0; Offset < Size; Offset += SystemInfo.dwPageSize)
+        Sum += *(volatile const UCHAR *)(Base + Offset);
+
+    return Sum;
+}
+
+static
+VOID
+TestFileScan(VOID)
+{
+    WCHAR TempPath[MAX_PATH], FileName[MAX_PATH];
+    HANDLE FileHandle, MappingHandle;
+    PUCHAR Buffer, View;
+    LARGE_INTEGER Start, End;
+    ULONG Faults, Sum, Expected = 0;
+    DWORD Written;
+    SIZE_T Offset;
+    BOOL Success;
+
+    GetTempPathW(_countof(TempPath), TempPath);
+    GetTempFileNameW(TempPath, L"mvf", 0, FileName);
+
+    FileHandle = CreateFileW(FileName,
+                             GENERIC_READ | GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             FILE_FLAG_DELETE_ON_CLOSE,
+                             NULL);
+    ok(FileHandle != INVALID_HANDLE_VALUE, "CreateFileW failed with %lu\n", GetLastError());
+    if (FileHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    /* Every page starts with a different byte */
+    Buffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, FAULT_AROUND_SIZE);
+    ok(Buffer != NULL, "Out of memory\n");
+    if (!Buffer)
+    {
+        CloseHandle(FileHandle);
+        return;
+    }
+    for (Offset = 0; Offset < FILE_SIZE; Offset += FAULT_AROUND_SIZE)
+    {
+        SIZE_T Page;
+
+        for (Page = 0; Page < FAULT_AROUND_SIZE; Page += SystemInfo.dwPageSize)
+        {
+            Buffer[Page] = (UCHAR)((Offset + Page) / SystemInfo.dwPageSize);
+            Expected += Buffer[Page];
+        }
+        Success = WriteFile(FileHandle, Buffer, FAULT_AROUND_SIZE, &Written, NULL);
+        ok(Success && Written == FAULT_AROUND_SIZE, "WriteFile failed with %lu\n", GetLastError());
+    }
+    HeapFree(GetProcessHeap(), 0, Buffer);
+
+    MappingHandle = CreateFileMappingW(FileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    ok(MappingHandle != NULL, "CreateFileMappingW failed with %lu\n", GetLastError());
+    if (!MappingHandle)
+    {
+        CloseHandle(FileHandle);
+        return;
+    }
+
+    /* Each pass uses a new view so the PTEs start out empty */
+    View = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+    ok(View != NULL, "MapViewOfFile failed with %lu\n", GetLastError());
+    if (View)
+    {
+        Faults = GetPageFaultCount();
+        QueryPerformanceCounter(&Start);
+        Sum = ScanView(View, FILE_SIZE);
+        QueryPerformanceCounter(&End);
+        Faults = GetPageFaultCount() - Faults;
+        ok(Sum == Expected, "Sum = %lu, expected %lu\n", Sum, Expected);
+        ReportScan(L"first sequential scan", FILE_SIZE, Faults, &Start, &End);
+        UnmapViewOfFile(View);
+    }
+
+    View = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+    ok(View != NULL, "MapViewOfFile failed with %lu\n", GetLastError());
+    if (View)
+    {
+        Faults = GetPageFaultCount();
+        QueryPerformanceCounter(&Start);
+        Sum = ScanView(View, FILE_SIZE);
+        QueryPerformanceCounter(&End);
+        Faults = GetPageFaultCount() - Faults;
+        ok(Sum == Expected, "Sum = %lu, expected %lu\n", Sum, Expected);
+        ReportScan(L"resident sequential scan", FILE_SIZE, Faults, &Start, &End);
+        UnmapViewOfFile(View);
+    }
+
+    /*
+     * The file is resident now, so the reads are gone and only the mapping of
+     * the neighbours is left: touch one page per window, then the rest of the
+     * pages should already be mapped.
+     */
+    View = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+    ok(View != NULL, "MapViewOfFile failed with %lu\n", GetLastError());
+    if (View)
+    {
+        for (Offset = 0; Offset < FILE_SIZE; Offset += FAULT_AROUND_SIZE)
+            ScanView(View + Offset, SystemInfo.dwPageSize);
+
+        Faults = GetPageFaultCount();
+        QueryPerformanceCounter(&Start);
+        Sum = ScanView(View, FILE_SIZE);
+        QueryPerformanceCounter(&End);
+        Faults = GetPageFaultCount() - Faults;
+        ok(Sum == Expected, "Sum = %lu, expected %lu\n", Sum, Expected);
+        ok(Faults < FILE_SIZE / FAULT_AROUND_SIZE,
+           "%lu faults after touching every window, expected less than %u\n",
+           Faults, FILE_SIZE / FAULT_AROUND_SIZE);
+        ReportScan(L"scan after touching every window", FILE_SIZE, Faults, &Start, &End);
+        UnmapViewOfFile(View);
+    }
+
+    CloseHandle(MappingHandle);
+    CloseHandle(FileHandle);
+}
+
+/* Maps big system images like a starting program would and touches all of their pages */
+static
+VOID
+TestImageStartup(VOID)
+{
+    static const PCWSTR Images[] = { L"shell32.dll", L"mshtml.dll", L"comctl32.dll", L"ole32.dll" };
+    LARGE_INTEGER Start, End;
+    PIMAGE_NT_HEADERS NtHeaders;
+    HMODULE Module;
+    ULONG i, Faults;
+
+    for (i = 0; i < _countof(Images); i++)
+    {
+        Faults = GetPageFaultCount();
+        QueryPerformanceCounter(&Start);
+        Module = LoadLibraryExW(Images[i], NULL, DONT_RESOLVE_DLL_REFERENCES);
+        if (!Module)
+        {
+            skip("%ls could not be loaded, error %lu\n", Images[i], GetLastError());
+            continue;
+        }
+
+        NtHeaders = RtlImageNtHeader(Module);
+        ok(NtHeaders != NULL, "%ls has no NT headers\n", Images[i]);
+        if (NtHeaders)
+            ScanView((PUCHAR)Module, NtHeaders->OptionalHeader.SizeOfImage);
+        QueryPerformanceCounter(&End);
+        Faults = GetPageFaultCount() - Faults;
+
+        if (NtHeaders)
+            ReportScan(Images[i], NtHeaders->OptionalHeader.SizeOfImage, Faults, &Start, &End);
+
+        FreeLibrary(Module);
+    }
+}
+
+START_TEST(MapViewOfFile)
+{
+    GetSystemInfo(&SystemInfo);
+
+    TestFileScan();
+    TestImageStartup();
+}
@@ -0,0 +1,229 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Boot and application launch times with the logical prefetcher
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+
+#include <winuser.h>
+
+#define PF_ENABLE_APPLICATION_LAUNCH    0x01
+#define PF_ENABLE_BOOT                  0x02
+
+/* The start of the scenario files, see ntoskrnl/include/internal/cc.h */
+#define PF_SCENARIO_VERSION             1
+#define PF_SCENARIO_MAGIC               'ACCS'
+
+typedef struct _PF_SCENARIO_HEADER_START
+{
+    ULONG Version;
+    ULONG MagicNumber;
+    ULONG Size;
+    WCHAR ScenName[30];
+    ULONG HashId;
+} PF_SCENARIO_HEADER_START;
+
+/* The boot trace runs that long, the scenario is saved right after */
+#define BOOT_TRACE_SECONDS              120
+
+static
+ULONG
+GetPrefetcherMode(VOID)
+{
+    ULONG Mode = PF_ENABLE_APPLICATION_LAUNCH | PF_ENABLE_BOOT;
+    DWORD Size = sizeof(Mode);
+
+    /* Read once at boot, both are on when it is not set */
+    RegGetValueW(HKEY_LOCAL_MACHINE,
+                 L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Memory Management\\PrefetchParameters",
+                 L"EnablePrefetcher",
+                 RRF_RT_REG_DWORD,
+                 NULL,
+                 &Mode,
+                 &Size);
+    return Mode;
+}
+
+/* Checks that there is a scenario file matching @Pattern, saved for @ScenName */
+static
+VOID
+CheckScenarioFile(
+    _In_ PCWSTR Pattern,
+    _In_ PCWSTR ScenName)
+{
+    WCHAR Path[MAX_PATH];
+    PWSTR FileName;
+    WIN32_FIND_DATAW FindData;
+    PF_SCENARIO_HEADER_START Header;
+    HANDLE Handle;
+    DWORD Read;
+    BOOL Success;
+
+    GetWindowsDirectoryW(Path, _countof(Path));
+    StringCchCatW(Path, _countof(Path), L"\\Prefetch\\");
+    FileName = Path + wcslen(Path);
+    StringCchCatW(Path, _countof(Path), Pattern);
+
+    Handle = FindFirstFileW(Path, &FindData);
+    ok(Handle != INVALID_HANDLE_VALUE, "No scenario file %ls\n", Path);
+    if (Handle == INVALID_HANDLE_VALUE)
+        return;
+    FindClose(Handle);
+
+    *FileName = UNICODE_NULL;
+    StringCchCatW(Path, _countof(Path), FindData.cFileName);
+    Handle = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(Handle != INVALID_HANDLE_VALUE, "Cannot open %ls: %lu\n", Path, GetLastError());
+    if (Handle == INVALID_HANDLE_VALUE)
+        return;
+
+    Success = ReadFile(Handle, &Header, sizeof(Header), &Read, NULL);
+    ok(Success && Read == sizeof(Header), "Cannot read %ls: %lu\n", Path, GetLastError());
+    if (Success && Read == sizeof(Header))
+    {
+        ok(Header.Version == PF_SCENARIO_VERSION, "Version is %lu\n", Header.Version);
+        ok(Header.MagicNumber == PF_SCENARIO_MAGIC, "MagicNumber is 0x%lx\n", Header.MagicNumber);
+        ok(Header.Size == FindData.nFileSizeLow, "Size is %lu, the file has %lu bytes\n", Header.Size, FindData.nFileSizeLow);
+        ok(!wcsncmp(Header.ScenName, ScenName, _countof(Header.ScenName)), "ScenName is %.30ls\n", Header.ScenName);
+    }
+
+    CloseHandle(Handle);
+}
+
+/* The desktop is up once the shell is, that is as close as we get to the end of the boot */
+static
+VOID
+TestBootTime(VOID)
+{
+    SYSTEM_TIMEOFDAY_INFORMATION TimeInfo;
+    PSYSTEM_PROCESS_INFORMATION ProcessInfo;
+    UNICODE_STRING Explorer = RTL_CONSTANT_STRING(L"explorer.exe");
+    PVOID Buffer;
+    ULONG Length = 0x40000;
+    NTSTATUS Status;
+
+    Status = NtQuerySystemInformation(SystemTimeOfDayInformation, &TimeInfo, sizeof(TimeInfo), NULL);
+    ok(NT_SUCCESS(Status), "SystemTimeOfDayInformation failed with 0x%lx\n", Status);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, Length);
+    ok(Buffer != NULL, "Out of memory\n");
+    if (!Buffer)
+        return;
+
+    Status = NtQuerySystemInformation(SystemProcessInformation, Buffer, Length, NULL);
+    ok(NT_SUCCESS(Status), "SystemProcessInformation failed with 0x%lx\n", Status);
+    if (NT_SUCCESS(Status))
+    {
+        ProcessInfo = Buffer;
+        while (TRUE)
+        {
+            if (RtlEqualUnicodeString(&ProcessInfo->ImageName, &Explorer, TRUE))
+            {
+                trace("Boot to desktop: %I64u ms\n",
+                      (ProcessInfo->CreateTime.QuadPart - TimeInfo.BootTime.QuadPart) / 10000);
+                break;
+            }
+
+            if (ProcessInfo->NextEntryOffset == 0)
+            {
+                skip("No shell is running\n");
+                break;
+            }
+            ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)((PUCHAR)ProcessInfo + ProcessInfo->NextEntryOffset);
+        }
+    }
+
+    HeapFree(GetProcessHeap(), 0, Buffer);
+
+    if (!(GetPrefetcherMode() & PF_ENABLE_BOOT))
+    {
+        skip("Boot prefetching is disabled\n");
+        return;
+    }
+    if ((TimeInfo.CurrentTime.QuadPart - TimeInfo.BootTime.QuadPart) / 10000000 < BOOT_TRACE_SECONDS + 30)
+    {
+        skip("The boot trace was not saved yet\n");
+        return;
+    }
+
+    CheckScenarioFile(L"NTOSBOOT-B00DFAAD.pf", L"NTOSBOOT");
+}
+
+static
+BOOL
+LaunchAndWait(
+    _In_ PWSTR CommandLine,
+    _Out_ PULONGLONG Elapsed)
+{
+    STARTUPINFOW StartupInfo = { sizeof(StartupInfo) };
+    PROCESS_INFORMATION ProcessInfo;
+    LARGE_INTEGER Frequency, Start, End;
+    DWORD Wait;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    if (!CreateProcessW(NULL, CommandLine, NULL, NULL, FALSE, 0, NULL, NULL, &StartupInfo, &ProcessInfo))
+        return FALSE;
+
+    Wait = WaitForInputIdle(ProcessInfo.hProcess, 30000);
+    QueryPerformanceCounter(&End);
+    ok(Wait == 0, "WaitForInputIdle returned %lu\n", Wait);
+    *Elapsed = (End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart;
+
+    /* Exiting ends the launch trace, the scenario is saved right after */
+    TerminateProcess(ProcessInfo.hProcess, 0);
+    WaitForSingleObject(ProcessInfo.hProcess, INFINITE);
+    CloseHandle(ProcessInfo.hThread);
+    CloseHandle(ProcessInfo.hProcess);
+    return TRUE;
+}
+
+static
+VOID
+TestLaunchTime(VOID)
+{
+    WCHAR CommandLine[MAX_PATH];
+    ULONGLONG Elapsed;
+    ULONG i;
+
+    GetSystemDirectoryW(CommandLine, _countof(CommandLine));
+    StringCchCatW(CommandLine, _countof(CommandLine), L"\\notepad.exe");
+    if (GetFileAttributesW(CommandLine) == INVALID_FILE_ATTRIBUTES)
+    {
+        skip("%ls not found\n", CommandLine);
+        return;
+    }
+
+    /* The first launch is traced, the next ones are prefetched from that trace */
+    for (i = 0; i < 3; i++)
+    {
+        if (!LaunchAndWait(CommandLine, &Elapsed))
+        {
+            ok(FALSE, "CreateProcessW failed with %lu\n", GetLastError());
+            return;
+        }
+        trace("Launch %lu of notepad.exe: %I64u ms\n", i + 1, Elapsed);
+
+        /* Let the trace be written and the image pages go */
+        Sleep(2000);
+
+        /* The first launch leaves its trace for the next ones */
+        if (i == 0)
+        {
+            if (GetPrefetcherMode() & PF_ENABLE_APPLICATION_LAUNCH)
+                CheckScenarioFile(L"NOTEPAD.EXE-*.pf", L"NOTEPAD.EXE");
+            else
+                skip("Application launch prefetching is disabled\n");
+        }
+    }
+}
+
+START_TEST(Prefetcher)
+{
+    TestBootTime();
+    TestLaunchTime();
+}
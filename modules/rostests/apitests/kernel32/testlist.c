@@ -23,11 +23,14 @@ extern void func_interlck(void);
 extern void func_IsDBCSLeadByteEx(void);
 extern void func_JapaneseCalendar(void);
 extern void func_LCMapString(void);
+extern void func_LargePages(void);
 extern void func_LoadLibraryExW(void);
 extern void func_lstrcpynW(void);
 extern void func_lstrlen(void);
 extern void func_Mailslot(void);
+extern void func_MapViewOfFile(void);
 extern void func_MultiByteToWideChar(void);
+extern void func_Prefetcher(void);
 extern void func_PrivMoveFileIdentityW(void);
 extern void func_QueueUserAPC(void);
 extern void func_SetComputerNameExW(void);
@@ -61,11 +64,14 @@ const struct test winetest_testlist[] =
     { "IsDBCSLeadByteEx",            func_IsDBCSLeadByteEx },
     { "JapaneseCalendar",            func_JapaneseCalendar },
     { "LCMapString",                 func_LCMapString },
+    { "LargePages",                  func_LargePages },
     { "LoadLibraryExW",              func_LoadLibraryExW },
     { "lstrcpynW",                   func_lstrcpynW },
     { "lstrlen",                     func_lstrlen },
     { "MailslotRead",                func_Mailslot },
+    { "MapViewOfFile",               func_MapViewOfFile },
     { "MultiByteToWideChar",         func_MultiByteToWideChar },
+    { "Prefetcher",                  func_Prefetcher },
     { "PrivMoveFileIdentityW",       func_PrivMoveFileIdentityW },
     { "QueueUserAPC",                func_QueueUserAPC },
     { "SetComputerNameExW",          func_SetComputerNameExW },
@@ -0,0 +1,357 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Paging throughput of private section pages under memory pressure,
+ *              through the compressed page store when it is enabled
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+
+/* The view has to fit into the user address space next to everything else */
+#define MAXIMUM_VIEW_SIZE   (768 * 1024 * 1024)
+
+static
+ULONG
+GetFreePageFilePages(VOID)
+{
+    NTSTATUS Status;
+    ULONG Buffer[256];
+    PSYSTEM_PAGEFILE_INFORMATION PageFile = (PSYSTEM_PAGEFILE_INFORMATION)Buffer;
+    ULONG FreePages = 0;
+    ULONG Length;
+
+    Status = NtQuerySystemInformation(SystemPageFileInformation, Buffer, sizeof(Buffer), &Length);
+    if (!NT_SUCCESS(Status) || Length == 0)
+        return 0;
+
+    while (TRUE)
+    {
+        FreePages += PageFile->TotalSize - PageFile->TotalInUse;
+        if (PageFile->NextEntryOffset == 0)
+            break;
+        PageFile = (PSYSTEM_PAGEFILE_INFORMATION)((PUCHAR)PageFile + PageFile->NextEntryOffset);
+    }
+
+    return FreePages;
+}
+
+static
+VOID
+GetFaultCounts(
+    _Out_ PULONG PageFaultCount,
+    _Out_ PULONG HardFaultCount)
+{
+    PROCESS_WS_STATISTICS_INFORMATION Statistics = { 0 };
+    NTSTATUS Status;
+
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessWorkingSetStatistics,
+                                       &Statistics,
+                                       sizeof(Statistics),
+                                       NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    *PageFaultCount = Statistics.PageFaultCount;
+    *HardFaultCount = Statistics.HardFaultCount;
+}
+
+/* Fails where there is no compressed page store to ask about */
+static
+BOOLEAN
+QueryPageStore(
+    _Out_ PSYSTEM_PAGE_STORE_INFORMATION Info)
+{
+    SUPERFETCH_INFORMATION SuperfetchInfo;
+    NTSTATUS Status;
+
+    SuperfetchInfo.Version = SUPERFETCH_INFORMATION_VERSION;
+    SuperfetchInfo.Magic = SUPERFETCH_INFORMATION_MAGIC;
+    SuperfetchInfo.InfoClass = SuperfetchPageStoreQuery;
+    SuperfetchInfo.Data = Info;
+    SuperfetchInfo.Length = sizeof(*Info);
+
+    Status = NtQuerySystemInformation(SystemSuperfetchInformation,
+                                      &SuperfetchInfo,
+                                      sizeof(SuperfetchInfo),
+                                      NULL);
+    return NT_SUCCESS(Status);
+}
+
+static
+VOID
+ReportPass(
+    _In_ PCSTR Name,
+    _In_ SIZE_T Bytes,
+    _In_ PLARGE_INTEGER Start,
+    _In_ PLARGE_INTEGER End,
+    _In_opt_ PSYSTEM_PAGE_STORE_INFORMATION Before,
+    _In_opt_ PSYSTEM_PAGE_STORE_INFORMATION After)
+{
+    LARGE_INTEGER Frequency;
+    ULONGLONG Elapsed;
+    ULONG Hits, Misses;
+
+    QueryPerformanceFrequency(&Frequency);
+    Elapsed = (End->QuadPart - Start->QuadPart) * 1000 / Frequency.QuadPart;
+    if (Elapsed == 0)
+        Elapsed = 1;
+
+    if (!Before || !After)
+    {
+        trace("%s: %Iu MB in %I64u ms, %I64u KB/s\n", Name, Bytes >> 20, Elapsed,
+              (ULONGLONG)(Bytes >> 10) * 1000 / Elapsed);
+        return;
+    }
+
+    Hits = After->HitCount - Before->HitCount;
+    Misses = After->MissCount - Before->MissCount;
+
+    trace("%s: %Iu MB in %I64u ms, %I64u KB/s, %lu stored, %lu rejected, %lu spilled, %lu hits, %lu misses (%lu%% hit rate)\n",
+          Name, Bytes >> 20, Elapsed, (ULONGLONG)(Bytes >> 10) * 1000 / Elapsed,
+          After->StoreCount - Before->StoreCount,
+          After->RejectCount - Before->RejectCount,
+          After->SpillCount - Before->SpillCount,
+          Hits, Misses, (Hits + Misses) ? Hits * 100 / (Hits + Misses) : 0);
+}
+
+static
+VOID
+ReportStore(
+    _In_ PSYSTEM_PAGE_STORE_INFORMATION Info,
+    _In_ ULONG PageSize)
+{
+    trace("Store: %lu pages in %Iu KB of %Iu KB (ratio %I64u%%), %lu in the paging file, %lu/%lu slots\n",
+          Info->StoredPages, Info->CompressedBytes >> 10, Info->BudgetBytes >> 10,
+          Info->CompressedBytes ? (ULONGLONG)Info->StoredPages * PageSize * 100 / Info->CompressedBytes : 0,
+          Info->SpilledPages, Info->UsedSlots, Info->TotalSlots);
+}
+
+/* Like most real data, every page repeats itself a lot but not entirely */
+static
+VOID
+WritePages(
+    _In_ PUCHAR Base,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageSize,
+    _In_ ULONG Pass)
+{
+    ULONG i, j;
+
+    for (i = 0; i < PageCount; i++)
+    {
+        PULONG Page = (PULONG)(Base + (SIZE_T)i * PageSize);
+
+        for (j = 0; j < PageSize / sizeof(ULONG); j++)
+            Page[j] = (j % 64 == 0) ? (i ^ Pass ^ j) : (j & 0xFF);
+    }
+}
+
+static
+ULONG
+CheckPages(
+    _In_ PUCHAR Base,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageSize,
+    _In_ ULONG Pass,
+    _In_ ULONG Stride)
+{
+    ULONG i, j, k, Bad = 0;
+
+    /* Stride lets the reader jump over the clusters instead of walking them */
+    for (k = 0; k < Stride; k++)
+    {
+        for (i = k; i < PageCount; i += Stride)
+        {
+            PULONG Page = (PULONG)(Base + (SIZE_T)i * PageSize);
+
+            for (j = 0; j < PageSize / sizeof(ULONG); j += 64)
+            {
+                if (Page[j] != (i ^ Pass ^ j) || Page[j + 1] != ((j + 1) & 0xFF))
+                {
+                    Bad++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return Bad;
+}
+
+static
+VOID
+TestPaging(
+    _In_ PSYSTEM_BASIC_INFORMATION BasicInfo,
+    _In_ SIZE_T ViewSize,
+    _In_ BOOLEAN UseStore)
+{
+    NTSTATUS Status;
+    SYSTEM_PAGE_STORE_INFORMATION Before = { 0 }, After = { 0 };
+    PSYSTEM_PAGE_STORE_INFORMATION PassBefore = NULL, PassAfter = NULL;
+    LARGE_INTEGER MaximumSize, Start, End;
+    HANDLE SectionHandle;
+    PVOID BaseAddress = NULL;
+    ULONG PageCount, FreePageFilePages, Bad;
+    ULONG Faults, HardFaults, FaultsBefore, HardFaultsBefore;
+
+    PageCount = (ULONG)(ViewSize / BasicInfo->PageSize);
+
+    /* Even with the store, whatever does not fit into it is spilled to the paging file */
+    FreePageFilePages = GetFreePageFilePages();
+    if (FreePageFilePages < PageCount)
+    {
+        skip("Not enough paging file space (%lu pages, %lu needed)\n", FreePageFilePages, PageCount);
+        return;
+    }
+
+    if (UseStore)
+    {
+        PassBefore = &Before;
+        PassAfter = &After;
+        QueryPageStore(&Before);
+        ReportStore(&Before, BasicInfo->PageSize);
+    }
+
+    MaximumSize.QuadPart = ViewSize;
+    Status = NtCreateSection(&SectionHandle,
+                             SECTION_ALL_ACCESS,
+                             NULL,
+                             &MaximumSize,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* Written copy-on-write pages are private to us and go to the paging file */
+    Status = NtMapViewOfSection(SectionHandle,
+                                NtCurrentProcess(),
+                                &BaseAddress,
+                                0,
+                                0,
+                                NULL,
+                                &ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_WRITECOPY);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+    {
+        NtClose(SectionHandle);
+        return;
+    }
+
+    /* Page out: every page gets dirty, older ones have to make room */
+    GetFaultCounts(&FaultsBefore, &HardFaultsBefore);
+    QueryPerformanceCounter(&Start);
+    WritePages(BaseAddress, PageCount, BasicInfo->PageSize, 1);
+    QueryPerformanceCounter(&End);
+    GetFaultCounts(&Faults, &HardFaults);
+    ok(Faults - FaultsBefore >= PageCount, "%lu faults for %lu new pages\n", Faults - FaultsBefore, PageCount);
+    if (UseStore)
+    {
+        QueryPageStore(&After);
+        ok(After.StoreCount != Before.StoreCount, "Nothing went into the store\n");
+    }
+    ReportPass("dirty fill", ViewSize, &Start, &End, PassBefore, PassAfter);
+
+    /* Page in sequentially, neighbours come back with the faulting page */
+    Before = After;
+    FaultsBefore = Faults;
+    HardFaultsBefore = HardFaults;
+    QueryPerformanceCounter(&Start);
+    Bad = CheckPages(BaseAddress, PageCount, BasicInfo->PageSize, 1, 1);
+    QueryPerformanceCounter(&End);
+    GetFaultCounts(&Faults, &HardFaults);
+    if (UseStore)
+    {
+        QueryPageStore(&After);
+        ok(After.HitCount != Before.HitCount, "Nothing came back from the store\n");
+    }
+    ok(Bad == 0, "%lu pages have wrong content\n", Bad);
+    ok(Faults != FaultsBefore, "No page had left the working set\n");
+    ok(HardFaults - HardFaultsBefore <= Faults - FaultsBefore, "%lu hard faults out of %lu\n",
+       HardFaults - HardFaultsBefore, Faults - FaultsBefore);
+    ReportPass("sequential read", ViewSize, &Start, &End, PassBefore, PassAfter);
+
+    /* Dirty them all again, the stale copies are replaced */
+    Before = After;
+    QueryPerformanceCounter(&Start);
+    WritePages(BaseAddress, PageCount, BasicInfo->PageSize, 2);
+    QueryPerformanceCounter(&End);
+    if (UseStore)
+        QueryPageStore(&After);
+    ReportPass("dirty rewrite", ViewSize, &Start, &End, PassBefore, PassAfter);
+
+    /* Page in out of order, one page per 64 KiB cluster at a time */
+    Before = After;
+    GetFaultCounts(&FaultsBefore, &HardFaultsBefore);
+    QueryPerformanceCounter(&Start);
+    Bad = CheckPages(BaseAddress, PageCount, BasicInfo->PageSize, 2, 0x10000 / BasicInfo->PageSize);
+    QueryPerformanceCounter(&End);
+    GetFaultCounts(&Faults, &HardFaults);
+    ok(Faults != FaultsBefore, "No page had left the working set\n");
+    if (UseStore)
+    {
+        QueryPageStore(&After);
+        ReportStore(&After, BasicInfo->PageSize);
+    }
+    ok(Bad == 0, "%lu pages have wrong content\n", Bad);
+    ReportPass("strided read", ViewSize, &Start, &End, PassBefore, PassAfter);
+
+    Status = NtUnmapViewOfSection(NtCurrentProcess(), BaseAddress);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    NtClose(SectionHandle);
+}
+
+START_TEST(SectionPaging)
+{
+    NTSTATUS Status;
+    SYSTEM_BASIC_INFORMATION BasicInfo;
+    SYSTEM_PAGE_STORE_INFORMATION StoreInfo;
+    SIZE_T PhysicalBytes;
+    BOOLEAN StoreAvailable;
+
+    if (!winetest_interactive)
+    {
+        skip("SectionPaging runs for minutes and fills the paging file. Set winetest_interactive to run it.\n");
+        return;
+    }
+
+    Status = NtQuerySystemInformation(SystemBasicInformation, &BasicInfo, sizeof(BasicInfo), NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* A quarter more than there is RAM forces the balancer to page out */
+    PhysicalBytes = (SIZE_T)BasicInfo.NumberOfPhysicalPages * BasicInfo.PageSize;
+    if (PhysicalBytes > MAXIMUM_VIEW_SIZE - MAXIMUM_VIEW_SIZE / 4)
+    {
+        skip("Too much RAM (%Iu MB) to put the system under pressure\n", PhysicalBytes >> 20);
+        return;
+    }
+
+    /*
+     * The store is set up at boot from PageStorePercent and stays. For numbers
+     * without it, boot with PageStorePercent set to 0 and compare the first pass.
+     */
+    StoreAvailable = QueryPageStore(&StoreInfo) && StoreInfo.BudgetBytes != 0;
+    trace("Compressed page store is %s\n", StoreAvailable ? "enabled" : "disabled");
+    TestPaging(&BasicInfo, PhysicalBytes + PhysicalBytes / 4, StoreAvailable);
+
+    if (!StoreAvailable)
+    {
+        skip("The compressed page store is not available\n");
+        return;
+    }
+
+    /* Twice the RAM, half of it has to be somewhere else at any time */
+    if (PhysicalBytes > MAXIMUM_VIEW_SIZE / 2)
+    {
+        skip("Too much RAM (%Iu MB) to fill the page store\n", PhysicalBytes >> 20);
+        return;
+    }
+    TestPaging(&BasicInfo, PhysicalBytes * 2, TRUE);
+}
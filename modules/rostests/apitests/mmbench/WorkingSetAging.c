@@ -0,0 +1,239 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Working set aging with several processes competing for RAM
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+
+#define CHILD_COUNT         4
+#define CHILD_PASSES        16
+
+/* Every child maps its view into its own address space */
+#define MAXIMUM_VIEW_SIZE   (768 * 1024 * 1024)
+
+/* What the children return when they could not run the workload */
+#define CHILD_FAILED        0xFFFFFFFF
+
+/* Twice the RAM takes a while to go through the paging file */
+#define CHILD_TIMEOUT       (10 * 60 * 1000)
+
+static
+BOOLEAN
+GetStatistics(
+    _In_ HANDLE ProcessHandle,
+    _Out_ PPROCESS_WS_STATISTICS_INFORMATION Statistics)
+{
+    NTSTATUS Status;
+
+    Status = NtQueryInformationProcess(ProcessHandle,
+                                       ProcessWorkingSetStatistics,
+                                       Statistics,
+                                       sizeof(*Statistics),
+                                       NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    return NT_SUCCESS(Status);
+}
+
+/*
+ * A quarter of the view is used on every pass, the rest once in a while.
+ * With the ages right, the cold pages are the ones that leave.
+ */
+static
+ULONG
+RunChild(
+    _In_ SIZE_T ViewSize)
+{
+    NTSTATUS Status;
+    SYSTEM_BASIC_INFORMATION BasicInfo;
+    LARGE_INTEGER MaximumSize;
+    HANDLE SectionHandle;
+    PVOID BaseAddress = NULL;
+    ULONG PageCount, HotCount, Pass, i;
+
+    Status = NtQuerySystemInformation(SystemBasicInformation, &BasicInfo, sizeof(BasicInfo), NULL);
+    if (!NT_SUCCESS(Status))
+        return CHILD_FAILED;
+
+    MaximumSize.QuadPart = ViewSize;
+    Status = NtCreateSection(&SectionHandle,
+                             SECTION_ALL_ACCESS,
+                             NULL,
+                             &MaximumSize,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             NULL);
+    if (!NT_SUCCESS(Status))
+        return CHILD_FAILED;
+
+    /* Written copy-on-write pages are private to us and can go to the paging file */
+    Status = NtMapViewOfSection(SectionHandle,
+                                NtCurrentProcess(),
+                                &BaseAddress,
+                                0,
+                                0,
+                                NULL,
+                                &ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_WRITECOPY);
+    if (!NT_SUCCESS(Status))
+    {
+        NtClose(SectionHandle);
+        return CHILD_FAILED;
+    }
+
+    PageCount = (ULONG)(ViewSize / BasicInfo.PageSize);
+    HotCount = PageCount / 4;
+
+    for (Pass = 0; Pass < CHILD_PASSES; Pass++)
+    {
+        ULONG Count = (Pass % 8 == 0) ? PageCount : HotCount;
+
+        for (i = 0; i < Count; i++)
+            ((PULONG)((PUCHAR)BaseAddress + (SIZE_T)i * BasicInfo.PageSize))[Pass % 64] += i;
+
+        /* Give the balancer a chance to age our pages */
+        Sleep(1000);
+    }
+
+    NtUnmapViewOfSection(NtCurrentProcess(), BaseAddress);
+    NtClose(SectionHandle);
+
+    /* Our counters outlive us, the parent reads them through our handle */
+    return PageCount;
+}
+
+static
+HANDLE
+StartChild(
+    _In_ SIZE_T ViewSize)
+{
+    WCHAR FileName[MAX_PATH];
+    WCHAR CommandLine[MAX_PATH + 64];
+    STARTUPINFOW StartupInfo = { sizeof(StartupInfo) };
+    PROCESS_INFORMATION ProcessInfo;
+
+    GetModuleFileNameW(NULL, FileName, _countof(FileName));
+    StringCbPrintfW(CommandLine, sizeof(CommandLine), L"\"%ls\" WorkingSetAging %Iu", FileName, ViewSize);
+
+    /* The children have nothing to say, they only return their page count */
+    StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+
+    if (!CreateProcessW(FileName, CommandLine, NULL, NULL, FALSE, 0, NULL, NULL, &StartupInfo, &ProcessInfo))
+    {
+        ok(FALSE, "CreateProcessW failed with %lu\n", GetLastError());
+        return NULL;
+    }
+
+    CloseHandle(ProcessInfo.hThread);
+    return ProcessInfo.hProcess;
+}
+
+START_TEST(WorkingSetAging)
+{
+    NTSTATUS Status;
+    SYSTEM_BASIC_INFORMATION BasicInfo;
+    PROCESS_WS_STATISTICS_INFORMATION Statistics;
+    HANDLE Children[CHILD_COUNT];
+    LARGE_INTEGER Frequency, Start, End;
+    SIZE_T PhysicalBytes, ViewSize;
+    ULONG ChildCount, TotalHardFaults, TotalAccessed, i;
+    DWORD ExitCode;
+    char **argv;
+    int argc;
+
+    argc = winetest_get_mainargs(&argv);
+    if (argc >= 3)
+    {
+        ExitProcess(RunChild((SIZE_T)_strtoui64(argv[2], NULL, 10)));
+    }
+
+    if (!winetest_interactive)
+    {
+        skip("WorkingSetAging runs for minutes and pages out the whole system. Set winetest_interactive to run it.\n");
+        return;
+    }
+
+    /* We are faulting, aren't we? */
+    if (!GetStatistics(NtCurrentProcess(), &Statistics))
+        return;
+    ok(Statistics.WorkingSetSize != 0, "Empty working set\n");
+    ok(Statistics.PeakWorkingSetSize >= Statistics.WorkingSetSize,
+       "Peak %Iu below current %Iu\n", Statistics.PeakWorkingSetSize, Statistics.WorkingSetSize);
+    ok(Statistics.PageFaultCount != 0, "No page fault was counted\n");
+
+    Status = NtQuerySystemInformation(SystemBasicInformation, &BasicInfo, sizeof(BasicInfo), NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* Together the children want twice the RAM */
+    PhysicalBytes = (SIZE_T)BasicInfo.NumberOfPhysicalPages * BasicInfo.PageSize;
+    ViewSize = PhysicalBytes * 2 / CHILD_COUNT;
+    if (ViewSize > MAXIMUM_VIEW_SIZE)
+    {
+        skip("Too much RAM (%Iu MB) to put the system under pressure\n", PhysicalBytes >> 20);
+        return;
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+
+    for (ChildCount = 0; ChildCount < CHILD_COUNT; ChildCount++)
+    {
+        Children[ChildCount] = StartChild(ViewSize);
+        if (!Children[ChildCount])
+            break;
+    }
+
+    TotalHardFaults = 0;
+    TotalAccessed = 0;
+    for (i = 0; i < ChildCount; i++)
+    {
+        if (WaitForSingleObject(Children[i], CHILD_TIMEOUT) != WAIT_OBJECT_0)
+        {
+            ok(FALSE, "Child %lu did not finish\n", i);
+            TerminateProcess(Children[i], CHILD_FAILED);
+            CloseHandle(Children[i]);
+            continue;
+        }
+
+        ok(GetExitCodeProcess(Children[i], &ExitCode), "GetExitCodeProcess failed with %lu\n", GetLastError());
+        ok(ExitCode != CHILD_FAILED, "Child %lu could not run\n", i);
+        if (ExitCode == CHILD_FAILED || !GetStatistics(Children[i], &Statistics))
+        {
+            CloseHandle(Children[i]);
+            continue;
+        }
+        CloseHandle(Children[i]);
+
+        /* Every page of the view was written at least once */
+        ok(Statistics.PageFaultCount >= ExitCode,
+           "Child %lu: %lu faults for %lu pages\n", i, Statistics.PageFaultCount, ExitCode);
+        ok(Statistics.HardFaultCount <= Statistics.PageFaultCount,
+           "Child %lu: %lu hard faults out of %lu\n", i, Statistics.HardFaultCount, Statistics.PageFaultCount);
+        ok(Statistics.PeakWorkingSetSize != 0, "Child %lu never had a working set\n", i);
+
+        trace("Child %lu: peak %Iu KB, %lu faults, %lu hard, %lu hits\n",
+              i, Statistics.PeakWorkingSetSize >> 10, Statistics.PageFaultCount,
+              Statistics.HardFaultCount, Statistics.AccessedPageCount);
+        TotalHardFaults += Statistics.HardFaultCount;
+        TotalAccessed += Statistics.AccessedPageCount;
+    }
+
+    QueryPerformanceCounter(&End);
+
+    /* Twice the RAM does not fit, and the balancer has to look at the pages to choose */
+    if (ChildCount == CHILD_COUNT)
+    {
+        ok(TotalHardFaults != 0, "%lu processes of %Iu MB never went to the paging file\n",
+           ChildCount, ViewSize >> 20);
+        ok(TotalAccessed != 0, "The balancer did not sample any page\n");
+    }
+
+    trace("%lu processes of %Iu MB each with %Iu MB of RAM: %lu hard faults in %I64u ms\n",
+          ChildCount, ViewSize >> 20, PhysicalBytes >> 20, TotalHardFaults,
+          (End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart);
+}
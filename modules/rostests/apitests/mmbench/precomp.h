@@ -0,0 +1,12 @@
+#ifndef _MMBENCH_APITEST_PRECOMP_H_
+#define _MMBENCH_APITEST_PRECOMP_H_
+
+#define WIN32_NO_STATUS
+#define _INC_WINDOWS
+#define COM_NO_WINDOWS_H
+
+#include <apitest.h>
+#include <ndk/ntndk.h>
+#include <strsafe.h>
+
+#endif /* _MMBENCH_APITEST_PRECOMP_H_ */
@@ -0,0 +1,15 @@
+#define __ROS_LONG64__
+
+#define STANDALONE
+#include <apitest.h>
+
+extern void func_SectionPaging(void);
+extern void func_WorkingSetAging(void);
+
+const struct test winetest_testlist[] =
+{
+    { "SectionPaging",                  func_SectionPaging },
+    { "WorkingSetAging",                func_WorkingSetAging },
+
+    { 0, 0 }
+};
@@ -9,7 +9,8 @@
 
 static
 HANDLE
-GetToken(VOID)
+GetToken(
+    _In_ ACCESS_MASK DesiredAccess)
 {
     NTSTATUS Status;
     HANDLE Token;
@@ -39,7 +40,7 @@ GetToken(VOID)
     ObjectAttributes.SecurityQualityOfService = &Sqos;
 
     Status = NtDuplicateToken(Token,
-                              TOKEN_QUERY | TOKEN_DUPLICATE,
+                              DesiredAccess,
                               &ObjectAttributes,
                               FALSE,
                               TokenImpersonation,
@@ -97,7 +98,7 @@ AccessCheckEmptyMappingTest(VOID)
         goto Quit;
     }
 
-    Token = GetToken();
+    Token = GetToken(TOKEN_QUERY | TOKEN_DUPLICATE);
     if (Token == NULL)
     {
         skip("Failed to get token, skipping tests\n");
@@ -182,7 +183,218 @@ Quit:
     }
 }
 
+static
+VOID
+AccessCheckRepeatedTest(VOID)
+{
+    NTSTATUS Status;
+    NTSTATUS AccessStatus;
+    ACCESS_MASK GrantedAccess;
+    PPRIVILEGE_SET PrivilegeSet = NULL;
+    ULONG PrivilegeSetLength;
+    HANDLE Token = NULL;
+    PTOKEN_GROUPS Groups = NULL;
+    TOKEN_GROUPS DisabledGroup;
+    PSID GroupSid = NULL;
+    PACL Dacl = NULL;
+    ULONG DaclSize;
+    ULONG Length;
+    ULONG Index;
+    ULONG Iterations;
+    DWORD StartTime, ElapsedTime;
+    SECURITY_DESCRIPTOR Sd;
+    static GENERIC_MAPPING Mapping = {STANDARD_RIGHTS_READ | 0x1,
+                                      STANDARD_RIGHTS_WRITE | 0x2,
+                                      STANDARD_RIGHTS_EXECUTE | 0x4,
+                                      STANDARD_RIGHTS_REQUIRED | 0x7};
+
+    PrivilegeSetLength = FIELD_OFFSET(PRIVILEGE_SET, Privilege[16]);
+    PrivilegeSet = RtlAllocateHeap(RtlGetProcessHeap(), 0, PrivilegeSetLength);
+    if (PrivilegeSet == NULL)
+    {
+        skip("Failed to allocate PrivilegeSet, skipping tests\n");
+        return;
+    }
+
+    Token = GetToken(TOKEN_QUERY | TOKEN_DUPLICATE | TOKEN_ADJUST_GROUPS);
+    if (Token == NULL)
+    {
+        skip("Failed to get token, skipping tests\n");
+        goto Quit;
+    }
+
+    /* Look for a group we are allowed to disable */
+    Status = NtQueryInformationToken(Token, TokenGroups, NULL, 0, &Length);
+    if (Status != STATUS_BUFFER_TOO_SMALL)
+    {
+        skip("Failed to query the token groups length (Status 0x%08lx), skipping tests\n", Status);
+        goto Quit;
+    }
+
+    Groups = RtlAllocateHeap(RtlGetProcessHeap(), 0, Length);
+    if (Groups == NULL)
+    {
+        skip("Failed to allocate token groups, skipping tests\n");
+        goto Quit;
+    }
+
+    Status = NtQueryInformationToken(Token, TokenGroups, Groups, Length, &Length);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to query the token groups (Status 0x%08lx), skipping tests\n", Status);
+        goto Quit;
+    }
+
+    for (Index = 0; Index < Groups->GroupCount; Index++)
+    {
+        if ((Groups->Groups[Index].Attributes & SE_GROUP_ENABLED) &&
+            !(Groups->Groups[Index].Attributes & (SE_GROUP_MANDATORY | SE_GROUP_USE_FOR_DENY_ONLY)))
+        {
+            GroupSid = Groups->Groups[Index].Sid;
+            break;
+        }
+    }
+
+    if (GroupSid == NULL)
+    {
+        skip("The token has no optional group, skipping tests\n");
+        goto Quit;
+    }
+
+    Status = RtlCreateSecurityDescriptor(&Sd, SECURITY_DESCRIPTOR_REVISION);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to create a security descriptor, skipping tests\n");
+        goto Quit;
+    }
+
+    DaclSize = sizeof(ACL) +
+               sizeof(ACCESS_ALLOWED_ACE) + RtlLengthSid(GroupSid);
+    Dacl = RtlAllocateHeap(RtlGetProcessHeap(),
+                           HEAP_ZERO_MEMORY,
+                           DaclSize);
+    if (Dacl == NULL)
+    {
+        skip("Failed to allocate memory for DACL, skipping tests\n");
+        goto Quit;
+    }
+
+    /* Only the optional group has access to the object */
+    Status = RtlCreateAcl(Dacl,
+                          DaclSize,
+                          ACL_REVISION);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to create DACL, skipping tests\n");
+        goto Quit;
+    }
+
+    Status = RtlAddAccessAllowedAce(Dacl,
+                                    ACL_REVISION,
+                                    0x1,
+                                    GroupSid);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to add allowed ACE for the group, skipping tests\n");
+        goto Quit;
+    }
+
+    RtlSetGroupSecurityDescriptor(&Sd, GroupSid, FALSE);
+    RtlSetOwnerSecurityDescriptor(&Sd, GroupSid, FALSE);
+    RtlSetDaclSecurityDescriptor(&Sd, TRUE, Dacl, FALSE);
+
+    /* Check the same descriptor over and over, the result must not change */
+    Iterations = 0;
+    StartTime = GetTickCount();
+    do
+    {
+        Status = NtAccessCheck(&Sd,
+                               Token,
+                               0x1,
+                               &Mapping,
+                               PrivilegeSet,
+                               &PrivilegeSetLength,
+                               &GrantedAccess,
+                               &AccessStatus);
+        if (Status != STATUS_SUCCESS || AccessStatus != STATUS_SUCCESS || GrantedAccess != 0x1)
+            break;
+        Iterations++;
+        ElapsedTime = GetTickCount() - StartTime;
+    } while (ElapsedTime < 1000);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_hex(AccessStatus, STATUS_SUCCESS);
+    ok_hex(GrantedAccess, 0x1);
+    if (ElapsedTime != 0)
+        trace("%lu access checks per second\n", Iterations * 1000 / ElapsedTime);
+
+    /* Disable the group, the access check must now fail */
+    DisabledGroup.GroupCount = 1;
+    DisabledGroup.Groups[0].Sid = GroupSid;
+    DisabledGroup.Groups[0].Attributes = 0;
+    Status = NtAdjustGroupsToken(Token,
+                                 FALSE,
+                                 &DisabledGroup,
+                                 0,
+                                 NULL,
+                                 NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    Status = NtAccessCheck(&Sd,
+                           Token,
+                           0x1,
+                           &Mapping,
+                           PrivilegeSet,
+                           &PrivilegeSetLength,
+                           &GrantedAccess,
+                           &AccessStatus);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_hex(AccessStatus, STATUS_ACCESS_DENIED);
+
+    /* Restore the groups, access must be granted again */
+    Status = NtAdjustGroupsToken(Token,
+                                 TRUE,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    Status = NtAccessCheck(&Sd,
+                           Token,
+                           0x1,
+                           &Mapping,
+                           PrivilegeSet,
+                           &PrivilegeSetLength,
+                           &GrantedAccess,
+                           &AccessStatus);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_hex(AccessStatus, STATUS_SUCCESS);
+    ok_hex(GrantedAccess, 0x1);
+
+Quit:
+    if (Dacl)
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Dacl);
+    }
+
+    if (Groups)
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Groups);
+    }
+
+    if (Token)
+    {
+        NtClose(Token);
+    }
+
+    if (PrivilegeSet)
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, PrivilegeSet);
+    }
+}
+
 START_TEST(NtAccessCheck)
 {
     AccessCheckEmptyMappingTest();
+    AccessCheckRepeatedTest();
 }
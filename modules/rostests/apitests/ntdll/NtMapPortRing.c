@@ -0,0 +1,331 @@
+/*
+ * PROJECT:     ReactOS API tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for NtMapPortRing and NtSignalWaitPortRing
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "precomp.h"
+
+#include <process.h>
+
+#define RING_SLOTS      16
+#define ROUND_TRIPS     20000
+#define LAST_VALUE      0xFFFFFFFF
+
+typedef struct _TEST_MESSAGE
+{
+    PORT_MESSAGE Header;
+    ULONG Value;
+} TEST_MESSAGE, *PTEST_MESSAGE;
+
+static UNICODE_STRING PortName = RTL_CONSTANT_STRING(L"\\NtdllApitestNtMapPortRingTestPort");
+
+/* Publishes the slot just written at the tail. Returns whether the consumer
+ * went to sleep and has to be signaled */
+static
+BOOLEAN
+RingPush(
+    _Inout_ PPORT_RING_QUEUE Queue)
+{
+    InterlockedIncrement((PLONG)&Queue->Tail);
+    return InterlockedExchange(&Queue->Waiting, 0) != 0;
+}
+
+/* Waits until there is something to take from the queue, signaling the
+ * other side first if asked to */
+static
+NTSTATUS
+RingWait(
+    _In_ HANDLE PortHandle,
+    _Inout_ PPORT_RING_QUEUE Queue,
+    _In_ BOOLEAN Signal)
+{
+    NTSTATUS Status;
+
+    for (;;)
+    {
+        if (Queue->Head != Queue->Tail)
+        {
+            if (Signal)
+                NtSignalWaitPortRing(PortHandle, PORT_RING_SIGNAL, NULL);
+            return STATUS_SUCCESS;
+        }
+
+        /* Announce the sleep, then look once more so no push is missed */
+        InterlockedExchange(&Queue->Waiting, 1);
+        if (Queue->Head != Queue->Tail)
+        {
+            InterlockedExchange(&Queue->Waiting, 0);
+            continue;
+        }
+
+        Status = NtSignalWaitPortRing(PortHandle,
+                                      (Signal ? PORT_RING_SIGNAL : 0) | PORT_RING_WAIT,
+                                      NULL);
+        Signal = FALSE;
+        if (Status != STATUS_SUCCESS)
+            return Status;
+    }
+}
+
+static
+VOID
+ReportRoundTrips(
+    _In_ PCSTR Name,
+    _In_ ULONG Count,
+    _In_ PLARGE_INTEGER Start,
+    _In_ PLARGE_INTEGER End)
+{
+    LARGE_INTEGER Frequency;
+
+    QueryPerformanceFrequency(&Frequency);
+    if (Count != 0)
+    {
+        trace("%s: %lu round trips, %lu ns each\n", Name, Count,
+              (ULONG)((End->QuadPart - Start->QuadPart) * 1000000000 / Frequency.QuadPart / Count));
+    }
+}
+
+UINT
+CALLBACK
+ServerThread(
+    _Inout_ PVOID Parameter)
+{
+    NTSTATUS Status;
+    TEST_MESSAGE Message;
+    HANDLE PortHandle;
+    HANDLE ServerPortHandle = Parameter;
+    PPORT_RING Ring = NULL;
+    PTEST_MESSAGE Request, Reply;
+    BOOLEAN Signal = FALSE;
+    ULONG Value;
+
+    RtlZeroMemory(&Message, sizeof(Message));
+    Status = NtListenPort(ServerPortHandle, &Message.Header);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    Status = NtAcceptConnectPort(&PortHandle, NULL, &Message.Header, TRUE, NULL, NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return 0;
+
+    Status = NtCompleteConnectPort(PortHandle);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    /* The server creates the ring, the client joins it later */
+    Status = NtMapPortRing(PortHandle, RING_SLOTS, (PVOID*)&Ring);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    /* Classic LPC: echo every request until the last one */
+    RtlZeroMemory(&Message, sizeof(Message));
+    Status = NtReplyWaitReceivePort(PortHandle, NULL, NULL, &Message.Header);
+    while (NT_SUCCESS(Status) && Message.Header.u2.s2.Type == LPC_REQUEST)
+    {
+        Value = Message.Value;
+        Message.Value = ~Value;
+        if (Value == LAST_VALUE)
+        {
+            Status = NtReplyPort(PortHandle, &Message.Header);
+            ok_hex(Status, STATUS_SUCCESS);
+            break;
+        }
+        Status = NtReplyWaitReceivePort(PortHandle, NULL, &Message.Header, &Message.Header);
+    }
+    ok_hex(Status, STATUS_SUCCESS);
+
+    /* Same through the ring */
+    while (Ring)
+    {
+        Status = RingWait(PortHandle, &Ring->Queue[PORT_RING_REQUEST_QUEUE], Signal);
+        if (Status != STATUS_SUCCESS)
+            break;
+
+        Request = PORT_RING_SLOT(Ring, PORT_RING_REQUEST_QUEUE, Ring->Queue[PORT_RING_REQUEST_QUEUE].Head);
+        Reply = PORT_RING_SLOT(Ring, PORT_RING_REPLY_QUEUE, Ring->Queue[PORT_RING_REPLY_QUEUE].Tail);
+        Value = Request->Value;
+        Reply->Header = Request->Header;
+        Reply->Value = ~Value;
+        InterlockedIncrement((PLONG)&Ring->Queue[PORT_RING_REQUEST_QUEUE].Head);
+
+        /* The signal goes along with our next wait */
+        Signal = RingPush(&Ring->Queue[PORT_RING_REPLY_QUEUE]);
+        if (Value == LAST_VALUE)
+        {
+            if (Signal)
+                NtSignalWaitPortRing(PortHandle, PORT_RING_SIGNAL, NULL);
+            break;
+        }
+    }
+    ok_hex(Status, STATUS_SUCCESS);
+
+    Status = NtClose(PortHandle);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    /* The view outlives the port */
+    if (Ring)
+    {
+        ok(Ring->SlotCount == RING_SLOTS, "SlotCount = %lu\n", Ring->SlotCount);
+        Status = NtUnmapViewOfSection(NtCurrentProcess(), Ring);
+        ok_hex(Status, STATUS_SUCCESS);
+    }
+
+    return 0;
+}
+
+UINT
+CALLBACK
+ClientThread(
+    _Inout_ PVOID Parameter)
+{
+    NTSTATUS Status;
+    HANDLE PortHandle;
+    SECURITY_QUALITY_OF_SERVICE SecurityQos;
+    TEST_MESSAGE Message;
+    PPORT_RING Ring = NULL;
+    PVOID Dummy;
+    PTEST_MESSAGE Request, Reply;
+    LARGE_INTEGER Start, End;
+    ULONG i, Value;
+
+    SecurityQos.Length = sizeof(SecurityQos);
+    SecurityQos.ImpersonationLevel = SecurityIdentification;
+    SecurityQos.EffectiveOnly = TRUE;
+    SecurityQos.ContextTrackingMode = SECURITY_STATIC_TRACKING;
+
+    Status = NtConnectPort(&PortHandle, &PortName, &SecurityQos, NULL, NULL, NULL, NULL, NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to connect\n");
+        return 0;
+    }
+
+    /* Classic LPC round trips */
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ROUND_TRIPS; i++)
+    {
+        Value = (i == ROUND_TRIPS - 1) ? LAST_VALUE : i;
+        RtlZeroMemory(&Message, sizeof(Message));
+        Message.Header.u1.s1.TotalLength = sizeof(Message);
+        Message.Header.u1.s1.DataLength = sizeof(Message.Value);
+        Message.Value = Value;
+        Status = NtRequestWaitReplyPort(PortHandle, &Message.Header, &Message.Header);
+        if (Status != STATUS_SUCCESS || Message.Value != ~Value)
+        {
+            ok(0, "[%lu] Status %lx, Value %lx\n", i, Status, Message.Value);
+            break;
+        }
+    }
+    QueryPerformanceCounter(&End);
+    ReportRoundTrips("NtRequestWaitReplyPort", i, &Start, &End);
+
+    /* Join the ring the server made */
+    Status = NtMapPortRing(PortHandle, 3, &Dummy);
+    ok_hex(Status, STATUS_INVALID_PARAMETER_2);
+    Status = NtMapPortRing(PortHandle, RING_SLOTS, (PVOID*)&Ring);
+    ok_hex(Status, STATUS_SUCCESS);
+    Status = NtMapPortRing(PortHandle, RING_SLOTS, &Dummy);
+    ok_hex(Status, STATUS_ALREADY_COMMITTED);
+    if (!Ring)
+    {
+        skip("No ring\n");
+        NtClose(PortHandle);
+        return 0;
+    }
+    ok(Ring->SlotCount == RING_SLOTS, "SlotCount = %lu\n", Ring->SlotCount);
+    ok(Ring->SlotSize >= sizeof(TEST_MESSAGE), "SlotSize = %lu\n", Ring->SlotSize);
+
+    /* Ring round trips */
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ROUND_TRIPS; i++)
+    {
+        Value = (i == ROUND_TRIPS - 1) ? LAST_VALUE : i;
+        Request = PORT_RING_SLOT(Ring, PORT_RING_REQUEST_QUEUE, Ring->Queue[PORT_RING_REQUEST_QUEUE].Tail);
+        RtlZeroMemory(Request, sizeof(*Request));
+        Request->Header.u1.s1.TotalLength = sizeof(*Request);
+        Request->Header.u1.s1.DataLength = sizeof(Request->Value);
+        Request->Value = Value;
+
+        Status = RingWait(PortHandle,
+                          &Ring->Queue[PORT_RING_REPLY_QUEUE],
+                          RingPush(&Ring->Queue[PORT_RING_REQUEST_QUEUE]));
+        if (Status != STATUS_SUCCESS)
+        {
+            ok(0, "[%lu] Status %lx\n", i, Status);
+            break;
+        }
+
+        Reply = PORT_RING_SLOT(Ring, PORT_RING_REPLY_QUEUE, Ring->Queue[PORT_RING_REPLY_QUEUE].Head);
+        ok(Reply->Value == ~Value, "[%lu] Value %lx\n", i, Reply->Value);
+        InterlockedIncrement((PLONG)&Ring->Queue[PORT_RING_REPLY_QUEUE].Head);
+    }
+    QueryPerformanceCounter(&End);
+    ReportRoundTrips("Port ring", i, &Start, &End);
+
+    /* The server closes its end after the last reply, which must wake us */
+    Status = RingWait(PortHandle, &Ring->Queue[PORT_RING_REPLY_QUEUE], FALSE);
+    ok_hex(Status, STATUS_PORT_DISCONNECTED);
+
+    Status = NtClose(PortHandle);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    /* The view outlives the port */
+    ok(Ring->SlotCount == RING_SLOTS, "SlotCount = %lu\n", Ring->SlotCount);
+    Status = NtUnmapViewOfSection(NtCurrentProcess(), Ring);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    return 0;
+}
+
+START_TEST(NtMapPortRing)
+{
+    NTSTATUS Status;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    HANDLE PortHandle;
+    HANDLE ThreadHandles[2];
+    PVOID Ring;
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &PortName,
+                               OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+    Status = NtCreatePort(&PortHandle,
+                          &ObjectAttributes,
+                          0,
+                          sizeof(TEST_MESSAGE),
+                          2 * sizeof(TEST_MESSAGE));
+    ok_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Failed to create port\n");
+        return;
+    }
+
+    /* Connection ports have nobody to share a ring with */
+    Status = NtMapPortRing(PortHandle, RING_SLOTS, &Ring);
+    ok_hex(Status, STATUS_INVALID_PORT_HANDLE);
+    Status = NtSignalWaitPortRing(PortHandle, PORT_RING_SIGNAL, NULL);
+    ok_hex(Status, STATUS_INVALID_PORT_HANDLE);
+    Status = NtSignalWaitPortRing(PortHandle, 0, NULL);
+    ok_hex(Status, STATUS_INVALID_PARAMETER_2);
+
+    ThreadHandles[0] = (HANDLE)_beginthreadex(NULL, 0, ServerThread, PortHandle, 0, NULL);
+    ok(ThreadHandles[0] != NULL, "_beginthreadex failed\n");
+    ThreadHandles[1] = (HANDLE)_beginthreadex(NULL, 0, ClientThread, NULL, 0, NULL);
+    ok(ThreadHandles[1] != NULL, "_beginthreadex failed\n");
+
+    Status = NtWaitForMultipleObjects(RTL_NUMBER_OF(ThreadHandles),
+                                      ThreadHandles,
+                                      WaitAll,
+                                      FALSE,
+                                      NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    NtClose(ThreadHandles[0]);
+    NtClose(ThreadHandles[1]);
+
+    Status = NtClose(PortHandle);
+    ok_hex(Status, STATUS_SUCCESS);
+}
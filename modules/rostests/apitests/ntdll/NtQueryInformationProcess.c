@@ -672,6 +672,73 @@ Test_ProcessWx86Information(void)
     trace("VdmPower = %lu\n", VdmPower);
 }
 
+static
+void
+Test_ProcessWorkingSetStatistics(void)
+{
+    NTSTATUS Status;
+    ULONG Length;
+    PROCESS_WS_STATISTICS_INFORMATION Before, After;
+    SIZE_T Size = 16 * PAGE_SIZE;
+    PVOID Buffer = NULL;
+    ULONG i;
+
+    /* The length must be exact */
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessWorkingSetStatistics,
+                                       &Before,
+                                       sizeof(Before) - 1,
+                                       NULL);
+    ok_hex(Status, STATUS_INFO_LENGTH_MISMATCH);
+
+    Status = NtQueryInformationProcess(NULL,
+                                       ProcessWorkingSetStatistics,
+                                       &Before,
+                                       sizeof(Before),
+                                       NULL);
+    ok_hex(Status, STATUS_INVALID_HANDLE);
+
+    Length = 0;
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessWorkingSetStatistics,
+                                       &Before,
+                                       sizeof(Before),
+                                       &Length);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_size_t(Length, sizeof(Before));
+    if (!NT_SUCCESS(Status))
+        return;
+
+    ok(Before.WorkingSetSize != 0, "WorkingSetSize is 0\n");
+    ok(Before.PeakWorkingSetSize >= Before.WorkingSetSize,
+       "PeakWorkingSetSize %Iu < WorkingSetSize %Iu\n", Before.PeakWorkingSetSize, Before.WorkingSetSize);
+    ok(Before.PageFaultCount != 0, "PageFaultCount is 0\n");
+
+    /* Demand-zero faults are soft ones */
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Buffer, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+    ok_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+    for (i = 0; i < Size; i += PAGE_SIZE)
+        ((PUCHAR)Buffer)[i] = 1;
+
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessWorkingSetStatistics,
+                                       &After,
+                                       sizeof(After),
+                                       NULL);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok(After.PageFaultCount >= Before.PageFaultCount + Size / PAGE_SIZE,
+       "PageFaultCount went from %lu to %lu\n", Before.PageFaultCount, After.PageFaultCount);
+    ok(After.HardFaultCount >= Before.HardFaultCount,
+       "HardFaultCount went from %lu to %lu\n", Before.HardFaultCount, After.HardFaultCount);
+    ok(After.AccessedPageCount >= Before.AccessedPageCount,
+       "AccessedPageCount went from %lu to %lu\n", Before.AccessedPageCount, After.AccessedPageCount);
+
+    Size = 0;
+    NtFreeVirtualMemory(NtCurrentProcess(), &Buffer, &Size, MEM_RELEASE);
+}
+
 static
 void
 Test_ProcQueryAlignmentProbe(void)
@@ -720,5 +787,6 @@ START_TEST(NtQueryInformationProcess)
     Test_ProcessQuotaLimitsEx();
     Test_ProcessPriorityClassAlignment();
     Test_ProcessWx86Information();
+    Test_ProcessWorkingSetStatistics();
     Test_ProcQueryAlignmentProbe();
 }
@@ -9,6 +9,121 @@
 
 #include <winreg.h>
 
+static volatile LONG StopFlushing;
+
+static
+DWORD
+WINAPI
+FlushThread(
+    _In_ PVOID Parameter)
+{
+    HANDLE KeyHandle = Parameter;
+    NTSTATUS Status;
+
+    while (!StopFlushing)
+    {
+        Status = NtFlushKey(KeyHandle);
+        ok(Status == STATUS_SUCCESS, "NtFlushKey returned %lx\n", Status);
+        Sleep(50);
+    }
+
+    return 0;
+}
+
+static
+VOID
+MeasureSetValueLatency(
+    _In_ HANDLE KeyHandle,
+    _In_ PCSTR Phase,
+    _In_ ULONG Milliseconds)
+{
+    NTSTATUS Status;
+    UNICODE_STRING ValueName;
+    WCHAR NameBuffer[16];
+    UCHAR Data[512];
+    LARGE_INTEGER Frequency, Start, End;
+    ULONGLONG Elapsed, Total = 0, Max = 0;
+    ULONG Count = 0;
+    DWORD StartTime;
+
+    QueryPerformanceFrequency(&Frequency);
+    RtlFillMemory(Data, sizeof(Data), 0x5A);
+
+    StartTime = GetTickCount();
+    while (GetTickCount() - StartTime < Milliseconds)
+    {
+        StringCbPrintfW(NameBuffer, sizeof(NameBuffer), L"Value%lu", Count % 64);
+        RtlInitUnicodeString(&ValueName, NameBuffer);
+        Data[0] = (UCHAR)Count;
+
+        QueryPerformanceCounter(&Start);
+        Status = NtSetValueKey(KeyHandle, &ValueName, 0, REG_BINARY, Data, sizeof(Data));
+        QueryPerformanceCounter(&End);
+        ok(Status == STATUS_SUCCESS, "[%s] NtSetValueKey failed with %lx\n", Phase, Status);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        Elapsed = (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart;
+        Total += Elapsed;
+        if (Elapsed > Max)
+            Max = Elapsed;
+        Count++;
+    }
+
+    ok(Count != 0, "[%s] No values were set\n", Phase);
+    if (Count != 0)
+    {
+        trace("[%s] %lu calls, average %I64u us, max %I64u us\n",
+              Phase, Count, Total / Count, Max);
+    }
+}
+
+/*
+ * Measures the latency of NtSetValueKey on a persistent key, once while
+ * the lazy flusher writes the hive out in the background and once while
+ * another thread keeps flushing the key explicitly.
+ */
+static
+VOID
+TestFlushLatency(
+    _In_ HANDLE ParentKeyHandle)
+{
+    NTSTATUS Status;
+    HANDLE KeyHandle;
+    HANDLE Thread;
+    UNICODE_STRING KeyName = RTL_CONSTANT_STRING(L"SOFTWARE\\ntdll-apitest-NtSetValueKey-Flush");
+    OBJECT_ATTRIBUTES ObjectAttributes;
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &KeyName,
+                               OBJ_CASE_INSENSITIVE,
+                               ParentKeyHandle,
+                               NULL);
+    Status = NtCreateKey(&KeyHandle, KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, 0, NULL);
+    ok(Status == STATUS_SUCCESS, "NtCreateKey returned %lx\n", Status);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* Lazy flushes kick in a few seconds after the hive went dirty */
+    MeasureSetValueLatency(KeyHandle, "lazy", 6000);
+
+    StopFlushing = FALSE;
+    Thread = CreateThread(NULL, 0, FlushThread, KeyHandle, 0, NULL);
+    ok(Thread != NULL, "CreateThread failed with %lu\n", GetLastError());
+    if (Thread)
+    {
+        MeasureSetValueLatency(KeyHandle, "flush", 2000);
+        InterlockedExchange(&StopFlushing, TRUE);
+        WaitForSingleObject(Thread, INFINITE);
+        CloseHandle(Thread);
+    }
+
+    Status = NtDeleteKey(KeyHandle);
+    ok(Status == STATUS_SUCCESS, "NtDeleteKey returned %lx\n", Status);
+    Status = NtClose(KeyHandle);
+    ok(Status == STATUS_SUCCESS, "NtClose returned %lx\n", Status);
+}
+
 START_TEST(NtSetValueKey)
 {
     NTSTATUS Status;
@@ -237,6 +352,9 @@ START_TEST(NtSetValueKey)
 
     RtlFreeHeap(GetProcessHeap(), 0, LargeBuffer);
     RtlFreeHeap(GetProcessHeap(), 0, PartialInfo);
+
+    TestFlushLatency(ParentKeyHandle);
+
     Status = NtDeleteKey(KeyHandle);
     ok(Status == STATUS_SUCCESS, "NtDeleteKey returned %lx\n", Status);
     Status = NtClose(KeyHandle);
@@ -0,0 +1,210 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Loopback round trip latency test
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "ws2_32.h"
+
+#define ROUND_TRIPS     10000
+
+typedef struct _ECHO_CONTEXT
+{
+    SOCKET Socket;
+    BOOL Datagram;
+} ECHO_CONTEXT, *PECHO_CONTEXT;
+
+/* Sends every message straight back until the peer goes away */
+static
+DWORD
+WINAPI
+EchoThread(PVOID Parameter)
+{
+    PECHO_CONTEXT Context = Parameter;
+    SOCKADDR_IN From;
+    int FromLen;
+    ULONG Message;
+    int ret;
+
+    for (;;)
+    {
+        FromLen = sizeof(From);
+        ret = recvfrom(Context->Socket, (char *)&Message, sizeof(Message), 0,
+                       Context->Datagram ? (SOCKADDR *)&From : NULL,
+                       Context->Datagram ? &FromLen : NULL);
+        if (ret != sizeof(Message))
+            break;
+
+        if (Context->Datagram)
+            ret = sendto(Context->Socket, (char *)&Message, sizeof(Message), 0, (SOCKADDR *)&From, FromLen);
+        else
+            ret = send(Context->Socket, (char *)&Message, sizeof(Message), 0);
+        if (ret != sizeof(Message) || Message == ~0UL)
+            break;
+    }
+
+    return 0;
+}
+
+static
+VOID
+PingPong(SOCKET Socket, PCSTR Name)
+{
+    LARGE_INTEGER Frequency, Start, End;
+    ULONG i, Message;
+    int ret;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ROUND_TRIPS; i++)
+    {
+        Message = (i == ROUND_TRIPS - 1) ? ~0UL : i;
+        ret = send(Socket, (char *)&Message, sizeof(Message), 0);
+        ok(ret == sizeof(Message), "[%s %lu] send returned %d, error %d\n", Name, i, ret, WSAGetLastError());
+        if (ret != sizeof(Message))
+            break;
+
+        Message = 0;
+        ret = recv(Socket, (char *)&Message, sizeof(Message), 0);
+        ok(ret == sizeof(Message), "[%s %lu] recv returned %d, error %d\n", Name, i, ret, WSAGetLastError());
+        if (ret != sizeof(Message))
+            break;
+        ok(Message == ((i == ROUND_TRIPS - 1) ? ~0UL : i), "[%s %lu] Got %lu back\n", Name, i, Message);
+    }
+    QueryPerformanceCounter(&End);
+
+    if (i != 0)
+    {
+        trace("%s: %lu round trips, %lu us each\n", Name, i,
+              (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart / i));
+    }
+}
+
+static
+VOID
+TestStream(void)
+{
+    SOCKET Listener, Client, Server;
+    SOCKADDR_IN Address;
+    ECHO_CONTEXT Context;
+    HANDLE Thread;
+    BOOL NoDelay = TRUE;
+    int AddrLen, ret;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Listener != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Listener == INVALID_SOCKET)
+        return;
+
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = 0;
+    AddrLen = sizeof(Address);
+    ret = bind(Listener, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "bind failed with %d\n", WSAGetLastError());
+    ret = getsockname(Listener, (SOCKADDR *)&Address, &AddrLen);
+    ok(ret == 0, "getsockname failed with %d\n", WSAGetLastError());
+    ret = listen(Listener, 1);
+    ok(ret == 0, "listen failed with %d\n", WSAGetLastError());
+
+    Client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Client != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    ret = connect(Client, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "connect failed with %d\n", WSAGetLastError());
+    Server = accept(Listener, NULL, NULL);
+    ok(Server != INVALID_SOCKET, "accept failed with %d\n", WSAGetLastError());
+    if (ret != 0 || Server == INVALID_SOCKET)
+    {
+        skip("No connection to test with\n");
+        goto Cleanup;
+    }
+
+    /* Every message is a single small segment */
+    setsockopt(Client, IPPROTO_TCP, TCP_NODELAY, (char *)&NoDelay, sizeof(NoDelay));
+    setsockopt(Server, IPPROTO_TCP, TCP_NODELAY, (char *)&NoDelay, sizeof(NoDelay));
+
+    Context.Socket = Server;
+    Context.Datagram = FALSE;
+    Thread = CreateThread(NULL, 0, EchoThread, &Context, 0, NULL);
+    ok(Thread != NULL, "CreateThread failed with %lu\n", GetLastError());
+    if (Thread)
+    {
+        PingPong(Client, "TCP");
+        WaitForSingleObject(Thread, INFINITE);
+        CloseHandle(Thread);
+    }
+
+Cleanup:
+    if (Server != INVALID_SOCKET)
+        closesocket(Server);
+    if (Client != INVALID_SOCKET)
+        closesocket(Client);
+    closesocket(Listener);
+}
+
+static
+VOID
+TestDatagram(void)
+{
+    SOCKET Client, Server;
+    SOCKADDR_IN Address;
+    ECHO_CONTEXT Context;
+    HANDLE Thread;
+    int AddrLen, ret;
+
+    Server = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(Server != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    Client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(Client != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Server == INVALID_SOCKET || Client == INVALID_SOCKET)
+        goto Cleanup;
+
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = 0;
+    AddrLen = sizeof(Address);
+    ret = bind(Server, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "bind failed with %d\n", WSAGetLastError());
+    ret = getsockname(Server, (SOCKADDR *)&Address, &AddrLen);
+    ok(ret == 0, "getsockname failed with %d\n", WSAGetLastError());
+    ret = connect(Client, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "connect failed with %d\n", WSAGetLastError());
+    if (ret != 0)
+        goto Cleanup;
+
+    Context.Socket = Server;
+    Context.Datagram = TRUE;
+    Thread = CreateThread(NULL, 0, EchoThread, &Context, 0, NULL);
+    ok(Thread != NULL, "CreateThread failed with %lu\n", GetLastError());
+    if (Thread)
+    {
+        PingPong(Client, "UDP");
+        WaitForSingleObject(Thread, INFINITE);
+        CloseHandle(Thread);
+    }
+
+Cleanup:
+    if (Server != INVALID_SOCKET)
+        closesocket(Server);
+    if (Client != INVALID_SOCKET)
+        closesocket(Client);
+}
+
+START_TEST(pingpong)
+{
+    WSADATA WsaData;
+    int ret;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret != 0)
+    {
+        skip("WSAStartup failed with %d\n", ret);
+        return;
+    }
+
+    TestStream();
+    TestDatagram();
+
+    WSACleanup();
+}
@@ -0,0 +1,317 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for poll sets with many mostly idle connections
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "ws2_32.h"
+#include <winsock/mswinsock.h>
+
+#define CONNECTION_COUNT    1000
+#define ACTIVE_COUNT        10
+#define ROUNDS              200
+
+/* fd_set is only FD_SETSIZE long, select() takes any count */
+typedef struct _BIG_FD_SET
+{
+    u_int fd_count;
+    SOCKET fd_array[CONNECTION_COUNT];
+} BIG_FD_SET;
+
+static SOCKET Clients[CONNECTION_COUNT];
+static SOCKET Servers[CONNECTION_COUNT];
+static BIG_FD_SET AllServers, ReadFds;
+static LPFN_POLLSETCREATE pPollSetCreate;
+static LPFN_POLLSETCONTROL pPollSetControl;
+
+static
+ULONG
+OpenConnections(void)
+{
+    SOCKET Listener;
+    SOCKADDR_IN Address;
+    ULONG i;
+    int AddrLen;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Listener != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Listener == INVALID_SOCKET)
+        return 0;
+
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = 0;
+    AddrLen = sizeof(Address);
+    if (bind(Listener, (SOCKADDR *)&Address, sizeof(Address)) == SOCKET_ERROR ||
+        getsockname(Listener, (SOCKADDR *)&Address, &AddrLen) == SOCKET_ERROR ||
+        listen(Listener, SOMAXCONN) == SOCKET_ERROR)
+    {
+        ok(0, "Could not set up the listener, error %d\n", WSAGetLastError());
+        closesocket(Listener);
+        return 0;
+    }
+
+    for (i = 0; i < CONNECTION_COUNT; i++)
+    {
+        Clients[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (Clients[i] == INVALID_SOCKET)
+            break;
+        if (connect(Clients[i], (SOCKADDR *)&Address, sizeof(Address)) == SOCKET_ERROR)
+        {
+            closesocket(Clients[i]);
+            break;
+        }
+        Servers[i] = accept(Listener, NULL, NULL);
+        if (Servers[i] == INVALID_SOCKET)
+        {
+            closesocket(Clients[i]);
+            break;
+        }
+        AllServers.fd_array[i] = Servers[i];
+    }
+    AllServers.fd_count = i;
+
+    closesocket(Listener);
+    return i;
+}
+
+static
+VOID
+CloseConnections(ULONG Count)
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        closesocket(Clients[i]);
+        closesocket(Servers[i]);
+    }
+}
+
+static
+BOOL
+GetExtensions(SOCKET Socket)
+{
+    GUID PollSetCreateGuid = WSAID_POLLSETCREATE;
+    GUID PollSetControlGuid = WSAID_POLLSETCONTROL;
+    DWORD Bytes;
+
+    if (WSAIoctl(Socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &PollSetCreateGuid, sizeof(PollSetCreateGuid),
+                 &pPollSetCreate, sizeof(pPollSetCreate),
+                 &Bytes, NULL, NULL) == SOCKET_ERROR ||
+        WSAIoctl(Socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &PollSetControlGuid, sizeof(PollSetControlGuid),
+                 &pPollSetControl, sizeof(pPollSetControl),
+                 &Bytes, NULL, NULL) == SOCKET_ERROR)
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestPollSet(ULONG Count)
+{
+    HANDLE Port, PollSet;
+    DWORD Events;
+    ULONG_PTR Key;
+    LPOVERLAPPED Context;
+    CHAR Byte = 'x';
+    BOOL Success;
+    ULONG i;
+    int ret;
+
+    Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    ok(Port != NULL, "CreateIoCompletionPort failed with %lu\n", GetLastError());
+    if (!Port)
+        return;
+
+    PollSet = pPollSetCreate(Port, 0x1234);
+    ok(PollSet != NULL, "PollSetCreate failed with %lu\n", GetLastError());
+    if (!PollSet)
+    {
+        CloseHandle(Port);
+        return;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        ret = pPollSetControl(PollSet, Servers[i], FD_READ | FD_CLOSE, (PVOID)(ULONG_PTR)i);
+        ok(ret == 0, "[%lu] PollSetControl failed with %lu\n", i, GetLastError());
+    }
+
+    /* Nobody has sent anything yet */
+    Success = GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 0);
+    ok(!Success && Context == NULL, "Got a completion for %p\n", Context);
+
+    /* Only the socket that got data shows up */
+    ret = send(Clients[Count / 2], &Byte, 1, 0);
+    ok(ret == 1, "send returned %d, error %d\n", ret, WSAGetLastError());
+    Success = GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 5000);
+    ok(Success, "GetQueuedCompletionStatus failed with %lu\n", GetLastError());
+    ok(Key == 0x1234, "Key = %Ix\n", Key);
+    ok((ULONG_PTR)Context == Count / 2, "Context = %p\n", Context);
+    ok(Events == FD_READ, "Events = %lx\n", Events);
+
+    /* The registration is one-shot until the socket is registered again */
+    ret = send(Clients[Count / 2], &Byte, 1, 0);
+    ok(ret == 1, "send returned %d, error %d\n", ret, WSAGetLastError());
+    Sleep(100);
+    Success = GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 0);
+    ok(!Success && Context == NULL, "Got a completion for %p\n", Context);
+
+    /* Re-arming a socket that is still readable posts right away */
+    ret = pPollSetControl(PollSet, Servers[Count / 2], FD_READ | FD_CLOSE, (PVOID)(ULONG_PTR)(Count / 2));
+    ok(ret == 0, "PollSetControl failed with %lu\n", GetLastError());
+    Success = GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 0);
+    ok(Success && (ULONG_PTR)Context == Count / 2, "Context = %p\n", Context);
+    recv(Servers[Count / 2], &Byte, 1, 0);
+    recv(Servers[Count / 2], &Byte, 1, 0);
+
+    /* A removed socket stays quiet */
+    ret = pPollSetControl(PollSet, Servers[0], 0, NULL);
+    ok(ret == 0, "PollSetControl failed with %lu\n", GetLastError());
+    ret = send(Clients[0], &Byte, 1, 0);
+    ok(ret == 1, "send returned %d, error %d\n", ret, WSAGetLastError());
+    Sleep(100);
+    Success = GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 0);
+    ok(!Success && Context == NULL, "Got a completion for %p\n", Context);
+    recv(Servers[0], &Byte, 1, 0);
+
+    ret = pPollSetControl(PollSet, Servers[0], 0, NULL);
+    ok(ret == SOCKET_ERROR, "PollSetControl returned %d\n", ret);
+
+    CloseHandle(PollSet);
+    CloseHandle(Port);
+}
+
+/* Every round a few clients send one byte, the server waits until it got them all */
+static
+VOID
+BenchmarkSelect(ULONG Count)
+{
+    DWORD Start, Elapsed;
+    ULONG Round, i, Received;
+    CHAR Byte = 'x';
+    int ret;
+
+    Start = GetTickCount();
+    for (Round = 0; Round < ROUNDS; Round++)
+    {
+        for (i = 0; i < ACTIVE_COUNT; i++)
+            send(Clients[(Round * ACTIVE_COUNT + i) % Count], &Byte, 1, 0);
+
+        for (Received = 0; Received < ACTIVE_COUNT; )
+        {
+            RtlCopyMemory(&ReadFds, &AllServers, sizeof(ReadFds));
+            ret = select(0, (fd_set *)&ReadFds, NULL, NULL, NULL);
+            ok(ret > 0, "select returned %d, error %d\n", ret, WSAGetLastError());
+            if (ret <= 0)
+                return;
+
+            for (i = 0; i < ReadFds.fd_count; i++)
+            {
+                if (recv(ReadFds.fd_array[i], &Byte, 1, 0) == 1)
+                    Received++;
+            }
+        }
+    }
+    Elapsed = GetTickCount() - Start;
+
+    trace("select: %lu rounds of %lu active sockets out of %lu took %lu ms\n",
+          ROUNDS, ACTIVE_COUNT, Count, Elapsed);
+}
+
+static
+VOID
+BenchmarkPollSet(ULONG Count)
+{
+    HANDLE Port, PollSet;
+    DWORD Start, Elapsed, Events;
+    ULONG_PTR Key;
+    LPOVERLAPPED Context;
+    ULONG Round, i, Received;
+    CHAR Byte = 'x';
+
+    Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    PollSet = Port ? pPollSetCreate(Port, 0) : NULL;
+    ok(PollSet != NULL, "Could not create a poll set, error %lu\n", GetLastError());
+    if (!PollSet)
+    {
+        if (Port)
+            CloseHandle(Port);
+        return;
+    }
+
+    for (i = 0; i < Count; i++)
+        pPollSetControl(PollSet, Servers[i], FD_READ, (PVOID)(ULONG_PTR)i);
+
+    Start = GetTickCount();
+    for (Round = 0; Round < ROUNDS; Round++)
+    {
+        for (i = 0; i < ACTIVE_COUNT; i++)
+            send(Clients[(Round * ACTIVE_COUNT + i) % Count], &Byte, 1, 0);
+
+        for (Received = 0; Received < ACTIVE_COUNT; Received++)
+        {
+            if (!GetQueuedCompletionStatus(Port, &Events, &Key, &Context, 5000))
+            {
+                ok(0, "GetQueuedCompletionStatus failed with %lu\n", GetLastError());
+                goto Cleanup;
+            }
+
+            i = (ULONG)(ULONG_PTR)Context;
+            recv(Servers[i], &Byte, 1, 0);
+            pPollSetControl(PollSet, Servers[i], FD_READ, Context);
+        }
+    }
+    Elapsed = GetTickCount() - Start;
+
+    trace("poll set: %lu rounds of %lu active sockets out of %lu took %lu ms\n",
+          ROUNDS, ACTIVE_COUNT, Count, Elapsed);
+
+Cleanup:
+    CloseHandle(PollSet);
+    CloseHandle(Port);
+}
+
+START_TEST(pollset)
+{
+    WSADATA WsaData;
+    ULONG Count;
+    int ret;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret != 0)
+    {
+        skip("WSAStartup failed with %d\n", ret);
+        return;
+    }
+
+    Count = OpenConnections();
+    ok(Count == CONNECTION_COUNT, "Only %lu connections could be opened, error %d\n", Count, WSAGetLastError());
+    if (Count < ACTIVE_COUNT)
+    {
+        CloseConnections(Count);
+        WSACleanup();
+        return;
+    }
+
+    if (!GetExtensions(Servers[0]))
+    {
+        skip("Poll sets are not supported\n");
+    }
+    else
+    {
+        TestPollSet(Count);
+        BenchmarkPollSet(Count);
+    }
+    BenchmarkSelect(Count);
+
+    CloseConnections(Count);
+    WSACleanup();
+}
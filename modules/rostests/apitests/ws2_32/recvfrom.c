@@ -0,0 +1,120 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for recvfrom with many bound UDP sockets
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "ws2_32.h"
+
+#define SOCKET_COUNT    512
+#define ROUNDS          16
+
+static SOCKET Sockets[SOCKET_COUNT];
+static SOCKADDR_IN Addresses[SOCKET_COUNT];
+
+/* Each datagram carries the index of the socket it was sent to, so a
+ * datagram delivered to the wrong address file is caught right away */
+static
+BOOL
+ReceiveIndex(SOCKET Socket, ULONG Expected)
+{
+    ULONG Index = ~0UL;
+    SOCKADDR_IN From;
+    fd_set ReadFds;
+    TIMEVAL Timeout = { 5, 0 };
+    int FromLen = sizeof(From);
+    int ret;
+
+    FD_ZERO(&ReadFds);
+    FD_SET(Socket, &ReadFds);
+    ret = select(0, &ReadFds, NULL, NULL, &Timeout);
+    ok(ret == 1, "[%lu] select returned %d, error %d\n", Expected, ret, WSAGetLastError());
+    if (ret != 1)
+        return FALSE;
+
+    ret = recvfrom(Socket, (char *)&Index, sizeof(Index), 0, (SOCKADDR *)&From, &FromLen);
+    ok(ret == sizeof(Index), "[%lu] recvfrom returned %d, error %d\n", Expected, ret, WSAGetLastError());
+    ok(Index == Expected, "[%lu] received datagram for socket %lu\n", Expected, Index);
+    return (ret == sizeof(Index) && Index == Expected);
+}
+
+START_TEST(recvfrom)
+{
+    WSADATA WsaData;
+    SOCKET Sender;
+    ULONG i, Round, Count = 0;
+    DWORD Start, Elapsed;
+    int AddrLen, ret;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret != 0)
+    {
+        skip("WSAStartup failed with %d\n", ret);
+        return;
+    }
+
+    Sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(Sender != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Sender == INVALID_SOCKET)
+    {
+        WSACleanup();
+        return;
+    }
+
+    /* Open plenty of address files so the receive path has to pick ours among them */
+    for (i = 0; i < SOCKET_COUNT; i++)
+    {
+        Sockets[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (Sockets[i] == INVALID_SOCKET)
+            break;
+
+        Addresses[i].sin_family = AF_INET;
+        Addresses[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        Addresses[i].sin_port = 0;
+        AddrLen = sizeof(Addresses[i]);
+        if (bind(Sockets[i], (SOCKADDR *)&Addresses[i], sizeof(Addresses[i])) == SOCKET_ERROR ||
+            getsockname(Sockets[i], (SOCKADDR *)&Addresses[i], &AddrLen) == SOCKET_ERROR)
+        {
+            closesocket(Sockets[i]);
+            break;
+        }
+    }
+    Count = i;
+    ok(Count == SOCKET_COUNT, "Only %lu sockets could be bound, error %d\n", Count, WSAGetLastError());
+
+    /* Every socket gets its own datagram, and only its own */
+    for (i = 0; i < Count; i++)
+    {
+        ret = sendto(Sender, (char *)&i, sizeof(i), 0, (SOCKADDR *)&Addresses[i], sizeof(Addresses[i]));
+        ok(ret == sizeof(i), "[%lu] sendto returned %d, error %d\n", i, ret, WSAGetLastError());
+    }
+    for (i = 0; i < Count; i++)
+    {
+        if (!ReceiveIndex(Sockets[i], i))
+            break;
+    }
+
+    /* Rough per-datagram cost with all of the sockets open */
+    if (Count != 0)
+    {
+        Start = GetTickCount();
+        for (Round = 0; Round < ROUNDS; Round++)
+        {
+            for (i = 0; i < Count; i++)
+                sendto(Sender, (char *)&i, sizeof(i), 0, (SOCKADDR *)&Addresses[i], sizeof(Addresses[i]));
+            for (i = 0; i < Count; i++)
+            {
+                if (!ReceiveIndex(Sockets[i], i))
+                    break;
+            }
+        }
+        Elapsed = GetTickCount() - Start;
+        trace("%lu datagrams across %lu sockets took %lu ms\n", ROUNDS * Count, Count, Elapsed);
+    }
+
+    for (i = 0; i < Count; i++)
+        closesocket(Sockets[i]);
+    closesocket(Sender);
+    WSACleanup();
+}
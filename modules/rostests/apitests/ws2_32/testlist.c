@@ -14,8 +14,12 @@ extern void func_ioctlsocket(void);
 extern void func_nonblocking(void);
 extern void func_nostartup(void);
 extern void func_open_osfhandle(void);
+extern void func_pingpong(void);
+extern void func_pollset(void);
 extern void func_recv(void);
+extern void func_recvfrom(void);
 extern void func_send(void);
+extern void func_throughput(void);
 extern void func_WSAAsync(void);
 extern void func_WSAIoctl(void);
 extern void func_WSARecv(void);
@@ -34,8 +38,12 @@ const struct test winetest_testlist[] =
     { "nonblocking", func_nonblocking },
     { "nostartup", func_nostartup },
     { "open_osfhandle", func_open_osfhandle },
+    { "pingpong", func_pingpong },
+    { "pollset", func_pollset },
     { "recv", func_recv },
+    { "recvfrom", func_recvfrom },
     { "send", func_send },
+    { "throughput", func_throughput },
     { "WSAAsync", func_WSAAsync },
     { "WSAIoctl", func_WSAIoctl },
     { "WSARecv", func_WSARecv },
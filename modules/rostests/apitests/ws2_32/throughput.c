@@ -0,0 +1,332 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Throughput test for large send/recv over one and several streams
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include "ws2_32.h"
+
+#define CHUNK_SIZE      (64 * 1024)
+#define TOTAL_SIZE      (64 * 1024 * 1024)
+#define STREAM_COUNT    4
+#define STREAM_SIZE     (16 * 1024 * 1024)
+#define CHARGEN_PORT    19
+
+typedef struct _SENDER_CONTEXT
+{
+    SOCKET Socket;
+    ULONG Limit;
+    ULONG Sent;
+    FILETIME KernelTime;
+    FILETIME UserTime;
+} SENDER_CONTEXT, *PSENDER_CONTEXT;
+
+static
+ULONGLONG
+FileTimeToULongLong(const FILETIME *Time)
+{
+    return ((ULONGLONG)Time->dwHighDateTime << 32) | Time->dwLowDateTime;
+}
+
+static
+DWORD
+WINAPI
+SenderThread(PVOID Parameter)
+{
+    PSENDER_CONTEXT Context = Parameter;
+    FILETIME CreationTime, ExitTime;
+    PUCHAR Buffer;
+    ULONG i;
+    int ret;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, CHUNK_SIZE);
+    if (!Buffer)
+        return 1;
+
+    while (Context->Sent < Context->Limit)
+    {
+        /* Number the bytes so the receiver can tell if anything got reordered */
+        for (i = 0; i < CHUNK_SIZE; i += sizeof(ULONG))
+            *(PULONG)&Buffer[i] = Context->Sent + i;
+
+        ret = send(Context->Socket, (char *)Buffer, CHUNK_SIZE, 0);
+        if (ret <= 0)
+            break;
+        Context->Sent += ret;
+    }
+
+    GetThreadTimes(GetCurrentThread(), &CreationTime, &ExitTime, &Context->KernelTime, &Context->UserTime);
+    shutdown(Context->Socket, SD_SEND);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    return 0;
+}
+
+typedef struct _RECEIVER_CONTEXT
+{
+    SOCKET Socket;
+    ULONG Limit;
+    ULONG Received;
+    ULONG Mismatches;
+    BOOL Check;
+} RECEIVER_CONTEXT, *PRECEIVER_CONTEXT;
+
+/* Takes in up to Limit bytes, or everything until the sender shuts down */
+static
+DWORD
+WINAPI
+ReceiverThread(PVOID Parameter)
+{
+    PRECEIVER_CONTEXT Context = Parameter;
+    PUCHAR Buffer;
+    ULONG i;
+    int ret;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, CHUNK_SIZE);
+    if (!Buffer)
+        return 1;
+
+    while (Context->Received < Context->Limit)
+    {
+        ret = recv(Context->Socket, (char *)Buffer, CHUNK_SIZE, 0);
+        if (ret <= 0)
+            break;
+
+        for (i = 0; Context->Check && i + sizeof(ULONG) <= (ULONG)ret; i += sizeof(ULONG))
+        {
+            if (*(PULONG)&Buffer[i] != Context->Received + i)
+                Context->Mismatches++;
+        }
+        Context->Received += ret;
+    }
+
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    return 0;
+}
+
+/* Several connections at once, so that the receive path gets to spread them
+ * over the processors. Over loopback both ends are local; when a chargen
+ * server is named in WS2_32_APITEST_CHARGEN (e.g. on the VM host), the data
+ * comes in through the network adapter instead */
+static
+VOID
+TestMultiStream(void)
+{
+    SOCKET Listener = INVALID_SOCKET;
+    SOCKADDR_IN Address;
+    SENDER_CONTEXT Senders[STREAM_COUNT];
+    RECEIVER_CONTEXT Receivers[STREAM_COUNT];
+    HANDLE Threads[2 * STREAM_COUNT];
+    ULONG ThreadCount = 0, Total = 0, i;
+    CHAR Peer[64];
+    BOOL Remote;
+    DWORD Start, Elapsed;
+    int AddrLen, ret;
+
+    Remote = GetEnvironmentVariableA("WS2_32_APITEST_CHARGEN", Peer, sizeof(Peer)) != 0;
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = Remote ? inet_addr(Peer) : htonl(INADDR_LOOPBACK);
+    Address.sin_port = Remote ? htons(CHARGEN_PORT) : 0;
+    if (Address.sin_addr.s_addr == INADDR_NONE)
+    {
+        skip("Invalid chargen server address '%s'\n", Peer);
+        return;
+    }
+
+    if (!Remote)
+    {
+        Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        ok(Listener != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+        if (Listener == INVALID_SOCKET)
+            return;
+
+        AddrLen = sizeof(Address);
+        ret = bind(Listener, (SOCKADDR *)&Address, sizeof(Address));
+        ok(ret == 0, "bind failed with %d\n", WSAGetLastError());
+        ret = getsockname(Listener, (SOCKADDR *)&Address, &AddrLen);
+        ok(ret == 0, "getsockname failed with %d\n", WSAGetLastError());
+        ret = listen(Listener, STREAM_COUNT);
+        ok(ret == 0, "listen failed with %d\n", WSAGetLastError());
+    }
+
+    for (i = 0; i < STREAM_COUNT; i++)
+    {
+        Senders[i].Socket = INVALID_SOCKET;
+        Senders[i].Limit = STREAM_SIZE;
+        Senders[i].Sent = 0;
+        Receivers[i].Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        Receivers[i].Limit = STREAM_SIZE;
+        Receivers[i].Received = 0;
+        Receivers[i].Mismatches = 0;
+        Receivers[i].Check = !Remote;
+        ok(Receivers[i].Socket != INVALID_SOCKET, "[%lu] socket failed with %d\n", i, WSAGetLastError());
+
+        ret = connect(Receivers[i].Socket, (SOCKADDR *)&Address, sizeof(Address));
+        ok(ret == 0, "[%lu] connect failed with %d\n", i, WSAGetLastError());
+        if (ret == 0 && !Remote)
+        {
+            Senders[i].Socket = accept(Listener, NULL, NULL);
+            ok(Senders[i].Socket != INVALID_SOCKET, "[%lu] accept failed with %d\n", i, WSAGetLastError());
+        }
+        if (ret != 0 || (!Remote && Senders[i].Socket == INVALID_SOCKET))
+        {
+            skip("No connection to test with\n");
+            i++;
+            goto Cleanup;
+        }
+    }
+
+    Start = GetTickCount();
+    for (i = 0; i < STREAM_COUNT; i++)
+    {
+        if (!Remote)
+            Threads[ThreadCount++] = CreateThread(NULL, 0, SenderThread, &Senders[i], 0, NULL);
+        Threads[ThreadCount++] = CreateThread(NULL, 0, ReceiverThread, &Receivers[i], 0, NULL);
+        ok(Threads[ThreadCount - 1] != NULL, "CreateThread failed with %lu\n", GetLastError());
+    }
+    for (i = 0; i < ThreadCount; i++)
+    {
+        if (Threads[i])
+        {
+            WaitForSingleObject(Threads[i], INFINITE);
+            CloseHandle(Threads[i]);
+        }
+    }
+    Elapsed = GetTickCount() - Start;
+
+    for (i = 0; i < STREAM_COUNT; i++)
+    {
+        ok(Receivers[i].Received >= STREAM_SIZE, "[%lu] Received %lu bytes\n", i, Receivers[i].Received);
+        ok(Receivers[i].Mismatches == 0, "[%lu] %lu words arrived out of place\n", i, Receivers[i].Mismatches);
+        Total += Receivers[i].Received;
+    }
+    trace("%lu streams from %s: %lu bytes in %lu ms (%lu MB/s)\n",
+          (ULONG)STREAM_COUNT, Remote ? Peer : "loopback", Total, Elapsed,
+          Elapsed ? (ULONG)((ULONGLONG)Total * 1000 / Elapsed / (1024 * 1024)) : 0);
+    i = STREAM_COUNT;
+
+Cleanup:
+    while (i-- > 0)
+    {
+        if (Senders[i].Socket != INVALID_SOCKET)
+            closesocket(Senders[i].Socket);
+        if (Receivers[i].Socket != INVALID_SOCKET)
+            closesocket(Receivers[i].Socket);
+    }
+    if (Listener != INVALID_SOCKET)
+        closesocket(Listener);
+}
+
+static
+VOID
+TestSingleStream(void)
+{
+    SOCKET Listener, Receiver;
+    SOCKADDR_IN Address;
+    SENDER_CONTEXT Context = { INVALID_SOCKET, TOTAL_SIZE };
+    FILETIME CreationTime, ExitTime, KernelTime, UserTime;
+    ULONGLONG CpuTime;
+    HANDLE Thread;
+    PUCHAR Buffer;
+    ULONG Received = 0, Mismatches = 0, i;
+    DWORD Start, Elapsed;
+    int AddrLen, ret;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Listener != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    if (Listener == INVALID_SOCKET)
+        return;
+
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = 0;
+    AddrLen = sizeof(Address);
+    ret = bind(Listener, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "bind failed with %d\n", WSAGetLastError());
+    ret = getsockname(Listener, (SOCKADDR *)&Address, &AddrLen);
+    ok(ret == 0, "getsockname failed with %d\n", WSAGetLastError());
+    ret = listen(Listener, 1);
+    ok(ret == 0, "listen failed with %d\n", WSAGetLastError());
+
+    Context.Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Context.Socket != INVALID_SOCKET, "socket failed with %d\n", WSAGetLastError());
+    ret = connect(Context.Socket, (SOCKADDR *)&Address, sizeof(Address));
+    ok(ret == 0, "connect failed with %d\n", WSAGetLastError());
+    Receiver = accept(Listener, NULL, NULL);
+    ok(Receiver != INVALID_SOCKET, "accept failed with %d\n", WSAGetLastError());
+    Buffer = HeapAlloc(GetProcessHeap(), 0, CHUNK_SIZE);
+    if (ret != 0 || Receiver == INVALID_SOCKET || !Buffer)
+    {
+        skip("No connection to test with\n");
+        goto Cleanup;
+    }
+
+    Start = GetTickCount();
+    Thread = CreateThread(NULL, 0, SenderThread, &Context, 0, NULL);
+    ok(Thread != NULL, "CreateThread failed with %lu\n", GetLastError());
+    if (!Thread)
+        goto Cleanup;
+
+    /* Receive in the same large chunks, checking every byte on the way */
+    for (;;)
+    {
+        ret = recv(Receiver, (char *)Buffer, CHUNK_SIZE, 0);
+        if (ret <= 0)
+            break;
+
+        for (i = 0; i + sizeof(ULONG) <= (ULONG)ret; i += sizeof(ULONG))
+        {
+            if (*(PULONG)&Buffer[i] != Received + i)
+                Mismatches++;
+        }
+        Received += ret;
+    }
+    ok(ret == 0, "recv failed with %d\n", WSAGetLastError());
+    Elapsed = GetTickCount() - Start;
+
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+    GetThreadTimes(GetCurrentThread(), &CreationTime, &ExitTime, &KernelTime, &UserTime);
+
+    ok(Context.Sent == TOTAL_SIZE, "Sent %lu bytes\n", Context.Sent);
+    ok(Received == Context.Sent, "Received %lu of %lu bytes\n", Received, Context.Sent);
+    ok(Mismatches == 0, "%lu words arrived out of place\n", Mismatches);
+
+    /* Both ends' CPU time, in 100ns units, counted against the data moved */
+    CpuTime = FileTimeToULongLong(&KernelTime) + FileTimeToULongLong(&UserTime) +
+              FileTimeToULongLong(&Context.KernelTime) + FileTimeToULongLong(&Context.UserTime);
+    if (Received != 0)
+    {
+        trace("%lu bytes in %lu ms (%lu MB/s), %lu ns CPU per KB\n",
+              Received, Elapsed,
+              Elapsed ? (ULONG)((ULONGLONG)Received * 1000 / Elapsed / (1024 * 1024)) : 0,
+              (ULONG)(CpuTime * 100 * 1024 / Received));
+    }
+
+Cleanup:
+    if (Buffer)
+        HeapFree(GetProcessHeap(), 0, Buffer);
+    if (Receiver != INVALID_SOCKET)
+        closesocket(Receiver);
+    if (Context.Socket != INVALID_SOCKET)
+        closesocket(Context.Socket);
+    closesocket(Listener);
+}
+
+START_TEST(throughput)
+{
+    WSADATA WsaData;
+    int ret;
+
+    ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret != 0)
+    {
+        skip("WSAStartup failed with %d\n", ret);
+        return;
+    }
+
+    TestSingleStream();
+    TestMultiStream();
+
+    WSACleanup();
+}
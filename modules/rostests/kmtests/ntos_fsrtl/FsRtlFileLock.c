@@ -0,0 +1,278 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     LGPL-2.1-or-later (https://spdx.org/licenses/LGPL-2.1-or-later)
+ * PURPOSE:     Kernel-Mode Test Suite FsRtl byte-range lock test
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+static
+BOOLEAN
+LockRange(
+    _In_ PFILE_LOCK FileLock,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG Offset,
+    _In_ LONGLONG Length,
+    _In_ ULONG Key,
+    _In_ BOOLEAN Exclusive,
+    _Out_ PNTSTATUS Status)
+{
+    LARGE_INTEGER FileOffset, LockLength;
+    IO_STATUS_BLOCK IoStatus;
+    BOOLEAN Result;
+
+    FileOffset.QuadPart = Offset;
+    LockLength.QuadPart = Length;
+    IoStatus.Status = STATUS_UNSUCCESSFUL;
+    Result = FsRtlFastLock(FileLock,
+                           FileObject,
+                           &FileOffset,
+                           &LockLength,
+                           PsGetCurrentProcess(),
+                           Key,
+                           TRUE,
+                           Exclusive,
+                           &IoStatus,
+                           NULL,
+                           FALSE);
+    *Status = IoStatus.Status;
+    return Result;
+}
+
+static
+NTSTATUS
+UnlockRange(
+    _In_ PFILE_LOCK FileLock,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG Offset,
+    _In_ LONGLONG Length,
+    _In_ ULONG Key)
+{
+    LARGE_INTEGER FileOffset, LockLength;
+
+    FileOffset.QuadPart = Offset;
+    LockLength.QuadPart = Length;
+    return FsRtlFastUnlockSingle(FileLock,
+                                 FileObject,
+                                 &FileOffset,
+                                 &LockLength,
+                                 PsGetCurrentProcess(),
+                                 Key,
+                                 NULL,
+                                 FALSE);
+}
+
+static
+BOOLEAN
+CheckRange(
+    _In_ PFILE_LOCK FileLock,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG Offset,
+    _In_ LONGLONG Length,
+    _In_ ULONG Key,
+    _In_ BOOLEAN Write)
+{
+    LARGE_INTEGER FileOffset, LockLength;
+
+    FileOffset.QuadPart = Offset;
+    LockLength.QuadPart = Length;
+    if (Write)
+        return FsRtlFastCheckLockForWrite(FileLock, &FileOffset, &LockLength, Key, FileObject, PsGetCurrentProcess());
+    return FsRtlFastCheckLockForRead(FileLock, &FileOffset, &LockLength, Key, FileObject, PsGetCurrentProcess());
+}
+
+static
+ULONG
+CountLocks(
+    _In_ PFILE_LOCK FileLock)
+{
+    PFILE_LOCK_INFO LockInfo;
+    ULONG Count = 0;
+
+    for (LockInfo = FsRtlGetNextFileLock(FileLock, TRUE);
+         LockInfo != NULL;
+         LockInfo = FsRtlGetNextFileLock(FileLock, FALSE))
+    {
+        Count++;
+    }
+
+    return Count;
+}
+
+static VOID FsRtlFileLockTestBasic(PFILE_OBJECT FileObject)
+{
+    FILE_LOCK FileLock;
+    NTSTATUS Status;
+    BOOLEAN Result;
+
+    FsRtlInitializeFileLock(&FileLock, NULL, NULL);
+
+    Result = LockRange(&FileLock, FileObject, 0, 10, 1, TRUE, &Status);
+    ok(Result == TRUE, "Exclusive lock failed\n");
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    Result = LockRange(&FileLock, FileObject, 5, 10, 2, TRUE, &Status);
+    ok(Result == FALSE, "Overlapping exclusive lock succeeded\n");
+    ok_eq_hex(Status, STATUS_FILE_LOCK_CONFLICT);
+
+    Result = LockRange(&FileLock, FileObject, 5, 10, 2, FALSE, &Status);
+    ok(Result == FALSE, "Shared lock overlapping an exclusive one succeeded\n");
+    ok_eq_hex(Status, STATUS_FILE_LOCK_CONFLICT);
+
+    ok_bool_true(CheckRange(&FileLock, FileObject, 0, 10, 1, FALSE), "Owner read:");
+    ok_bool_true(CheckRange(&FileLock, FileObject, 0, 10, 1, TRUE), "Owner write:");
+    ok_bool_false(CheckRange(&FileLock, FileObject, 9, 1, 2, FALSE), "Other read:");
+    ok_bool_false(CheckRange(&FileLock, FileObject, 9, 1, 2, TRUE), "Other write:");
+    ok_bool_true(CheckRange(&FileLock, FileObject, 10, 10, 2, TRUE), "Write after lock:");
+
+    /* A shared lock next to an exclusive one: an access spanning both must see the exclusive one */
+    Result = LockRange(&FileLock, FileObject, 100, 100, 1, FALSE, &Status);
+    ok(Result == TRUE, "Shared lock failed\n");
+    Result = LockRange(&FileLock, FileObject, 200, 100, 1, TRUE, &Status);
+    ok(Result == TRUE, "Exclusive lock failed\n");
+    ok_bool_true(CheckRange(&FileLock, FileObject, 150, 20, 2, FALSE), "Read shared range:");
+    ok_bool_false(CheckRange(&FileLock, FileObject, 150, 100, 2, FALSE), "Read across exclusive range:");
+    ok_bool_false(CheckRange(&FileLock, FileObject, 50, 200, 2, FALSE), "Read covering both ranges:");
+
+    /* Overlapping shared locks are merged, and split again on unlock */
+    Result = LockRange(&FileLock, FileObject, 1000, 100, 1, FALSE, &Status);
+    ok(Result == TRUE, "Shared lock failed\n");
+    Result = LockRange(&FileLock, FileObject, 1050, 150, 2, FALSE, &Status);
+    ok(Result == TRUE, "Overlapping shared lock failed\n");
+    Result = LockRange(&FileLock, FileObject, 1100, 1, 3, TRUE, &Status);
+    ok(Result == FALSE, "Exclusive lock over shared locks succeeded\n");
+    ok_eq_hex(UnlockRange(&FileLock, FileObject, 1000, 100, 2), STATUS_RANGE_NOT_LOCKED);
+    ok_eq_hex(UnlockRange(&FileLock, FileObject, 1000, 100, 1), STATUS_SUCCESS);
+    Result = LockRange(&FileLock, FileObject, 1000, 50, 3, TRUE, &Status);
+    ok(Result == TRUE, "Exclusive lock on unlocked range failed\n");
+    Result = LockRange(&FileLock, FileObject, 1100, 1, 3, TRUE, &Status);
+    ok(Result == FALSE, "Exclusive lock over shared lock succeeded\n");
+
+    ok_eq_ulong(CountLocks(&FileLock), 5UL);
+
+    ok_eq_hex(UnlockRange(&FileLock, FileObject, 0, 10, 2), STATUS_RANGE_NOT_LOCKED);
+    ok_eq_hex(UnlockRange(&FileLock, FileObject, 0, 10, 1), STATUS_SUCCESS);
+    ok_eq_hex(UnlockRange(&FileLock, FileObject, 0, 10, 1), STATUS_RANGE_NOT_LOCKED);
+    ok_bool_true(CheckRange(&FileLock, FileObject, 9, 1, 2, TRUE), "Write after unlock:");
+
+    ok_eq_hex(FsRtlFastUnlockAll(&FileLock, FileObject, PsGetCurrentProcess(), NULL), STATUS_SUCCESS);
+    ok_eq_ulong(CountLocks(&FileLock), 0UL);
+
+    FsRtlUninitializeFileLock(&FileLock);
+}
+
+static VOID FsRtlFileLockTestMany(PFILE_OBJECT FileObject)
+{
+    FILE_LOCK FileLock;
+    NTSTATUS Status;
+    ULONG i, Failures;
+    LARGE_INTEGER Start, End, Frequency;
+    const ULONG LockCount = 8192;
+    const ULONG SharedCount = 1024;
+
+    FsRtlInitializeFileLock(&FileLock, NULL, NULL);
+
+    /* One exclusive lock per record, with a gap between each of them */
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < LockCount; i++)
+    {
+        if (!LockRange(&FileLock, FileObject, i * 32ULL, 16, i, TRUE, &Status))
+            Failures++;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu locks failed\n", Failures);
+    trace("Took %lu locks in %I64d us\n", LockCount, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 0; i < LockCount; i++)
+    {
+        if (!CheckRange(&FileLock, FileObject, i * 32ULL, 16, i, TRUE) ||
+            CheckRange(&FileLock, FileObject, i * 32ULL + 8, 16, i + 1, FALSE) ||
+            !CheckRange(&FileLock, FileObject, i * 32ULL + 16, 16, i + 1, TRUE))
+        {
+            Failures++;
+        }
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu checks failed\n", Failures);
+    trace("Did %lu checks in %I64d us\n", LockCount * 3, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    ok_eq_ulong(CountLocks(&FileLock), LockCount);
+
+    /* Shared locks filling the gaps */
+    Failures = 0;
+    for (i = 0; i < LockCount - 1; i++)
+    {
+        if (!LockRange(&FileLock, FileObject, i * 32ULL + 16, 16, i, FALSE, &Status))
+            Failures++;
+    }
+    ok(Failures == 0, "%lu shared locks failed\n", Failures);
+
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 0; i < LockCount; i++)
+    {
+        if (UnlockRange(&FileLock, FileObject, i * 32ULL, 16, i) != STATUS_SUCCESS)
+            Failures++;
+    }
+    for (i = 0; i < LockCount - 1; i++)
+    {
+        if (UnlockRange(&FileLock, FileObject, i * 32ULL + 16, 16, i) != STATUS_SUCCESS)
+            Failures++;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu unlocks failed\n", Failures);
+    trace("Released %lu locks in %I64d us\n", LockCount * 2 - 1, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    ok_eq_ulong(CountLocks(&FileLock), 0UL);
+
+    /* Overlapping shared locks all merge into a single range */
+    Failures = 0;
+    for (i = 0; i < SharedCount; i++)
+    {
+        if (!LockRange(&FileLock, FileObject, i * 8ULL, 16, i, FALSE, &Status))
+            Failures++;
+    }
+    ok(Failures == 0, "%lu shared locks failed\n", Failures);
+    ok_eq_ulong(CountLocks(&FileLock), 1UL);
+    ok_bool_true(CheckRange(&FileLock, FileObject, 0, SharedCount * 8ULL, SharedCount, FALSE), "Read shared range:");
+    ok_bool_false(CheckRange(&FileLock, FileObject, 0, SharedCount * 8ULL, SharedCount, TRUE), "Write shared range:");
+
+    /* Releasing every other one leaves them disjoint */
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 1; i < SharedCount; i += 2)
+    {
+        if (UnlockRange(&FileLock, FileObject, i * 8ULL, 16, i) != STATUS_SUCCESS)
+            Failures++;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu unlocks failed\n", Failures);
+    trace("Released %lu shared locks in %I64d us\n", SharedCount / 2, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+    ok_eq_ulong(CountLocks(&FileLock), SharedCount / 2);
+
+    ok_eq_hex(FsRtlFastUnlockAll(&FileLock, FileObject, PsGetCurrentProcess(), NULL), STATUS_SUCCESS);
+    ok_eq_ulong(CountLocks(&FileLock), 0UL);
+
+    FsRtlUninitializeFileLock(&FileLock);
+}
+
+START_TEST(FsRtlFileLock)
+{
+    PFILE_OBJECT FileObject;
+
+    FileObject = ExAllocatePoolZero(NonPagedPool, sizeof(*FileObject), 'LFmK');
+    if (skip(FileObject != NULL, "Out of memory\n"))
+        return;
+
+    FsRtlFileLockTestBasic(FileObject);
+    FsRtlFileLockTestMany(FileObject);
+
+    ExFreePoolWithTag(FileObject, 'LFmK');
+}
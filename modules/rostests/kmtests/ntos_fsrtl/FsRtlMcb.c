@@ -2474,6 +2474,82 @@ end_test:
     FsRtlUninitializeLargeMcb(&Mcb);
 }
 
+static VOID FsRtlLargeMcbTestFragmented(VOID)
+{
+    LARGE_MCB Mcb;
+    ULONG i, NbRuns, Index, Failures;
+    LONGLONG Vbn, Lbn, SectorCount;
+    LARGE_INTEGER Start, End, Frequency;
+    const ULONG RunCount = 16384;
+
+    /* Simulate a heavily fragmented file: one cluster per run, a hole between each */
+    FsRtlInitializeLargeMcb(&Mcb, PagedPool);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < RunCount; i++)
+    {
+        if (!FsRtlAddLargeMcbEntry(&Mcb, i * 2, i * 3 + 1, 1))
+            break;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(i == RunCount, "Failed to add run %lu\n", i);
+    trace("Added %lu runs in %I64d us\n", RunCount, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    NbRuns = FsRtlNumberOfRunsInLargeMcb(&Mcb);
+    ok(NbRuns == RunCount * 2 - 1, "Expected %lu runs, got: %lu\n", RunCount * 2 - 1, NbRuns);
+
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 0; i < RunCount; i++)
+    {
+        if (!FsRtlLookupLargeMcbEntry(&Mcb, i * 2, &Lbn, &SectorCount, NULL, NULL, &Index) ||
+            Lbn != i * 3 + 1 || SectorCount != 1 || Index != i * 2)
+        {
+            Failures++;
+        }
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu lookups failed\n", Failures);
+    trace("Looked up %lu runs in %I64d us\n", RunCount, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    Failures = 0;
+    Start = KeQueryPerformanceCounter(NULL);
+    for (i = 0; i < RunCount; i++)
+    {
+        if (!FsRtlGetNextLargeMcbEntry(&Mcb, i * 2, &Vbn, &Lbn, &SectorCount) ||
+            Vbn != i * 2 || Lbn != i * 3 + 1 || SectorCount != 1)
+        {
+            Failures++;
+        }
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Failures == 0, "%lu enumerations failed\n", Failures);
+    trace("Enumerated %lu runs in %I64d us\n", RunCount, (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+    /* Fill the holes, everything must merge back into a single run */
+    for (i = 0; i < RunCount - 1; i++)
+    {
+        FsRtlRemoveLargeMcbEntry(&Mcb, i * 2, 1);
+        ok(FsRtlAddLargeMcbEntry(&Mcb, i * 2, i * 2 + 1, 2) == TRUE, "expected TRUE, got FALSE\n");
+    }
+    FsRtlRemoveLargeMcbEntry(&Mcb, (RunCount - 1) * 2, 1);
+    ok(FsRtlAddLargeMcbEntry(&Mcb, (RunCount - 1) * 2, (RunCount - 1) * 2 + 1, 1) == TRUE, "expected TRUE, got FALSE\n");
+
+    NbRuns = FsRtlNumberOfRunsInLargeMcb(&Mcb);
+    ok(NbRuns == 1, "Expected 1 run, got: %lu\n", NbRuns);
+    ok(FsRtlLookupLastLargeMcbEntryAndIndex(&Mcb, &Vbn, &Lbn, &Index) == TRUE, "expected TRUE, got FALSE\n");
+    ok(Vbn == RunCount * 2 - 2, "Expected Vbn %lu, got: %I64d\n", RunCount * 2 - 2, Vbn);
+    ok(Lbn == RunCount * 2 - 1, "Expected Lbn %lu, got: %I64d\n", RunCount * 2 - 1, Lbn);
+    ok(Index == 0, "Expected Index 0, got: %lu\n", Index);
+
+    /* Splitting without inserting anything must not leave the run cut in two */
+    ok(FsRtlSplitLargeMcb(&Mcb, RunCount, 0) == TRUE, "expected TRUE, got FALSE\n");
+    NbRuns = FsRtlNumberOfRunsInLargeMcb(&Mcb);
+    ok(NbRuns == 1, "Expected 1 run, got: %lu\n", NbRuns);
+
+    FsRtlUninitializeLargeMcb(&Mcb);
+}
+
 START_TEST(FsRtlMcb)
 {
     FsRtlMcbTest();
@@ -2482,4 +2558,5 @@ START_TEST(FsRtlMcb)
     FsRtlLargeMcbTestsFastFat();
     FsRtlLargeMcbTestsFastFat_2();
     FsRtlLargeMcbTestsFastFat_3();
+    FsRtlLargeMcbTestFragmented();
 }
@@ -47,12 +47,177 @@ TestTimerFunctional(
     CheckTimer(Timer, TimerNotificationObject + Type, 0L, FALSE, OriginalIrql, (PVOID *)NULL, 0);
 }
 
+#define TIMER_COUNT 32
+
+static
+BOOLEAN
+(NTAPI
+*pKeSetCoalescableTimer)(
+    IN OUT PKTIMER Timer,
+    IN LARGE_INTEGER DueTime,
+    IN ULONG Period,
+    IN ULONG TolerableDelay,
+    IN PKDPC Dpc OPTIONAL);
+
+typedef struct _TIMER_CONTEXT
+{
+    KTIMER Timer;
+    KDPC Dpc;
+    ULONGLONG DueTime;
+    ULONGLONG FiredTime;
+    PKEVENT DoneEvent;
+    volatile LONG *Remaining;
+} TIMER_CONTEXT, *PTIMER_CONTEXT;
+
+static KDEFERRED_ROUTINE TimerDpcRoutine;
+
+static
+VOID
+NTAPI
+TimerDpcRoutine(
+    IN PKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2)
+{
+    PTIMER_CONTEXT Context = DeferredContext;
+
+    Context->FiredTime = KeQueryInterruptTime();
+    if (InterlockedDecrement(Context->Remaining) == 0)
+        KeSetEvent(Context->DoneEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static
+VOID
+TestTimerExpirations(
+    IN PTIMER_CONTEXT Contexts,
+    IN ULONG TolerableDelay)
+{
+    KEVENT DoneEvent;
+    volatile LONG Remaining = TIMER_COUNT;
+    LARGE_INTEGER DueTime, Timeout;
+    ULONGLONG Tick, Latency, Expirations[TIMER_COUNT];
+    ULONG Histogram[5] = { 0 };
+    ULONG i, j, Distinct = 0;
+    NTSTATUS Status;
+
+    Tick = KeQueryTimeIncrement();
+    KeInitializeEvent(&DoneEvent, NotificationEvent, FALSE);
+
+    for (i = 0; i < TIMER_COUNT; i++)
+    {
+        KeInitializeTimerEx(&Contexts[i].Timer, NotificationTimer);
+        KeInitializeDpc(&Contexts[i].Dpc, TimerDpcRoutine, &Contexts[i]);
+        Contexts[i].DoneEvent = &DoneEvent;
+        Contexts[i].Remaining = &Remaining;
+        Contexts[i].FiredTime = 0;
+    }
+
+    /* Spread the due times over 20 to 330ms from now */
+    for (i = 0; i < TIMER_COUNT; i++)
+    {
+        DueTime.QuadPart = -(LONGLONG)(20 + i * 10) * 10 * 1000;
+        Contexts[i].DueTime = KeQueryInterruptTime() - DueTime.QuadPart;
+        if (TolerableDelay)
+            pKeSetCoalescableTimer(&Contexts[i].Timer, DueTime, 0, TolerableDelay, &Contexts[i].Dpc);
+        else
+            KeSetTimer(&Contexts[i].Timer, DueTime, &Contexts[i].Dpc);
+    }
+
+    Timeout.QuadPart = -10 * 1000 * 1000 * 10LL;
+    Status = KeWaitForSingleObject(&DoneEvent, Executive, KernelMode, FALSE, &Timeout);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (Status != STATUS_SUCCESS)
+    {
+        for (i = 0; i < TIMER_COUNT; i++)
+            KeCancelTimer(&Contexts[i].Timer);
+        KeFlushQueuedDpcs();
+        return;
+    }
+
+    for (i = 0; i < TIMER_COUNT; i++)
+    {
+        /* Timers may expire up to one clock tick early, never beyond the tolerance */
+        ok(Contexts[i].FiredTime + Tick >= Contexts[i].DueTime,
+           "Timer %lu fired %I64u before its due time\n", i, Contexts[i].DueTime - Contexts[i].FiredTime);
+        Latency = Contexts[i].FiredTime > Contexts[i].DueTime ?
+                  Contexts[i].FiredTime - Contexts[i].DueTime : 0;
+        ok(Latency <= (TolerableDelay + 500) * 10ULL * 1000,
+           "Timer %lu fired %I64u late\n", i, Latency);
+
+        /* Latency distribution: <1ms, <10ms, <50ms, <250ms, more */
+        if (Latency < 10 * 1000) Histogram[0]++;
+        else if (Latency < 100 * 1000) Histogram[1]++;
+        else if (Latency < 500 * 1000) Histogram[2]++;
+        else if (Latency < 2500 * 1000) Histogram[3]++;
+        else Histogram[4]++;
+
+        /* Count the distinct expiration ticks */
+        for (j = 0; j < Distinct; j++)
+        {
+            if (Expirations[j] / Tick == Contexts[i].FiredTime / Tick)
+                break;
+        }
+        if (j == Distinct)
+            Expirations[Distinct++] = Contexts[i].FiredTime;
+    }
+
+    trace("Tolerable delay %lums: %lu timers expired in %lu ticks, latency <1ms %lu, <10ms %lu, <50ms %lu, <250ms %lu, more %lu\n",
+          TolerableDelay, TIMER_COUNT, Distinct,
+          Histogram[0], Histogram[1], Histogram[2], Histogram[3], Histogram[4]);
+    if (TolerableDelay >= 250)
+        ok(Distinct < TIMER_COUNT, "Coalescable timers expired in %lu distinct ticks\n", Distinct);
+}
+
+static
+VOID
+TestIdleWakeups(VOID)
+{
+    SYSTEM_INTERRUPT_INFORMATION Before[MAXIMUM_PROCESSORS], After[MAXIMUM_PROCESSORS];
+    LARGE_INTEGER Start, End, Interval;
+    ULONG Elapsed, Size, Dpcs = 0, Switches = 0;
+    ULONG i, Count = 0;
+    KAFFINITY Affinity;
+    NTSTATUS Status;
+
+    for (Affinity = KeQueryActiveProcessors(); Affinity; Affinity >>= 1)
+        Count += Affinity & 1;
+    Size = Count * sizeof(SYSTEM_INTERRUPT_INFORMATION);
+    Status = ZwQuerySystemInformation(SystemInterruptInformation, Before, Size, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    KeQueryTickCount(&Start);
+    Interval.QuadPart = -2 * 1000 * 1000 * 10LL;
+    KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+    KeQueryTickCount(&End);
+
+    Status = ZwQuerySystemInformation(SystemInterruptInformation, After, Size, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    for (i = 0; i < Count; i++)
+    {
+        Dpcs += After[i].DpcCount - Before[i].DpcCount;
+        Switches += After[i].ContextSwitches - Before[i].ContextSwitches;
+    }
+
+    Elapsed = (ULONG)((End.QuadPart - Start.QuadPart) * KeQueryTimeIncrement() / (10 * 1000));
+    if (Elapsed == 0) Elapsed = 1;
+    trace("Idle for %lums on %lu processors: %lu DPCs/sec, %lu context switches/sec\n",
+          Elapsed, Count, Dpcs * 1000 / Elapsed, Switches * 1000 / Elapsed);
+}
+
 START_TEST(KeTimer)
 {
     KTIMER Timer;
     KIRQL Irql;
     KIRQL Irqls[] = { PASSIVE_LEVEL, APC_LEVEL, DISPATCH_LEVEL, HIGH_LEVEL };
     INT i;
+    PTIMER_CONTEXT Contexts;
+    UNICODE_STRING KeSetCoalescableTimerName = RTL_CONSTANT_STRING(L"KeSetCoalescableTimer");
 
     for (i = 0; i < sizeof Irqls / sizeof Irqls[0]; ++i)
     {
@@ -67,4 +232,21 @@ START_TEST(KeTimer)
 
     ok_irql(PASSIVE_LEVEL);
     KmtSetIrql(PASSIVE_LEVEL);
+
+    Contexts = ExAllocatePoolWithTag(NonPagedPool, TIMER_COUNT * sizeof(*Contexts), 'TmeK');
+    if (skip(Contexts != NULL, "Out of memory\n"))
+        return;
+
+    TestTimerExpirations(Contexts, 0);
+
+    pKeSetCoalescableTimer = MmGetSystemRoutineAddress(&KeSetCoalescableTimerName);
+    if (!skip(pKeSetCoalescableTimer != NULL, "KeSetCoalescableTimer unavailable\n"))
+    {
+        TestTimerExpirations(Contexts, 50);
+        TestTimerExpirations(Contexts, 250);
+    }
+
+    ExFreePoolWithTag(Contexts, 'TmeK');
+
+    TestIdleWakeups();
 }
@@ -0,0 +1,30 @@
+/*
+ * PROJECT:     ReactOS lwIP unit tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     lwIP port for the user mode unit tests
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LWIP_ERRNO_STDINCLUDE
+
+/* Endianness */
+#define BYTE_ORDER LITTLE_ENDIAN
+
+/* Compiler hints for packing structures */
+#define PACK_STRUCT_STRUCT
+#define PACK_STRUCT_USE_INCLUDES
+
+/* A broken assumption inside lwIP fails the running test */
+void _ck_assert_failed(const char *file, int line, const char *expr, ...);
+
+#define LWIP_PLATFORM_DIAG(x) do { printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x) _ck_assert_failed(__FILE__, __LINE__, x, NULL)
+
+/* lwip_unittests.c has it */
+unsigned int lwip_port_rand(void);
+#define LWIP_RAND() ((u32_t)lwip_port_rand())
@@ -0,0 +1,219 @@
+/*
+ * PROJECT:     ReactOS lwIP unit tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The part of the Check unit test framework the lwIP tests use
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include <apitest.h>
+/* Check has its own */
+#undef START_TEST
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+
+#define MAX_TESTS 64
+
+struct TCase
+{
+    const char *name;
+    SFun setup;
+    SFun teardown;
+    const TTest *tests[MAX_TESTS];
+    int count;
+    TCase *next;
+};
+
+struct Suite
+{
+    const char *name;
+    TCase *tcases;
+    Suite *next;
+};
+
+struct SRunner
+{
+    Suite *suites;
+    int failed;
+};
+
+/* Where a failed assertion leaves the running test */
+static jmp_buf ck_test_env;
+static int ck_test_running;
+static int ck_test_failed;
+
+Suite *
+suite_create(const char *name)
+{
+    Suite *s = calloc(1, sizeof(*s));
+
+    if (!s)
+        abort();
+    s->name = name;
+    return s;
+}
+
+void
+suite_add_tcase(Suite *s, TCase *tc)
+{
+    TCase **last;
+
+    for (last = &s->tcases; *last; last = &(*last)->next);
+    *last = tc;
+}
+
+TCase *
+tcase_create(const char *name)
+{
+    TCase *tc = calloc(1, sizeof(*tc));
+
+    if (!tc)
+        abort();
+    tc->name = name;
+    return tc;
+}
+
+void
+tcase_add_checked_fixture(TCase *tc, SFun setup, SFun teardown)
+{
+    tc->setup = setup;
+    tc->teardown = teardown;
+}
+
+void
+_tcase_add_test(TCase *tc, const TTest *ttest, int _signal, int allowed_exit_value, int start, int end)
+{
+    if (tc->count == MAX_TESTS)
+    {
+        ok(0, "Too many tests in %s\n", tc->name);
+        return;
+    }
+    tc->tests[tc->count++] = ttest;
+}
+
+SRunner *
+srunner_create(Suite *s)
+{
+    SRunner *sr = calloc(1, sizeof(*sr));
+
+    if (!sr)
+        abort();
+    sr->suites = s;
+    return sr;
+}
+
+void
+srunner_add_suite(SRunner *sr, Suite *s)
+{
+    Suite **last;
+
+    for (last = &sr->suites; *last; last = &(*last)->next);
+    *last = s;
+}
+
+void
+srunner_set_xml(SRunner *sr, const char *fname)
+{
+    /* The results go to the test log */
+}
+
+void
+srunner_set_fork_status(SRunner *sr, enum fork_status fstat)
+{
+    /* Everything runs in this process */
+}
+
+static
+void
+ck_run_test(TCase *tc, const TTest *ttest)
+{
+    ck_test_failed = 0;
+    ck_test_running = 1;
+
+    if (!setjmp(ck_test_env))
+    {
+        if (tc->setup)
+            tc->setup();
+        ttest->fn(0);
+    }
+
+    /* Like checked fixtures, the teardown runs after failures as well */
+    if (tc->teardown && !setjmp(ck_test_env))
+        tc->teardown();
+
+    ck_test_running = 0;
+}
+
+void
+srunner_run_all(SRunner *sr, enum print_output print_mode)
+{
+    Suite *s;
+    TCase *tc;
+    int i;
+
+    for (s = sr->suites; s; s = s->next)
+    {
+        for (tc = s->tcases; tc; tc = tc->next)
+        {
+            for (i = 0; i < tc->count; i++)
+            {
+                if (print_mode >= CK_NORMAL)
+                    trace("%s: %s\n", s->name, tc->tests[i]->name);
+
+                ck_run_test(tc, tc->tests[i]);
+                if (ck_test_failed)
+                    sr->failed++;
+            }
+        }
+    }
+}
+
+int
+srunner_ntests_failed(SRunner *sr)
+{
+    return sr->failed;
+}
+
+void
+srunner_free(SRunner *sr)
+{
+    Suite *s, *nexts;
+    TCase *tc, *nexttc;
+
+    for (s = sr->suites; s; s = nexts)
+    {
+        for (tc = s->tcases; tc; tc = nexttc)
+        {
+            nexttc = tc->next;
+            free(tc);
+        }
+        nexts = s->next;
+        free(s);
+    }
+    free(sr);
+}
+
+void
+_ck_assert_failed(const char *file, int line, const char *expr, ...)
+{
+    char message[512];
+    const char *format;
+    va_list args;
+
+    va_start(args, expr);
+    format = va_arg(args, const char *);
+    if (format)
+        vsnprintf(message, sizeof(message), format, args);
+    else
+        snprintf(message, sizeof(message), "%s", expr);
+    va_end(args);
+
+    ok_(file, line)(0, "%s\n", message);
+
+    ck_test_failed = 1;
+    if (ck_test_running)
+        longjmp(ck_test_env, 1);
+}
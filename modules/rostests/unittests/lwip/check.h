@@ -0,0 +1,87 @@
+/*
+ * PROJECT:     ReactOS lwIP unit tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The part of the Check unit test framework the lwIP tests use
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* The lwIP tests are written for Check. This runs them in-process on top of
+ * the Wine test framework instead: every failed assertion is reported with
+ * ok() and ends its test, like Check does in CK_NOFORK mode */
+
+#define CHECK_MAJOR_VERSION 0
+#define CHECK_MINOR_VERSION 15
+#define CHECK_MICRO_VERSION 2
+
+typedef void (*TFun)(int _i);
+typedef void (*SFun)(void);
+
+typedef struct TTest
+{
+    const char *name;
+    TFun fn;
+    const char *file;
+    int line;
+} TTest;
+
+typedef struct Suite Suite;
+typedef struct TCase TCase;
+typedef struct SRunner SRunner;
+
+enum print_output
+{
+    CK_SILENT,
+    CK_MINIMAL,
+    CK_NORMAL,
+    CK_VERBOSE,
+    CK_ENV
+};
+
+enum fork_status
+{
+    CK_FORK_GETENV,
+    CK_FORK,
+    CK_NOFORK
+};
+
+#define START_TEST(__testname) \
+    static void __testname##_fn(int _i); \
+    static const TTest __testname##_ttest = { #__testname, __testname##_fn, __FILE__, __LINE__ }; \
+    static const TTest *__testname = &__testname##_ttest; \
+    static void __testname##_fn(int _i)
+
+#define END_TEST
+
+Suite *suite_create(const char *name);
+void suite_add_tcase(Suite *s, TCase *tc);
+
+TCase *tcase_create(const char *name);
+void tcase_add_checked_fixture(TCase *tc, SFun setup, SFun teardown);
+void _tcase_add_test(TCase *tc, const TTest *ttest, int _signal, int allowed_exit_value, int start, int end);
+#define tcase_add_test(tc, tf) _tcase_add_test((tc), (tf), 0, 0, 0, 1)
+
+SRunner *srunner_create(Suite *s);
+void srunner_add_suite(SRunner *sr, Suite *s);
+void srunner_set_xml(SRunner *sr, const char *fname);
+void srunner_set_fork_status(SRunner *sr, enum fork_status fstat);
+void srunner_run_all(SRunner *sr, enum print_output print_mode);
+int srunner_ntests_failed(SRunner *sr);
+void srunner_free(SRunner *sr);
+
+/* The optional message is a format string and its arguments */
+void _ck_assert_failed(const char *file, int line, const char *expr, ...);
+
+#define fail_unless(expr, ...) \
+    ((expr) ? (void)0 : _ck_assert_failed(__FILE__, __LINE__, "Assertion '" #expr "' failed", ## __VA_ARGS__, NULL))
+#define fail_if(expr, ...) \
+    (!(expr) ? (void)0 : _ck_assert_failed(__FILE__, __LINE__, "Failure '" #expr "' occurred", ## __VA_ARGS__, NULL))
+#define fail(...) \
+    _ck_assert_failed(__FILE__, __LINE__, "Failed", ## __VA_ARGS__, NULL)
+#define ck_assert(expr) fail_unless(expr)
+#define ck_assert_msg(expr, ...) fail_unless(expr, ## __VA_ARGS__)
+#define ck_abort() fail()
+#define ck_abort_msg(...) fail(__VA_ARGS__)
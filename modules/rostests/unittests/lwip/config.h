@@ -0,0 +1,8 @@
+/*
+ * PROJECT:     ReactOS lwIP unit tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Stands in for the config.h of Check's autotools build
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#pragma once
@@ -0,0 +1,17 @@
+/*
+ * PROJECT:     ReactOS lwIP unit tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Runs the lwIP TCP tests with the tcpip driver settings
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#include <apitest.h>
+
+/* lwip_unittests.c, built with LWIP_UNITTESTS_LIB */
+int lwip_unittests_run(void);
+
+START_TEST(tcp)
+{
+    /* Each failed check has been reported already */
+    lwip_unittests_run();
+}
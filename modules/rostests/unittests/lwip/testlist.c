@@ -0,0 +1,10 @@
+#define STANDALONE
+#include <apitest.h>
+
+extern void func_tcp(void);
+
+const struct test winetest_testlist[] =
+{
+    { "tcp", func_tcp },
+    { 0, 0 }
+};
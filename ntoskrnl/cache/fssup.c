@@ -17,7 +17,6 @@
 
 /* GLOBALS ********************************************************************/
 
-PFSN_PREFETCHER_GLOBALS CcPfGlobals;
 extern LONG CcOutstandingDeletes;
 extern KEVENT CcpLazyWriteEvent;
 extern KEVENT CcFinalizeEvent;
@@ -108,24 +107,6 @@ CcInitializeCacheManager(VOID)
     return TRUE;
 }
 
-CODE_SEG("INIT")
-VOID
-NTAPI
-CcPfInitializePrefetcher(VOID)
-{
-    /* Notify debugger */
-    DbgPrintEx(DPFLTR_PREFETCHER_ID,
-               DPFLTR_TRACE_LEVEL,
-               "CCPF: InitializePrefetecher()\n");
-
-    /* Setup the Prefetcher Data */
-    InitializeListHead(&CcPfGlobals.ActiveTraces);
-    InitializeListHead(&CcPfGlobals.CompletedTraces);
-    ExInitializeFastMutex(&CcPfGlobals.CompletedTracesLock);
-
-    /* FIXME: Setup the rest of the prefetecher */
-}
-
 BOOLEAN
 NTAPI
 CcpAcquireFileLock(PNOCC_CACHE_MAP Map)
@@ -38,11 +38,6 @@ typedef struct _NOCC_CACHE_MAP
     ULONG ReadAheadGranularity;
 } NOCC_CACHE_MAP, *PNOCC_CACHE_MAP;
 
-CODE_SEG("INIT")
-VOID
-NTAPI
-CcPfInitializePrefetcher(VOID);
-
 VOID
 NTAPI
 CcMdlReadComplete2(IN PFILE_OBJECT FileObject,
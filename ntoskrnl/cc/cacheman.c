@@ -14,32 +14,12 @@
 #define NDEBUG
 #include <debug.h>
 
-BOOLEAN CcPfEnablePrefetcher;
-PFSN_PREFETCHER_GLOBALS CcPfGlobals;
 MM_SYSTEMSIZE CcCapturedSystemSize;
 
 static ULONG BugCheckFileId = 0x4 << 16;
 
 /* FUNCTIONS *****************************************************************/
 
-CODE_SEG("INIT")
-VOID
-NTAPI
-CcPfInitializePrefetcher(VOID)
-{
-    /* Notify debugger */
-    DbgPrintEx(DPFLTR_PREFETCHER_ID,
-               DPFLTR_TRACE_LEVEL,
-               "CCPF: InitializePrefetecher()\n");
-
-    /* Setup the Prefetcher Data */
-    InitializeListHead(&CcPfGlobals.ActiveTraces);
-    InitializeListHead(&CcPfGlobals.CompletedTraces);
-    ExInitializeFastMutex(&CcPfGlobals.CompletedTracesLock);
-
-    /* FIXME: Setup the rest of the prefetecher */
-}
-
 CODE_SEG("INIT")
 BOOLEAN
 CcInitializeCacheManager(VOID)
@@ -227,7 +227,7 @@ VOID CcScheduleLazyWriteScan(
     /* Finally, already running, so queue for the next second */
     else
     {
-        KeSetTimer(&LazyWriter.ScanTimer, CcIdleDelay, &LazyWriter.ScanDpc);
+        KeSetCoalescableTimer(&LazyWriter.ScanTimer, CcIdleDelay, 0, 1000, &LazyWriter.ScanDpc);
     }
 }
 
@@ -0,0 +1,1098 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Logical prefetcher for boot and application launch
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+/*
+ * While a scenario (the boot, or the first seconds of a process) runs, every
+ * page fault on a file is logged to its trace. When the trace ends the pages
+ * are sorted, merged into runs and saved to \SystemRoot\Prefetch. The next
+ * time the scenario begins, those runs are read into the sections of their
+ * files before anyone faults on them.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+BOOLEAN CcPfEnablePrefetcher;
+ULONG CcPfEnablePrefetcherMode = PF_ENABLE_APPLICATION_LAUNCH | PF_ENABLE_BOOT;
+PFSN_PREFETCHER_GLOBALS CcPfGlobals;
+
+static WORK_QUEUE_ITEM CcPfBootPrefetchWorkItem;
+
+static UNICODE_STRING CcPfPrefetchDirectory = RTL_CONSTANT_STRING(L"\\SystemRoot\\Prefetch");
+
+/* How long faults are logged once the scenario began, in 100ns units */
+#define PF_BOOT_TRACE_PERIOD            (120LL * 10 * 1000 * 1000)
+#define PF_APP_LAUNCH_TRACE_PERIOD      (10LL * 10 * 1000 * 1000)
+
+#define PF_BOOT_MAX_FAULTS              32768
+#define PF_BOOT_MAX_FILES               1024
+#define PF_APP_LAUNCH_MAX_FAULTS        8192
+#define PF_APP_LAUNCH_MAX_FILES         256
+
+/* Faults are logged at DISPATCH_LEVEL into nonpaged buffers of that many
+ * entries, a new one is only added once the last one is full */
+#define PF_LOG_ENTRIES_PER_BUFFER       512
+
+/* Every traced launch holds nonpaged memory until its trace ends */
+#define PF_MAX_ACTIVE_APP_LAUNCHES      8
+
+/* Holes of up to that many pages between two faults are read with them */
+#define PF_MAX_RUN_GAP                  4
+
+#define PF_MAX_SCENARIO_SIZE            (2 * 1024 * 1024)
+#define PF_MAX_SCENARIO_PAGES           (PF_BOOT_MAX_FAULTS * (PF_MAX_RUN_GAP + 1))
+#define PF_MAX_PAGE                     ((1UL << 30) - 1)
+
+/* FUNCTIONS *****************************************************************/
+
+static
+VOID
+PfpBuildScenarioPath(
+    _In_ PPF_SCENARIO_ID ScenarioId,
+    _Out_writes_(BufferLength) PWCHAR Buffer,
+    _In_ SIZE_T BufferLength,
+    _Out_ PUNICODE_STRING Path)
+{
+    RtlStringCchPrintfW(Buffer,
+                        BufferLength,
+                        L"%wZ\\%ls-%08lX.pf",
+                        &CcPfPrefetchDirectory,
+                        ScenarioId->ScenName,
+                        ScenarioId->HashId);
+    RtlInitUnicodeString(Path, Buffer);
+}
+
+static
+BOOLEAN
+PfpVerifyScenario(
+    _In_ PPF_SCENARIO_HEADER Scenario,
+    _In_ ULONG Size,
+    _In_ PPF_SCENARIO_ID ScenarioId,
+    _In_ PF_SCENARIO_TYPE ScenarioType)
+{
+    PPF_FILE_INFO FileInfo;
+    PPF_RUN_INFO RunInfo;
+    ULONG NumPages = 0;
+    ULONG i;
+
+    if (Scenario->Version != PF_SCENARIO_VERSION ||
+        Scenario->MagicNumber != PF_SCENARIO_MAGIC ||
+        Scenario->Size != Size ||
+        Scenario->ScenarioType != ScenarioType ||
+        Scenario->ScenarioId.HashId != ScenarioId->HashId ||
+        _wcsnicmp(Scenario->ScenarioId.ScenName, ScenarioId->ScenName, RTL_NUMBER_OF(ScenarioId->ScenName)))
+    {
+        return FALSE;
+    }
+
+    /* The tables must be within the file, counts are checked against the size first */
+    if (Scenario->NumFiles > Size / sizeof(PF_FILE_INFO) ||
+        Scenario->NumRuns > Size / sizeof(PF_RUN_INFO) ||
+        (Scenario->FileInfoOffset % sizeof(ULONG)) != 0 ||
+        (Scenario->RunInfoOffset % sizeof(ULONG)) != 0 ||
+        (ULONGLONG)Scenario->FileInfoOffset + Scenario->NumFiles * sizeof(PF_FILE_INFO) > Size ||
+        (ULONGLONG)Scenario->RunInfoOffset + Scenario->NumRuns * sizeof(PF_RUN_INFO) > Size)
+    {
+        return FALSE;
+    }
+
+    FileInfo = (PPF_FILE_INFO)((PUCHAR)Scenario + Scenario->FileInfoOffset);
+    for (i = 0; i < Scenario->NumFiles; i++)
+    {
+        if (FileInfo[i].NameLength == 0 ||
+            (FileInfo[i].NameOffset % sizeof(WCHAR)) != 0 ||
+            (FileInfo[i].NameLength % sizeof(WCHAR)) != 0 ||
+            (ULONGLONG)FileInfo[i].NameOffset + FileInfo[i].NameLength + sizeof(WCHAR) > Size)
+        {
+            return FALSE;
+        }
+    }
+
+    /* Runs are grouped by file, so each file is opened once */
+    RunInfo = (PPF_RUN_INFO)((PUCHAR)Scenario + Scenario->RunInfoOffset);
+    for (i = 0; i < Scenario->NumRuns; i++)
+    {
+        if (RunInfo[i].FileIndex >= Scenario->NumFiles ||
+            RunInfo[i].NumPages == 0 ||
+            RunInfo[i].StartPage > PF_MAX_PAGE ||
+            RunInfo[i].NumPages > PF_MAX_SCENARIO_PAGES - NumPages ||
+            RunInfo[i].NumPages > PF_MAX_PAGE - RunInfo[i].StartPage + 1 ||
+            (i > 0 && RunInfo[i].FileIndex < RunInfo[i - 1].FileIndex))
+        {
+            return FALSE;
+        }
+
+        NumPages += RunInfo[i].NumPages;
+    }
+
+    return TRUE;
+}
+
+static
+NTSTATUS
+PfpReadScenario(
+    _In_ PPF_SCENARIO_ID ScenarioId,
+    _In_ PF_SCENARIO_TYPE ScenarioType,
+    _Out_ PPF_SCENARIO_HEADER *Scenario)
+{
+    WCHAR PathBuffer[MAX_PATH];
+    UNICODE_STRING Path;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    FILE_STANDARD_INFORMATION StandardInfo;
+    PPF_SCENARIO_HEADER Buffer;
+    HANDLE FileHandle;
+    NTSTATUS Status;
+    ULONG Size;
+
+    PfpBuildScenarioPath(ScenarioId, PathBuffer, RTL_NUMBER_OF(PathBuffer), &Path);
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &Path,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+
+    Status = ZwOpenFile(&FileHandle,
+                        GENERIC_READ | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = ZwQueryInformationFile(FileHandle,
+                                    &IoStatusBlock,
+                                    &StandardInfo,
+                                    sizeof(StandardInfo),
+                                    FileStandardInformation);
+    if (!NT_SUCCESS(Status))
+        goto Quit;
+
+    if (StandardInfo.EndOfFile.QuadPart < sizeof(PF_SCENARIO_HEADER) ||
+        StandardInfo.EndOfFile.QuadPart > PF_MAX_SCENARIO_SIZE)
+    {
+        Status = STATUS_INVALID_IMAGE_FORMAT;
+        goto Quit;
+    }
+    Size = StandardInfo.EndOfFile.LowPart;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, Size, TAG_PREFETCH);
+    if (!Buffer)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+
+    Status = ZwReadFile(FileHandle, NULL, NULL, NULL, &IoStatusBlock, Buffer, Size, NULL, NULL);
+    if (NT_SUCCESS(Status) &&
+        (IoStatusBlock.Information != Size || !PfpVerifyScenario(Buffer, Size, ScenarioId, ScenarioType)))
+    {
+        DPRINT1("Ignoring bad scenario file %wZ\n", &Path);
+        Status = STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Buffer, TAG_PREFETCH);
+        goto Quit;
+    }
+
+    *Scenario = Buffer;
+
+Quit:
+    ZwClose(FileHandle);
+    return Status;
+}
+
+/* Returns a referenced section of the file, its segments are where the pages go */
+static
+NTSTATUS
+PfpCreatePrefetchSection(
+    _In_ HANDLE FileHandle,
+    _In_ BOOLEAN IsImage,
+    _Out_ PVOID *Section)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    HANDLE SectionHandle;
+    NTSTATUS Status;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    Status = ZwCreateSection(&SectionHandle,
+                             SECTION_MAP_READ | SECTION_QUERY | (IsImage ? SECTION_MAP_EXECUTE : 0),
+                             &ObjectAttributes,
+                             NULL,
+                             IsImage ? PAGE_EXECUTE : PAGE_READONLY,
+                             IsImage ? SEC_IMAGE : SEC_COMMIT,
+                             FileHandle);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = ObReferenceObjectByHandle(SectionHandle,
+                                       SECTION_QUERY,
+                                       MmSectionObjectType,
+                                       KernelMode,
+                                       Section,
+                                       NULL);
+    ZwClose(SectionHandle);
+    return Status;
+}
+
+/*
+ * An open section of a file keeps it from being written to or deleted, so
+ * the boot trace, which runs for minutes, lets go of its sections as soon as
+ * the pages are read: they stay only for the files that are in use by then.
+ * A launch trace is short, and the process it waits for maps its files a
+ * moment later, so it keeps them until it ends.
+ */
+static
+NTSTATUS
+PfpPrefetchRuns(
+    _In_ PPFSN_TRACE_HEADER Trace,
+    _In_ HANDLE FileHandle,
+    _In_ PFILE_OBJECT FileObject,
+    _In_reads_(NumRuns) PPF_RUN_INFO RunInfo,
+    _In_ ULONG NumRuns,
+    _In_ BOOLEAN IsImage)
+{
+    PREAD_LIST ReadList;
+    PVOID Section;
+    ULONG NumPages = 0;
+    ULONG i, j;
+    NTSTATUS Status;
+
+    for (i = 0; i < NumRuns; i++)
+    {
+        if (RunInfo[i].IsImage == IsImage)
+            NumPages += RunInfo[i].NumPages;
+    }
+
+    if (NumPages == 0)
+        return STATUS_SUCCESS;
+
+    if (Trace->Process && Trace->NumPrefetchSections == Trace->MaxPrefetchSections)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ReadList = ExAllocatePoolWithTag(PagedPool,
+                                     FIELD_OFFSET(READ_LIST, List[NumPages]),
+                                     TAG_PREFETCH);
+    if (!ReadList)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = PfpCreatePrefetchSection(FileHandle, IsImage, &Section);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(ReadList, TAG_PREFETCH);
+        return Status;
+    }
+
+    ReadList->FileObject = FileObject;
+    ReadList->NumberOfEntries = 0;
+    ReadList->IsImage = IsImage;
+
+    for (i = 0; i < NumRuns; i++)
+    {
+        if (RunInfo[i].IsImage != IsImage)
+            continue;
+
+        for (j = 0; j < RunInfo[i].NumPages; j++)
+        {
+            ReadList->List[ReadList->NumberOfEntries++].Alignment =
+                (ULONGLONG)(RunInfo[i].StartPage + j) << PAGE_SHIFT;
+        }
+    }
+
+    Status = MmPrefetchPages(1, &ReadList);
+
+    if (Trace->Process)
+        Trace->PrefetchSections[Trace->NumPrefetchSections++] = Section;
+    else
+        ObDereferenceObject(Section);
+
+    ExFreePoolWithTag(ReadList, TAG_PREFETCH);
+    return Status;
+}
+
+static
+VOID
+PfpPrefetchFiles(
+    _In_ PPFSN_TRACE_HEADER Trace,
+    _In_ PPF_SCENARIO_HEADER Scenario)
+{
+    PPF_FILE_INFO FileInfo = (PPF_FILE_INFO)((PUCHAR)Scenario + Scenario->FileInfoOffset);
+    PPF_RUN_INFO RunInfo = (PPF_RUN_INFO)((PUCHAR)Scenario + Scenario->RunInfoOffset);
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UNICODE_STRING FileName;
+    PFILE_OBJECT FileObject;
+    HANDLE FileHandle;
+    ULONG First, Last, Index;
+    BOOLEAN HasImage, HasData;
+    NTSTATUS Status;
+
+    for (First = 0; First < Scenario->NumRuns; First = Last)
+    {
+        Index = RunInfo[First].FileIndex;
+        HasImage = HasData = FALSE;
+        for (Last = First; Last < Scenario->NumRuns && RunInfo[Last].FileIndex == Index; Last++)
+        {
+            if (RunInfo[Last].IsImage)
+                HasImage = TRUE;
+            else
+                HasData = TRUE;
+        }
+
+        FileName.Buffer = (PWCH)((PUCHAR)Scenario + FileInfo[Index].NameOffset);
+        FileName.Length = FileName.MaximumLength = FileInfo[Index].NameLength;
+        InitializeObjectAttributes(&ObjectAttributes,
+                                   &FileName,
+                                   OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                   NULL,
+                                   NULL);
+
+        Status = ZwOpenFile(&FileHandle,
+                            FILE_READ_DATA | FILE_EXECUTE | SYNCHRONIZE,
+                            &ObjectAttributes,
+                            &IoStatusBlock,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT("Cannot open %wZ for prefetching: 0x%lx\n", &FileName, Status);
+            continue;
+        }
+
+        Status = ObReferenceObjectByHandle(FileHandle,
+                                           0,
+                                           IoFileObjectType,
+                                           KernelMode,
+                                           (PVOID*)&FileObject,
+                                           NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            ZwClose(FileHandle);
+            continue;
+        }
+
+        if (HasImage)
+            Status = PfpPrefetchRuns(Trace, FileHandle, FileObject, &RunInfo[First], Last - First, TRUE);
+
+        if (HasData && Status != STATUS_INSUFFICIENT_RESOURCES)
+            Status = PfpPrefetchRuns(Trace, FileHandle, FileObject, &RunInfo[First], Last - First, FALSE);
+
+        ObDereferenceObject(FileObject);
+        ZwClose(FileHandle);
+
+        /* Memory got short, what is left would only push out what was read */
+        if (Status == STATUS_INSUFFICIENT_RESOURCES)
+            break;
+    }
+}
+
+static
+VOID
+PfpPrefetchScenario(
+    _In_ PPFSN_TRACE_HEADER Trace)
+{
+    PPF_SCENARIO_HEADER Scenario;
+    NTSTATUS Status;
+
+    Status = PfpReadScenario(&Trace->ScenarioId, Trace->ScenarioType, &Scenario);
+    if (NT_SUCCESS(Status))
+    {
+        DPRINT("Prefetching %lu pages of %ls\n", Scenario->NumPages, Trace->ScenarioId.ScenName);
+
+        InterlockedIncrement(&CcPfGlobals.ActivePrefetches);
+        PfpPrefetchFiles(Trace, Scenario);
+        InterlockedDecrement(&CcPfGlobals.ActivePrefetches);
+
+        ExFreePoolWithTag(Scenario, TAG_PREFETCH);
+    }
+
+    KeSetEvent(&Trace->PrefetchDoneEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static
+VOID
+NTAPI
+PfpBootPrefetchWorker(
+    _In_ PVOID Parameter)
+{
+    PfpPrefetchScenario(Parameter);
+}
+
+static
+int
+__cdecl
+PfpCompareLogEntries(const void * x,
+                     const void * y)
+{
+    const PF_LOG_ENTRY *Entry1 = (const PF_LOG_ENTRY *)x;
+    const PF_LOG_ENTRY *Entry2 = (const PF_LOG_ENTRY *)y;
+
+    if (Entry1->FileKey != Entry2->FileKey)
+        return Entry1->FileKey > Entry2->FileKey ? 1 : -1;
+    if (Entry1->Type != Entry2->Type)
+        return Entry1->Type > Entry2->Type ? 1 : -1;
+    if (Entry1->FileOffset != Entry2->FileOffset)
+        return Entry1->FileOffset > Entry2->FileOffset ? 1 : -1;
+    return 0;
+}
+
+static
+NTSTATUS
+PfpSaveScenarioFile(
+    _In_ PPF_SCENARIO_ID ScenarioId,
+    _In_ PPF_SCENARIO_HEADER Scenario)
+{
+    WCHAR PathBuffer[MAX_PATH];
+    UNICODE_STRING Path;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    HANDLE Handle;
+    NTSTATUS Status;
+
+    /* The directory is created the first time anything is saved */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &CcPfPrefetchDirectory,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN_IF,
+                          FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status))
+        return Status;
+    ZwClose(Handle);
+
+    PfpBuildScenarioPath(ScenarioId, PathBuffer, RTL_NUMBER_OF(PathBuffer), &Path);
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &Path,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          GENERIC_WRITE | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          0,
+                          FILE_OVERWRITE_IF,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = ZwWriteFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Scenario, Scenario->Size, NULL, NULL);
+
+    ZwClose(Handle);
+    return Status;
+}
+
+/* Turns the log of a finished trace into runs and saves them for the next time */
+static
+NTSTATUS
+PfpWriteScenario(
+    _In_ PPFSN_TRACE_HEADER Trace)
+{
+    PPFSN_LOG_ENTRIES Log;
+    PLIST_ENTRY ListEntry;
+    PPF_LOG_ENTRY Entries;
+    POBJECT_NAME_INFORMATION *Names;
+    PPF_SCENARIO_HEADER Scenario = NULL;
+    PPF_FILE_INFO FileInfo;
+    PPF_RUN_INFO Runs, RunInfo;
+    PUSHORT FileIndex;
+    ULONG NumEntries = 0, NumRuns = 0, NumFiles = 0, NumPages = 0;
+    ULONG NamesSize = 0, Size, NameOffset;
+    ULONG ReturnLength, i;
+    NTSTATUS Status;
+
+    for (ListEntry = Trace->TraceBuffersList.Flink;
+         ListEntry != &Trace->TraceBuffersList;
+         ListEntry = ListEntry->Flink)
+    {
+        Log = CONTAINING_RECORD(ListEntry, PFSN_LOG_ENTRIES, TraceBuffersLink);
+        NumEntries += Log->NumEntries;
+    }
+
+    if (NumEntries == 0)
+        return STATUS_SUCCESS;
+
+    Entries = ExAllocatePoolWithTag(PagedPool, NumEntries * sizeof(*Entries), TAG_PREFETCH);
+    Names = ExAllocatePoolZero(PagedPool, Trace->NumFiles * sizeof(*Names), TAG_PREFETCH);
+    FileIndex = ExAllocatePoolWithTag(PagedPool, Trace->NumFiles * sizeof(*FileIndex), TAG_PREFETCH);
+    Runs = ExAllocatePoolWithTag(PagedPool, NumEntries * sizeof(*Runs), TAG_PREFETCH);
+    if (!Entries || !Names || !FileIndex || !Runs)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+
+    /* Nothing is logged anymore, gather the buffers in one piece for sorting */
+    NumEntries = 0;
+    for (ListEntry = Trace->TraceBuffersList.Flink;
+         ListEntry != &Trace->TraceBuffersList;
+         ListEntry = ListEntry->Flink)
+    {
+        Log = CONTAINING_RECORD(ListEntry, PFSN_LOG_ENTRIES, TraceBuffersLink);
+        RtlCopyMemory(&Entries[NumEntries], Log->Entries, Log->NumEntries * sizeof(*Entries));
+        NumEntries += Log->NumEntries;
+    }
+
+    /* The next boot opens the files by name */
+    for (i = 0; i < Trace->NumFiles; i++)
+    {
+        Status = ObQueryNameString(Trace->Files[i], NULL, 0, &ReturnLength);
+        if (Status != STATUS_INFO_LENGTH_MISMATCH)
+            continue;
+
+        Names[i] = ExAllocatePoolWithTag(PagedPool, ReturnLength, TAG_PREFETCH);
+        if (!Names[i])
+            continue;
+
+        Status = ObQueryNameString(Trace->Files[i], Names[i], ReturnLength, &ReturnLength);
+        if (!NT_SUCCESS(Status) || Names[i]->Name.Length == 0)
+        {
+            ExFreePoolWithTag(Names[i], TAG_PREFETCH);
+            Names[i] = NULL;
+        }
+    }
+
+    qsort(Entries, NumEntries, sizeof(Entries[0]), PfpCompareLogEntries);
+
+    /* Sorted by file and page, neighbours and duplicates fold into runs */
+    RtlFillMemory(FileIndex, Trace->NumFiles * sizeof(*FileIndex), 0xFF);
+    for (i = 0; i < NumEntries; i++)
+    {
+        PPF_LOG_ENTRY Entry = &Entries[i];
+
+        if (!Names[Entry->FileKey])
+            continue;
+
+        if (FileIndex[Entry->FileKey] == MAXUSHORT)
+            FileIndex[Entry->FileKey] = (USHORT)NumFiles++;
+
+        if (NumRuns > 0)
+        {
+            RunInfo = &Runs[NumRuns - 1];
+            if (RunInfo->FileIndex == FileIndex[Entry->FileKey] &&
+                RunInfo->IsImage == Entry->Type &&
+                Entry->FileOffset <= RunInfo->StartPage + RunInfo->NumPages + PF_MAX_RUN_GAP)
+            {
+                if (Entry->FileOffset >= RunInfo->StartPage + RunInfo->NumPages)
+                {
+                    NumPages += Entry->FileOffset + 1 - (RunInfo->StartPage + RunInfo->NumPages);
+                    RunInfo->NumPages = Entry->FileOffset + 1 - RunInfo->StartPage;
+                }
+                continue;
+            }
+        }
+
+        RunInfo = &Runs[NumRuns++];
+        RunInfo->FileIndex = FileIndex[Entry->FileKey];
+        RunInfo->IsImage = (USHORT)Entry->Type;
+        RunInfo->StartPage = Entry->FileOffset;
+        RunInfo->NumPages = 1;
+        NumPages++;
+    }
+
+    if (NumRuns == 0)
+    {
+        Status = STATUS_SUCCESS;
+        goto Quit;
+    }
+
+    for (i = 0; i < Trace->NumFiles; i++)
+    {
+        if (FileIndex[i] != MAXUSHORT)
+            NamesSize += Names[i]->Name.Length + sizeof(UNICODE_NULL);
+    }
+
+    Size = sizeof(PF_SCENARIO_HEADER) + NumFiles * sizeof(PF_FILE_INFO) + NumRuns * sizeof(PF_RUN_INFO) + NamesSize;
+    if (Size > PF_MAX_SCENARIO_SIZE)
+    {
+        Status = STATUS_BUFFER_OVERFLOW;
+        goto Quit;
+    }
+
+    Scenario = ExAllocatePoolZero(PagedPool, Size, TAG_PREFETCH);
+    if (!Scenario)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+
+    Scenario->Version = PF_SCENARIO_VERSION;
+    Scenario->MagicNumber = PF_SCENARIO_MAGIC;
+    Scenario->Size = Size;
+    Scenario->ScenarioId = Trace->ScenarioId;
+    Scenario->ScenarioType = Trace->ScenarioType;
+    Scenario->FileInfoOffset = sizeof(PF_SCENARIO_HEADER);
+    Scenario->NumFiles = NumFiles;
+    Scenario->RunInfoOffset = Scenario->FileInfoOffset + NumFiles * sizeof(PF_FILE_INFO);
+    Scenario->NumRuns = NumRuns;
+    Scenario->NumPages = NumPages;
+
+    RtlCopyMemory((PUCHAR)Scenario + Scenario->RunInfoOffset, Runs, NumRuns * sizeof(PF_RUN_INFO));
+
+    FileInfo = (PPF_FILE_INFO)((PUCHAR)Scenario + Scenario->FileInfoOffset);
+    NameOffset = Scenario->RunInfoOffset + NumRuns * sizeof(PF_RUN_INFO);
+    for (i = 0; i < Trace->NumFiles; i++)
+    {
+        if (FileIndex[i] == MAXUSHORT)
+            continue;
+
+        FileInfo[FileIndex[i]].NameOffset = NameOffset;
+        FileInfo[FileIndex[i]].NameLength = Names[i]->Name.Length;
+        RtlCopyMemory((PUCHAR)Scenario + NameOffset, Names[i]->Name.Buffer, Names[i]->Name.Length);
+        NameOffset += Names[i]->Name.Length + sizeof(UNICODE_NULL);
+    }
+
+    Status = PfpSaveScenarioFile(&Trace->ScenarioId, Scenario);
+
+    DPRINT("Scenario %ls: %ld faults, %lu files, %lu runs, %lu pages, status 0x%lx\n",
+           Trace->ScenarioId.ScenName, Trace->NumFaults, NumFiles, NumRuns, NumPages, Status);
+
+Quit:
+    if (Scenario)
+        ExFreePoolWithTag(Scenario, TAG_PREFETCH);
+    if (Names)
+    {
+        for (i = 0; i < Trace->NumFiles; i++)
+        {
+            if (Names[i])
+                ExFreePoolWithTag(Names[i], TAG_PREFETCH);
+        }
+        ExFreePoolWithTag(Names, TAG_PREFETCH);
+    }
+    if (FileIndex)
+        ExFreePoolWithTag(FileIndex, TAG_PREFETCH);
+    if (Runs)
+        ExFreePoolWithTag(Runs, TAG_PREFETCH);
+    if (Entries)
+        ExFreePoolWithTag(Entries, TAG_PREFETCH);
+    return Status;
+}
+
+static
+VOID
+PfpFreeTrace(
+    _In_ PPFSN_TRACE_HEADER Trace)
+{
+    PPFSN_LOG_ENTRIES Log;
+    ULONG i;
+
+    for (i = 0; i < Trace->NumFiles; i++)
+        ObDereferenceObject(Trace->Files[i]);
+
+    for (i = 0; i < Trace->NumPrefetchSections; i++)
+        ObDereferenceObject(Trace->PrefetchSections[i]);
+
+    if (Trace->Process)
+        ObDereferenceObject(Trace->Process);
+
+    if (Trace->PrefetchSections)
+        ExFreePoolWithTag(Trace->PrefetchSections, TAG_PREFETCH);
+    if (Trace->Files)
+        ExFreePoolWithTag(Trace->Files, TAG_PREFETCH);
+    while (!IsListEmpty(&Trace->TraceBuffersList))
+    {
+        Log = CONTAINING_RECORD(RemoveHeadList(&Trace->TraceBuffersList), PFSN_LOG_ENTRIES, TraceBuffersLink);
+        ExFreePoolWithTag(Log, TAG_PREFETCH);
+    }
+    ExFreePoolWithTag(Trace, TAG_PREFETCH);
+}
+
+static
+VOID
+NTAPI
+PfpEndTraceWorker(
+    _In_ PVOID Parameter)
+{
+    PPFSN_TRACE_HEADER Trace = Parameter;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    /* Nothing gets logged to it anymore */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    RemoveEntryList(&Trace->ActiveTracesLink);
+    if (CcPfGlobals.SystemWideTrace == Trace)
+        CcPfGlobals.SystemWideTrace = NULL;
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+
+    /* The timer may have fired while the process was going away */
+    KeCancelTimer(&Trace->TraceTimer);
+    KeFlushQueuedDpcs();
+
+    /* The prefetch may still be using the trace */
+    KeWaitForSingleObject(&Trace->PrefetchDoneEvent, Executive, KernelMode, FALSE, NULL);
+
+    Status = PfpWriteScenario(Trace);
+    if (!NT_SUCCESS(Status))
+        DPRINT1("Failed to save scenario %ls: 0x%lx\n", Trace->ScenarioId.ScenName, Status);
+
+    PfpFreeTrace(Trace);
+}
+
+static
+VOID
+PfpQueueEndTrace(
+    _In_ PPFSN_TRACE_HEADER Trace)
+{
+    if (InterlockedExchange(&Trace->EndTraceCalled, 1) == 0)
+        ExQueueWorkItem(&Trace->EndTraceWorkItem, DelayedWorkQueue);
+}
+
+static
+VOID
+NTAPI
+PfpTraceTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    PfpQueueEndTrace(DeferredContext);
+}
+
+static
+PPFSN_LOG_ENTRIES
+PfpAddTraceBuffer(
+    _In_ PPFSN_TRACE_HEADER Trace)
+{
+    PPFSN_LOG_ENTRIES Log;
+    ULONG Logged, MaxEntries;
+
+    Logged = Trace->NumTraceBuffers * PF_LOG_ENTRIES_PER_BUFFER;
+    if (Logged >= (ULONG)Trace->MaxFaults)
+        return NULL;
+
+    MaxEntries = Trace->MaxFaults - Logged;
+    if (MaxEntries > PF_LOG_ENTRIES_PER_BUFFER)
+        MaxEntries = PF_LOG_ENTRIES_PER_BUFFER;
+
+    Log = ExAllocatePoolWithTag(NonPagedPool,
+                                FIELD_OFFSET(PFSN_LOG_ENTRIES, Entries[MaxEntries]),
+                                TAG_PREFETCH);
+    if (!Log)
+        return NULL;
+
+    Log->NumEntries = 0;
+    Log->MaxEntries = MaxEntries;
+    InsertTailList(&Trace->TraceBuffersList, &Log->TraceBuffersLink);
+    Trace->NumTraceBuffers++;
+    Trace->CurrentTraceBuffer = Log;
+
+    return Log;
+}
+
+static
+PPFSN_TRACE_HEADER
+PfpStartTrace(
+    _In_ PPF_SCENARIO_ID ScenarioId,
+    _In_ PF_SCENARIO_TYPE ScenarioType,
+    _In_opt_ PEPROCESS Process,
+    _In_ LONGLONG Period,
+    _In_ ULONG MaxFaults,
+    _In_ ULONG MaxFiles)
+{
+    PPFSN_TRACE_HEADER Trace;
+    PLIST_ENTRY ListEntry;
+    ULONG NumLaunches = 0;
+    KIRQL OldIrql;
+
+    Trace = ExAllocatePoolZero(NonPagedPool, sizeof(*Trace), TAG_PREFETCH);
+    if (!Trace)
+        return NULL;
+
+    InitializeListHead(&Trace->TraceBuffersList);
+    Trace->MaxFaults = MaxFaults;
+    PfpAddTraceBuffer(Trace);
+    Trace->Files = ExAllocatePoolWithTag(NonPagedPool, MaxFiles * sizeof(PFILE_OBJECT), TAG_PREFETCH);
+    if (Process)
+        Trace->PrefetchSections = ExAllocatePoolWithTag(PagedPool, 2 * MaxFiles * sizeof(PVOID), TAG_PREFETCH);
+    if (!Trace->CurrentTraceBuffer || !Trace->Files || (Process && !Trace->PrefetchSections))
+    {
+        PfpFreeTrace(Trace);
+        return NULL;
+    }
+
+    Trace->Magic = PFSN_TRACE_MAGIC;
+    Trace->ScenarioId = *ScenarioId;
+    Trace->ScenarioType = ScenarioType;
+    Trace->MaxFiles = MaxFiles;
+    Trace->MaxPrefetchSections = Process ? 2 * MaxFiles : 0;
+    Trace->TraceTimerPeriod.QuadPart = -Period;
+    KeQuerySystemTime(&Trace->LaunchTime);
+    KeInitializeEvent(&Trace->PrefetchDoneEvent, NotificationEvent, FALSE);
+    KeInitializeTimer(&Trace->TraceTimer);
+    KeInitializeDpc(&Trace->TraceTimerDpc, PfpTraceTimerDpc, Trace);
+    ExInitializeWorkItem(&Trace->EndTraceWorkItem, PfpEndTraceWorker, Trace);
+
+    if (Process)
+    {
+        ObReferenceObject(Process);
+        Trace->Process = Process;
+    }
+
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+
+    if (Process)
+    {
+        for (ListEntry = CcPfGlobals.ActiveTraces.Flink;
+             ListEntry != &CcPfGlobals.ActiveTraces;
+             ListEntry = ListEntry->Flink)
+        {
+            if (CONTAINING_RECORD(ListEntry, PFSN_TRACE_HEADER, ActiveTracesLink)->Process)
+                NumLaunches++;
+        }
+
+        /* Too many launches at once, let this one go untraced */
+        if (NumLaunches >= PF_MAX_ACTIVE_APP_LAUNCHES)
+        {
+            KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+            PfpFreeTrace(Trace);
+            return NULL;
+        }
+    }
+
+    InsertTailList(&CcPfGlobals.ActiveTraces, &Trace->ActiveTracesLink);
+    if (!Process)
+        CcPfGlobals.SystemWideTrace = Trace;
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+
+    KeSetTimer(&Trace->TraceTimer, Trace->TraceTimerPeriod, &Trace->TraceTimerDpc);
+
+    return Trace;
+}
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+CcPfInitializePrefetcher(VOID)
+{
+    /* Notify debugger */
+    DbgPrintEx(DPFLTR_PREFETCHER_ID,
+               DPFLTR_TRACE_LEVEL,
+               "CCPF: InitializePrefetecher()\n");
+
+    /* Setup the Prefetcher Data */
+    InitializeListHead(&CcPfGlobals.ActiveTraces);
+    KeInitializeSpinLock(&CcPfGlobals.ActiveTracesLock);
+    InitializeListHead(&CcPfGlobals.CompletedTraces);
+    ExInitializeFastMutex(&CcPfGlobals.CompletedTracesLock);
+
+    /* What setup does is not worth remembering */
+    if (ExpInTextModeSetup || InitIsWinPEMode)
+        CcPfEnablePrefetcherMode = 0;
+
+    CcPfEnablePrefetcher = (CcPfEnablePrefetcherMode & (PF_ENABLE_APPLICATION_LAUNCH | PF_ENABLE_BOOT)) != 0;
+}
+
+NTSTATUS
+NTAPI
+CcPfBeginBootPhase(
+    _In_ PF_BOOT_PHASE_ID Phase)
+{
+    PF_SCENARIO_ID ScenarioId = { L"NTOSBOOT", 0xB00DFAAD };
+    PPFSN_TRACE_HEADER Trace;
+
+    PAGED_CODE();
+
+    /* The boot is traced from the start of SMSS on, when the file systems are up */
+    if (Phase != PfSessionManagerInitPhase)
+        return STATUS_SUCCESS;
+
+    if (!(CcPfEnablePrefetcherMode & PF_ENABLE_BOOT))
+        return STATUS_NOT_SUPPORTED;
+
+    Trace = PfpStartTrace(&ScenarioId,
+                          PfSystemBootScenarioType,
+                          NULL,
+                          PF_BOOT_TRACE_PERIOD,
+                          PF_BOOT_MAX_FAULTS,
+                          PF_BOOT_MAX_FILES);
+    if (!Trace)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* The boot goes on while the pages come in */
+    ExInitializeWorkItem(&CcPfBootPrefetchWorkItem, PfpBootPrefetchWorker, Trace);
+    ExQueueWorkItem(&CcPfBootPrefetchWorkItem, DelayedWorkQueue);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+CcPfBeginAppLaunch(
+    _In_ PEPROCESS Process)
+{
+    POBJECT_NAME_INFORMATION ImageName = Process->SeAuditProcessCreationInfo.ImageFileName;
+    PF_SCENARIO_ID ScenarioId;
+    PPFSN_TRACE_HEADER Trace;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (!(CcPfEnablePrefetcherMode & PF_ENABLE_APPLICATION_LAUNCH))
+        return STATUS_NOT_SUPPORTED;
+
+    if (!ImageName || ImageName->Name.Length == 0)
+        return STATUS_NOT_SUPPORTED;
+
+    /* Same scheme as the files: NOTEPAD.EXE-1234ABCD, the hash tells copies at different paths apart */
+    RtlZeroMemory(&ScenarioId, sizeof(ScenarioId));
+    for (i = 0; i < sizeof(Process->ImageFileName) - 1 && Process->ImageFileName[i]; i++)
+        ScenarioId.ScenName[i] = RtlUpcaseUnicodeChar((WCHAR)(UCHAR)Process->ImageFileName[i]);
+    RtlHashUnicodeString(&ImageName->Name, TRUE, HASH_STRING_ALGORITHM_X65599, &ScenarioId.HashId);
+
+    Trace = PfpStartTrace(&ScenarioId,
+                          PfApplicationLaunchScenarioType,
+                          Process,
+                          PF_APP_LAUNCH_TRACE_PERIOD,
+                          PF_APP_LAUNCH_MAX_FAULTS,
+                          PF_APP_LAUNCH_MAX_FILES);
+    if (!Trace)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* The first thread waits for the pages, the process did not run yet */
+    PfpPrefetchScenario(Trace);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+CcPfProcessExitNotification(
+    _In_ PEPROCESS Process)
+{
+    PPFSN_TRACE_HEADER Trace;
+    PLIST_ENTRY ListEntry;
+    KIRQL OldIrql;
+
+    if (!(Process->Flags & PSF_LAUNCH_PREFETCHED_BIT))
+        return;
+
+    /* A process that is gone has nothing more to fault */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    for (ListEntry = CcPfGlobals.ActiveTraces.Flink;
+         ListEntry != &CcPfGlobals.ActiveTraces;
+         ListEntry = ListEntry->Flink)
+    {
+        Trace = CONTAINING_RECORD(ListEntry, PFSN_TRACE_HEADER, ActiveTracesLink);
+        if (Trace->Process == Process)
+        {
+            KeCancelTimer(&Trace->TraceTimer);
+            PfpQueueEndTrace(Trace);
+            break;
+        }
+    }
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+}
+
+static
+VOID
+PfpLogEntry(
+    _In_ PPFSN_TRACE_HEADER Trace,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ ULONG Page,
+    _In_ BOOLEAN IsImage)
+{
+    PPFSN_LOG_ENTRIES Log = Trace->CurrentTraceBuffer;
+    PPF_LOG_ENTRY Entry;
+    ULONG FileKey;
+
+    Trace->NumFaults++;
+    if (Log->NumEntries >= Log->MaxEntries)
+    {
+        Log = PfpAddTraceBuffer(Trace);
+        if (!Log)
+            return;
+    }
+
+    /* Faults come in bursts on the same file */
+    FileKey = Trace->LastFileKey;
+    if (FileKey >= Trace->NumFiles || Trace->Files[FileKey] != FileObject)
+    {
+        for (FileKey = 0; FileKey < Trace->NumFiles; FileKey++)
+        {
+            if (Trace->Files[FileKey] == FileObject)
+                break;
+        }
+
+        if (FileKey == Trace->NumFiles)
+        {
+            if (Trace->NumFiles == Trace->MaxFiles)
+                return;
+
+            ObReferenceObject(FileObject);
+            Trace->Files[Trace->NumFiles++] = FileObject;
+        }
+
+        Trace->LastFileKey = FileKey;
+    }
+
+    Entry = &Log->Entries[Log->NumEntries++];
+    Entry->FileOffset = Page;
+    Entry->Type = IsImage;
+    Entry->FileKey = FileKey;
+}
+
+VOID
+NTAPI
+CcPfLogPageFault(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ ULONGLONG FileOffset,
+    _In_ BOOLEAN IsImage)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    PPFSN_TRACE_HEADER Trace;
+    PLIST_ENTRY ListEntry;
+    ULONGLONG Page = FileOffset >> PAGE_SHIFT;
+    KIRQL OldIrql;
+
+    /* This runs for every fault on a file, stay cheap when nothing is traced */
+    if (IsListEmpty(&CcPfGlobals.ActiveTraces) || Page > PF_MAX_PAGE)
+        return;
+
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    for (ListEntry = CcPfGlobals.ActiveTraces.Flink;
+         ListEntry != &CcPfGlobals.ActiveTraces;
+         ListEntry = ListEntry->Flink)
+    {
+        Trace = CONTAINING_RECORD(ListEntry, PFSN_TRACE_HEADER, ActiveTracesLink);
+
+        /* The boot trace takes everything */
+        if (Trace->Process && Trace->Process != Process)
+            continue;
+
+        PfpLogEntry(Trace, FileObject, (ULONG)Page, IsImage);
+    }
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+}
+
+/* EOF */
@@ -515,7 +515,7 @@ retry:
             {
                 Page = (PFN_NUMBER)(MmGetPhysicalAddress((PUCHAR)current->BaseAddress + (i * PAGE_SIZE)).QuadPart >> PAGE_SHIFT);
 
-                MmPageOutPhysicalAddress(Page);
+                MmPageOutPhysicalAddress(Page, NULL);
             }
 
             /* Reacquire the locks */
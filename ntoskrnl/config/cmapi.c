@@ -82,7 +82,6 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
 {
     PLIST_ENTRY NextEntry;
     PCMHIVE Hive;
-    NTSTATUS Status;
     BOOLEAN Result = TRUE;
 
     /* Make sure that the registry isn't read-only now */
@@ -114,22 +113,22 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
             /* Only sync if we are forced to or if it won't cause a hive shrink */
             if (ForceFlush || !HvHiveWillShrink(&Hive->Hive))
             {
-                /* Do the sync */
-                Status = HvSyncHive(&Hive->Hive);
-
-                /* If something failed - set the flag and continue looping */
-                if (!NT_SUCCESS(Status))
+                /* Do the sync, this releases the flusher lock */
+                if (!CmpFlushHive(Hive))
+                {
+                    /* Something failed - set the flag and continue looping */
                     Result = FALSE;
+                }
             }
             else
             {
                 /* We won't flush if the hive might shrink */
                 Result = FALSE;
                 CmpForceForceFlush = TRUE;
-            }
 
-            /* Release the flusher lock */
-            CmpUnlockHiveFlusher(Hive);
+                /* Release the flusher lock */
+                CmpUnlockHiveFlusher(Hive);
+            }
         }
 
         /* Try the next entry */
@@ -1992,15 +1991,12 @@ CmFlushKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
             KeReleaseGuardedMutex(CmHive->ViewLock);
         }
 
-        /* Flush only this hive */
-        if (!HvSyncHive(Hive))
+        /* Flush only this hive, this releases the flush lock */
+        if (!CmpFlushHive(CmHive))
         {
             /* Fail */
             Status = STATUS_REGISTRY_IO_FAILED;
         }
-
-        /* Release the flush lock */
-        CmpUnlockHiveFlusher(CmHive);
     }
 
     /* Return the status */
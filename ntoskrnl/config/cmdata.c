@@ -454,7 +454,7 @@ DATA_SEG("INITDATA") CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
     {
         L"Session Manager\\Memory Management",
         L"LargePageMinimum",
-        &DummyData,
+        &MmLargePageMinimum,
         NULL,
         NULL
     },
@@ -486,6 +486,27 @@ DATA_SEG("INITDATA") CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL,
         NULL
     },
+    {
+        L"Session Manager\\Memory Management",
+        L"FaultAroundSize",
+        &MmFaultAroundSize,
+        NULL,
+        NULL
+    },
+    {
+        L"Session Manager\\Memory Management",
+        L"PageStorePercent",
+        &MmPageStorePercent,
+        NULL,
+        NULL
+    },
+    {
+        L"Session Manager\\Memory Management\\PrefetchParameters",
+        L"EnablePrefetcher",
+        &CcPfEnablePrefetcherMode,
+        NULL,
+        NULL
+    },
     {
         L"Session Manager\\Executive",
         L"AdditionalCriticalWorkerThreads",
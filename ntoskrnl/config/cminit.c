@@ -154,6 +154,8 @@ CmpInitializeHive(
 
     /* Initialize the flush lock */
     ExInitializeResourceLite(Hive->FlusherLock);
+    ExInitializePushLock(&Hive->FlushSerializerLock);
+    Hive->FlushSerializerOwner = NULL;
 
     /* Setup hive locks */
     ExInitializePushLock(&Hive->HiveLock);
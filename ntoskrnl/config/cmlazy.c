@@ -28,13 +28,64 @@ LONG CmpFlushStarveWriters;
 
 /* FUNCTIONS ******************************************************************/
 
+BOOLEAN
+NTAPI
+CmpFlushHive(IN PCMHIVE CmHive)
+{
+    PHV_HIVE_SNAPSHOT Snapshot;
+    BOOLEAN Success;
+
+    /* The caller gave us the flusher lock exclusively */
+    CMP_ASSERT_FLUSH_LOCK(CmHive);
+
+    /* Grab a copy of the dirty blocks while nobody can touch them */
+    if (!HvCaptureHiveSnapshot(&CmHive->Hive, &Snapshot))
+    {
+        /* Out of memory most likely, do it the old way */
+        Success = HvSyncHive(&CmHive->Hive);
+        CmpUnlockHiveFlusher(CmHive);
+        return Success;
+    }
+
+    /* Check if the hive was clean */
+    if (!Snapshot)
+    {
+        CmpUnlockHiveFlusher(CmHive);
+        return TRUE;
+    }
+
+    /*
+     * Writers only need the flusher lock shared, so let them go on
+     * while we do the I/O. Other flushers still have to wait for us,
+     * we keep the flush serializer until we unlock.
+     */
+    ExConvertExclusiveToSharedLite(CmHive->FlusherLock);
+    Success = HvWriteHiveSnapshot(&CmHive->Hive, Snapshot);
+    if (Success)
+    {
+        CmpUnlockHiveFlusher(CmHive);
+        HvReleaseHiveSnapshot(&CmHive->Hive, Snapshot, TRUE);
+        return TRUE;
+    }
+
+    /*
+     * Put the blocks back in the dirty vector for the next flush. Only
+     * trade the shared lock for an exclusive one, keeping the serializer,
+     * so that no other flush can sneak in between.
+     */
+    ExReleaseResourceLite(CmHive->FlusherLock);
+    ExAcquireResourceExclusiveLite(CmHive->FlusherLock, TRUE);
+    HvReleaseHiveSnapshot(&CmHive->Hive, Snapshot, FALSE);
+    CmpUnlockHiveFlusher(CmHive);
+    return FALSE;
+}
+
 BOOLEAN
 NTAPI
 CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                    _Out_ PBOOLEAN Error,
                    _Out_ PULONG DirtyCount)
 {
-    NTSTATUS Status;
     PLIST_ENTRY NextEntry;
     PCMHIVE CmHive;
     BOOLEAN Result;
@@ -79,12 +130,12 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                 /* Do the sync */
                 DPRINT("Flushing: %wZ\n", &CmHive->FileFullPath);
                 DPRINT("Handle: %p\n", CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
-                Status = HvSyncHive(&CmHive->Hive);
-                if (!NT_SUCCESS(Status))
+                CmpLockHiveFlusherExclusive(CmHive);
+                if (!CmpFlushHive(CmHive))
                 {
                     /* Let them know we failed */
-                    DPRINT1("Failed to flush %wZ on handle %p (status 0x%08lx)\n",
-                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY], Status);
+                    DPRINT1("Failed to flush %wZ on handle %p\n",
+                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
                     *Error = TRUE;
                     Result = FALSE;
                     break;
@@ -165,7 +216,7 @@ CmpLazyFlush(VOID)
         /* Do it */
         DueTime.QuadPart = Int32x32To64(CmpLazyFlushIntervalInSeconds,
                                         -10 * 1000 * 1000);
-        KeSetTimer(&CmpLazyFlushTimer, DueTime, &CmpLazyFlushDpc);
+        KeSetCoalescableTimer(&CmpLazyFlushTimer, DueTime, 0, 1000, &CmpLazyFlushDpc);
     }
 }
 
@@ -2013,6 +2013,13 @@ CmpLockHiveFlusherExclusive(IN PCMHIVE Hive)
     CMP_ASSERT_REGISTRY_LOCK_OR_LOADING(Hive);
     ASSERT((ExIsResourceAcquiredShared(Hive->FlusherLock) == 0) &&
            (ExIsResourceAcquiredExclusiveLite(Hive->FlusherLock) == 0));
+
+    /*
+     * Keep other exclusive owners out until we unlock, even while
+     * CmpFlushHive lets writers in again during the I/O
+     */
+    ExAcquirePushLockExclusive(&Hive->FlushSerializerLock);
+    Hive->FlushSerializerOwner = KeGetCurrentThread();
     ExAcquireResourceExclusiveLite(Hive->FlusherLock, TRUE);
 }
 
@@ -2037,6 +2044,13 @@ CmpUnlockHiveFlusher(IN PCMHIVE Hive)
 
     /* Release the lock */
     ExReleaseResourceLite(Hive->FlusherLock);
+
+    /* And let the next exclusive owner in, if we were one */
+    if (Hive->FlushSerializerOwner == KeGetCurrentThread())
+    {
+        Hive->FlushSerializerOwner = NULL;
+        ExReleasePushLockExclusive(&Hive->FlushSerializerLock);
+    }
 }
 
 BOOLEAN
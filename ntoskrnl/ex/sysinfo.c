@@ -1042,6 +1042,7 @@ QSI_DEF(SystemProcessInformation)
                 SpiCurrent->PeakVirtualSize = Process->PeakVirtualSize;
                 SpiCurrent->VirtualSize = Process->VirtualSize;
                 SpiCurrent->PageFaultCount = Process->Vm.PageFaultCount;
+                SpiCurrent->HardFaultCount = Process->Vm.HardFaultCount;
                 SpiCurrent->PeakWorkingSetSize = Process->Vm.PeakWorkingSetSize;
                 SpiCurrent->WorkingSetSize = Process->Vm.WorkingSetSize;
                 SpiCurrent->QuotaPeakPagedPoolUsage = Process->QuotaPeak[PsPagedPool];
@@ -2823,6 +2824,54 @@ QSI_DEF(SystemFirmwareTableInformation)
     return Status;
 }
 
+/* Class 79 - Superfetch information */
+QSI_DEF(SystemSuperfetchInformation)
+{
+    PSUPERFETCH_INFORMATION SuperfetchInfo = (PSUPERFETCH_INFORMATION)Buffer;
+    SYSTEM_PAGE_STORE_INFORMATION StoreInfo;
+    PVOID Data;
+    ULONG Length;
+
+    *ReqSize = sizeof(SUPERFETCH_INFORMATION);
+
+    if (Size != *ReqSize)
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    if (SuperfetchInfo->Version != SUPERFETCH_INFORMATION_VERSION ||
+        SuperfetchInfo->Magic != SUPERFETCH_INFORMATION_MAGIC)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* The compressed page store is the only thing we know about */
+    if (SuperfetchInfo->InfoClass != SuperfetchPageStoreQuery)
+    {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    Data = SuperfetchInfo->Data;
+    Length = SuperfetchInfo->Length;
+
+    if (Length < sizeof(SYSTEM_PAGE_STORE_INFORMATION))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    /* The data buffer is not covered by the caller's probe */
+    if (ExGetPreviousMode() != KernelMode)
+    {
+        ProbeForWrite(Data, sizeof(SYSTEM_PAGE_STORE_INFORMATION), sizeof(ULONG_PTR));
+    }
+
+    /* Faulting on the caller's buffer may need the store, so don't fill it under its lock */
+    MmQueryPageStoreInformation(&StoreInfo);
+    *(PSYSTEM_PAGE_STORE_INFORMATION)Data = StoreInfo;
+
+    return STATUS_SUCCESS;
+}
+
 /* Query/Set Calls Table */
 typedef
 struct _QSSI_CALLS
@@ -2922,6 +2971,9 @@ CallQS[] =
     SI_XX(SystemWow64SharedInformation), /* FIXME: not implemented */
     SI_XX(SystemRegisterFirmwareTableInformationHandler), /* FIXME: not implemented */
     SI_QX(SystemFirmwareTableInformation),
+    SI_XX(SystemModuleInformationEx), /* FIXME: not implemented */
+    SI_XX(SystemVerifierTriageInformation), /* FIXME: not implemented */
+    SI_QX(SystemSuperfetchInformation),
 };
 
 C_ASSERT(SystemBasicInformation == 0);
@@ -30,9 +30,44 @@ typedef union _COMBINED_LOCK_ELEMENT
 }
     COMBINED_LOCK_ELEMENT, *PCOMBINED_LOCK_ELEMENT;
 
+/* Lock ranges are kept in an AVL tree ordered by starting offset, where each
+   node also records the highest ending offset found in its subtree. This lets
+   overlap queries skip whole subtrees that end before the range of interest,
+   so finding the locks overlapping a range costs O(log n) per match.
+*/
+typedef struct _LOCK_RANGE_NODE
+{
+    struct _LOCK_RANGE_NODE *Left;
+    struct _LOCK_RANGE_NODE *Right;
+    LONGLONG Start;
+    LONGLONG End;
+    LONGLONG MaxEnd;
+    LONG Height;
+}
+    LOCK_RANGE_NODE, *PLOCK_RANGE_NODE;
+
+/* Position of a node in the tree, valid even after the node is freed */
+typedef struct _LOCK_RANGE_KEY
+{
+    LONGLONG Start;
+    ULONG_PTR Node;
+}
+    LOCK_RANGE_KEY, *PLOCK_RANGE_KEY;
+
+typedef struct _LOCK_RANGE_ENTRY
+{
+    LOCK_RANGE_NODE Node;
+    COMBINED_LOCK_ELEMENT Lock;
+}
+    LOCK_RANGE_ENTRY, *PLOCK_RANGE_ENTRY;
+
 typedef struct _LOCK_INFORMATION
 {
-    RTL_GENERIC_TABLE RangeTable;
+    /* Exclusive locks and merged shared ranges, never overlapping */
+    PLOCK_RANGE_NODE RangeTree;
+    /* Individual shared locks, which may overlap each other */
+    PLOCK_RANGE_NODE SharedTree;
+    LOCK_RANGE_KEY EnumerationKey;
     IO_CSQ Csq;
     KSPIN_LOCK CsqLock;
     LIST_ENTRY CsqList;
@@ -45,12 +80,16 @@ typedef struct _LOCK_INFORMATION
 typedef struct _LOCK_SHARED_RANGE
 {
     LIST_ENTRY Entry;
+    LOCK_RANGE_NODE Node;
     LARGE_INTEGER Start, End;
     ULONG Key;
     PVOID ProcessId;
 }
     LOCK_SHARED_RANGE, *PLOCK_SHARED_RANGE;
 
+#define LOCK_RANGE_FIRST_START  ((LONGLONG)0x8000000000000000ULL)
+#define LOCK_RANGE_LAST_END     ((LONGLONG)0x7FFFFFFFFFFFFFFFULL)
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -62,57 +101,227 @@ FsRtlCompleteLockIrpReal(IN PCOMPLETE_LOCK_IRP_ROUTINE CompleteRoutine,
                          OUT PNTSTATUS NewStatus,
                          IN PFILE_OBJECT FileObject OPTIONAL);
 
-/* Generic table methods */
+/* Interval tree methods */
 
-static PVOID NTAPI LockAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
+static BOOLEAN LockRangesOverlap
+(LONGLONG StartA, LONGLONG EndA, LONGLONG StartB, LONGLONG EndB)
 {
-    PVOID Result;
-    Result = ExAllocatePoolWithTag(NonPagedPool, Bytes, TAG_TABLE);
-    DPRINT("LockAllocate(%lu) => %p\n", Bytes, Result);
-    return Result;
+    /* Match if either range starts inside the other one */
+    return (StartA < EndB && StartA >= StartB) ||
+           (StartB < EndA && StartB >= StartA);
 }
 
-static VOID NTAPI LockFree(PRTL_GENERIC_TABLE Table, PVOID Buffer)
+static BOOLEAN LockCompare(PCOMBINED_LOCK_ELEMENT A, PCOMBINED_LOCK_ELEMENT B)
 {
-    DPRINT("LockFree(%p)\n", Buffer);
-    ExFreePoolWithTag(Buffer, TAG_TABLE);
+    return LockRangesOverlap(A->Exclusive.FileLock.StartingByte.QuadPart,
+                             A->Exclusive.FileLock.EndingByte.QuadPart,
+                             B->Exclusive.FileLock.StartingByte.QuadPart,
+                             B->Exclusive.FileLock.EndingByte.QuadPart);
 }
 
-static RTL_GENERIC_COMPARE_RESULTS NTAPI LockCompare
-(PRTL_GENERIC_TABLE Table, PVOID PtrA, PVOID PtrB)
+/* Nodes with the same starting offset are ordered by address */
+static BOOLEAN LockRangeKeyLess
+(LONGLONG StartA, ULONG_PTR NodeA, LONGLONG StartB, ULONG_PTR NodeB)
 {
-    PCOMBINED_LOCK_ELEMENT A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Result;
-#if 0
-    DPRINT("Starting to compare element %x to element %x\n", PtrA, PtrB);
-#endif
-    /* Match if we overlap */
-    if (((A->Exclusive.FileLock.StartingByte.QuadPart <
-          B->Exclusive.FileLock.EndingByte.QuadPart) &&
-         (A->Exclusive.FileLock.StartingByte.QuadPart >=
-          B->Exclusive.FileLock.StartingByte.QuadPart)) ||
-        ((B->Exclusive.FileLock.StartingByte.QuadPart <
-          A->Exclusive.FileLock.EndingByte.QuadPart) &&
-         (B->Exclusive.FileLock.StartingByte.QuadPart >=
-          A->Exclusive.FileLock.StartingByte.QuadPart)))
-        return GenericEqual;
-    /* Otherwise, key on the starting byte */
-    Result =
-        (A->Exclusive.FileLock.StartingByte.QuadPart <
-         B->Exclusive.FileLock.StartingByte.QuadPart) ? GenericLessThan :
-        (A->Exclusive.FileLock.StartingByte.QuadPart >
-         B->Exclusive.FileLock.StartingByte.QuadPart) ? GenericGreaterThan :
-        GenericEqual;
-#if 0
-    DPRINT("Compare(%x:%x) %x-%x to %x-%x => %d\n",
-           A,B,
-           A->Exclusive.FileLock.StartingByte.LowPart,
-           A->Exclusive.FileLock.EndingByte.LowPart,
-           B->Exclusive.FileLock.StartingByte.LowPart,
-           B->Exclusive.FileLock.EndingByte.LowPart,
-           Result);
-#endif
-    return Result;
+    return StartA < StartB || (StartA == StartB && NodeA < NodeB);
+}
+
+static LONG LockRangeHeight(PLOCK_RANGE_NODE Node)
+{
+    return Node ? Node->Height : 0;
+}
+
+static VOID LockRangeUpdate(PLOCK_RANGE_NODE Node)
+{
+    LONG LeftHeight = LockRangeHeight(Node->Left);
+    LONG RightHeight = LockRangeHeight(Node->Right);
+
+    Node->Height = (LeftHeight > RightHeight ? LeftHeight : RightHeight) + 1;
+    Node->MaxEnd = Node->End;
+    if (Node->Left && Node->Left->MaxEnd > Node->MaxEnd)
+        Node->MaxEnd = Node->Left->MaxEnd;
+    if (Node->Right && Node->Right->MaxEnd > Node->MaxEnd)
+        Node->MaxEnd = Node->Right->MaxEnd;
+}
+
+static PLOCK_RANGE_NODE LockRangeRotateRight(PLOCK_RANGE_NODE Node)
+{
+    PLOCK_RANGE_NODE Pivot = Node->Left;
+    Node->Left = Pivot->Right;
+    Pivot->Right = Node;
+    LockRangeUpdate(Node);
+    LockRangeUpdate(Pivot);
+    return Pivot;
+}
+
+static PLOCK_RANGE_NODE LockRangeRotateLeft(PLOCK_RANGE_NODE Node)
+{
+    PLOCK_RANGE_NODE Pivot = Node->Right;
+    Node->Right = Pivot->Left;
+    Pivot->Left = Node;
+    LockRangeUpdate(Node);
+    LockRangeUpdate(Pivot);
+    return Pivot;
+}
+
+static PLOCK_RANGE_NODE LockRangeBalance(PLOCK_RANGE_NODE Node)
+{
+    LONG Balance;
+
+    LockRangeUpdate(Node);
+    Balance = LockRangeHeight(Node->Left) - LockRangeHeight(Node->Right);
+    if (Balance > 1)
+    {
+        if (LockRangeHeight(Node->Left->Left) < LockRangeHeight(Node->Left->Right))
+            Node->Left = LockRangeRotateLeft(Node->Left);
+        return LockRangeRotateRight(Node);
+    }
+    if (Balance < -1)
+    {
+        if (LockRangeHeight(Node->Right->Right) < LockRangeHeight(Node->Right->Left))
+            Node->Right = LockRangeRotateRight(Node->Right);
+        return LockRangeRotateLeft(Node);
+    }
+    return Node;
+}
+
+static PLOCK_RANGE_NODE LockRangeInsert(PLOCK_RANGE_NODE Root, PLOCK_RANGE_NODE Node)
+{
+    if (!Root)
+    {
+        Node->Left = Node->Right = NULL;
+        Node->Height = 1;
+        Node->MaxEnd = Node->End;
+        return Node;
+    }
+    if (LockRangeKeyLess(Node->Start, (ULONG_PTR)Node, Root->Start, (ULONG_PTR)Root))
+        Root->Left = LockRangeInsert(Root->Left, Node);
+    else
+        Root->Right = LockRangeInsert(Root->Right, Node);
+    return LockRangeBalance(Root);
+}
+
+static PLOCK_RANGE_NODE LockRangeRemoveFirst(PLOCK_RANGE_NODE Root, PLOCK_RANGE_NODE *First)
+{
+    if (!Root->Left)
+    {
+        *First = Root;
+        return Root->Right;
+    }
+    Root->Left = LockRangeRemoveFirst(Root->Left, First);
+    return LockRangeBalance(Root);
+}
+
+static PLOCK_RANGE_NODE LockRangeRemove(PLOCK_RANGE_NODE Root, PLOCK_RANGE_NODE Node)
+{
+    PLOCK_RANGE_NODE Successor;
+
+    ASSERT(Root);
+    if (Root == Node)
+    {
+        if (!Root->Right) return Root->Left;
+        Root->Right = LockRangeRemoveFirst(Root->Right, &Successor);
+        Successor->Left = Root->Left;
+        Successor->Right = Root->Right;
+        return LockRangeBalance(Successor);
+    }
+    if (LockRangeKeyLess(Node->Start, (ULONG_PTR)Node, Root->Start, (ULONG_PTR)Root))
+        Root->Left = LockRangeRemove(Root->Left, Node);
+    else
+        Root->Right = LockRangeRemove(Root->Right, Node);
+    return LockRangeBalance(Root);
+}
+
+/* Returns the first node overlapping Start-End that is ordered after the
+   position After (or the very first one if After is NULL) */
+static PLOCK_RANGE_NODE LockRangeFindOverlap
+(PLOCK_RANGE_NODE Root, LONGLONG Start, LONGLONG End, PLOCK_RANGE_KEY After)
+{
+    PLOCK_RANGE_NODE Found;
+
+    /* Nothing in this subtree ends late enough to overlap */
+    if (!Root || Root->MaxEnd < Start) return NULL;
+
+    if (!After || LockRangeKeyLess(After->Start, After->Node, Root->Start, (ULONG_PTR)Root))
+    {
+        Found = LockRangeFindOverlap(Root->Left, Start, End, After);
+        if (Found) return Found;
+        if (LockRangesOverlap(Root->Start, Root->End, Start, End)) return Root;
+    }
+
+    /* Everything on the right starts after the range */
+    if (Root->Start > End) return NULL;
+    return LockRangeFindOverlap(Root->Right, Start, End, After);
+}
+
+static PCOMBINED_LOCK_ELEMENT FsRtlpFindLockRange
+(PLOCK_INFORMATION LockInfo, PCOMBINED_LOCK_ELEMENT ToFind, PCOMBINED_LOCK_ELEMENT After)
+{
+    LOCK_RANGE_KEY Key;
+    PLOCK_RANGE_ENTRY Entry;
+    PLOCK_RANGE_NODE Node;
+
+    if (After)
+    {
+        Entry = CONTAINING_RECORD(After, LOCK_RANGE_ENTRY, Lock);
+        Key.Start = Entry->Node.Start;
+        Key.Node = (ULONG_PTR)&Entry->Node;
+    }
+    Node = LockRangeFindOverlap(LockInfo->RangeTree,
+                                ToFind->Exclusive.FileLock.StartingByte.QuadPart,
+                                ToFind->Exclusive.FileLock.EndingByte.QuadPart,
+                                After ? &Key : NULL);
+    if (!Node) return NULL;
+    return &CONTAINING_RECORD(Node, LOCK_RANGE_ENTRY, Node)->Lock;
+}
+
+/* Like RtlInsertElementGenericTable: returns the overlapping range if there
+   is one, otherwise a copy of ToInsert which is added to the tree */
+static PCOMBINED_LOCK_ELEMENT FsRtlpInsertLockRange
+(PLOCK_INFORMATION LockInfo, PCOMBINED_LOCK_ELEMENT ToInsert, PBOOLEAN InsertedNew)
+{
+    PCOMBINED_LOCK_ELEMENT Conflict;
+    PLOCK_RANGE_ENTRY Entry;
+
+    *InsertedNew = FALSE;
+    Conflict = FsRtlpFindLockRange(LockInfo, ToInsert, NULL);
+    if (Conflict) return Conflict;
+
+    Entry = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Entry), TAG_TABLE);
+    DPRINT("LockAllocate(%lu) => %p\n", (ULONG)sizeof(*Entry), Entry);
+    if (!Entry) return NULL;
+
+    Entry->Lock = *ToInsert;
+    Entry->Node.Start = ToInsert->Exclusive.FileLock.StartingByte.QuadPart;
+    Entry->Node.End = ToInsert->Exclusive.FileLock.EndingByte.QuadPart;
+    LockInfo->RangeTree = LockRangeInsert(LockInfo->RangeTree, &Entry->Node);
+    *InsertedNew = TRUE;
+    return &Entry->Lock;
+}
+
+static VOID FsRtlpDeleteLockRange
+(PLOCK_INFORMATION LockInfo, PCOMBINED_LOCK_ELEMENT Element)
+{
+    PLOCK_RANGE_ENTRY Entry = CONTAINING_RECORD(Element, LOCK_RANGE_ENTRY, Lock);
+    DPRINT("LockFree(%p)\n", Entry);
+    LockInfo->RangeTree = LockRangeRemove(LockInfo->RangeTree, &Entry->Node);
+    ExFreePoolWithTag(Entry, TAG_TABLE);
+}
+
+static VOID FsRtlpInsertSharedRange
+(PLOCK_INFORMATION LockInfo, PLOCK_SHARED_RANGE SharedRange)
+{
+    InsertTailList(&LockInfo->SharedLocks, &SharedRange->Entry);
+    SharedRange->Node.Start = SharedRange->Start.QuadPart;
+    SharedRange->Node.End = SharedRange->End.QuadPart;
+    LockInfo->SharedTree = LockRangeInsert(LockInfo->SharedTree, &SharedRange->Node);
+}
+
+static VOID FsRtlpRemoveSharedRange
+(PLOCK_INFORMATION LockInfo, PLOCK_SHARED_RANGE SharedRange)
+{
+    RemoveEntryList(&SharedRange->Entry);
+    LockInfo->SharedTree = LockRangeRemove(LockInfo->SharedTree, &SharedRange->Node);
 }
 
 /* CSQ methods */
@@ -167,8 +376,7 @@ static PIRP NTAPI LockPeekNextIrp(PIO_CSQ Csq, PIRP Irp, PVOID PeekContext)
         /* If a context was specified, it's a range to check to unlock */
         if (WhereUnlock)
         {
-            Matching = LockCompare
-                (&LockInfo->RangeTable, &LockElement, WhereUnlock) != GenericEqual;
+            Matching = !LockCompare(&LockElement, WhereUnlock);
         }
         /* Else get any completable IRP */
         else
@@ -255,11 +463,18 @@ NTAPI
 FsRtlGetNextFileLock(IN PFILE_LOCK FileLock,
                      IN BOOLEAN Restart)
 {
-    PCOMBINED_LOCK_ELEMENT Entry;
-    if (!FileLock->LockInformation) return NULL;
-    Entry = RtlEnumerateGenericTable(FileLock->LockInformation, Restart);
-    if (!Entry) return NULL;
-    else return &Entry->Exclusive.FileLock;
+    PLOCK_INFORMATION LockInfo = FileLock->LockInformation;
+    PLOCK_RANGE_NODE Node;
+    if (!LockInfo) return NULL;
+    Node = LockRangeFindOverlap(LockInfo->RangeTree,
+                                LOCK_RANGE_FIRST_START,
+                                LOCK_RANGE_LAST_END,
+                                Restart ? NULL : &LockInfo->EnumerationKey);
+    if (!Node) return NULL;
+    /* Remember where we are, the entry itself may go away before the next call */
+    LockInfo->EnumerationKey.Start = Node->Start;
+    LockInfo->EnumerationKey.Node = (ULONG_PTR)Node;
+    return &CONTAINING_RECORD(Node, LOCK_RANGE_ENTRY, Node)->Lock.Exclusive.FileLock;
 }
 
 VOID
@@ -295,24 +510,16 @@ FsRtlpRebuildSharedLockRange
      * capture and expand a shared range from the shared range list.
      * Finish when we've incorporated all overlapping shared regions.
      */
-    BOOLEAN InsertedNew = FALSE, RemovedOld;
+    BOOLEAN InsertedNew = FALSE;
     COMBINED_LOCK_ELEMENT NewElement = *Conflict;
     PCOMBINED_LOCK_ELEMENT Entry;
-    while ((Entry = RtlLookupElementGenericTable
-            (FileLock->LockInformation, &NewElement)))
+    while ((Entry = FsRtlpFindLockRange(LockInfo, &NewElement, NULL)))
     {
         FsRtlpExpandLockElement(&NewElement, Entry);
-        RemovedOld = RtlDeleteElementGenericTable
-            (&LockInfo->RangeTable,
-             Entry);
-        ASSERT(RemovedOld);
+        FsRtlpDeleteLockRange(LockInfo, Entry);
     }
-    Conflict = RtlInsertElementGenericTable
-        (&LockInfo->RangeTable,
-         &NewElement,
-         sizeof(NewElement),
-         &InsertedNew);
-    ASSERT(InsertedNew);
+    Conflict = FsRtlpInsertLockRange(LockInfo, &NewElement, &InsertedNew);
+    ASSERT(InsertedNew || !Conflict);
     return Conflict;
 }
 
@@ -389,13 +596,11 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
 
         LockInfo->BelongsTo = FileLock;
         InitializeListHead(&LockInfo->SharedLocks);
-
-        RtlInitializeGenericTable
-            (&LockInfo->RangeTable,
-             LockCompare,
-             LockAllocate,
-             LockFree,
-             NULL);
+        LockInfo->RangeTree = NULL;
+        LockInfo->SharedTree = NULL;
+        LockInfo->EnumerationKey.Start = LOCK_RANGE_FIRST_START;
+        LockInfo->EnumerationKey.Node = 0;
+        LockInfo->Generation = 0;
 
         KeInitializeSpinLock(&LockInfo->CsqLock);
         InitializeListHead(&LockInfo->CsqList);
@@ -418,11 +623,7 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
     ToInsert.Exclusive.FileLock.Key = Key;
     ToInsert.Exclusive.FileLock.ExclusiveLock = ExclusiveLock;
 
-    Conflict = RtlInsertElementGenericTable
-        (FileLock->LockInformation,
-         &ToInsert,
-         sizeof(ToInsert),
-         &InsertedNew);
+    Conflict = FsRtlpInsertLockRange(LockInfo, &ToInsert, &InsertedNew);
 
     if (Conflict && !InsertedNew)
     {
@@ -470,59 +671,54 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
         }
         else
         {
-            ULONG i;
             /* We know of at least one lock in range that's shared.  We need to
              * find out if any more exist and any are exclusive. */
-            for (i = 0; i < RtlNumberGenericTableElements(&LockInfo->RangeTable); i++)
+            for (;
+                 Conflict;
+                 Conflict = FsRtlpFindLockRange(LockInfo, &ToInsert, Conflict))
             {
-                Conflict = RtlGetElementGenericTable(&LockInfo->RangeTable, i);
-
-                /* The first argument will be inserted as a shared range */
-                if (Conflict && (LockCompare(&LockInfo->RangeTable, Conflict, &ToInsert) == GenericEqual))
+                if (Conflict->Exclusive.FileLock.ExclusiveLock)
                 {
-                    if (Conflict->Exclusive.FileLock.ExclusiveLock)
+                    /* Found an exclusive match */
+                    if (FailImmediately)
                     {
-                        /* Found an exclusive match */
-                        if (FailImmediately)
+                        IoStatus->Status = STATUS_FILE_LOCK_CONFLICT;
+                        DPRINT("STATUS_FILE_LOCK_CONFLICT\n");
+                        if (Irp)
                         {
-                            IoStatus->Status = STATUS_FILE_LOCK_CONFLICT;
-                            DPRINT("STATUS_FILE_LOCK_CONFLICT\n");
-                            if (Irp)
-                            {
-                                DPRINT("STATUS_FILE_LOCK_CONFLICT: Complete\n");
-                                FsRtlCompleteLockIrpReal
-                                    (FileLock->CompleteLockIrpRoutine,
-                                     Context,
-                                     Irp,
-                                     IoStatus->Status,
-                                     &Status,
-                                     FileObject);
-                            }
+                            DPRINT("STATUS_FILE_LOCK_CONFLICT: Complete\n");
+                            FsRtlCompleteLockIrpReal
+                                (FileLock->CompleteLockIrpRoutine,
+                                 Context,
+                                 Irp,
+                                 IoStatus->Status,
+                                 &Status,
+                                 FileObject);
                         }
-                        else
+                    }
+                    else
+                    {
+                        IoStatus->Status = STATUS_PENDING;
+                        if (Irp)
                         {
-                            IoStatus->Status = STATUS_PENDING;
-                            if (Irp)
-                            {
-                                IoMarkIrpPending(Irp);
-                                IoCsqInsertIrpEx
-                                    (&LockInfo->Csq,
-                                     Irp,
-                                     NULL,
-                                     NULL);
-                            }
+                            IoMarkIrpPending(Irp);
+                            IoCsqInsertIrpEx
+                                (&LockInfo->Csq,
+                                 Irp,
+                                 NULL,
+                                 NULL);
                         }
-                        return FALSE;
                     }
+                    return FALSE;
                 }
             }
 
             DPRINT("Overlapping shared lock %wZ %08x%08x %08x%08x\n",
                    &FileObject->FileName,
-                   Conflict->Exclusive.FileLock.StartingByte.HighPart,
-                   Conflict->Exclusive.FileLock.StartingByte.LowPart,
-                   Conflict->Exclusive.FileLock.EndingByte.HighPart,
-                   Conflict->Exclusive.FileLock.EndingByte.LowPart);
+                   ToInsert.Exclusive.FileLock.StartingByte.HighPart,
+                   ToInsert.Exclusive.FileLock.StartingByte.LowPart,
+                   ToInsert.Exclusive.FileLock.EndingByte.HighPart,
+                   ToInsert.Exclusive.FileLock.EndingByte.LowPart);
             Conflict = FsRtlpRebuildSharedLockRange(FileLock,
                                                     LockInfo,
                                                     &ToInsert);
@@ -539,6 +735,7 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
                          &Status,
                          FileObject);
                 }
+                return FALSE;
             }
 
             /* We got here because there were only overlapping shared locks */
@@ -568,7 +765,7 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
             NewSharedRange->End.QuadPart = FileOffset->QuadPart + Length->QuadPart;
             NewSharedRange->Key = Key;
             NewSharedRange->ProcessId = ToInsert.Exclusive.FileLock.ProcessId;
-            InsertTailList(&LockInfo->SharedLocks, &NewSharedRange->Entry);
+            FsRtlpInsertSharedRange(LockInfo, NewSharedRange);
 
             DPRINT("Acquired shared lock %wZ %08x%08x %08x%08x\n",
                    &FileObject->FileName,
@@ -640,7 +837,7 @@ FsRtlPrivateLock(IN PFILE_LOCK FileLock,
             NewSharedRange->End.QuadPart = FileOffset->QuadPart + Length->QuadPart;
             NewSharedRange->Key = Key;
             NewSharedRange->ProcessId = Process;
-            InsertTailList(&LockInfo->SharedLocks, &NewSharedRange->Entry);
+            FsRtlpInsertSharedRange(LockInfo, NewSharedRange);
         }
 
         /* Assume all is cool, and lock is set */
@@ -689,15 +886,14 @@ FsRtlCheckLockForReadAccess(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.EndingByte.QuadPart =
         ToFind.Exclusive.FileLock.StartingByte.QuadPart +
         IoStack->Parameters.Read.Length;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckLockForReadAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
-        return TRUE;
+    Result = TRUE;
+    for (Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, NULL);
+         Found && Result;
+         Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, Found))
+    {
+        Result = !Found->Exclusive.FileLock.ExclusiveLock ||
+            IoStack->Parameters.Read.Key == Found->Exclusive.FileLock.Key;
     }
-    Result = !Found->Exclusive.FileLock.ExclusiveLock ||
-        IoStack->Parameters.Read.Key == Found->Exclusive.FileLock.Key;
     DPRINT("CheckLockForReadAccess(%wZ) => %s\n", &IoStack->FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -728,14 +924,13 @@ FsRtlCheckLockForWriteAccess(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.EndingByte.QuadPart =
         ToFind.Exclusive.FileLock.StartingByte.QuadPart +
         IoStack->Parameters.Write.Length;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckLockForWriteAccess(%wZ) => TRUE\n", &IoStack->FileObject->FileName);
-        return TRUE;
+    Result = TRUE;
+    for (Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, NULL);
+         Found && Result;
+         Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, Found))
+    {
+        Result = Process == Found->Exclusive.FileLock.ProcessId;
     }
-    Result = Process == Found->Exclusive.FileLock.ProcessId;
     DPRINT("CheckLockForWriteAccess(%wZ) => %s\n", &IoStack->FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -766,12 +961,17 @@ FsRtlFastCheckLockForRead(IN PFILE_LOCK FileLock,
     ToFind.Exclusive.FileLock.EndingByte.QuadPart =
         FileOffset->QuadPart + Length->QuadPart;
     if (!FileLock->LockInformation) return TRUE;
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found || !Found->Exclusive.FileLock.ExclusiveLock) return TRUE;
-    return Found->Exclusive.FileLock.Key == Key &&
-        Found->Exclusive.FileLock.ProcessId == EProcess;
+    /* Only exclusive locks held by somebody else prevent reading */
+    for (Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, NULL);
+         Found;
+         Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, Found))
+    {
+        if (Found->Exclusive.FileLock.ExclusiveLock &&
+            (Found->Exclusive.FileLock.Key != Key ||
+             Found->Exclusive.FileLock.ProcessId != EProcess))
+            return FALSE;
+    }
+    return TRUE;
 }
 
 /*
@@ -804,15 +1004,14 @@ FsRtlFastCheckLockForWrite(IN PFILE_LOCK FileLock,
         DPRINT("CheckForWrite(%wZ) => TRUE\n", &FileObject->FileName);
         return TRUE;
     }
-    Found = RtlLookupElementGenericTable
-        (FileLock->LockInformation,
-         &ToFind);
-    if (!Found) {
-        DPRINT("CheckForWrite(%wZ) => TRUE\n", &FileObject->FileName);
-        return TRUE;
+    Result = TRUE;
+    for (Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, NULL);
+         Found && Result;
+         Found = FsRtlpFindLockRange(FileLock->LockInformation, &ToFind, Found))
+    {
+        Result = Found->Exclusive.FileLock.Key == Key &&
+            Found->Exclusive.FileLock.ProcessId == EProcess;
     }
-    Result = Found->Exclusive.FileLock.Key == Key &&
-        Found->Exclusive.FileLock.ProcessId == EProcess;
     DPRINT("CheckForWrite(%wZ) => %s\n", &FileObject->FileName, Result ? "TRUE" : "FALSE");
     return Result;
 }
@@ -832,7 +1031,11 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
                       IN BOOLEAN AlreadySynchronized)
 {
     BOOLEAN FoundShared = FALSE;
+#ifndef NDEBUG
     PLIST_ENTRY SharedEntry;
+#endif
+    PLOCK_RANGE_NODE SharedNode;
+    LOCK_RANGE_KEY SharedKey;
     PLOCK_SHARED_RANGE SharedRange = NULL;
     COMBINED_LOCK_ELEMENT Find;
     PCOMBINED_LOCK_ELEMENT Entry;
@@ -858,7 +1061,7 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
         DPRINT("File not previously locked (ever)\n");
         return STATUS_RANGE_NOT_LOCKED;
     }
-    Entry = RtlLookupElementGenericTable(&InternalInfo->RangeTable, &Find);
+    Entry = FsRtlpFindLockRange(InternalInfo, &Find, NULL);
     if (!Entry) {
         DPRINT("Range not locked %wZ\n", &FileObject->FileName);
         return STATUS_RANGE_NOT_LOCKED;
@@ -885,7 +1088,7 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
         }
         RtlCopyMemory(&Find, Entry, sizeof(Find));
         // Remove the old exclusive lock region
-        RtlDeleteElementGenericTable(&InternalInfo->RangeTable, Entry);
+        FsRtlpDeleteLockRange(InternalInfo, Entry);
     }
     else
     {
@@ -895,11 +1098,19 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
                Entry->Exclusive.FileLock.StartingByte.LowPart,
                Entry->Exclusive.FileLock.EndingByte.HighPart,
                Entry->Exclusive.FileLock.EndingByte.LowPart);
-        for (SharedEntry = InternalInfo->SharedLocks.Flink;
-             SharedEntry != &InternalInfo->SharedLocks;
-             SharedEntry = SharedEntry->Flink)
+        for (SharedNode = LockRangeFindOverlap(InternalInfo->SharedTree,
+                                               Find.Exclusive.FileLock.StartingByte.QuadPart,
+                                               Find.Exclusive.FileLock.EndingByte.QuadPart,
+                                               NULL);
+             SharedNode;
+             SharedNode = LockRangeFindOverlap(InternalInfo->SharedTree,
+                                               Find.Exclusive.FileLock.StartingByte.QuadPart,
+                                               Find.Exclusive.FileLock.EndingByte.QuadPart,
+                                               &SharedKey))
         {
-            SharedRange = CONTAINING_RECORD(SharedEntry, LOCK_SHARED_RANGE, Entry);
+            SharedRange = CONTAINING_RECORD(SharedNode, LOCK_SHARED_RANGE, Node);
+            SharedKey.Start = SharedNode->Start;
+            SharedKey.Node = (ULONG_PTR)SharedNode;
             if (SharedRange->Start.QuadPart == FileOffset->QuadPart &&
                 SharedRange->End.QuadPart == FileOffset->QuadPart + Length->QuadPart &&
                 SharedRange->Key == Key &&
@@ -919,7 +1130,7 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
         if (FoundShared)
         {
             /* Remove the found range from the shared range lists */
-            RemoveEntryList(&SharedRange->Entry);
+            FsRtlpRemoveSharedRange(InternalInfo, SharedRange);
             ExFreePoolWithTag(SharedRange, TAG_RANGE);
             /* We need to rebuild the list of shared ranges. */
             DPRINT("Removing the lock entry %wZ (%08x%08x:%08x%08x)\n",
@@ -931,14 +1142,22 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
 
             /* Remember what was in there and remove it from the table */
             Find = *Entry;
-            RtlDeleteElementGenericTable(&InternalInfo->RangeTable, &Find);
-            /* Put shared locks back in place */
-            for (SharedEntry = InternalInfo->SharedLocks.Flink;
-                 SharedEntry != &InternalInfo->SharedLocks;
-                 SharedEntry = SharedEntry->Flink)
+            FsRtlpDeleteLockRange(InternalInfo, Entry);
+            /* Put the shared locks that were part of it back in place */
+            for (SharedNode = LockRangeFindOverlap(InternalInfo->SharedTree,
+                                                   Find.Exclusive.FileLock.StartingByte.QuadPart,
+                                                   Find.Exclusive.FileLock.EndingByte.QuadPart,
+                                                   NULL);
+                 SharedNode;
+                 SharedNode = LockRangeFindOverlap(InternalInfo->SharedTree,
+                                                   Find.Exclusive.FileLock.StartingByte.QuadPart,
+                                                   Find.Exclusive.FileLock.EndingByte.QuadPart,
+                                                   &SharedKey))
             {
                 COMBINED_LOCK_ELEMENT LockElement;
-                SharedRange = CONTAINING_RECORD(SharedEntry, LOCK_SHARED_RANGE, Entry);
+                SharedRange = CONTAINING_RECORD(SharedNode, LOCK_SHARED_RANGE, Node);
+                SharedKey.Start = SharedNode->Start;
+                SharedKey.Node = (ULONG_PTR)SharedNode;
                 LockElement.Exclusive.FileLock.FileObject = FileObject;
                 LockElement.Exclusive.FileLock.StartingByte = SharedRange->Start;
                 LockElement.Exclusive.FileLock.EndingByte = SharedRange->End;
@@ -946,15 +1165,6 @@ FsRtlFastUnlockSingle(IN PFILE_LOCK FileLock,
                 LockElement.Exclusive.FileLock.Key = SharedRange->Key;
                 LockElement.Exclusive.FileLock.ExclusiveLock = FALSE;
 
-                if (LockCompare(&InternalInfo->RangeTable, &Find, &LockElement) != GenericEqual)
-                {
-                    DPRINT("Skipping range %08x%08x:%08x%08x\n",
-                           LockElement.Exclusive.FileLock.StartingByte.HighPart,
-                           LockElement.Exclusive.FileLock.StartingByte.LowPart,
-                           LockElement.Exclusive.FileLock.EndingByte.HighPart,
-                           LockElement.Exclusive.FileLock.EndingByte.LowPart);
-                    continue;
-                }
                 DPRINT("Re-creating range %08x%08x:%08x%08x\n",
                        LockElement.Exclusive.FileLock.StartingByte.HighPart,
                        LockElement.Exclusive.FileLock.StartingByte.LowPart,
@@ -1029,6 +1239,8 @@ FsRtlFastUnlockAll(IN PFILE_LOCK FileLock,
 {
     PLIST_ENTRY ListEntry;
     PCOMBINED_LOCK_ELEMENT Entry;
+    PLOCK_RANGE_NODE Node;
+    LOCK_RANGE_KEY Position;
     PLOCK_INFORMATION InternalInfo = FileLock->LockInformation;
     DPRINT("FsRtlFastUnlockAll(%wZ)\n", &FileObject->FileName);
     // XXX Synchronize somehow
@@ -1055,11 +1267,21 @@ FsRtlFastUnlockAll(IN PFILE_LOCK FileLock,
              Context,
              TRUE);
     }
-    for (Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, TRUE);
-         Entry;
-         Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, FALSE))
+    /* Unlocking may free the entry, so walk the tree by position */
+    for (Node = LockRangeFindOverlap(InternalInfo->RangeTree,
+                                     LOCK_RANGE_FIRST_START,
+                                     LOCK_RANGE_LAST_END,
+                                     NULL);
+         Node;
+         Node = LockRangeFindOverlap(InternalInfo->RangeTree,
+                                     LOCK_RANGE_FIRST_START,
+                                     LOCK_RANGE_LAST_END,
+                                     &Position))
     {
         LARGE_INTEGER Length;
+        Entry = &CONTAINING_RECORD(Node, LOCK_RANGE_ENTRY, Node)->Lock;
+        Position.Start = Node->Start;
+        Position.Node = (ULONG_PTR)Node;
         // We'll take the first one to be the list head, and free the others first...
         Length.QuadPart =
             Entry->Exclusive.FileLock.EndingByte.QuadPart -
@@ -1091,6 +1313,8 @@ FsRtlFastUnlockAllByKey(IN PFILE_LOCK FileLock,
 {
     PLIST_ENTRY ListEntry;
     PCOMBINED_LOCK_ELEMENT Entry;
+    PLOCK_RANGE_NODE Node;
+    LOCK_RANGE_KEY Position;
     PLOCK_INFORMATION InternalInfo = FileLock->LockInformation;
 
     DPRINT("FsRtlFastUnlockAllByKey(%wZ,Key %x)\n", &FileObject->FileName, Key);
@@ -1117,11 +1341,21 @@ FsRtlFastUnlockAllByKey(IN PFILE_LOCK FileLock,
              Context,
              TRUE);
     }
-    for (Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, TRUE);
-         Entry;
-         Entry = RtlEnumerateGenericTable(&InternalInfo->RangeTable, FALSE))
+    /* Unlocking may free the entry, so walk the tree by position */
+    for (Node = LockRangeFindOverlap(InternalInfo->RangeTree,
+                                     LOCK_RANGE_FIRST_START,
+                                     LOCK_RANGE_LAST_END,
+                                     NULL);
+         Node;
+         Node = LockRangeFindOverlap(InternalInfo->RangeTree,
+                                     LOCK_RANGE_FIRST_START,
+                                     LOCK_RANGE_LAST_END,
+                                     &Position))
     {
         LARGE_INTEGER Length;
+        Entry = &CONTAINING_RECORD(Node, LOCK_RANGE_ENTRY, Node)->Lock;
+        Position.Start = Node->Start;
+        Position.Node = (ULONG_PTR)Node;
         // We'll take the first one to be the list head, and free the others first...
         Length.QuadPart =
             Entry->Exclusive.FileLock.EndingByte.QuadPart -
@@ -1282,7 +1516,7 @@ FsRtlUninitializeFileLock(IN PFILE_LOCK FileLock)
     {
         PIRP Irp;
         PLOCK_INFORMATION InternalInfo = FileLock->LockInformation;
-        PCOMBINED_LOCK_ELEMENT Entry;
+        PLOCK_RANGE_NODE Node;
         PLIST_ENTRY SharedEntry;
         PLOCK_SHARED_RANGE SharedRange;
         // MSDN: this completes any remaining lock IRPs
@@ -1291,12 +1525,13 @@ FsRtlUninitializeFileLock(IN PFILE_LOCK FileLock)
         {
             SharedRange = CONTAINING_RECORD(SharedEntry, LOCK_SHARED_RANGE, Entry);
             SharedEntry = SharedEntry->Flink;
-            RemoveEntryList(&SharedRange->Entry);
+            FsRtlpRemoveSharedRange(InternalInfo, SharedRange);
             ExFreePoolWithTag(SharedRange, TAG_RANGE);
         }
-        while ((Entry = RtlGetElementGenericTable(&InternalInfo->RangeTable, 0)) != NULL)
+        while ((Node = InternalInfo->RangeTree) != NULL)
         {
-            RtlDeleteElementGenericTable(&InternalInfo->RangeTable, Entry);
+            FsRtlpDeleteLockRange(InternalInfo,
+                                  &CONTAINING_RECORD(Node, LOCK_RANGE_ENTRY, Node)->Lock);
         }
         while ((Irp = IoCsqRemoveNextIrp(&InternalInfo->Csq, NULL)) != NULL)
         {
@@ -14,25 +14,39 @@
 #define NDEBUG
 #include <debug.h>
 
-#define MIN(x,y) (((x)<(y))?(x):(y))
-#define MAX(x,y) (((x)>(y))?(x):(y))
-
 /* GLOBALS *******************************************************************/
 
 PAGED_LOOKASIDE_LIST FsRtlFirstMappingLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlFastMutexLookasideList;
 
-/* We use only real 'mapping' runs; we do not store 'holes' to our GTree. */
+/*
+ * We use only real 'mapping' runs; we do not store 'holes' in our array.
+ * Runs are kept sorted by RunStartVbn and never overlap, so that any lookup
+ * is a binary search. Each run also caches its index in the public view of
+ * the MCB (that is, counting the holes in front of it), which lets index
+ * based lookups be binary searches as well.
+ *
+ * There is no bulk insert: the FsRtl MCB API has none, and file systems load
+ * their mappings one run at a time in VBN order. Such an append extends or
+ * goes after the last run, so it costs a binary search and no copying, and
+ * the array grows geometrically.
+ */
 typedef struct _LARGE_MCB_MAPPING_ENTRY // run
 {
     LARGE_INTEGER RunStartVbn;
     LARGE_INTEGER RunEndVbn;   /* RunStartVbn+SectorCount; that means +1 after the last sector */
     LARGE_INTEGER StartingLbn; /* Lbn of 'RunStartVbn' */
+    ULONG RunIndex;            /* Index of the run, holes included */
 } LARGE_MCB_MAPPING_ENTRY, *PLARGE_MCB_MAPPING_ENTRY;
 
+/* Number of runs stored along with the mapping, before we need an array */
+#define MCB_INLINE_RUN_COUNT 4
+
 typedef struct _LARGE_MCB_MAPPING // mcb_priv
 {
-    RTL_GENERIC_TABLE Table;
+    PLARGE_MCB_MAPPING_ENTRY Runs;
+    ULONG MaximumRunCount;
+    LARGE_MCB_MAPPING_ENTRY InlineRuns[MCB_INLINE_RUN_COUNT];
 } LARGE_MCB_MAPPING, *PLARGE_MCB_MAPPING;
 
 typedef struct _BASE_MCB_INTERNAL {
@@ -43,76 +57,189 @@ typedef struct _BASE_MCB_INTERNAL {
     PLARGE_MCB_MAPPING Mapping;
 } BASE_MCB_INTERNAL, *PBASE_MCB_INTERNAL;
 
+/* PRIVATE FUNCTIONS *********************************************************/
+
 /*
-static LARGE_MCB_MAPPING_ENTRY StaticRunBelow0 = {
-    {{-1}}, // ignored
-    {{0}},
-    {{-1}}, // ignored
-};
-*/
-
-static PVOID NTAPI McbMappingAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
+ * Returns the position of the first run ending after @Vbn, or the number of
+ * runs if there is none. If @Vbn is mapped, that is the run mapping it,
+ * otherwise @Vbn lies in the hole in front of that run.
+ */
+static
+ULONG
+McbFindRun(IN PBASE_MCB_INTERNAL Mcb,
+           IN LONGLONG Vbn)
 {
-    PVOID Result;
-    PBASE_MCB Mcb = (PBASE_MCB)Table->TableContext;
-    Result = ExAllocatePoolWithTag(Mcb->PoolType, Bytes, 'BCML');
-    DPRINT("McbMappingAllocate(%lu) => %p\n", Bytes, Result);
-    return Result;
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
+    ULONG Low = 0, High = Mcb->PairCount, Middle;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+
+        if (Runs[Middle].RunEndVbn.QuadPart <= Vbn)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    return Low;
 }
 
-static VOID NTAPI McbMappingFree(PRTL_GENERIC_TABLE Table, PVOID Buffer)
+/*
+ * Returns the position of the first run whose index is at least @RunIndex,
+ * or the number of runs if there is none.
+ */
+static
+ULONG
+McbFindRunByIndex(IN PBASE_MCB_INTERNAL Mcb,
+                  IN ULONG RunIndex)
 {
-    DPRINT("McbMappingFree(%p)\n", Buffer);
-    ExFreePoolWithTag(Buffer, 'BCML');
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
+    ULONG Low = 0, High = Mcb->PairCount, Middle;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+
+        if (Runs[Middle].RunIndex < RunIndex)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    return Low;
 }
 
+/* Returns the first VBN of the hole (possibly empty) in front of the run at @Position */
 static
-RTL_GENERIC_COMPARE_RESULTS
-NTAPI
-McbMappingCompare(PRTL_GENERIC_TABLE Table,
-                  PVOID PtrA,
-                  PVOID PtrB)
+LONGLONG
+McbHoleStartVbn(IN PBASE_MCB_INTERNAL Mcb,
+                IN ULONG Position)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    ASSERT(A);
-    ASSERT(B);
-
-    if (A->RunStartVbn.QuadPart == B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart == B->RunEndVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunEndVbn.QuadPart <= B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunEndVbn.QuadPart >= B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
-    else
+    if (Position == 0)
+        return 0;
+
+    return Mcb->Mapping->Runs[Position - 1].RunEndVbn.QuadPart;
+}
+
+/* Recomputes the cached run indexes, starting with the run at @Position */
+static
+VOID
+McbUpdateRunIndexes(IN PBASE_MCB_INTERNAL Mcb,
+                    IN ULONG Position)
+{
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
+    ULONG RunIndex;
+
+    RunIndex = (Position == 0) ? 0 : Runs[Position - 1].RunIndex + 1;
+
+    for (; Position < Mcb->PairCount; Position++)
+    {
+        if (Runs[Position].RunStartVbn.QuadPart > McbHoleStartVbn(Mcb, Position))
+            RunIndex++;
+
+        Runs[Position].RunIndex = RunIndex++;
+    }
+}
+
+/* Makes sure there is room for at least @RunCount runs in the mapping */
+static
+BOOLEAN
+McbReserveRuns(IN PBASE_MCB_INTERNAL Mcb,
+               IN ULONG RunCount)
+{
+    PLARGE_MCB_MAPPING Mapping = Mcb->Mapping;
+    PLARGE_MCB_MAPPING_ENTRY NewRuns;
+    ULONG NewMaximumRunCount;
+
+    if (RunCount <= Mapping->MaximumRunCount)
+        return TRUE;
+
+    /* Grow geometrically, so that appending runs stays cheap */
+    NewMaximumRunCount = Mapping->MaximumRunCount * 2;
+    if (NewMaximumRunCount < RunCount)
+        NewMaximumRunCount = RunCount;
+
+    NewRuns = ExAllocatePoolWithTag(Mcb->PoolType,
+                                    NewMaximumRunCount * sizeof(LARGE_MCB_MAPPING_ENTRY),
+                                    'BCML');
+    if (NewRuns == NULL)
     {
-        ASSERT(FALSE);
-        Res = GenericEqual;
+        DPRINT1("Failed to grow MCB %p to %lu runs\n", Mcb, NewMaximumRunCount);
+        return FALSE;
     }
 
-    return Res;
+    RtlCopyMemory(NewRuns, Mapping->Runs, Mcb->PairCount * sizeof(LARGE_MCB_MAPPING_ENTRY));
+
+    if (Mapping->Runs != Mapping->InlineRuns)
+        ExFreePoolWithTag(Mapping->Runs, 'BCML');
+
+    Mapping->Runs = NewRuns;
+    Mapping->MaximumRunCount = NewMaximumRunCount;
+    return TRUE;
 }
 
-static RTL_GENERIC_COMPARE_RESULTS NTAPI McbMappingIntersectCompare(PRTL_GENERIC_TABLE Table, PVOID PtrA, PVOID PtrB)
+/* Inserts a run at @Position. Room must have been reserved by the caller. */
+static
+VOID
+McbInsertRun(IN PBASE_MCB_INTERNAL Mcb,
+             IN ULONG Position,
+             IN LONGLONG StartVbn,
+             IN LONGLONG EndVbn,
+             IN LONGLONG StartingLbn)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    if (A->RunStartVbn.QuadPart <= B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart >= B->RunStartVbn.QuadPart && B->RunEndVbn.QuadPart > A->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart < B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunStartVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
-    else
-        Res = GenericEqual;
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
+
+    ASSERT(Mcb->PairCount < Mcb->Mapping->MaximumRunCount);
+    ASSERT(Position <= Mcb->PairCount);
+
+    RtlMoveMemory(&Runs[Position + 1],
+                  &Runs[Position],
+                  (Mcb->PairCount - Position) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+
+    Runs[Position].RunStartVbn.QuadPart = StartVbn;
+    Runs[Position].RunEndVbn.QuadPart = EndVbn;
+    Runs[Position].StartingLbn.QuadPart = StartingLbn;
+    ++Mcb->PairCount;
+}
+
+/* Deletes @Count runs starting at @Position */
+static
+VOID
+McbDeleteRuns(IN PBASE_MCB_INTERNAL Mcb,
+              IN ULONG Position,
+              IN ULONG Count)
+{
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
 
-    return Res;
+    ASSERT(Position + Count <= Mcb->PairCount);
+
+    RtlMoveMemory(&Runs[Position],
+                  &Runs[Position + Count],
+                  (Mcb->PairCount - Position - Count) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+    Mcb->PairCount -= Count;
 }
 
+/* Merges the run at @Position with the next one if they are contiguous, both in VBN and LBN */
+static
+VOID
+McbMergeWithNextRun(IN PBASE_MCB_INTERNAL Mcb,
+                    IN ULONG Position)
+{
+    PLARGE_MCB_MAPPING_ENTRY Runs = Mcb->Mapping->Runs;
+
+    if (Position + 1 >= Mcb->PairCount)
+        return;
+
+    if (Runs[Position].RunEndVbn.QuadPart != Runs[Position + 1].RunStartVbn.QuadPart ||
+        Runs[Position].StartingLbn.QuadPart + (Runs[Position].RunEndVbn.QuadPart - Runs[Position].RunStartVbn.QuadPart) != Runs[Position + 1].StartingLbn.QuadPart)
+    {
+        return;
+    }
+
+    Runs[Position].RunEndVbn.QuadPart = Runs[Position + 1].RunEndVbn.QuadPart;
+    McbDeleteRuns(Mcb, Position + 1, 1);
+}
 
 /* PUBLIC FUNCTIONS **********************************************************/
 
@@ -140,10 +267,10 @@ FsRtlAddBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
     BOOLEAN Result = TRUE;
     BOOLEAN IntResult;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY Node, NeedleRun;
-    PLARGE_MCB_MAPPING_ENTRY LowerRun, HigherRun;
-    BOOLEAN NewElement;
+    PLARGE_MCB_MAPPING_ENTRY Runs, LowerRun, HigherRun;
     LONGLONG IntLbn, IntSectorCount;
+    LONGLONG EndVbn;
+    ULONG Position;
 
     DPRINT("FsRtlAddBaseMcbEntry(%p, %I64d, %I64d, %I64d)\n", OpaqueMcb, Vbn, Lbn, SectorCount);
 
@@ -175,91 +302,71 @@ FsRtlAddBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
         }
     }
 
+    /* Make sure we will not fail half way. Merging never needs more than one slot. */
+    if (!McbReserveRuns(Mcb, Mcb->PairCount + 1))
+    {
+        Result = FALSE;
+        goto quit;
+    }
+
     /* clean any possible previous entries in our range */
     FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, SectorCount);
 
     // We need to map [Vbn, Vbn+SectorCount) to [Lbn, Lbn+SectorCount),
     // taking in account the fact that we need to merge these runs if
-    // they are adjacent or overlap, but fail if new run fully fits into another run
-
-    /* initially we think we will be inserted as a separate run */
-    Node.RunStartVbn.QuadPart = Vbn;
-    Node.RunEndVbn.QuadPart = Vbn + SectorCount;
-    Node.StartingLbn.QuadPart = Lbn;
-
-    /* optionally merge with lower run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunStartVbn.QuadPart - 1;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    NeedleRun.StartingLbn.QuadPart = ~0ULL;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((LowerRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (LowerRun->StartingLbn.QuadPart + (LowerRun->RunEndVbn.QuadPart - LowerRun->RunStartVbn.QuadPart) == Node.StartingLbn.QuadPart))
+    // they are adjacent. The range is now free, so the run found at
+    // Position (if any) starts at or after the end of the new run.
+    // NB: Two consecutive runs can only be merged, if actual LBNs also match!
+    EndVbn = Vbn + SectorCount;
+    Position = McbFindRun(Mcb, Vbn);
+    Runs = Mcb->Mapping->Runs;
+
+    LowerRun = NULL;
+    if (Position > 0 &&
+        Runs[Position - 1].RunEndVbn.QuadPart == Vbn &&
+        Runs[Position - 1].StartingLbn.QuadPart + (Vbn - Runs[Position - 1].RunStartVbn.QuadPart) == Lbn)
     {
-        ASSERT(LowerRun->RunEndVbn.QuadPart == Node.RunStartVbn.QuadPart);
-        Node.RunStartVbn.QuadPart = LowerRun->RunStartVbn.QuadPart;
-        Node.StartingLbn.QuadPart = LowerRun->StartingLbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, LowerRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting lower run found (%I64d,%I64d) Lbn: %I64d\n", LowerRun->RunStartVbn.QuadPart, LowerRun->RunEndVbn.QuadPart, LowerRun->StartingLbn.QuadPart);
+        LowerRun = &Runs[Position - 1];
+        DPRINT("Adjacent lower run found (%I64d,%I64d) Lbn: %I64d\n", LowerRun->RunStartVbn.QuadPart, LowerRun->RunEndVbn.QuadPart, LowerRun->StartingLbn.QuadPart);
     }
 
-    /* optionally merge with higher run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunEndVbn.QuadPart;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((HigherRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (Node.StartingLbn.QuadPart <= HigherRun->StartingLbn.QuadPart))
+    HigherRun = NULL;
+    if (Position < Mcb->PairCount &&
+        Runs[Position].RunStartVbn.QuadPart == EndVbn &&
+        Runs[Position].StartingLbn.QuadPart == Lbn + SectorCount)
     {
-        ASSERT(HigherRun->RunStartVbn.QuadPart == Node.RunEndVbn.QuadPart);
-        Node.RunEndVbn.QuadPart = HigherRun->RunEndVbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HigherRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting higher run found (%I64d,%I64d) Lbn: %I64d\n", HigherRun->RunStartVbn.QuadPart, HigherRun->RunEndVbn.QuadPart, HigherRun->StartingLbn.QuadPart);
+        HigherRun = &Runs[Position];
+        DPRINT("Adjacent higher run found (%I64d,%I64d) Lbn: %I64d\n", HigherRun->RunStartVbn.QuadPart, HigherRun->RunEndVbn.QuadPart, HigherRun->StartingLbn.QuadPart);
     }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-
-    /* finally insert the resulting run */
-    RtlInsertElementGenericTable(&Mcb->Mapping->Table, &Node, sizeof(Node), &NewElement);
-    ++Mcb->PairCount;
-    ASSERT(NewElement);
-
-    // NB: Two consecutive runs can only be merged, if actual LBNs also match!
-
-    /* 1.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |/////////////|
-                |
-                Node->RunStartVbn
-
-        2.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |//////|
-        |
-        Node->RunStartVbn
-
-        3.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |///|
-                |
-                Node->RunStartVbn
-
-        4.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |///////////////|
-        |
-        Node->RunStartVbn
 
+    if (LowerRun && HigherRun)
+    {
+        /* Exact fit, the new run glues the previous and next runs together */
+        LowerRun->RunEndVbn.QuadPart = HigherRun->RunEndVbn.QuadPart;
+        McbDeleteRuns(Mcb, Position, 1);
+        McbUpdateRunIndexes(Mcb, Position - 1);
+    }
+    else if (LowerRun)
+    {
+        /* Extend the previous run, this is the common case of a growing file */
+        LowerRun->RunEndVbn.QuadPart = EndVbn;
+        McbUpdateRunIndexes(Mcb, Position - 1);
+    }
+    else if (HigherRun)
+    {
+        /* Extend the next run downwards */
+        HigherRun->RunStartVbn.QuadPart = Vbn;
+        HigherRun->StartingLbn.QuadPart = Lbn;
+        McbUpdateRunIndexes(Mcb, Position);
+    }
+    else
+    {
+        /* Insert as a separate run */
+        McbInsertRun(Mcb, Position, Vbn, EndVbn, Lbn);
+        McbUpdateRunIndexes(Mcb, Position);
+    }
 
+    /*
     Situation with holes:
     1. Holes at both ends
     2. Hole at the right, new run merged with the previous run
@@ -337,48 +444,34 @@ FsRtlGetNextBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
 {
     BOOLEAN Result = FALSE;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run = NULL;
-    ULONG CurrentIndex = 0;
-    ULONGLONG LastVbn = 0;
-    ULONGLONG LastSectorCount = 0;
-
-    // Traverse the tree
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-    Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        // is the current index a hole?
-        if (Run->RunStartVbn.QuadPart > (LastVbn + LastSectorCount))
-        {
-            // Is this the index we're looking for?
-            if (RunIndex == CurrentIndex)
-            {
-                *Vbn = LastVbn + LastSectorCount;
-                *Lbn = -1;
-                *SectorCount = Run->RunStartVbn.QuadPart - *Vbn;
-
-                Result = TRUE;
-                goto quit;
-            }
-
-            CurrentIndex++;
-        }
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    ULONG Position;
 
-        if (RunIndex == CurrentIndex)
-        {
-            *Vbn = Run->RunStartVbn.QuadPart;
-            *Lbn = Run->StartingLbn.QuadPart;
-            *SectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+    Position = McbFindRunByIndex(Mcb, RunIndex);
+    if (Position == Mcb->PairCount)
+    {
+        goto quit;
+    }
 
-            Result = TRUE;
-            goto quit;
-        }
+    Run = &Mcb->Mapping->Runs[Position];
+    if (Run->RunIndex == RunIndex)
+    {
+        *Vbn = Run->RunStartVbn.QuadPart;
+        *Lbn = Run->StartingLbn.QuadPart;
+        *SectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+    }
+    else
+    {
+        /* The index we're looking for is the hole in front of this run */
+        ASSERT(Run->RunIndex == RunIndex + 1);
 
-        CurrentIndex++;
-        LastVbn = Run->RunStartVbn.QuadPart;
-        LastSectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+        *Vbn = McbHoleStartVbn(Mcb, Position);
+        *Lbn = -1;
+        *SectorCount = Run->RunStartVbn.QuadPart - *Vbn;
     }
 
+    Result = TRUE;
+
 quit:
     DPRINT("FsRtlGetNextBaseMcbEntry(%p, %d, %p, %p, %p) = %d (%I64d, %I64d, %I64d)\n", Mcb, RunIndex, Vbn, Lbn, SectorCount, Result, *Vbn, *Lbn, *SectorCount);
     return Result;
@@ -436,11 +529,8 @@ FsRtlInitializeBaseMcb(IN PBASE_MCB OpaqueMcb,
     Mcb->PoolType = PoolType;
     Mcb->PairCount = 0;
     Mcb->MaximumPairCount = MAXIMUM_PAIR_COUNT;
-    RtlInitializeGenericTable(&Mcb->Mapping->Table,
-                              McbMappingCompare,
-                              McbMappingAllocate,
-                              McbMappingFree,
-                              Mcb);
+    Mcb->Mapping->Runs = Mcb->Mapping->InlineRuns;
+    Mcb->Mapping->MaximumRunCount = MCB_INLINE_RUN_COUNT;
 }
 
 /*
@@ -511,38 +601,52 @@ FsRtlLookupBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
     OUT PULONG Index OPTIONAL)
 {
     BOOLEAN Result = FALSE;
-    ULONG i;
-    LONGLONG LastVbn = 0, LastLbn = 0, Count = 0;   // the last values we've found during traversal
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    LONGLONG HoleStartVbn;
+    ULONG Position;
 
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p)\n", OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index);
 
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &LastVbn, &LastLbn, &Count); i++)
+    // find the run mapping the target, or the run following the hole it lies in
+    Position = McbFindRun(Mcb, Vbn);
+    if (Position == Mcb->PairCount)
     {
-        // have we reached the target mapping?
-        if (Vbn < LastVbn + Count)
-        {
-            if (Lbn)
-            {
-                if (LastLbn == -1)
-                    *Lbn = -1;
-                else
-                    *Lbn = LastLbn + (Vbn - LastVbn);
-            }
-
-            if (SectorCountFromLbn)
-                *SectorCountFromLbn = LastVbn + Count - Vbn;
-            if (StartingLbn)
-                *StartingLbn = LastLbn;
-            if (SectorCountFromStartingLbn)
-                *SectorCountFromStartingLbn = LastVbn + Count - LastVbn;
-            if (Index)
-                *Index = i;
-
-            Result = TRUE;
-            goto quit;
-        }
+        goto quit;
+    }
+
+    Run = &Mcb->Mapping->Runs[Position];
+    HoleStartVbn = McbHoleStartVbn(Mcb, Position);
+
+    if (Vbn >= Run->RunStartVbn.QuadPart || Run->RunStartVbn.QuadPart == HoleStartVbn)
+    {
+        if (Lbn)
+            *Lbn = Run->StartingLbn.QuadPart + (Vbn - Run->RunStartVbn.QuadPart);
+        if (SectorCountFromLbn)
+            *SectorCountFromLbn = Run->RunEndVbn.QuadPart - Vbn;
+        if (StartingLbn)
+            *StartingLbn = Run->StartingLbn.QuadPart;
+        if (SectorCountFromStartingLbn)
+            *SectorCountFromStartingLbn = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+        if (Index)
+            *Index = Run->RunIndex;
+    }
+    else
+    {
+        if (Lbn)
+            *Lbn = -1;
+        if (SectorCountFromLbn)
+            *SectorCountFromLbn = Run->RunStartVbn.QuadPart - Vbn;
+        if (StartingLbn)
+            *StartingLbn = -1;
+        if (SectorCountFromStartingLbn)
+            *SectorCountFromStartingLbn = Run->RunStartVbn.QuadPart - HoleStartVbn;
+        if (Index)
+            *Index = Run->RunIndex - 1;
     }
 
+    Result = TRUE;
+
 quit:
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p) = %d (%I64d, %I64d, %I64d, %I64d, %d)\n",
            OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index, Result,
@@ -594,47 +698,27 @@ FsRtlLookupLastLargeMcbEntryAndIndex_internal(IN PBASE_MCB_INTERNAL Mcb,
                                               OUT PLONGLONG Lbn,
                                               OUT PULONG Index OPTIONAL)
 {
-    ULONG RunIndex = 0;
-    PLARGE_MCB_MAPPING_ENTRY Run, RunFound = NULL;
-    LONGLONG LastVbn = 0;
-
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        /* Take care when we must emulate missing 'hole' runs. */
-        if (Run->RunStartVbn.QuadPart > LastVbn)
-        {
-            RunIndex++;
-        }
-        LastVbn = Run->RunEndVbn.QuadPart;
-        RunIndex++;
-        RunFound = Run;
-    }
+    PLARGE_MCB_MAPPING_ENTRY RunFound;
 
-    if (!RunFound)
+    /* Last run is always a 'real' run */
+    if (Mcb->PairCount == 0)
     {
         return FALSE;
     }
 
+    RunFound = &Mcb->Mapping->Runs[Mcb->PairCount - 1];
+
     if (Vbn)
     {
         *Vbn = RunFound->RunEndVbn.QuadPart - 1;
     }
     if (Lbn)
     {
-        if (1)
-        {
-            *Lbn = RunFound->StartingLbn.QuadPart + (RunFound->RunEndVbn.QuadPart - RunFound->RunStartVbn.QuadPart) - 1;
-        }
-        else
-        {
-            *Lbn = ~0ULL;
-        }
+        *Lbn = RunFound->StartingLbn.QuadPart + (RunFound->RunEndVbn.QuadPart - RunFound->RunStartVbn.QuadPart) - 1;
     }
     if (Index)
     {
-        *Index = RunIndex - 1;
+        *Index = RunFound->RunIndex;
     }
 
     return TRUE;
@@ -741,16 +825,15 @@ ULONG
 NTAPI
 FsRtlNumberOfRunsInBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
     ULONG NumberOfRuns = 0;
-    LONGLONG Vbn, Lbn, Count;
-    int i;
 
     DPRINT("FsRtlNumberOfRunsInBaseMcb(%p)\n", OpaqueMcb);
 
-    // Count how many Mcb entries there are
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &Vbn, &Lbn, &Count); i++)
+    // The index of the last run tells how many Mcb entries there are, holes included
+    if (Mcb->PairCount != 0)
     {
-        NumberOfRuns++;
+        NumberOfRuns = Mcb->Mapping->Runs[Mcb->PairCount - 1].RunIndex + 1;
     }
 
     DPRINT("FsRtlNumberOfRunsInBaseMcb(%p) = %d\n", OpaqueMcb, NumberOfRuns);
@@ -797,8 +880,9 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
                         IN LONGLONG SectorCount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY NeedleRun;
     PLARGE_MCB_MAPPING_ENTRY HaystackRun;
+    LONGLONG EndVbn;
+    ULONG First, Position, Last;
     BOOLEAN Result = TRUE;
 
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, SectorCount);
@@ -815,82 +899,68 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
         goto quit;
     }
 
-    NeedleRun.RunStartVbn.QuadPart = Vbn;
-    NeedleRun.RunEndVbn.QuadPart = Vbn + SectorCount;
-    NeedleRun.StartingLbn.QuadPart = -1;
+    EndVbn = Vbn + SectorCount;
 
-    /* adjust/destroy all intersecting ranges */
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    while ((HaystackRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)))
+    /* find the first intersecting run, if any */
+    First = McbFindRun(Mcb, Vbn);
+    if (First == Mcb->PairCount ||
+        Mcb->Mapping->Runs[First].RunStartVbn.QuadPart >= EndVbn)
     {
-        if (HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunStartVbn.QuadPart)
-        {
-            LONGLONG HaystackRunEnd = HaystackRun->RunEndVbn.QuadPart;
-            ASSERT(HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunStartVbn.QuadPart);
-
-            HaystackRun->RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart;
-
-            if (HaystackRunEnd > NeedleRun.RunEndVbn.QuadPart)
-            {
-                /* The run we are deleting is included in the run we just truncated.
-                 * Add the tail back. */
-                LARGE_MCB_MAPPING_ENTRY TailRun;
-                BOOLEAN NewElement;
-
-                TailRun.RunStartVbn.QuadPart = NeedleRun.RunEndVbn.QuadPart;
-                TailRun.RunEndVbn.QuadPart = HaystackRunEnd;
-                TailRun.StartingLbn.QuadPart = HaystackRun->StartingLbn.QuadPart + (NeedleRun.RunEndVbn.QuadPart - HaystackRun->RunStartVbn.QuadPart);
-
-                Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-
-                RtlInsertElementGenericTable(&Mcb->Mapping->Table, &TailRun, sizeof(TailRun), &NewElement);
-                ++Mcb->PairCount;
-                ASSERT(NewElement);
+        goto quit;
+    }
 
-                Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-            }
-        }
-        else if (HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunEndVbn.QuadPart)
+    HaystackRun = &Mcb->Mapping->Runs[First];
+    if (HaystackRun->RunStartVbn.QuadPart < Vbn &&
+        HaystackRun->RunEndVbn.QuadPart > EndVbn)
+    {
+        /* The range we are deleting is included in this run.
+         * Truncate it and add the tail back. */
+        if (!McbReserveRuns(Mcb, Mcb->PairCount + 1))
         {
-            LONGLONG HaystackRunStart = HaystackRun->RunStartVbn.QuadPart;
-            LONGLONG HaystackStartingLbn = HaystackRun->StartingLbn.QuadPart;
-
-            ASSERT(HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunEndVbn.QuadPart);
-            HaystackRun->RunStartVbn.QuadPart = NeedleRun.RunEndVbn.QuadPart;
-            /* Adjust the starting LBN */
-            HaystackRun->StartingLbn.QuadPart += NeedleRun.RunEndVbn.QuadPart - HaystackRunStart;
+            Result = FALSE;
+            goto quit;
+        }
 
-            if (HaystackRunStart < NeedleRun.RunStartVbn.QuadPart)
-            {
-                /* The run we are deleting is included in the run we just truncated.
-                 * Add the head back. */
-                LARGE_MCB_MAPPING_ENTRY HeadRun;
-                BOOLEAN NewElement;
+        HaystackRun = &Mcb->Mapping->Runs[First];
+        McbInsertRun(Mcb,
+                     First + 1,
+                     EndVbn,
+                     HaystackRun->RunEndVbn.QuadPart,
+                     HaystackRun->StartingLbn.QuadPart + (EndVbn - HaystackRun->RunStartVbn.QuadPart));
+        HaystackRun->RunEndVbn.QuadPart = Vbn;
 
-                HeadRun.RunStartVbn.QuadPart = HaystackRunStart;
-                HeadRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart;
-                HeadRun.StartingLbn.QuadPart = HaystackStartingLbn;
+        McbUpdateRunIndexes(Mcb, First);
+        goto quit;
+    }
 
-                Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
+    /* adjust/destroy all intersecting ranges */
+    Position = First;
+    if (HaystackRun->RunStartVbn.QuadPart < Vbn)
+    {
+        /* Keep the head of the run crossing the start of the range */
+        HaystackRun->RunEndVbn.QuadPart = Vbn;
+        Position++;
+    }
 
-                RtlInsertElementGenericTable(&Mcb->Mapping->Table, &HeadRun, sizeof(HeadRun), &NewElement);
-                ++Mcb->PairCount;
-                ASSERT(NewElement);
+    /* Runs fully included in the range go away */
+    Last = Position;
+    while (Last < Mcb->PairCount &&
+           Mcb->Mapping->Runs[Last].RunEndVbn.QuadPart <= EndVbn)
+    {
+        Last++;
+    }
 
-                Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-            }
-        }
-        else
-        {
-            //ASSERT(NeedleRun.RunStartVbn.QuadPart >= HaystackRun->RunStartVbn.QuadPart);
-            //ASSERT(NeedleRun.RunEndVbn.QuadPart <= HaystackRun->RunEndVbn.QuadPart);
-            Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-            RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HaystackRun);
-            --Mcb->PairCount;
-            Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-        }
+    /* Keep the tail of the run crossing the end of the range */
+    if (Last < Mcb->PairCount &&
+        Mcb->Mapping->Runs[Last].RunStartVbn.QuadPart < EndVbn)
+    {
+        HaystackRun = &Mcb->Mapping->Runs[Last];
+        HaystackRun->StartingLbn.QuadPart += EndVbn - HaystackRun->RunStartVbn.QuadPart;
+        HaystackRun->RunStartVbn.QuadPart = EndVbn;
     }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
+
+    McbDeleteRuns(Mcb, Position, Last - Position);
+    McbUpdateRunIndexes(Mcb, First);
 
 quit:
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, SectorCount, Result);
@@ -921,14 +991,14 @@ NTAPI
 FsRtlResetBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Element;
 
     DPRINT("FsRtlResetBaseMcb(%p)\n", OpaqueMcb);
 
-    while (RtlNumberGenericTableElements(&Mcb->Mapping->Table) &&
-           (Element = (PLARGE_MCB_MAPPING_ENTRY)RtlGetElementGenericTable(&Mcb->Mapping->Table, 0)))
+    if (Mcb->Mapping->Runs != Mcb->Mapping->InlineRuns)
     {
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, Element);
+        ExFreePoolWithTag(Mcb->Mapping->Runs, 'BCML');
+        Mcb->Mapping->Runs = Mcb->Mapping->InlineRuns;
+        Mcb->Mapping->MaximumRunCount = MCB_INLINE_RUN_COUNT;
     }
 
     Mcb->PairCount = 0;
@@ -955,7 +1025,16 @@ FsRtlResetLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
+ * @Mcb: #PLARGE_MCB initialized by FsRtlInitializeLargeMcb().
+ * %NULL value is forbidden.
+ * @Vbn: Virtual block number where the hole is to be inserted.
+ * @Amount: Length of the hole to insert.
+ *
+ * Inserts a hole of @Amount blocks at @Vbn, shifting all the mappings
+ * at or above @Vbn up. A run crossing @Vbn is split in two.
+ *
+ * Returns: %TRUE if successful.
  */
 BOOLEAN
 NTAPI
@@ -964,54 +1043,60 @@ FsRtlSplitBaseMcb(IN PBASE_MCB OpaqueMcb,
                   IN LONGLONG Amount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run, InsertLowerRun = NULL, ExistingRun = NULL;
-    BOOLEAN NewElement;
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    ULONG First, Position;
+    BOOLEAN Result = TRUE;
 
     DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, Amount);
 
-    /* Traverse the tree */
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
+    if (Vbn < 0 || Amount < 0)
     {
-        /* unaffected run? */
-        /* FIXME: performance: effective skip of all 'lower' runs without traversing them */
-        if (Vbn >= Run->RunEndVbn.QuadPart) { DPRINT("Skipping it\n"); continue; }
-
-        /* crossing run to be split?
-        * 'lower_run' is created on the original place; just shortened.
-        * current 'run' is shifted up later
-        */
-        if (Vbn < Run->RunEndVbn.QuadPart)
-        {
-            /* FIXME: shift 'run->Lbn_start' ? */
-            Run->RunStartVbn.QuadPart = Vbn;
+        Result = FALSE;
+        goto quit;
+    }
 
-            InsertLowerRun = NULL;
-        }
+    /* Skip all the unaffected 'lower' runs at once */
+    First = McbFindRun(Mcb, Vbn);
+    Position = First;
 
-        /* Shift the current 'run'.
-        * Ordering is not changed in Generic Tree so I hope I do not need to reinsert it.
-        */
-        Run->RunStartVbn.QuadPart += Amount;
-        ASSERT(Run->RunEndVbn.QuadPart + Amount > Run->RunEndVbn.QuadPart); /* overflow? */
-        Run->RunEndVbn.QuadPart += Amount;
-        /* FIXME: shift 'run->Lbn_start' ? */
+    /* crossing run to be split? */
+    if (Position < Mcb->PairCount &&
+        Mcb->Mapping->Runs[Position].RunStartVbn.QuadPart < Vbn)
+    {
+        if (!McbReserveRuns(Mcb, Mcb->PairCount + 1))
+        {
+            Result = FALSE;
+            goto quit;
+        }
 
-        /* continue the traversal */
+        /* The lower part stays in place, the upper part is inserted already shifted */
+        Run = &Mcb->Mapping->Runs[Position];
+        McbInsertRun(Mcb,
+                     Position + 1,
+                     Vbn + Amount,
+                     Run->RunEndVbn.QuadPart + Amount,
+                     Run->StartingLbn.QuadPart + (Vbn - Run->RunStartVbn.QuadPart));
+        Run->RunEndVbn.QuadPart = Vbn;
+        Position += 2;
     }
 
-    if (InsertLowerRun)
+    /* Shift the remaining runs, ordering is not changed */
+    for (; Position < Mcb->PairCount; Position++)
     {
-        ExistingRun = RtlInsertElementGenericTable(&Mcb->Mapping->Table, InsertLowerRun, sizeof(*InsertLowerRun), &NewElement);
-        ++Mcb->PairCount;
+        Run = &Mcb->Mapping->Runs[Position];
+        ASSERT(Run->RunEndVbn.QuadPart + Amount >= Run->RunEndVbn.QuadPart); /* overflow? */
+        Run->RunStartVbn.QuadPart += Amount;
+        Run->RunEndVbn.QuadPart += Amount;
     }
 
-    ASSERT(ExistingRun == NULL);
+    /* An empty hole leaves the halves of a split run contiguous, join them back */
+    McbMergeWithNextRun(Mcb, First);
+    McbUpdateRunIndexes(Mcb, First);
 
-    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, TRUE);
+quit:
+    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, Result);
 
-    return TRUE;
+    return Result;
 }
 
 /*
@@ -1039,16 +1124,31 @@ FsRtlSplitLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 FsRtlTruncateBaseMcb(IN PBASE_MCB OpaqueMcb,
                      IN LONGLONG Vbn)
 {
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    ULONG Position;
+
     DPRINT("FsRtlTruncateBaseMcb(%p, %I64d)\n", OpaqueMcb, Vbn);
 
-    FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, MAXLONG - Vbn + 1);
+    if (Vbn < 0)
+        return;
+
+    /* Cut the run crossing Vbn and drop everything above it */
+    Position = McbFindRun(Mcb, Vbn);
+    if (Position < Mcb->PairCount &&
+        Mcb->Mapping->Runs[Position].RunStartVbn.QuadPart < Vbn)
+    {
+        Mcb->Mapping->Runs[Position].RunEndVbn.QuadPart = Vbn;
+        Position++;
+    }
+
+    Mcb->PairCount = Position;
 }
 
 /*
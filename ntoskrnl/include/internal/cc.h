@@ -66,6 +66,41 @@ extern ULONG CcPinMappedDataCount;
 extern ULONG CcDataPages;
 extern ULONG CcDataFlushes;
 
+//
+// Prefetcher
+//
+#define PF_ENABLE_APPLICATION_LAUNCH                    0x01
+#define PF_ENABLE_BOOT                                  0x02
+
+#define PF_SCENARIO_VERSION                             1
+#define PF_SCENARIO_MAGIC                               'ACCS'
+
+#define PFSN_TRACE_MAGIC                                'rTfP'
+
+typedef enum _PF_SCENARIO_TYPE
+{
+    PfApplicationLaunchScenarioType,
+    PfSystemBootScenarioType,
+    PfMaxScenarioType
+} PF_SCENARIO_TYPE;
+
+typedef enum _PF_BOOT_PHASE_ID
+{
+    PfKernelInitPhase = 0,
+    PfBootDriverInitPhase = 90,
+    PfSystemDriverInitPhase = 120,
+    PfSessionManagerInitPhase = 150,
+    PfSMRegistryInitPhase = 180,
+    PfVideoInitPhase = 210,
+    PfPostVideoInitPhase = 240,
+    PfBootAcceptedRegistryInitPhase = 270,
+    PfUserShellReadyPhase = 300,
+    PfMaxBootPhaseId = 900
+} PF_BOOT_PHASE_ID;
+
+extern BOOLEAN CcPfEnablePrefetcher;
+extern ULONG CcPfEnablePrefetcherMode;
+
 typedef struct _PF_SCENARIO_ID
 {
     WCHAR ScenName[30];
@@ -117,6 +152,39 @@ typedef struct _PF_TRACE_HEADER
     ULONGLONG Reserved[5];
 } PF_TRACE_HEADER, *PPF_TRACE_HEADER;
 
+//
+// Scenario files in \SystemRoot\Prefetch: the header, then the files, then
+// the runs sorted by file and offset, then the NUL terminated file names
+//
+typedef struct _PF_SCENARIO_HEADER
+{
+    ULONG Version;
+    ULONG MagicNumber;
+    ULONG Size;
+    PF_SCENARIO_ID ScenarioId;
+    ULONG ScenarioType; // PF_SCENARIO_TYPE
+    ULONG FileInfoOffset;
+    ULONG NumFiles;
+    ULONG RunInfoOffset;
+    ULONG NumRuns;
+    ULONG NumPages;
+} PF_SCENARIO_HEADER, *PPF_SCENARIO_HEADER;
+
+typedef struct _PF_FILE_INFO
+{
+    ULONG NameOffset;
+    USHORT NameLength; // in bytes, without the NUL
+    USHORT Reserved;
+} PF_FILE_INFO, *PPF_FILE_INFO;
+
+typedef struct _PF_RUN_INFO
+{
+    USHORT FileIndex;
+    USHORT IsImage;
+    ULONG StartPage; // image pages are counted from the image base
+    ULONG NumPages;
+} PF_RUN_INFO, *PPF_RUN_INFO;
+
 typedef struct _PFSN_TRACE_DUMP
 {
     LIST_ENTRY CompletedTracesLink;
@@ -153,6 +221,16 @@ typedef struct _PFSN_TRACE_HEADER
     LARGE_INTEGER LaunchTime;
     PPF_SECTION_INFO SectionInfo;
     ULONG SectionInfoCount;
+
+    /* ROS specific */
+    PFILE_OBJECT *Files;            /* referenced, indexed by the FileKey of the log entries */
+    ULONG NumFiles;
+    ULONG MaxFiles;
+    ULONG LastFileKey;
+    PVOID *PrefetchSections;        /* launch traces keep the prefetched pages around until they end */
+    ULONG NumPrefetchSections;
+    ULONG MaxPrefetchSections;
+    KEVENT PrefetchDoneEvent;
 } PFSN_TRACE_HEADER, *PPFSN_TRACE_HEADER;
 
 typedef struct _PFSN_PREFETCHER_GLOBALS
@@ -295,6 +373,32 @@ CcPfInitializePrefetcher(
     VOID
 );
 
+NTSTATUS
+NTAPI
+CcPfBeginBootPhase(
+    _In_ PF_BOOT_PHASE_ID Phase
+);
+
+NTSTATUS
+NTAPI
+CcPfBeginAppLaunch(
+    _In_ PEPROCESS Process
+);
+
+VOID
+NTAPI
+CcPfProcessExitNotification(
+    _In_ PEPROCESS Process
+);
+
+VOID
+NTAPI
+CcPfLogPageFault(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ ULONGLONG FileOffset,
+    _In_ BOOLEAN IsImage
+);
+
 VOID
 NTAPI
 CcMdlReadComplete2(
@@ -1105,6 +1105,12 @@ CmpLazyFlush(
     VOID
 );
 
+BOOLEAN
+NTAPI
+CmpFlushHive(
+    IN PCMHIVE CmHive
+);
+
 //
 // Open/Create Routines
 //
@@ -135,6 +135,7 @@ extern LIST_ENTRY KeBugcheckCallbackListHead, KeBugcheckReasonCallbackListHead;
 extern KSPIN_LOCK BugCheckCallbackLock;
 extern KDPC KiTimerExpireDpc;
 extern KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+extern const ULONG KiTimerCoalescingWindows[];
 extern FAST_MUTEX KiGenericCallDpcMutex;
 extern LIST_ENTRY KiProfileListHead, KiProfileSourceListHead;
 extern KSPIN_LOCK KiProfileLock;
@@ -300,6 +301,19 @@ KiInsertTreeTimer(
     IN LARGE_INTEGER Interval
 );
 
+/* The public declaration is only there for Windows 7 and later */
+#if (NTDDI_VERSION < NTDDI_WIN7)
+BOOLEAN
+NTAPI
+KeSetCoalescableTimer(
+    IN OUT PKTIMER Timer,
+    IN LARGE_INTEGER DueTime,
+    IN ULONG Period,
+    IN ULONG TolerableDelay,
+    IN PKDPC Dpc OPTIONAL
+);
+#endif
+
 VOID
 FASTCALL
 KiCompleteTimer(
@@ -943,6 +943,27 @@ KxInsertTimer(IN PKTIMER Timer,
     }
 }
 
+//
+// Called by KiComputeDueTime to move the due time of a coalescable timer
+// onto the next boundary of its coalescing window, so that timers with
+// a tolerable delay all expire on the same clock ticks. Coalescing only
+// ever delays a timer, it never makes it expire before its due time.
+//
+FORCEINLINE
+VOID
+KiCoalesceDueTime(IN PKTIMER Timer)
+{
+    ULONGLONG Window, DueTime;
+
+    /* Get the window size in 100ns units */
+    Window = KiTimerCoalescingWindows[Timer->Header.EncodedTolerableDelay];
+    if (!Window) return;
+
+    /* Round the due time up to the window */
+    DueTime = ((Timer->DueTime.QuadPart + Window - 1) / Window) * Window;
+    Timer->DueTime.QuadPart = max(DueTime, (ULONGLONG)Timer->DueTime.QuadPart);
+}
+
 //
 // Called by KeSetTimerEx and KiInsertTreeTimer to calculate Due Time
 // See the Windows HPI Blog for more information
@@ -987,6 +1008,9 @@ KiComputeDueTime(IN PKTIMER Timer,
     /* Recalculate due time */
     Timer->DueTime.QuadPart = InterruptTime.QuadPart - DueTime.QuadPart;
 
+    /* Line it up with other timers if it can be delayed */
+    if (Timer->Header.Coalescable) KiCoalesceDueTime(Timer);
+
     /* Get the handle */
     *Hand = KiComputeTimerTableIndex(Timer->DueTime.QuadPart);
     Timer->Header.Hand = (UCHAR)*Hand;
@@ -74,6 +74,22 @@ typedef struct _LPCP_DATA_INFO
     } Entries[1];
 } LPCP_DATA_INFO, *PLPCP_DATA_INFO;
 
+//
+// Shared message ring of a connected client/communication port pair.
+// Doorbell[n] is what the consumer of queue n waits on. The views belong
+// to the processes that mapped them, Mapped[n] only keeps each side from
+// mapping the ring twice.
+//
+typedef struct _LPCP_PORT_RING
+{
+    PVOID Section;
+    SIZE_T ViewSize;
+    KEVENT Doorbell[2];
+    BOOLEAN Mapped[2];
+    LONG ReferenceCount;
+    BOOLEAN Disconnected;
+} LPCP_PORT_RING, *PLPCP_PORT_RING;
+
 
 //
 // Internal Port Management
@@ -117,6 +133,12 @@ LpcpMoveMessage(
     IN PCLIENT_ID ClientId
 );
 
+VOID
+NTAPI
+LpcpDeletePortRing(
+    IN PLPCP_PORT_OBJECT Port
+);
+
 VOID
 NTAPI
 LpcpSaveDataInfoMessage(
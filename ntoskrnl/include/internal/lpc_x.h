@@ -16,8 +16,18 @@
 // Waits on an LPC semaphore for a receive operation
 //
 #define LpcpReceiveWait(s, w)                               \
+    LpcpHandoffReceiveWait(NULL, s, w)
+
+//
+// Releases the LPC semaphore h, if any, and waits on s for a receive
+// operation. The release keeps the dispatcher lock so that the processor
+// goes straight to the thread just woken, which requires that nothing at
+// all runs between the release and the wait.
+//
+#define LpcpHandoffReceiveWait(h, s, w)                     \
 {                                                           \
     LPCTRACE(LPC_REPLY_DEBUG, "Wait: %p\n", s);             \
+    if (h) KeReleaseSemaphore(h, 1, 1, TRUE);               \
     Status = KeWaitForSingleObject(s,                       \
                                    WrLpcReceive,            \
                                    w,                       \
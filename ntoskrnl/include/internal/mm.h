@@ -526,6 +526,7 @@ typedef struct _MMPAGING_FILE
     PFILE_OBJECT FileObject;
     UNICODE_STRING PageFileName;
     PRTL_BITMAP Bitmap;
+    ULONG HintIndex;
     HANDLE FileHandle;
 }
 MMPAGING_FILE, *PMMPAGING_FILE;
@@ -712,10 +713,33 @@ MmInitSystem(IN ULONG Phase,
 
 /* pagefile.c ****************************************************************/
 
+/* Largest run of pages moved to or from the paging file in one I/O (64 KiB) */
+#define MM_SWAP_CLUSTER_SIZE (0x10000 / PAGE_SIZE)
+
+/* Swap entries with this bit set name a slot of the compressed page store */
+#define MM_PAGE_STORE_ENTRY     0x200
+#define MM_IS_PAGE_STORE_ENTRY(E) (((E) & MM_PAGE_STORE_ENTRY) != 0)
+
+SWAPENTRY
+NTAPI
+MiAllocPageFileSlots(
+    _Inout_ PULONG Count);
+
 SWAPENTRY
 NTAPI
 MmAllocSwapPage(VOID);
 
+SWAPENTRY
+NTAPI
+MmAllocSwapPages(
+    _Inout_ PULONG Count);
+
+SWAPENTRY
+NTAPI
+MmAdvanceSwapEntry(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ ULONG Pages);
+
 VOID
 NTAPI
 MmFreeSwapPage(SWAPENTRY Entry);
@@ -736,6 +760,13 @@ MmReadFromSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count);
+
 NTSTATUS
 NTAPI
 MmWriteToSwapPage(
@@ -743,6 +774,13 @@ MmWriteToSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmWriteToSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count);
+
 VOID
 NTAPI
 MmShowOutOfSpaceMessagePagingFile(VOID);
@@ -754,6 +792,42 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset);
 
+/* pagestore.c ***************************************************************/
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MiInitializePageStore(VOID);
+
+SWAPENTRY
+NTAPI
+MiAllocPageStoreSlots(
+    _Inout_ PULONG Count);
+
+VOID
+NTAPI
+MiFreePageStoreSlot(
+    _In_ SWAPENTRY Entry);
+
+NTSTATUS
+NTAPI
+MiWritePageStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count);
+
+NTSTATUS
+NTAPI
+MiReadPageStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count);
+
+VOID
+NTAPI
+MmQueryPageStoreInformation(
+    _Out_ PSYSTEM_PAGE_STORE_INFORMATION StoreInformation);
+
 /* process.c ****************************************************************/
 
 NTSTATUS
@@ -981,7 +1055,9 @@ MmInitializeRmapList(VOID);
 
 NTSTATUS
 NTAPI
-MmPageOutPhysicalAddress(PFN_NUMBER Page);
+MmPageOutPhysicalAddress(
+    _In_ PFN_NUMBER Page,
+    _Out_opt_ PULONG PagesFreed);
 
 PMM_SECTION_SEGMENT
 NTAPI
@@ -1171,6 +1247,13 @@ MmIsDisabledPage(
     PVOID Address
 );
 
+BOOLEAN
+NTAPI
+MmIsDirtyPage(
+    _In_ PEPROCESS Process,
+    _In_ PVOID Address,
+    _Out_opt_ PBOOLEAN Accessed);
+
 CODE_SEG("INIT")
 VOID
 NTAPI
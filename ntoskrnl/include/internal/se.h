@@ -734,6 +734,45 @@ SeComputeQuotaInformationSize(
     _In_ PSECURITY_DESCRIPTOR SecurityDescriptor,
     _Out_ PULONG QuotaInfoSize);
 
+//
+// Access check cache functions
+//
+VOID
+NTAPI
+SepDeleteAccessCheckCache(
+    _In_ PTOKEN Token);
+
+BOOLEAN
+NTAPI
+SepIsAccessCheckCacheable(
+    _In_ PACL Dacl,
+    _In_opt_ PSID PrincipalSelfSid,
+    _In_opt_ POBJECT_TYPE_LIST_INTERNAL ObjectTypeList);
+
+BOOLEAN
+NTAPI
+SepLookupAccessCheckCache(
+    _In_ PTOKEN Token,
+    _In_ PACL Dacl,
+    _In_ PGENERIC_MAPPING GenericMapping,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ACCESS_MASK RemainingAccess,
+    _In_ ACCESS_MASK PreviouslyGrantedAccess,
+    _Out_ PACCESS_MASK GrantedAccess,
+    _Out_ PNTSTATUS AccessStatus);
+
+VOID
+NTAPI
+SepInsertAccessCheckCache(
+    _In_ PTOKEN Token,
+    _In_ PACL Dacl,
+    _In_ PGENERIC_MAPPING GenericMapping,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ACCESS_MASK RemainingAccess,
+    _In_ ACCESS_MASK PreviouslyGrantedAccess,
+    _In_ ACCESS_MASK GrantedAccess,
+    _In_ NTSTATUS AccessStatus);
+
 //
 // Security Reference Monitor (SeRm) functions
 //
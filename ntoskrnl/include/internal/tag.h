@@ -16,6 +16,7 @@
 #define TAG_SHARED_CACHE_MAP        'cScC'
 #define TAG_PRIVATE_CACHE_MAP       'cPcC'
 #define TAG_BCB                     'cBcC'
+#define TAG_PREFETCH                'fPcC'
 
 /* Executive Tags */
 #define TAG_CALLBACK_ROUTINE_BLOCK  'brbC'
@@ -112,6 +113,7 @@
 #define TAG_MM                  '  mM'
 #define TAG_MM_SECTION_SEGMENT  'SSMM'
 #define TAG_SECTION_PAGE_TABLE  'TPSM'
+#define TAG_MM_PAGE_STORE       'SPmM'
 
 /* Object Manager Tags */
 #define OB_NAME_TAG             'mNbO'
@@ -159,6 +161,7 @@
 #define TAG_SE_DIR_BUFFER       'bDeS'
 #define TAG_SE_PROXY_DATA       'dPoT'
 #define TAG_SE_TOKEN_LOCK       'lTeS'
+#define TAG_SE_ACCESS_CACHE     'cAcS'
 #define TAG_LOGON_SESSION       'sLeS'
 #define TAG_LOGON_NOTIFICATION  'nLeS'
 #define TAG_SID_AND_ATTRIBUTES  'aSeS'
@@ -169,5 +172,6 @@
 #define TAG_LPC_MESSAGE         'McpL'
 #define TAG_LPC_ZONE            'ZcpL'
 #define TAG_LPC_CONNECT_MESSAGE 'CCPL'
+#define TAG_LPC_RING            'RcpL'
 
 /* EOF */
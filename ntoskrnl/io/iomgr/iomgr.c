@@ -516,7 +516,7 @@ IoInitSystem(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     ExpireTime.QuadPart = -10000000;
     KeInitializeDpc(&IopTimerDpc, IopTimerDispatch, NULL);
     KeInitializeTimerEx(&IopTimer, SynchronizationTimer);
-    KeSetTimerEx(&IopTimer, ExpireTime, 1000, &IopTimerDpc);
+    KeSetCoalescableTimer(&IopTimer, ExpireTime, 1000, 1000, &IopTimerDpc);
 
     /* Create Object Types */
     if (!IopCreateObjectTypes())
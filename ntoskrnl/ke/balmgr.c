@@ -150,9 +150,9 @@ KeBalanceSetManager(IN PVOID Context)
     KeInitializeTimerEx(&PeriodTimer, SynchronizationTimer);
     KeInitializeDpc(&ScanDpc, KiScanReadyQueues, &KiReadyScanLast);
 
-    /* Setup the periodic timer */
+    /* Setup the periodic timer, it can share its tick with other timers */
     DueTime.QuadPart = -1 * 10 * 1000 * 1000;
-    KeSetTimerEx(&PeriodTimer, DueTime, 1000, &ScanDpc);
+    KeSetCoalescableTimer(&PeriodTimer, DueTime, 1000, 1000, &ScanDpc);
 
     /* Setup the wait objects */
     WaitObjects[0] = &PeriodTimer;
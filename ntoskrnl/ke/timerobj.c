@@ -19,6 +19,19 @@ LARGE_INTEGER KiTimeIncrementReciprocal;
 UCHAR KiTimeIncrementShiftCount;
 BOOLEAN KiEnableTimerWatchdog = FALSE;
 
+/*
+ * Coalescing windows of timers set with a tolerable delay, in 100ns units.
+ * The index is stored in the EncodedTolerableDelay field of the timer.
+ */
+const ULONG KiTimerCoalescingWindows[] =
+{
+    0,
+    50 * 10 * 1000,
+    100 * 10 * 1000,
+    250 * 10 * 1000,
+    1000 * 10 * 1000
+};
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 BOOLEAN
@@ -196,6 +209,69 @@ KiCompleteTimer(IN PKTIMER Timer,
     if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
 }
 
+static
+BOOLEAN
+KiSetTimer(IN OUT PKTIMER Timer,
+           IN LARGE_INTEGER DueTime,
+           IN LONG Period,
+           IN ULONG TolerableDelay,
+           IN PKDPC Dpc OPTIONAL)
+{
+    KIRQL OldIrql;
+    UCHAR Window;
+    BOOLEAN Inserted;
+    ULONG Hand = 0;
+    BOOLEAN RequestInterrupt = FALSE;
+    ASSERT_TIMER(Timer);
+    ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+    DPRINT("KiSetTimer(): Timer %p, DueTime %I64d, Period %d, Delay %lu, Dpc %p\n",
+           Timer, DueTime.QuadPart, Period, TolerableDelay, Dpc);
+
+    /* Pick the largest coalescing window that fits the tolerable delay */
+    Window = (UCHAR)(RTL_NUMBER_OF(KiTimerCoalescingWindows) - 1);
+    while ((Window > 0) &&
+           (KiTimerCoalescingWindows[Window] > (ULONGLONG)TolerableDelay * 10000))
+    {
+        Window--;
+    }
+
+    /* Lock the Database and Raise IRQL */
+    OldIrql = KiAcquireDispatcherLock();
+
+    /* Check if it's inserted, and remove it if it is */
+    Inserted = Timer->Header.Inserted;
+    if (Inserted) KxRemoveTreeTimer(Timer);
+
+    /* Set Default Timer Data */
+    Timer->Dpc = Dpc;
+    Timer->Period = Period;
+    Timer->Header.Coalescable = (Window != 0);
+    Timer->Header.EncodedTolerableDelay = Window;
+    if (!KiComputeDueTime(Timer, DueTime, &Hand))
+    {
+        /* Signal the timer */
+        RequestInterrupt = KiSignalTimer(Timer);
+
+        /* Release the dispatcher lock */
+        KiReleaseDispatcherLockFromSynchLevel();
+
+        /* Check if we need to do an interrupt */
+        if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
+    }
+    else
+    {
+        /* Insert the timer */
+        Timer->Header.SignalState = FALSE;
+        KxInsertTimer(Timer, Hand);
+    }
+
+    /* Exit the dispatcher */
+    KiExitDispatcher(OldIrql);
+
+    /* Return old state */
+    return Inserted;
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -296,47 +372,22 @@ KeSetTimerEx(IN OUT PKTIMER Timer,
              IN LONG Period,
              IN PKDPC Dpc OPTIONAL)
 {
-    KIRQL OldIrql;
-    BOOLEAN Inserted;
-    ULONG Hand = 0;
-    BOOLEAN RequestInterrupt = FALSE;
-    ASSERT_TIMER(Timer);
-    ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-    DPRINT("KeSetTimerEx(): Timer %p, DueTime %I64d, Period %d, Dpc %p\n",
-           Timer, DueTime.QuadPart, Period, Dpc);
-
-    /* Lock the Database and Raise IRQL */
-    OldIrql = KiAcquireDispatcherLock();
-
-    /* Check if it's inserted, and remove it if it is */
-    Inserted = Timer->Header.Inserted;
-    if (Inserted) KxRemoveTreeTimer(Timer);
-
-    /* Set Default Timer Data */
-    Timer->Dpc = Dpc;
-    Timer->Period = Period;
-    if (!KiComputeDueTime(Timer, DueTime, &Hand))
-    {
-        /* Signal the timer */
-        RequestInterrupt = KiSignalTimer(Timer);
-
-        /* Release the dispatcher lock */
-        KiReleaseDispatcherLockFromSynchLevel();
-
-        /* Check if we need to do an interrupt */
-        if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
-    }
-    else
-    {
-        /* Insert the timer */
-        Timer->Header.SignalState = FALSE;
-        KxInsertTimer(Timer, Hand);
-    }
-
-    /* Exit the dispatcher */
-    KiExitDispatcher(OldIrql);
+    /* Call the internal function without any tolerable delay */
+    return KiSetTimer(Timer, DueTime, Period, 0, Dpc);
+}
 
-    /* Return old state */
-    return Inserted;
+/*
+ * @implemented
+ */
+BOOLEAN
+NTAPI
+KeSetCoalescableTimer(IN OUT PKTIMER Timer,
+                      IN LARGE_INTEGER DueTime,
+                      IN ULONG Period,
+                      IN ULONG TolerableDelay,
+                      IN PKDPC Dpc OPTIONAL)
+{
+    /* Call the internal function */
+    return KiSetTimer(Timer, DueTime, Period, TolerableDelay, Dpc);
 }
 
@@ -364,6 +364,9 @@ LpcpDeletePort(IN PVOID ObjectBody)
     /* Destroy the port queue */
     LpcpDestroyPortQueue(Port, TRUE);
 
+    /* Let go of the shared message ring */
+    LpcpDeletePortRing(Port);
+
     /* Check if we had views */
     if ((Port->ClientSectionBase) || (Port->ServerSectionBase))
     {
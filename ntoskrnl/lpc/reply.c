@@ -369,7 +369,7 @@ NtReplyWaitReceivePortEx(IN HANDLE PortHandle,
     LARGE_INTEGER CapturedTimeout;
     PLPCP_PORT_OBJECT Port, ReceivePort, ConnectionPort = NULL;
     PLPCP_MESSAGE Message;
-    PETHREAD Thread = PsGetCurrentThread(), WakeupThread;
+    PETHREAD Thread = PsGetCurrentThread(), WakeupThread = NULL;
     PLPCP_CONNECTION_MESSAGE ConnectMessage;
     ULONG ConnectionInfoLength;
 
@@ -586,16 +586,19 @@ NtReplyWaitReceivePortEx(IN HANDLE PortHandle,
                                 CapturedReplyMessage.CallbackId,
                                 CapturedReplyMessage.ClientId);
 
-        /* Release the lock and release the LPC semaphore to wake up waiters */
+        /* Release the lock, the LPC semaphore is released below */
         KeReleaseGuardedMutex(&LpcpLock);
-        LpcpCompleteWait(&WakeupThread->LpcReplySemaphore);
-
-        /* Now we can let go of the thread */
-        ObDereferenceObject(WakeupThread);
     }
 
-    /* Now wait for someone to reply to us */
-    LpcpReceiveWait(ReceivePort->MsgQueue.Semaphore, WaitMode);
+    /* Now release the LPC semaphore to wake up the client, handing it the
+       processor, and wait for someone to reply to us */
+    LpcpHandoffReceiveWait(WakeupThread ? &WakeupThread->LpcReplySemaphore : NULL,
+                           ReceivePort->MsgQueue.Semaphore,
+                           WaitMode);
+
+    /* Now we can let go of the thread, which we couldn't do with the
+       dispatcher lock held */
+    if (WakeupThread) ObDereferenceObject(WakeupThread);
     if (Status != STATUS_SUCCESS) goto Cleanup;
 
     /* Wait done, get the LPC lock */
@@ -0,0 +1,368 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Local Procedure Call: Shared Message Rings
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+/* INCLUDES ******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+static
+ULONG
+LpcpGetRingSide(IN PLPCP_PORT_OBJECT Port)
+{
+    /* Clients produce requests and consume replies, servers the other way */
+    return ((Port->Flags & LPCP_PORT_TYPE_MASK) == LPCP_CLIENT_PORT) ?
+           PORT_RING_REQUEST_QUEUE : PORT_RING_REPLY_QUEUE;
+}
+
+static
+VOID
+LpcpFreePortRing(IN PLPCP_PORT_RING Ring)
+{
+    ObDereferenceObject(Ring->Section);
+    ExFreePoolWithTag(Ring, TAG_LPC_RING);
+}
+
+static
+NTSTATUS
+LpcpCreatePortRing(IN ULONG SlotCount,
+                   IN ULONG SlotSize,
+                   OUT PLPCP_PORT_RING *NewRing)
+{
+    PLPCP_PORT_RING Ring;
+    PPORT_RING Header;
+    LARGE_INTEGER SectionSize;
+    SIZE_T ViewSize = 0;
+    ULONG HeaderSize;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    /* Allocate the ring, one reference for each of the two ports */
+    Ring = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Ring), TAG_LPC_RING);
+    if (!Ring) return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Ring, sizeof(*Ring));
+    KeInitializeEvent(&Ring->Doorbell[PORT_RING_REQUEST_QUEUE], SynchronizationEvent, FALSE);
+    KeInitializeEvent(&Ring->Doorbell[PORT_RING_REPLY_QUEUE], SynchronizationEvent, FALSE);
+    Ring->ReferenceCount = 2;
+
+    /* The header gets its own cache line, then come both queues' slots */
+    HeaderSize = ALIGN_UP_BY(sizeof(PORT_RING), 64);
+    SectionSize.QuadPart = HeaderSize + 2 * SlotCount * SlotSize;
+    Status = MmCreateSection(&Ring->Section,
+                             SECTION_ALL_ACCESS,
+                             NULL,
+                             &SectionSize,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             NULL,
+                             NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Ring, TAG_LPC_RING);
+        return Status;
+    }
+
+    /* Lay out the header before either side gets to see it */
+    Status = MmMapViewInSystemSpace(Ring->Section, (PVOID*)&Header, &ViewSize);
+    if (!NT_SUCCESS(Status))
+    {
+        LpcpFreePortRing(Ring);
+        return Status;
+    }
+
+    Header->SlotCount = SlotCount;
+    Header->SlotSize = SlotSize;
+    Header->Queue[PORT_RING_REQUEST_QUEUE].SlotOffset = HeaderSize;
+    Header->Queue[PORT_RING_REPLY_QUEUE].SlotOffset = HeaderSize + SlotCount * SlotSize;
+    MmUnmapViewInSystemSpace(Header);
+
+    Ring->ViewSize = (SIZE_T)SectionSize.QuadPart;
+    *NewRing = Ring;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+LpcpDeletePortRing(IN PLPCP_PORT_OBJECT Port)
+{
+    PLPCP_PORT_RING Ring = Port->Ring;
+    ULONG Side = LpcpGetRingSide(Port);
+    LONG ReferenceCount;
+
+    PAGED_CODE();
+
+    if (!Ring) return;
+
+    /*
+     * Detach the ring from the port. Our view is left alone: the process
+     * may have unmapped it and put something else at the same address
+     * since, so it's up to the process to unmap it or to exit.
+     */
+    KeAcquireGuardedMutex(&LpcpLock);
+    Port->Ring = NULL;
+    Ring->Disconnected = TRUE;
+    ReferenceCount = --Ring->ReferenceCount;
+    KeReleaseGuardedMutex(&LpcpLock);
+
+    LPCTRACE(LPC_CLOSE_DEBUG, "Port: %p. Ring: %p. Side: %lu\n", Port, Ring, Side);
+
+    /* Whoever waits on the other end must not sleep forever */
+    KeSetEvent(&Ring->Doorbell[PORT_RING_REQUEST_QUEUE], IO_NO_INCREMENT, FALSE);
+    KeSetEvent(&Ring->Doorbell[PORT_RING_REPLY_QUEUE], IO_NO_INCREMENT, FALSE);
+
+    /* Free it once both ports are gone */
+    if (!ReferenceCount) LpcpFreePortRing(Ring);
+}
+
+/* PUBLIC FUNCTIONS **********************************************************/
+
+/*
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+NtMapPortRing(IN HANDLE PortHandle,
+              IN ULONG SlotCount,
+              OUT PVOID *RingBase)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PLPCP_PORT_OBJECT Port;
+    PLPCP_PORT_RING Ring, NewRing = NULL;
+    PEPROCESS Process = PsGetCurrentProcess();
+    PVOID Base = NULL;
+    SIZE_T ViewSize;
+    ULONG Side;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    /* The indexes wrap freely, so the slot count has to be a power of two */
+    if ((SlotCount < 2) ||
+        (SlotCount > PORT_RING_MAX_SLOTS) ||
+        (SlotCount & (SlotCount - 1)))
+    {
+        return STATUS_INVALID_PARAMETER_2;
+    }
+
+    /* Check for user mode access */
+    if (PreviousMode != KernelMode)
+    {
+        _SEH2_TRY
+        {
+            ProbeForWritePointer(RingBase);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* Reference the port */
+    Status = ObReferenceObjectByHandle(PortHandle,
+                                       0,
+                                       LpcPortObjectType,
+                                       PreviousMode,
+                                       (PVOID*)&Port,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Only the two ends of an established connection can share a ring */
+    if (((Port->Flags & LPCP_PORT_TYPE_MASK) != LPCP_CLIENT_PORT) &&
+        ((Port->Flags & LPCP_PORT_TYPE_MASK) != LPCP_COMMUNICATION_PORT))
+    {
+        ObDereferenceObject(Port);
+        return STATUS_INVALID_PORT_HANDLE;
+    }
+    Side = LpcpGetRingSide(Port);
+
+    /* Whichever side comes first creates the ring for both */
+    if (!Port->Ring)
+    {
+        Status = LpcpCreatePortRing(SlotCount,
+                                    ALIGN_UP_BY(Port->MaxMessageLength, sizeof(ULONGLONG)),
+                                    &NewRing);
+        if (!NT_SUCCESS(Status))
+        {
+            ObDereferenceObject(Port);
+            return Status;
+        }
+    }
+
+    KeAcquireGuardedMutex(&LpcpLock);
+
+    /* The other side may have beaten us to it in the meantime */
+    Ring = Port->Ring;
+    if (!Ring)
+    {
+        if (Port->ConnectedPort)
+        {
+            Ring = NewRing;
+            NewRing = NULL;
+            Port->Ring = Ring;
+            Port->ConnectedPort->Ring = Ring;
+        }
+        else
+        {
+            Status = STATUS_PORT_DISCONNECTED;
+        }
+    }
+
+    /* Each side maps the ring once; claim our view */
+    if (Ring)
+    {
+        if (Ring->Mapped[Side])
+        {
+            Status = STATUS_ALREADY_COMMITTED;
+        }
+        else
+        {
+            Ring->Mapped[Side] = TRUE;
+        }
+    }
+
+    KeReleaseGuardedMutex(&LpcpLock);
+
+    if (NewRing) LpcpFreePortRing(NewRing);
+    if (!NT_SUCCESS(Status))
+    {
+        ObDereferenceObject(Port);
+        return Status;
+    }
+
+    /* Map it into the caller */
+    ViewSize = Ring->ViewSize;
+    Status = MmMapViewOfSection(Ring->Section,
+                                Process,
+                                &Base,
+                                0,
+                                0,
+                                NULL,
+                                &ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_READWRITE);
+
+    if (!NT_SUCCESS(Status))
+    {
+        /* Let the caller try again */
+        KeAcquireGuardedMutex(&LpcpLock);
+        Ring->Mapped[Side] = FALSE;
+        KeReleaseGuardedMutex(&LpcpLock);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        LPCTRACE(LPC_CONNECT_DEBUG, "Port: %p. Ring: %p. Base: %p\n", Port, Ring, Base);
+
+        _SEH2_TRY
+        {
+            *RingBase = Base;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* The view stays mapped until the process goes away */
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+    }
+
+    ObDereferenceObject(Port);
+    return Status;
+}
+
+/*
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+NtSignalWaitPortRing(IN HANDLE PortHandle,
+                     IN ULONG Flags,
+                     IN PLARGE_INTEGER Timeout OPTIONAL)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    LARGE_INTEGER CapturedTimeout;
+    PLPCP_PORT_OBJECT Port;
+    PLPCP_PORT_RING Ring;
+    ULONG Side;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    if (!(Flags) || (Flags & ~(PORT_RING_SIGNAL | PORT_RING_WAIT)))
+        return STATUS_INVALID_PARAMETER_2;
+
+    /* Capture the timeout */
+    if ((Timeout) && (PreviousMode != KernelMode))
+    {
+        _SEH2_TRY
+        {
+            ProbeForReadLargeInteger(Timeout);
+            CapturedTimeout = *(volatile LARGE_INTEGER*)Timeout;
+            Timeout = &CapturedTimeout;
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* Reference the port */
+    Status = ObReferenceObjectByHandle(PortHandle,
+                                       0,
+                                       LpcPortObjectType,
+                                       PreviousMode,
+                                       (PVOID*)&Port,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* The ring only goes away with the port, which we hold on to */
+    Ring = Port->Ring;
+    if (!Ring)
+    {
+        ObDereferenceObject(Port);
+        return STATUS_INVALID_PORT_HANDLE;
+    }
+    if (Ring->Disconnected)
+    {
+        ObDereferenceObject(Port);
+        return STATUS_PORT_DISCONNECTED;
+    }
+    Side = LpcpGetRingSide(Port);
+
+    /* Ring the consumer of the queue we produce into. When we are going to
+     * wait right after, keep the dispatcher lock so that this processor
+     * switches directly to the thread we just woke up */
+    if (Flags & PORT_RING_SIGNAL)
+    {
+        KeSetEvent(&Ring->Doorbell[Side],
+                   EVENT_INCREMENT,
+                   (Flags & PORT_RING_WAIT) ? TRUE : FALSE);
+    }
+
+    /* Then wait for the other side to fill the queue we consume */
+    if (Flags & PORT_RING_WAIT)
+    {
+        Status = KeWaitForSingleObject(&Ring->Doorbell[Side ^ 1],
+                                       WrLpcReceive,
+                                       PreviousMode,
+                                       FALSE,
+                                       Timeout);
+        if ((Status == STATUS_SUCCESS) && (Ring->Disconnected))
+            Status = STATUS_PORT_DISCONNECTED;
+    }
+
+    ObDereferenceObject(Port);
+    return Status;
+}
+
+/* EOF */
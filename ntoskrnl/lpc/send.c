@@ -959,7 +959,9 @@ NtRequestWaitReplyPort(IN HANDLE PortHandle,
         }
     }
 
-    /* Now release the semaphore */
+    /* Now release the semaphore. This has to happen before APCs are enabled
+       again, or a suspend or terminate would leave the message queued with
+       the server never told about it, so no processor handoff here */
     LpcpCompleteWait(Semaphore);
     KeLeaveCriticalRegion();
 
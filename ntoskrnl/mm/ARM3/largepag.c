@@ -26,6 +26,22 @@ ULONG MmLargePageDriverBufferLength = -1;
 LIST_ENTRY MiLargePageDriverList;
 BOOLEAN MiLargePageAllDrivers;
 
+/* Size of the pages we hand out for MEM_LARGE_PAGES, zero if the CPU can't map them */
+SIZE_T MiLargePageSize;
+
+/* Physical pages needed before the kernel and HAL get large pages, zero for the default */
+ULONG MmLargePageMinimum;
+
+#define MI_LARGE_PAGE_PFNS              (PDE_MAPPED_VA >> PAGE_SHIFT)
+#define MI_DEFAULT_LARGE_PAGE_MINIMUM   ((255 * _1MB) >> PAGE_SHIFT)
+
+/* How long an allocation waits for the compaction helper before giving up */
+#define MI_LARGE_PAGE_COMPACTION_TIMEOUT    (-10 * 1000 * 1000 * 5)
+
+WORK_QUEUE_ITEM MiLargePageCompactionWorkItem;
+KEVENT MiLargePageCompactionEvent;
+LONG MiLargePageCompactionQueued;
+
 /* FUNCTIONS ******************************************************************/
 
 CODE_SEG("INIT")
@@ -45,7 +61,18 @@ MiInitializeLargePageSupport(VOID)
     /* Initialize the process tracking list, and insert the system process */
     InitializeListHead(&MmProcessList);
     InsertTailList(&MmProcessList, &PsGetCurrentProcess()->MmProcessLinks);
+
+#ifdef _M_IX86
+    /* The processor has to be able to map 4MB pages */
+    if ((KeFeatureBits & KF_LARGE_PAGE) && (__readcr4() & CR4_PSE))
+    {
+        MiLargePageSize = PDE_MAPPED_VA;
+    }
 #endif
+#endif
+
+    /* Nothing is being compacted yet */
+    KeInitializeEvent(&MiLargePageCompactionEvent, NotificationEvent, TRUE);
 }
 
 CODE_SEG("INIT")
@@ -101,4 +128,393 @@ MiInitializeDriverLargePageList(VOID)
     }
 }
 
+/* Counts the pages the compaction helper would have to page out to free this chunk */
+static
+ULONG
+MiCountLargePageEvictions(
+    _In_ PFN_NUMBER BasePage)
+{
+    PMMPFN Pfn1 = MI_PFN_ELEMENT(BasePage);
+    ULONG i, Count = 0;
+    KIRQL OldIrql;
+
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++, Pfn1++)
+    {
+        if (!MiIsPfnInUse(Pfn1)) continue;
+
+        /* Only mapped pages of the legacy memory manager can be paged out */
+        if (!MI_IS_ROS_PFN(Pfn1) || !Pfn1->RmapListHead)
+        {
+            Count = MAXULONG;
+            break;
+        }
+        Count++;
+    }
+    MiReleasePfnLock(OldIrql);
+
+    return Count;
+}
+
+/* Pages out whatever is in the way of the cheapest large page there is */
+static
+VOID
+NTAPI
+MiLargePageCompactionWorker(
+    _In_ PVOID Context)
+{
+    PPHYSICAL_MEMORY_RUN Run;
+    PFN_NUMBER Page, LastPage, BestPage = 0;
+    ULONG i, Count, BestCount = MAXULONG, Freed = 0;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    for (i = 0; (i < MmPhysicalMemoryBlock->NumberOfRuns) && (BestCount != 0); i++)
+    {
+        Run = &MmPhysicalMemoryBlock->Run[i];
+        LastPage = min(Run->BasePage + Run->PageCount, MmHighestPhysicalPage + 1);
+
+        for (Page = ALIGN_UP_BY(Run->BasePage, MI_LARGE_PAGE_PFNS);
+             Page + MI_LARGE_PAGE_PFNS <= LastPage;
+             Page += MI_LARGE_PAGE_PFNS)
+        {
+            Count = MiCountLargePageEvictions(Page);
+            if (Count < BestCount)
+            {
+                BestCount = Count;
+                BestPage = Page;
+                if (Count == 0) break;
+            }
+        }
+    }
+
+    if ((BestCount != MAXULONG) && (BestCount != 0))
+    {
+        for (Page = BestPage; Page < BestPage + MI_LARGE_PAGE_PFNS; Page++)
+        {
+            /* Keep the page around while it is paged out, like the balancer does */
+            OldIrql = MiAcquirePfnLock();
+            if (!MI_IS_ROS_PFN(MI_PFN_ELEMENT(Page)) || !MI_PFN_ELEMENT(Page)->RmapListHead)
+            {
+                MiReleasePfnLock(OldIrql);
+                continue;
+            }
+            MmReferencePage(Page);
+            MiReleasePfnLock(OldIrql);
+
+            if (NT_SUCCESS(MmPageOutPhysicalAddress(Page, NULL))) Freed++;
+
+            OldIrql = MiAcquirePfnLock();
+            MmDereferencePage(Page);
+            MiReleasePfnLock(OldIrql);
+        }
+
+        DPRINT("Large page compaction at %lx: %lu of %lu pages out\n", BestPage, Freed, BestCount);
+    }
+
+    InterlockedExchange(&MiLargePageCompactionQueued, 0);
+    KeSetEvent(&MiLargePageCompactionEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static
+PFN_NUMBER
+MiAllocateLargePage(VOID)
+{
+    LARGE_INTEGER Timeout;
+    PFN_NUMBER PageFrameIndex;
+    ULONG i;
+
+    /* Don't let large pages take what the rest of the system needs to run */
+    if (MmAvailablePages < MmMinimumFreePages + MI_LARGE_PAGE_PFNS) return 0;
+
+    PageFrameIndex = MiFindContiguousPages(0,
+                                           MmHighestPhysicalPage,
+                                           MI_LARGE_PAGE_PFNS,
+                                           MI_LARGE_PAGE_PFNS,
+                                           MmCached);
+    if (!PageFrameIndex)
+    {
+        /* Have the helper clear a chunk, unless it is already at it */
+        if (!InterlockedExchange(&MiLargePageCompactionQueued, 1))
+        {
+            KeClearEvent(&MiLargePageCompactionEvent);
+            ExInitializeWorkItem(&MiLargePageCompactionWorkItem, MiLargePageCompactionWorker, NULL);
+            ExQueueWorkItem(&MiLargePageCompactionWorkItem, DelayedWorkQueue);
+        }
+
+        Timeout.QuadPart = MI_LARGE_PAGE_COMPACTION_TIMEOUT;
+        KeWaitForSingleObject(&MiLargePageCompactionEvent, Executive, KernelMode, FALSE, &Timeout);
+
+        PageFrameIndex = MiFindContiguousPages(0,
+                                               MmHighestPhysicalPage,
+                                               MI_LARGE_PAGE_PFNS,
+                                               MI_LARGE_PAGE_PFNS,
+                                               MmCached);
+        if (!PageFrameIndex) return 0;
+    }
+
+    /* Private memory starts out zeroed */
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++) MiZeroPhysicalPage(PageFrameIndex + i);
+
+    return PageFrameIndex;
+}
+
+static
+VOID
+MiFreeLargePage(
+    _In_ PFN_NUMBER PageFrameIndex)
+{
+    PMMPFN Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+    ULONG i;
+    KIRQL OldIrql;
+
+    OldIrql = MiAcquirePfnLock();
+
+    /* These are the pages MiFindContiguousPages set up for us */
+    ASSERT(Pfn1->u3.e1.StartOfAllocation == 1);
+    ASSERT((Pfn1 + MI_LARGE_PAGE_PFNS - 1)->u3.e1.EndOfAllocation == 1);
+    Pfn1->u3.e1.StartOfAllocation = 0;
+    (Pfn1 + MI_LARGE_PAGE_PFNS - 1)->u3.e1.EndOfAllocation = 0;
+
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++, Pfn1++)
+    {
+        ASSERT(Pfn1->u3.e1.PageLocation == ActiveAndValid);
+        ASSERT(Pfn1->u2.ShareCount == 1);
+
+        /* Set the special pending delete marker, the last reference frees it */
+        MI_SET_PFN_DELETED(Pfn1);
+        MiDecrementShareCount(Pfn1, PageFrameIndex + i);
+    }
+    MiReleasePfnLock(OldIrql);
+}
+
+NTSTATUS
+NTAPI
+MiAllocateLargePages(
+    _Out_writes_(Count) PPFN_NUMBER PageFrames,
+    _In_ ULONG Count)
+{
+    ULONG i;
+
+    PAGED_CODE();
+    ASSERT(MiLargePageSize != 0);
+
+    for (i = 0; i < Count; i++)
+    {
+        PageFrames[i] = MiAllocateLargePage();
+        if (!PageFrames[i])
+        {
+            DPRINT1("Out of large pages after %lu of %lu\n", i, Count);
+            MiFreeLargePages(PageFrames, i);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+MiFreeLargePages(
+    _In_reads_(Count) PPFN_NUMBER PageFrames,
+    _In_ ULONG Count)
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++) MiFreeLargePage(PageFrames[i]);
+}
+
+NTSTATUS
+NTAPI
+MiMapLargePageVad(
+    _In_ PEPROCESS Process,
+    _In_ PMMVAD Vad,
+    _In_ PPFN_NUMBER PageFrames)
+{
+    PETHREAD CurrentThread = PsGetCurrentThread();
+    PMMPDE PointerPde, LastPde;
+    MMPDE TempPde;
+    ULONG i = 0;
+
+    PointerPde = MiAddressToPde(Vad->StartingVpn << PAGE_SHIFT);
+    LastPde = MiAddressToPde(Vad->EndingVpn << PAGE_SHIFT);
+
+    /* The process may have gone away since the VAD was inserted, and took the VAD along */
+    MmLockAddressSpace(&Process->Vm);
+    if (Process->VmDeleted)
+    {
+        MmUnlockAddressSpace(&Process->Vm);
+        MiFreeLargePages(PageFrames, (ULONG)(LastPde - PointerPde + 1));
+        return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    MiLockProcessWorkingSetUnsafe(Process, CurrentThread);
+    do
+    {
+        /* Faults in large page VADs are refused, so nobody built a page table here */
+        ASSERT(PointerPde->u.Long == 0);
+
+        MI_MAKE_HARDWARE_PTE_USER(&TempPde,
+                                  MiPdeToPte(PointerPde),
+                                  Vad->u.VadFlags.Protection,
+                                  PageFrames[i++]);
+        TempPde.u.Hard.LargePage = 1;
+        MI_WRITE_VALID_PDE(PointerPde, TempPde);
+    } while (++PointerPde <= LastPde);
+    MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
+
+    MmUnlockAddressSpace(&Process->Vm);
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+MiDeleteLargePageVad(
+    _In_ PEPROCESS Process,
+    _In_ PMMVAD Vad)
+{
+    PMMPDE PointerPde, LastPde;
+    PFN_NUMBER PageFrameIndex;
+    BOOLEAN Flush = FALSE;
+
+    ASSERT(Vad->u.VadFlags.VadType == VadLargePages);
+    ASSERT(PsGetCurrentThread()->OwnsProcessWorkingSetExclusive);
+
+    PointerPde = MiAddressToPde(Vad->StartingVpn << PAGE_SHIFT);
+    LastPde = MiAddressToPde(Vad->EndingVpn << PAGE_SHIFT);
+    do
+    {
+        /* The VAD may be torn down before its pages were mapped */
+        if (!PointerPde->u.Long) continue;
+
+        ASSERT(MI_IS_PAGE_LARGE(PointerPde));
+        PageFrameIndex = PFN_FROM_PTE(PointerPde);
+        PointerPde->u.Long = 0;
+        Flush = TRUE;
+
+        MiFreeLargePage(PageFrameIndex);
+    } while (++PointerPde <= LastPde);
+
+    if (Flush) KeFlushProcessTb();
+}
+
+/* Maps one PDE worth of an image with a large page if the loader put it there contiguously */
+static
+BOOLEAN
+MiMapKernelChunk(
+    _In_ ULONG_PTR Va)
+{
+#if (_MI_PAGING_LEVELS == 2)
+    PMMPDE PointerPde = MiAddressToPde(Va), PageDirectory;
+    PMMPTE PointerPte = MiAddressToPte(Va);
+    PFN_NUMBER BasePage = PFN_FROM_PTE(PointerPte);
+    PLIST_ENTRY NextEntry;
+    PEPROCESS Process;
+    MMPDE TempPde;
+    ULONG i, Index;
+    KIRQL OldIrql, HyperIrql;
+
+    if (!PointerPde->u.Hard.Valid || MI_IS_PAGE_LARGE(PointerPde)) return FALSE;
+    if (BasePage & (MI_LARGE_PAGE_PFNS - 1)) return FALSE;
+
+    /* Discarded sections and anything the loader scattered stay on small pages */
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++)
+    {
+        if (!PointerPte[i].u.Hard.Valid ||
+            PointerPte[i].u.Hard.CacheDisable ||
+            (PFN_FROM_PTE(&PointerPte[i]) != BasePage + i))
+        {
+            return FALSE;
+        }
+    }
+
+    /*
+     * Section protections can't be kept on a large page. The old page table
+     * stays as it is, address spaces that still point at it see the same pages.
+     */
+    TempPde = *PointerPde;
+    TempPde.u.Hard.PageFrameNumber = BasePage;
+    TempPde.u.Hard.LargePage = 1;
+    TempPde.u.Long |= PTE_READWRITE;
+    MI_MAKE_ACCESSED_PAGE(&TempPde);
+    MI_MAKE_DIRTY_PAGE(&TempPde);
+    TempPde.u.Hard.Global = PointerPte->u.Hard.Global;
+
+    /* Every address space has its own copy of the system PDEs */
+    Index = MiGetPdeOffset(Va);
+    OldIrql = MiAcquireExpansionLock();
+    MmSystemPagePtes[Index] = TempPde;
+    for (NextEntry = MmProcessList.Flink; NextEntry != &MmProcessList; NextEntry = NextEntry->Flink)
+    {
+        Process = CONTAINING_RECORD(NextEntry, EPROCESS, MmProcessLinks);
+        PageDirectory = MiMapPageInHyperSpace(PsGetCurrentProcess(),
+                                              Process->Pcb.DirectoryTableBase[0] >> PAGE_SHIFT,
+                                              &HyperIrql);
+        PageDirectory[Index] = TempPde;
+        MiUnmapPageInHyperSpace(PsGetCurrentProcess(), PageDirectory, HyperIrql);
+    }
+    *PointerPde = TempPde;
+    MiReleaseExpansionLock(OldIrql);
+
+    /* The resource section can't be made writable or read-only on its own anymore */
+    if ((MiKernelResourceStartPte) &&
+        (MiKernelResourceStartPte < PointerPte + MI_LARGE_PAGE_PFNS) &&
+        (MiKernelResourceEndPte > PointerPte))
+    {
+        MiKernelResourceStartPte = NULL;
+        MiKernelResourceEndPte = NULL;
+    }
+
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+VOID
+NTAPI
+MiMapKernelWithLargePages(VOID)
+{
+    PLDR_DATA_TABLE_ENTRY LdrEntry;
+    PLIST_ENTRY NextEntry;
+    ULONG_PTR Va, EndVa;
+    ULONG i, Count = 0;
+
+    if (!MiLargePageSize) return;
+
+    /* Small machines can't afford the memory the discarded sections would have given back */
+    if (MmNumberOfPhysicalPages < (MmLargePageMinimum ? MmLargePageMinimum : MI_DEFAULT_LARGE_PAGE_MINIMUM))
+    {
+        return;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite(&PsLoadedModuleResource, TRUE);
+
+    /* The kernel comes first, then the HAL */
+    NextEntry = PsLoadedModuleList.Flink;
+    for (i = 0; (i < 2) && (NextEntry != &PsLoadedModuleList); i++, NextEntry = NextEntry->Flink)
+    {
+        LdrEntry = CONTAINING_RECORD(NextEntry, LDR_DATA_TABLE_ENTRY, InLoadOrderLinks);
+
+        /* Only chunks the image covers entirely, its neighbours may be unloaded */
+        Va = ALIGN_UP_BY((ULONG_PTR)LdrEntry->DllBase, PDE_MAPPED_VA);
+        EndVa = ALIGN_DOWN_BY((ULONG_PTR)LdrEntry->DllBase + LdrEntry->SizeOfImage, PDE_MAPPED_VA);
+        for (; Va < EndVa; Va += PDE_MAPPED_VA)
+        {
+            if (MiMapKernelChunk(Va)) Count++;
+        }
+    }
+
+    ExReleaseResourceLite(&PsLoadedModuleResource);
+    KeLeaveCriticalRegion();
+
+    if (Count)
+    {
+        KeFlushEntireTb(TRUE, TRUE);
+        DPRINT1("Kernel and HAL mapped with %lu large pages\n", Count);
+    }
+}
+
 /* EOF */
@@ -1196,7 +1196,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
                (PointerPpe->u.Hard.Valid == 0) ||
 #endif
                (PointerPde->u.Hard.Valid == 0) ||
-               (PointerPte->u.Hard.Valid == 0))
+               (!MI_IS_PAGE_LARGE(PointerPde) && (PointerPte->u.Hard.Valid == 0)))
         {
             //
             // What kind of lock were we using?
@@ -1250,7 +1250,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
         //
         // Check if this was a write or modify
         //
-        if (Operation != IoReadAccess)
+        if ((Operation != IoReadAccess) && !MI_IS_PAGE_LARGE(PointerPde))
         {
             //
             // Check if the PTE is not writable
@@ -1331,9 +1331,17 @@ MmProbeAndLockPages(IN PMDL Mdl,
         }
 
         //
-        // Grab the PFN
+        // Grab the PFN, large pages are mapped read/write and have no PTEs
         //
-        PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        if (MI_IS_PAGE_LARGE(PointerPde))
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPde) +
+                             MiAddressToPteOffset(MiPteToAddress(PointerPte));
+        }
+        else
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        }
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
         if (Pfn1)
         {
@@ -1842,18 +1850,6 @@ MmUnmapReservedMapping(
                        MDL_FREE_EXTRA_PTES);
 }
 
-/*
- * @unimplemented
- */
-NTSTATUS
-NTAPI
-MmPrefetchPages(IN ULONG NumberOfLists,
-                IN PREAD_LIST *ReadLists)
-{
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
-}
-
 /*
  * @unimplemented
  */
@@ -540,6 +540,8 @@ extern BOOLEAN MmMirroring;
 extern BOOLEAN MmMakeLowMemory;
 extern BOOLEAN MmEnforceWriteProtection;
 extern SIZE_T MmAllocationFragment;
+extern ULONG MmFaultAroundSize;
+extern ULONG MmPageStorePercent;
 extern ULONG MmConsumedPoolPercentage;
 extern ULONG MmVerifyDriverBufferType;
 extern ULONG MmVerifyDriverLevel;
@@ -547,6 +549,9 @@ extern WCHAR MmVerifyDriverBuffer[512];
 extern WCHAR MmLargePageDriverBuffer[512];
 extern LIST_ENTRY MiLargePageDriverList;
 extern BOOLEAN MiLargePageAllDrivers;
+extern SIZE_T MiLargePageSize;
+extern ULONG MmLargePageMinimum;
+extern PMMPTE MiKernelResourceStartPte, MiKernelResourceEndPte;
 extern ULONG MmVerifyDriverBufferLength;
 extern ULONG MmLargePageDriverBufferLength;
 extern SIZE_T MmSizeOfNonPagedPoolInBytes;
@@ -2162,6 +2167,41 @@ MiSyncCachedRanges(
     VOID
 );
 
+NTSTATUS
+NTAPI
+MiAllocateLargePages(
+    _Out_writes_(Count) PPFN_NUMBER PageFrames,
+    _In_ ULONG Count
+);
+
+VOID
+NTAPI
+MiFreeLargePages(
+    _In_reads_(Count) PPFN_NUMBER PageFrames,
+    _In_ ULONG Count
+);
+
+NTSTATUS
+NTAPI
+MiMapLargePageVad(
+    _In_ PEPROCESS Process,
+    _In_ PMMVAD Vad,
+    _In_ PPFN_NUMBER PageFrames
+);
+
+VOID
+NTAPI
+MiDeleteLargePageVad(
+    _In_ PEPROCESS Process,
+    _In_ PMMVAD Vad
+);
+
+VOID
+NTAPI
+MiMapKernelWithLargePages(
+    VOID
+);
+
 BOOLEAN
 NTAPI
 MiIsPfnInUse(
@@ -204,9 +204,10 @@ MmDbgCopyMemory(IN ULONG64 Address,
             /* FIXME */
         }
 
-        /* If we are going to write to the address, then check if its writable */
+        /* If we are going to write to the address, then check if its writable (large pages always are) */
         PointerPte = MiAddressToPte(TargetAddress);
         if ((Flags & MMDBG_COPY_WRITE) &&
+            (!MI_IS_PHYSICAL_ADDRESS(TargetAddress)) &&
             (!MI_IS_PAGE_WRITEABLE(PointerPte)))
         {
             /* Not writable, we need to do a physical copy */
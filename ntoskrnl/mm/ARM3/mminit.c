@@ -2461,7 +2461,7 @@ MmArmInitSystem(IN ULONG Phase,
         /* Now setup the shared user data fields */
         ASSERT(SharedUserData->NumberOfPhysicalPages == 0);
         SharedUserData->NumberOfPhysicalPages = MmNumberOfPhysicalPages;
-        SharedUserData->LargePageMinimum = 0;
+        SharedUserData->LargePageMinimum = (ULONG)MiLargePageSize;
 
         /* Check for workstation (Wi for WinNT) */
         if (MmProductType == '\0i\0W')
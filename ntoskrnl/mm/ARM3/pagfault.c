@@ -953,7 +953,8 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     /* Release the PFN lock while we proceed */
     MiReleasePfnLock(*OldIrql);
 
-    /* Do the paging IO */
+    /* Do the paging IO, this is a hard fault for the process */
+    InterlockedIncrement((PLONG)&CurrentProcess->Vm.HardFaultCount);
     Status = MiReadPageFile(Page, PageFileIndex, PageFileOffset);
 
     /* Lock the PFN database again */
@@ -2235,6 +2236,13 @@ UserFault:
             return Status;
         }
 
+        /* Large page VADs get their PDEs when they are created, before that they can't be used */
+        if ((Vad) && (Vad->u.VadFlags.VadType == VadLargePages))
+        {
+            MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+            return STATUS_ACCESS_VIOLATION;
+        }
+
         /* Resolve a demand zero fault */
         Status = MiResolveDemandZeroFault(PointerPte,
                                  PointerPde,
@@ -2262,10 +2270,11 @@ UserFault:
         ASSERT(KeAreAllApcsDisabled() == TRUE);
         ASSERT(PointerPde->u.Hard.Valid == 1);
     }
-    else
+    else if (MI_IS_PAGE_LARGE(PointerPde))
     {
-        /* Not yet implemented in ReactOS */
-        ASSERT(MI_IS_PAGE_LARGE(PointerPde) == FALSE);
+        /* Large pages are resident and read/write, so this was a stale TLB entry */
+        MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+        return STATUS_SUCCESS;
     }
 
     /* Now capture the PTE. */
@@ -1310,11 +1310,20 @@ MmCleanProcessAddressSpace(IN PEPROCESS Process)
         ASSERT(VadTree->NumberGenericTableElements >= 1);
         MiRemoveNode((PMMADDRESS_NODE)Vad, VadTree);
 
-        /* Only regular VADs supported for now */
-        ASSERT(Vad->u.VadFlags.VadType == VadNone);
+        /* Only regular and large page VADs supported for now */
+        ASSERT((Vad->u.VadFlags.VadType == VadNone) ||
+               (Vad->u.VadFlags.VadType == VadLargePages));
 
+        /* Large pages have no PTEs, the pages go back directly */
+        if (Vad->u.VadFlags.VadType == VadLargePages)
+        {
+            MiDeleteLargePageVad(Process, Vad);
+
+            /* Release the working set */
+            MiUnlockProcessWorkingSetUnsafe(Process, Thread);
+        }
         /* Check if this is a section VAD */
-        if (!(Vad->u.VadFlags.PrivateMemory) && (Vad->ControlArea))
+        else if (!(Vad->u.VadFlags.PrivateMemory) && (Vad->ControlArea))
         {
             /* Remove the view */
             MiRemoveMappedView(Process, Vad);
@@ -1912,6 +1912,16 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
             ASSERT(NT_SUCCESS(Status));
         }
     }
+    else if (Vad->u.VadFlags.VadType == VadLargePages)
+    {
+        /* Large pages are committed as a whole with one protection, there are no PTEs to look at */
+        MemoryInfo.BaseAddress = PAGE_ALIGN(BaseAddress);
+        MemoryInfo.AllocationBase = (PVOID)(Vad->StartingVpn << PAGE_SHIFT);
+        MemoryInfo.AllocationProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
+        MemoryInfo.Protect = MemoryInfo.AllocationProtect;
+        MemoryInfo.State = MEM_COMMIT;
+        MemoryInfo.RegionSize = ((Vad->EndingVpn + 1) << PAGE_SHIFT) - (ULONG_PTR)MemoryInfo.BaseAddress;
+    }
     else
     {
         /* Build the initial information block */
@@ -4473,6 +4483,8 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     PMMPTE PointerPte, LastPte;
     PMMPDE PointerPde;
     TABLE_SEARCH_RESULT Result;
+    PPFN_NUMBER LargePages = NULL;
+    ULONG LargePageCount = 0;
     PAGED_CODE();
 
     /* Check for valid Zero bits */
@@ -4651,14 +4663,44 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     }
 
     //
-    // Fail on the things we don't yet support
+    // Large pages are reserved and committed in one go, in whole pages, and
+    // can't change protection later on
     //
-    if ((AllocationType & MEM_LARGE_PAGES) == MEM_LARGE_PAGES)
+    if (AllocationType & MEM_LARGE_PAGES)
     {
-        DPRINT1("MEM_LARGE_PAGES not supported\n");
-        Status = STATUS_INVALID_PARAMETER;
-        goto FailPathNoLock;
+        if (!MiLargePageSize)
+        {
+            DPRINT1("MEM_LARGE_PAGES not supported on this processor\n");
+            Status = STATUS_INVALID_PARAMETER;
+            goto FailPathNoLock;
+        }
+
+        if ((AllocationType & (MEM_RESERVE | MEM_COMMIT)) != (MEM_RESERVE | MEM_COMMIT))
+        {
+            DPRINT1("Must supply MEM_RESERVE and MEM_COMMIT with MEM_LARGE_PAGES\n");
+            Status = STATUS_INVALID_PARAMETER_5;
+            goto FailPathNoLock;
+        }
+
+        if (((ULONG_PTR)PBaseAddress & (MiLargePageSize - 1)) ||
+            (PRegionSize & (MiLargePageSize - 1)))
+        {
+            DPRINT1("MEM_LARGE_PAGES range is not a multiple of the large page size\n");
+            Status = STATUS_INVALID_PARAMETER;
+            goto FailPathNoLock;
+        }
+
+        if ((ProtectionMask != MM_READWRITE) && (ProtectionMask != MM_EXECUTE_READWRITE))
+        {
+            DPRINT1("MEM_LARGE_PAGES only supports read/write protection\n");
+            Status = STATUS_INVALID_PAGE_PROTECTION;
+            goto FailPathNoLock;
+        }
     }
+
+    //
+    // Fail on the things we don't yet support
+    //
     if ((AllocationType & MEM_PHYSICAL) == MEM_PHYSICAL)
     {
         DPRINT1("MEM_PHYSICAL not supported\n");
@@ -4755,6 +4797,33 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
         Vad->u.VadFlags.PrivateMemory = 1;
         Vad->ControlArea = NULL; // For Memory-Area hack
 
+        //
+        // Get the physical memory for large pages first, the VAD can't live without it
+        //
+        if (AllocationType & MEM_LARGE_PAGES)
+        {
+            Vad->u.VadFlags.VadType = VadLargePages;
+
+            LargePageCount = (ULONG)(PRegionSize / MiLargePageSize);
+            LargePages = ExAllocatePoolWithTag(PagedPool,
+                                               LargePageCount * sizeof(PFN_NUMBER),
+                                               TAG_MM);
+            if (LargePages == NULL)
+            {
+                ExFreePoolWithTag(Vad, 'SdaV');
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto FailPathNoLock;
+            }
+
+            Status = MiAllocateLargePages(LargePages, LargePageCount);
+            if (!NT_SUCCESS(Status))
+            {
+                ExFreePoolWithTag(LargePages, TAG_MM);
+                ExFreePoolWithTag(Vad, 'SdaV');
+                goto FailPathNoLock;
+            }
+        }
+
         //
         // Insert the VAD
         //
@@ -4762,15 +4831,35 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
                                &StartingAddress,
                                PRegionSize,
                                HighestAddress,
-                               MM_VIRTMEM_GRANULARITY,
+                               LargePages ? MiLargePageSize : MM_VIRTMEM_GRANULARITY,
                                AllocationType);
         if (!NT_SUCCESS(Status))
         {
             DPRINT1("Failed to insert the VAD!\n");
+            if (LargePages)
+            {
+                MiFreeLargePages(LargePages, LargePageCount);
+                ExFreePoolWithTag(LargePages, TAG_MM);
+            }
             ExFreePoolWithTag(Vad, 'SdaV');
             goto FailPathNoLock;
         }
 
+        //
+        // Now that the VAD has its place, put the large pages behind it
+        //
+        if (LargePages)
+        {
+            Status = MiMapLargePageVad(Process, Vad, LargePages);
+            ExFreePoolWithTag(LargePages, TAG_MM);
+            if (!NT_SUCCESS(Status))
+            {
+                /* The VAD and its quota went away with the process */
+                QuotaCharged = FALSE;
+                goto FailPathNoLock;
+            }
+        }
+
         //
         // Detach and dereference the target process if
         // it was different from the current process
@@ -5354,6 +5443,39 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
     //
     if (FreeType & MEM_RELEASE)
     {
+        //
+        // Large pages can only go all at once, and only once they are mapped
+        //
+        if (Vad->u.VadFlags.VadType == VadLargePages)
+        {
+            if ((((ULONG_PTR)PBaseAddress >> PAGE_SHIFT) != Vad->StartingVpn) ||
+                ((PRegionSize) && ((EndingAddress >> PAGE_SHIFT) != Vad->EndingVpn)))
+            {
+                DPRINT1("Large page allocations must be released as a whole\n");
+                Status = STATUS_FREE_VM_NOT_AT_BASE;
+                goto FailPath;
+            }
+
+            if (MiAddressToPde(PBaseAddress)->u.Long == 0)
+            {
+                DPRINT1("Large page allocation at 0x%p is still being set up\n", PBaseAddress);
+                Status = STATUS_MEMORY_NOT_ALLOCATED;
+                goto FailPath;
+            }
+
+            StartingAddress = Vad->StartingVpn << PAGE_SHIFT;
+            EndingAddress = (Vad->EndingVpn << PAGE_SHIFT) | (PAGE_SIZE - 1);
+
+            MiLockProcessWorkingSetUnsafe(Process, CurrentThread);
+            ASSERT(Process->VadRoot.NumberGenericTableElements >= 1);
+            MiRemoveNode((PMMADDRESS_NODE)Vad, &Process->VadRoot);
+            PsReturnProcessNonPagedPoolQuota(Process, sizeof(MMVAD_LONG));
+            MiDeleteLargePageVad(Process, Vad);
+            MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
+            Status = STATUS_SUCCESS;
+            goto FinalPath;
+        }
+
         //
         // ARM3 only supports this VAD in this path
         //
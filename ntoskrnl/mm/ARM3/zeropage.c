@@ -42,6 +42,9 @@ MmZeroPageThread(VOID)
     /* Get the discardable sections to free them */
     MiFindInitializationCode(&StartAddress, &EndAddress);
     if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+
+    /* What is left of the kernel and the HAL stays for good, map it with large pages */
+    MiMapKernelWithLargePages();
     DPRINT("Free pages: %lx\n", MmAvailablePages);
 
     /* Set our priority to 0 */
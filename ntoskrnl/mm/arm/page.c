@@ -213,7 +213,8 @@ MmGetPfnForProcess(IN PEPROCESS Process,
 BOOLEAN
 NTAPI
 MmIsDirtyPage(IN PEPROCESS Process,
-              IN PVOID Address)
+              IN PVOID Address,
+              OUT PBOOLEAN Accessed OPTIONAL)
 {
     UNIMPLEMENTED_DBGBREAK();
     return FALSE;
@@ -36,6 +36,9 @@ static KTIMER MiBalancerTimer;
 
 static LONG PageOutThreadActive;
 
+/* User pages not accessed during that many trimming passes are paged out first */
+#define MI_USER_PAGE_MAXIMUM_AGE 3
+
 /* FUNCTIONS ****************************************************************/
 
 CODE_SEG("INIT")
@@ -134,135 +137,163 @@ MiTrimMemoryConsumer(ULONG Consumer, ULONG InitialTarget)
     return (InitialTarget > NrFreedPages) ? (InitialTarget - NrFreedPages) : 0;
 }
 
-NTSTATUS
-MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
+/*
+ * Clears the accessed bit of every user mapping of the page and tells whether
+ * any of them was set, i.e. whether the page was used since the last call.
+ */
+static
+BOOLEAN
+MiSampleUserPage(PFN_NUMBER Page)
 {
-    PFN_NUMBER FirstPage, CurrentPage;
-    NTSTATUS Status;
-
-    (*NrFreedPages) = 0;
+    PEPROCESS Process = NULL;
+    PVOID Address = NULL;
+    BOOLEAN Accessed = FALSE;
 
-    DPRINT("MM BALANCER: %s\n", Priority ? "Paging out!" : "Removing access bit!");
-
-    FirstPage = MmGetLRUFirstUserPage();
-    CurrentPage = FirstPage;
-    while (CurrentPage != 0 && Target > 0)
+    /*
+     * We have a lock-ordering problem here. We cant lock the PFN DB before the Process address space.
+     * So we must use circonvoluted loops.
+     * Well...
+     */
+    while (TRUE)
     {
-        if (Priority)
+        KAPC_STATE ApcState;
+        KIRQL OldIrql = MiAcquirePfnLock();
+        PMM_RMAP_ENTRY Entry = MmGetRmapListHeadPage(Page);
+        while (Entry)
         {
-            Status = MmPageOutPhysicalAddress(CurrentPage);
-            if (NT_SUCCESS(Status))
+            if (RMAP_IS_SEGMENT(Entry->Address))
             {
-                DPRINT("Succeeded\n");
-                Target--;
-                (*NrFreedPages)++;
-                if (CurrentPage == FirstPage)
-                {
-                    FirstPage = 0;
-                }
+                Entry = Entry->Next;
+                continue;
             }
+
+            /* Check that we didn't treat this entry before */
+            if (Entry->Address < Address)
+            {
+                Entry = Entry->Next;
+                continue;
+            }
+
+            if ((Entry->Address == Address) && (Entry->Process <= Process))
+            {
+                Entry = Entry->Next;
+                continue;
+            }
+
+            break;
         }
-        else
+
+        if (!Entry)
         {
-            /* When not paging-out agressively, just reset the accessed bit */
-            PEPROCESS Process = NULL;
-            PVOID Address = NULL;
-            BOOLEAN Accessed = FALSE;
-
-            /*
-             * We have a lock-ordering problem here. We cant lock the PFN DB before the Process address space.
-             * So we must use circonvoluted loops.
-             * Well...
-             */
-            while (TRUE)
-            {
-                KAPC_STATE ApcState;
-                KIRQL OldIrql = MiAcquirePfnLock();
-                PMM_RMAP_ENTRY Entry = MmGetRmapListHeadPage(CurrentPage);
-                while (Entry)
-                {
-                    if (RMAP_IS_SEGMENT(Entry->Address))
-                    {
-                        Entry = Entry->Next;
-                        continue;
-                    }
-
-                    /* Check that we didn't treat this entry before */
-                    if (Entry->Address < Address)
-                    {
-                        Entry = Entry->Next;
-                        continue;
-                    }
-
-                    if ((Entry->Address == Address) && (Entry->Process <= Process))
-                    {
-                        Entry = Entry->Next;
-                        continue;
-                    }
-
-                    break;
-                }
+            MiReleasePfnLock(OldIrql);
+            break;
+        }
 
-                if (!Entry)
-                {
-                    MiReleasePfnLock(OldIrql);
-                    break;
-                }
+        Process = Entry->Process;
+        Address = Entry->Address;
+
+        ObReferenceObject(Process);
 
-                Process = Entry->Process;
-                Address = Entry->Address;
+        if (!ExAcquireRundownProtection(&Process->RundownProtect))
+        {
+            ObDereferenceObject(Process);
+            MiReleasePfnLock(OldIrql);
+            continue;
+        }
 
-                ObReferenceObject(Process);
+        MiReleasePfnLock(OldIrql);
 
-                if (!ExAcquireRundownProtection(&Process->RundownProtect))
-                {
-                    ObDereferenceObject(Process);
-                    MiReleasePfnLock(OldIrql);
-                    continue;
-                }
+        KeStackAttachProcess(&Process->Pcb, &ApcState);
+        MiLockProcessWorkingSet(Process, PsGetCurrentThread());
 
-                MiReleasePfnLock(OldIrql);
+        /* Be sure this is still valid. */
+        if (MmIsAddressValid(Address))
+        {
+            PMMPTE Pte = MiAddressToPte(Address);
+            if (Pte->u.Hard.Accessed)
+            {
+                /* A hit for this process' working set */
+                Process->Vm.AccessedPageCount++;
+                Accessed = TRUE;
+            }
+            Pte->u.Hard.Accessed = 0;
 
-                KeStackAttachProcess(&Process->Pcb, &ApcState);
-                MiLockProcessWorkingSet(Process, PsGetCurrentThread());
+            /* There is no need to invalidate, the balancer thread is never on a user process */
+            //KeInvalidateTlbEntry(Address);
+        }
 
-                /* Be sure this is still valid. */
-                if (MmIsAddressValid(Address))
-                {
-                    PMMPTE Pte = MiAddressToPte(Address);
-                    Accessed = Accessed || Pte->u.Hard.Accessed;
-                    Pte->u.Hard.Accessed = 0;
+        MiUnlockProcessWorkingSet(Process, PsGetCurrentThread());
 
-                    /* There is no need to invalidate, the balancer thread is never on a user process */
-                    //KeInvalidateTlbEntry(Address);
-                }
+        KeUnstackDetachProcess(&ApcState);
+        ExReleaseRundownProtection(&Process->RundownProtect);
+        ObDereferenceObject(Process);
+    }
 
-                MiUnlockProcessWorkingSet(Process, PsGetCurrentThread());
+    return Accessed;
+}
 
-                KeUnstackDetachProcess(&ApcState);
-                ExReleaseRundownProtection(&Process->RundownProtect);
-                ObDereferenceObject(Process);
-            }
+/*
+ * Walks the user pages once in LRU order. Every page is sampled and aged
+ * (the age is the number of walks the page went unused, up to
+ * MI_USER_PAGE_MAXIMUM_AGE) and paged out if it is at least MinimumAge old.
+ * A MinimumAge of 0 pages out in plain LRU order without sampling.
+ */
+static
+VOID
+MiTrimUserPages(
+    _Inout_ PULONG Target,
+    _In_ ULONG MinimumAge,
+    _In_ BOOLEAN CountVisitedPages,
+    _Inout_ PULONG NrFreedPages)
+{
+    PFN_NUMBER FirstPage, CurrentPage;
+    NTSTATUS Status;
 
-            if (!Accessed)
-            {
-                /* Nobody accessed this page since the last time we check. Time to clean up */
+    FirstPage = MmGetLRUFirstUserPage();
+    CurrentPage = FirstPage;
+    while (CurrentPage != 0 && *Target > 0)
+    {
+        ULONG Age = MI_USER_PAGE_MAXIMUM_AGE;
+
+        if (MinimumAge != 0)
+        {
+            BOOLEAN Accessed = MiSampleUserPage(CurrentPage);
+            KIRQL OldIrql = MiAcquirePfnLock();
+            PMMPFN Pfn = MiGetPfnEntry(CurrentPage);
+
+            /* HACK: ReactOS pages have no working set entry, the PFN one keeps the age */
+            if (Accessed)
+                Pfn->Wsle.u1.e1.Age = 0;
+            else if (Pfn->Wsle.u1.e1.Age < MI_USER_PAGE_MAXIMUM_AGE)
+                Pfn->Wsle.u1.e1.Age++;
+            Age = Pfn->Wsle.u1.e1.Age;
+
+            MiReleasePfnLock(OldIrql);
+        }
+
+        if (Age >= MinimumAge)
+        {
+            ULONG PagesFreed = 0;
 
-                Status = MmPageOutPhysicalAddress(CurrentPage);
-                if (NT_SUCCESS(Status))
+            /* Private neighbours may go out in the same cluster */
+            Status = MmPageOutPhysicalAddress(CurrentPage, &PagesFreed);
+            if (NT_SUCCESS(Status))
+            {
+                DPRINT("Paged out %lu pages of age %lu\n", PagesFreed, Age);
+                (*NrFreedPages) += PagesFreed;
+                if (!CountVisitedPages)
+                    *Target -= min(*Target, PagesFreed);
+                if (CurrentPage == FirstPage)
                 {
-                    if (CurrentPage == FirstPage)
-                    {
-                        FirstPage = 0;
-                    }
+                    FirstPage = 0;
                 }
-                // DPRINT1("Paged-out one page: %s\n", NT_SUCCESS(Status) ? "Yes" : "No");
             }
-
-            /* Done for this page. */
-            Target--;
         }
 
+        /* When not paging-out agressively, the target is the number of pages to look at */
+        if (CountVisitedPages)
+            (*Target)--;
+
         CurrentPage = MmGetLRUNextUserPage(CurrentPage, TRUE);
         if (FirstPage == 0)
         {
@@ -271,7 +302,7 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
         else if (CurrentPage == FirstPage)
         {
             DPRINT1("We are back at the start, abort!\n");
-            return STATUS_SUCCESS;
+            break;
         }
     }
 
@@ -281,6 +312,28 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
         MmDereferencePage(CurrentPage);
         MiReleasePfnLock(OldIrql);
     }
+}
+
+NTSTATUS
+MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
+{
+    (*NrFreedPages) = 0;
+
+    DPRINT("MM BALANCER: %s\n", Priority ? "Paging out!" : "Aging pages!");
+
+    if (!Priority)
+    {
+        /* Only what went unused for several passes goes out */
+        MiTrimUserPages(&Target, MI_USER_PAGE_MAXIMUM_AGE, TRUE, NrFreedPages);
+        return STATUS_SUCCESS;
+    }
+
+    /* Oldest first: anything not used since the last pass... */
+    MiTrimUserPages(&Target, 1, FALSE, NrFreedPages);
+
+    /* ...and if that is not enough, whatever is next in LRU order */
+    if (Target > 0)
+        MiTrimUserPages(&Target, 0, FALSE, NrFreedPages);
 
     return STATUS_SUCCESS;
 }
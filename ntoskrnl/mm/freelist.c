@@ -643,6 +643,9 @@ MmAllocPage(ULONG Type)
     Pfn1->NextLRU = NULL;
     Pfn1->PreviousLRU = NULL;
 
+    /* A new page starts young, see MmTrimUserMemory */
+    Pfn1->Wsle.u1.e1.Age = 0;
+
     if (Type == MC_USER)
     {
         Pfn1->u4.MustBeCached = 1; /* HACK again */
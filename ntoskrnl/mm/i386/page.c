@@ -508,6 +508,44 @@ MmIsDisabledPage(PEPROCESS Process, PVOID Address)
     return Ret;
 }
 
+BOOLEAN
+NTAPI
+MmIsDirtyPage(
+    _In_ PEPROCESS Process,
+    _In_ PVOID Address,
+    _Out_opt_ PBOOLEAN Accessed)
+{
+    BOOLEAN Ret = FALSE;
+    PMMPTE PointerPte;
+
+    /* This is only used by the page-out path, which deals with user pages */
+    ASSERT(Address < MmSystemRangeStart);
+    ASSERT(Process != NULL);
+    ASSERT(Process == PsGetCurrentProcess());
+
+    if (Accessed)
+        *Accessed = FALSE;
+
+    MiLockProcessWorkingSetShared(Process, PsGetCurrentThread());
+
+    if (MiIsPageTablePresent(Address))
+    {
+        MiMakePdeExistAndMakeValid(MiAddressToPde(Address), Process, MM_NOIRQL);
+
+        PointerPte = MiAddressToPte(Address);
+        if (PointerPte->u.Hard.Valid)
+        {
+            Ret = !!PointerPte->u.Hard.Dirty;
+            if (Accessed)
+                *Accessed = !!PointerPte->u.Hard.Accessed;
+        }
+    }
+
+    MiUnlockProcessWorkingSetShared(Process, PsGetCurrentThread());
+
+    return Ret;
+}
+
 BOOLEAN
 NTAPI
 MmIsPageSwapEntry(PEPROCESS Process, PVOID Address)
@@ -266,6 +266,9 @@ MmAccessFault(IN ULONG FaultCode,
         }
         else
         {
+            /* Charge the fault to the process working set */
+            InterlockedIncrement((PLONG)&PsGetCurrentProcess()->Vm.PageFaultCount);
+
             /* Could this be a VAD fault from user-mode? */
             MiLockProcessWorkingSetShared(PsGetCurrentProcess(), PsGetCurrentThread());
             Vad = MiLocateVad(&PsGetCurrentProcess()->VadRoot, Address);
@@ -142,9 +142,33 @@ MmShowOutOfSpaceMessagePagingFile(VOID)
     }
 }
 
+SWAPENTRY
+NTAPI
+MmAdvanceSwapEntry(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ ULONG Pages)
+{
+    /* Store entries number their slots the same way, only without a file */
+    if (MM_IS_PAGE_STORE_ENTRY(SwapEntry))
+        return SwapEntry + ((SWAPENTRY)Pages << 11);
+
+    /* Entry for the slot that follows SwapEntry by that many pages in the same file */
+    return ENTRY_FROM_FILE_OFFSET(FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry) + Pages);
+}
+
 NTSTATUS
 NTAPI
 MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+{
+    return MmWriteToSwapPages(SwapEntry, &Page, 1);
+}
+
+NTSTATUS
+NTAPI
+MmWriteToSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count)
 {
     ULONG i;
     ULONG_PTR offset;
@@ -152,10 +176,10 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(PFN_NUMBER)];
+    UCHAR MdlBase[sizeof(MDL) + MM_SWAP_CLUSTER_SIZE * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
 
-    DPRINT("MmWriteToSwapPage\n");
+    DPRINT("MmWriteToSwapPages\n");
 
     if (SwapEntry == 0)
     {
@@ -163,6 +187,11 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
         return(STATUS_UNSUCCESSFUL);
     }
 
+    ASSERT(Count != 0 && Count <= MM_SWAP_CLUSTER_SIZE);
+
+    if (MM_IS_PAGE_STORE_ENTRY(SwapEntry))
+        return MiWritePageStore(SwapEntry, Pages, Count);
+
     i = FILE_FROM_ENTRY(SwapEntry);
     offset = OFFSET_FROM_ENTRY(SwapEntry) - 1;
 
@@ -173,8 +202,9 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
+    /* The slots are contiguous, so the whole run goes out with one write */
+    MmInitializeMdl(Mdl, NULL, Count * PAGE_SIZE);
+    MmBuildMdlFromPages(Mdl, Pages);
     Mdl->MdlFlags |= MDL_PAGES_LOCKED;
 
     file_offset.QuadPart = offset * PAGE_SIZE;
@@ -198,18 +228,11 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
     return(Status);
 }
 
-
-NTSTATUS
-NTAPI
-MmReadFromSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
-{
-    return MiReadPageFile(Page, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry));
-}
-
+static
 NTSTATUS
-NTAPI
-MiReadPageFile(
-    _In_ PFN_NUMBER Page,
+MiReadPageFileCluster(
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count,
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
 {
@@ -217,7 +240,7 @@ MiReadPageFile(
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(PFN_NUMBER)];
+    UCHAR MdlBase[sizeof(MDL) + MM_SWAP_CLUSTER_SIZE * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
     PMMPAGING_FILE PagingFile;
 
@@ -229,6 +252,8 @@ MiReadPageFile(
         return(STATUS_UNSUCCESSFUL);
     }
 
+    ASSERT(Count != 0 && Count <= MM_SWAP_CLUSTER_SIZE);
+
     /* Normalize offset. */
     PageFileOffset--;
 
@@ -242,8 +267,8 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
+    MmInitializeMdl(Mdl, NULL, Count * PAGE_SIZE);
+    MmBuildMdlFromPages(Mdl, Pages);
     Mdl->MdlFlags |= MDL_PAGES_LOCKED | MDL_IO_PAGE_READ;
 
     file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
@@ -266,6 +291,39 @@ MiReadPageFile(
     return(Status);
 }
 
+NTSTATUS
+NTAPI
+MmReadFromSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+{
+    if (MM_IS_PAGE_STORE_ENTRY(SwapEntry))
+        return MiReadPageStore(SwapEntry, &Page, 1);
+
+    return MiReadPageFileCluster(&Page, 1, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry));
+}
+
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count)
+{
+    if (MM_IS_PAGE_STORE_ENTRY(SwapEntry))
+        return MiReadPageStore(SwapEntry, Pages, Count);
+
+    return MiReadPageFileCluster(Pages, Count, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry));
+}
+
+NTSTATUS
+NTAPI
+MiReadPageFile(
+    _In_ PFN_NUMBER Page,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    return MiReadPageFileCluster(&Page, 1, PageFileIndex, PageFileOffset);
+}
+
 CODE_SEG("INIT")
 VOID
 NTAPI
@@ -284,6 +342,8 @@ MmInitPagingFile(VOID)
         MmPagingFile[i] = NULL;
     }
     MmNumberOfPagingFiles = 0;
+
+    MiInitializePageStore();
 }
 
 VOID
@@ -294,6 +354,12 @@ MmFreeSwapPage(SWAPENTRY Entry)
     ULONG_PTR off;
     PMMPAGING_FILE PagingFile;
 
+    if (MM_IS_PAGE_STORE_ENTRY(Entry))
+    {
+        MiFreePageStoreSlot(Entry);
+        return;
+    }
+
     i = FILE_FROM_ENTRY(Entry);
     off = OFFSET_FROM_ENTRY(Entry) - 1;
 
@@ -305,7 +371,8 @@ MmFreeSwapPage(SWAPENTRY Entry)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    RtlClearBit(PagingFile->Bitmap, off >> 5);
+    ASSERT(RtlCheckBit(PagingFile->Bitmap, (ULONG)off));
+    RtlClearBit(PagingFile->Bitmap, (ULONG)off);
 
     PagingFile->FreeSpace++;
     PagingFile->CurrentUsage--;
@@ -320,44 +387,79 @@ MmFreeSwapPage(SWAPENTRY Entry)
 SWAPENTRY
 NTAPI
 MmAllocSwapPage(VOID)
+{
+    ULONG Count = 1;
+
+    return MmAllocSwapPages(&Count);
+}
+
+/*
+ * Allocates up to *Count slots that follow each other, so the pages stored
+ * there can be moved with a single I/O. The compressed store is tried first,
+ * it sends the cold pages on to the paging files by itself. The request is
+ * halved until a free run is found and *Count receives the length that was
+ * allocated.
+ */
+SWAPENTRY
+NTAPI
+MmAllocSwapPages(
+    _Inout_ PULONG Count)
+{
+    SWAPENTRY Entry;
+
+    Entry = MiAllocPageStoreSlots(Count);
+    if (Entry)
+        return Entry;
+
+    return MiAllocPageFileSlots(Count);
+}
+
+/* Same as MmAllocSwapPages, but always in a paging file */
+SWAPENTRY
+NTAPI
+MiAllocPageFileSlots(
+    _Inout_ PULONG Count)
 {
     ULONG i;
     ULONG off;
-    SWAPENTRY entry;
+    ULONG Run;
+    PMMPAGING_FILE PagingFile;
 
-    KeAcquireGuardedMutex(&MmPageFileCreationLock);
+    ASSERT(*Count != 0 && *Count <= MM_SWAP_CLUSTER_SIZE);
 
-    if (MiFreeSwapPages == 0)
-    {
-        KeReleaseGuardedMutex(&MmPageFileCreationLock);
-        return(0);
-    }
+    KeAcquireGuardedMutex(&MmPageFileCreationLock);
 
-    for (i = 0; i < MAX_PAGING_FILES; i++)
+    for (Run = min(*Count, MiFreeSwapPages); Run != 0; Run /= 2)
     {
-        if (MmPagingFile[i] != NULL &&
-                MmPagingFile[i]->FreeSpace >= 1)
+        for (i = 0; i < MAX_PAGING_FILES; i++)
         {
-            off = RtlFindClearBitsAndSet(MmPagingFile[i]->Bitmap, 1, 0);
+            PagingFile = MmPagingFile[i];
+            if (PagingFile == NULL || PagingFile->FreeSpace < Run)
+                continue;
+
+            /* Carry on after the last run, the holes at the start are mostly too short */
+            off = RtlFindClearBitsAndSet(PagingFile->Bitmap, Run, PagingFile->HintIndex);
             if (off == 0xFFFFFFFF)
-            {
-                KeBugCheck(MEMORY_MANAGEMENT);
-                KeReleaseGuardedMutex(&MmPageFileCreationLock);
-                return(STATUS_UNSUCCESSFUL);
-            }
-            MiUsedSwapPages++;
-            MiFreeSwapPages--;
-            UpdateTotalCommittedPages(1);
+                continue;
+
+            PagingFile->HintIndex = off + Run;
+            PagingFile->FreeSpace -= Run;
+            PagingFile->CurrentUsage += Run;
+
+            MiUsedSwapPages += Run;
+            MiFreeSwapPages -= Run;
+            UpdateTotalCommittedPages(Run);
 
             KeReleaseGuardedMutex(&MmPageFileCreationLock);
 
-            entry = ENTRY_FROM_FILE_OFFSET(i, off + 1);
-            return(entry);
+            *Count = Run;
+            return ENTRY_FROM_FILE_OFFSET(i, off + 1);
         }
     }
 
     KeReleaseGuardedMutex(&MmPageFileCreationLock);
-    KeBugCheck(MEMORY_MANAGEMENT);
+
+    *Count = 0;
     return(0);
 }
 
@@ -792,6 +894,12 @@ EarlyQuit:
                         (ULONG)(PagingFile->MaximumSize));
     RtlClearAllBits(PagingFile->Bitmap);
 
+    /* The file is not extended, keep the slots past its end out of reach */
+    RtlSetBits(PagingFile->Bitmap,
+               (ULONG)PagingFile->FreeSpace,
+               (ULONG)(PagingFile->MaximumSize - PagingFile->FreeSpace));
+    PagingFile->HintIndex = 0;
+
     /* Insert the new paging file information into the list */
     KeAcquireGuardedMutex(&MmPageFileCreationLock);
     /* Ensure the corresponding slot is empty yet */
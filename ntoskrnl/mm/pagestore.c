@@ -0,0 +1,561 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Compressed in-memory store in front of the paging files
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+/*
+ * Pages trimmed from the working sets are compressed into nonpaged pool
+ * instead of being written out. Their swap entries name a store slot, so the
+ * PTEs and section entries do not change when a slot later moves to disk:
+ * once the store grows past its budget the oldest slots are written to the
+ * paging files in clusters and only remember where their page went.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+#include "ARM3/miarm.h"
+
+/* GLOBALS *******************************************************************/
+
+/* Share of the physical memory the compressed pages may use, 0 disables the store */
+ULONG MmPageStorePercent = 25;
+
+#define MI_MAXIMUM_PAGE_STORE_PERCENT   50
+
+/* Pages that don't shrink below this go to the paging file as they are */
+#define MI_MAXIMUM_COMPRESSED_SIZE      (PAGE_SIZE * 3 / 4)
+
+/*
+ * Store entries number their slots like paging file entries number their
+ * offsets, so runs of them can be advanced through the same way.
+ */
+#define SLOT_FROM_ENTRY(i) ((ULONG)((i) >> 11))
+#define ENTRY_FROM_SLOT(i) (((SWAPENTRY)(i) << 11) | MM_PAGE_STORE_ENTRY | 0x400)
+
+/* The slot holds compressed data */
+#define MI_STORE_SLOT_COMPRESSED    0x01
+/* The page was moved to the paging file */
+#define MI_STORE_SLOT_SPILLED       0x02
+/* The compressed data is off the age list, being written to the paging file */
+#define MI_STORE_SLOT_SPILLING      0x04
+
+typedef struct _MI_STORE_SLOT
+{
+    LIST_ENTRY AgeListEntry;
+    PVOID Data;
+    SWAPENTRY PageFileEntry;
+    USHORT Size;
+    USHORT Flags;
+} MI_STORE_SLOT, *PMI_STORE_SLOT;
+
+static KGUARDED_MUTEX MiPageStoreLock;
+static KGUARDED_MUTEX MiPageStoreSpillLock;
+
+static PMI_STORE_SLOT MiPageStoreSlots;
+static RTL_BITMAP MiPageStoreBitmap;
+static ULONG MiPageStoreHint;
+
+/* Compressed slots, the oldest first */
+static LIST_ENTRY MiPageStoreAgeList;
+
+/* Compression workspace and output buffer, used under the store lock */
+static PVOID MiPageStoreWorkSpace;
+static PUCHAR MiPageStoreBuffer;
+
+/* Pages decompressed for one cluster write, used under the spill lock */
+static PUCHAR MiPageStoreSpillBuffer;
+
+static SYSTEM_PAGE_STORE_INFORMATION MiPageStoreInfo;
+
+/* FUNCTIONS *****************************************************************/
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MiInitializePageStore(VOID)
+{
+    ULONG SlotCount;
+    ULONG WorkSpaceSize;
+    ULONG FragmentWorkSpaceSize;
+    PULONG BitmapBuffer;
+    SIZE_T Budget;
+    NTSTATUS Status;
+
+    KeInitializeGuardedMutex(&MiPageStoreLock);
+    KeInitializeGuardedMutex(&MiPageStoreSpillLock);
+    InitializeListHead(&MiPageStoreAgeList);
+
+    if (MmPageStorePercent == 0)
+    {
+        DPRINT1("Compressed page store disabled\n");
+        return;
+    }
+
+    /* The compressed pages live in nonpaged pool, they can't take all of it */
+    Budget = (SIZE_T)(MmNumberOfPhysicalPages / 100) *
+             min(MmPageStorePercent, MI_MAXIMUM_PAGE_STORE_PERCENT) * PAGE_SIZE;
+    Budget = min(Budget, MmMaximumNonPagedPoolInBytes / 4);
+
+    /* Enough slots for the budget at 4:1, spilled slots share the same table */
+    SlotCount = (ULONG)(Budget / PAGE_SIZE) * 4;
+    if (SlotCount < MM_SWAP_CLUSTER_SIZE)
+        return;
+
+    Status = RtlGetCompressionWorkSpaceSize(COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+                                            &WorkSpaceSize,
+                                            &FragmentWorkSpaceSize);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    MiPageStoreSlots = ExAllocatePoolWithTag(NonPagedPool, SlotCount * sizeof(MI_STORE_SLOT), TAG_MM_PAGE_STORE);
+    BitmapBuffer = ExAllocatePoolWithTag(NonPagedPool, ALIGN_UP_BY(SlotCount, 32) / 8, TAG_MM_PAGE_STORE);
+    MiPageStoreWorkSpace = ExAllocatePoolWithTag(NonPagedPool, WorkSpaceSize, TAG_MM_PAGE_STORE);
+    MiPageStoreBuffer = ExAllocatePoolWithTag(NonPagedPool, MI_MAXIMUM_COMPRESSED_SIZE, TAG_MM_PAGE_STORE);
+    MiPageStoreSpillBuffer = ExAllocatePoolWithTag(NonPagedPool, MM_SWAP_CLUSTER_SIZE * PAGE_SIZE, TAG_MM_PAGE_STORE);
+    if (!MiPageStoreSlots || !BitmapBuffer || !MiPageStoreWorkSpace || !MiPageStoreBuffer || !MiPageStoreSpillBuffer)
+    {
+        DPRINT1("Not enough pool for the compressed page store\n");
+        if (MiPageStoreSlots) ExFreePoolWithTag(MiPageStoreSlots, TAG_MM_PAGE_STORE);
+        if (BitmapBuffer) ExFreePoolWithTag(BitmapBuffer, TAG_MM_PAGE_STORE);
+        if (MiPageStoreWorkSpace) ExFreePoolWithTag(MiPageStoreWorkSpace, TAG_MM_PAGE_STORE);
+        if (MiPageStoreBuffer) ExFreePoolWithTag(MiPageStoreBuffer, TAG_MM_PAGE_STORE);
+        if (MiPageStoreSpillBuffer) ExFreePoolWithTag(MiPageStoreSpillBuffer, TAG_MM_PAGE_STORE);
+        MiPageStoreSlots = NULL;
+        return;
+    }
+
+    RtlInitializeBitMap(&MiPageStoreBitmap, BitmapBuffer, SlotCount);
+    RtlClearAllBits(&MiPageStoreBitmap);
+
+    MiPageStoreInfo.BudgetBytes = Budget;
+    MiPageStoreInfo.TotalSlots = SlotCount;
+
+    DPRINT1("Compressed page store: %Iu KB, %lu slots\n", Budget / 1024, SlotCount);
+}
+
+/*
+ * Takes the content out of a slot, which is then empty but still allocated.
+ * The commit charge of a spilled page goes back from the paging file slot to
+ * the store slot. Must be called with the store lock held.
+ */
+static
+VOID
+MiEmptyPageStoreSlot(
+    _In_ PMI_STORE_SLOT Slot)
+{
+    if (Slot->Flags & MI_STORE_SLOT_COMPRESSED)
+    {
+        /* A spill in progress owns the data, it frees it once it sees it changed */
+        if (Slot->Flags & MI_STORE_SLOT_SPILLING)
+        {
+            Slot->Flags &= ~MI_STORE_SLOT_SPILLING;
+        }
+        else
+        {
+            RemoveEntryList(&Slot->AgeListEntry);
+            ExFreePoolWithTag(Slot->Data, TAG_MM_PAGE_STORE);
+        }
+        MiPageStoreInfo.StoredPages--;
+        MiPageStoreInfo.CompressedBytes -= Slot->Size;
+    }
+    else if (Slot->Flags & MI_STORE_SLOT_SPILLED)
+    {
+        MmFreeSwapPage(Slot->PageFileEntry);
+        UpdateTotalCommittedPages(1);
+        MiPageStoreInfo.SpilledPages--;
+    }
+
+    Slot->Data = NULL;
+    Slot->PageFileEntry = 0;
+    Slot->Size = 0;
+    Slot->Flags &= ~(MI_STORE_SLOT_COMPRESSED | MI_STORE_SLOT_SPILLED);
+}
+
+/*
+ * Allocates up to *Count consecutive store slots. On failure *Count is left
+ * alone, the caller falls back to the paging files.
+ */
+SWAPENTRY
+NTAPI
+MiAllocPageStoreSlots(
+    _Inout_ PULONG Count)
+{
+    ULONG Run;
+    ULONG Slot;
+    ULONG i;
+
+    if (!MiPageStoreSlots)
+        return 0;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    /* Spilling can't keep up, let the paging files take the pages directly */
+    if (MiPageStoreInfo.CompressedBytes >= 2 * MiPageStoreInfo.BudgetBytes)
+    {
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        return 0;
+    }
+
+    for (Run = *Count; Run != 0; Run /= 2)
+    {
+        Slot = RtlFindClearBitsAndSet(&MiPageStoreBitmap, Run, MiPageStoreHint);
+        if (Slot == 0xFFFFFFFF)
+            continue;
+
+        MiPageStoreHint = Slot + Run;
+        for (i = 0; i < Run; i++)
+            RtlZeroMemory(&MiPageStoreSlots[Slot + i], sizeof(MI_STORE_SLOT));
+
+        MiPageStoreInfo.UsedSlots += Run;
+        UpdateTotalCommittedPages(Run);
+
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+
+        *Count = Run;
+        return ENTRY_FROM_SLOT(Slot);
+    }
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+    return 0;
+}
+
+VOID
+NTAPI
+MiFreePageStoreSlot(
+    _In_ SWAPENTRY Entry)
+{
+    PMI_STORE_SLOT Slot;
+    ULONG Index = SLOT_FROM_ENTRY(Entry);
+
+    ASSERT(Index < MiPageStoreBitmap.SizeOfBitMap);
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    ASSERT(RtlCheckBit(&MiPageStoreBitmap, Index));
+    Slot = &MiPageStoreSlots[Index];
+    MiEmptyPageStoreSlot(Slot);
+
+    RtlClearBit(&MiPageStoreBitmap, Index);
+    MiPageStoreInfo.UsedSlots--;
+    UpdateTotalCommittedPages(-1);
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+}
+
+/*
+ * Writes the oldest compressed pages to the paging files, a cluster at a
+ * time, until the store is back within its budget.
+ */
+static
+VOID
+MiSpillPageStore(VOID)
+{
+    PMI_STORE_SLOT Slots[MM_SWAP_CLUSTER_SIZE];
+    PVOID Data[MM_SWAP_CLUSTER_SIZE];
+    PFN_NUMBER Pages[MM_SWAP_CLUSTER_SIZE];
+    SWAPENTRY PageFileEntry;
+    PMI_STORE_SLOT Slot;
+    ULONG Count, Run, Final, i;
+    NTSTATUS Status;
+
+    /* Somebody else is already on it */
+    if (!KeTryToAcquireGuardedMutex(&MiPageStoreSpillLock))
+        return;
+
+    while (MiPageStoreInfo.CompressedBytes > MiPageStoreInfo.BudgetBytes)
+    {
+        Run = MM_SWAP_CLUSTER_SIZE;
+        PageFileEntry = MiAllocPageFileSlots(&Run);
+        if (!PageFileEntry)
+            break;
+
+        KeAcquireGuardedMutex(&MiPageStoreLock);
+
+        /* Readers keep using the compressed data while it is being written */
+        for (Count = 0; Count < Run && !IsListEmpty(&MiPageStoreAgeList); Count++)
+        {
+            Slot = CONTAINING_RECORD(RemoveHeadList(&MiPageStoreAgeList), MI_STORE_SLOT, AgeListEntry);
+            ASSERT(Slot->Flags == MI_STORE_SLOT_COMPRESSED);
+
+            Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1,
+                                         MiPageStoreSpillBuffer + Count * PAGE_SIZE,
+                                         PAGE_SIZE,
+                                         Slot->Data,
+                                         Slot->Size,
+                                         &Final);
+            ASSERT(NT_SUCCESS(Status) && Final == PAGE_SIZE);
+
+            Slot->Flags |= MI_STORE_SLOT_SPILLING;
+            Slots[Count] = Slot;
+            Data[Count] = Slot->Data;
+            Pages[Count] = (PFN_NUMBER)(MmGetPhysicalAddress(MiPageStoreSpillBuffer + Count * PAGE_SIZE).QuadPart >> PAGE_SHIFT);
+        }
+
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+
+        /* Give back what we could not fill */
+        for (i = Count; i < Run; i++)
+            MmFreeSwapPage(MmAdvanceSwapEntry(PageFileEntry, i));
+
+        if (Count == 0)
+            break;
+
+        Status = MmWriteToSwapPages(PageFileEntry, Pages, Count);
+
+        KeAcquireGuardedMutex(&MiPageStoreLock);
+
+        for (i = 0; i < Count; i++)
+        {
+            Slot = Slots[i];
+
+            /*
+             * The old data is only freed here, so a slot that was emptied,
+             * freed or written again meanwhile can't point to it anymore.
+             */
+            if (Slot->Data != Data[i])
+            {
+                /* The paging file copy is stale */
+                ExFreePoolWithTag(Data[i], TAG_MM_PAGE_STORE);
+                MmFreeSwapPage(MmAdvanceSwapEntry(PageFileEntry, i));
+            }
+            else if (!NT_SUCCESS(Status))
+            {
+                /* Keep it compressed, it will be the first to go next time */
+                MmFreeSwapPage(MmAdvanceSwapEntry(PageFileEntry, i));
+                Slot->Flags &= ~MI_STORE_SLOT_SPILLING;
+                InsertHeadList(&MiPageStoreAgeList, &Slot->AgeListEntry);
+            }
+            else
+            {
+                /* The paging file slot carries the commit charge from now on */
+                ExFreePoolWithTag(Slot->Data, TAG_MM_PAGE_STORE);
+                MiPageStoreInfo.StoredPages--;
+                MiPageStoreInfo.CompressedBytes -= Slot->Size;
+                MiPageStoreInfo.SpilledPages++;
+                MiPageStoreInfo.SpillCount++;
+                UpdateTotalCommittedPages(-1);
+
+                Slot->Data = NULL;
+                Slot->Size = 0;
+                Slot->PageFileEntry = MmAdvanceSwapEntry(PageFileEntry, i);
+                Slot->Flags = MI_STORE_SLOT_SPILLED;
+            }
+        }
+
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Spilling the page store failed with 0x%lx\n", Status);
+            break;
+        }
+    }
+
+    KeReleaseGuardedMutex(&MiPageStoreSpillLock);
+}
+
+static
+NTSTATUS
+MiStorePage(
+    _In_ ULONG Index,
+    _In_ PFN_NUMBER Page)
+{
+    PMI_STORE_SLOT Slot = &MiPageStoreSlots[Index];
+    PEPROCESS Process = PsGetCurrentProcess();
+    SWAPENTRY PageFileEntry;
+    PVOID Address;
+    PVOID Data = NULL;
+    ULONG Size = 0;
+    ULONG Count;
+    KIRQL Irql;
+    NTSTATUS Status;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    ASSERT(RtlCheckBit(&MiPageStoreBitmap, Index));
+
+    /* The page is written again, whatever the slot had is stale */
+    MiEmptyPageStoreSlot(Slot);
+
+    Address = MiMapPageInHyperSpace(Process, Page, &Irql);
+    Status = RtlCompressBuffer(COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+                               Address,
+                               PAGE_SIZE,
+                               MiPageStoreBuffer,
+                               MI_MAXIMUM_COMPRESSED_SIZE,
+                               PAGE_SIZE,
+                               &Size,
+                               MiPageStoreWorkSpace);
+    MiUnmapPageInHyperSpace(Process, Address, Irql);
+
+    if (NT_SUCCESS(Status))
+    {
+        Data = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_MM_PAGE_STORE);
+    }
+
+    if (Data)
+    {
+        RtlCopyMemory(Data, MiPageStoreBuffer, Size);
+
+        Slot->Data = Data;
+        Slot->Size = (USHORT)Size;
+        Slot->Flags |= MI_STORE_SLOT_COMPRESSED;
+        InsertTailList(&MiPageStoreAgeList, &Slot->AgeListEntry);
+
+        MiPageStoreInfo.StoredPages++;
+        MiPageStoreInfo.CompressedBytes += Size;
+        MiPageStoreInfo.StoreCount++;
+
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        return STATUS_SUCCESS;
+    }
+
+    MiPageStoreInfo.RejectCount++;
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+
+    /* It doesn't compress, write it out right away and keep the slot as a reference */
+    Count = 1;
+    PageFileEntry = MiAllocPageFileSlots(&Count);
+    if (!PageFileEntry)
+        return STATUS_PAGEFILE_QUOTA_EXCEEDED;
+
+    Status = MmWriteToSwapPage(PageFileEntry, Page);
+    if (!NT_SUCCESS(Status))
+    {
+        MmFreeSwapPage(PageFileEntry);
+        return Status;
+    }
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+    Slot->PageFileEntry = PageFileEntry;
+    Slot->Flags |= MI_STORE_SLOT_SPILLED;
+    MiPageStoreInfo.SpilledPages++;
+    UpdateTotalCommittedPages(-1);
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+MiWritePageStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count)
+{
+    ULONG Index = SLOT_FROM_ENTRY(SwapEntry);
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i;
+
+    ASSERT(Index + Count <= MiPageStoreBitmap.SizeOfBitMap);
+
+    for (i = 0; i < Count; i++)
+    {
+        Status = MiStorePage(Index + i, Pages[i]);
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+
+    MiSpillPageStore();
+
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+MiReadPageStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(Count) PPFN_NUMBER Pages,
+    _In_ ULONG Count)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    ULONG Index = SLOT_FROM_ENTRY(SwapEntry);
+    PMI_STORE_SLOT Slot;
+    SWAPENTRY PageFileEntry;
+    PVOID Address;
+    ULONG Final;
+    ULONG Run;
+    ULONG i;
+    KIRQL Irql;
+    NTSTATUS Status;
+
+    ASSERT(Index + Count <= MiPageStoreBitmap.SizeOfBitMap);
+
+    for (i = 0; i < Count; i += Run)
+    {
+        KeAcquireGuardedMutex(&MiPageStoreLock);
+
+        Slot = &MiPageStoreSlots[Index + i];
+        ASSERT(RtlCheckBit(&MiPageStoreBitmap, Index + i));
+
+        if (Slot->Flags & MI_STORE_SLOT_COMPRESSED)
+        {
+            Address = MiMapPageInHyperSpace(Process, Pages[i], &Irql);
+            Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1,
+                                         Address,
+                                         PAGE_SIZE,
+                                         Slot->Data,
+                                         Slot->Size,
+                                         &Final);
+            MiUnmapPageInHyperSpace(Process, Address, Irql);
+            MiPageStoreInfo.HitCount++;
+
+            KeReleaseGuardedMutex(&MiPageStoreLock);
+
+            if (!NT_SUCCESS(Status) || Final != PAGE_SIZE)
+            {
+                DPRINT1("Corrupted page store slot %lu\n", Index + i);
+                return STATUS_UNSUCCESSFUL;
+            }
+
+            Run = 1;
+            continue;
+        }
+
+        if (!(Slot->Flags & MI_STORE_SLOT_SPILLED))
+        {
+            KeReleaseGuardedMutex(&MiPageStoreLock);
+            DPRINT1("Reading empty page store slot %lu\n", Index + i);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        /* Slots spilled together usually sit next to each other on disk too */
+        PageFileEntry = Slot->PageFileEntry;
+        for (Run = 1; i + Run < Count; Run++)
+        {
+            Slot = &MiPageStoreSlots[Index + i + Run];
+            if (!(Slot->Flags & MI_STORE_SLOT_SPILLED) ||
+                Slot->PageFileEntry != MmAdvanceSwapEntry(PageFileEntry, Run))
+            {
+                break;
+            }
+        }
+        MiPageStoreInfo.MissCount += Run;
+
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+
+        Status = MmReadFromSwapPages(PageFileEntry, &Pages[i], Run);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+MmQueryPageStoreInformation(
+    _Out_ PSYSTEM_PAGE_STORE_INFORMATION StoreInformation)
+{
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+    *StoreInformation = MiPageStoreInfo;
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+}
+
+/* EOF */
@@ -46,9 +46,88 @@ MmInitializeRmapList(VOID)
                                      50);
 }
 
+/*
+ * A neighbour of a page being written to the paging file can go along in the
+ * same I/O if it is private to the process, dirty and not recently used. The
+ * slot it may still hold from an earlier page-out is stale and gets released.
+ */
+static
+BOOLEAN
+MiIsPageOutCandidate(
+    _In_ PEPROCESS Process,
+    _In_ PMEMORY_AREA MemoryArea,
+    _In_ PVOID Address)
+{
+    PMM_SECTION_SEGMENT Segment = MemoryArea->SectionData.Segment;
+    LARGE_INTEGER Offset;
+    ULONG_PTR Entry;
+    PFN_NUMBER Page;
+    BOOLEAN Accessed;
+
+    /* This also fails for pages that are not mapped */
+    if (!MmIsDirtyPage(Process, Address, &Accessed) || Accessed)
+        return FALSE;
+
+    Page = MmGetPfnForProcess(Process, Address);
+
+    Offset.QuadPart = MemoryArea->SectionData.ViewOffset +
+             ((ULONG_PTR)Address - MA_GetStartingAddress(MemoryArea));
+    Entry = MmGetPageEntrySectionSegment(Segment, &Offset);
+    if ((Entry && MM_IS_WAIT_PTE(Entry)) || Page == PFN_FROM_SSE(Entry))
+        return FALSE;
+
+    /* Locked down for I/O or otherwise in use */
+    return MmGetReferenceCountPage(Page) == 1;
+}
+
+/*
+ * Finds the run of pages around Address that can be paged out together. The
+ * run stays within the region so all of its pages have the same protection.
+ */
+static
+ULONG
+MiGatherPageOutCluster(
+    _In_ PEPROCESS Process,
+    _In_ PMEMORY_AREA MemoryArea,
+    _In_ PVOID Address,
+    _Out_ PVOID *StartAddress)
+{
+    PMM_REGION Region;
+    PVOID RegionBase;
+    ULONG_PTR Low, High, Start, End;
+
+    Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
+                          &MemoryArea->SectionData.RegionListHead,
+                          Address, &RegionBase);
+
+    Low = (ULONG_PTR)RegionBase;
+    High = min((ULONG_PTR)RegionBase + Region->Length, MA_GetEndingAddress(MemoryArea));
+
+    Start = (ULONG_PTR)Address;
+    while (Start > Low &&
+           (ULONG_PTR)Address - Start < (MM_SWAP_CLUSTER_SIZE - 1) * PAGE_SIZE &&
+           MiIsPageOutCandidate(Process, MemoryArea, (PVOID)(Start - PAGE_SIZE)))
+    {
+        Start -= PAGE_SIZE;
+    }
+
+    End = (ULONG_PTR)Address + PAGE_SIZE;
+    while (End < High &&
+           End - Start < MM_SWAP_CLUSTER_SIZE * PAGE_SIZE &&
+           MiIsPageOutCandidate(Process, MemoryArea, (PVOID)End))
+    {
+        End += PAGE_SIZE;
+    }
+
+    *StartAddress = (PVOID)Start;
+    return (ULONG)((End - Start) >> PAGE_SHIFT);
+}
+
 NTSTATUS
 NTAPI
-MmPageOutPhysicalAddress(PFN_NUMBER Page)
+MmPageOutPhysicalAddress(
+    _In_ PFN_NUMBER Page,
+    _Out_opt_ PULONG PagesFreed)
 {
     PMM_RMAP_ENTRY entry;
     PMEMORY_AREA MemoryArea;
@@ -60,6 +139,9 @@ MmPageOutPhysicalAddress(PFN_NUMBER Page)
     LARGE_INTEGER SegmentOffset;
     KIRQL OldIrql;
 
+    if (PagesFreed)
+        *PagesFreed = 1;
+
 GetEntry:
     OldIrql = MiAcquirePfnLock();
 
@@ -176,24 +258,67 @@ GetEntry:
         if (Page != PFN_FROM_SSE(Entry))
         {
             SWAPENTRY SwapEntry;
+            PFN_NUMBER Pages[MM_SWAP_CLUSTER_SIZE];
+            PVOID StartAddress = Address;
+            PVOID ClusterAddress;
+            ULONG Count = 1;
+            ULONG Index = 0;
+            ULONG i;
 
             /* This page is private to the process */
-            MmUnlockSectionSegment(Segment);
+            Pages[0] = Page;
 
             /* Check if we should write it back to the page file */
             SwapEntry = MmGetSavedSwapEntryPage(Page);
 
-            if ((SwapEntry == 0) && Dirty)
+            if (Dirty)
             {
-                /* We don't have a Swap entry, yet the page is dirty. Get one */
-                SwapEntry = MmAllocSwapPage();
-                if (!SwapEntry)
+                SWAPENTRY ClusterEntry;
+                ULONG RunLength;
+
+                /* Take the dirty neighbours along, they go out with the same write */
+                Count = MiGatherPageOutCluster(Process, MemoryArea, Address, &StartAddress);
+                Index = (ULONG)(((ULONG_PTR)Address - (ULONG_PTR)StartAddress) >> PAGE_SHIFT);
+                MmUnlockSectionSegment(Segment);
+
+                /* Get a fresh run of slots for the whole cluster */
+                RunLength = Count;
+                ClusterEntry = MmAllocSwapPages(&RunLength);
+                if (ClusterEntry)
+                {
+                    /* The copy we had in the paging file is stale anyway */
+                    if (SwapEntry)
+                    {
+                        MmSetSavedSwapEntryPage(Page, 0);
+                        MmFreeSwapPage(SwapEntry);
+                    }
+                    SwapEntry = ClusterEntry;
+
+                    /* Only a shorter run was free, trim the cluster around our page */
+                    if (RunLength < Count)
+                    {
+                        if (Index >= RunLength)
+                        {
+                            StartAddress = (PUCHAR)StartAddress + (Index - RunLength + 1) * PAGE_SIZE;
+                            Index = RunLength - 1;
+                        }
+                        Count = RunLength;
+                    }
+                }
+                else if (SwapEntry)
+                {
+                    /* Write this page alone to the slot it already has */
+                    StartAddress = Address;
+                    Count = 1;
+                    Index = 0;
+                }
+                else
                 {
                     PMM_REGION Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
                             &MemoryArea->SectionData.RegionListHead,
                             Address, NULL);
 
-                    /* We can't, so let this page in the Process VM */
+                    /* We don't have a Swap entry and can't get one, so let this page in the Process VM */
                     MmCreateVirtualMapping(Process, Address, Region->Protect, Page);
                     MmInsertRmap(Page, Process, Address);
                     MmSetDirtyPage(Process, Address);
@@ -207,36 +332,71 @@ GetEntry:
                     return STATUS_UNSUCCESSFUL;
                 }
             }
+            else
+            {
+                MmUnlockSectionSegment(Segment);
+            }
 
             if (Dirty)
             {
                 SWAPENTRY Dummy;
 
-                /* Put a wait entry into the process and unlock */
-                MmCreatePageFileMapping(Process, Address, MM_WAIT_ENTRY);
+                /* Take the rest of the cluster out of the process and put wait entries everywhere */
+                for (i = 0; i < Count; i++)
+                {
+                    ClusterAddress = (PUCHAR)StartAddress + i * PAGE_SIZE;
+                    if (i != Index)
+                    {
+                        SWAPENTRY StaleEntry;
+
+                        Pages[i] = MmGetPfnForProcess(Process, ClusterAddress);
+                        MmDeleteRmap(Pages[i], Process, ClusterAddress);
+                        MmDeleteVirtualMapping(Process, ClusterAddress, NULL, NULL);
+
+                        StaleEntry = MmGetSavedSwapEntryPage(Pages[i]);
+                        if (StaleEntry)
+                        {
+                            MmSetSavedSwapEntryPage(Pages[i], 0);
+                            MmFreeSwapPage(StaleEntry);
+                        }
+                    }
+                    else
+                    {
+                        Pages[i] = Page;
+                    }
+                    MmCreatePageFileMapping(Process, ClusterAddress, MM_WAIT_ENTRY);
+                }
                 MmUnlockAddressSpace(AddressSpace);
 
-                Status = MmWriteToSwapPage(SwapEntry, Page);
+                Status = MmWriteToSwapPages(SwapEntry, Pages, Count);
 
                 MmLockAddressSpace(AddressSpace);
-                MmDeletePageFileMapping(Process, Address, &Dummy);
-                ASSERT(Dummy == MM_WAIT_ENTRY);
+                for (i = 0; i < Count; i++)
+                {
+                    MmDeletePageFileMapping(Process, (PUCHAR)StartAddress + i * PAGE_SIZE, &Dummy);
+                    ASSERT(Dummy == MM_WAIT_ENTRY);
+                }
 
                 if (!NT_SUCCESS(Status))
                 {
-                    /* We failed at saving the content of this page. Keep it in */
+                    /* We failed at saving the content of these pages. Keep them in */
                     PMM_REGION Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
                             &MemoryArea->SectionData.RegionListHead,
                             Address, NULL);
 
-                    /* This Swap Entry is useless to us */
-                    MmSetSavedSwapEntryPage(Page, 0);
-                    MmFreeSwapPage(SwapEntry);
+                    for (i = 0; i < Count; i++)
+                    {
+                        ClusterAddress = (PUCHAR)StartAddress + i * PAGE_SIZE;
 
-                    /* We can't, so let this page in the Process VM */
-                    MmCreateVirtualMapping(Process, Address, Region->Protect, Page);
-                    MmInsertRmap(Page, Process, Address);
-                    MmSetDirtyPage(Process, Address);
+                        /* This Swap Entry is useless to us */
+                        MmSetSavedSwapEntryPage(Pages[i], 0);
+                        MmFreeSwapPage(MmAdvanceSwapEntry(SwapEntry, i));
+
+                        /* We can't, so let this page in the Process VM */
+                        MmCreateVirtualMapping(Process, ClusterAddress, Region->Protect, Pages[i]);
+                        MmInsertRmap(Pages[i], Process, ClusterAddress);
+                        MmSetDirtyPage(Process, ClusterAddress);
+                    }
 
                     MmUnlockAddressSpace(AddressSpace);
                     if (Process != PsInitialSystemProcess)
@@ -251,11 +411,16 @@ GetEntry:
             if (SwapEntry)
             {
                 /* Keep this in the process VM */
-                MmCreatePageFileMapping(Process, Address, SwapEntry);
-                MmSetSavedSwapEntryPage(Page, 0);
+                for (i = 0; i < Count; i++)
+                {
+                    MmCreatePageFileMapping(Process,
+                                            (PUCHAR)StartAddress + i * PAGE_SIZE,
+                                            MmAdvanceSwapEntry(SwapEntry, i));
+                    MmSetSavedSwapEntryPage(Pages[i], 0);
+                }
             }
 
-            /* We can finally let this page go */
+            /* We can finally let these pages go */
             MmUnlockAddressSpace(AddressSpace);
             if (Process != PsInitialSystemProcess)
                 KeDetachProcess();
@@ -264,11 +429,17 @@ GetEntry:
             ASSERT(MmGetRmapListHeadPage(Page) == NULL);
             MiReleasePfnLock(OldIrql);
 #endif
-            MmReleasePageMemoryConsumer(MC_USER, Page);
+            for (i = 0; i < Count; i++)
+            {
+                MmReleasePageMemoryConsumer(MC_USER, Pages[i]);
+            }
 
             ExReleaseRundownProtection(&Process->RundownProtect);
             ObDereferenceObject(Process);
 
+            if (PagesFreed)
+                *PagesFreed = Count;
+
             return STATUS_SUCCESS;
         }
 
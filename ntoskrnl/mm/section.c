@@ -195,6 +195,11 @@ POBJECT_TYPE MmSectionObjectType = NULL;
 
 ULONG_PTR MmSubsectionBase;
 
+/* Size of the window around a fault on a mapped file that is read in and mapped with it */
+ULONG MmFaultAroundSize = _64K;
+
+#define MI_MAXIMUM_FAULT_AROUND_SIZE (1024 * 1024)
+
 static ULONG SectionCharacteristicsToProtect[16] =
 {
     PAGE_NOACCESS,          /* 0 = NONE */
@@ -1532,6 +1537,179 @@ MmAlterViewAttributes(PMMSUPPORT AddressSpace,
     MmUnlockSectionSegment(Segment);
 }
 
+/*
+ * The fault-around window is the MmFaultAroundSize aligned block of the view
+ * around the faulting address, cut down to the region of that address.
+ */
+static
+VOID
+MiGetFaultAroundWindow(
+    _In_ PMEMORY_AREA MemoryArea,
+    _In_ PVOID Address,
+    _Out_ PULONG_PTR WindowStart,
+    _Out_ PULONG_PTR WindowEnd)
+{
+    ULONG_PTR AreaStart = MA_GetStartingAddress(MemoryArea);
+    ULONG_PTR AreaEnd = MA_GetEndingAddress(MemoryArea);
+    ULONG_PTR Size, Start, End;
+    PMM_REGION Region;
+    PVOID RegionBase;
+
+    Size = PAGE_ROUND_DOWN(min(MmFaultAroundSize, MI_MAXIMUM_FAULT_AROUND_SIZE));
+    if (Size <= PAGE_SIZE)
+    {
+        /* Disabled */
+        *WindowStart = PAGE_ROUND_DOWN(Address);
+        *WindowEnd = *WindowStart + PAGE_SIZE;
+        return;
+    }
+
+    Start = AreaStart + (((ULONG_PTR)Address - AreaStart) / Size) * Size;
+    End = min(Start + Size, AreaEnd);
+
+    Region = MmFindRegion((PVOID)AreaStart,
+                          &MemoryArea->SectionData.RegionListHead,
+                          Address, &RegionBase);
+    *WindowStart = max(Start, (ULONG_PTR)RegionBase);
+    *WindowEnd = min(End, (ULONG_PTR)RegionBase + Region->Length);
+}
+
+/*
+ * Maps the resident pages of the segment that lie in the fault-around window
+ * into the PTEs that are still empty, so walking through a view does not take
+ * a fault on every page. Called with the segment locked.
+ */
+static
+VOID
+MiMapFaultAroundPages(
+    _In_ PEPROCESS Process,
+    _In_ PMEMORY_AREA MemoryArea,
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ PVOID Address,
+    _In_ ULONG Attributes)
+{
+    ULONG_PTR WindowStart, WindowEnd, Current;
+    LARGE_INTEGER Offset;
+    ULONG_PTR Entry;
+    PFN_NUMBER Page;
+
+    if (Process == NULL)
+        return;
+
+    MiGetFaultAroundWindow(MemoryArea, Address, &WindowStart, &WindowEnd);
+
+    for (Current = WindowStart; Current < WindowEnd; Current += PAGE_SIZE)
+    {
+        if (Current == PAGE_ROUND_DOWN(Address))
+            continue;
+
+        /* Leave anything that is mapped, private or otherwise special alone */
+        if (MmIsPagePresent(Process, (PVOID)Current) ||
+            MmIsPageSwapEntry(Process, (PVOID)Current) ||
+            MmIsDisabledPage(Process, (PVOID)Current))
+        {
+            continue;
+        }
+
+        Offset.QuadPart = Current - MA_GetStartingAddress(MemoryArea)
+                          + MemoryArea->SectionData.ViewOffset;
+        Entry = MmGetPageEntrySectionSegment(Segment, &Offset);
+        if (Entry == 0 || IS_SWAP_FROM_SSE(Entry))
+            continue;
+
+        Page = PFN_FROM_SSE(Entry);
+        if (!NT_SUCCESS(MmCreateVirtualMapping(Process, (PVOID)Current, Attributes, Page)))
+            break;
+
+        MmInsertRmap(Page, Process, (PVOID)Current);
+        MmSharePageEntrySectionSegment(Segment, &Offset);
+    }
+}
+
+/*
+ * Faults that have to wait for the paging file or the backing file are charged
+ * to the process, next to the page fault count.
+ */
+static
+VOID
+MiCountHardFault(
+    _In_opt_ PEPROCESS Process)
+{
+    if (Process)
+        InterlockedIncrement((PLONG)&Process->Vm.HardFaultCount);
+}
+
+/*
+ * Tells the prefetcher which page of a file the current thread needed, image
+ * pages by their offset in the image, so a later launch can read them first.
+ */
+static
+VOID
+MiLogPrefetchFault(
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ PLARGE_INTEGER Offset)
+{
+    if (!CcPfEnablePrefetcher || !Segment->FileObject)
+        return;
+
+    if (*Segment->Flags & MM_DATAFILE_SEGMENT)
+        CcPfLogPageFault(Segment->FileObject, Offset->QuadPart, FALSE);
+    else
+        CcPfLogPageFault(Segment->FileObject, Segment->Image.VirtualAddress + Offset->QuadPart, TRUE);
+}
+
+/*
+ * Pages written together by the clustered page-out sit in consecutive paging
+ * file slots. Those that follow the faulting one are read in with it, as long
+ * as memory is not short. They get a wait entry like the faulting page and
+ * the count of pages in the cluster is returned.
+ */
+static
+ULONG
+MiGatherPageInCluster(
+    _In_ PEPROCESS Process,
+    _In_ PMEMORY_AREA MemoryArea,
+    _In_ PVOID Address,
+    _In_ SWAPENTRY SwapEntry,
+    _Inout_updates_(MM_SWAP_CLUSTER_SIZE) PPFN_NUMBER Pages)
+{
+    PMM_REGION Region;
+    PVOID RegionBase;
+    PVOID NextAddress;
+    ULONG_PTR End;
+    SWAPENTRY NextEntry;
+    SWAPENTRY DummyEntry;
+    ULONG Count;
+
+    if (Process == NULL || MmAvailablePages < MmMinimumFreePages + MM_SWAP_CLUSTER_SIZE)
+        return 1;
+
+    /* Stay in the region, the whole cluster is mapped with the same protection */
+    Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
+                          &MemoryArea->SectionData.RegionListHead,
+                          Address, &RegionBase);
+    End = min((ULONG_PTR)RegionBase + Region->Length, MA_GetEndingAddress(MemoryArea));
+
+    for (Count = 1; Count < MM_SWAP_CLUSTER_SIZE; Count++)
+    {
+        NextAddress = (PUCHAR)Address + Count * PAGE_SIZE;
+        if ((ULONG_PTR)NextAddress >= End || !MmIsPageSwapEntry(Process, NextAddress))
+            break;
+
+        MmGetPageFileMapping(Process, NextAddress, &NextEntry);
+        if (NextEntry != MmAdvanceSwapEntry(SwapEntry, Count))
+            break;
+
+        if (!NT_SUCCESS(MmRequestPageMemoryConsumer(MC_USER, FALSE, &Pages[Count])))
+            break;
+
+        MmDeletePageFileMapping(Process, NextAddress, &DummyEntry);
+        MmCreatePageFileMapping(Process, NextAddress, MM_WAIT_ENTRY);
+    }
+
+    return Count;
+}
+
 NTSTATUS
 NTAPI
 MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
@@ -1615,6 +1793,10 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     if (HasSwapEntry)
     {
         SWAPENTRY DummyEntry;
+        PFN_NUMBER Pages[MM_SWAP_CLUSTER_SIZE];
+        PVOID ClusterAddress;
+        ULONG Count;
+        ULONG i;
 
         MmGetPageFileMapping(Process, Address, &SwapEntry);
         if (SwapEntry == MM_WAIT_ENTRY)
@@ -1647,39 +1829,51 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         /* Tell everyone else we are serving the fault. */
         MmCreatePageFileMapping(Process, Address, MM_WAIT_ENTRY);
 
+        /* Bring the rest of the cluster in with the same read */
+        Pages[0] = Page;
+        Count = MiGatherPageInCluster(Process, MemoryArea, PAddress, SwapEntry, Pages);
+
         MmUnlockAddressSpace(AddressSpace);
 
-        Status = MmReadFromSwapPage(SwapEntry, Page);
+        MiCountHardFault(Process);
+        Status = MmReadFromSwapPages(SwapEntry, Pages, Count);
         if (!NT_SUCCESS(Status))
         {
-            DPRINT1("MmReadFromSwapPage failed, status = %x\n", Status);
+            DPRINT1("MmReadFromSwapPages failed, status = %x\n", Status);
             KeBugCheck(MEMORY_MANAGEMENT);
         }
 
         MmLockAddressSpace(AddressSpace);
-        MmDeletePageFileMapping(Process, PAddress, &DummyEntry);
-        ASSERT(DummyEntry == MM_WAIT_ENTRY);
 
-        Status = MmCreateVirtualMapping(Process,
-                                        PAddress,
-                                        Region->Protect,
-                                        Page);
-        if (!NT_SUCCESS(Status))
+        for (i = 0; i < Count; i++)
         {
-            DPRINT("MmCreateVirtualMapping failed, not out of memory\n");
-            KeBugCheck(MEMORY_MANAGEMENT);
-            return Status;
-        }
+            ClusterAddress = (PUCHAR)PAddress + i * PAGE_SIZE;
 
-        /*
-         * Store the swap entry for later use.
-         */
-        MmSetSavedSwapEntryPage(Page, SwapEntry);
+            MmDeletePageFileMapping(Process, ClusterAddress, &DummyEntry);
+            ASSERT(DummyEntry == MM_WAIT_ENTRY);
+
+            Status = MmCreateVirtualMapping(Process,
+                                            ClusterAddress,
+                                            Region->Protect,
+                                            Pages[i]);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT("MmCreateVirtualMapping failed, not out of memory\n");
+                KeBugCheck(MEMORY_MANAGEMENT);
+                return Status;
+            }
+
+            /*
+             * Store the swap entry for later use.
+             */
+            MmSetSavedSwapEntryPage(Pages[i], MmAdvanceSwapEntry(SwapEntry, i));
+
+            /*
+             * Add the page to the process's working set
+             */
+            if (Process) MmInsertRmap(Pages[i], Process, ClusterAddress);
+        }
 
-        /*
-         * Add the page to the process's working set
-         */
-        if (Process) MmInsertRmap(Page, Process, Address);
         /*
          * Finish the operation
          */
@@ -1772,6 +1966,19 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             return STATUS_SUCCESS;
         }
 
+        /* Read the whole fault-around window, unless the file is accessed randomly or memory is short */
+        ULONG_PTR WindowStart, WindowEnd;
+        LONGLONG ReadOffset = Offset.QuadPart;
+        ULONG ReadLength = PAGE_SIZE;
+
+        if (!FlagOn(Segment->FileObject->Flags, FO_RANDOM_ACCESS) &&
+            MmAvailablePages > MmMinimumFreePages + (MI_MAXIMUM_FAULT_AROUND_SIZE >> PAGE_SHIFT))
+        {
+            MiGetFaultAroundWindow(MemoryArea, PAddress, &WindowStart, &WindowEnd);
+            ReadOffset -= (ULONG_PTR)PAddress - WindowStart;
+            ReadLength = (ULONG)(WindowEnd - WindowStart);
+        }
+
         MmUnlockSectionSegment(Segment);
         MmUnlockAddressSpace(AddressSpace);
 
@@ -1780,7 +1987,8 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
 
         PFSRTL_COMMON_FCB_HEADER FcbHeader = Segment->FileObject->FsContext;
 
-        Status = MmMakeSegmentResident(Segment, Offset.QuadPart, PAGE_SIZE, &FcbHeader->ValidDataLength, FALSE);
+        MiCountHardFault(Process);
+        Status = MmMakeSegmentResident(Segment, ReadOffset, ReadLength, &FcbHeader->ValidDataLength, FALSE);
 
         FsRtlReleaseFile(Segment->FileObject);
 
@@ -1831,6 +2039,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
 
         MmUnlockAddressSpace(AddressSpace);
 
+        MiCountHardFault(Process);
         Status = MmReadFromSwapPage(SwapEntry, Page);
         if (!NT_SUCCESS(Status))
         {
@@ -1903,6 +2112,12 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
 
         /* Take a reference on it */
         MmSharePageEntrySectionSegment(Segment, &Offset);
+
+        /* Pages read in for a fault come back here once the read is done */
+        MiLogPrefetchFault(Segment, &Offset);
+
+        /* Map what is already resident around it too */
+        MiMapFaultAroundPages(Process, MemoryArea, Segment, PAddress, Attributes);
         MmUnlockSectionSegment(Segment);
 
         DPRINT("Address 0x%p\n", Address);
@@ -4996,6 +5211,138 @@ MmMakeDataSectionResident(
     return Status;
 }
 
+/*
+ * Reads the pages of one read list into the segments of its file. Offsets of
+ * image lists are relative to the image base, the others are file offsets.
+ * Consecutive pages of the list go to the disk as one run.
+ */
+static
+NTSTATUS
+MiPrefetchReadList(
+    _In_ PREAD_LIST ReadList)
+{
+    PSECTION_OBJECT_POINTERS SectionObjectPointer = ReadList->FileObject->SectionObjectPointer;
+    PMM_IMAGE_SECTION_OBJECT ImageSectionObject = NULL;
+    PMM_SECTION_SEGMENT Segment = NULL;
+    PFSRTL_COMMON_FCB_HEADER FcbHeader;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i = 0;
+
+    if (ReadList->IsImage)
+    {
+        /* Only fill an image section that is already there, the caller keeps one open */
+        KIRQL OldIrql = MiAcquirePfnLock();
+        ImageSectionObject = SectionObjectPointer->ImageSectionObject;
+        if (ImageSectionObject && !(ImageSectionObject->SegFlags & (MM_SEGMENT_INCREATE | MM_SEGMENT_INDELETE)))
+            InterlockedIncrement64(&ImageSectionObject->RefCount);
+        else
+            ImageSectionObject = NULL;
+        MiReleasePfnLock(OldIrql);
+    }
+    else
+    {
+        Segment = MiGrabDataSection(SectionObjectPointer);
+    }
+
+    if (!ImageSectionObject && !Segment)
+        return STATUS_NOT_MAPPED_VIEW;
+
+    /* Same as a fault, keep the VDL stable while reading */
+    FsRtlAcquireFileExclusive(ReadList->FileObject);
+    FcbHeader = ReadList->FileObject->FsContext;
+
+    while (i < ReadList->NumberOfEntries)
+    {
+        LONGLONG RunStart = PAGE_ROUND_DOWN_64(ReadList->List[i].Alignment);
+        LONGLONG RunEnd = RunStart + PAGE_SIZE;
+
+        for (i++; i < ReadList->NumberOfEntries; i++)
+        {
+            if (PAGE_ROUND_DOWN_64(ReadList->List[i].Alignment) != RunEnd)
+                break;
+            RunEnd += PAGE_SIZE;
+        }
+
+        /* Don't push out what others are using for what might be needed */
+        if (MmAvailablePages < MmMinimumFreePages + ((RunEnd - RunStart) >> PAGE_SHIFT))
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        if (ImageSectionObject)
+        {
+            ULONG s;
+
+            /* A run may cross from one image segment into the next */
+            for (s = 0; s < ImageSectionObject->NrSegments; s++)
+            {
+                PMM_SECTION_SEGMENT ImageSegment = &ImageSectionObject->Segments[s];
+                LONGLONG SegmentStart = ImageSegment->Image.VirtualAddress;
+                LONGLONG SegmentEnd = SegmentStart + ImageSegment->Length.QuadPart;
+                LONGLONG Start = max(RunStart, SegmentStart);
+                LONGLONG End = min(RunEnd, SegmentEnd);
+
+                if (Start >= End)
+                    continue;
+
+                Status = MmMakeSegmentResident(ImageSegment,
+                                               Start - SegmentStart,
+                                               (ULONG)(End - Start),
+                                               &FcbHeader->ValidDataLength,
+                                               FALSE);
+                if (!NT_SUCCESS(Status))
+                    break;
+            }
+        }
+        else
+        {
+            Status = MmMakeSegmentResident(Segment,
+                                           RunStart,
+                                           (ULONG)(RunEnd - RunStart),
+                                           &FcbHeader->ValidDataLength,
+                                           FALSE);
+        }
+
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+
+    FsRtlReleaseFile(ReadList->FileObject);
+
+    if (ImageSectionObject)
+        MmDereferenceSegment(ImageSectionObject->Segments);
+    else
+        MmDereferenceSegment(Segment);
+
+    return Status;
+}
+
+/*
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+MmPrefetchPages(IN ULONG NumberOfLists,
+                IN PREAD_LIST *ReadLists)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < NumberOfLists; i++)
+    {
+        Status = MiPrefetchReadList(ReadLists[i]);
+
+        /* A file that is gone does not keep the others from being read */
+        if (Status == STATUS_INSUFFICIENT_RESOURCES)
+            break;
+    }
+
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 MmMakeSegmentDirty(
@@ -1126,7 +1126,8 @@ PspExitProcess(IN BOOLEAN LastThread,
             /* FIXME: Check job status code and do I/O completion if needed */
         }
 
-        /* FIXME: Notify the Prefetcher */
+        /* Notify the Prefetcher */
+        CcPfProcessExitNotification(Process);
     }
     else
     {
@@ -17,6 +17,17 @@
 /* Debugging Level */
 ULONG PspTraceLevel = 0;
 
+/* ProcessWorkingSetStatistics is far past the end of PsProcessInfoClass */
+static const INFORMATION_CLASS_INFO PspWorkingSetStatisticsInfo[] =
+{
+    IQS_SAME
+    (
+        PROCESS_WS_STATISTICS_INFORMATION,
+        ULONG,
+        ICIF_QUERY
+    ),
+};
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 NTSTATUS
@@ -49,6 +60,66 @@ PsReferenceProcessFilePointer(IN PEPROCESS Process,
     return Section ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
 }
 
+static
+NTSTATUS
+PspQueryWorkingSetStatistics(
+    _In_ HANDLE ProcessHandle,
+    _Out_ PVOID ProcessInformation,
+    _In_ ULONG ProcessInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _In_ KPROCESSOR_MODE PreviousMode)
+{
+    PPROCESS_WS_STATISTICS_INFORMATION WsStatistics = ProcessInformation;
+    PEPROCESS Process;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    /* Same checks as for the other classes */
+    Status = DefaultQueryInfoBufferCheck(0,
+                                         PspWorkingSetStatisticsInfo,
+                                         RTL_NUMBER_OF(PspWorkingSetStatisticsInfo),
+                                         ICIF_PROBE_READ,
+                                         ProcessInformation,
+                                         ProcessInformationLength,
+                                         ReturnLength,
+                                         NULL,
+                                         PreviousMode);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Reference the process */
+    Status = ObReferenceObjectByHandle(ProcessHandle,
+                                       PROCESS_QUERY_INFORMATION,
+                                       PsProcessType,
+                                       PreviousMode,
+                                       (PVOID*)&Process,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Enter SEH for write safety */
+    _SEH2_TRY
+    {
+        /* Return data from the working set */
+        WsStatistics->WorkingSetSize = Process->Vm.WorkingSetSize;
+        WsStatistics->PeakWorkingSetSize = Process->Vm.PeakWorkingSetSize;
+        WsStatistics->PageFaultCount = Process->Vm.PageFaultCount;
+        WsStatistics->HardFaultCount = Process->Vm.HardFaultCount;
+        WsStatistics->AccessedPageCount = Process->Vm.AccessedPageCount;
+
+        if (ReturnLength) *ReturnLength = sizeof(PROCESS_WS_STATISTICS_INFORMATION);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Get the exception code */
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    /* Dereference the process */
+    ObDereferenceObject(Process);
+    return Status;
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -70,6 +141,16 @@ NtQueryInformationProcess(
 
     PAGED_CODE();
 
+    /* Our own class has no place in the table */
+    if (ProcessInformationClass == ProcessWorkingSetStatistics)
+    {
+        return PspQueryWorkingSetStatistics(ProcessHandle,
+                                            ProcessInformation,
+                                            ProcessInformationLength,
+                                            ReturnLength,
+                                            PreviousMode);
+    }
+
     /* Verify Information Class validity */
     Status = DefaultQueryInfoBufferCheck(ProcessInformationClass,
                                          PsProcessInfoClass,
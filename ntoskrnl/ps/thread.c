@@ -15,7 +15,6 @@
 
 /* GLOBALS ******************************************************************/
 
-extern BOOLEAN CcPfEnablePrefetcher;
 extern ULONG MmReadClusterSize;
 POBJECT_TYPE PsThreadType = NULL;
 
@@ -65,7 +64,12 @@ PspUserThreadStartup(IN PKSTART_ROUTINE StartRoutine,
         /* Check if the Prefetcher is enabled */
         if (CcPfEnablePrefetcher)
         {
-            /* FIXME: Prepare to prefetch this process */
+            /* Prefetch this process, once and before it runs any user code */
+            if (!(PspSetProcessFlag(Thread->ThreadsProcess, PSF_LAUNCH_PREFETCHED_BIT) &
+                  PSF_LAUNCH_PREFETCHED_BIT))
+            {
+                CcPfBeginAppLaunch(Thread->ThreadsProcess);
+            }
         }
 
         /* Raise to APC */
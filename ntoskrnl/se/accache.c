@@ -0,0 +1,353 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Security access check result cache
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ********************************************************************/
+
+/*
+ * Each token gets its own cache the first time one of its access checks
+ * is stored. The cache is a small direct-mapped table indexed by a hash
+ * of the DACL contents and the requested access, so the checks of one
+ * token never evict those of another, and the cache goes away with the
+ * token. Each slot keeps a private copy of the DACL it was computed from,
+ * so a hit is only reported when the ACEs are byte-for-byte identical.
+ * Entries are tied to the token's ModifiedId, which gets a fresh LUID
+ * every time the groups, privileges or other security-relevant bits of
+ * the token are adjusted, hence stale entries can never match again.
+ */
+#define SEP_ACCESS_CACHE_ENTRIES        16
+#define SEP_ACCESS_CACHE_MAX_ACL_SIZE   256
+
+typedef struct _SEP_ACCESS_CACHE_ENTRY
+{
+    LUID ModifiedId;
+    ULONG DaclHash;
+    USHORT DaclSize;
+    BOOLEAN InUse;
+    GENERIC_MAPPING GenericMapping;
+    ACCESS_MASK DesiredAccess;
+    ACCESS_MASK RemainingAccess;
+    ACCESS_MASK PreviouslyGrantedAccess;
+    ACCESS_MASK GrantedAccess;
+    NTSTATUS AccessStatus;
+    UCHAR Dacl[SEP_ACCESS_CACHE_MAX_ACL_SIZE];
+} SEP_ACCESS_CACHE_ENTRY, *PSEP_ACCESS_CACHE_ENTRY;
+
+typedef struct _SEP_ACCESS_CACHE
+{
+    EX_PUSH_LOCK Lock;
+    SEP_ACCESS_CACHE_ENTRY Entries[SEP_ACCESS_CACHE_ENTRIES];
+} SEP_ACCESS_CACHE, *PSEP_ACCESS_CACHE;
+
+/* PRIVATE FUNCTIONS **********************************************************/
+
+/**
+ * @brief
+ * Computes the hash of a DACL, used to pick a cache slot.
+ *
+ * @param[in] Dacl
+ * A pointer to a DACL to be hashed.
+ *
+ * @return
+ * Returns the FNV-1a hash of the whole DACL buffer.
+ */
+static
+ULONG
+SepHashAccessCacheDacl(
+    _In_ PACL Dacl)
+{
+    PUCHAR Buffer = (PUCHAR)Dacl;
+    ULONG Hash = 0x811C9DC5;
+    USHORT Index;
+
+    for (Index = 0; Index < Dacl->AclSize; Index++)
+    {
+        Hash ^= Buffer[Index];
+        Hash *= 0x01000193;
+    }
+
+    return Hash;
+}
+
+/**
+ * @brief
+ * Computes the slot index for a given access check key.
+ */
+static
+ULONG
+SepGetAccessCacheIndex(
+    _In_ ULONG DaclHash,
+    _In_ ACCESS_MASK DesiredAccess)
+{
+    ULONG Hash;
+
+    Hash = DaclHash ^ (DesiredAccess * 0x9E3779B1);
+    Hash ^= (Hash >> 16);
+
+    return Hash % SEP_ACCESS_CACHE_ENTRIES;
+}
+
+/**
+ * @brief
+ * Determines if a cache slot matches the given access check key.
+ */
+static
+BOOLEAN
+SepAccessCacheEntryMatches(
+    _In_ PSEP_ACCESS_CACHE_ENTRY Entry,
+    _In_ PTOKEN Token,
+    _In_ PACL Dacl,
+    _In_ ULONG DaclHash,
+    _In_ PGENERIC_MAPPING GenericMapping,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ACCESS_MASK RemainingAccess,
+    _In_ ACCESS_MASK PreviouslyGrantedAccess)
+{
+    return Entry->InUse &&
+           RtlEqualLuid(&Entry->ModifiedId, &Token->ModifiedId) &&
+           Entry->DaclHash == DaclHash &&
+           Entry->DaclSize == Dacl->AclSize &&
+           Entry->DesiredAccess == DesiredAccess &&
+           Entry->RemainingAccess == RemainingAccess &&
+           Entry->PreviouslyGrantedAccess == PreviouslyGrantedAccess &&
+           RtlEqualMemory(&Entry->GenericMapping, GenericMapping, sizeof(GENERIC_MAPPING)) &&
+           RtlEqualMemory(Entry->Dacl, Dacl, Dacl->AclSize);
+}
+
+/* PUBLIC FUNCTIONS ***********************************************************/
+
+/**
+ * @brief
+ * Frees the access check cache of a token that is being deleted.
+ *
+ * @param[in] Token
+ * A pointer to the token.
+ */
+VOID
+NTAPI
+SepDeleteAccessCheckCache(
+    _In_ PTOKEN Token)
+{
+    PAGED_CODE();
+
+    if (Token->AccessCheckCache)
+    {
+        ExFreePoolWithTag(Token->AccessCheckCache, TAG_SE_ACCESS_CACHE);
+        Token->AccessCheckCache = NULL;
+    }
+}
+
+/**
+ * @brief
+ * Determines whether an access check against a DACL can be served from
+ * or stored in the access check cache.
+ *
+ * @param[in] Dacl
+ * A pointer to the DACL that is about to be evaluated.
+ *
+ * @param[in] PrincipalSelfSid
+ * The principal self SID given to the access check, if any.
+ *
+ * @param[in] ObjectTypeList
+ * The object type list given to the access check, if any.
+ *
+ * @return
+ * Returns TRUE if the result of this access check only depends on the
+ * token, the DACL, the generic mapping and the desired access, FALSE
+ * otherwise.
+ */
+BOOLEAN
+NTAPI
+SepIsAccessCheckCacheable(
+    _In_ PACL Dacl,
+    _In_opt_ PSID PrincipalSelfSid,
+    _In_opt_ POBJECT_TYPE_LIST_INTERNAL ObjectTypeList)
+{
+    return PrincipalSelfSid == NULL &&
+           ObjectTypeList == NULL &&
+           Dacl->AclSize <= SEP_ACCESS_CACHE_MAX_ACL_SIZE;
+}
+
+/**
+ * @brief
+ * Looks up the result of a previous access check in the cache.
+ *
+ * @param[in] Token
+ * A pointer to the token the access check is done against. The caller
+ * must hold the token lock.
+ *
+ * @param[in] Dacl
+ * A pointer to the DACL of the object's security descriptor.
+ *
+ * @param[in] GenericMapping
+ * The generic mapping of the object type.
+ *
+ * @param[in] DesiredAccess
+ * The mapped desired access rights.
+ *
+ * @param[in] RemainingAccess
+ * The access rights that remain to be granted by the DACL, after
+ * the privilege checks.
+ *
+ * @param[in] PreviouslyGrantedAccess
+ * The access rights that have already been granted before evaluating
+ * the DACL.
+ *
+ * @param[out] GrantedAccess
+ * Receives the cached granted access rights.
+ *
+ * @param[out] AccessStatus
+ * Receives the cached access status.
+ *
+ * @return
+ * Returns TRUE if a matching entry was found, FALSE otherwise.
+ */
+BOOLEAN
+NTAPI
+SepLookupAccessCheckCache(
+    _In_ PTOKEN Token,
+    _In_ PACL Dacl,
+    _In_ PGENERIC_MAPPING GenericMapping,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ACCESS_MASK RemainingAccess,
+    _In_ ACCESS_MASK PreviouslyGrantedAccess,
+    _Out_ PACCESS_MASK GrantedAccess,
+    _Out_ PNTSTATUS AccessStatus)
+{
+    PSEP_ACCESS_CACHE Cache = Token->AccessCheckCache;
+    PSEP_ACCESS_CACHE_ENTRY Entry;
+    ULONG DaclHash;
+    BOOLEAN Found = FALSE;
+
+    PAGED_CODE();
+
+    /* Nothing was stored for this token yet */
+    if (Cache == NULL)
+        return FALSE;
+
+    DaclHash = SepHashAccessCacheDacl(Dacl);
+    Entry = &Cache->Entries[SepGetAccessCacheIndex(DaclHash, DesiredAccess)];
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&Cache->Lock);
+
+    if (SepAccessCacheEntryMatches(Entry,
+                                   Token,
+                                   Dacl,
+                                   DaclHash,
+                                   GenericMapping,
+                                   DesiredAccess,
+                                   RemainingAccess,
+                                   PreviouslyGrantedAccess))
+    {
+        *GrantedAccess = Entry->GrantedAccess;
+        *AccessStatus = Entry->AccessStatus;
+        Found = TRUE;
+    }
+
+    ExReleasePushLockShared(&Cache->Lock);
+    KeLeaveCriticalRegion();
+
+    return Found;
+}
+
+/**
+ * @brief
+ * Records the result of an access check in the cache of the token,
+ * replacing whatever entry occupied the slot before. The cache is
+ * created on the first call for a token.
+ *
+ * @param[in] Token
+ * A pointer to the token the access check was done against. The caller
+ * must hold the token lock.
+ *
+ * @param[in] Dacl
+ * A pointer to the DACL that was evaluated.
+ *
+ * @param[in] GenericMapping
+ * The generic mapping of the object type.
+ *
+ * @param[in] DesiredAccess
+ * The mapped desired access rights.
+ *
+ * @param[in] RemainingAccess
+ * The access rights that remained to be granted by the DACL.
+ *
+ * @param[in] PreviouslyGrantedAccess
+ * The access rights that were granted before evaluating the DACL.
+ *
+ * @param[in] GrantedAccess
+ * The resulting granted access rights.
+ *
+ * @param[in] AccessStatus
+ * The resulting access status.
+ */
+VOID
+NTAPI
+SepInsertAccessCheckCache(
+    _In_ PTOKEN Token,
+    _In_ PACL Dacl,
+    _In_ PGENERIC_MAPPING GenericMapping,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ ACCESS_MASK RemainingAccess,
+    _In_ ACCESS_MASK PreviouslyGrantedAccess,
+    _In_ ACCESS_MASK GrantedAccess,
+    _In_ NTSTATUS AccessStatus)
+{
+    PSEP_ACCESS_CACHE Cache = Token->AccessCheckCache;
+    PSEP_ACCESS_CACHE_ENTRY Entry;
+    ULONG DaclHash;
+
+    PAGED_CODE();
+
+    if (Cache == NULL)
+    {
+        Cache = ExAllocatePoolZero(PagedPool, sizeof(SEP_ACCESS_CACHE), TAG_SE_ACCESS_CACHE);
+        if (Cache == NULL)
+        {
+            /* Not fatal, the check is simply done again next time */
+            return;
+        }
+
+        ExInitializePushLock(&Cache->Lock);
+
+        /* The token lock may be held shared, another check could have been first */
+        if (InterlockedCompareExchangePointer(&Token->AccessCheckCache, Cache, NULL) != NULL)
+        {
+            ExFreePoolWithTag(Cache, TAG_SE_ACCESS_CACHE);
+            Cache = Token->AccessCheckCache;
+        }
+    }
+
+    DaclHash = SepHashAccessCacheDacl(Dacl);
+    Entry = &Cache->Entries[SepGetAccessCacheIndex(DaclHash, DesiredAccess)];
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&Cache->Lock);
+
+    Entry->ModifiedId = Token->ModifiedId;
+    Entry->DaclHash = DaclHash;
+    Entry->DaclSize = Dacl->AclSize;
+    Entry->GenericMapping = *GenericMapping;
+    Entry->DesiredAccess = DesiredAccess;
+    Entry->RemainingAccess = RemainingAccess;
+    Entry->PreviouslyGrantedAccess = PreviouslyGrantedAccess;
+    Entry->GrantedAccess = GrantedAccess;
+    Entry->AccessStatus = AccessStatus;
+    RtlCopyMemory(Entry->Dacl, Dacl, Dacl->AclSize);
+    Entry->InUse = TRUE;
+
+    ExReleasePushLockExclusive(&Cache->Lock);
+    KeLeaveCriticalRegion();
+}
+
+/* EOF */
@@ -968,6 +968,9 @@ SepAccessCheckWorker(
     BOOLEAN AccessIsGranted = FALSE;
     PACCESS_TOKEN Token = NULL;
     ACCESS_CHECK_RIGHTS AccessCheckRights = {0};
+    BOOLEAN CacheAccessCheck = FALSE;
+    ACCESS_MASK CacheRemainingAccess = 0;
+    ACCESS_MASK CachePreviouslyGrantedAccess = 0;
 
     PAGED_CODE();
 
@@ -1126,6 +1129,32 @@ SepAccessCheckWorker(
         goto ReturnCommonStatus;
     }
 
+    /*
+     * Walking the DACL against every group of the token is expensive,
+     * especially when the same token keeps opening objects sharing the
+     * same security descriptor. See if we have the result of this very
+     * check already cached.
+     */
+    if (SepIsAccessCheckCacheable(Dacl, PrincipalSelfSid, ObjectTypeList))
+    {
+        if (SepLookupAccessCheckCache(Token,
+                                      Dacl,
+                                      GenericMapping,
+                                      DesiredAccess,
+                                      RemainingAccess,
+                                      PreviouslyGrantedAccess,
+                                      &PreviouslyGrantedAccess,
+                                      &Status))
+        {
+            goto ReturnCommonStatus;
+        }
+
+        /* Not cached yet, remember the key so we can insert the result */
+        CacheAccessCheck = TRUE;
+        CacheRemainingAccess = RemainingAccess;
+        CachePreviouslyGrantedAccess = PreviouslyGrantedAccess;
+    }
+
     /*
      * Determine the MAXIMUM_ALLOWED access rights according to the DACL.
      * Or if the caller is supplying a list of object types then determine
@@ -1442,6 +1471,19 @@ ReturnCommonStatus:
         *AccessStatusList = Status;
     }
 
+    /* Cache the outcome of the DACL evaluation for subsequent checks */
+    if (CacheAccessCheck)
+    {
+        SepInsertAccessCheckCache(Token,
+                                  Dacl,
+                                  GenericMapping,
+                                  DesiredAccess,
+                                  CacheRemainingAccess,
+                                  CachePreviouslyGrantedAccess,
+                                  PreviouslyGrantedAccess,
+                                  Status);
+    }
+
 #if DBG
     /* Dump security debug info on access denied case */
     if (Status == STATUS_ACCESS_DENIED)
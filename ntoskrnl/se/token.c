@@ -1633,6 +1633,9 @@ SepDeleteToken(
     /* Delete the dynamic information area */
     if (AccessToken->DynamicPart)
         ExFreePoolWithTag(AccessToken->DynamicPart, TAG_TOKEN_DYNAMIC);
+
+    /* Delete the cached access check results */
+    SepDeleteAccessCheckCache(AccessToken);
 }
 
 /**
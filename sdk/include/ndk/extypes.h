@@ -1567,6 +1567,65 @@ typedef struct _SYSTEM_FIRMWARE_TABLE_INFORMATION
 
 #endif // !NTOS_MODE_USER
 
+//
+// Class 79
+//
+#define SUPERFETCH_INFORMATION_VERSION      45
+#define SUPERFETCH_INFORMATION_MAGIC        ('kuhC')
+
+typedef enum _SUPERFETCH_INFORMATION_CLASS
+{
+    SuperfetchRetrieveTrace = 1,
+    SuperfetchSystemParameters,
+    SuperfetchLogEvent,
+    SuperfetchGenerateTrace,
+    SuperfetchPrefetch,
+    SuperfetchPfnQuery,
+    SuperfetchPfnSetPriority,
+    SuperfetchPrivSourceQuery,
+    SuperfetchSequenceNumberQuery,
+    SuperfetchScenarioPhase,
+    SuperfetchWorkerPriority,
+    SuperfetchScenarioQuery,
+    SuperfetchScenarioPrefetch,
+    SuperfetchRobustnessControl,
+    SuperfetchTimeControl,
+    SuperfetchMemoryListQuery,
+    SuperfetchMemoryRangesQuery,
+    SuperfetchTracingControl,
+    SuperfetchTrimWhileAgingControl,
+    SuperfetchInformationMax
+} SUPERFETCH_INFORMATION_CLASS;
+
+#define SuperfetchPageStoreQuery ((SUPERFETCH_INFORMATION_CLASS)0x100) // ReactOS-specific
+
+typedef struct _SUPERFETCH_INFORMATION
+{
+    ULONG Version;
+    ULONG Magic;
+    SUPERFETCH_INFORMATION_CLASS InfoClass;
+    PVOID Data;
+    ULONG Length;
+} SUPERFETCH_INFORMATION, *PSUPERFETCH_INFORMATION;
+
+//
+// Data for SuperfetchPageStoreQuery
+//
+typedef struct _SYSTEM_PAGE_STORE_INFORMATION
+{
+    SIZE_T BudgetBytes;
+    SIZE_T CompressedBytes;
+    ULONG TotalSlots;
+    ULONG UsedSlots;
+    ULONG StoredPages;
+    ULONG SpilledPages;
+    ULONG StoreCount;
+    ULONG RejectCount;
+    ULONG SpillCount;
+    ULONG HitCount;
+    ULONG MissCount;
+} SYSTEM_PAGE_STORE_INFORMATION, *PSYSTEM_PAGE_STORE_INFORMATION;
+
 //
 // Class 80
 //
@@ -149,6 +149,15 @@ NtReadRequestData(
     _Out_ PULONG ReturnLength
 );
 
+NTSYSCALLAPI
+NTSTATUS
+NTAPI
+NtMapPortRing(
+    _In_ HANDLE PortHandle,
+    _In_ ULONG SlotCount,
+    _Out_ PVOID *RingBase
+);
+
 NTSYSCALLAPI
 NTSTATUS
 NTAPI
@@ -218,6 +227,15 @@ NtSecureConnectPort(
     _Inout_opt_ PULONG ConnectionInformationLength
 );
 
+NTSYSCALLAPI
+NTSTATUS
+NTAPI
+NtSignalWaitPortRing(
+    _In_ HANDLE PortHandle,
+    _In_ ULONG Flags,
+    _In_opt_ PLARGE_INTEGER Timeout
+);
+
 NTSYSCALLAPI
 NTSTATUS
 NTAPI
@@ -324,6 +342,15 @@ ZwReadRequestData(
     _Out_ PULONG ReturnLength
 );
 
+NTSYSAPI
+NTSTATUS
+NTAPI
+ZwMapPortRing(
+    _In_ HANDLE PortHandle,
+    _In_ ULONG SlotCount,
+    _Out_ PVOID *RingBase
+);
+
 NTSYSAPI
 NTSTATUS
 NTAPI
@@ -393,6 +420,15 @@ ZwSecureConnectPort(
     _Inout_opt_ PULONG ConnectionInformationLength
 );
 
+NTSYSAPI
+NTSTATUS
+NTAPI
+ZwSignalWaitPortRing(
+    _In_ HANDLE PortHandle,
+    _In_ ULONG Flags,
+    _In_opt_ PLARGE_INTEGER Timeout
+);
+
 NTSYSAPI
 NTSTATUS
 NTAPI
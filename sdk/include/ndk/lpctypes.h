@@ -89,6 +89,44 @@ typedef enum _PORT_INFORMATION_CLASS
     PortNoInformation
 } PORT_INFORMATION_CLASS;
 
+//
+// Shared Message Ring (NtMapPortRing)
+//
+// Each queue has a single producer and a single consumer. The producer
+// writes the slot at Tail and then advances Tail; if the consumer had
+// set Waiting, the producer clears it and signals with NtSignalWaitPortRing.
+// The consumer takes slots until Head reaches Tail, then sets Waiting,
+// checks Tail once more and only then waits. A client that never has more
+// than SlotCount requests outstanding can never overflow either queue.
+// The ring stays mapped after the port is closed, until the process unmaps
+// it with NtUnmapViewOfSection.
+//
+#define PORT_RING_REQUEST_QUEUE         0
+#define PORT_RING_REPLY_QUEUE           1
+#define PORT_RING_MAX_SLOTS             256
+
+#define PORT_RING_SIGNAL                0x1
+#define PORT_RING_WAIT                  0x2
+
+typedef struct _PORT_RING_QUEUE
+{
+    volatile ULONG Head;
+    volatile ULONG Tail;
+    volatile LONG Waiting;
+    ULONG SlotOffset;
+} PORT_RING_QUEUE, *PPORT_RING_QUEUE;
+
+typedef struct _PORT_RING
+{
+    ULONG SlotCount;
+    ULONG SlotSize;
+    PORT_RING_QUEUE Queue[2];
+} PORT_RING, *PPORT_RING;
+
+#define PORT_RING_SLOT(Ring, QueueIndex, Index)                         \
+    ((PVOID)((PUCHAR)(Ring) + (Ring)->Queue[QueueIndex].SlotOffset +    \
+             ((Index) & ((Ring)->SlotCount - 1)) * (Ring)->SlotSize))
+
 #ifdef NTOS_MODE_USER
 
 //
@@ -229,6 +267,7 @@ typedef struct _LPCP_PORT_OBJECT
     ULONG MaxConnectionInfoLength;
     ULONG Flags;
     KEVENT WaitEvent;
+    struct _LPCP_PORT_RING *Ring;
 } LPCP_PORT_OBJECT, *PLPCP_PORT_OBJECT;
 
 //
@@ -962,6 +962,10 @@ typedef struct _MMSUPPORT
 #if (NTDDI_VERSION >= NTDDI_LONGHORN)
     PVOID AccessLog;
 #endif
+#ifdef __REACTOS__
+    ULONG HardFaultCount;
+    ULONG AccessedPageCount;
+#endif
 } MMSUPPORT, *PMMSUPPORT;
 
 //
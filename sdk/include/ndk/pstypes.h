@@ -382,6 +382,8 @@ typedef enum _PROCESSINFOCLASS
     MaxProcessInfoClass
 } PROCESSINFOCLASS;
 
+#define ProcessWorkingSetStatistics ((PROCESSINFOCLASS)0x100) // ReactOS-specific
+
 typedef enum _THREADINFOCLASS
 {
     ThreadBasicInformation,
@@ -918,6 +920,19 @@ typedef struct _PROCESS_WS_WATCH_INFORMATION
     PVOID FaultingVa;
 } PROCESS_WS_WATCH_INFORMATION, *PPROCESS_WS_WATCH_INFORMATION;
 
+//
+// Data for ProcessWorkingSetStatistics. AccessedPageCount counts the pages
+// the balancer found used since its previous look at them.
+//
+typedef struct _PROCESS_WS_STATISTICS_INFORMATION
+{
+    SIZE_T WorkingSetSize;
+    SIZE_T PeakWorkingSetSize;
+    ULONG PageFaultCount;
+    ULONG HardFaultCount;
+    ULONG AccessedPageCount;
+} PROCESS_WS_STATISTICS_INFORMATION, *PPROCESS_WS_STATISTICS_INFORMATION;
+
 typedef struct _PROCESS_SESSION_INFORMATION
 {
     ULONG SessionId;
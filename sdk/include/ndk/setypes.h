@@ -250,7 +250,8 @@ typedef struct _TOKEN
     HANDLE ThreadCid;                                 /* 0xB8 */
     ULONG CreateMethod;                               /* 0xBC */
 #endif
-    ULONG VariablePart;                               /* 0xC0 */
+    PVOID AccessCheckCache;                           /* 0xC0, ReactOS specific, see ntoskrnl/se/accache.c */
+    ULONG VariablePart;                               /* 0xC4 */
 } TOKEN, *PTOKEN;
 
 typedef struct _AUX_ACCESS_DATA
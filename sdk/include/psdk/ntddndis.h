@@ -296,6 +296,9 @@ typedef ULONG NDIS_OID, *PNDIS_OID;
 #define OID_GEN_MINIPORT_INFO             0x00020217
 #define OID_GEN_RESET_VERIFY_PARAMETERS   0x00020218
 
+/* ReactOS-specific, answered by NDIS itself */
+#define OID_GEN_RECEIVE_QUEUE_STATISTICS  0xFF020001
+
 /* IEEE 802.3 (Ethernet) OIDs */
 #define NDIS_802_3_MAC_OPTION_PRIORITY    0x00000001
 
@@ -445,6 +448,13 @@ typedef ULONG NDIS_OID, *PNDIS_OID;
                                                METHOD_OUT_DIRECT,            \
                                                FILE_ANY_ACCESS)
 
+/* OID_GEN_RECEIVE_QUEUE_STATISTICS */
+typedef struct _NDIS_RECEIVE_QUEUE_STATISTICS {
+  ULONG QueueCount;
+  ULONG ProcessorCount;
+  ULONG ReceivedPackets[1];
+} NDIS_RECEIVE_QUEUE_STATISTICS, *PNDIS_RECEIVE_QUEUE_STATISTICS;
+
 /* Hardware status codes (OID_GEN_HARDWARE_STATUS) */
 typedef enum _NDIS_HARDWARE_STATUS {
   NdisHardwareStatusReady,
@@ -132,6 +132,12 @@ typedef struct _AFD_ENUM_NETWORK_EVENTS_INFO {
     NTSTATUS EventStatus[AFD_MAX_EVENTS];
 } AFD_ENUM_NETWORK_EVENTS_INFO, *PAFD_ENUM_NETWORK_EVENTS_INFO;
 
+typedef struct _AFD_POLL_SET_INFO {
+    HANDLE				Handle;
+    ULONG				Events;
+    PVOID				Context;
+} AFD_POLL_SET_INFO, *PAFD_POLL_SET_INFO;
+
 typedef struct _AFD_DISCONNECT_INFO {
     ULONG				DisconnectType;
     LARGE_INTEGER			Timeout;
@@ -261,6 +267,7 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DEFER_ACCEPT		35
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_POLL_SET_CONTROL		43
 
 /* AFD IOCTLs */
 
@@ -336,6 +343,8 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_POLL_SET_CONTROL \
+  _AFD_CONTROL_CODE(AFD_POLL_SET_CONTROL, METHOD_NEITHER)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
@@ -0,0 +1,74 @@
+/*
+ * PROJECT:     ReactOS Storage Stack
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Per-disk latency histograms returned by IOCTL_DISK_PERFORMANCE
+ * COPYRIGHT:   Copyright 2024 ReactOS Team
+ */
+
+#ifndef _DISKSTAT_H_
+#define _DISKSTAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Latency bucket N holds the requests that completed in less than
+// 2^(N + DISK_LATENCY_BUCKET_SHIFT) microseconds and did not fit in bucket
+// N - 1. The last bucket also holds everything slower than that.
+//
+#define DISK_LATENCY_BUCKET_SHIFT           4
+#define DISK_LATENCY_BUCKETS                20
+
+//
+// Queue depth bucket N counts the requests that found between 2^N and
+// 2^(N + 1) - 1 requests outstanding on the disk, themselves included.
+//
+#define DISK_QUEUE_DEPTH_BUCKETS            12
+
+#define DISK_LATENCY_INFORMATION_VERSION    1
+
+typedef enum _DISK_LATENCY_OPERATION
+{
+    DiskLatencyRead,
+    DiskLatencyWrite,
+    DiskLatencyFlush,
+    DiskLatencyOperationMax
+} DISK_LATENCY_OPERATION, *PDISK_LATENCY_OPERATION;
+
+//
+// Times are in 100ns units
+//
+typedef struct _DISK_LATENCY_HISTOGRAM
+{
+    ULONGLONG Count;
+    ULONGLONG TotalTime;
+    ULONGLONG MaximumTime;
+    ULONG Buckets[DISK_LATENCY_BUCKETS];
+} DISK_LATENCY_HISTOGRAM, *PDISK_LATENCY_HISTOGRAM;
+
+typedef struct _DISK_LATENCY_INFORMATION
+{
+    ULONG Version;
+    ULONG Size;
+    DISK_LATENCY_HISTOGRAM Operations[DiskLatencyOperationMax];
+    ULONG QueueDepth[DISK_QUEUE_DEPTH_BUCKETS];
+    ULONG MaximumQueueDepth;
+    ULONG Reserved;
+} DISK_LATENCY_INFORMATION, *PDISK_LATENCY_INFORMATION;
+
+//
+// Output of IOCTL_DISK_PERFORMANCE when the buffer is large enough,
+// callers that only know about DISK_PERFORMANCE get just that.
+//
+typedef struct _DISK_PERFORMANCE_EX
+{
+    DISK_PERFORMANCE Performance;
+    DISK_LATENCY_INFORMATION Latency;
+} DISK_PERFORMANCE_EX, *PDISK_PERFORMANCE_EX;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DISKSTAT_H_ */
@@ -15,5 +15,29 @@ typedef struct _NS_ROUTINE {
     DWORD        dwPriority;
 } NS_ROUTINE, *PNS_ROUTINE, * FAR LPNS_ROUTINE;
 
+/*
+ * Poll sets, a ReactOS extension queried with SIO_GET_EXTENSION_FUNCTION_POINTER.
+ * A poll set is bound to an I/O completion port. Each registered socket posts one
+ * completion (key = CompletionKey, overlapped = Context, bytes = FD_* events) when
+ * it becomes ready, then stays quiet until it is registered again. Registering a
+ * socket with no events removes it from the set.
+ */
+#define WSAID_POLLSETCREATE \
+    {0xdc218fef,0x154a,0x4f9a,{0x92,0x53,0xe7,0x3d,0x00,0x28,0xa2,0xba}}
+#define WSAID_POLLSETCONTROL \
+    {0x887b2090,0xe99f,0x49bb,{0xa2,0x25,0xe8,0x59,0x6e,0x9d,0x45,0x68}}
+
+typedef HANDLE
+(WINAPI *LPFN_POLLSETCREATE)(
+    HANDLE CompletionPort,
+    ULONG_PTR CompletionKey);
+
+typedef INT
+(WINAPI *LPFN_POLLSETCONTROL)(
+    HANDLE PollSet,
+    SOCKET Socket,
+    LONG NetworkEvents,
+    PVOID Context);
+
 #endif
 
@@ -325,6 +325,8 @@ typedef struct _CMHIVE
     EX_PUSH_LOCK WriterLock;
     PKTHREAD WriterLockOwner;
     PERESOURCE FlusherLock;
+    EX_PUSH_LOCK FlushSerializerLock;
+    PKTHREAD FlushSerializerOwner;
     EX_PUSH_LOCK SecurityLock;
     PKTHREAD HiveSecurityLockOwner;
     LIST_ENTRY LRUViewListHead;
@@ -374,6 +376,22 @@ typedef struct _HV_TRACK_CELL_REF
     USHORT StaticCount;
 } HV_TRACK_CELL_REF, *PHV_TRACK_CELL_REF;
 
+//
+// Point-in-time copy of the dirty blocks of a hive, captured under the
+// flusher lock and written out to the log and primary files without it
+//
+typedef struct _HV_HIVE_SNAPSHOT
+{
+    HBASE_BLOCK BaseBlock;
+    ULONG Sequence;
+    ULONG AdvancedSequence;
+    ULONG DirtyCount;
+    PULONG DirtyBlocks;
+    ULONG LogDataOffset;
+    ULONG LogBufferSize;
+    PUCHAR LogBuffer;
+} HV_HIVE_SNAPSHOT, *PHV_HIVE_SNAPSHOT;
+
 extern ULONG CmlibTraceLevel;
 
 //
@@ -518,6 +536,25 @@ BOOLEAN CMAPI
 HvWriteHive(
    PHHIVE RegistryHive);
 
+BOOLEAN
+CMAPI
+HvCaptureHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _Out_ PHV_HIVE_SNAPSHOT *Snapshot);
+
+BOOLEAN
+CMAPI
+HvWriteHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _In_ PHV_HIVE_SNAPSHOT Snapshot);
+
+VOID
+CMAPI
+HvReleaseHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _In_ PHV_HIVE_SNAPSHOT Snapshot,
+    _In_ BOOLEAN Written);
+
 BOOLEAN
 CMAPI
 HvWriteAlternateHive(
@@ -444,6 +444,113 @@ HvpWriteHive(
     return TRUE;
 }
 
+/**
+ * @brief
+ * Writes the dirty blocks of a hive snapshot to a
+ * primary or alternate hive file. Blocks that are
+ * adjacent in the hive are written out at once.
+ *
+ * @param[in] RegistryHive
+ * A pointer to a hive descriptor the snapshot
+ * was captured from.
+ *
+ * @param[in] Snapshot
+ * A pointer to the snapshot to be written.
+ *
+ * @param[in] FileType
+ * The file type of a registry hive. This can be HFILE_TYPE_PRIMARY
+ * or HFILE_TYPE_ALTERNATE.
+ *
+ * @return
+ * Returns TRUE if writing to hive has succeeded,
+ * FALSE otherwise.
+ */
+static
+BOOLEAN
+CMAPI
+HvpWriteHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _In_ PHV_HIVE_SNAPSHOT Snapshot,
+    _In_ ULONG FileType)
+{
+    BOOLEAN Success;
+    ULONG FileOffset;
+    ULONG Index, RunLength;
+    PUCHAR Data;
+
+    /* Same transaction as HvpWriteHive, on the captured header */
+    Snapshot->BaseBlock.Type = HFILE_TYPE_PRIMARY;
+    Snapshot->BaseBlock.Sequence1++;
+    Snapshot->BaseBlock.CheckSum = HvpHiveHeaderChecksum(&Snapshot->BaseBlock);
+
+    FileOffset = 0;
+    Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                      &FileOffset, &Snapshot->BaseBlock,
+                                      sizeof(HBASE_BLOCK));
+    if (!Success)
+    {
+        DPRINT1("Failed to write the base block header to primary hive (primary sequence)\n");
+        return FALSE;
+    }
+
+    /* Write the dirty blocks, coalescing runs of adjacent blocks */
+    Index = 0;
+    while (Index < Snapshot->DirtyCount)
+    {
+        RunLength = 1;
+        while ((Index + RunLength < Snapshot->DirtyCount) &&
+               (Snapshot->DirtyBlocks[Index + RunLength] ==
+                Snapshot->DirtyBlocks[Index] + RunLength))
+        {
+            RunLength++;
+        }
+
+        Data = Snapshot->LogBuffer + Snapshot->LogDataOffset + Index * HBLOCK_SIZE;
+        FileOffset = (Snapshot->DirtyBlocks[Index] + 1) * HBLOCK_SIZE;
+        Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                          &FileOffset, Data,
+                                          RunLength * HBLOCK_SIZE);
+        if (!Success)
+        {
+            DPRINT1("Failed to write hive blocks to primary hive file (block index 0x%x, count %lu)\n",
+                    Snapshot->DirtyBlocks[Index], RunLength);
+            return FALSE;
+        }
+
+        Index += RunLength;
+    }
+
+    Success = RegistryHive->FileFlush(RegistryHive, FileType, NULL, 0);
+    if (!Success)
+    {
+        DPRINT1("Failed to flush the primary hive\n");
+        return FALSE;
+    }
+
+    /* Close the transaction */
+    Snapshot->BaseBlock.Sequence2++;
+    Snapshot->BaseBlock.CheckSum = HvpHiveHeaderChecksum(&Snapshot->BaseBlock);
+
+    FileOffset = 0;
+    Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                      &FileOffset, &Snapshot->BaseBlock,
+                                      sizeof(HBASE_BLOCK));
+    if (!Success)
+    {
+        DPRINT1("Failed to write the base block header to primary hive (secondary sequence)\n");
+        return FALSE;
+    }
+
+    Success = RegistryHive->FileFlush(RegistryHive, FileType, NULL, 0);
+    if (!Success)
+    {
+        DPRINT1("Failed to flush the primary hive\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 /* PUBLIC FUNCTIONS ***********************************************************/
 
 /**
@@ -679,4 +786,300 @@ HvSyncHiveFromRecover(
     return HvpWriteHive(RegistryHive, TRUE, HFILE_TYPE_PRIMARY);
 }
 
+/**
+ * @brief
+ * Captures the dirty blocks of a hive into a private
+ * snapshot, so that they can be written to the log and
+ * primary hive files without holding up the writers of
+ * the hive. The dirty vector is cleared and the sequence
+ * numbers of the hive are advanced as if the hive had
+ * been synced.
+ *
+ * @param[in] RegistryHive
+ * A pointer to a hive descriptor where the snapshot
+ * is to be captured from. The caller must hold the
+ * flusher lock of the hive exclusively.
+ *
+ * @param[out] Snapshot
+ * Receives the captured snapshot, or NULL if the
+ * hive has nothing to be written.
+ *
+ * @return
+ * Returns TRUE if the snapshot has been captured or
+ * there is nothing to capture, FALSE otherwise. The
+ * hive is left untouched on failure.
+ */
+BOOLEAN
+CMAPI
+HvCaptureHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _Out_ PHV_HIVE_SNAPSHOT *Snapshot)
+{
+    PHV_HIVE_SNAPSHOT NewSnapshot;
+    ULONG DirtyCount, BitmapSize, HeaderSize, ArraySize, Advance;
+    ULONG BlockIndex, LastIndex, Index;
+    PUCHAR Bitmap;
+
+    ASSERT(!RegistryHive->ReadOnly);
+    ASSERT(RegistryHive->Signature == HV_HHIVE_SIGNATURE);
+    ASSERT(RegistryHive->BaseBlock->Length ==
+           RegistryHive->Storage[Stable].Length * HBLOCK_SIZE);
+
+    *Snapshot = NULL;
+
+    /* Nothing to do for volatile or clean hives */
+    if (RegistryHive->HiveFlags & HIVE_VOLATILE)
+        return TRUE;
+
+    /* Count the dirty blocks first */
+    DirtyCount = 0;
+    BlockIndex = 0;
+    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    {
+        LastIndex = BlockIndex;
+        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
+        if (BlockIndex == ~HV_CLEAN_BLOCK || BlockIndex < LastIndex)
+        {
+            break;
+        }
+
+        DirtyCount++;
+        BlockIndex++;
+    }
+
+    if (DirtyCount == 0)
+        return TRUE;
+
+    HvpValidateBaseHeader(RegistryHive);
+
+    if (RegistryHive->BaseBlock->Sequence1 !=
+        RegistryHive->BaseBlock->Sequence2)
+    {
+        DPRINT1("The sequences DO NOT MATCH (Sequence1 == 0x%x, Sequence2 == 0x%x)\n",
+                RegistryHive->BaseBlock->Sequence1, RegistryHive->BaseBlock->Sequence2);
+        return FALSE;
+    }
+
+    /*
+     * The snapshot is a single allocation holding the descriptor,
+     * the indices of the dirty blocks and the complete log image:
+     * header, dirty block bitmap and a copy of every dirty block.
+     */
+    BitmapSize = ROUND_UP(sizeof(ULONG) + RegistryHive->DirtyVector.SizeOfBitMap, HSECTOR_SIZE);
+    HeaderSize = ROUND_UP(sizeof(HV_HIVE_SNAPSHOT) + DirtyCount * sizeof(ULONG), sizeof(ULONGLONG));
+    ArraySize = HV_LOG_HEADER_SIZE + BitmapSize + DirtyCount * HBLOCK_SIZE;
+
+    NewSnapshot = RegistryHive->Allocate(HeaderSize + ArraySize, TRUE, TAG_CM);
+    if (!NewSnapshot)
+    {
+        DPRINT1("Couldn't allocate a snapshot of %lu dirty blocks\n", DirtyCount);
+        return FALSE;
+    }
+
+    NewSnapshot->DirtyBlocks = (PULONG)(NewSnapshot + 1);
+    NewSnapshot->LogBuffer = (PUCHAR)NewSnapshot + HeaderSize;
+    NewSnapshot->LogBufferSize = ArraySize;
+    NewSnapshot->LogDataOffset = HV_LOG_HEADER_SIZE + BitmapSize;
+    RtlZeroMemory(NewSnapshot->LogBuffer, NewSnapshot->LogDataOffset);
+
+    Bitmap = NewSnapshot->LogBuffer + HV_LOG_HEADER_SIZE;
+    *((PULONG)Bitmap) = HV_LOG_DIRTY_SIGNATURE;
+    Bitmap += sizeof(HV_LOG_DIRTY_SIGNATURE);
+
+    /* Copy the dirty blocks */
+    Index = 0;
+    BlockIndex = 0;
+    while (BlockIndex < RegistryHive->Storage[Stable].Length && Index < DirtyCount)
+    {
+        LastIndex = BlockIndex;
+        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
+        if (BlockIndex == ~HV_CLEAN_BLOCK || BlockIndex < LastIndex)
+        {
+            break;
+        }
+
+        Bitmap[BlockIndex] = HV_LOG_DIRTY_BLOCK;
+        NewSnapshot->DirtyBlocks[Index] = BlockIndex;
+        RtlCopyMemory(NewSnapshot->LogBuffer + NewSnapshot->LogDataOffset + Index * HBLOCK_SIZE,
+                      (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress,
+                      HBLOCK_SIZE);
+
+        Index++;
+        BlockIndex++;
+    }
+    NewSnapshot->DirtyCount = Index;
+    NewSnapshot->LogBufferSize = NewSnapshot->LogDataOffset + Index * HBLOCK_SIZE;
+
+#if !defined(_BLDR_)
+    /* Update hive header modification time */
+    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
+#endif
+
+    RtlCopyMemory(&NewSnapshot->BaseBlock, RegistryHive->BaseBlock, sizeof(HBASE_BLOCK));
+    NewSnapshot->Sequence = RegistryHive->BaseBlock->Sequence1;
+
+    /*
+     * Every file that gets written bumps both sequence numbers by
+     * one, so move the in-memory header to where HvSyncHive would
+     * have left it. Later syncs then continue from there.
+     */
+    Advance = 1;
+    if (RegistryHive->Log) Advance++;
+    if (RegistryHive->Alternate) Advance++;
+
+    RegistryHive->BaseBlock->Type = HFILE_TYPE_PRIMARY;
+    RegistryHive->BaseBlock->Sequence1 += Advance;
+    RegistryHive->BaseBlock->Sequence2 += Advance;
+    RegistryHive->BaseBlock->CheckSum = HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
+    NewSnapshot->AdvancedSequence = RegistryHive->BaseBlock->Sequence1;
+
+    /* The snapshot owns the dirty data now */
+    RtlClearAllBits(&RegistryHive->DirtyVector);
+    RegistryHive->DirtyCount = 0;
+
+    *Snapshot = NewSnapshot;
+    return TRUE;
+}
+
+/**
+ * @brief
+ * Writes a hive snapshot to the log, primary and
+ * alternate hive files. The log is written in one
+ * sequential write and made durable before the primary
+ * hive file is touched.
+ *
+ * @param[in] RegistryHive
+ * A pointer to a hive descriptor the snapshot was
+ * captured from. The caller must prevent any other
+ * flush of the hive, but writers of the hive may
+ * proceed concurrently.
+ *
+ * @param[in] Snapshot
+ * A pointer to the snapshot to be written.
+ *
+ * @return
+ * Returns TRUE if the snapshot has been written,
+ * FALSE otherwise.
+ */
+BOOLEAN
+CMAPI
+HvWriteHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _In_ PHV_HIVE_SNAPSHOT Snapshot)
+{
+    BOOLEAN Success = FALSE;
+    ULONG FileOffset;
+#if !defined(CMLIB_HOST) && !defined(_BLDR_)
+    BOOLEAN HardErrors;
+
+    /* Disable hard errors before syncing the hive */
+    HardErrors = IoSetThreadHardErrorMode(FALSE);
+#endif
+
+    /* Write the log first, header, bitmap and data at once */
+    if (RegistryHive->Log)
+    {
+        Snapshot->BaseBlock.Type = HFILE_TYPE_LOG;
+        Snapshot->BaseBlock.Sequence1++;
+        Snapshot->BaseBlock.CheckSum = HvpHiveHeaderChecksum(&Snapshot->BaseBlock);
+        RtlCopyMemory(Snapshot->LogBuffer, &Snapshot->BaseBlock, HV_LOG_HEADER_SIZE);
+
+        FileOffset = 0;
+        if (!RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG, &FileOffset,
+                                     Snapshot->LogBuffer, Snapshot->LogBufferSize) ||
+            !RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0))
+        {
+            DPRINT1("Failed to write the log (primary sequence)\n");
+            goto Quit;
+        }
+
+        Snapshot->BaseBlock.Sequence2++;
+        Snapshot->BaseBlock.CheckSum = HvpHiveHeaderChecksum(&Snapshot->BaseBlock);
+
+        FileOffset = 0;
+        if (!RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG, &FileOffset,
+                                     &Snapshot->BaseBlock, HV_LOG_HEADER_SIZE) ||
+            !RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0))
+        {
+            DPRINT1("Failed to write the log (secondary sequence)\n");
+            goto Quit;
+        }
+    }
+
+    /* Now reconcile the primary hive file from the snapshot */
+    if (!HvpWriteHiveSnapshot(RegistryHive, Snapshot, HFILE_TYPE_PRIMARY))
+    {
+        DPRINT1("Failed to write the primary hive\n");
+        goto Quit;
+    }
+
+    /* And the alternate one if present */
+    if (RegistryHive->Alternate)
+    {
+        if (!HvpWriteHiveSnapshot(RegistryHive, Snapshot, HFILE_TYPE_ALTERNATE))
+        {
+            DPRINT1("Failed to write the alternate hive\n");
+            goto Quit;
+        }
+    }
+
+    Success = TRUE;
+
+Quit:
+#if !defined(CMLIB_HOST) && !defined(_BLDR_)
+    IoSetThreadHardErrorMode(HardErrors);
+#endif
+    return Success;
+}
+
+/**
+ * @brief
+ * Frees a hive snapshot. If the snapshot could not
+ * be written, its blocks are marked dirty again and,
+ * unless the hive has been synced since, its sequence
+ * numbers are put back to where they were, so that
+ * the next sync of the hive redoes the failed one.
+ *
+ * @param[in] RegistryHive
+ * A pointer to a hive descriptor the snapshot was
+ * captured from. If Written is FALSE, the caller must
+ * hold the flusher lock of the hive exclusively.
+ *
+ * @param[in] Snapshot
+ * A pointer to the snapshot to be released.
+ *
+ * @param[in] Written
+ * Whether the snapshot has been successfully written.
+ */
+VOID
+CMAPI
+HvReleaseHiveSnapshot(
+    _In_ PHHIVE RegistryHive,
+    _In_ PHV_HIVE_SNAPSHOT Snapshot,
+    _In_ BOOLEAN Written)
+{
+    ULONG Index;
+
+    if (!Written)
+    {
+        /* Writers may have dirtied some of these blocks again meanwhile */
+        for (Index = 0; Index < Snapshot->DirtyCount; Index++)
+        {
+            RtlSetBits(&RegistryHive->DirtyVector, Snapshot->DirtyBlocks[Index], 1);
+        }
+        RegistryHive->DirtyCount = RtlNumberOfSetBits(&RegistryHive->DirtyVector);
+
+        /* A later sync that went through must not be undone */
+        if ((RegistryHive->BaseBlock->Sequence1 == Snapshot->AdvancedSequence) &&
+            (RegistryHive->BaseBlock->Sequence2 == Snapshot->AdvancedSequence))
+        {
+            RegistryHive->BaseBlock->Sequence1 = Snapshot->Sequence;
+            RegistryHive->BaseBlock->Sequence2 = Snapshot->Sequence;
+            RegistryHive->BaseBlock->CheckSum = HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
+        }
+    }
+
+    RegistryHive->Free(Snapshot, 0);
+}
+
 /* EOF */
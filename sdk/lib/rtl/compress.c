@@ -216,6 +216,86 @@ out:
 }
 
 
+/* index into the match table for the three bytes at ptr */
+#define LZNT1_HASH(ptr) ((((ptr)[0] << 8) ^ ((ptr)[1] << 4) ^ (ptr)[2]) & 0xFFF)
+
+/* compress a single LZNT1 chunk, returns NULL if it doesn't fit into dst */
+static PUCHAR lznt1_compress_chunk(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size, USHORT *hash)
+{
+    UCHAR *src_cur, *src_end, *dst_cur, *dst_end;
+    ULONG displacement_bits, length_bits;
+    ULONG length, max_length, displacement, pos, i;
+    UCHAR *flags;
+    UCHAR flag_bit;
+    USHORT candidate;
+
+    src_cur = src;
+    src_end = src + src_size;
+    dst_cur = dst;
+    dst_end = dst + dst_size;
+
+    /* the table holds the last position of every three byte sequence seen */
+    memset(hash, 0xFF, 0x1000 * sizeof(USHORT));
+
+    while (src_cur < src_end)
+    {
+        /* each group of 8 entities is preceded by a flags byte */
+        if (dst_cur >= dst_end) return NULL;
+        flags = dst_cur++;
+        *flags = 0;
+
+        for (flag_bit = 0; flag_bit < 8 && src_cur < src_end; flag_bit++)
+        {
+            pos = src_cur - src;
+            length = 0;
+            displacement = 0;
+            length_bits = 0;
+
+            if (src_end - src_cur >= 3)
+            {
+                candidate = hash[LZNT1_HASH(src_cur)];
+                hash[LZNT1_HASH(src_cur)] = (USHORT)pos;
+
+                if (candidate != 0xFFFF)
+                {
+                    /* same split as the decompressor, it depends on the position in the chunk */
+                    for (displacement_bits = 12; displacement_bits > 4; displacement_bits--)
+                        if ((1 << (displacement_bits - 1)) < pos) break;
+                    length_bits = 16 - displacement_bits;
+                    max_length  = min((1 << length_bits) + 2, src_end - src_cur);
+
+                    /* overlapping matches are fine, the decompressor copies bytewise */
+                    displacement = pos - candidate;
+                    while (length < max_length && src_cur[length] == (src_cur - displacement)[length])
+                        length++;
+                }
+            }
+
+            if (length >= 3)
+            {
+                /* backwards reference */
+                if (dst_cur + sizeof(WORD) > dst_end) return NULL;
+                *(WORD *)dst_cur = (WORD)(((displacement - 1) << length_bits) | (length - 3));
+                dst_cur += sizeof(WORD);
+                *flags |= 1 << flag_bit;
+
+                /* remember the positions covered by the reference as well */
+                for (i = 1; i < length && src_end - (src_cur + i) >= 3; i++)
+                    hash[LZNT1_HASH(src_cur + i)] = (USHORT)(pos + i);
+                src_cur += length;
+            }
+            else
+            {
+                /* uncompressed data */
+                if (dst_cur >= dst_end) return NULL;
+                *dst_cur++ = *src_cur++;
+            }
+        }
+    }
+
+    return dst_cur;
+}
+
 static NTSTATUS
 RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
                         ULONG chunk_size, ULONG *final_size, UCHAR *workspace)
@@ -223,11 +303,31 @@ RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
         UCHAR *src_cur = src, *src_end = src + src_size;
         UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
         ULONG block_size;
+        UCHAR *ptr;
 
         while (src_cur < src_end)
         {
             /* determine size of current chunk */
             block_size = min(0x1000, src_end - src_cur);
+            if (dst_cur + sizeof(WORD) > dst_end)
+                return STATUS_BUFFER_TOO_SMALL;
+
+            /* try to compress the chunk, keeping it only if it got smaller */
+            if (workspace)
+            {
+                ptr = lznt1_compress_chunk(src_cur, block_size, dst_cur + sizeof(WORD),
+                                           min(block_size - 1, dst_end - dst_cur - sizeof(WORD)),
+                                           (USHORT *)workspace);
+                if (ptr)
+                {
+                    /* write (compressed) chunk header */
+                    *(WORD *)dst_cur = 0xB000 | (ptr - dst_cur - sizeof(WORD) - 1);
+                    dst_cur = ptr;
+                    src_cur += block_size;
+                    continue;
+                }
+            }
+
             if (dst_cur + sizeof(WORD) + block_size > dst_end)
                 return STATUS_BUFFER_TOO_SMALL;
 
@@ -261,7 +361,8 @@ RtlpWorkSpaceSizeLZNT1(USHORT Engine,
    }
    else if (Engine == COMPRESSION_ENGINE_MAXIMUM)
    {
-      *BufferAndWorkSpaceSize = 0x10;
+      /* Both engines keep the same match table in the workspace */
+      *BufferAndWorkSpaceSize = 0x8010;
       *FragmentWorkSpaceSize = 0x1000;
       return(STATUS_SUCCESS);
    }